@@ -0,0 +1,498 @@
+#include "annot.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "platform.h"
+
+#define WHITE 0xFFFFFFFFu
+
+// 5x7 glyphs for printable ASCII, one byte per row, bit 4 = leftmost
+// column (the label font of render.c, extended).
+#define GLYPH_FIRST 32
+#define GLYPH_LAST 126
+static const unsigned char kGlyphs[GLYPH_LAST - GLYPH_FIRST + 1][7] = {
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, // space
+    {0x04, 0x04, 0x04, 0x04, 0x04, 0x00, 0x04}, // !
+    {0x0A, 0x0A, 0x0A, 0x00, 0x00, 0x00, 0x00}, // "
+    {0x0A, 0x0A, 0x1F, 0x0A, 0x1F, 0x0A, 0x0A}, // #
+    {0x04, 0x0F, 0x14, 0x0E, 0x05, 0x1E, 0x04}, // $
+    {0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03}, // %
+    {0x0C, 0x12, 0x14, 0x08, 0x15, 0x12, 0x0D}, // &
+    {0x0C, 0x04, 0x08, 0x00, 0x00, 0x00, 0x00}, // '
+    {0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02}, // (
+    {0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08}, // )
+    {0x00, 0x04, 0x15, 0x0E, 0x15, 0x04, 0x00}, // *
+    {0x00, 0x04, 0x04, 0x1F, 0x04, 0x04, 0x00}, // +
+    {0x00, 0x00, 0x00, 0x00, 0x0C, 0x04, 0x08}, // ,
+    {0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00}, // -
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C}, // .
+    {0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00}, // /
+    {0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E}, // 0
+    {0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E}, // 1
+    {0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F}, // 2
+    {0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E}, // 3
+    {0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02}, // 4
+    {0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E}, // 5
+    {0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E}, // 6
+    {0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08}, // 7
+    {0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E}, // 8
+    {0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C}, // 9
+    {0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00}, // :
+    {0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x04, 0x08}, // ;
+    {0x02, 0x04, 0x08, 0x10, 0x08, 0x04, 0x02}, // <
+    {0x00, 0x00, 0x1F, 0x00, 0x1F, 0x00, 0x00}, // =
+    {0x08, 0x04, 0x02, 0x01, 0x02, 0x04, 0x08}, // >
+    {0x0E, 0x11, 0x01, 0x02, 0x04, 0x00, 0x04}, // ?
+    {0x0E, 0x11, 0x01, 0x0D, 0x15, 0x15, 0x0E}, // @
+    {0x0E, 0x11, 0x11, 0x11, 0x1F, 0x11, 0x11}, // A
+    {0x1E, 0x11, 0x11, 0x1E, 0x11, 0x11, 0x1E}, // B
+    {0x0E, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0E}, // C
+    {0x1C, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1C}, // D
+    {0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x1F}, // E
+    {0x1F, 0x10, 0x10, 0x1C, 0x10, 0x10, 0x10}, // F
+    {0x0E, 0x11, 0x10, 0x10, 0x13, 0x11, 0x0E}, // G
+    {0x11, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11}, // H
+    {0x0E, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E}, // I
+    {0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0C}, // J
+    {0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11}, // K
+    {0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1F}, // L
+    {0x11, 0x1B, 0x15, 0x11, 0x11, 0x11, 0x11}, // M
+    {0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11}, // N
+    {0x0E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E}, // O
+    {0x1E, 0x11, 0x11, 0x1E, 0x10, 0x10, 0x10}, // P
+    {0x0E, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0D}, // Q
+    {0x1E, 0x11, 0x11, 0x1E, 0x14, 0x12, 0x11}, // R
+    {0x0F, 0x10, 0x10, 0x0E, 0x01, 0x01, 0x1E}, // S
+    {0x1F, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04}, // T
+    {0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E}, // U
+    {0x11, 0x11, 0x11, 0x11, 0x11, 0x0A, 0x04}, // V
+    {0x11, 0x11, 0x11, 0x15, 0x15, 0x1B, 0x11}, // W
+    {0x11, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x11}, // X
+    {0x11, 0x11, 0x0A, 0x04, 0x04, 0x04, 0x04}, // Y
+    {0x1F, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1F}, // Z
+    {0x0E, 0x08, 0x08, 0x08, 0x08, 0x08, 0x0E}, // [
+    {0x00, 0x10, 0x08, 0x04, 0x02, 0x01, 0x00}, // backslash
+    {0x0E, 0x02, 0x02, 0x02, 0x02, 0x02, 0x0E}, // ]
+    {0x04, 0x0A, 0x11, 0x00, 0x00, 0x00, 0x00}, // ^
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1F}, // _
+    {0x08, 0x04, 0x02, 0x00, 0x00, 0x00, 0x00}, // `
+    {0x00, 0x00, 0x0E, 0x01, 0x0F, 0x11, 0x0F}, // a
+    {0x10, 0x10, 0x16, 0x19, 0x11, 0x11, 0x1E}, // b
+    {0x00, 0x00, 0x0E, 0x10, 0x10, 0x11, 0x0E}, // c
+    {0x01, 0x01, 0x0D, 0x13, 0x11, 0x11, 0x0F}, // d
+    {0x00, 0x00, 0x0E, 0x11, 0x1F, 0x10, 0x0E}, // e
+    {0x06, 0x09, 0x08, 0x1C, 0x08, 0x08, 0x08}, // f
+    {0x00, 0x0F, 0x11, 0x11, 0x0F, 0x01, 0x0E}, // g
+    {0x10, 0x10, 0x16, 0x19, 0x11, 0x11, 0x11}, // h
+    {0x04, 0x00, 0x0C, 0x04, 0x04, 0x04, 0x0E}, // i
+    {0x02, 0x00, 0x06, 0x02, 0x02, 0x12, 0x0C}, // j
+    {0x10, 0x10, 0x12, 0x14, 0x18, 0x14, 0x12}, // k
+    {0x0C, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E}, // l
+    {0x00, 0x00, 0x1A, 0x15, 0x15, 0x11, 0x11}, // m
+    {0x00, 0x00, 0x16, 0x19, 0x11, 0x11, 0x11}, // n
+    {0x00, 0x00, 0x0E, 0x11, 0x11, 0x11, 0x0E}, // o
+    {0x00, 0x00, 0x1E, 0x11, 0x1E, 0x10, 0x10}, // p
+    {0x00, 0x00, 0x0D, 0x13, 0x0F, 0x01, 0x01}, // q
+    {0x00, 0x00, 0x16, 0x19, 0x10, 0x10, 0x10}, // r
+    {0x00, 0x00, 0x0E, 0x10, 0x0E, 0x01, 0x1E}, // s
+    {0x08, 0x08, 0x1C, 0x08, 0x08, 0x09, 0x06}, // t
+    {0x00, 0x00, 0x11, 0x11, 0x11, 0x13, 0x0D}, // u
+    {0x00, 0x00, 0x11, 0x11, 0x11, 0x0A, 0x04}, // v
+    {0x00, 0x00, 0x11, 0x11, 0x15, 0x15, 0x0A}, // w
+    {0x00, 0x00, 0x11, 0x0A, 0x04, 0x0A, 0x11}, // x
+    {0x00, 0x00, 0x11, 0x11, 0x0F, 0x01, 0x0E}, // y
+    {0x00, 0x00, 0x1F, 0x02, 0x04, 0x08, 0x1F}, // z
+    {0x02, 0x04, 0x04, 0x08, 0x04, 0x04, 0x02}, // {
+    {0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04}, // |
+    {0x08, 0x04, 0x04, 0x02, 0x04, 0x04, 0x08}, // }
+    {0x00, 0x00, 0x08, 0x15, 0x02, 0x00, 0x00}, // ~
+};
+
+static int Annot_Min(int a, int b) { return a < b ? a : b; }
+static int Annot_Max(int a, int b) { return a > b ? a : b; }
+
+// d moved towards c by a / 256; the result is opaque.
+static uint32_t Annot_Blend(uint32_t d, uint32_t c, unsigned a) {
+  uint32_t rb = d & 0xFF00FFu, g = d & 0x00FF00u;
+  rb = (rb + ((((c & 0xFF00FFu) - rb) * a) >> 8)) & 0xFF00FFu;
+  g = (g + ((((c & 0x00FF00u) - g) * a) >> 8)) & 0x00FF00u;
+  return 0xFF000000u | rb | g;
+}
+
+static void Annot_Fill(IMAGE *dst, int ox, int oy, const IRECT *r,
+                       uint32_t c) {
+  for (int y = r->top; y < r->bottom; y++) {
+    uint32_t *p = (uint32_t *)IMAGE_ROW(dst, y - oy) - ox;
+    for (int x = r->left; x < r->right; x++)
+      p[x] = c;
+  }
+}
+
+static void Annot_FillClip(IMAGE *dst, int ox, int oy, const IRECT *clip,
+                           IRECT r, uint32_t c) {
+  if (IRect_Intersect(&r, clip, &r))
+    Annot_Fill(dst, ox, oy, &r, c);
+}
+
+static IRECT Annot_Rect(const ANNOTATION *a) {
+  IRECT r = {a->x0, a->y0, a->x1, a->y1};
+  IRect_Normalize(&r);
+  return r;
+}
+
+static IRECT Annot_TextBox(const ANNOTATION *a) {
+  int w = a->len ? a->len * 6 * ANNOT_TEXT_SCALE - ANNOT_TEXT_SCALE
+                 : ANNOT_TEXT_SCALE; // a caret while empty
+  return (IRECT){a->x0, a->y0, a->x0 + w + 2 * ANNOT_TEXT_PAD,
+                 a->y0 + 7 * ANNOT_TEXT_SCALE + 2 * ANNOT_TEXT_PAD};
+}
+
+IRECT Annot_Bounds(const ANNOTATION *a) {
+  IRECT r = {0, 0, 0, 0};
+  switch (a->kind) {
+  case ANNOT_ARROW:
+    if (a->x0 != a->x1 || a->y0 != a->y1) {
+      int m = Annot_Max(ANNOT_STROKE, ANNOT_HEAD) + 2;
+      r = Annot_Rect(a);
+      r = (IRECT){r.left - m, r.top - m, r.right + m, r.bottom + m};
+    }
+    break;
+  case ANNOT_BOX:
+  case ANNOT_MARK:
+    r = Annot_Rect(a);
+    if (IRect_IsEmpty(&r))
+      r = (IRECT){0, 0, 0, 0};
+    break;
+  case ANNOT_TEXT:
+    r = Annot_TextBox(a);
+    break;
+  }
+  return r;
+}
+
+// Antialiased arrow: a round-ended shaft and a triangular head. Coverage
+// is the distance to the shape's edge, in pixels, clamped to [0, 1].
+static void Annot_PaintArrow(const ANNOTATION *a, IMAGE *dst, int ox, int oy,
+                             const IRECT *r) {
+  float tx = a->x0 + 0.5f, ty = a->y0 + 0.5f;
+  float hx = a->x1 + 0.5f, hy = a->y1 + 0.5f;
+  float vx = hx - tx, vy = hy - ty, len = sqrtf(vx * vx + vy * vy);
+  if (len < 1)
+    return;
+  float ux = vx / len, uy = vy / len;
+  float hl = len < ANNOT_HEAD ? len : (float)ANNOT_HEAD, hw = hl * 0.5f;
+  float shaft = len - hl * 0.5f, half = ANNOT_STROKE * 0.5f;
+  float side = sqrtf(hw * hw + hl * hl);
+  for (int y = r->top; y < r->bottom; y++) {
+    uint32_t *p = (uint32_t *)IMAGE_ROW(dst, y - oy) - ox;
+    for (int x = r->left; x < r->right; x++) {
+      float px = x + 0.5f - tx, py = y + 0.5f - ty;
+      float along = px * ux + py * uy, across = fabsf(py * ux - px * uy);
+      float t = along < 0 ? 0 : along > shaft ? shaft : along;
+      float dx = px - ux * t, dy = py - uy * t;
+      float cov = half + 0.5f - sqrtf(dx * dx + dy * dy);
+      // head: in front of its base and between its sides, which meet at
+      // the apex
+      float back = len - along, s = (hw * back - hl * across) / side;
+      float e = hl - back < s ? hl - back : s;
+      cov = cov > e + 0.5f ? cov : e + 0.5f;
+      if (cov >= 1)
+        p[x] = a->color;
+      else if (cov > 0)
+        p[x] = Annot_Blend(p[x], a->color, (unsigned)(cov * 256));
+    }
+  }
+}
+
+static void Annot_PaintText(const ANNOTATION *a, IMAGE *dst, int ox, int oy,
+                            const IRECT *r) {
+  Annot_Fill(dst, ox, oy, r, a->color);
+  const int s = ANNOT_TEXT_SCALE;
+  int x0 = a->x0 + ANNOT_TEXT_PAD, y0 = a->y0 + ANNOT_TEXT_PAD;
+  int first = Annot_Max(0, (r->left - x0) / (6 * s));
+  int last = Annot_Min(a->len, (r->right - x0) / (6 * s) + 1);
+  for (int i = first; i < last; i++) {
+    unsigned char ch = (unsigned char)a->text[i];
+    const unsigned char *g =
+        kGlyphs[ch >= GLYPH_FIRST && ch <= GLYPH_LAST ? ch - GLYPH_FIRST
+                                                      : '?' - GLYPH_FIRST];
+    for (int row = 0; row < 7; row++)
+      for (int col = 0; col < 5; col++)
+        if (g[row] & (0x10 >> col)) {
+          int gx = x0 + i * 6 * s + col * s, gy = y0 + row * s;
+          Annot_FillClip(dst, ox, oy, r, (IRECT){gx, gy, gx + s, gy + s},
+                         WHITE);
+        }
+  }
+}
+
+// Draws a (whose bounds are b) over dst, only inside clip.
+static void Annot_Paint(const ANNOTATION *a, const IRECT *b, IMAGE *dst,
+                        int ox, int oy, const IRECT *clip) {
+  IRECT r;
+  if (IRect_IsEmpty(b) || !IRect_Intersect(b, clip, &r))
+    return;
+  switch (a->kind) {
+  case ANNOT_ARROW:
+    Annot_PaintArrow(a, dst, ox, oy, &r);
+    break;
+  case ANNOT_BOX: {
+    const IRECT *o = b;
+    int w = Annot_Min(ANNOT_STROKE, (o->right - o->left + 1) / 2);
+    int h = Annot_Min(ANNOT_STROKE, (o->bottom - o->top + 1) / 2);
+    IRECT sides[4] = {{o->left, o->top, o->right, o->top + h},
+                      {o->left, o->bottom - h, o->right, o->bottom},
+                      {o->left, o->top + h, o->left + w, o->bottom - h},
+                      {o->right - w, o->top + h, o->right, o->bottom - h}};
+    for (int i = 0; i < 4; i++)
+      Annot_FillClip(dst, ox, oy, &r, sides[i], a->color);
+    break;
+  }
+  case ANNOT_MARK:
+    // multiplied, like a highlighter: dark text stays dark
+    for (int y = r.top; y < r.bottom; y++) {
+      unsigned char *p = IMAGE_ROW(dst, y - oy) + (size_t)(r.left - ox) * 4;
+      for (int x = r.left; x < r.right; x++, p += 4)
+        for (int k = 0; k < 3; k++)
+          p[k] = (unsigned char)(p[k] * (((a->color >> (8 * k)) & 0xFF) + 1)
+                                 >> 8);
+    }
+    break;
+  case ANNOT_TEXT:
+    Annot_PaintText(a, dst, ox, oy, &r);
+    break;
+  }
+}
+
+// --- Tile grid ---
+
+static int Annot_Grow(void **p, int *cap, int need, size_t size) {
+  if (*cap >= need)
+    return 1;
+  int n = *cap ? *cap * 2 : 16;
+  while (n < need)
+    n *= 2;
+  void *q = realloc(*p, (size_t)n * size);
+  if (!q)
+    return 0;
+  *p = q;
+  *cap = n;
+  return 1;
+}
+
+// Tiles under r (inclusive), or 0 when r is empty.
+static int Annot_TileRange(const ANNOT_LAYER *l, const IRECT *r, int *x0,
+                           int *y0, int *x1, int *y1) {
+  if (IRect_IsEmpty(r) || !l->tile)
+    return 0;
+  *x0 = Annot_Max(r->left, 0) / ANNOT_TILE;
+  *y0 = Annot_Max(r->top, 0) / ANNOT_TILE;
+  *x1 = Annot_Min(r->right - 1, l->w - 1) / ANNOT_TILE;
+  *y1 = Annot_Min(r->bottom - 1, l->h - 1) / ANNOT_TILE;
+  return *x0 <= *x1 && *y0 <= *y1;
+}
+
+static void Annot_MarkDirty(ANNOT_LAYER *l, const IRECT *r) {
+  int x0, y0, x1, y1;
+  if (!Annot_TileRange(l, r, &x0, &y0, &x1, &y1))
+    return;
+  for (int ty = y0; ty <= y1; ty++)
+    for (int tx = x0; tx <= x1; tx++) {
+      int t = ty * l->cols + tx;
+      l->dirty[t >> 6] |= 1ull << (t & 63);
+    }
+}
+
+// Adds i to tile t's list, keeping it in drawing order.
+static int Annot_TileAdd(ANNOT_TILE_CACHE *c, int i) {
+  if (!Annot_Grow((void **)&c->idx, &c->cap, c->n + 1, sizeof(int)))
+    return 0;
+  int k = c->n;
+  while (k > 0 && c->idx[k - 1] > i) {
+    c->idx[k] = c->idx[k - 1];
+    k--;
+  }
+  c->idx[k] = i;
+  c->n++;
+  return 1;
+}
+
+static void Annot_TileRemove(ANNOT_LAYER *l, ANNOT_TILE_CACHE *c, int i) {
+  int k = c->n;
+  while (k > 0 && c->idx[k - 1] != i) // usually the last one
+    k--;
+  if (!k)
+    return;
+  memmove(&c->idx[k - 1], &c->idx[k], (size_t)(c->n - k) * sizeof(int));
+  if (--c->n == 0 && c->px) {
+    free(c->px);
+    c->px = NULL;
+    l->stats.cacheBytes -= ANNOT_TILE * ANNOT_TILE * 4;
+  }
+}
+
+static int Annot_InRange(int tx, int ty, int ok, int x0, int y0, int x1,
+                         int y1) {
+  return ok && tx >= x0 && tx <= x1 && ty >= y0 && ty <= y1;
+}
+
+// Moves item i from the tiles under old to those under now.
+static int Annot_Retile(ANNOT_LAYER *l, int i, const IRECT *old,
+                        const IRECT *now) {
+  int ox0 = 0, oy0 = 0, ox1 = -1, oy1 = -1, nx0 = 0, ny0 = 0, nx1 = -1,
+      ny1 = -1;
+  int hadOld = Annot_TileRange(l, old, &ox0, &oy0, &ox1, &oy1);
+  int hasNew = Annot_TileRange(l, now, &nx0, &ny0, &nx1, &ny1);
+  for (int ty = oy0; hadOld && ty <= oy1; ty++)
+    for (int tx = ox0; tx <= ox1; tx++)
+      if (!Annot_InRange(tx, ty, hasNew, nx0, ny0, nx1, ny1))
+        Annot_TileRemove(l, &l->tile[ty * l->cols + tx], i);
+  int ok = 1;
+  for (int ty = ny0; hasNew && ty <= ny1; ty++)
+    for (int tx = nx0; tx <= nx1; tx++)
+      if (!Annot_InRange(tx, ty, hadOld, ox0, oy0, ox1, oy1))
+        ok &= Annot_TileAdd(&l->tile[ty * l->cols + tx], i);
+  Annot_MarkDirty(l, old);
+  Annot_MarkDirty(l, now);
+  return ok;
+}
+
+// --- Layer ---
+
+int Annot_Add(ANNOT_LAYER *l, const FRAMEBUFFER *fb, const ANNOTATION *a) {
+  if (!l->tile) {
+    l->w = fb->w;
+    l->h = fb->h;
+    l->cols = (fb->w + ANNOT_TILE - 1) / ANNOT_TILE;
+    l->rows = (fb->h + ANNOT_TILE - 1) / ANNOT_TILE;
+    size_t n = (size_t)l->cols * l->rows;
+    l->tile = (ANNOT_TILE_CACHE *)calloc(n ? n : 1, sizeof(ANNOT_TILE_CACHE));
+    l->dirty = (uint64_t *)calloc(n / 64 + 1, sizeof(uint64_t));
+    if (!l->tile || !l->dirty) {
+      Annot_Clear(l);
+      return -1;
+    }
+  }
+  int cap = l->cap;
+  if (!Annot_Grow((void **)&l->item, &cap, l->n + 1, sizeof(ANNOTATION)))
+    return -1;
+  cap = l->cap;
+  if (!Annot_Grow((void **)&l->bounds, &cap, l->n + 1, sizeof(IRECT)))
+    return -1;
+  l->cap = cap;
+  int i = l->n++;
+  l->bounds[i] = (IRECT){0, 0, 0, 0};
+  Annot_Set(l, i, a);
+  return i;
+}
+
+int Annot_Set(ANNOT_LAYER *l, int i, const ANNOTATION *a) {
+  IRECT frame = {0, 0, l->w, l->h}, now = Annot_Bounds(a);
+  if (!IRect_Intersect(&now, &frame, &now))
+    now = (IRECT){0, 0, 0, 0};
+  l->item[i] = *a;
+  l->item[i].len = Annot_Min(Annot_Max(a->len, 0), ANNOT_TEXT_MAX);
+  l->item[i].text[l->item[i].len] = 0;
+  IRECT old = l->bounds[i];
+  l->bounds[i] = now;
+  l->stats.edits++;
+  return Annot_Retile(l, i, &old, &now);
+}
+
+void Annot_Pop(ANNOT_LAYER *l) {
+  if (!l->n)
+    return;
+  IRECT none = {0, 0, 0, 0};
+  Annot_Retile(l, l->n - 1, &l->bounds[l->n - 1], &none);
+  l->n--;
+}
+
+void Annot_Clear(ANNOT_LAYER *l) {
+  if (l->tile)
+    for (int t = 0; t < l->cols * l->rows; t++) {
+      free(l->tile[t].idx);
+      free(l->tile[t].px);
+    }
+  free(l->tile);
+  free(l->dirty);
+  free(l->item);
+  free(l->bounds);
+  memset(l, 0, sizeof(*l));
+}
+
+void Annot_Invalidate(ANNOT_LAYER *l, const IRECT *r) {
+  Annot_MarkDirty(l, r);
+}
+
+// Composites tile t (frame rect tr) into its cache: the frame, redacted,
+// then the annotations that reach into it.
+static int Annot_DrawTile(ANNOT_LAYER *l, int t, const IRECT *tr,
+                          const FRAMEBUFFER *fb,
+                          const REDACT_LAYER *redact) {
+  ANNOT_TILE_CACHE *c = &l->tile[t];
+  if (!c->px) {
+    if (!(c->px = (uint32_t *)malloc(ANNOT_TILE * ANNOT_TILE * 4)))
+      return 0;
+    l->stats.cacheBytes += ANNOT_TILE * ANNOT_TILE * 4;
+  }
+  IMAGE img = {(unsigned char *)c->px, tr->right - tr->left,
+               tr->bottom - tr->top, ANNOT_TILE * 4};
+  Framebuffer_Read(fb, 0, tr, &img, -tr->left, -tr->top);
+  if (redact)
+    Redact_Apply(redact, &img, tr->left, tr->top, tr);
+  for (int k = 0; k < c->n; k++)
+    Annot_Paint(&l->item[c->idx[k]], &l->bounds[c->idx[k]], &img, tr->left,
+                tr->top, tr);
+  l->dirty[t >> 6] &= ~(1ull << (t & 63));
+  l->stats.tilesDrawn++;
+  return 1;
+}
+
+void Annot_Draw(ANNOT_LAYER *l, const FRAMEBUFFER *fb,
+                const REDACT_LAYER *redact, IMAGE *dst, const IRECT *clip) {
+  IRECT full = {0, 0, dst->w, dst->h}, r;
+  int x0, y0, x1, y1;
+  if (!l->n || !IRect_Intersect(clip, &full, &r) ||
+      !Annot_TileRange(l, &r, &x0, &y0, &x1, &y1))
+    return;
+  long long t0 = Clock_Ns();
+  for (int ty = y0; ty <= y1; ty++)
+    for (int tx = x0; tx <= x1; tx++) {
+      int t = ty * l->cols + tx;
+      if (!l->tile[t].n)
+        continue;
+      IRECT tr = {tx * ANNOT_TILE, ty * ANNOT_TILE,
+                  Annot_Min((tx + 1) * ANNOT_TILE, l->w),
+                  Annot_Min((ty + 1) * ANNOT_TILE, l->h)},
+            c;
+      if (((l->dirty[t >> 6] >> (t & 63)) & 1 || !l->tile[t].px) &&
+          !Annot_DrawTile(l, t, &tr, fb, redact))
+        continue;
+      if (!IRect_Intersect(&tr, &r, &c))
+        continue;
+      size_t bytes = (size_t)(c.right - c.left) * 4;
+      for (int y = c.top; y < c.bottom; y++)
+        memcpy(IMAGE_ROW(dst, y) + (size_t)c.left * 4,
+               l->tile[t].px + (size_t)(y - tr.top) * ANNOT_TILE +
+                   (c.left - tr.left),
+               bytes);
+    }
+  l->stats.drawNs += Clock_Ns() - t0;
+}
+
+void Annot_Flatten(const ANNOT_LAYER *l, IMAGE *dst, int ox, int oy,
+                   const IRECT *clip) {
+  IRECT target = {ox, oy, ox + dst->w, oy + dst->h}, c;
+  if (!IRect_Intersect(clip, &target, &c))
+    return;
+  for (int i = 0; i < l->n; i++)
+    Annot_Paint(&l->item[i], &l->bounds[i], dst, ox, oy, &c);
+}
+
+const char *Annot_KindName(int kind) {
+  static const char *names[ANNOT_KINDS] = {"arrow", "box", "highlighter",
+                                           "text"};
+  return kind >= 0 && kind < ANNOT_KINDS ? names[kind] : "off";
+}
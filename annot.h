@@ -0,0 +1,91 @@
+#ifndef SCREENSHOT_ANNOT_H
+#define SCREENSHOT_ANNOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "framebuffer.h"
+#include "image.h"
+#include "redact.h"
+
+// Annotations over a capture: arrows, boxes, highlighter marks and text
+// labels, kept as a list (frame coordinates) and drawn over the redacted
+// frame inside the selection.
+//
+// The overlay draws them through a cache of composited ANNOT_TILE squares:
+// only tiles that something touches are kept, and an edit marks just the
+// tiles under the old and new bounds of what changed. Each tile also lists
+// the annotations that reach into it, so redrawing one costs its own area
+// and those annotations, whatever the total. Exports skip the cache and
+// draw every annotation once over the crop.
+
+#define ANNOT_TILE 64
+#define ANNOT_STROKE 4      // arrow and box line width
+#define ANNOT_HEAD 18       // arrowhead length
+#define ANNOT_TEXT_MAX 120
+#define ANNOT_TEXT_SCALE 3  // text glyphs are 5x7 cells of this side
+#define ANNOT_TEXT_PAD 4
+#define ANNOT_COLOR 0xFFE0301Eu     // BGRA red
+#define ANNOT_HIGHLIGHT 0xFFFFE14Du // multiplied in: yellow highlighter
+
+enum { ANNOT_ARROW, ANNOT_BOX, ANNOT_MARK, ANNOT_TEXT, ANNOT_KINDS };
+
+typedef struct {
+  int kind;
+  int x0, y0, x1, y1; // arrow tail and head, or two corners; text at (x0, y0)
+  uint32_t color;
+  int len;
+  char text[ANNOT_TEXT_MAX + 1];
+} ANNOTATION;
+
+typedef struct {
+  int *idx; // annotations reaching into the tile, in drawing order
+  int n, cap;
+  uint32_t *px; // composited ANNOT_TILE square, NULL until first drawn
+} ANNOT_TILE_CACHE;
+
+typedef struct {
+  unsigned long long edits, tilesDrawn;
+  long long drawNs; // tile rasterization, all of it
+  size_t cacheBytes;
+} ANNOT_STATS;
+
+typedef struct {
+  ANNOTATION *item;
+  IRECT *bounds; // per item: the pixels it can touch
+  int n, cap;
+  int w, h, cols, rows; // frame size and tile grid, set by the first add
+  ANNOT_TILE_CACHE *tile;
+  uint64_t *dirty; // one bit per tile: its pixels must be drawn again
+  ANNOT_STATS stats;
+} ANNOT_LAYER;
+
+// Pixels annotation a can touch (empty for a zero-length arrow or box).
+IRECT Annot_Bounds(const ANNOTATION *a);
+
+// Appends a to a layer over fb's frame; returns its index, or -1 if out of
+// memory.
+int Annot_Add(ANNOT_LAYER *l, const FRAMEBUFFER *fb, const ANNOTATION *a);
+// Replaces annotation i. Returns 0 if out of memory (i is then dropped from
+// the tiles it moved into).
+int Annot_Set(ANNOT_LAYER *l, int i, const ANNOTATION *a);
+// Drops the last annotation.
+void Annot_Pop(ANNOT_LAYER *l);
+// Drops every annotation and the cache.
+void Annot_Clear(ANNOT_LAYER *l);
+// The frame under r changed (a redaction region moved, say): cached tiles
+// there are drawn again.
+void Annot_Invalidate(ANNOT_LAYER *l, const IRECT *r);
+
+// Overlay path: copies the composited tiles over dst (frame coordinates)
+// inside clip, drawing dirty ones first from fb with redaction applied.
+// Tiles without annotations are left alone.
+void Annot_Draw(ANNOT_LAYER *l, const FRAMEBUFFER *fb,
+                const REDACT_LAYER *redact, IMAGE *dst, const IRECT *clip);
+// Export path: draws every annotation over dst, where frame point (x, y) is
+// dst pixel (x - ox, y - oy), only inside clip (frame coordinates).
+void Annot_Flatten(const ANNOT_LAYER *l, IMAGE *dst, int ox, int oy,
+                   const IRECT *clip);
+const char *Annot_KindName(int kind);
+
+#endif
@@ -0,0 +1,376 @@
+#include "batch.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "platform.h"
+
+#define MANIFEST_LINE 8192
+
+static const char *const kFormatNames[] = {"png", "qoi", "raw"};
+
+static int Batch_Fail(char *err, size_t n, const char *what, const char *arg) {
+  if (arg)
+    snprintf(err, n, "%s: %s", what, arg);
+  else
+    snprintf(err, n, "%s", what);
+  return 0;
+}
+
+static char *Batch_Strdup(const char *s) {
+  size_t n = strlen(s) + 1;
+  char *p = (char *)malloc(n);
+  if (p)
+    memcpy(p, s, n);
+  return p;
+}
+
+static int Batch_Add(BATCH *b, IRECT r, const char *path) {
+  if (b->count == b->cap) {
+    int cap = b->cap ? b->cap * 2 : 16;
+    BATCH_REGION *p = (BATCH_REGION *)realloc(b->regions, cap * sizeof(*p));
+    if (!p)
+      return 0;
+    b->regions = p;
+    b->cap = cap;
+  }
+  BATCH_REGION *g = &b->regions[b->count];
+  memset(g, 0, sizeof(*g));
+  g->rect = r;
+  if (path && !(g->path = Batch_Strdup(path)))
+    return 0;
+  b->count++;
+  return 1;
+}
+
+// "x,y,w,h" with a positive size; *end is left after the last number.
+static int Batch_ParseRect(const char *s, IRECT *r, const char **end) {
+  long v[4];
+  for (int i = 0; i < 4; i++) {
+    char *e;
+    v[i] = strtol(s, &e, 10);
+    if (e == s || (i < 3 && *e != ','))
+      return 0;
+    s = e + (i < 3);
+  }
+  if (v[2] <= 0 || v[3] <= 0 || v[2] > 1 << 20 || v[3] > 1 << 20 ||
+      labs(v[0]) > 1 << 20 || labs(v[1]) > 1 << 20)
+    return 0;
+  r->left = (int)v[0];
+  r->top = (int)v[1];
+  r->right = (int)(v[0] + v[2]);
+  r->bottom = (int)(v[1] + v[3]);
+  if (end)
+    *end = s;
+  return 1;
+}
+
+static int Batch_ReadManifest(BATCH *b, const char *name, char *err,
+                              size_t n) {
+  FILE *f = strcmp(name, "-") ? fopen(name, "r") : stdin;
+  if (!f)
+    return Batch_Fail(err, n, "cannot read manifest", name);
+  char line[MANIFEST_LINE];
+  int ok = 1;
+  for (int no = 1; ok && fgets(line, sizeof(line), f); no++) {
+    size_t len = strlen(line);
+    while (len && (line[len - 1] == '\n' || line[len - 1] == '\r' ||
+                   line[len - 1] == ' ' || line[len - 1] == '\t'))
+      line[--len] = 0;
+    const char *s = line;
+    while (*s == ' ' || *s == '\t')
+      s++;
+    if (!*s || *s == '#')
+      continue;
+    IRECT r;
+    const char *rest;
+    if (!Batch_ParseRect(s, &r, &rest) ||
+        (*rest && *rest != ' ' && *rest != '\t')) {
+      char where[64];
+      snprintf(where, sizeof(where), "%s line %d", name, no);
+      ok = Batch_Fail(err, n, "bad manifest entry", where);
+      break;
+    }
+    while (*rest == ' ' || *rest == '\t')
+      rest++;
+    ok = Batch_Add(b, r, *rest ? rest : NULL) ||
+         Batch_Fail(err, n, "out of memory", NULL);
+  }
+  if (f != stdin)
+    fclose(f);
+  return ok;
+}
+
+// The pattern with its placeholders filled in for region i.
+static char *Batch_Expand(const BATCH *b, int i) {
+  const IRECT *r = &b->regions[i].rect;
+  size_t cap = strlen(b->pattern) + 64, len = 0;
+  char *out = (char *)malloc(cap);
+  for (const char *s = b->pattern; out && *s; s++) {
+    char num[32];
+    const char *sub = NULL;
+    size_t skip = 0;
+    if (*s == '{') {
+      const char *close = strchr(s, '}');
+      size_t k = close ? (size_t)(close - s) + 1 : 0;
+      if (k == 3 && strchr("nxywh", s[1])) {
+        int v = s[1] == 'n'   ? i + 1
+                : s[1] == 'x' ? r->left
+                : s[1] == 'y' ? r->top
+                : s[1] == 'w' ? r->right - r->left
+                              : r->bottom - r->top;
+        snprintf(num, sizeof(num), "%d", v);
+        sub = num;
+      } else if (k == 5 && !strncmp(s, "{ext}", 5)) {
+        sub = Export_Extension(b->format);
+      }
+      skip = sub ? k - 1 : 0;
+    }
+    size_t add = sub ? strlen(sub) : 1;
+    if (len + add + 1 > cap) {
+      cap = (len + add + 1) * 2;
+      char *p = (char *)realloc(out, cap);
+      if (!p)
+        free(out);
+      out = p;
+      if (!out)
+        break;
+    }
+    memcpy(out + len, sub ? sub : s, add);
+    len += add;
+    s += skip;
+  }
+  if (out)
+    out[len] = 0;
+  return out;
+}
+
+// True if the pattern gives every region its own name.
+static int Batch_PatternVaries(const char *p) {
+  return strstr(p, "{n}") || (strstr(p, "{x}") && strstr(p, "{y}"));
+}
+
+int Batch_Parse(BATCH *b, int argc, char **argv, char *err, size_t n) {
+  memset(b, 0, sizeof(*b));
+  for (int i = 0; i < argc; i++) {
+    const char *a = argv[i];
+    const char *v = i + 1 < argc ? argv[i + 1] : NULL;
+    if (!strcmp(a, "--region") || !strcmp(a, "--manifest") ||
+        !strcmp(a, "--out") || !strcmp(a, "--format") ||
+        !strcmp(a, "--report")) {
+      if (!v)
+        return Batch_Fail(err, n, "missing value for", a);
+      i++;
+    } else {
+      return Batch_Fail(err, n, "unknown option", a);
+    }
+    IRECT r;
+    if (!strcmp(a, "--region")) {
+      const char *end;
+      if (!Batch_ParseRect(v, &r, &end) || *end)
+        return Batch_Fail(err, n, "bad region (want x,y,w,h)", v);
+      if (!Batch_Add(b, r, NULL))
+        return Batch_Fail(err, n, "out of memory", NULL);
+    } else if (!strcmp(a, "--manifest")) {
+      if (!Batch_ReadManifest(b, v, err, n))
+        return 0;
+    } else if (!strcmp(a, "--out")) {
+      b->pattern = v;
+    } else if (!strcmp(a, "--format")) {
+      if (!Export_ParseFormat(v, &b->format))
+        return Batch_Fail(err, n, "unknown format", v);
+      b->formatSet = 1;
+    } else {
+      b->report = v;
+    }
+  }
+  if (!b->count)
+    return Batch_Fail(err, n, "no regions (use --region or --manifest)", NULL);
+
+  if (!b->formatSet) {
+    const char *dot = b->pattern ? strrchr(b->pattern, '.') : NULL;
+    if (!dot || strpbrk(dot, "/\\") || !Export_ParseFormat(dot + 1, &b->format))
+      b->format = Export_Format();
+  }
+
+  int unnamed = 0;
+  for (int i = 0; i < b->count; i++)
+    unnamed += !b->regions[i].path;
+  if (unnamed && !b->pattern)
+    return Batch_Fail(err, n, "--out is required for regions without a path",
+                      NULL);
+  if (unnamed > 1 && !Batch_PatternVaries(b->pattern))
+    return Batch_Fail(err, n, "--out must contain {n} (or {x} and {y})",
+                      b->pattern);
+  for (int i = 0; i < b->count; i++) {
+    BATCH_REGION *g = &b->regions[i];
+    if (!g->path && !(g->path = Batch_Expand(b, i)))
+      return Batch_Fail(err, n, "out of memory", NULL);
+  }
+  return 1;
+}
+
+static FILE *Batch_Open(const char *path) {
+#ifdef _WIN32
+  // Arguments arrive as UTF-8; the C runtime would read them as ANSI.
+  wchar_t wide[4096];
+  if (!MultiByteToWideChar(CP_UTF8, 0, path, -1, wide, 4096))
+    return NULL;
+  return _wfopen(wide, L"wb");
+#else
+  return fopen(path, "wb");
+#endif
+}
+
+static void Batch_Remove(const char *path) {
+#ifdef _WIN32
+  wchar_t wide[4096];
+  if (MultiByteToWideChar(CP_UTF8, 0, path, -1, wide, 4096))
+    _wremove(wide);
+#else
+  remove(path);
+#endif
+}
+
+typedef struct {
+  BATCH *b;
+  const FRAMEBUFFER *fb;
+} BATCH_JOB;
+
+// A region inside one tile is encoded straight from the capture; only ones
+// spanning monitors (or gaps) are copied out first.
+static void Batch_EncodeOne(BATCH *b, const FRAMEBUFFER *fb, int i) {
+  BATCH_REGION *g = &b->regions[i];
+  long long t0 = Clock_Ns();
+  IRECT want = {g->rect.left - fb->virt.left, g->rect.top - fb->virt.top,
+                g->rect.right - fb->virt.left, g->rect.bottom - fb->virt.top};
+  IRECT bounds = {0, 0, fb->w, fb->h}, r;
+  if (!IRect_Intersect(&want, &bounds, &r)) {
+    g->error = "outside the desktop";
+    return;
+  }
+  IMAGE img, crop = {0};
+  if (!Framebuffer_View(fb, &r, &img)) {
+    if (!Framebuffer_Crop(fb, &r, &crop)) {
+      g->error = "out of memory";
+      return;
+    }
+    img = crop;
+    g->copied = 1;
+  }
+  g->w = img.w;
+  g->h = img.h;
+
+  FILE *f = Batch_Open(g->path);
+  if (!f) {
+    g->error = "cannot open output";
+  } else {
+    g->ok = Export_Write(f, &img, b->format, &g->stats);
+    g->ok = (fclose(f) == 0) && g->ok;
+    if (!g->ok) {
+      g->error = "write failed";
+      Batch_Remove(g->path);
+    }
+  }
+  Image_Free(&crop);
+  g->ns = Clock_Ns() - t0;
+}
+
+static void Batch_EncodeRange(void *ctx, int begin, int end) {
+  BATCH_JOB *job = (BATCH_JOB *)ctx;
+  for (int i = begin; i < end; i++)
+    Batch_EncodeOne(job->b, job->fb, i);
+}
+
+// The PNG encoder already spreads one image over every core, but Par_For
+// runs nested calls inline, so a handful of PNGs go one after another with
+// full-width encodes; with as many regions as cores (or the single-threaded
+// QOI/raw writers) the regions themselves are spread instead.
+int Batch_Run(BATCH *b, const FRAMEBUFFER *fb) {
+  long long t0 = Clock_Ns();
+  BATCH_JOB job = {b, fb};
+  b->parallel =
+      b->count > 1 && (b->format != EXPORT_PNG || b->count >= Cpu_Count());
+  if (b->parallel)
+    Par_For(b->count, 1, Batch_EncodeRange, &job);
+  else
+    Batch_EncodeRange(&job, 0, b->count);
+  b->encodeNs = Clock_Ns() - t0;
+  int ok = 0;
+  for (int i = 0; i < b->count; i++)
+    ok += b->regions[i].ok;
+  return ok;
+}
+
+void Json_String(FILE *f, const char *s) {
+  if (!s) {
+    fputs("null", f);
+    return;
+  }
+  fputc('"', f);
+  for (; *s; s++) {
+    unsigned char c = (unsigned char)*s;
+    if (c == '"' || c == '\\')
+      fprintf(f, "\\%c", c);
+    else if (c < 0x20)
+      fprintf(f, "\\u%04x", c);
+    else
+      fputc(c, f);
+  }
+  fputc('"', f);
+}
+
+int Batch_Report(const BATCH *b, const FRAMEBUFFER *fb, const char *error) {
+  FILE *f = b->report ? Batch_Open(b->report) : stdout;
+  if (!f)
+    return 0;
+  int done = 0;
+  for (int i = 0; i < b->count; i++)
+    done += b->regions[i].ok;
+  fprintf(f, "{\n  \"ok\": %s,\n  \"error\": ",
+          !error && done == b->count ? "true" : "false");
+  Json_String(f, error);
+  if (fb)
+    fprintf(f,
+            ",\n  \"desktop\": {\"x\": %d, \"y\": %d, \"w\": %d, \"h\": %d, "
+            "\"monitors\": %d}",
+            fb->virt.left, fb->virt.top, fb->w, fb->h, fb->ntiles);
+  fprintf(f,
+          ",\n  \"format\": \"%s\",\n  \"threads\": %d,\n"
+          "  \"parallel_regions\": %s,\n  \"grab_ms\": %.3f,\n"
+          "  \"encode_ms\": %.3f,\n  \"peak_rss_mb\": %.1f,\n"
+          "  \"succeeded\": %d,\n  \"regions\": [",
+          kFormatNames[b->format], Cpu_Count(), b->parallel ? "true" : "false",
+          b->grabNs / 1e6, b->encodeNs / 1e6, Mem_PeakRss() / 1e6, done);
+  for (int i = 0; i < b->count; i++) {
+    const BATCH_REGION *g = &b->regions[i];
+    const IRECT *r = &g->rect;
+    fprintf(f,
+            "%s\n    {\"n\": %d, \"x\": %d, \"y\": %d, \"w\": %d, \"h\": %d, "
+            "\"path\": ",
+            i ? "," : "", i + 1, r->left, r->top, r->right - r->left,
+            r->bottom - r->top);
+    Json_String(f, g->path);
+    fprintf(f, ", \"ok\": %s, \"error\": ", g->ok ? "true" : "false");
+    Json_String(f, g->error);
+    fprintf(f,
+            ", \"width\": %d, \"height\": %d, \"bytes\": %llu, "
+            "\"copied\": %s, \"encode_ms\": %.3f, \"ms\": %.3f}",
+            g->w, g->h, g->stats.fileBytes, g->copied ? "true" : "false",
+            g->stats.ns / 1e6, g->ns / 1e6);
+  }
+  fprintf(f, "%s]\n}\n", b->count ? "\n  " : "");
+  int ok = !ferror(f);
+  if (f == stdout)
+    ok = fflush(f) == 0 && ok;
+  else
+    ok = fclose(f) == 0 && ok;
+  return ok;
+}
+
+void Batch_Free(BATCH *b) {
+  for (int i = 0; i < b->count; i++)
+    free(b->regions[i].path);
+  free(b->regions);
+  memset(b, 0, sizeof(*b));
+}
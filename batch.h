@@ -0,0 +1,61 @@
+#ifndef SCREENSHOT_BATCH_H
+#define SCREENSHOT_BATCH_H
+
+#include <stdio.h>
+
+#include "export.h"
+#include "framebuffer.h"
+
+// Headless `screenshot capture`: the platform grabs the desktop once (no
+// windows), then every requested region is cropped from that one frame and
+// encoded to its own file in parallel. A JSON report gives per-region sizes
+// and timings for test harnesses.
+//
+//   capture [--region x,y,w,h]... [--manifest file] [--out pattern]
+//           [--format png|qoi|raw] [--report file]
+//
+// Regions are in screen coordinates. A manifest has one `x,y,w,h [path]`
+// per line (blank lines and `#` comments skipped, `-` reads stdin); lines
+// without a path, and --region, use the --out pattern, where {n} is the
+// 1-based region number, {x} {y} {w} {h} the region and {ext} the format's
+// extension. The format is --format, else the pattern's extension, else
+// SCREENSHOT_FORMAT.
+
+typedef struct {
+  IRECT rect; // screen coordinates, as requested
+  char *path;
+  int ok;
+  const char *error; // static string when !ok
+  int w, h;          // written size, after clipping to the desktop
+  int copied;        // spans tiles, so it was cropped to a heap image
+  long long ns;      // crop + encode + close
+  EXPORT_STATS stats;
+} BATCH_REGION;
+
+typedef struct {
+  BATCH_REGION *regions;
+  int count, cap;
+  const char *pattern;
+  const char *report; // NULL for stdout
+  EXPORT_FORMAT format;
+  int formatSet;
+  int parallel;              // regions encoded side by side (see Batch_Run)
+  long long grabNs, encodeNs; // filled by the caller / Batch_Run
+} BATCH;
+
+// Parses the arguments after `capture`. Returns 1, or 0 with a message in
+// err; call Batch_Free either way.
+int Batch_Parse(BATCH *b, int argc, char **argv, char *err, size_t n);
+
+// Encodes every region of fb. Returns the number that succeeded.
+int Batch_Run(BATCH *b, const FRAMEBUFFER *fb);
+
+// Writes the JSON report (to --report, or stdout). Returns 1 on success.
+int Batch_Report(const BATCH *b, const FRAMEBUFFER *fb, const char *error);
+
+void Batch_Free(BATCH *b);
+
+// s as a JSON string literal, or null; shared with the other reports.
+void Json_String(FILE *f, const char *s);
+
+#endif
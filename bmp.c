@@ -0,0 +1,33 @@
+#include "bmp.h"
+
+#include <string.h>
+
+static void Put16(unsigned char *p, unsigned v) {
+  p[0] = (unsigned char)v;
+  p[1] = (unsigned char)(v >> 8);
+}
+static void Put32(unsigned char *p, unsigned v) {
+  Put16(p, v & 0xFFFF);
+  Put16(p + 2, v >> 16);
+}
+
+int Bmp_Header(const IMAGE *img, unsigned char hdr[BMP_HEADER]) {
+  size_t n = BMP_HEADER + (size_t)img->w * 4 * (size_t)img->h;
+  if (img->w <= 0 || img->h <= 0 || n > 0x7FFFFFFF)
+    return 0;
+  memset(hdr, 0, BMP_HEADER);
+  // BITMAPFILEHEADER
+  hdr[0] = 'B';
+  hdr[1] = 'M';
+  Put32(hdr + 2, (unsigned)n);
+  Put32(hdr + 10, BMP_HEADER);
+  // BITMAPINFOHEADER
+  Put32(hdr + 14, 40);
+  Put32(hdr + 18, (unsigned)img->w);
+  Put32(hdr + 22, (unsigned)-img->h); // top-down
+  Put16(hdr + 26, 1);
+  Put16(hdr + 28, 32);
+  Put32(hdr + 38, 2835); // 72 dpi
+  Put32(hdr + 42, 2835);
+  return 1;
+}
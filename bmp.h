@@ -0,0 +1,14 @@
+#ifndef SCREENSHOT_BMP_H
+#define SCREENSHOT_BMP_H
+
+#include "image.h"
+
+#define BMP_HEADER 54 // BITMAPFILEHEADER + BITMAPINFOHEADER
+
+// Header of a top-down (negative height) 32-bpp BI_RGB .bmp for a packed
+// image (stride = w * 4): the file is this header followed by img's rows as
+// they are in memory, so they can be sent without a copy. Returns 0 if the
+// file would be too large for the format.
+int Bmp_Header(const IMAGE *img, unsigned char hdr[BMP_HEADER]);
+
+#endif
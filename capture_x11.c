@@ -0,0 +1,380 @@
+#define _GNU_SOURCE
+#include "capture_x11.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
+#include "platform.h"
+
+#ifdef HAVE_XRANDR
+#include <X11/extensions/Xrandr.h>
+#endif
+
+// --- X errors ---
+// One handler for the process, looking the display up in a small table.
+// Only the thread using a display reads its errors, but displays come and
+// go on other threads, so the table is locked.
+
+#define X_ERROR_SLOTS 16
+
+typedef struct {
+  Display *dpy; // NULL: free
+  int ignore, trapped, err;
+} X_ERROR_SLOT;
+
+static X_ERROR_SLOT g_xerr[X_ERROR_SLOTS];
+static MUTEX g_xerrLock;
+static int (*g_xlibHandler)(Display *, XErrorEvent *);
+static pthread_once_t g_xerrOnce = PTHREAD_ONCE_INIT;
+
+// The slot for dpy, taking a free one if `add`; NULL if there is none.
+static X_ERROR_SLOT *X11Error_Slot(Display *dpy, int add) {
+  X_ERROR_SLOT *empty = NULL;
+  for (int i = 0; i < X_ERROR_SLOTS; i++) {
+    if (g_xerr[i].dpy == dpy)
+      return &g_xerr[i];
+    if (!g_xerr[i].dpy && !empty)
+      empty = &g_xerr[i];
+  }
+  if (!add || !empty)
+    return NULL;
+  memset(empty, 0, sizeof(*empty));
+  empty->dpy = dpy;
+  return empty;
+}
+
+static int X11Error_Handler(Display *dpy, XErrorEvent *e) {
+  Mutex_Lock(&g_xerrLock);
+  X_ERROR_SLOT *t = X11Error_Slot(dpy, 0);
+  int mine = t && (t->trapped || t->ignore);
+  if (t && t->trapped && !t->err)
+    t->err = e->error_code ? e->error_code : 1;
+  Mutex_Unlock(&g_xerrLock);
+  return mine || !g_xlibHandler ? 0 : g_xlibHandler(dpy, e);
+}
+
+static void X11Error_Init(void) {
+  Mutex_Init(&g_xerrLock);
+  g_xlibHandler = XSetErrorHandler(X11Error_Handler);
+}
+
+void X11Error_Ignore(Display *dpy) {
+  pthread_once(&g_xerrOnce, X11Error_Init);
+  Mutex_Lock(&g_xerrLock);
+  X_ERROR_SLOT *t = X11Error_Slot(dpy, 1);
+  if (t)
+    t->ignore = 1;
+  Mutex_Unlock(&g_xerrLock);
+}
+
+void X11Error_Trap(Display *dpy) {
+  pthread_once(&g_xerrOnce, X11Error_Init);
+  Mutex_Lock(&g_xerrLock);
+  X_ERROR_SLOT *t = X11Error_Slot(dpy, 1);
+  if (t) {
+    t->err = 0;
+    t->trapped = 1;
+  }
+  Mutex_Unlock(&g_xerrLock);
+}
+
+int X11Error_Untrap(Display *dpy) {
+  XSync(dpy, False);
+  Mutex_Lock(&g_xerrLock);
+  X_ERROR_SLOT *t = X11Error_Slot(dpy, 0);
+  int err = t ? t->err : 0;
+  if (t && !t->ignore)
+    t->dpy = NULL;
+  else if (t)
+    t->trapped = 0;
+  Mutex_Unlock(&g_xerrLock);
+  return err;
+}
+
+void X11Error_Forget(Display *dpy) {
+  pthread_once(&g_xerrOnce, X11Error_Init);
+  Mutex_Lock(&g_xerrLock);
+  X_ERROR_SLOT *t = X11Error_Slot(dpy, 0);
+  if (t)
+    t->dpy = NULL;
+  Mutex_Unlock(&g_xerrLock);
+}
+
+static int Format32(Display *dpy, Visual **vis, int *depth) {
+  int scr = DefaultScreen(dpy);
+  *vis = DefaultVisual(dpy, scr);
+  *depth = DefaultDepth(dpy, scr);
+  // Everything downstream assumes BGRA bytes; other layouts are not supported
+  return (*depth == 24 || *depth == 32) && (*vis)->red_mask == 0xFF0000 &&
+         (*vis)->green_mask == 0xFF00 && (*vis)->blue_mask == 0xFF;
+}
+
+static int Image_Check(XImage *img) {
+  return img->bits_per_pixel == 32 && img->byte_order == LSBFirst;
+}
+
+static void View(X11_IMAGE *xi) {
+  xi->image.px = (unsigned char *)xi->img->data;
+  xi->image.w = xi->img->width;
+  xi->image.h = xi->img->height;
+  xi->image.stride = xi->img->bytes_per_line;
+}
+
+static int Image_CreateShm(Display *dpy, Visual *vis, int depth, int w, int h,
+                           X11_IMAGE *xi) {
+  if (getenv("SCREENSHOT_NO_SHM") || !XShmQueryExtension(dpy))
+    return 0;
+  XImage *img = XShmCreateImage(dpy, vis, depth, ZPixmap, NULL, &xi->shm, w, h);
+  if (!img)
+    return 0;
+  if (!Image_Check(img)) {
+    XDestroyImage(img);
+    return 0;
+  }
+  xi->shm.shmid = shmget(IPC_PRIVATE, (size_t)img->bytes_per_line * h,
+                         IPC_CREAT | 0600);
+  if (xi->shm.shmid < 0) {
+    XDestroyImage(img);
+    return 0;
+  }
+  xi->shm.shmaddr = img->data = (char *)shmat(xi->shm.shmid, NULL, 0);
+  if (xi->shm.shmaddr == (char *)-1) {
+    shmctl(xi->shm.shmid, IPC_RMID, NULL);
+    img->data = NULL;
+    XDestroyImage(img);
+    return 0;
+  }
+  xi->shm.readOnly = False;
+
+  // XShmAttach fails asynchronously on remote displays.
+  XSync(dpy, False);
+  X11Error_Trap(dpy);
+  Status ok = XShmAttach(dpy, &xi->shm);
+  int err = X11Error_Untrap(dpy);
+  // Both sides are attached (or attaching failed): let the segment go away
+  // with its last user.
+  shmctl(xi->shm.shmid, IPC_RMID, NULL);
+  if (!ok || err) {
+    shmdt(xi->shm.shmaddr);
+    img->data = NULL;
+    XDestroyImage(img);
+    return 0;
+  }
+  xi->img = img;
+  xi->useShm = 1;
+  return 1;
+}
+
+int X11Image_Create(Display *dpy, int w, int h, X11_IMAGE *xi) {
+  memset(xi, 0, sizeof(*xi));
+  Visual *vis;
+  int depth;
+  if (w <= 0 || h <= 0 || !Format32(dpy, &vis, &depth))
+    return 0;
+  if (!Image_CreateShm(dpy, vis, depth, w, h, xi)) {
+    char *data = (char *)malloc((size_t)w * h * 4);
+    if (!data)
+      return 0;
+    xi->img = XCreateImage(dpy, vis, depth, ZPixmap, 0, data, w, h, 32, w * 4);
+    if (!xi->img) {
+      free(data);
+      return 0;
+    }
+    if (!Image_Check(xi->img)) {
+      XDestroyImage(xi->img); // frees data
+      xi->img = NULL;
+      return 0;
+    }
+  }
+  View(xi);
+  return 1;
+}
+
+void X11Image_Destroy(Display *dpy, X11_IMAGE *xi) {
+  if (!xi->img)
+    return;
+  if (xi->useShm) {
+    XShmDetach(dpy, &xi->shm);
+    XSync(dpy, False);
+    shmdt(xi->shm.shmaddr);
+    xi->img->data = NULL; // not malloc'd; keep XDestroyImage off it
+  }
+  XDestroyImage(xi->img);
+  memset(xi, 0, sizeof(*xi));
+}
+
+int X11Image_Get(Display *dpy, Drawable d, int x, int y, X11_IMAGE *xi) {
+  if (xi->useShm)
+    return XShmGetImage(dpy, d, xi->img, x, y, AllPlanes) != 0;
+  return XGetSubImage(dpy, d, x, y, xi->img->width, xi->img->height,
+                      AllPlanes, ZPixmap, xi->img, 0, 0) != NULL;
+}
+
+void X11Image_Put(Display *dpy, Drawable d, GC gc, X11_IMAGE *xi,
+                  const IRECT *r) {
+  unsigned w = (unsigned)(r->right - r->left);
+  unsigned h = (unsigned)(r->bottom - r->top);
+  if (xi->useShm)
+    XShmPutImage(dpy, d, gc, xi->img, r->left, r->top, r->left, r->top, w, h,
+                 False);
+  else
+    XPutImage(dpy, d, gc, xi->img, r->left, r->top, r->left, r->top, w, h);
+}
+
+static int Monitors(Display *dpy, IRECT *mon, int max) {
+  int scr = DefaultScreen(dpy);
+  IRECT root = {0, 0, DisplayWidth(dpy, scr), DisplayHeight(dpy, scr)};
+  int n = 0;
+#ifdef HAVE_XRANDR
+  int evBase, errBase, major = 0, minor = 0;
+  int randr = XRRQueryExtension(dpy, &evBase, &errBase) &&
+              XRRQueryVersion(dpy, &major, &minor);
+#if RANDR_MAJOR > 1 || RANDR_MINOR >= 5
+  // RandR 1.5 monitors are what desktops treat as screens: a tiled display
+  // driven by two CRTCs is one, and users can define their own
+  // (xrandr --setmonitor), which is also how the tests lay out several
+  // monitors on Xvfb's single CRTC.
+  if (randr && (major > 1 || minor >= 5)) {
+    int count = 0;
+    XRRMonitorInfo *mi =
+        XRRGetMonitors(dpy, RootWindow(dpy, scr), True, &count);
+    for (int i = 0; mi && i < count && n < max; i++) {
+      IRECT r = {mi[i].x, mi[i].y, mi[i].x + mi[i].width,
+                 mi[i].y + mi[i].height};
+      if (IRect_Intersect(&r, &root, &r))
+        mon[n++] = r;
+    }
+    if (mi)
+      XRRFreeMonitors(mi);
+  }
+#endif
+  XRRScreenResources *res = NULL;
+  if (randr && n == 0)
+    res = XRRGetScreenResourcesCurrent(dpy, RootWindow(dpy, scr));
+  for (int i = 0; res && i < res->ncrtc && n < max; i++) {
+    XRRCrtcInfo *ci = XRRGetCrtcInfo(dpy, res, res->crtcs[i]);
+    if (!ci)
+      continue;
+    IRECT r = {ci->x, ci->y, ci->x + (int)ci->width, ci->y + (int)ci->height};
+    if (ci->mode != None && ci->noutput > 0 && IRect_Intersect(&r, &root, &r))
+      mon[n++] = r;
+    XRRFreeCrtcInfo(ci);
+  }
+  if (res)
+    XRRFreeScreenResources(res);
+#else
+  (void)max;
+#endif
+  if (n == 0)
+    mon[n++] = root;
+  return n;
+}
+
+static int Capture_Open(Display *dpy, X11_CAPTURE *c, const FRAMEBUFFER *fb) {
+  c->dpy = dpy;
+  c->fb = *fb;
+  c->serial = 0;
+  for (int i = 0; i < fb->ntiles; i++) {
+    X11_OUTPUT *o = &c->out[i];
+    o->dpy = dpy;
+    if (i > 0 && !c->serial) {
+      Display *w = XOpenDisplay(DisplayString(dpy));
+      if (w)
+        o->dpy = w;
+      else
+        c->serial = 1;
+    }
+    FB_TILE *t = &c->fb.tiles[i];
+    if (!X11Image_Create(o->dpy, t->area.right - t->area.left,
+                         t->area.bottom - t->area.top, &o->frame))
+      return 0;
+    t->capture = o->frame.image;
+  }
+  return 1;
+}
+
+static int GrabTile(void *ctx, int i) {
+  X11_CAPTURE *c = (X11_CAPTURE *)ctx;
+  X11_OUTPUT *o = &c->out[i];
+  const IRECT *a = &c->fb.tiles[i].area;
+  return X11Image_Get(o->dpy, DefaultRootWindow(o->dpy),
+                      c->fb.virt.left + a->left, c->fb.virt.top + a->top,
+                      &o->frame);
+}
+
+int X11Capture_Layout(Display *dpy, FRAMEBUFFER *fb) {
+  IRECT mon[FB_MAX_TILES];
+  return Framebuffer_Layout(fb, mon, Monitors(dpy, mon, FB_MAX_TILES));
+}
+
+int X11Capture_Grab(Display *dpy, X11_CAPTURE *c) {
+  FRAMEBUFFER fb;
+  X11Capture_Layout(dpy, &fb);
+  c->reopened = !c->dpy || !c->out[0].frame.img || c->adopted ||
+                !Framebuffer_SameLayout(&c->fb, &fb);
+  if (c->reopened) {
+    X11Capture_Release(c);
+    c->reopened = 1;
+    if (!Capture_Open(dpy, c, &fb))
+      return 0;
+  }
+  long long t0 = Clock_Ns();
+  int ok = 1;
+  if (c->serial) {
+    for (int i = 0; i < c->fb.ntiles; i++)
+      ok &= GrabTile(c, i);
+  } else {
+    ok = Framebuffer_Capture(&c->fb, GrabTile, c);
+  }
+  c->grabNs = Clock_Ns() - t0;
+  c->shm = c->out[0].frame.useShm;
+  return ok;
+}
+
+void X11Capture_Adopt(Display *dpy, X11_CAPTURE *c, const FRAMEBUFFER *layout,
+                      const IMAGE *tiles) {
+  c->reopened = !c->adopted || !Framebuffer_SameLayout(&c->fb, layout);
+  if (c->reopened) {
+    X11Capture_Release(c);
+    c->reopened = c->adopted = 1;
+    c->dpy = dpy;
+    c->fb.virt = layout->virt;
+    c->fb.w = layout->w;
+    c->fb.h = layout->h;
+    c->fb.ntiles = layout->ntiles;
+    for (int i = 0; i < layout->ntiles; i++)
+      c->fb.tiles[i].area = layout->tiles[i].area;
+  }
+  for (int i = 0; i < c->fb.ntiles; i++)
+    c->fb.tiles[i].capture = tiles[i];
+  c->shm = 0;
+}
+
+static void Capture_CloseOutputs(X11_CAPTURE *c) {
+  for (int i = 0; i < FB_MAX_TILES; i++) {
+    X11_OUTPUT *o = &c->out[i];
+    if (!o->dpy)
+      continue;
+    X11Image_Destroy(o->dpy, &o->frame);
+    if (o->dpy != c->dpy)
+      XCloseDisplay(o->dpy);
+    o->dpy = NULL;
+  }
+}
+
+void X11Capture_Trim(X11_CAPTURE *c) {
+  if (!c->fb.store)
+    return;
+  Capture_CloseOutputs(c);
+  for (int i = 0; i < c->fb.ntiles; i++)
+    memset(&c->fb.tiles[i].capture, 0, sizeof(IMAGE));
+}
+
+void X11Capture_Release(X11_CAPTURE *c) {
+  Framebuffer_Free(&c->fb);
+  Capture_CloseOutputs(c);
+  memset(c, 0, sizeof(*c));
+}
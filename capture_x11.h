@@ -0,0 +1,79 @@
+#ifndef SCREENSHOT_CAPTURE_X11_H
+#define SCREENSHOT_CAPTURE_X11_H
+
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
+
+#include "framebuffer.h"
+#include "image.h"
+
+// Xlib has one error handler for the whole process, while the overlay,
+// the pick worker, the shadow and the capture workers each have their own
+// connection and thread. The handler installed by the first call here
+// dispatches on the error's display: between X11Error_Trap and
+// X11Error_Untrap a display's errors are recorded for it, all errors on a
+// display passed to X11Error_Ignore are dropped, and the rest go to the
+// handler Xlib had before. Nothing else calls XSetErrorHandler.
+void X11Error_Ignore(Display *dpy);
+void X11Error_Trap(Display *dpy);
+// Syncs dpy and ends the trap; returns the first error code caught, or 0.
+int X11Error_Untrap(Display *dpy);
+// Drops what is kept for dpy; call before closing an ignored display.
+void X11Error_Forget(Display *dpy);
+
+// 32-bpp ZPixmap image, backed by a MIT-SHM segment when the server
+// supports it (local connections) and by plain client memory otherwise.
+// `image` views the same pixels, so the portable modules read/write the
+// XImage in place.
+typedef struct {
+  XImage *img;
+  XShmSegmentInfo shm;
+  int useShm;
+  IMAGE image;
+} X11_IMAGE;
+
+int X11Image_Create(Display *dpy, int w, int h, X11_IMAGE *xi);
+void X11Image_Destroy(Display *dpy, X11_IMAGE *xi);
+// Reads the drawable area at (x, y) sized like xi into xi.
+int X11Image_Get(Display *dpy, Drawable d, int x, int y, X11_IMAGE *xi);
+// Writes r (in image coordinates) to the same spot in d.
+void X11Image_Put(Display *dpy, Drawable d, GC gc, X11_IMAGE *xi,
+                  const IRECT *r);
+
+// Root-window grab into a per-monitor framebuffer (RandR 1.5 monitors, or
+// CRTCs on older servers, when built with HAVE_XRANDR; otherwise the whole
+// screen as one tile). Every monitor gets its own image and, past the
+// first, its own X connection: requests on one connection are serviced in
+// order, so that is what lets the grabs run in parallel. Images are reused
+// while the layout stays the same.
+typedef struct {
+  Display *dpy; // connection that owns frame
+  X11_IMAGE frame;
+} X11_OUTPUT;
+
+typedef struct {
+  Display *dpy; // caller's connection
+  FRAMEBUFFER fb;
+  X11_OUTPUT out[FB_MAX_TILES];
+  int serial;       // a worker connection failed: grab one after another
+  int shm;          // the last grab went through MIT-SHM
+  long long grabNs; // duration of the last grab
+  int reopened;     // the last grab had to (re)allocate its images
+  int adopted;      // tiles are borrowed, see X11Capture_Adopt
+} X11_CAPTURE;
+
+// Current monitor layout, as X11Capture_Grab would capture it.
+int X11Capture_Layout(Display *dpy, FRAMEBUFFER *fb);
+int X11Capture_Grab(Display *dpy, X11_CAPTURE *c);
+// Uses pixels captured elsewhere (the resident shadow) as the tiles of a
+// framebuffer with the given layout; the caller keeps them alive until the
+// framebuffer is reset. Dimmed copies are kept while the layout is the same.
+void X11Capture_Adopt(Display *dpy, X11_CAPTURE *c, const FRAMEBUFFER *layout,
+                      const IMAGE *tiles);
+// Frees the grab images once the framebuffer is packed; the next grab
+// recreates them.
+void X11Capture_Trim(X11_CAPTURE *c);
+void X11Capture_Release(X11_CAPTURE *c);
+
+#endif
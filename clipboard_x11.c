@@ -0,0 +1,350 @@
+#define _GNU_SOURCE // open_memstream
+#include "clipboard_x11.h"
+
+#include <X11/Xatom.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bmp.h"
+#include "capture_x11.h"
+#include "platform.h"
+#include "png.h"
+#include "raw.h"
+
+#define CLIP_MAX_TRANSFERS 8 // concurrent INCR pastes
+
+// What the clipboard holds. Transfers keep a reference, so a new copy (or
+// losing the selection) in the middle of a paste does not free the pixels
+// under it.
+typedef struct {
+  int refs;
+  EXPORT_IMAGE *src; // packed
+  unsigned char bmpHdr[BMP_HEADER], rawHdr[RAW_HEADER];
+  unsigned char *png; // encoded on first request
+  size_t pngLen;
+  long long pngNs;
+} CLIP_ITEM;
+
+// A payload in two pieces, a header and a body; the body may be the pixels.
+typedef struct {
+  const unsigned char *p[2];
+  size_t n[2];
+} CLIP_DATA;
+
+typedef struct {
+  Window requestor; // None: slot free
+  Atom property, target;
+  CLIP_ITEM *item;
+  CLIP_DATA data;
+  size_t off, total;
+  unsigned chunks;
+  long long t0, encodeNs;
+} CLIP_TRANSFER;
+
+static struct {
+  Display *dpy;
+  Window owner;
+  int verbose;
+  Atom clipboard, targets, incr, png, bmp, raw;
+  CLIP_ITEM *item;
+  CLIP_TRANSFER xfer[CLIP_MAX_TRANSFERS];
+} g_clip;
+
+// Requestors are other clients' windows and may be gone by the time we
+// write to them; Begin/End bracket such requests and report whether they
+// failed, instead of letting Xlib's default handler exit.
+static void Trap_Begin(void) { X11Error_Trap(g_clip.dpy); }
+static int Trap_End(void) { return X11Error_Untrap(g_clip.dpy) == 0; }
+
+static void Item_Release(CLIP_ITEM *it) {
+  if (!it || --it->refs > 0)
+    return;
+  ExportImage_Release(it->src);
+  free(it->png);
+  free(it);
+}
+
+// Payload for target; encodes PNG the first time it is asked for.
+static int Item_Data(CLIP_ITEM *it, Atom target, CLIP_DATA *d) {
+  size_t px = (size_t)it->src->img.w * 4 * (size_t)it->src->img.h;
+  memset(d, 0, sizeof(*d));
+  if (target == g_clip.bmp) {
+    d->p[0] = it->bmpHdr, d->n[0] = BMP_HEADER;
+    d->p[1] = it->src->img.px, d->n[1] = px;
+  } else if (target == g_clip.raw) {
+    d->p[0] = it->rawHdr, d->n[0] = RAW_HEADER;
+    d->p[1] = it->src->img.px, d->n[1] = px;
+  } else if (target == g_clip.png) {
+    if (!it->png) {
+      long long t0 = Clock_Ns();
+      char *buf = NULL;
+      size_t len = 0;
+      FILE *f = open_memstream(&buf, &len);
+      int ok = f && Png_Write(f, &it->src->img, 0, NULL);
+      if (f)
+        fclose(f);
+      if (!ok) {
+        free(buf);
+        return 0;
+      }
+      it->png = (unsigned char *)buf;
+      it->pngLen = len;
+      it->pngNs = Clock_Ns() - t0;
+    }
+    d->p[0] = it->png, d->n[0] = it->pngLen;
+  } else {
+    return 0;
+  }
+  return 1;
+}
+
+static void Clip_Drop(void) {
+  Item_Release(g_clip.item);
+  g_clip.item = NULL;
+}
+
+void X11Clip_Init(Display *dpy, Window owner, int verbose) {
+  g_clip.dpy = dpy;
+  g_clip.owner = owner;
+  g_clip.verbose = verbose;
+  g_clip.clipboard = XInternAtom(dpy, "CLIPBOARD", False);
+  g_clip.targets = XInternAtom(dpy, "TARGETS", False);
+  g_clip.incr = XInternAtom(dpy, "INCR", False);
+  g_clip.png = XInternAtom(dpy, "image/png", False);
+  g_clip.bmp = XInternAtom(dpy, "image/bmp", False);
+  g_clip.raw = XInternAtom(dpy, "image/x-bgra", False);
+}
+
+int X11Clip_Set(EXPORT_IMAGE *img, Time t) {
+  Clip_Drop();
+  const IMAGE *px = &img->img;
+  CLIP_ITEM *it = (CLIP_ITEM *)calloc(1, sizeof(CLIP_ITEM));
+  if (!it || px->stride != px->w * 4 || !Bmp_Header(px, it->bmpHdr)) {
+    free(it);
+    return 0;
+  }
+  it->refs = 1;
+  it->src = img;
+  ExportImage_Retain(img);
+  Raw_Header(px, it->rawHdr);
+  g_clip.item = it;
+  XSetSelectionOwner(g_clip.dpy, g_clip.clipboard, g_clip.owner, t);
+  return XGetSelectionOwner(g_clip.dpy, g_clip.clipboard) == g_clip.owner;
+}
+
+size_t X11Clip_HeldBytes(void) {
+  const CLIP_ITEM *it = g_clip.item;
+  if (!it)
+    return 0;
+  return (size_t)it->src->img.w * 4 * (size_t)it->src->img.h + it->pngLen;
+}
+
+// Largest property we can write in one request.
+static size_t Clip_MaxChunk(void) {
+  long units = XExtendedMaxRequestSize(g_clip.dpy);
+  if (!units)
+    units = XMaxRequestSize(g_clip.dpy);
+  return (size_t)units * 4 - 256;
+}
+
+// Writes bytes [off, off + len) of d as the property; len == 0 writes the
+// empty property that ends an INCR transfer.
+static void Clip_Put(Window w, Atom prop, Atom type, const CLIP_DATA *d,
+                     size_t off, size_t len) {
+  int mode = PropModeReplace;
+  for (int i = 0; i < 2 && len; i++) {
+    if (off >= d->n[i]) {
+      off -= d->n[i];
+      continue;
+    }
+    size_t k = d->n[i] - off < len ? d->n[i] - off : len;
+    XChangeProperty(g_clip.dpy, w, prop, type, 8, mode, d->p[i] + off,
+                    (int)k);
+    mode = PropModeAppend;
+    off = 0;
+    len -= k;
+  }
+  if (mode == PropModeReplace)
+    XChangeProperty(g_clip.dpy, w, prop, type, 8, mode,
+                    (const unsigned char *)"", 0);
+}
+
+static void Clip_LogPaste(Atom target, size_t bytes, unsigned chunks,
+                          long long t0, long long encodeNs) {
+  if (!g_clip.verbose)
+    return;
+  char *name = XGetAtomName(g_clip.dpy, target);
+  fprintf(stderr,
+          "screenshot: paste %s %.2f MB in %u chunk(s), request-to-last-byte "
+          "%.2f ms (encode %.2f ms)\n",
+          name ? name : "?", bytes / 1e6, chunks, (Clock_Ns() - t0) / 1e6,
+          encodeNs / 1e6);
+  if (name)
+    XFree(name);
+}
+
+static void Xfer_End(CLIP_TRANSFER *x) {
+  Item_Release(x->item);
+  memset(x, 0, sizeof(*x));
+}
+
+static CLIP_TRANSFER *Xfer_Find(Window w, Atom prop) {
+  for (int i = 0; i < CLIP_MAX_TRANSFERS; i++) {
+    CLIP_TRANSFER *x = &g_clip.xfer[i];
+    if (x->requestor && x->requestor == w &&
+        (prop == None || x->property == prop))
+      return x;
+  }
+  return NULL;
+}
+
+// Whether another transfer is still writing to x's requestor, as when a
+// client asks for two targets at once.
+static int Xfer_Shared(const CLIP_TRANSFER *x) {
+  for (int i = 0; i < CLIP_MAX_TRANSFERS; i++) {
+    const CLIP_TRANSFER *o = &g_clip.xfer[i];
+    if (o != x && o->requestor == x->requestor)
+      return 1;
+  }
+  return 0;
+}
+
+// The requestor deleted the property: send the next chunk. A chunk never
+// spans header and body, so each is a single property write the requestor
+// reads whole.
+static void Xfer_Next(CLIP_TRANSFER *x) {
+  size_t len = 0, off = x->off;
+  for (int i = 0; i < 2; i++) {
+    if (off < x->data.n[i]) {
+      len = x->data.n[i] - off;
+      break;
+    }
+    off -= x->data.n[i];
+  }
+  size_t max = Clip_MaxChunk();
+  if (len > max)
+    len = max;
+  Trap_Begin();
+  Clip_Put(x->requestor, x->property, x->target, &x->data, x->off, len);
+  // The empty chunk just written ends the transfer; the others to this
+  // window still need its property deletes.
+  if (!len && !Xfer_Shared(x))
+    XSelectInput(g_clip.dpy, x->requestor, NoEventMask);
+  int alive = Trap_End();
+  if (len && alive) {
+    x->off += len;
+    x->chunks++;
+    return;
+  }
+  if (alive)
+    Clip_LogPaste(x->target, x->total, x->chunks, x->t0, x->encodeNs);
+  Xfer_End(x);
+}
+
+// Called inside Clip_Answer's error trap; the caller ends the transfer
+// again if the requestor turned out to be gone.
+static CLIP_TRANSFER *Xfer_Start(XSelectionRequestEvent *rq, Atom prop,
+                                 CLIP_ITEM *it, const CLIP_DATA *d,
+                                 long long t0, long long encodeNs) {
+  CLIP_TRANSFER *x = NULL;
+  for (int i = 0; i < CLIP_MAX_TRANSFERS && !x; i++)
+    if (!g_clip.xfer[i].requestor)
+      x = &g_clip.xfer[i];
+  if (!x)
+    return NULL;
+  x->total = d->n[0] + d->n[1];
+  // INCR's size is a lower bound; anything past 32 bits just says "big"
+  long size = x->total > 0x7FFFFFFF ? 0x7FFFFFFF : (long)x->total;
+  // select first so the requestor's delete of the INCR property is seen
+  XSelectInput(g_clip.dpy, rq->requestor,
+               PropertyChangeMask | StructureNotifyMask);
+  XChangeProperty(g_clip.dpy, rq->requestor, prop, g_clip.incr, 32,
+                  PropModeReplace, (unsigned char *)&size, 1);
+  x->requestor = rq->requestor;
+  x->property = prop;
+  x->target = rq->target;
+  x->item = it;
+  it->refs++;
+  x->data = *d;
+  x->t0 = t0;
+  x->encodeNs = encodeNs;
+  return x;
+}
+
+static void Clip_Answer(XSelectionRequestEvent *rq) {
+  long long t0 = Clock_Ns();
+  Atom prop = rq->property != None ? rq->property : rq->target;
+  XSelectionEvent ev = {0};
+  ev.type = SelectionNotify;
+  ev.display = rq->display;
+  ev.requestor = rq->requestor;
+  ev.selection = rq->selection;
+  ev.target = rq->target;
+  ev.time = rq->time;
+  ev.property = None;
+
+  CLIP_ITEM *it = g_clip.item;
+  CLIP_DATA d;
+  CLIP_TRANSFER *started = NULL;
+  int log = 0;
+  long long encodeNs = 0;
+  Trap_Begin();
+  if (rq->target == g_clip.targets) {
+    Atom list[] = {g_clip.targets, g_clip.png, g_clip.bmp, g_clip.raw};
+    XChangeProperty(g_clip.dpy, rq->requestor, prop, XA_ATOM, 32,
+                    PropModeReplace, (unsigned char *)list, 4);
+    ev.property = prop;
+  } else if (it) {
+    int cached = it->png != NULL;
+    if (Item_Data(it, rq->target, &d)) {
+      if (rq->target == g_clip.png && !cached)
+        encodeNs = it->pngNs;
+      if (d.n[0] + d.n[1] <= Clip_MaxChunk()) {
+        Clip_Put(rq->requestor, prop, rq->target, &d, 0, d.n[0] + d.n[1]);
+        ev.property = prop;
+        log = 1;
+      } else if ((started = Xfer_Start(rq, prop, it, &d, t0, encodeNs))) {
+        ev.property = prop;
+      }
+    }
+  }
+  XSendEvent(g_clip.dpy, rq->requestor, False, NoEventMask, (XEvent *)&ev);
+  if (!Trap_End()) {
+    if (started)
+      Xfer_End(started);
+  } else if (log) {
+    Clip_LogPaste(rq->target, d.n[0] + d.n[1], 1, t0, encodeNs);
+  }
+}
+
+int X11Clip_HandleEvent(XEvent *ev) {
+  CLIP_TRANSFER *x;
+  switch (ev->type) {
+  case SelectionRequest:
+    if (ev->xselectionrequest.owner != g_clip.owner)
+      return 0;
+    Clip_Answer(&ev->xselectionrequest);
+    return 1;
+  case SelectionClear:
+    if (ev->xselectionclear.window != g_clip.owner ||
+        ev->xselectionclear.selection != g_clip.clipboard)
+      return 0;
+    Clip_Drop(); // transfers in flight keep their own reference
+    return 1;
+  case PropertyNotify:
+    if (ev->xproperty.state != PropertyDelete ||
+        !(x = Xfer_Find(ev->xproperty.window, ev->xproperty.atom)))
+      return 0;
+    Xfer_Next(x);
+    return 1;
+  case DestroyNotify:
+    if (!(x = Xfer_Find(ev->xdestroywindow.window, None)))
+      return 0;
+    do // requestor went away mid-paste
+      Xfer_End(x);
+    while ((x = Xfer_Find(ev->xdestroywindow.window, None)));
+    return 1;
+  }
+  return 0;
+}
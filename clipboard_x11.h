@@ -0,0 +1,32 @@
+#ifndef SCREENSHOT_CLIPBOARD_X11_H
+#define SCREENSHOT_CLIPBOARD_X11_H
+
+#include <X11/Xlib.h>
+
+#include "export.h"
+
+// CLIPBOARD owner for screenshots. X has no clipboard store: the data lives
+// in this process and is handed out on each paste (SelectionRequest), so the
+// resident controller window owns the selection.
+//
+// Copying only keeps the cropped pixels. Each target is produced when a
+// paste asks for it: image/bmp and image/x-bgra (raw.h) are a small header
+// followed by the pixels themselves, image/png is encoded on the first
+// request and kept. Payloads larger than one request go out with the INCR
+// protocol, chunk by chunk as the requestor reads them.
+
+// verbose: report each paste (size, chunks, request-to-last-byte) on stderr.
+void X11Clip_Init(Display *dpy, Window owner, int verbose);
+
+// Keeps a reference to img and claims CLIPBOARD.
+int X11Clip_Set(EXPORT_IMAGE *img, Time t);
+
+// Bytes held for the clipboard: pixels plus encoded targets.
+size_t X11Clip_HeldBytes(void);
+
+// Handles SelectionRequest/SelectionClear for the owner window and the
+// PropertyNotify/DestroyNotify of requestors in an INCR transfer; returns 1
+// if the event was consumed.
+int X11Clip_HandleEvent(XEvent *ev);
+
+#endif
@@ -0,0 +1,680 @@
+#include "deflate.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define WINDOW_SIZE 32768
+#define WINDOW_MASK (WINDOW_SIZE - 1)
+#define HASH_BITS 15
+#define MAX_CHAIN 16
+#define MIN_MATCH 4 // hashed on 4 bytes; the format allows 3
+#define MAX_MATCH 258
+#define BLOCK_SYMBOLS 32768 // symbols per Huffman block
+#define MAX_STORED 65535
+
+static const unsigned short kLenBase[29] = {
+    3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+    31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const unsigned char kLenExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1,
+                                            1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+                                            4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const unsigned short kDistBase[30] = {
+    1,   2,   3,   4,   5,   7,    9,    13,   17,   25,
+    33,  49,  65,  97,  129, 193,  257,  385,  513,  769,
+    1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const unsigned char kDistExtra[30] = {0, 0, 0,  0,  1,  1,  2,  2,
+                                             3, 3, 4,  4,  5,  5,  6,  6,
+                                             7, 7, 8,  8,  9,  9,  10, 10,
+                                             11, 11, 12, 12, 13, 13};
+static const unsigned char kClOrder[19] = {16, 17, 18, 0, 8,  7, 9,  6, 10, 5,
+                                           11, 4,  12, 3, 13, 2, 14, 1, 15};
+
+static int Log2(unsigned x) {
+  int n = 0;
+  while (x >>= 1)
+    n++;
+  return n;
+}
+
+// Length 3..258 -> code 0..28 (symbol 257 + code).
+static int LenCode(int len) {
+  unsigned x = (unsigned)len - 3;
+  if (len == MAX_MATCH)
+    return 28;
+  if (x < 8)
+    return (int)x;
+  int nb = Log2(x);
+  return 4 * (nb - 1) + (int)((x >> (nb - 2)) & 3);
+}
+
+// Distance 1..32768 -> code 0..29.
+static int DistCode(int dist) {
+  unsigned x = (unsigned)dist - 1;
+  if (x < 4)
+    return (int)x;
+  int nb = Log2(x);
+  return 2 * nb + (int)((x >> (nb - 1)) & 1);
+}
+
+// --- Bit output (LSB first) ---
+typedef struct {
+  unsigned char *out;
+  size_t pos;
+  unsigned long long acc;
+  int n;
+} BITS;
+
+static void Put(BITS *b, unsigned v, int n) {
+  b->acc |= (unsigned long long)v << b->n;
+  b->n += n;
+  while (b->n >= 8) {
+    b->out[b->pos++] = (unsigned char)b->acc;
+    b->acc >>= 8;
+    b->n -= 8;
+  }
+}
+
+static void Align(BITS *b) {
+  if (b->n)
+    Put(b, 0, 8 - b->n);
+}
+
+static void PutStored(BITS *b, const unsigned char *p, size_t n, int final) {
+  do {
+    size_t k = n < MAX_STORED ? n : MAX_STORED;
+    Put(b, final && k == n, 1);
+    Put(b, 0, 2);
+    Align(b);
+    Put(b, (unsigned)k, 16);
+    Put(b, (unsigned)k ^ 0xFFFF, 16);
+    memcpy(b->out + b->pos, p, k);
+    b->pos += k;
+    p += k;
+    n -= k;
+  } while (n);
+}
+
+// --- Huffman codes ---
+
+// Code lengths for freq[0..n) limited to maxBits; unused symbols get 0.
+// Past the limit the frequencies are flattened and the tree rebuilt, which
+// costs a little ratio on pathological inputs only.
+static void Huff_Lengths(const unsigned *freq, int n, int maxBits,
+                         unsigned char *len) {
+  unsigned f[288];
+  int leaf[288];
+  unsigned w[2 * 288];
+  int parent[2 * 288];
+  unsigned char depth[2 * 288];
+  memcpy(f, freq, sizeof(unsigned) * (size_t)n);
+  memset(len, 0, (size_t)n);
+  for (;;) {
+    int m = 0;
+    for (int i = 0; i < n; i++)
+      if (f[i])
+        leaf[m++] = i;
+    if (m == 0)
+      return;
+    if (m == 1) {
+      len[leaf[0]] = 1;
+      return;
+    }
+    // leaves by ascending frequency (insertion sort: n <= 288)
+    for (int i = 1; i < m; i++) {
+      int s = leaf[i], j = i;
+      for (; j > 0 && f[leaf[j - 1]] > f[s]; j--)
+        leaf[j] = leaf[j - 1];
+      leaf[j] = s;
+    }
+    for (int i = 0; i < m; i++)
+      w[i] = f[leaf[i]];
+    // two-queue merge: leaves 0..m-1, internal nodes m..2m-2 in order
+    int li = 0, ni = m, next = m;
+    while (next < 2 * m - 1) {
+      int pick[2];
+      for (int k = 0; k < 2; k++) {
+        if (li < m && (ni >= next || w[li] <= w[ni]))
+          pick[k] = li++;
+        else
+          pick[k] = ni++;
+      }
+      w[next] = w[pick[0]] + w[pick[1]];
+      parent[pick[0]] = parent[pick[1]] = next;
+      next++;
+    }
+    depth[2 * m - 2] = 0;
+    int maxDepth = 0;
+    for (int i = 2 * m - 3; i >= 0; i--) {
+      depth[i] = (unsigned char)(depth[parent[i]] + 1);
+      if (i < m && depth[i] > maxDepth)
+        maxDepth = depth[i];
+    }
+    if (maxDepth <= maxBits) {
+      for (int i = 0; i < m; i++)
+        len[leaf[i]] = depth[i];
+      return;
+    }
+    for (int i = 0; i < n; i++)
+      if (f[i])
+        f[i] = (f[i] >> 1) | 1;
+  }
+}
+
+// Canonical codes, bit-reversed for LSB-first output.
+static void Huff_Codes(const unsigned char *len, int n, unsigned short *code) {
+  unsigned count[16] = {0}, next[16];
+  for (int i = 0; i < n; i++)
+    count[len[i]]++;
+  count[0] = 0;
+  unsigned c = 0;
+  for (int b = 1; b < 16; b++) {
+    c = (c + count[b - 1]) << 1;
+    next[b] = c;
+  }
+  for (int i = 0; i < n; i++) {
+    if (!len[i])
+      continue;
+    unsigned v = next[len[i]]++, r = 0;
+    for (int b = 0; b < len[i]; b++)
+      r |= ((v >> b) & 1) << (len[i] - 1 - b);
+    code[i] = (unsigned short)r;
+  }
+}
+
+// --- Blocks ---
+typedef struct {
+  unsigned short lit; // literal byte, or match length when dist > 0
+  unsigned short dist;
+} SYM;
+
+typedef struct {
+  unsigned char litLen[286], distLen[30], clLen[19];
+  unsigned short litCode[286], distCode[30], clCode[19];
+  unsigned char cl[286 + 30]; // run-length coded code lengths
+  unsigned char clExtra[286 + 30];
+  int ncl, hlit, hdist, hclen;
+} TREES;
+
+static int RunLengths(const unsigned char *lens, int n, unsigned char *cl,
+                      unsigned char *extra) {
+  int k = 0;
+  for (int i = 0; i < n;) {
+    int v = lens[i], r = 1;
+    while (i + r < n && lens[i + r] == v)
+      r++;
+    i += r;
+    if (v == 0) {
+      while (r >= 11) {
+        int m = r < 138 ? r : 138;
+        cl[k] = 18, extra[k++] = (unsigned char)(m - 11);
+        r -= m;
+      }
+      if (r >= 3) {
+        cl[k] = 17, extra[k++] = (unsigned char)(r - 3);
+        r = 0;
+      }
+    } else {
+      cl[k] = (unsigned char)v, extra[k++] = 0;
+      r--;
+      while (r >= 3) {
+        int m = r < 6 ? r : 6;
+        cl[k] = 16, extra[k++] = (unsigned char)(m - 3);
+        r -= m;
+      }
+    }
+    while (r-- > 0)
+      cl[k] = (unsigned char)v, extra[k++] = 0;
+  }
+  return k;
+}
+
+// Builds the block's trees; returns its size in bits.
+static size_t Trees_Build(TREES *t, const SYM *syms, int nsyms) {
+  unsigned litF[286] = {0}, distF[30] = {0}, clF[19] = {0};
+  for (int i = 0; i < nsyms; i++) {
+    if (syms[i].dist) {
+      litF[257 + LenCode(syms[i].lit)]++;
+      distF[DistCode(syms[i].dist)]++;
+    } else {
+      litF[syms[i].lit]++;
+    }
+  }
+  litF[256] = 1;
+  int anyDist = 0;
+  for (int i = 0; i < 30; i++)
+    anyDist |= distF[i] != 0;
+  if (!anyDist)
+    distF[0] = 1; // the format wants at least one distance code
+  Huff_Lengths(litF, 286, 15, t->litLen);
+  Huff_Lengths(distF, 30, 15, t->distLen);
+  Huff_Codes(t->litLen, 286, t->litCode);
+  Huff_Codes(t->distLen, 30, t->distCode);
+
+  t->hlit = 286;
+  while (t->hlit > 257 && !t->litLen[t->hlit - 1])
+    t->hlit--;
+  t->hdist = 30;
+  while (t->hdist > 1 && !t->distLen[t->hdist - 1])
+    t->hdist--;
+  unsigned char all[286 + 30];
+  memcpy(all, t->litLen, (size_t)t->hlit);
+  memcpy(all + t->hlit, t->distLen, (size_t)t->hdist);
+  t->ncl = RunLengths(all, t->hlit + t->hdist, t->cl, t->clExtra);
+  for (int i = 0; i < t->ncl; i++)
+    clF[t->cl[i]]++;
+  Huff_Lengths(clF, 19, 7, t->clLen);
+  Huff_Codes(t->clLen, 19, t->clCode);
+  t->hclen = 19;
+  while (t->hclen > 4 && !t->clLen[kClOrder[t->hclen - 1]])
+    t->hclen--;
+
+  size_t bits = 3 + 5 + 5 + 4 + 3 * (size_t)t->hclen;
+  static const unsigned char clExtraBits[19] = {[16] = 2, [17] = 3, [18] = 7};
+  for (int i = 0; i < 19; i++)
+    bits += (size_t)clF[i] * (t->clLen[i] + clExtraBits[i]);
+  for (int i = 0; i < 286; i++) {
+    size_t e = i > 256 ? kLenExtra[i - 257] : 0;
+    bits += (size_t)litF[i] * (t->litLen[i] + e);
+  }
+  if (anyDist)
+    for (int i = 0; i < 30; i++)
+      bits += (size_t)distF[i] * (t->distLen[i] + kDistExtra[i]);
+  return bits;
+}
+
+static void PutDynamic(BITS *b, const TREES *t, const SYM *syms, int nsyms,
+                       int final) {
+  Put(b, final, 1);
+  Put(b, 2, 2);
+  Put(b, (unsigned)(t->hlit - 257), 5);
+  Put(b, (unsigned)(t->hdist - 1), 5);
+  Put(b, (unsigned)(t->hclen - 4), 4);
+  for (int i = 0; i < t->hclen; i++)
+    Put(b, t->clLen[kClOrder[i]], 3);
+  for (int i = 0; i < t->ncl; i++) {
+    int c = t->cl[i];
+    Put(b, t->clCode[c], t->clLen[c]);
+    if (c >= 16)
+      Put(b, t->clExtra[i], c == 16 ? 2 : c == 17 ? 3 : 7);
+  }
+  for (int i = 0; i < nsyms; i++) {
+    const SYM *s = &syms[i];
+    if (!s->dist) {
+      Put(b, t->litCode[s->lit], t->litLen[s->lit]);
+      continue;
+    }
+    int lc = LenCode(s->lit), dc = DistCode(s->dist);
+    Put(b, t->litCode[257 + lc], t->litLen[257 + lc]);
+    Put(b, (unsigned)(s->lit - kLenBase[lc]), kLenExtra[lc]);
+    Put(b, t->distCode[dc], t->distLen[dc]);
+    Put(b, (unsigned)(s->dist - kDistBase[dc]), kDistExtra[dc]);
+  }
+  Put(b, t->litCode[256], t->litLen[256]);
+}
+
+// One block over raw bytes [p, p + n), dynamic or stored, whichever is
+// smaller.
+static void PutBlock(BITS *b, const SYM *syms, int nsyms,
+                     const unsigned char *p, size_t n, int final) {
+  TREES t;
+  size_t dynBits = Trees_Build(&t, syms, nsyms);
+  size_t storedBits = (n + 5 * (n / MAX_STORED + 1)) * 8 + 7;
+  if (storedBits < dynBits)
+    PutStored(b, p, n, final);
+  else
+    PutDynamic(b, &t, syms, nsyms, final);
+}
+
+static unsigned Hash4(const unsigned char *p) {
+  unsigned v;
+  memcpy(&v, p, 4);
+  return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+size_t Deflate_Bound(size_t n) {
+  // every block could fall back to stored: 5 header bytes per 64 KB piece
+  // and per block, plus the closing empty block
+  return n + 5 * (n / 16383 + 3) + 16;
+}
+
+size_t Deflate_Compress(const unsigned char *src, size_t n, unsigned char *dst,
+                        int final) {
+  BITS b = {dst, 0, 0, 0};
+  int *head = (int *)malloc(sizeof(int) << HASH_BITS);
+  int *prev = (int *)malloc(sizeof(int) * WINDOW_SIZE);
+  SYM *syms = (SYM *)malloc(sizeof(SYM) * BLOCK_SYMBOLS);
+  if (!head || !prev || !syms) {
+    // out of memory: still produce a valid stream
+    free(head);
+    free(prev);
+    free(syms);
+    if (n)
+      PutStored(&b, src, n, final);
+    head = prev = NULL;
+    syms = NULL;
+  } else {
+    memset(head, 0xFF, sizeof(int) << HASH_BITS);
+    size_t pos = 0, blockStart = 0;
+    int nsyms = 0;
+    while (pos < n) {
+      int best = 0, bestDist = 0;
+      if (pos + MIN_MATCH <= n) {
+        unsigned h = Hash4(src + pos);
+        int cand = head[h];
+        size_t maxLen = n - pos < MAX_MATCH ? n - pos : MAX_MATCH;
+        for (int chain = MAX_CHAIN;
+             cand >= 0 && pos - (size_t)cand <= WINDOW_SIZE && chain > 0;
+             chain--) {
+          const unsigned char *a = src + cand, *c = src + pos;
+          if (a[best] == c[best]) {
+            size_t l = 0;
+            while (l < maxLen && a[l] == c[l])
+              l++;
+            if ((int)l > best) {
+              best = (int)l;
+              bestDist = (int)(pos - (size_t)cand);
+              if (l == maxLen)
+                break;
+            }
+          }
+          int nx = prev[cand & WINDOW_MASK];
+          if (nx >= cand)
+            break; // slot reused by a newer position
+          cand = nx;
+        }
+        prev[pos & WINDOW_MASK] = head[h];
+        head[h] = (int)pos;
+      }
+      if (best >= MIN_MATCH) {
+        syms[nsyms].lit = (unsigned short)best;
+        syms[nsyms++].dist = (unsigned short)bestDist;
+        // long runs are left out of the hash chains, as zlib's fast levels do
+        size_t end = pos + (size_t)best;
+        size_t stop = best <= 32 ? end : pos + 1;
+        for (size_t q = pos + 1; q < stop && q + MIN_MATCH <= n; q++) {
+          unsigned h = Hash4(src + q);
+          prev[q & WINDOW_MASK] = head[h];
+          head[h] = (int)q;
+        }
+        pos = end;
+      } else {
+        syms[nsyms].lit = src[pos++];
+        syms[nsyms++].dist = 0;
+      }
+      if (nsyms == BLOCK_SYMBOLS) {
+        PutBlock(&b, syms, nsyms, src + blockStart, pos - blockStart,
+                 final && pos == n);
+        blockStart = pos;
+        nsyms = 0;
+      }
+    }
+    if (nsyms)
+      PutBlock(&b, syms, nsyms, src + blockStart, pos - blockStart, final);
+    else if (final && n == 0)
+      PutStored(&b, src, 0, 1);
+  }
+  free(head);
+  free(prev);
+  free(syms);
+  if (!final) {
+    // sync flush: empty stored block, leaves the stream byte-aligned
+    Put(&b, 0, 3);
+    Align(&b);
+    Put(&b, 0, 16);
+    Put(&b, 0xFFFF, 16);
+  }
+  Align(&b);
+  return b.pos;
+}
+
+// --- Decoder ---
+// Codes of up to INF_FAST bits resolve with one table lookup; longer ones
+// (rare: they need a skewed tree) walk the canonical code a bit at a time.
+
+#define INF_FAST 10
+
+typedef struct {
+  unsigned short fast[1 << INF_FAST]; // length << 9 | symbol, 0 if longer
+  short count[16];                    // codes of each length
+  short sym[288];                     // symbols in canonical order
+} INF_HUFF;
+
+typedef struct {
+  const unsigned char *p, *end;
+  unsigned long long bits; // LSB first
+  int nb;
+  size_t over; // zero bytes fed past the end
+} INF_BITS;
+
+static void Inf_Refill(INF_BITS *s) {
+  while (s->nb <= 56) {
+    if (s->p < s->end)
+      s->bits |= (unsigned long long)*s->p++ << s->nb;
+    else
+      s->over++;
+    s->nb += 8;
+  }
+}
+
+static unsigned Inf_Take(INF_BITS *s, int n) {
+  unsigned v = (unsigned)(s->bits & ((1ull << n) - 1));
+  s->bits >>= n;
+  s->nb -= n;
+  return v;
+}
+
+// Returns 0 for an over-subscribed set of lengths; incomplete ones are
+// allowed (a single distance code is).
+static int Inf_Build(INF_HUFF *h, const unsigned char *len, int n) {
+  short offs[16];
+  memset(h->count, 0, sizeof(h->count));
+  memset(h->fast, 0, sizeof(h->fast));
+  for (int i = 0; i < n; i++)
+    h->count[len[i]]++;
+  h->count[0] = 0;
+  int left = 1;
+  for (int l = 1; l < 16; l++) {
+    left = left * 2 - h->count[l];
+    if (left < 0)
+      return 0;
+  }
+  offs[1] = 0;
+  for (int l = 1; l < 15; l++)
+    offs[l + 1] = (short)(offs[l] + h->count[l]);
+  for (int i = 0; i < n; i++)
+    if (len[i])
+      h->sym[offs[len[i]]++] = (short)i;
+  // canonical codes, bit-reversed into the table
+  int code = 0, k = 0;
+  for (int l = 1; l <= INF_FAST; l++, code <<= 1)
+    for (int c = 0; c < h->count[l]; c++, code++, k++) {
+      unsigned rev = 0;
+      for (int b = 0; b < l; b++)
+        rev |= ((unsigned)(code >> b) & 1) << (l - 1 - b);
+      for (unsigned j = rev; j < (1u << INF_FAST); j += 1u << l)
+        h->fast[j] = (unsigned short)(l << 9 | h->sym[k]);
+    }
+  return 1;
+}
+
+// Needs at least 15 bits buffered. Returns -1 for a code not in the tree.
+static int Inf_Decode(INF_BITS *s, const INF_HUFF *h) {
+  unsigned e = h->fast[s->bits & ((1u << INF_FAST) - 1)];
+  if (e) {
+    Inf_Take(s, (int)(e >> 9));
+    return (int)(e & 511);
+  }
+  int code = 0, first = 0, index = 0;
+  for (int l = 1; l < 16; l++) {
+    code |= (int)((s->bits >> (l - 1)) & 1);
+    int count = h->count[l];
+    if (code - count < first) {
+      Inf_Take(s, l);
+      return h->sym[index + (code - first)];
+    }
+    index += count;
+    first = (first + count) << 1;
+    code <<= 1;
+  }
+  return -1;
+}
+
+static int Inf_Dynamic(INF_BITS *s, INF_HUFF *lit, INF_HUFF *dist) {
+  unsigned char lens[320], cl[19] = {0};
+  Inf_Refill(s);
+  int nlit = (int)Inf_Take(s, 5) + 257, ndist = (int)Inf_Take(s, 5) + 1;
+  int ncl = (int)Inf_Take(s, 4) + 4;
+  if (nlit > 286 || ndist > 30)
+    return 0;
+  for (int i = 0; i < ncl; i++) {
+    Inf_Refill(s);
+    cl[kClOrder[i]] = (unsigned char)Inf_Take(s, 3);
+  }
+  if (!Inf_Build(lit, cl, 19))
+    return 0;
+  for (int i = 0; i < nlit + ndist;) {
+    Inf_Refill(s);
+    int sym = Inf_Decode(s, lit), rep = 0, v = 0;
+    if (sym < 0)
+      return 0;
+    if (sym < 16) {
+      lens[i++] = (unsigned char)sym;
+      continue;
+    }
+    if (sym == 16) {
+      if (!i)
+        return 0;
+      v = lens[i - 1];
+      rep = 3 + (int)Inf_Take(s, 2);
+    } else if (sym == 17) {
+      rep = 3 + (int)Inf_Take(s, 3);
+    } else {
+      rep = 11 + (int)Inf_Take(s, 7);
+    }
+    if (i + rep > nlit + ndist)
+      return 0;
+    while (rep--)
+      lens[i++] = (unsigned char)v;
+  }
+  if (!lens[256])
+    return 0;
+  return Inf_Build(lit, lens, nlit) && Inf_Build(dist, lens + nlit, ndist);
+}
+
+static void Inf_Fixed(INF_HUFF *lit, INF_HUFF *dist) {
+  unsigned char lens[288];
+  for (int i = 0; i < 288; i++)
+    lens[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+  Inf_Build(lit, lens, 288);
+  for (int i = 0; i < 30; i++)
+    lens[i] = 5;
+  Inf_Build(dist, lens, 30);
+}
+
+size_t Inflate(const unsigned char *src, size_t n, unsigned char *dst,
+               size_t cap) {
+  INF_BITS s = {src, src + n, 0, 0, 0};
+  INF_HUFF *h = (INF_HUFF *)malloc(2 * sizeof(INF_HUFF));
+  if (!h)
+    return (size_t)-1;
+  INF_HUFF *lit = &h[0], *dist = &h[1];
+  size_t pos = 0;
+  int final = 0;
+  while (!final) {
+    Inf_Refill(&s);
+    final = (int)Inf_Take(&s, 1);
+    int type = (int)Inf_Take(&s, 2);
+    if (type == 0) {
+      // back to whole bytes: hand the buffered ones back to the pointer
+      Inf_Take(&s, s.nb & 7);
+      if ((size_t)(s.nb >> 3) < s.over)
+        goto bad;
+      s.p -= (size_t)(s.nb >> 3) - s.over;
+      s.bits = 0;
+      s.nb = 0;
+      s.over = 0;
+      if (s.end - s.p < 4)
+        goto bad;
+      unsigned len = s.p[0] | (unsigned)s.p[1] << 8;
+      unsigned nlen = s.p[2] | (unsigned)s.p[3] << 8;
+      s.p += 4;
+      if ((len ^ 0xFFFF) != nlen || (size_t)(s.end - s.p) < len ||
+          cap - pos < len)
+        goto bad;
+      memcpy(dst + pos, s.p, len);
+      s.p += len;
+      pos += len;
+      continue;
+    }
+    if (type == 1)
+      Inf_Fixed(lit, dist);
+    else if (type != 2 || !Inf_Dynamic(&s, lit, dist))
+      goto bad;
+    for (;;) {
+      Inf_Refill(&s);
+      int sym = Inf_Decode(&s, lit);
+      if (sym < 256) {
+        if (sym < 0 || pos == cap)
+          goto bad;
+        dst[pos++] = (unsigned char)sym;
+        continue;
+      }
+      if (sym == 256)
+        break;
+      sym -= 257;
+      if (sym >= 29)
+        goto bad;
+      size_t len = kLenBase[sym] + Inf_Take(&s, kLenExtra[sym]);
+      int d = Inf_Decode(&s, dist);
+      if (d < 0 || d >= 30)
+        goto bad;
+      Inf_Refill(&s);
+      size_t back = kDistBase[d] + Inf_Take(&s, kDistExtra[d]);
+      if (back > pos || cap - pos < len)
+        goto bad;
+      unsigned char *o = dst + pos;
+      const unsigned char *from = o - back;
+      if (len <= back)
+        memcpy(o, from, len);
+      else
+        for (size_t i = 0; i < len; i++) // overlapping: repeats the run
+          o[i] = from[i];
+      pos += len;
+    }
+    if ((size_t)(s.nb >> 3) < s.over)
+      goto bad; // read past the end
+  }
+  free(h);
+  return pos;
+bad:
+  free(h);
+  return (size_t)-1;
+}
+
+#define ADLER_MOD 65521u
+
+unsigned long Adler32(unsigned long adler, const unsigned char *p, size_t n) {
+  unsigned long a = adler & 0xFFFF, s = (adler >> 16) & 0xFFFF;
+  while (n) {
+    size_t k = n < 5552 ? n : 5552; // largest run without overflow
+    n -= k;
+    while (k--) {
+      a += *p++;
+      s += a;
+    }
+    a %= ADLER_MOD;
+    s %= ADLER_MOD;
+  }
+  return (s << 16) | a;
+}
+
+unsigned long Adler32_Combine(unsigned long a, unsigned long b, size_t lenB) {
+  unsigned long rem = (unsigned long)(lenB % ADLER_MOD);
+  unsigned long a1 = a & 0xFFFF, s1 = (a >> 16) & 0xFFFF;
+  unsigned long a2 = b & 0xFFFF, s2 = (b >> 16) & 0xFFFF;
+  unsigned long sum1 = a1 + a2 + ADLER_MOD - 1;
+  unsigned long sum2 = (rem * a1) % ADLER_MOD + s1 + s2 + ADLER_MOD - rem;
+  sum1 %= ADLER_MOD;
+  sum2 %= ADLER_MOD;
+  return (sum2 << 16) | sum1;
+}
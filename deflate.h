@@ -0,0 +1,31 @@
+#ifndef SCREENSHOT_DEFLATE_H
+#define SCREENSHOT_DEFLATE_H
+
+#include <stddef.h>
+
+// Raw DEFLATE (RFC 1951) encoder for the PNG writer: hash-chain LZ77 and
+// dynamic Huffman blocks, falling back to stored blocks where those are
+// smaller. Each call is an independent stream piece: a non-final piece ends
+// byte-aligned with an empty stored block (a zlib "sync flush"), so pieces
+// compressed on different threads can simply be concatenated, with only the
+// last one final. The decoder is for reading PNGs back (`screenshot diff`).
+
+// Worst-case output size for n input bytes.
+size_t Deflate_Bound(size_t n);
+
+// Compresses n bytes into dst (Deflate_Bound(n) bytes). Returns the size.
+size_t Deflate_Compress(const unsigned char *src, size_t n, unsigned char *dst,
+                        int final);
+
+// Decompresses a raw DEFLATE stream into dst, which must hold all of it.
+// Returns the number of bytes written, or (size_t)-1 on bad data or if dst
+// is too small.
+size_t Inflate(const unsigned char *src, size_t n, unsigned char *dst,
+               size_t cap);
+
+// zlib's Adler-32 (start with 1), and the checksum of A followed by B from
+// the checksums of both and the length of B.
+unsigned long Adler32(unsigned long adler, const unsigned char *p, size_t n);
+unsigned long Adler32_Combine(unsigned long a, unsigned long b, size_t lenB);
+
+#endif
@@ -0,0 +1,583 @@
+#include "diff.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "batch.h"
+#include "export.h"
+#include "png.h"
+#include "qoi.h"
+#include "raw.h"
+
+#ifdef PLATFORM_X86
+#include <emmintrin.h>
+#endif
+
+#define HIGHLIGHT_GRAIN 16 // rows per Par_For chunk
+
+// Per 4-bit pixel mask: how many, the first and the last.
+static const unsigned char kCount[16] = {0, 1, 1, 2, 1, 2, 2, 3,
+                                         1, 2, 2, 3, 2, 3, 3, 4};
+static const unsigned char kFirst[16] = {0, 0, 1, 0, 2, 0, 1, 0,
+                                         3, 0, 1, 0, 2, 0, 1, 0};
+static const unsigned char kLast[16] = {0, 0, 1, 1, 2, 2, 2, 2,
+                                        3, 3, 3, 3, 3, 3, 3, 3};
+
+static int Diff_Min(int a, int b) { return a < b ? a : b; }
+static int Diff_Max(int a, int b) { return a > b ? a : b; }
+
+static int Diff_Pixel(const unsigned char *a, const unsigned char *b,
+                      int threshold) {
+  for (int c = 0; c < 3; c++)
+    if (abs(a[c] - b[c]) > threshold)
+      return 1;
+  return 0;
+}
+
+// Changed pixels among the n of rows a and b. *first and *last get the
+// index of the first and last one, and are left alone if there are none.
+static int Diff_Run(const unsigned char *a, const unsigned char *b, int n,
+                    int threshold, int *first, int *last) {
+  int count = 0, f = -1, l = -1, i = 0;
+#ifdef PLATFORM_X86
+  const __m128i color = _mm_set1_epi32(0x00FFFFFF);
+  const __m128i t = _mm_set1_epi8((char)threshold), zero = _mm_setzero_si128();
+  for (; i + 4 <= n; i += 4) {
+    __m128i va = _mm_loadu_si128((const __m128i *)(a + (size_t)i * 4));
+    __m128i vb = _mm_loadu_si128((const __m128i *)(b + (size_t)i * 4));
+    // |a - b| per byte, then what exceeds the threshold, alpha masked off
+    __m128i d = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+    d = _mm_and_si128(_mm_subs_epu8(d, t), color);
+    int m = ~_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(d, zero))) & 15;
+    if (m) {
+      count += kCount[m];
+      if (f < 0)
+        f = i + kFirst[m];
+      l = i + kLast[m];
+    }
+  }
+#endif
+  for (; i < n; i++)
+    if (Diff_Pixel(a + (size_t)i * 4, b + (size_t)i * 4, threshold)) {
+      count++;
+      if (f < 0)
+        f = i;
+      l = i;
+    }
+  if (count) {
+    *first = f;
+    *last = l;
+  }
+  return count;
+}
+
+typedef struct {
+  DIFF *d;
+  const IMAGE *a, *b;
+} DIFF_JOB;
+
+static void Diff_Bands(void *ctx, int begin, int end) {
+  const DIFF_JOB *j = (const DIFF_JOB *)ctx;
+  DIFF *d = j->d;
+  for (int ty = begin; ty < end; ty++) {
+    DIFF_CELL *cell = d->cell + (size_t)ty * d->cols;
+    for (int c = 0; c < d->cols; c++)
+      cell[c] = (DIFF_CELL){{INT_MAX, INT_MAX, INT_MIN, INT_MIN}, 0, 0};
+    int y1 = Diff_Min((ty + 1) * DIFF_TILE, d->h);
+    for (int y = ty * DIFF_TILE; y < y1; y++) {
+      const unsigned char *ra = y < j->a->h ? IMAGE_ROW(j->a, y) : NULL;
+      const unsigned char *rb = IMAGE_ROW(j->b, y);
+      int cw = ra ? Diff_Min(j->a->w, d->w) : 0; // width a also covers
+      if (cw == d->w && !memcmp(ra, rb, (size_t)cw * 4))
+        continue;
+      for (int c = 0; c < d->cols; c++) {
+        DIFF_CELL *e = &cell[c];
+        int x0 = c * DIFF_TILE, x1 = Diff_Min(x0 + DIFF_TILE, d->w);
+        int n = Diff_Min(x1, cw) - x0, count = 0, f = 0, l = 0;
+        size_t at = (size_t)x0 * 4;
+        if (n > 0 && memcmp(ra + at, rb + at, (size_t)n * 4)) {
+          e->touched = 1;
+          count = Diff_Run(ra + at, rb + at, n, d->threshold, &f, &l);
+          f += x0;
+          l += x0;
+        }
+        if (x1 > x0 + Diff_Max(n, 0)) { // past a's right or bottom edge
+          if (!count)
+            f = x0 + Diff_Max(n, 0);
+          l = x1 - 1;
+          count += x1 - (x0 + Diff_Max(n, 0));
+          e->touched = 1;
+        }
+        if (!count)
+          continue;
+        e->pixels += (unsigned)count;
+        e->bounds.left = Diff_Min(e->bounds.left, f);
+        e->bounds.right = Diff_Max(e->bounds.right, l + 1);
+        e->bounds.top = Diff_Min(e->bounds.top, y);
+        e->bounds.bottom = y + 1;
+      }
+    }
+    for (int c = 0; c < d->cols; c++)
+      if (!cell[c].pixels)
+        cell[c].bounds = (IRECT){0, 0, 0, 0};
+  }
+}
+
+static int Diff_AddRegion(DIFF *d, const IRECT *r, unsigned long long px) {
+  if (d->n == d->cap) {
+    int cap = d->cap ? d->cap * 2 : 64;
+    DIFF_REGION *p =
+        (DIFF_REGION *)realloc(d->region, (size_t)cap * sizeof(*p));
+    if (!p)
+      return 0;
+    d->region = p;
+    d->cap = cap;
+  }
+  d->region[d->n++] = (DIFF_REGION){*r, px};
+  return 1;
+}
+
+// Connected changed tiles, flooded from each one not yet labelled.
+static int Diff_Merge(DIFF *d) {
+  size_t ntiles = (size_t)d->cols * d->rows;
+  int *stack = (int *)malloc(ntiles * sizeof(int));
+  unsigned char *seen = (unsigned char *)calloc(ntiles, 1);
+  int ok = stack && seen;
+  for (size_t i = 0; ok && i < ntiles; i++) {
+    if (seen[i] || !d->cell[i].pixels)
+      continue;
+    IRECT r = d->cell[i].bounds;
+    unsigned long long px = 0;
+    size_t top = 0;
+    stack[top++] = (int)i;
+    seen[i] = 1;
+    while (top) {
+      int t = stack[--top], tx = t % d->cols, ty = t / d->cols;
+      IRect_Union(&r, &d->cell[t].bounds, &r);
+      px += d->cell[t].pixels;
+      int y1 = Diff_Min(ty + 1, d->rows - 1);
+      int x1 = Diff_Min(tx + 1, d->cols - 1);
+      for (int ny = Diff_Max(ty - 1, 0); ny <= y1; ny++)
+        for (int nx = Diff_Max(tx - 1, 0); nx <= x1; nx++) {
+          int k = ny * d->cols + nx;
+          if (!seen[k] && d->cell[k].pixels) {
+            seen[k] = 1;
+            stack[top++] = k;
+          }
+        }
+    }
+    ok = Diff_AddRegion(d, &r, px);
+  }
+  free(stack);
+  free(seen);
+  // an L-shaped region's rect can cover another one
+  for (int merged = 1; ok && merged;) {
+    merged = 0;
+    for (int i = 0; i < d->n; i++)
+      for (int k = i + 1; k < d->n; k++) {
+        IRECT o;
+        if (!IRect_Intersect(&d->region[i].rect, &d->region[k].rect, &o))
+          continue;
+        IRect_Union(&d->region[i].rect, &d->region[k].rect,
+                    &d->region[i].rect);
+        d->region[i].pixels += d->region[k].pixels;
+        d->region[k--] = d->region[--d->n];
+        merged = 1;
+      }
+  }
+  return ok;
+}
+
+int Diff_Compare(DIFF *d, const IMAGE *a, const IMAGE *b, int threshold) {
+  long long t0 = Clock_Ns();
+  int cols = (b->w + DIFF_TILE - 1) / DIFF_TILE;
+  int rows = (b->h + DIFF_TILE - 1) / DIFF_TILE;
+  if (cols * rows > d->cols * d->rows || !d->cell) {
+    free(d->cell);
+    d->cell = (DIFF_CELL *)malloc((size_t)cols * rows * sizeof(DIFF_CELL));
+  }
+  d->n = 0;
+  memset(&d->stats, 0, sizeof(d->stats));
+  d->w = b->w;
+  d->h = b->h;
+  d->threshold = Diff_Max(0, Diff_Min(threshold, 255));
+  d->cols = d->cell ? cols : 0;
+  d->rows = d->cell ? rows : 0;
+  if (!d->cell)
+    return 0;
+  DIFF_JOB j = {d, a, b};
+  Par_For(rows, 1, Diff_Bands, &j);
+  DIFF_STATS *st = &d->stats;
+  st->tiles = cols * rows;
+  for (int i = 0; i < st->tiles; i++) {
+    st->identical += !d->cell[i].touched;
+    st->changed += d->cell[i].pixels != 0;
+    st->pixels += d->cell[i].pixels;
+  }
+  long long t1 = Clock_Ns();
+  st->compareNs = t1 - t0;
+  int ok = Diff_Merge(d);
+  st->mergeNs = Clock_Ns() - t1;
+  return ok;
+}
+
+typedef struct {
+  const DIFF *d;
+  const IMAGE *a, *b;
+  IMAGE *out;
+} HIGHLIGHT_JOB;
+
+// n pixels halfway to white.
+static void WashOut(const unsigned char *s, unsigned char *o, int n) {
+  int i = 0;
+#ifdef PLATFORM_X86
+  const __m128i white = _mm_set1_epi8((char)0xFF);
+  const __m128i opaque = _mm_set1_epi32((int)0xFF000000u);
+  for (; i + 4 <= n; i += 4) {
+    __m128i p = _mm_loadu_si128((const __m128i *)(s + (size_t)i * 4));
+    _mm_storeu_si128((__m128i *)(o + (size_t)i * 4),
+                     _mm_or_si128(_mm_avg_epu8(p, white), opaque));
+  }
+#endif
+  for (; i < n; i++) {
+    unsigned p = ((const unsigned *)s)[i];
+    ((unsigned *)o)[i] = 0xFF000000u | (((p >> 1) & 0x7F7F7F) + 0x808080);
+  }
+}
+
+static void Highlight_Rows(void *ctx, int begin, int end) {
+  const HIGHLIGHT_JOB *j = (const HIGHLIGHT_JOB *)ctx;
+  const DIFF *d = j->d;
+  for (int y = begin; y < end; y++) {
+    const unsigned char *rb = IMAGE_ROW(j->b, y);
+    const unsigned char *ra = y < j->a->h ? IMAGE_ROW(j->a, y) : NULL;
+    unsigned char *ro = IMAGE_ROW(j->out, y);
+    int cw = ra ? Diff_Min(j->a->w, d->w) : 0;
+    const DIFF_CELL *cell = d->cell + (size_t)(y / DIFF_TILE) * d->cols;
+    for (int c = 0; c < d->cols; c++) {
+      int x0 = c * DIFF_TILE, x1 = Diff_Min(x0 + DIFF_TILE, d->w);
+      WashOut(rb + (size_t)x0 * 4, ro + (size_t)x0 * 4, x1 - x0);
+      if (!cell[c].pixels)
+        continue;
+      unsigned *o = (unsigned *)ro;
+      for (int x = x0; x < x1; x++)
+        if (x >= cw || Diff_Pixel(ra + (size_t)x * 4, rb + (size_t)x * 4,
+                                  d->threshold)) {
+          // three quarters DIFF_COLOR over the original
+          unsigned p = ((const unsigned *)rb)[x], k = DIFF_COLOR;
+          unsigned half = ((p >> 1) & 0x7F7F7F) + ((k >> 1) & 0x7F7F7F);
+          o[x] = 0xFF000000u | (((half >> 1) & 0x7F7F7F) +
+                                ((k >> 1) & 0x7F7F7F));
+        }
+    }
+  }
+}
+
+int Diff_Highlight(const DIFF *d, const IMAGE *a, const IMAGE *b,
+                   IMAGE *out) {
+  if (!Image_Alloc(out, d->w, d->h))
+    return 0;
+  HIGHLIGHT_JOB j = {d, a, b, out};
+  Par_For(d->h, HIGHLIGHT_GRAIN, Highlight_Rows, &j);
+  IRECT all = {0, 0, out->w, out->h};
+  Diff_DrawOutlines(d, out, &all);
+  return 1;
+}
+
+static void Diff_Fill(IMAGE *dst, const IRECT *rect, const IRECT *clip) {
+  IRECT r;
+  if (!IRect_Intersect(rect, clip, &r))
+    return;
+  for (int y = r.top; y < r.bottom; y++) {
+    unsigned *p = (unsigned *)IMAGE_ROW(dst, y);
+    for (int x = r.left; x < r.right; x++)
+      p[x] = DIFF_COLOR;
+  }
+}
+
+void Diff_DrawOutlines(const DIFF *d, IMAGE *dst, const IRECT *clip) {
+  const int o = DIFF_OUTLINE;
+  for (int i = 0; i < d->n; i++) {
+    const IRECT *r = &d->region[i].rect;
+    IRECT edges[4] = {
+        {r->left - o, r->top - o, r->right + o, r->top},
+        {r->left - o, r->bottom, r->right + o, r->bottom + o},
+        {r->left - o, r->top, r->left, r->bottom},
+        {r->right, r->top, r->right + o, r->bottom}};
+    for (int k = 0; k < 4; k++)
+      Diff_Fill(dst, &edges[k], clip);
+  }
+}
+
+void Diff_Free(DIFF *d) {
+  free(d->cell);
+  free(d->region);
+  memset(d, 0, sizeof(*d));
+}
+
+// --- `screenshot diff` ---
+
+static unsigned char *Diff_Slurp(const char *path, size_t *n) {
+  FILE *f = File_Open(path, "rb");
+  if (!f)
+    return NULL;
+  size_t cap = 1 << 20, len = 0, got;
+  unsigned char *buf = (unsigned char *)malloc(cap);
+  while (buf && (got = fread(buf + len, 1, cap - len, f)) > 0) {
+    len += got;
+    unsigned char *p =
+        len < cap ? buf : (unsigned char *)realloc(buf, cap *= 2);
+    if (!p)
+      free(buf);
+    buf = p;
+  }
+  if (buf && ferror(f)) {
+    free(buf);
+    buf = NULL;
+  }
+  fclose(f);
+  *n = len;
+  return buf;
+}
+
+static unsigned GetLE32(const unsigned char *p) {
+  return p[0] | (unsigned)p[1] << 8 | (unsigned)p[2] << 16 |
+         (unsigned)p[3] << 24;
+}
+
+static int Raw_Decode(const unsigned char *p, size_t n, IMAGE *out) {
+  if (n < RAW_HEADER || memcmp(p, "BGRA", 4))
+    return 0;
+  unsigned w = GetLE32(p + 4), h = GetLE32(p + 8), stride = GetLE32(p + 12);
+  if (!w || !h || w > 0x7FFF || h > 0x7FFF || stride < w * 4 ||
+      (size_t)(h - 1) * stride + w * 4 > n - RAW_HEADER ||
+      !Image_Alloc(out, (int)w, (int)h))
+    return 0;
+  for (unsigned y = 0; y < h; y++)
+    memcpy(IMAGE_ROW(out, y), p + RAW_HEADER + (size_t)y * stride,
+           (size_t)w * 4);
+  return 1;
+}
+
+// PNG, QOI or raw, by content.
+static int Diff_Load(const char *path, IMAGE *out) {
+  size_t n;
+  unsigned char *data = Diff_Slurp(path, &n);
+  if (!data)
+    return 0;
+  int ok = Png_Decode(data, n, out) || Qoi_Decode(data, n, out) ||
+           Raw_Decode(data, n, out);
+  free(data);
+  return ok;
+}
+
+typedef struct {
+  const char *path[2], *out, *report;
+  IMAGE img[2];
+  DIFF d;
+  long long loadNs, highlightNs, writeNs;
+  EXPORT_STATS stats;
+} DIFF_RUN;
+
+static int Diff_Report(const DIFF_RUN *r) {
+  FILE *f = r->report ? File_Open(r->report, "wb") : stdout;
+  if (!f)
+    return 0;
+  const DIFF *d = &r->d;
+  const DIFF_STATS *st = &d->stats;
+  int same = r->img[0].w == r->img[1].w && r->img[0].h == r->img[1].h;
+  fprintf(f, "{\n  \"identical\": %s,\n",
+          same && !st->pixels ? "true" : "false");
+  for (int i = 0; i < 2; i++) {
+    fprintf(f, "  \"%c\": {\"path\": ", 'a' + i);
+    Json_String(f, r->path[i]);
+    fprintf(f, ", \"w\": %d, \"h\": %d},\n", r->img[i].w, r->img[i].h);
+  }
+  fprintf(f,
+          "  \"threshold\": %d,\n  \"threads\": %d,\n  \"tiles\": %d,\n"
+          "  \"tiles_identical\": %d,\n  \"tiles_changed\": %d,\n"
+          "  \"changed_pixels\": %llu,\n  \"load_ms\": %.3f,\n"
+          "  \"compare_ms\": %.3f,\n  \"merge_ms\": %.3f,\n  \"out\": ",
+          d->threshold, Cpu_Count(), st->tiles, st->identical, st->changed,
+          st->pixels, r->loadNs / 1e6, st->compareNs / 1e6,
+          st->mergeNs / 1e6);
+  Json_String(f, r->out);
+  fprintf(f,
+          ",\n  \"highlight_ms\": %.3f,\n  \"write_ms\": %.3f,\n"
+          "  \"regions\": [",
+          r->highlightNs / 1e6, r->writeNs / 1e6);
+  for (int i = 0; i < d->n; i++) {
+    const IRECT *g = &d->region[i].rect;
+    fprintf(f,
+            "%s\n    {\"x\": %d, \"y\": %d, \"w\": %d, \"h\": %d, "
+            "\"pixels\": %llu}",
+            i ? "," : "", g->left, g->top, g->right - g->left,
+            g->bottom - g->top, d->region[i].pixels);
+  }
+  fprintf(f, "%s]\n}\n", d->n ? "\n  " : "");
+  int ok = !ferror(f);
+  if (f == stdout)
+    ok = fflush(f) == 0 && ok;
+  else
+    ok = fclose(f) == 0 && ok;
+  return ok;
+}
+
+static int Diff_WriteOut(DIFF_RUN *r, EXPORT_FORMAT fmt) {
+  IMAGE hi;
+  long long t0 = Clock_Ns();
+  if (!Diff_Highlight(&r->d, &r->img[0], &r->img[1], &hi))
+    return 0;
+  long long t1 = Clock_Ns();
+  r->highlightNs = t1 - t0;
+  FILE *f = File_Open(r->out, "wb");
+  int ok = f && Export_Write(f, &hi, fmt, &r->stats);
+  if (f)
+    ok = fclose(f) == 0 && ok;
+  r->writeNs = Clock_Ns() - t1;
+  Image_Free(&hi);
+  return ok;
+}
+
+int Diff_Main(int argc, char **argv) {
+  DIFF_RUN r;
+  memset(&r, 0, sizeof(r));
+  EXPORT_FORMAT fmt = Export_Format();
+  int threshold = 0, files = 0, formatSet = 0;
+  for (int i = 0; i < argc; i++) {
+    const char *arg = argv[i], *val = i + 1 < argc ? argv[i + 1] : NULL;
+    if (arg[0] != '-' || !arg[1]) {
+      if (files == 2)
+        goto usage;
+      r.path[files++] = arg;
+      continue;
+    }
+    if (!val)
+      goto usage;
+    i++;
+    int ok = 1;
+    if (!strcmp(arg, "--threshold")) {
+      char *e;
+      long t = strtol(val, &e, 10);
+      ok = e != val && !*e && t >= 0 && t <= 255;
+      threshold = (int)t;
+    } else if (!strcmp(arg, "--out")) {
+      r.out = val;
+    } else if (!strcmp(arg, "--report")) {
+      r.report = val;
+    } else if (!strcmp(arg, "--format")) {
+      ok = Export_ParseFormat(val, &fmt);
+      formatSet = 1;
+    } else {
+      ok = 0;
+    }
+    if (!ok)
+      goto usage;
+  }
+  if (files != 2)
+    goto usage;
+  if (r.out && !formatSet) {
+    const char *dot = strrchr(r.out, '.');
+    if (dot && !strpbrk(dot, "/\\"))
+      Export_ParseFormat(dot + 1, &fmt);
+  }
+
+  int status = 2;
+  long long t0 = Clock_Ns();
+  for (int i = 0; i < 2; i++)
+    if (!Diff_Load(r.path[i], &r.img[i])) {
+      fprintf(stderr, "screenshot diff: cannot read %s as PNG, QOI or raw\n",
+              r.path[i]);
+      goto done;
+    }
+  r.loadNs = Clock_Ns() - t0;
+  if (!Diff_Compare(&r.d, &r.img[0], &r.img[1], threshold)) {
+    fprintf(stderr, "screenshot diff: out of memory\n");
+    goto done;
+  }
+  if (r.out && !Diff_WriteOut(&r, fmt)) {
+    fprintf(stderr, "screenshot diff: cannot write %s\n", r.out);
+    goto done;
+  }
+  if (!Diff_Report(&r)) {
+    fprintf(stderr, "screenshot diff: cannot write the report\n");
+    goto done;
+  }
+  status = r.d.stats.pixels || r.img[0].w != r.img[1].w ||
+                   r.img[0].h != r.img[1].h
+               ? 1
+               : 0;
+done:
+  Image_Free(&r.img[0]);
+  Image_Free(&r.img[1]);
+  Diff_Free(&r.d);
+  return status;
+usage:
+  fprintf(stderr, "usage: screenshot diff [--threshold N] [--out file] "
+                  "[--format png|qoi|raw]\n"
+                  "                       [--report file] a b\n");
+  return 2;
+}
+
+// --- Previous capture ---
+
+static void Keep_Copy(DIFF_KEEP *k, const FRAMEBUFFER *fb) {
+  long long t0 = Clock_Ns();
+  size_t bytes = (size_t)fb->w * fb->h * 4;
+  if (bytes > k->cap || bytes > DIFF_KEEP_MAX_BYTES) {
+    Image_Free(&k->img);
+    k->cap = 0;
+    if (bytes > DIFF_KEEP_MAX_BYTES || !Image_Alloc(&k->img, fb->w, fb->h))
+      return;
+    k->cap = bytes;
+  }
+  k->img.w = fb->w;
+  k->img.h = fb->h;
+  k->img.stride = fb->w * 4;
+  size_t covered = 0;
+  for (int i = 0; i < fb->ntiles; i++) {
+    const IRECT *a = &fb->tiles[i].area;
+    covered += (size_t)(a->right - a->left) * (size_t)(a->bottom - a->top);
+  }
+  if (covered < (size_t)fb->w * fb->h)
+    for (int y = 0; y < fb->h; y++) {
+      unsigned *p = (unsigned *)IMAGE_ROW(&k->img, y);
+      for (int x = 0; x < fb->w; x++)
+        p[x] = 0xFF000000u;
+    }
+  for (int i = 0; i < fb->ntiles; i++) {
+    const FB_TILE *t = &fb->tiles[i];
+    int w = t->area.right - t->area.left;
+    for (int y = t->area.top; y < t->area.bottom; y++)
+      memcpy(IMAGE_ROW(&k->img, y) + (size_t)t->area.left * 4,
+             IMAGE_ROW(&t->capture, y - t->area.top), (size_t)w * 4);
+  }
+  k->copyNs = Clock_Ns() - t0;
+}
+
+static void Keep_Worker(void *arg) {
+  DIFF_KEEP *k = (DIFF_KEEP *)arg;
+  Keep_Copy(k, k->fb);
+}
+
+void Diff_KeepAsync(DIFF_KEEP *k, const FRAMEBUFFER *fb) {
+  Diff_KeepWait(k);
+  k->fb = fb;
+  k->threaded = Thread_Start(&k->thread, Keep_Worker, k);
+  if (!k->threaded)
+    Keep_Copy(k, fb);
+}
+
+void Diff_KeepWait(DIFF_KEEP *k) {
+  if (k->threaded)
+    Thread_Join(k->thread);
+  k->threaded = 0;
+  k->fb = NULL;
+}
+
+void Diff_KeepFree(DIFF_KEEP *k) {
+  Diff_KeepWait(k);
+  Image_Free(&k->img);
+  memset(k, 0, sizeof(*k));
+}
@@ -0,0 +1,92 @@
+#ifndef SCREENSHOT_DIFF_H
+#define SCREENSHOT_DIFF_H
+
+#include <stddef.h>
+
+#include "framebuffer.h"
+#include "image.h"
+#include "platform.h"
+
+// Visual diff of two captures: a pixel changed when any color channel
+// differs by more than a threshold (alpha is ignored). The frame is cut
+// into DIFF_TILE squares, one band of tiles per Par_For item. Rows that are
+// byte-identical are skipped with a memcmp, then each tile's slice of a row
+// is, so tiles that did not change cost one compare; the rest go through
+// the SIMD threshold kernel, which also finds their changed pixel bounds.
+// Changed tiles that touch (8-neighbours) form one region, whose rect is
+// the union of their bounds; regions whose rects overlap are merged.
+//
+// Used headless by `screenshot diff a b` and by the overlay ('d'), which
+// compares the frozen frame with a copy of the one before.
+
+#define DIFF_TILE 32
+#define DIFF_OUTLINE 2             // region frame width, drawn outside it
+#define DIFF_COLOR 0xFFFF00FFu     // BGRA magenta
+#define DIFF_KEEP_MAX_BYTES (128u << 20) // largest frame the overlay keeps
+
+typedef struct {
+  IRECT rect;
+  unsigned long long pixels; // changed ones inside it
+} DIFF_REGION;
+
+typedef struct {
+  IRECT bounds; // changed pixels, empty if none
+  unsigned pixels;
+  int touched; // some byte differs
+} DIFF_CELL;
+
+typedef struct {
+  int tiles, identical, changed; // all, byte-identical, with changed pixels
+  unsigned long long pixels;     // changed
+  long long compareNs, mergeNs;
+} DIFF_STATS;
+
+typedef struct {
+  int w, h, threshold; // of b; its pixels outside a count as changed
+  int cols, rows;
+  DIFF_CELL *cell;
+  DIFF_REGION *region;
+  int n, cap;
+  DIFF_STATS stats;
+} DIFF;
+
+// Compares b with a; threshold is 0 (any change) to 255. Returns 0 if out
+// of memory.
+int Diff_Compare(DIFF *d, const IMAGE *a, const IMAGE *b, int threshold);
+// b washed out toward white, its changed pixels tinted DIFF_COLOR and the
+// regions framed, as a new heap image.
+int Diff_Highlight(const DIFF *d, const IMAGE *a, const IMAGE *b,
+                   IMAGE *out);
+// Frames every region in DIFF_COLOR, only inside clip.
+void Diff_DrawOutlines(const DIFF *d, IMAGE *dst, const IRECT *clip);
+void Diff_Free(DIFF *d);
+
+// `screenshot diff [options] a b` (PNG, QOI or raw files): a JSON report
+// of the changed regions on stdout (or --report), and with --out the
+// highlighted image. Exits 0 if nothing changed, 1 if something did and 2
+// on bad arguments or unreadable files.
+int Diff_Main(int argc, char **argv);
+
+// --- Previous capture ---
+// The overlay copies each frozen frame (gaps between monitors black) on a
+// worker while it opens; the next session compares against that copy.
+// Frames over DIFF_KEEP_MAX_BYTES are not kept.
+
+typedef struct {
+  IMAGE img; // empty when nothing is kept
+  size_t cap;
+  long long copyNs;
+
+  // Diff_KeepAsync
+  const FRAMEBUFFER *fb;
+  THREAD thread;
+  int threaded;
+} DIFF_KEEP;
+
+// Copies the capture pixels of fb on a worker thread; they must stay until
+// Diff_KeepWait or Diff_KeepFree.
+void Diff_KeepAsync(DIFF_KEEP *k, const FRAMEBUFFER *fb);
+void Diff_KeepWait(DIFF_KEEP *k);
+void Diff_KeepFree(DIFF_KEEP *k);
+
+#endif
@@ -0,0 +1,111 @@
+#include "dim.h"
+
+#include "platform.h"
+
+#ifdef PLATFORM_X86
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+// round(c * m / 255) without a divide: x = c*m + 128; (x + (x >> 8)) >> 8.
+// Every intermediate fits in 16 bits, which is what the SIMD paths rely on.
+static void Dim_RowScalar(const unsigned char *s, unsigned char *d, int n,
+                          unsigned m) {
+  for (int i = 0; i < n; i++) {
+    unsigned x = s[i] * m + 128;
+    d[i] = (unsigned char)((x + (x >> 8)) >> 8);
+  }
+}
+
+#ifdef PLATFORM_X86
+static int Dim_RowSSE2(const unsigned char *s, unsigned char *d, int n,
+                       unsigned m) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i mul = _mm_set1_epi16((short)m);
+  const __m128i half = _mm_set1_epi16(128);
+  const __m128i opaque = _mm_set1_epi32((int)0xFF000000);
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+    __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(v, zero), mul),
+                               half);
+    __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(v, zero), mul),
+                               half);
+    lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+    hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+    _mm_storeu_si128((__m128i *)(d + i),
+                     _mm_or_si128(_mm_packus_epi16(lo, hi), opaque));
+  }
+  return i;
+}
+
+TARGET_AVX2
+static int Dim_RowAVX2(const unsigned char *s, unsigned char *d, int n,
+                       unsigned m) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i mul = _mm256_set1_epi16((short)m);
+  const __m256i half = _mm256_set1_epi16(128);
+  const __m256i opaque = _mm256_set1_epi32((int)0xFF000000);
+  int i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+    // unpack/pack both work per 128-bit lane, so byte order round-trips
+    __m256i lo = _mm256_add_epi16(
+        _mm256_mullo_epi16(_mm256_unpacklo_epi8(v, zero), mul), half);
+    __m256i hi = _mm256_add_epi16(
+        _mm256_mullo_epi16(_mm256_unpackhi_epi8(v, zero), mul), half);
+    lo = _mm256_srli_epi16(_mm256_add_epi16(lo, _mm256_srli_epi16(lo, 8)), 8);
+    hi = _mm256_srli_epi16(_mm256_add_epi16(hi, _mm256_srli_epi16(hi, 8)), 8);
+    _mm256_storeu_si256((__m256i *)(d + i),
+                        _mm256_or_si256(_mm256_packus_epi16(lo, hi), opaque));
+  }
+  return i;
+}
+#endif
+
+typedef struct {
+  const IMAGE *src;
+  IMAGE *dst;
+  unsigned m;
+  DIM_PATH path;
+} DIM_JOB;
+
+static void Dim_Rows(void *ctx, int y0, int y1) {
+  const DIM_JOB *j = (const DIM_JOB *)ctx;
+  int n = j->src->w * 4;
+  for (int y = y0; y < y1; y++) {
+    const unsigned char *s = IMAGE_ROW(j->src, y);
+    unsigned char *d = IMAGE_ROW(j->dst, y);
+    int done = 0;
+#ifdef PLATFORM_X86
+    if (j->path == DIM_AVX2)
+      done = Dim_RowAVX2(s, d, n, j->m);
+    else if (j->path == DIM_SSE2)
+      done = Dim_RowSSE2(s, d, n, j->m);
+#endif
+    Dim_RowScalar(s + done, d + done, n - done, j->m);
+    for (int x = done; x < n; x += 4)
+      d[x + 3] = 0xFF;
+  }
+}
+
+DIM_PATH Dim_BestPath(void) {
+#ifdef PLATFORM_X86
+  return Cpu_HasAVX2() ? DIM_AVX2 : DIM_SSE2;
+#else
+  return DIM_SCALAR;
+#endif
+}
+
+void Dim_Build(const IMAGE *src, IMAGE *dst, unsigned char alpha) {
+  Dim_BuildPath(src, dst, alpha, DIM_BEST);
+}
+
+void Dim_BuildPath(const IMAGE *src, IMAGE *dst, unsigned char alpha,
+                   DIM_PATH path) {
+  DIM_PATH best = Dim_BestPath();
+  DIM_JOB j = {src, dst, 255u - alpha, path > best ? best : path};
+  // ~256 KB of source per chunk keeps every core busy down to 1080p
+  int grain = src->w > 0 ? (65536 + src->w - 1) / src->w : 1;
+  Par_For(src->h, grain, Dim_Rows, &j);
+}
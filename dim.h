@@ -0,0 +1,20 @@
+#ifndef SCREENSHOT_DIM_H
+#define SCREENSHOT_DIM_H
+
+#include "image.h"
+
+// Writes src darkened as if black were blended over it with the given
+// constant alpha (the overlay's AlphaBlend), i.e. c * (255 - alpha) / 255.
+// dst must be at least src's size; the alpha byte is forced opaque.
+void Dim_Build(const IMAGE *src, IMAGE *dst, unsigned char alpha);
+
+// Kernels Dim_Build picks from; tests and benchmarks force one. A path the
+// CPU (or build) lacks falls back to the next simpler one.
+typedef enum { DIM_SCALAR, DIM_SSE2, DIM_AVX2, DIM_BEST } DIM_PATH;
+
+void Dim_BuildPath(const IMAGE *src, IMAGE *dst, unsigned char alpha,
+                   DIM_PATH path);
+// The path DIM_BEST resolves to on this machine.
+DIM_PATH Dim_BestPath(void);
+
+#endif
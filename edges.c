@@ -0,0 +1,378 @@
+#include "edges.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef PLATFORM_X86
+#include <emmintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#define EDGES_GRAIN 64 // rows per Par_For chunk
+#define EDGES_COL_GRAIN 8 // bit-plane words per chunk of the column passes
+
+static int Edges_Ctz(uint32_t v) {
+#ifdef _MSC_VER
+  unsigned long i;
+  _BitScanForward(&i, v);
+  return (int)i;
+#else
+  return __builtin_ctz(v);
+#endif
+}
+
+static int Edges_Count(uint32_t v) {
+  int n = 0;
+  for (; v; v &= v - 1)
+    n++;
+  return n;
+}
+
+int Edges_SnapDistance(void) {
+  const char *env = getenv("SCREENSHOT_SNAP");
+  int d = env ? atoi(env) : EDGE_SNAP;
+  return d < 0 ? 0 : d > 64 ? 64 : d;
+}
+
+// --- Gradient: one bit per pixel boundary ---
+
+static void Edges_SetBits(uint32_t *bits, int pos, unsigned mask) {
+  uint64_t v = (uint64_t)mask << (pos & 31);
+  bits[pos >> 5] |= (uint32_t)v;
+  if (v >> 32)
+    bits[(pos >> 5) + 1] |= (uint32_t)(v >> 32);
+}
+
+static int Edges_Loud(const unsigned char *a, const unsigned char *b) {
+  for (int c = 0; c < 3; c++) {
+    int d = a[c] > b[c] ? a[c] - b[c] : b[c] - a[c];
+    if (d > EDGE_THRESHOLD)
+      return 1;
+  }
+  return 0;
+}
+
+#ifdef PLATFORM_X86
+// All ones in the lanes of the 4 pixels where no color channel differs by
+// more than the threshold (alpha is ignored; X servers leave it undefined).
+static __m128i Edges_Quiet4(const unsigned char *a, const unsigned char *b) {
+  const __m128i thr = _mm_set1_epi8(EDGE_THRESHOLD);
+  const __m128i rgb = _mm_set1_epi32(0x00FFFFFF);
+  __m128i va = _mm_loadu_si128((const __m128i *)a);
+  __m128i vb = _mm_loadu_si128((const __m128i *)b);
+  __m128i d = _mm_and_si128(
+      _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va)), rgb);
+  __m128i q = _mm_cmpeq_epi8(_mm_subs_epu8(d, thr), _mm_setzero_si128());
+  return _mm_cmpeq_epi32(q, _mm_set1_epi32(-1));
+}
+#endif
+
+// Sets bit pos + i where pixel i of a and of b differ, for i < n.
+static void Edges_MarkRow(const unsigned char *a, const unsigned char *b,
+                          int n, uint32_t *bits, int pos) {
+  int i = 0;
+#ifdef PLATFORM_X86
+  for (; i + 16 <= n; i += 16) {
+    const unsigned char *pa = a + (size_t)i * 4, *pb = b + (size_t)i * 4;
+    __m128i q01 = _mm_packs_epi32(Edges_Quiet4(pa, pb),
+                                  Edges_Quiet4(pa + 16, pb + 16));
+    __m128i q23 = _mm_packs_epi32(Edges_Quiet4(pa + 32, pb + 32),
+                                  Edges_Quiet4(pa + 48, pb + 48));
+    unsigned loud = ~(unsigned)_mm_movemask_epi8(_mm_packs_epi16(q01, q23)) &
+                    0xFFFF;
+    if (loud)
+      Edges_SetBits(bits, pos + i, loud);
+  }
+#endif
+  for (; i < n; i++)
+    if (Edges_Loud(a + (size_t)i * 4, b + (size_t)i * 4))
+      Edges_SetBits(bits, pos + i, 1);
+}
+
+typedef struct {
+  const FB_TILE *t;
+  uint32_t *v, *hz; // vertical / horizontal edge planes
+  int words;
+} GRADIENT_JOB;
+
+static void Edges_GradientRows(void *ctx, int begin, int end) {
+  const GRADIENT_JOB *j = (const GRADIENT_JOB *)ctx;
+  const IMAGE *img = &j->t->capture;
+  int x0 = j->t->area.left;
+  for (int ty = begin; ty < end; ty++) {
+    size_t row = (size_t)(j->t->area.top + ty) * (size_t)j->words;
+    const unsigned char *p = IMAGE_ROW(img, ty);
+    Edges_MarkRow(p + 4, p, img->w - 1, j->v + row, x0 + 1);
+    if (ty > 0)
+      Edges_MarkRow(p, IMAGE_ROW(img, ty - 1), img->w, j->hz + row, x0);
+  }
+}
+
+// --- Runs: keep bits that belong to EDGE_MIN_RUN in a row ---
+// A run test is an AND over a window and its undo an OR over the same
+// window back; both go by doubling (1, 2, 4...), so EDGE_MIN_RUN must be a
+// power of two.
+
+typedef struct {
+  uint32_t *bits;
+  int words, h;
+} RUN_JOB;
+
+// Vertical runs, along columns: word columns [begin, end) of every row.
+static void Edges_ColumnRuns(void *ctx, int begin, int end) {
+  const RUN_JOB *j = (const RUN_JOB *)ctx;
+  size_t st = (size_t)j->words;
+  for (int s = 1; s < EDGE_MIN_RUN; s *= 2)
+    for (int y = 0; y < j->h; y++) {
+      uint32_t *r = j->bits + (size_t)y * st;
+      const uint32_t *dn = y + s < j->h ? r + (size_t)s * st : NULL;
+      for (int i = begin; i < end; i++)
+        r[i] &= dn ? dn[i] : 0;
+    }
+  for (int s = 1; s < EDGE_MIN_RUN; s *= 2)
+    for (int y = j->h - 1; y >= s; y--) {
+      uint32_t *r = j->bits + (size_t)y * st;
+      const uint32_t *up = r - (size_t)s * st;
+      for (int i = begin; i < end; i++)
+        r[i] |= up[i];
+    }
+}
+
+// Horizontal runs, along rows; bit b of word i is x = 32 i + b.
+static void Edges_RowRuns(void *ctx, int begin, int end) {
+  const RUN_JOB *j = (const RUN_JOB *)ctx;
+  int n = j->words;
+  for (int y = begin; y < end; y++) {
+    uint32_t *r = j->bits + (size_t)y * (size_t)n;
+    for (int s = 1; s < EDGE_MIN_RUN; s *= 2)
+      for (int i = 0; i < n; i++)
+        r[i] &= (r[i] >> s) | (i + 1 < n ? r[i + 1] << (32 - s) : 0);
+    for (int s = 1; s < EDGE_MIN_RUN; s *= 2)
+      for (int i = n - 1; i >= 0; i--)
+        r[i] |= (r[i] << s) | (i > 0 ? r[i - 1] >> (32 - s) : 0);
+  }
+}
+
+// --- Tables ---
+
+typedef struct {
+  const uint32_t *bits;
+  int words;
+  int *start, *pos;
+} ROW_TABLE_JOB;
+
+static void Edges_CountRows(void *ctx, int begin, int end) {
+  const ROW_TABLE_JOB *j = (const ROW_TABLE_JOB *)ctx;
+  for (int y = begin; y < end; y++) {
+    const uint32_t *r = j->bits + (size_t)y * (size_t)j->words;
+    int n = 0;
+    for (int i = 0; i < j->words; i++)
+      n += Edges_Count(r[i]);
+    j->start[y + 1] = n;
+  }
+}
+
+static void Edges_FillRows(void *ctx, int begin, int end) {
+  const ROW_TABLE_JOB *j = (const ROW_TABLE_JOB *)ctx;
+  for (int y = begin; y < end; y++) {
+    const uint32_t *r = j->bits + (size_t)y * (size_t)j->words;
+    int *out = j->pos + j->start[y];
+    for (int i = 0; i < j->words; i++)
+      for (uint32_t v = r[i]; v; v &= v - 1)
+        *out++ = i * 32 + Edges_Ctz(v);
+  }
+}
+
+// Per-row positions of the set bits. Returns 0 if out of memory or over
+// `limit` entries.
+static int Edges_RowTable(const uint32_t *bits, int words, int h,
+                          size_t limit, int **start, int **pos,
+                          size_t *count) {
+  *pos = NULL;
+  if (!(*start = (int *)calloc((size_t)h + 1, sizeof(int))))
+    return 0;
+  ROW_TABLE_JOB j = {bits, words, *start, NULL};
+  Par_For(h, EDGES_GRAIN, Edges_CountRows, &j);
+  size_t total = 0;
+  for (int y = 0; y < h; y++) {
+    total += (size_t)(*start)[y + 1];
+    if (total > limit)
+      return 0;
+    (*start)[y + 1] = (int)total;
+  }
+  *count = total;
+  if (!(*pos = (int *)malloc((total ? total : 1) * sizeof(int))))
+    return 0;
+  j.pos = *pos;
+  Par_For(h, EDGES_GRAIN, Edges_FillRows, &j);
+  return 1;
+}
+
+// Per-column positions: rows are visited top down, so each column comes out
+// sorted.
+static int Edges_ColumnTable(const uint32_t *bits, int words, int w, int h,
+                             size_t limit, int **start, int **pos,
+                             size_t *count) {
+  *pos = NULL;
+  if (!(*start = (int *)calloc((size_t)w + 1, sizeof(int))))
+    return 0;
+  int *s = *start;
+  size_t total = 0;
+  for (int y = 0; y < h; y++) {
+    const uint32_t *r = bits + (size_t)y * (size_t)words;
+    for (int i = 0; i < words; i++)
+      for (uint32_t v = r[i]; v; v &= v - 1) {
+        s[i * 32 + Edges_Ctz(v) + 1]++;
+        total++;
+      }
+  }
+  if (total > limit)
+    return 0;
+  for (int x = 0; x < w; x++)
+    s[x + 1] += s[x];
+  *count = total;
+  int *fill = (int *)malloc((size_t)w * sizeof(int));
+  if (!(*pos = (int *)malloc((total ? total : 1) * sizeof(int))) || !fill) {
+    free(fill);
+    return 0;
+  }
+  memcpy(fill, s, (size_t)w * sizeof(int));
+  for (int y = 0; y < h; y++) {
+    const uint32_t *r = bits + (size_t)y * (size_t)words;
+    for (int i = 0; i < words; i++)
+      for (uint32_t v = r[i]; v; v &= v - 1)
+        (*pos)[fill[i * 32 + Edges_Ctz(v)]++] = y;
+  }
+  free(fill);
+  return 1;
+}
+
+static void Edges_FreeTables(EDGE_INDEX *e) {
+  free(e->rowStart);
+  free(e->rowX);
+  free(e->colStart);
+  free(e->colY);
+  e->rowStart = e->rowX = e->colStart = e->colY = NULL;
+}
+
+int Edges_Build(EDGE_INDEX *e, const FRAMEBUFFER *fb) {
+  long long t0 = Clock_Ns();
+  Atomic_Store(&e->ready, 0);
+  Edges_FreeTables(e);
+  memset(&e->stats, 0, sizeof(e->stats));
+  e->w = fb->w;
+  e->h = fb->h;
+  int words = (fb->w + 31) / 32;
+  size_t planeWords = (size_t)words * (size_t)fb->h;
+  uint32_t *v = (uint32_t *)calloc(planeWords * 2, sizeof(uint32_t));
+  if (!v || !fb->w || !fb->h) {
+    free(v);
+    e->w = e->h = 0;
+    Atomic_Store(&e->ready, 1);
+    return 0;
+  }
+  uint32_t *hz = v + planeWords;
+  for (int i = 0; i < fb->ntiles; i++) {
+    GRADIENT_JOB g = {&fb->tiles[i], v, hz, words};
+    Par_For(fb->tiles[i].capture.h, EDGES_GRAIN, Edges_GradientRows, &g);
+  }
+  long long t1 = Clock_Ns();
+  RUN_JOB rv = {v, words, fb->h}, rh = {hz, words, fb->h};
+  Par_For(words, EDGES_COL_GRAIN, Edges_ColumnRuns, &rv);
+  Par_For(fb->h, EDGES_GRAIN, Edges_RowRuns, &rh);
+  long long t2 = Clock_Ns();
+
+  // A frame that is edges everywhere (a photo, noise) would not snap
+  // usefully anyway; past a quarter of the pixels that axis is dropped.
+  size_t limit = (size_t)fb->w * (size_t)fb->h / 4;
+  if (!Edges_RowTable(v, words, fb->h, limit, &e->rowStart, &e->rowX,
+                      &e->stats.vertical)) {
+    free(e->rowStart);
+    free(e->rowX);
+    e->rowStart = e->rowX = NULL;
+    e->stats.vertical = 0;
+    e->stats.dropped = 1;
+  }
+  if (!Edges_ColumnTable(hz, words, fb->w, fb->h, limit, &e->colStart,
+                         &e->colY, &e->stats.horizontal)) {
+    free(e->colStart);
+    free(e->colY);
+    e->colStart = e->colY = NULL;
+    e->stats.horizontal = 0;
+    e->stats.dropped = 1;
+  }
+  free(v);
+  long long t3 = Clock_Ns();
+  e->stats.gradientNs = t1 - t0;
+  e->stats.runsNs = t2 - t1;
+  e->stats.tablesNs = t3 - t2;
+  e->stats.totalNs = t3 - t0;
+  Atomic_Store(&e->ready, 1);
+  return 1;
+}
+
+static void Edges_Worker(void *arg) {
+  EDGE_INDEX *e = (EDGE_INDEX *)arg;
+  Edges_Build(e, e->fb);
+}
+
+void Edges_BuildAsync(EDGE_INDEX *e, const FRAMEBUFFER *fb) {
+  Edges_Wait(e);
+  Atomic_Store(&e->ready, 0);
+  e->fb = fb;
+  e->threaded = Thread_Start(&e->thread, Edges_Worker, e);
+  if (!e->threaded)
+    Edges_Build(e, fb);
+}
+
+void Edges_Wait(EDGE_INDEX *e) {
+  if (e->threaded)
+    Thread_Join(e->thread);
+  e->threaded = 0;
+  e->fb = NULL;
+}
+
+int Edges_Ready(const EDGE_INDEX *e) { return Atomic_Load(&e->ready) != 0; }
+
+void Edges_Free(EDGE_INDEX *e) {
+  Edges_Wait(e);
+  Edges_FreeTables(e);
+  memset(e, 0, sizeof(*e));
+}
+
+// Nearest of list[0..n) to v within dist, else v.
+static int Edges_Nearest(const int *list, int n, int v, int dist) {
+  int lo = 0, hi = n;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (list[mid] < v)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  int best = v, bestD = dist + 1;
+  if (lo < n && list[lo] - v < bestD) {
+    best = list[lo];
+    bestD = list[lo] - v;
+  }
+  if (lo > 0 && v - list[lo - 1] < bestD)
+    best = list[lo - 1];
+  return best;
+}
+
+int Edges_SnapX(const EDGE_INDEX *e, int x, int y, int dist) {
+  if (dist <= 0 || !Edges_Ready(e) || !e->rowStart || y < 0 || y >= e->h)
+    return x;
+  const int *s = e->rowStart + y;
+  return Edges_Nearest(e->rowX + s[0], s[1] - s[0], x, dist);
+}
+
+int Edges_SnapY(const EDGE_INDEX *e, int x, int y, int dist) {
+  if (dist <= 0 || !Edges_Ready(e) || !e->colStart || x < 0 || x >= e->w)
+    return y;
+  const int *s = e->colStart + x;
+  return Edges_Nearest(e->colY + s[0], s[1] - s[0], y, dist);
+}
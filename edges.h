@@ -0,0 +1,62 @@
+#ifndef SCREENSHOT_EDGES_H
+#define SCREENSHOT_EDGES_H
+
+#include "framebuffer.h"
+#include "platform.h"
+
+// Snap-to-edge index over a capture. A gradient pass marks pixel boundaries
+// where any color channel steps by more than EDGE_THRESHOLD; only straight
+// runs of at least EDGE_MIN_RUN such boundaries are kept (window borders,
+// panels, buttons), which drops most of the short strokes text is made of.
+// The survivors go into sorted per-row tables of vertical edges and
+// per-column tables of horizontal ones, so a drag snaps with one binary
+// search per axis and never reads pixels.
+//
+// Edge coordinates are boundaries: x is the line between pixel x - 1 and
+// pixel x, which is what a selection's left or right (exclusive) side is.
+
+#define EDGE_THRESHOLD 16 // channel step that counts as an edge
+#define EDGE_MIN_RUN 8    // shortest straight run that is kept
+#define EDGE_SNAP 8       // default snap distance, see Edges_SnapDistance
+
+typedef struct {
+  long long gradientNs, runsNs, tablesNs, totalNs;
+  size_t vertical, horizontal; // table entries (edge pixels kept)
+  int dropped; // an axis had more edges than the tables may hold
+} EDGE_STATS;
+
+typedef struct {
+  int w, h;
+  // Vertical edges crossing row y: rowX[rowStart[y] .. rowStart[y + 1]),
+  // ascending. Horizontal edges crossing column x likewise in colY.
+  int *rowStart, *rowX;
+  int *colStart, *colY;
+  EDGE_STATS stats;
+
+  // Edges_BuildAsync
+  const FRAMEBUFFER *fb;
+  THREAD thread;
+  int threaded;
+  volatile long ready;
+} EDGE_INDEX;
+
+// SCREENSHOT_SNAP in pixels (0 turns snapping off), default EDGE_SNAP.
+int Edges_SnapDistance(void);
+
+// Builds the index from the capture pixels of fb. Returns 0 if out of
+// memory (the index is then empty).
+int Edges_Build(EDGE_INDEX *e, const FRAMEBUFFER *fb);
+// Edges_Build on a worker thread; queries find no edges until it is done.
+// The capture pixels must stay until Edges_Wait or Edges_Free.
+void Edges_BuildAsync(EDGE_INDEX *e, const FRAMEBUFFER *fb);
+void Edges_Wait(EDGE_INDEX *e);
+int Edges_Ready(const EDGE_INDEX *e);
+// Joins any worker and frees the tables.
+void Edges_Free(EDGE_INDEX *e);
+
+// The vertical edge in row y nearest to x, if one is within dist; x
+// otherwise. Edges_SnapY is the same for horizontal edges in column x.
+int Edges_SnapX(const EDGE_INDEX *e, int x, int y, int dist);
+int Edges_SnapY(const EDGE_INDEX *e, int x, int y, int dist);
+
+#endif
@@ -0,0 +1,242 @@
+#include "export.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "platform.h"
+#include "qoi.h"
+#include "raw.h"
+
+EXPORT_FORMAT Export_Format(void) {
+  const char *env = getenv("SCREENSHOT_FORMAT");
+  EXPORT_FORMAT fmt;
+  return env && Export_ParseFormat(env, &fmt) ? fmt : EXPORT_PNG;
+}
+
+int Export_ParseFormat(const char *name, EXPORT_FORMAT *fmt) {
+  if (!strcmp(name, "png"))
+    *fmt = EXPORT_PNG;
+  else if (!strcmp(name, "qoi"))
+    *fmt = EXPORT_QOI;
+  else if (!strcmp(name, "raw") || !strcmp(name, "bgra"))
+    *fmt = EXPORT_RAW;
+  else
+    return 0;
+  return 1;
+}
+
+const char *Export_Extension(EXPORT_FORMAT fmt) {
+  switch (fmt) {
+  case EXPORT_QOI:
+    return "qoi";
+  case EXPORT_RAW:
+    return "bgra";
+  default:
+    return "png";
+  }
+}
+
+int Export_Write(FILE *f, const IMAGE *img, EXPORT_FORMAT fmt,
+                 EXPORT_STATS *st) {
+  long long t0 = Clock_Ns();
+  PNG_STATS png;
+  memset(&png, 0, sizeof(png));
+  int ok;
+  switch (fmt) {
+  case EXPORT_QOI:
+    ok = Qoi_Write(f, img) && fflush(f) == 0;
+    break;
+  case EXPORT_RAW:
+    ok = Raw_Write(f, img);
+    break;
+  default:
+    ok = Png_Write(f, img, 0, &png);
+    break;
+  }
+  if (st) {
+    long long pos = File_Tell(f);
+    st->format = fmt;
+    st->pixelBytes = (unsigned long long)img->w * (unsigned long long)img->h *
+                     4;
+    st->fileBytes = pos > 0 ? (unsigned long long)pos : 0;
+    st->ns = Clock_Ns() - t0;
+    st->png = png;
+  }
+  return ok;
+}
+
+void Export_Describe(const EXPORT_STATS *st, char *buf, size_t n) {
+  char kind[96];
+  const PNG_STATS *p = &st->png;
+  if (st->format == EXPORT_QOI)
+    snprintf(kind, sizeof(kind), "QOI");
+  else if (st->format == EXPORT_RAW)
+    snprintf(kind, sizeof(kind), "raw BGRA");
+  else if (p->colors)
+    snprintf(kind, sizeof(kind),
+             "PNG, %d colors at %d bpp, census %.2f ms, %d bands", p->colors,
+             p->depth, p->censusNs / 1e6, p->bands);
+  else
+    snprintf(kind, sizeof(kind), "PNG, RGB, %d bands in %d groups", p->bands,
+             p->groups);
+  double s = st->ns / 1e9;
+  snprintf(buf, n, "%s, %.1f MB -> %.1f MB in %.2f ms (%.0f MB/s)", kind,
+           st->pixelBytes / 1e6, st->fileBytes / 1e6, st->ns / 1e6,
+           s > 0 ? st->pixelBytes / 1e6 / s : 0.0);
+}
+
+// --- Background export ---
+static struct {
+  int started, threadless; // threadless: the worker failed to start
+  THREAD th;
+  MUTEX mu;
+  COND changed; // a job was queued, taken or finished
+  EXPORT_JOB ring[EXPORT_QUEUE_DEPTH];
+  int head, count, busy;
+  EXPORT_QUEUE_STATS stats;
+  // latency ring, indexed by stats.completed
+  long long wait[EXPORT_LATENCY_SAMPLES], done[EXPORT_LATENCY_SAMPLES];
+} g_xq;
+
+EXPORT_IMAGE *ExportImage_Wrap(IMAGE *img) {
+  EXPORT_IMAGE *ei = (EXPORT_IMAGE *)malloc(sizeof(EXPORT_IMAGE));
+  if (!ei)
+    return NULL;
+  ei->img = *img;
+  ei->refs = 1;
+  img->px = NULL;
+  return ei;
+}
+
+void ExportImage_Retain(EXPORT_IMAGE *ei) { Atomic_Inc(&ei->refs); }
+
+void ExportImage_Release(EXPORT_IMAGE *ei) {
+  if (!ei || Atomic_Dec(&ei->refs) > 0)
+    return;
+  Image_Free(&ei->img);
+  free(ei);
+}
+
+static void Export_Run(EXPORT_JOB *j) {
+  j->startNs = Clock_Ns();
+  int ok = 1;
+  if (j->publish)
+    ok = j->publish(j);
+  if (j->file) {
+    if (!Export_Write(j->file, &j->image->img, j->format, &j->stats))
+      ok = 0;
+    if (fclose(j->file) != 0)
+      ok = 0;
+  }
+  j->endNs = Clock_Ns();
+  if (j->done)
+    j->done(j, ok);
+  ExportImage_Release(j->image);
+}
+
+// Records a finished job's latencies; called under the lock (or without a
+// worker).
+static void Export_Completed(const EXPORT_JOB *j) {
+  int i = (int)(g_xq.stats.completed % EXPORT_LATENCY_SAMPLES);
+  long long wait = j->startNs - j->submitNs, done = j->endNs - j->submitNs;
+  g_xq.wait[i] = wait;
+  g_xq.done[i] = done;
+  if (wait > g_xq.stats.waitMax)
+    g_xq.stats.waitMax = wait;
+  if (done > g_xq.stats.doneMax)
+    g_xq.stats.doneMax = done;
+  g_xq.stats.completed++;
+}
+
+static void Export_Worker(void *arg) {
+  (void)arg;
+  for (;;) {
+    Mutex_Lock(&g_xq.mu);
+    while (!g_xq.count)
+      Cond_Wait(&g_xq.changed, &g_xq.mu);
+    EXPORT_JOB j = g_xq.ring[g_xq.head];
+    g_xq.head = (g_xq.head + 1) % EXPORT_QUEUE_DEPTH;
+    g_xq.count--;
+    g_xq.busy = 1;
+    Cond_Broadcast(&g_xq.changed);
+    Mutex_Unlock(&g_xq.mu);
+
+    Export_Run(&j);
+
+    Mutex_Lock(&g_xq.mu);
+    g_xq.busy = 0;
+    Export_Completed(&j);
+    Cond_Broadcast(&g_xq.changed);
+    Mutex_Unlock(&g_xq.mu);
+  }
+}
+
+void Export_Submit(const EXPORT_JOB *job) {
+  long long t0 = Clock_Ns();
+  if (!g_xq.started) {
+    Mutex_Init(&g_xq.mu);
+    Cond_Init(&g_xq.changed);
+    g_xq.threadless = !Thread_Start(&g_xq.th, Export_Worker, NULL);
+    g_xq.started = 1;
+  }
+  if (g_xq.threadless) {
+    // no worker: export in the caller, as before the queue existed
+    EXPORT_JOB j = *job;
+    j.submitNs = t0;
+    g_xq.stats.submitted++;
+    Export_Run(&j);
+    Export_Completed(&j);
+    return;
+  }
+  Mutex_Lock(&g_xq.mu);
+  if (g_xq.count == EXPORT_QUEUE_DEPTH) {
+    g_xq.stats.stalls++;
+    while (g_xq.count == EXPORT_QUEUE_DEPTH)
+      Cond_Wait(&g_xq.changed, &g_xq.mu);
+    g_xq.stats.stallNs += Clock_Ns() - t0;
+  }
+  EXPORT_JOB *slot =
+      &g_xq.ring[(g_xq.head + g_xq.count) % EXPORT_QUEUE_DEPTH];
+  *slot = *job;
+  slot->submitNs = t0;
+  g_xq.count++;
+  g_xq.stats.submitted++;
+  Cond_Broadcast(&g_xq.changed);
+  Mutex_Unlock(&g_xq.mu);
+}
+
+void Export_Flush(void) {
+  if (!g_xq.started || g_xq.threadless)
+    return;
+  Mutex_Lock(&g_xq.mu);
+  while (g_xq.count || g_xq.busy)
+    Cond_Wait(&g_xq.changed, &g_xq.mu);
+  Mutex_Unlock(&g_xq.mu);
+}
+
+static int CompareLL(const void *a, const void *b) {
+  long long x = *(const long long *)a, y = *(const long long *)b;
+  return x < y ? -1 : x > y;
+}
+
+void Export_QueueStats(EXPORT_QUEUE_STATS *out) {
+  long long wait[EXPORT_LATENCY_SAMPLES], done[EXPORT_LATENCY_SAMPLES];
+  int locked = g_xq.started && !g_xq.threadless;
+  if (locked)
+    Mutex_Lock(&g_xq.mu);
+  *out = g_xq.stats;
+  int n = out->completed < EXPORT_LATENCY_SAMPLES ? (int)out->completed
+                                                  : EXPORT_LATENCY_SAMPLES;
+  memcpy(wait, g_xq.wait, sizeof(wait[0]) * (size_t)n);
+  memcpy(done, g_xq.done, sizeof(done[0]) * (size_t)n);
+  if (locked)
+    Mutex_Unlock(&g_xq.mu);
+  if (!n)
+    return;
+  qsort(wait, (size_t)n, sizeof(wait[0]), CompareLL);
+  qsort(done, (size_t)n, sizeof(done[0]), CompareLL);
+  out->waitP50 = wait[(n - 1) / 2];
+  out->waitP99 = wait[(n - 1) * 99 / 100];
+  out->doneP50 = done[(n - 1) / 2];
+  out->doneP99 = done[(n - 1) * 99 / 100];
+}
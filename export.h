@@ -0,0 +1,86 @@
+#ifndef SCREENSHOT_EXPORT_H
+#define SCREENSHOT_EXPORT_H
+
+#include <stdio.h>
+
+#include "image.h"
+#include "png.h"
+
+// File formats for saved selections. SCREENSHOT_FORMAT picks one: "png"
+// (default, smallest), "qoi" (lossless at close to memory speed) or "raw"
+// (BGRA with a 16-byte header, see raw.h).
+typedef enum { EXPORT_PNG, EXPORT_QOI, EXPORT_RAW } EXPORT_FORMAT;
+
+typedef struct {
+  EXPORT_FORMAT format;
+  unsigned long long pixelBytes, fileBytes; // input at 4 bytes per pixel
+  long long ns;
+  PNG_STATS png; // EXPORT_PNG only
+} EXPORT_STATS;
+
+EXPORT_FORMAT Export_Format(void);
+// "png", "qoi", "raw" (or its extension "bgra"); returns 0 for anything else.
+int Export_ParseFormat(const char *name, EXPORT_FORMAT *fmt);
+const char *Export_Extension(EXPORT_FORMAT fmt);
+
+// Returns 1 on success; st may be NULL.
+int Export_Write(FILE *f, const IMAGE *img, EXPORT_FORMAT fmt,
+                 EXPORT_STATS *st);
+
+// One-line summary for the stats logs: format, size, time and throughput.
+void Export_Describe(const EXPORT_STATS *st, char *buf, size_t n);
+
+// --- Background export ---
+// Confirming a selection hands the crop to a worker thread and returns, so
+// the overlay closes at once. Jobs run one after another, each in stages:
+// `publish` (clipboard data), then the file write, then `done`. At most
+// EXPORT_QUEUE_DEPTH jobs wait; Export_Submit blocks past that, so captures
+// fired faster than they encode slow the caller down instead of piling up
+// crops. Submit from one thread.
+
+#define EXPORT_QUEUE_DEPTH 4
+
+// Immutable crop, shared by queued jobs and the clipboard.
+typedef struct {
+  IMAGE img;
+  volatile long refs;
+} EXPORT_IMAGE;
+
+// Takes img's pixels; the result starts with one reference.
+EXPORT_IMAGE *ExportImage_Wrap(IMAGE *img);
+void ExportImage_Retain(EXPORT_IMAGE *ei);
+void ExportImage_Release(EXPORT_IMAGE *ei);
+
+typedef struct EXPORT_JOB EXPORT_JOB;
+struct EXPORT_JOB {
+  EXPORT_IMAGE *image; // the queue takes over this reference
+  int (*publish)(EXPORT_JOB *job); // optional
+  FILE *file;                      // optional; closed by the worker
+  EXPORT_FORMAT format;
+  void (*done)(EXPORT_JOB *job, int ok); // optional, on the worker
+  void *ctx;
+  long long submitNs, startNs, endNs; // queue wait is startNs - submitNs
+  EXPORT_STATS stats;                 // of the file write
+};
+
+// Latency percentiles are over the last EXPORT_LATENCY_SAMPLES jobs.
+#define EXPORT_LATENCY_SAMPLES 256
+
+typedef struct {
+  unsigned long long submitted, completed;
+  unsigned long long stalls; // submits that waited for a free slot
+  long long stallNs;
+  // Per job, submit to start (the wait in the queue) and submit to done;
+  // the maxima are over every job.
+  long long waitP50, waitP99, waitMax;
+  long long doneP50, doneP99, doneMax;
+} EXPORT_QUEUE_STATS;
+
+// Queues a copy of job. If no worker thread could be started, the job runs
+// in the caller instead.
+void Export_Submit(const EXPORT_JOB *job);
+// Waits until every job submitted so far has finished.
+void Export_Flush(void);
+void Export_QueueStats(EXPORT_QUEUE_STATS *out);
+
+#endif
@@ -0,0 +1,558 @@
+#include "framebuffer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "dim.h"
+#include "lz.h"
+#include "platform.h"
+
+#define BLOCK_BYTES ((size_t)FB_BLOCK_SIZE * FB_BLOCK_SIZE * 4)
+#define SLOT_BYTES (2 * BLOCK_BYTES) // decoded capture, then its dimmed copy
+
+typedef struct {
+  unsigned char *lz;
+  size_t lzSize;
+  int slot; // cache slot holding the decoded block, -1 if none
+} PACKED_BLOCK;
+
+struct FB_STORE {
+  unsigned char alpha;
+  int cols[FB_MAX_TILES], rows[FB_MAX_TILES];
+  PACKED_BLOCK *blocks[FB_MAX_TILES];
+
+  // decoded blocks; the least recently used slot is reused first
+  int nslots;
+  unsigned char *slotMem;
+  PACKED_BLOCK **owner;
+  unsigned long long *used, clock;
+  int *pending; // scratch: block columns of the band being faulted in
+
+  FB_PACK_STATS stats;
+};
+
+int Framebuffer_Layout(FRAMEBUFFER *fb, const IRECT *monitors, int n) {
+  memset(fb, 0, sizeof(*fb));
+  IRECT virt = {0, 0, 0, 0};
+  for (int i = 0; i < n; i++)
+    IRect_Union(&virt, &monitors[i], &virt);
+  fb->virt = virt;
+  fb->w = virt.right - virt.left;
+  fb->h = virt.bottom - virt.top;
+  for (int i = 0; i < n && fb->ntiles < FB_MAX_TILES; i++) {
+    if (IRect_IsEmpty(&monitors[i]))
+      continue;
+    IRECT a = {monitors[i].left - virt.left, monitors[i].top - virt.top,
+               monitors[i].right - virt.left, monitors[i].bottom - virt.top};
+    int dup = 0;
+    for (int j = 0; j < fb->ntiles; j++)
+      dup |= !memcmp(&fb->tiles[j].area, &a, sizeof(a));
+    if (!dup)
+      fb->tiles[fb->ntiles++].area = a;
+  }
+  return fb->ntiles;
+}
+
+typedef struct {
+  FB_GRAB_FN grab;
+  void *ctx;
+  int tile, ok;
+} GRAB_JOB;
+
+static void GrabThread(void *arg) {
+  GRAB_JOB *j = (GRAB_JOB *)arg;
+  j->ok = j->grab(j->ctx, j->tile);
+}
+
+int Framebuffer_Capture(const FRAMEBUFFER *fb, FB_GRAB_FN grab, void *ctx) {
+  GRAB_JOB jobs[FB_MAX_TILES];
+  THREAD threads[FB_MAX_TILES];
+  int started[FB_MAX_TILES] = {0};
+  for (int i = 0; i < fb->ntiles; i++) {
+    jobs[i].grab = grab;
+    jobs[i].ctx = ctx;
+    jobs[i].tile = i;
+    jobs[i].ok = 0;
+  }
+  // Tile 0 runs on the calling thread; a tile whose thread cannot be
+  // started is grabbed inline as well.
+  for (int i = 1; i < fb->ntiles; i++)
+    started[i] = Thread_Start(&threads[i], GrabThread, &jobs[i]);
+  int ok = 1;
+  for (int i = 0; i < fb->ntiles; i++) {
+    if (started[i])
+      Thread_Join(threads[i]);
+    else
+      GrabThread(&jobs[i]);
+    ok &= jobs[i].ok;
+  }
+  return ok && fb->ntiles > 0;
+}
+
+static void Store_Free(FB_STORE *st) {
+  if (!st)
+    return;
+  for (int i = 0; i < FB_MAX_TILES; i++) {
+    int n = st->blocks[i] ? st->cols[i] * st->rows[i] : 0;
+    for (int j = 0; j < n; j++)
+      free(st->blocks[i][j].lz);
+    free(st->blocks[i]);
+  }
+  free(st->slotMem);
+  free(st->owner);
+  free(st->used);
+  free(st->pending);
+  free(st);
+}
+
+int Framebuffer_SameLayout(const FRAMEBUFFER *a, const FRAMEBUFFER *b) {
+  if (a->ntiles != b->ntiles || memcmp(&a->virt, &b->virt, sizeof(IRECT)))
+    return 0;
+  for (int i = 0; i < a->ntiles; i++)
+    if (memcmp(&a->tiles[i].area, &b->tiles[i].area, sizeof(IRECT)))
+      return 0;
+  return 1;
+}
+
+void Framebuffer_Reset(FRAMEBUFFER *fb) {
+  Framebuffer_Finish(fb);
+  Store_Free(fb->store);
+  fb->store = NULL;
+  for (int i = 0; i < fb->ntiles; i++)
+    fb->tiles[i].dimRows = 0;
+}
+
+void Framebuffer_Free(FRAMEBUFFER *fb) {
+  Framebuffer_Finish(fb);
+  for (int i = 0; i < fb->ntiles; i++)
+    Image_Free(&fb->tiles[i].dimmed);
+  Store_Free(fb->store);
+  fb->store = NULL;
+}
+
+int Framebuffer_Dim(FRAMEBUFFER *fb, unsigned char alpha) {
+  Store_Free(fb->store);
+  fb->store = NULL;
+  for (int i = 0; i < fb->ntiles; i++) {
+    FB_TILE *t = &fb->tiles[i];
+    if (!t->dimmed.px &&
+        !Image_Alloc(&t->dimmed, t->capture.w, t->capture.h))
+      return 0;
+    Dim_Build(&t->capture, &t->dimmed, alpha);
+    t->dimRows = t->capture.h;
+  }
+  return 1;
+}
+
+// Block (bx, by) of a tile, in tile coordinates.
+static IRECT BlockRect(const FRAMEBUFFER *fb, int tile, int bx, int by) {
+  const IRECT *a = &fb->tiles[tile].area;
+  IRECT r = {bx * FB_BLOCK_SIZE, by * FB_BLOCK_SIZE,
+             (bx + 1) * FB_BLOCK_SIZE, (by + 1) * FB_BLOCK_SIZE};
+  if (r.right > a->right - a->left)
+    r.right = a->right - a->left;
+  if (r.bottom > a->bottom - a->top)
+    r.bottom = a->bottom - a->top;
+  return r;
+}
+
+typedef struct {
+  const FRAMEBUFFER *fb;
+  FB_STORE *st;
+  int first[FB_MAX_TILES + 1]; // flat index of each tile's first block
+  volatile long failed;
+} PACK_JOB;
+
+static void PackBlocks(void *ctx, int begin, int end) {
+  PACK_JOB *job = (PACK_JOB *)ctx;
+  unsigned char *raw = (unsigned char *)malloc(BLOCK_BYTES);
+  unsigned char *tmp = (unsigned char *)malloc(Lz_Bound(BLOCK_BYTES));
+  if (!raw || !tmp)
+    Atomic_Inc(&job->failed);
+  for (int k = begin; k < end && raw && tmp; k++) {
+    int t = 0;
+    while (k >= job->first[t + 1])
+      t++;
+    int j = k - job->first[t], cols = job->st->cols[t];
+    IRECT r = BlockRect(job->fb, t, j % cols, j / cols);
+    const IMAGE *src = &job->fb->tiles[t].capture;
+    size_t row = (size_t)(r.right - r.left) * 4, n = 0;
+    for (int y = r.top; y < r.bottom; y++, n += row)
+      memcpy(raw + n, IMAGE_ROW(src, y) + (size_t)r.left * 4, row);
+    PACKED_BLOCK *b = &job->st->blocks[t][j];
+    b->lzSize = Lz_Compress(raw, n, tmp);
+    b->lz = (unsigned char *)malloc(b->lzSize);
+    if (!b->lz) {
+      Atomic_Inc(&job->failed);
+      break;
+    }
+    memcpy(b->lz, tmp, b->lzSize);
+  }
+  free(raw);
+  free(tmp);
+}
+
+static FB_STORE *Store_Build(const FRAMEBUFFER *fb, unsigned char alpha,
+                             size_t budget) {
+  long long t0 = Clock_Ns();
+  FB_STORE *st = (FB_STORE *)calloc(1, sizeof(*st));
+  if (!st)
+    return NULL;
+  st->alpha = alpha;
+  PACK_JOB job = {fb, st, {0}, 0};
+  int maxCols = 0;
+  for (int i = 0; i < fb->ntiles; i++) {
+    const IRECT *a = &fb->tiles[i].area;
+    int w = a->right - a->left, h = a->bottom - a->top;
+    st->cols[i] = (w + FB_BLOCK_SIZE - 1) / FB_BLOCK_SIZE;
+    st->rows[i] = (h + FB_BLOCK_SIZE - 1) / FB_BLOCK_SIZE;
+    st->blocks[i] = (PACKED_BLOCK *)calloc((size_t)st->cols[i] * st->rows[i],
+                                           sizeof(PACKED_BLOCK));
+    if (!st->blocks[i]) {
+      Store_Free(st);
+      return NULL;
+    }
+    job.first[i + 1] = job.first[i] + st->cols[i] * st->rows[i];
+    if (st->cols[i] > maxCols)
+      maxCols = st->cols[i];
+    st->stats.rawBytes += (size_t)w * (size_t)h * 4;
+  }
+  int nblocks = job.first[fb->ntiles];
+  Par_For(nblocks, 4, PackBlocks, &job);
+  if (job.failed) {
+    Store_Free(st);
+    return NULL;
+  }
+  for (int i = 0; i < fb->ntiles; i++) {
+    for (int j = 0; j < st->cols[i] * st->rows[i]; j++) {
+      st->blocks[i][j].slot = -1;
+      st->stats.packedBytes += st->blocks[i][j].lzSize;
+    }
+  }
+
+  // What the packed data leaves of the budget goes to the cache, but it must
+  // hold at least one band of blocks across the widest tile.
+  size_t left = budget > st->stats.packedBytes
+                    ? budget - st->stats.packedBytes
+                    : 0;
+  int nslots = (int)(left / SLOT_BYTES);
+  if (nslots < maxCols)
+    nslots = maxCols;
+  if (nslots > nblocks)
+    nslots = nblocks;
+  st->nslots = nslots;
+  st->slotMem = (unsigned char *)malloc((size_t)nslots * SLOT_BYTES);
+  st->owner = (PACKED_BLOCK **)calloc((size_t)nslots, sizeof(*st->owner));
+  st->used = (unsigned long long *)calloc((size_t)nslots, sizeof(*st->used));
+  st->pending = (int *)malloc((size_t)maxCols * sizeof(int));
+  if (!st->slotMem || !st->owner || !st->used || !st->pending) {
+    Store_Free(st);
+    return NULL;
+  }
+  st->stats.cacheBytes = (size_t)nslots * SLOT_BYTES;
+  st->stats.packNs = Clock_Ns() - t0;
+  return st;
+}
+
+static void Store_Install(FRAMEBUFFER *fb, FB_STORE *st) {
+  for (int i = 0; i < fb->ntiles; i++) {
+    Image_Free(&fb->tiles[i].dimmed);
+    fb->tiles[i].dimRows = 0;
+  }
+  Store_Free(fb->store);
+  fb->store = st;
+}
+
+int Framebuffer_Pack(FRAMEBUFFER *fb, unsigned char alpha, size_t budget) {
+  FB_STORE *st = Store_Build(fb, alpha, budget);
+  if (!st)
+    return 0;
+  Store_Install(fb, st);
+  return 1;
+}
+
+// Budget that Framebuffer_Prepare should pack to, 0 if the plain dimmed
+// copies fit.
+static size_t PackBudget(const FRAMEBUFFER *fb) {
+  const char *env = getenv("SCREENSHOT_BUDGET_MB");
+  long mb = env ? strtol(env, NULL, 10) : 256;
+  size_t budget = mb > 0 ? (size_t)mb << 20 : 0;
+  return budget && Framebuffer_Bytes(fb) * 2 > budget ? budget : 0;
+}
+
+int Framebuffer_Prepare(FRAMEBUFFER *fb, unsigned char alpha) {
+  size_t budget = PackBudget(fb);
+  if (budget && Framebuffer_Pack(fb, alpha, budget))
+    return 1;
+  return Framebuffer_Dim(fb, alpha);
+}
+
+#define DIM_BAND 64 // rows per progressive step
+
+struct FB_ASYNC {
+  FRAMEBUFFER *fb;
+  unsigned char alpha;
+  size_t budget;
+  FB_NOTIFY_FN notify;
+  void *ctx;
+  THREAD thread;
+  int threaded;
+  FB_STORE *store; // built by the worker, installed by Framebuffer_Finish
+};
+
+static void PrepareWorker(void *arg) {
+  FB_ASYNC *job = (FB_ASYNC *)arg;
+  FRAMEBUFFER *fb = job->fb;
+  if (job->budget)
+    job->store = Store_Build(fb, job->alpha, job->budget);
+  for (int i = 0; i < fb->ntiles && !job->budget; i++) {
+    FB_TILE *t = &fb->tiles[i];
+    for (int top = 0; top < t->capture.h; top += DIM_BAND) {
+      int bottom = top + DIM_BAND < t->capture.h ? top + DIM_BAND
+                                                 : t->capture.h;
+      IMAGE src = t->capture, dst = t->dimmed;
+      src.px = IMAGE_ROW(&t->capture, top);
+      dst.px = IMAGE_ROW(&t->dimmed, top);
+      src.h = dst.h = bottom - top;
+      Dim_Build(&src, &dst, job->alpha);
+      Atomic_Store(&t->dimRows, bottom);
+      if (job->notify)
+        job->notify(job->ctx, i, top, bottom);
+    }
+  }
+  if (job->notify)
+    job->notify(job->ctx, -1, 0, 0);
+}
+
+void Framebuffer_PrepareAsync(FRAMEBUFFER *fb, unsigned char alpha,
+                              FB_NOTIFY_FN notify, void *ctx) {
+  Framebuffer_Finish(fb);
+  FB_ASYNC *job = (FB_ASYNC *)calloc(1, sizeof(*job));
+  if (!job) {
+    Framebuffer_Prepare(fb, alpha);
+    if (notify)
+      notify(ctx, -1, 0, 0);
+    return;
+  }
+  job->fb = fb;
+  job->alpha = alpha;
+  job->budget = PackBudget(fb);
+  job->notify = notify;
+  job->ctx = ctx;
+  Store_Free(fb->store);
+  fb->store = NULL;
+  for (int i = 0; i < fb->ntiles; i++) {
+    FB_TILE *t = &fb->tiles[i];
+    t->dimRows = 0;
+    if (!job->budget && !t->dimmed.px &&
+        !Image_Alloc(&t->dimmed, t->capture.w, t->capture.h))
+      job->budget = Framebuffer_Bytes(fb); // no room for a copy: pack
+  }
+  fb->async = job;
+  job->threaded = Thread_Start(&job->thread, PrepareWorker, job);
+  if (!job->threaded)
+    PrepareWorker(job);
+}
+
+int Framebuffer_Finish(FRAMEBUFFER *fb) {
+  FB_ASYNC *job = fb->async;
+  if (!job)
+    return 1;
+  if (job->threaded)
+    Thread_Join(job->thread);
+  fb->async = NULL;
+  int ok = 1;
+  if (job->store)
+    Store_Install(fb, job->store);
+  else if (job->budget)
+    ok = Framebuffer_Dim(fb, job->alpha); // packing failed
+  free(job);
+  return ok;
+}
+
+const FB_PACK_STATS *Framebuffer_PackStats(const FRAMEBUFFER *fb) {
+  return fb->store ? &fb->store->stats : NULL;
+}
+
+// Decoded pixels of a cached block; the dimmed copy follows the capture.
+static IMAGE SlotImage(const FRAMEBUFFER *fb, int tile, int bx, int by,
+                       int dimmed) {
+  const PACKED_BLOCK *b =
+      &fb->store->blocks[tile][by * fb->store->cols[tile] + bx];
+  IRECT r = BlockRect(fb, tile, bx, by);
+  IMAGE img;
+  img.px = fb->store->slotMem + (size_t)b->slot * SLOT_BYTES +
+           (dimmed ? BLOCK_BYTES : 0);
+  img.w = r.right - r.left;
+  img.h = r.bottom - r.top;
+  img.stride = img.w * 4;
+  return img;
+}
+
+typedef struct {
+  const FRAMEBUFFER *fb;
+  int tile, by;
+} FAULT_JOB;
+
+static void DecodeBlocks(void *ctx, int begin, int end) {
+  FAULT_JOB *job = (FAULT_JOB *)ctx;
+  FB_STORE *st = job->fb->store;
+  for (int k = begin; k < end; k++) {
+    int bx = st->pending[k];
+    const PACKED_BLOCK *b =
+        &st->blocks[job->tile][job->by * st->cols[job->tile] + bx];
+    IMAGE cap = SlotImage(job->fb, job->tile, bx, job->by, 0);
+    IMAGE dim = SlotImage(job->fb, job->tile, bx, job->by, 1);
+    Lz_Decompress(b->lz, b->lzSize, cap.px, BLOCK_BYTES);
+    Dim_Build(&cap, &dim, st->alpha);
+  }
+}
+
+// Makes blocks [bx0, bx1] of one band resident, decoding the missing ones
+// in parallel. Slots used by this band are never evicted by it.
+static void Store_FaultBand(const FRAMEBUFFER *fb, int tile, int by, int bx0,
+                            int bx1) {
+  FB_STORE *st = fb->store;
+  unsigned long long now = ++st->clock;
+  int npending = 0;
+  for (int bx = bx0; bx <= bx1; bx++) {
+    PACKED_BLOCK *b = &st->blocks[tile][by * st->cols[tile] + bx];
+    if (b->slot >= 0)
+      st->used[b->slot] = now;
+    else
+      st->pending[npending++] = bx;
+  }
+  if (!npending)
+    return;
+  long long t0 = Clock_Ns();
+  for (int k = 0; k < npending; k++) {
+    int victim = 0;
+    for (int i = 1; i < st->nslots; i++)
+      if (st->used[i] < st->used[victim])
+        victim = i;
+    if (st->owner[victim])
+      st->owner[victim]->slot = -1;
+    PACKED_BLOCK *b = &st->blocks[tile][by * st->cols[tile] + st->pending[k]];
+    b->slot = victim;
+    st->owner[victim] = b;
+    st->used[victim] = now;
+  }
+  FAULT_JOB job = {fb, tile, by};
+  Par_For(npending, 1, DecodeBlocks, &job);
+  long long dt = Clock_Ns() - t0;
+  st->stats.faults += (unsigned long long)npending;
+  st->stats.faultNs += dt;
+  if (dt > st->stats.faultMaxNs)
+    st->stats.faultMaxNs = dt;
+}
+
+static void FillBlack(IMAGE *dst, const IRECT *r) {
+  for (int y = r->top; y < r->bottom; y++) {
+    unsigned *p = (unsigned *)IMAGE_ROW(dst, y);
+    for (int x = r->left; x < r->right; x++)
+      p[x] = 0xFF000000u;
+  }
+}
+
+// Copies s (framebuffer coordinates, inside the tile) out of the packed
+// blocks, one band of blocks at a time.
+static void Store_ReadTile(const FRAMEBUFFER *fb, int tile, int dimmed,
+                           const IRECT *s, IMAGE *dst, int dx, int dy) {
+  const IRECT *a = &fb->tiles[tile].area;
+  IRECT l = {s->left - a->left, s->top - a->top, s->right - a->left,
+             s->bottom - a->top};
+  int bx0 = l.left / FB_BLOCK_SIZE, bx1 = (l.right - 1) / FB_BLOCK_SIZE;
+  int by0 = l.top / FB_BLOCK_SIZE, by1 = (l.bottom - 1) / FB_BLOCK_SIZE;
+  for (int by = by0; by <= by1; by++) {
+    Store_FaultBand(fb, tile, by, bx0, bx1);
+    for (int bx = bx0; bx <= bx1; bx++) {
+      IRECT br = BlockRect(fb, tile, bx, by), c;
+      IRect_Intersect(&br, &l, &c);
+      IMAGE src = SlotImage(fb, tile, bx, by, dimmed);
+      size_t n = (size_t)(c.right - c.left) * 4;
+      for (int y = c.top; y < c.bottom; y++)
+        memcpy(IMAGE_ROW(dst, y + a->top + dy) +
+                   (size_t)(c.left + a->left + dx) * 4,
+               IMAGE_ROW(&src, y - br.top) + (size_t)(c.left - br.left) * 4,
+               n);
+    }
+  }
+}
+
+void Framebuffer_Read(const FRAMEBUFFER *fb, int dimmed, const IRECT *r,
+                      IMAGE *dst, int dx, int dy) {
+  IRECT bounds = {0, 0, fb->w, fb->h}, c;
+  if (!IRect_Intersect(r, &bounds, &c))
+    return;
+
+  // Only pay for the black fill when r is not inside a single monitor.
+  int covered = 0;
+  for (int i = 0; i < fb->ntiles && !covered; i++) {
+    const IRECT *a = &fb->tiles[i].area;
+    covered = c.left >= a->left && c.top >= a->top && c.right <= a->right &&
+              c.bottom <= a->bottom;
+  }
+  if (!covered) {
+    IRECT d = {c.left + dx, c.top + dy, c.right + dx, c.bottom + dy};
+    FillBlack(dst, &d);
+  }
+
+  for (int i = 0; i < fb->ntiles; i++) {
+    const FB_TILE *t = &fb->tiles[i];
+    IRECT s;
+    if (!IRect_Intersect(&c, &t->area, &s))
+      continue;
+    if (fb->store) {
+      Store_ReadTile(fb, i, dimmed, &s, dst, dx, dy);
+      continue;
+    }
+    // rows not dimmed yet show the frozen capture
+    int split = dimmed ? t->area.top + (int)Atomic_Load(&t->dimRows) : 0;
+    size_t n = (size_t)(s.right - s.left) * 4;
+    for (int y = s.top; y < s.bottom; y++) {
+      const IMAGE *src = y < split ? &t->dimmed : &t->capture;
+      if (src->px)
+        memcpy(IMAGE_ROW(dst, y + dy) + (size_t)(s.left + dx) * 4,
+               IMAGE_ROW(src, y - t->area.top) +
+                   (size_t)(s.left - t->area.left) * 4,
+               n);
+    }
+  }
+}
+
+int Framebuffer_Crop(const FRAMEBUFFER *fb, const IRECT *r, IMAGE *out) {
+  IRECT bounds = {0, 0, fb->w, fb->h}, c;
+  if (!IRect_Intersect(r, &bounds, &c) ||
+      !Image_Alloc(out, c.right - c.left, c.bottom - c.top))
+    return 0;
+  Framebuffer_Read(fb, 0, &c, out, -c.left, -c.top);
+  return 1;
+}
+
+int Framebuffer_View(const FRAMEBUFFER *fb, const IRECT *r, IMAGE *out) {
+  if (fb->store || IRect_IsEmpty(r))
+    return 0;
+  for (int i = 0; i < fb->ntiles; i++) {
+    const FB_TILE *t = &fb->tiles[i];
+    const IRECT *a = &t->area;
+    if (r->left >= a->left && r->top >= a->top && r->right <= a->right &&
+        r->bottom <= a->bottom) {
+      out->px = IMAGE_ROW(&t->capture, r->top - a->top) +
+                (size_t)(r->left - a->left) * 4;
+      out->w = r->right - r->left;
+      out->h = r->bottom - r->top;
+      out->stride = t->capture.stride;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+size_t Framebuffer_Bytes(const FRAMEBUFFER *fb) {
+  size_t n = 0;
+  for (int i = 0; i < fb->ntiles; i++) {
+    const IRECT *a = &fb->tiles[i].area;
+    n += (size_t)(a->right - a->left) * (size_t)(a->bottom - a->top) * 4;
+  }
+  return n;
+}
@@ -0,0 +1,105 @@
+#ifndef SCREENSHOT_FRAMEBUFFER_H
+#define SCREENSHOT_FRAMEBUFFER_H
+
+#include "image.h"
+
+// The virtual desktop as one tile per monitor. Only covered areas are
+// stored; gaps between mismatched monitors read as opaque black (which is
+// what a bounding-box grab returned for them anyway). Framebuffer
+// coordinates have (0, 0) at the top-left of the desktop bounding box, so
+// they equal overlay client coordinates.
+
+#define FB_MAX_TILES 16
+#define FB_BLOCK_SIZE 256 // packed-mode block edge, in pixels
+
+typedef struct {
+  IRECT area;    // framebuffer coordinates
+  IMAGE capture; // area-sized; memory owned by the platform grab
+  IMAGE dimmed;  // heap, filled by Framebuffer_Dim
+  volatile long dimRows; // leading rows of dimmed that are ready
+} FB_TILE;
+
+typedef struct FB_STORE FB_STORE;
+typedef struct FB_ASYNC FB_ASYNC;
+
+typedef struct {
+  IRECT virt; // desktop bounding box in screen coordinates
+  int w, h;
+  int ntiles;
+  FB_TILE tiles[FB_MAX_TILES];
+  FB_STORE *store; // packed mode, see Framebuffer_Prepare
+  FB_ASYNC *async; // Framebuffer_PrepareAsync in flight
+} FRAMEBUFFER;
+
+typedef struct {
+  size_t rawBytes, packedBytes, cacheBytes;
+  unsigned long long faults; // blocks decoded on demand
+  long long packNs;
+  long long faultNs, faultMaxNs; // total, and the longest single stall
+} FB_PACK_STATS;
+
+// Lays out tiles for the given monitor rects (screen coordinates). Empty and
+// duplicate (mirrored) rects are dropped. Returns the number of tiles.
+int Framebuffer_Layout(FRAMEBUFFER *fb, const IRECT *monitors, int n);
+
+// Calls grab(ctx, i) for every tile, each on its own thread, and waits for
+// all of them. Returns 1 if every grab succeeded.
+typedef int (*FB_GRAB_FN)(void *ctx, int tile);
+int Framebuffer_Capture(const FRAMEBUFFER *fb, FB_GRAB_FN grab, void *ctx);
+
+// Builds each tile's dimmed copy (see Dim_Build).
+int Framebuffer_Dim(FRAMEBUFFER *fb, unsigned char alpha);
+
+// Memory-budget mode. Splits the tiles into FB_BLOCK_SIZE blocks kept
+// LZ-compressed; blocks are decoded and dimmed on demand into a cache that
+// keeps packed + cached bytes near `budget`. Afterwards the tiles' capture
+// pixels are no longer read, so the platform may free them.
+int Framebuffer_Pack(FRAMEBUFFER *fb, unsigned char alpha, size_t budget);
+
+// Dims, or packs when capture + dimmed copies would exceed the budget
+// (SCREENSHOT_BUDGET_MB, default 256; 0 never packs).
+int Framebuffer_Prepare(FRAMEBUFFER *fb, unsigned char alpha);
+
+// Framebuffer_Prepare on a worker thread, so the overlay can show the frozen
+// capture at once. Until a band of rows is dimmed, reads of the dimmed
+// image return the capture there. notify(ctx, tile, top, bottom) runs on the
+// worker after each band (tile-local rows), then once with tile = -1 when
+// everything is done; the owner then calls Framebuffer_Finish.
+typedef void (*FB_NOTIFY_FN)(void *ctx, int tile, int top, int bottom);
+void Framebuffer_PrepareAsync(FRAMEBUFFER *fb, unsigned char alpha,
+                              FB_NOTIFY_FN notify, void *ctx);
+
+// Joins the worker and installs a packed store if one was built. Returns
+// what Framebuffer_Prepare would have.
+int Framebuffer_Finish(FRAMEBUFFER *fb);
+
+// NULL unless packed.
+const FB_PACK_STATS *Framebuffer_PackStats(const FRAMEBUFFER *fb);
+
+// True if both lay out the same tiles, so buffers sized for one fit the
+// other.
+int Framebuffer_SameLayout(const FRAMEBUFFER *a, const FRAMEBUFFER *b);
+
+// Ends a session but keeps the dimmed copies for the next capture of the
+// same layout: joins any worker and drops the packed store.
+void Framebuffer_Reset(FRAMEBUFFER *fb);
+
+// Releases the dimmed copies and the packed store (joining any worker).
+void Framebuffer_Free(FRAMEBUFFER *fb);
+
+// Copies r (framebuffer coordinates, clipped to the framebuffer) from the
+// capture or dimmed tiles into dst at the same position offset by (dx, dy).
+void Framebuffer_Read(const FRAMEBUFFER *fb, int dimmed, const IRECT *r,
+                      IMAGE *dst, int dx, int dy);
+
+// Full-brightness copy of r (clipped) into a new heap image.
+int Framebuffer_Crop(const FRAMEBUFFER *fb, const IRECT *r, IMAGE *out);
+
+// Points out at the capture pixels of r when r lies inside one tile of an
+// unpacked framebuffer (no copy); returns 0 otherwise.
+int Framebuffer_View(const FRAMEBUFFER *fb, const IRECT *r, IMAGE *out);
+
+// Bytes of capture pixels covered by tiles (before packing), for stats.
+size_t Framebuffer_Bytes(const FRAMEBUFFER *fb);
+
+#endif
@@ -0,0 +1,57 @@
+#include "frameclock.h"
+
+#include <string.h>
+
+#define QMASK (FRAMECLOCK_QUEUE - 1)
+
+void FrameClock_Init(FRAME_CLOCK *fc, int refreshHz) {
+  memset(fc, 0, sizeof(*fc));
+  if (refreshHz < 24 || refreshHz > 1000)
+    refreshHz = 60;
+  fc->period = 1000000000LL / refreshHz;
+}
+
+void FrameClock_Push(FRAME_CLOCK *fc, int x, int y, long long now) {
+  if (fc->tail - fc->head == FRAMECLOCK_QUEUE)
+    fc->head++; // full: the oldest position can never be shown anyway
+  POINTER_EVENT *e = &fc->q[fc->tail++ & QMASK];
+  e->x = x;
+  e->y = y;
+  e->t = now;
+  fc->events++;
+}
+
+long long FrameClock_Due(const FRAME_CLOCK *fc, long long now) {
+  if (fc->head == fc->tail)
+    return -1;
+  return fc->nextFrame > now ? fc->nextFrame - now : 0;
+}
+
+int FrameClock_Take(FRAME_CLOCK *fc, long long now, POINTER_EVENT *out) {
+  if (fc->head == fc->tail)
+    return 0;
+  if (!fc->inputTime)
+    fc->inputTime = fc->q[fc->head & QMASK].t;
+  *out = fc->q[(fc->tail - 1) & QMASK];
+  fc->head = fc->tail;
+  fc->updates++;
+  // Stay on the period grid while busy; after an idle gap the first event
+  // goes out at once and restarts the grid from there.
+  if (now - fc->nextFrame < fc->period)
+    fc->nextFrame += fc->period;
+  else
+    fc->nextFrame = now + fc->period;
+  return 1;
+}
+
+void FrameClock_Presented(FRAME_CLOCK *fc, long long now) {
+  if (!fc->inputTime)
+    return;
+  long long lat = now - fc->inputTime;
+  fc->inputTime = 0;
+  fc->presents++;
+  fc->latencyLast = lat;
+  fc->latencySum += lat;
+  if (lat > fc->latencyMax)
+    fc->latencyMax = lat;
+}
@@ -0,0 +1,42 @@
+#ifndef SCREENSHOT_FRAMECLOCK_H
+#define SCREENSHOT_FRAMECLOCK_H
+
+// Pointer-event coalescing paced by the display refresh. Drag events are
+// queued as they arrive; at most one selection update is produced per frame
+// period, from the newest queued position. Times are Clock_Ns() values.
+
+#define FRAMECLOCK_QUEUE 256 // power of two; oldest events drop when full
+
+typedef struct {
+  int x, y;
+  long long t; // arrival time
+} POINTER_EVENT;
+
+typedef struct {
+  POINTER_EVENT q[FRAMECLOCK_QUEUE];
+  unsigned head, tail; // head == tail: empty
+
+  long long period;    // ns per display frame
+  long long nextFrame; // earliest time the next update may be produced
+  long long inputTime; // oldest event in the pending update, 0 if none
+
+  // counters
+  unsigned long long events, updates, presents;
+  long long latencyLast, latencyMax, latencySum; // input-to-present, ns
+} FRAME_CLOCK;
+
+void FrameClock_Init(FRAME_CLOCK *fc, int refreshHz);
+
+void FrameClock_Push(FRAME_CLOCK *fc, int x, int y, long long now);
+
+// ns until an update should be produced: 0 = now, -1 = nothing queued.
+long long FrameClock_Due(const FRAME_CLOCK *fc, long long now);
+
+// Folds all queued events into *out (the newest position) and advances the
+// clock by one period. Returns 0 if the queue was empty.
+int FrameClock_Take(FRAME_CLOCK *fc, long long now, POINTER_EVENT *out);
+
+// The update produced by the last Take has reached the screen.
+void FrameClock_Presented(FRAME_CLOCK *fc, long long now);
+
+#endif
@@ -0,0 +1,859 @@
+#include "history.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "batch.h"
+#include "export.h"
+#include "lz.h"
+
+#define TILE_BYTES (HISTORY_TILE * HISTORY_TILE * 4)
+#define PACK_BATCH 64          // new tiles compressed per Par_For
+#define NO_OFFSET UINT64_MAX   // slot taken, record not written yet
+#define READ_GRAIN 8           // tiles per Par_For chunk
+
+#define HASH_P1 0x9E3779B185EBCA87ull
+#define HASH_P2 0xC2B2AE3D27D4EB4Full
+#define HASH_P3 0x165667B19E3779F9ull
+
+static const char kIndexMagic[8] = "SHIDX01";
+static const char kRecordMagic[4] = {'S', 'H', 'C', '1'};
+
+static int History_Min(int a, int b) { return a < b ? a : b; }
+
+// --- Tile hash ---
+// Four independent multiply-rotate lanes (the xxHash64 round) take the
+// tile's rows 8 bytes at a time, so the multiplies overlap; the lanes and
+// the tile size are then folded into two differently mixed halves.
+
+static uint64_t Rotl(uint64_t x, int r) { return x << r | x >> (64 - r); }
+
+static uint64_t Load64(const unsigned char *p) {
+  uint64_t v;
+  memcpy(&v, p, 8);
+  return v;
+}
+
+static uint64_t Round(uint64_t s, uint64_t v) {
+  s += v * HASH_P2;
+  return Rotl(s, 31) * HASH_P1;
+}
+
+static uint64_t Avalanche(uint64_t x) {
+  x ^= x >> 33;
+  x *= HASH_P2;
+  x ^= x >> 29;
+  x *= HASH_P3;
+  return x ^ x >> 32;
+}
+
+static HISTORY_KEY Tile_Hash(const unsigned char *px, size_t stride, int w,
+                             int h) {
+  uint64_t s[4] = {HASH_P1 + HASH_P2, HASH_P2, 0, 0 - HASH_P1};
+  size_t n = (size_t)w * 4;
+  for (int y = 0; y < h; y++, px += stride) {
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+      s[0] = Round(s[0], Load64(px + i));
+      s[1] = Round(s[1], Load64(px + i + 8));
+      s[2] = Round(s[2], Load64(px + i + 16));
+      s[3] = Round(s[3], Load64(px + i + 24));
+    }
+    for (int k = 0; i + 8 <= n; i += 8, k++)
+      s[k] = Round(s[k], Load64(px + i));
+    if (i < n) { // odd width: one pixel left
+      uint32_t v;
+      memcpy(&v, px + i, 4);
+      s[3] = Round(s[3], v);
+    }
+  }
+  uint64_t size = (uint64_t)w << 16 | (uint64_t)h;
+  HISTORY_KEY k;
+  k.lo = Avalanche(Rotl(s[0], 1) + Rotl(s[1], 7) + Rotl(s[2], 12) +
+                   Rotl(s[3], 18) + size * HASH_P3);
+  k.hi = Avalanche((s[0] ^ Rotl(s[2], 29)) * HASH_P3 +
+                   (s[1] ^ Rotl(s[3], 23)) * HASH_P1 + size);
+  if (!k.lo && !k.hi)
+    k.lo = 1;
+  return k;
+}
+
+static int Key_Empty(HISTORY_KEY k) { return !k.lo && !k.hi; }
+
+static int Key_Equal(HISTORY_KEY a, HISTORY_KEY b) {
+  return a.lo == b.lo && a.hi == b.hi;
+}
+
+// Unpacks a record's payload into w * h * 4 = raw bytes.
+static int Tile_Unpack(const unsigned char *src, size_t n, unsigned char *px,
+                       size_t raw) {
+  if (n == raw) {
+    memcpy(px, src, raw);
+    return 1;
+  }
+  return n < raw && Lz_Decompress(src, n, px, raw) == raw;
+}
+
+// --- Index ---
+
+static void History_Path(const HISTORY *h, const char *name, char *out) {
+  snprintf(out, HISTORY_PATH_MAX + 16, "%s/%s", h->dir, name);
+}
+
+static HISTORY_INDEX *Index(const HISTORY *h) {
+  return (HISTORY_INDEX *)h->idx.p;
+}
+
+static HISTORY_SLOT *Slots(const HISTORY *h) {
+  return (HISTORY_SLOT *)(h->idx.p + sizeof(HISTORY_INDEX));
+}
+
+// The slot holding k, or the empty one where it would go.
+static uint64_t Index_Probe(const HISTORY *h, HISTORY_KEY k) {
+  const HISTORY_SLOT *s = Slots(h);
+  uint64_t mask = Index(h)->slots - 1, i = k.lo & mask;
+  while (!Key_Empty(s[i].key) && !Key_Equal(s[i].key, k))
+    i = (i + 1) & mask;
+  return i;
+}
+
+// (Re)maps tiles.idx with room for `slots`; a reader's index lives in
+// private memory instead, so the file is never written.
+static int Index_Map(HISTORY *h, uint64_t slots) {
+  char path[HISTORY_PATH_MAX + 16];
+  if (h->mapped)
+    FileMap_Close(&h->idx);
+  History_Path(h, "tiles.idx", path);
+  h->mapped = FileMap_Open(&h->idx, h->writer ? path : NULL,
+                           sizeof(HISTORY_INDEX) +
+                               (size_t)slots * sizeof(HISTORY_SLOT));
+  return h->mapped;
+}
+
+static void Index_Reset(HISTORY *h, uint64_t slots, uint64_t packBytes) {
+  memset(h->idx.p, 0, h->idx.size);
+  HISTORY_INDEX *ix = Index(h);
+  memcpy(ix->magic, kIndexMagic, sizeof(kIndexMagic));
+  ix->slots = slots;
+  ix->packBytes = packBytes;
+}
+
+static int Index_Valid(const HISTORY *h, long long packSize) {
+  const HISTORY_INDEX *ix = Index(h);
+  if (h->idx.size < sizeof(HISTORY_INDEX) ||
+      memcmp(ix->magic, kIndexMagic, sizeof(kIndexMagic)) || ix->dirty ||
+      ix->slots < HISTORY_MIN_SLOTS || (ix->slots & (ix->slots - 1)) ||
+      ix->used >= ix->slots || ix->packBytes > (uint64_t)packSize)
+    return 0;
+  return (h->idx.size - sizeof(HISTORY_INDEX)) / sizeof(HISTORY_SLOT) >=
+         ix->slots;
+}
+
+// Grows the table so `more` new keys still leave it half empty.
+static int Index_Reserve(HISTORY *h, uint64_t more) {
+  HISTORY_INDEX *ix = Index(h);
+  uint64_t slots = ix->slots;
+  while ((ix->used + more) * 2 > slots)
+    slots *= 2;
+  if (slots == ix->slots)
+    return 1;
+  uint64_t packBytes = ix->packBytes, dirty = ix->dirty, n = 0;
+  HISTORY_SLOT *s = Slots(h);
+  HISTORY_SLOT *old =
+      (HISTORY_SLOT *)malloc((size_t)(ix->used + 1) * sizeof(HISTORY_SLOT));
+  if (!old)
+    return 0;
+  for (uint64_t i = 0; i < ix->slots; i++)
+    if (!Key_Empty(s[i].key))
+      old[n++] = s[i];
+  int ok = Index_Map(h, slots);
+  if (ok) {
+    Index_Reset(h, slots, packBytes);
+    ix = Index(h);
+    ix->dirty = dirty;
+    ix->used = n;
+    s = Slots(h);
+    for (uint64_t i = 0; i < n; i++)
+      s[Index_Probe(h, old[i].key)] = old[i];
+  }
+  free(old);
+  return ok;
+}
+
+// Indexes tiles.pack from scratch. Each record is unpacked and rehashed;
+// the first that is cut short or does not match its key ends the pack, and
+// the next capture overwrites from there.
+static int Index_Rebuild(HISTORY *h) {
+  long long t0 = Clock_Ns();
+  if (!Index_Map(h, HISTORY_MIN_SLOTS))
+    return 0;
+  Index_Reset(h, HISTORY_MIN_SLOTS, 0);
+  unsigned char *buf = (unsigned char *)malloc(TILE_BYTES * 2);
+  long long off = 0;
+  int ok = buf != NULL;
+  HISTORY_TILE_RECORD rec;
+  if (ok && File_Seek(h->pack, 0, SEEK_SET))
+    ok = 0;
+  while (ok && fread(&rec, sizeof(rec), 1, h->pack) == 1) {
+    size_t raw = (size_t)rec.w * rec.h * 4;
+    if (!rec.w || !rec.h || rec.w > HISTORY_TILE || rec.h > HISTORY_TILE ||
+        !rec.size || rec.size > raw ||
+        fread(buf, 1, rec.size, h->pack) != rec.size ||
+        !Tile_Unpack(buf, rec.size, buf + TILE_BYTES, raw) ||
+        !Key_Equal(Tile_Hash(buf + TILE_BYTES, (size_t)rec.w * 4, rec.w,
+                             rec.h),
+                   rec.key))
+      break;
+    if (!Index_Reserve(h, 1)) {
+      ok = 0;
+      break;
+    }
+    uint64_t at = Index_Probe(h, rec.key);
+    HISTORY_SLOT *s = &Slots(h)[at];
+    if (Key_Empty(s->key)) {
+      s->key = rec.key;
+      s->offset = (uint64_t)off;
+      s->size = rec.size;
+      s->w = rec.w;
+      s->h = rec.h;
+      Index(h)->used++;
+    }
+    off += (long long)(sizeof(rec) + rec.size);
+  }
+  free(buf);
+  clearerr(h->pack);
+  if (!ok)
+    return 0;
+  Index(h)->packBytes = (uint64_t)off;
+  h->packEnd = off;
+  h->stats.rebuildNs += Clock_Ns() - t0;
+  return 1;
+}
+
+// --- Capture log ---
+
+static unsigned long long Tile_Count(uint32_t w, uint32_t h) {
+  return (unsigned long long)((w + HISTORY_TILE - 1) / HISTORY_TILE) *
+         ((h + HISTORY_TILE - 1) / HISTORY_TILE);
+}
+
+static int Capture_Push(HISTORY *h, const HISTORY_RECORD *rec,
+                        long long keys) {
+  if (h->n == h->cap) {
+    int cap = h->cap ? h->cap * 2 : 64;
+    HISTORY_CAPTURE *c = (HISTORY_CAPTURE *)realloc(
+        h->capture, (size_t)cap * sizeof(HISTORY_CAPTURE));
+    if (!c)
+      return 0;
+    h->capture = c;
+    h->cap = cap;
+  }
+  HISTORY_CAPTURE *c = &h->capture[h->n++];
+  c->time = rec->time;
+  c->w = (int)rec->w;
+  c->h = (int)rec->h;
+  c->keys = keys;
+  return 1;
+}
+
+// Loads the capture list; a record cut short ends the log.
+static int Log_Scan(HISTORY *h) {
+  HISTORY_RECORD rec;
+  long long off = 0, end;
+  if (File_Seek(h->log, 0, SEEK_END) || (end = File_Tell(h->log)) < 0 ||
+      File_Seek(h->log, 0, SEEK_SET))
+    return 0;
+  while (off + (long long)sizeof(rec) <= end &&
+         fread(&rec, sizeof(rec), 1, h->log) == 1) {
+    if (memcmp(rec.magic, kRecordMagic, 4) || !rec.w || !rec.h ||
+        rec.w > 0x7FFFFFFF || rec.h > 0x7FFFFFFF ||
+        rec.tiles != Tile_Count(rec.w, rec.h))
+      break;
+    long long keys = off + (long long)sizeof(rec);
+    long long next = keys + (long long)rec.tiles * sizeof(HISTORY_KEY);
+    if (next > end || !Capture_Push(h, &rec, keys) ||
+        File_Seek(h->log, next, SEEK_SET))
+      break;
+    off = next;
+  }
+  clearerr(h->log);
+  h->logEnd = off;
+  return 1;
+}
+
+// --- Store ---
+
+static FILE *History_File(const HISTORY *h, const char *name) {
+  char path[HISTORY_PATH_MAX + 16];
+  History_Path(h, name, path);
+  if (!h->writer)
+    return File_Open(path, "rb");
+  FILE *f = File_Open(path, "r+b");
+  return f ? f : File_Open(path, "w+b");
+}
+
+int History_Open(HISTORY *h, const char *dir, int write) {
+  memset(h, 0, sizeof(*h));
+  size_t len = strlen(dir);
+  if (!len || len >= HISTORY_PATH_MAX || (write && !Dir_Create(dir)))
+    return 0;
+  memcpy(h->dir, dir, len + 1);
+  h->writer = write;
+  h->pack = History_File(h, "tiles.pack");
+  h->log = History_File(h, "captures.log");
+  long long packSize;
+  if (!h->pack || (write && !File_Lock(h->pack)) || !h->log ||
+      !Log_Scan(h) || File_Seek(h->pack, 0, SEEK_END) ||
+      (packSize = File_Tell(h->pack)) < 0)
+    goto fail;
+
+  // Trusted when well formed, not left mid-capture and no longer than the
+  // pack; bytes past packBytes are an unfinished capture, written over. A
+  // reader may find a writer mid-capture, and indexes the pack itself.
+  char path[HISTORY_PATH_MAX + 16];
+  History_Path(h, "tiles.idx", path);
+  h->mapped = write ? FileMap_Open(&h->idx, path, 0)
+                    : FileMap_OpenRead(&h->idx, path);
+  if (!h->mapped || !Index_Valid(h, packSize)) {
+    if (!Index_Rebuild(h))
+      goto fail;
+  }
+  h->packEnd = (long long)Index(h)->packBytes;
+  return 1;
+fail:
+  History_Close(h);
+  return 0;
+}
+
+void History_Close(HISTORY *h) {
+  if (h->pack)
+    fclose(h->pack);
+  if (h->log)
+    fclose(h->log);
+  if (h->mapped)
+    FileMap_Close(&h->idx);
+  free(h->capture);
+  free(h->keys);
+  free(h->fresh);
+  free(h->work);
+  memset(h, 0, sizeof(*h));
+}
+
+// --- Add ---
+
+typedef struct {
+  const IMAGE *img;
+  int cols;
+  HISTORY_KEY *keys;
+  const uint32_t *fresh; // PACK_BATCH tiles to pack
+  unsigned char *work;
+  const unsigned char *data[PACK_BATCH];
+  uint32_t size[PACK_BATCH];
+} ADD_JOB;
+
+static void Tile_Rect(const IMAGE *img, int cols, uint32_t i, int *x, int *y,
+                      int *w, int *h) {
+  *x = (int)(i % (uint32_t)cols) * HISTORY_TILE;
+  *y = (int)(i / (uint32_t)cols) * HISTORY_TILE;
+  *w = History_Min(HISTORY_TILE, img->w - *x);
+  *h = History_Min(HISTORY_TILE, img->h - *y);
+}
+
+static void Hash_Bands(void *ctx, int begin, int end) {
+  ADD_JOB *j = (ADD_JOB *)ctx;
+  for (int ty = begin; ty < end; ty++)
+    for (int tx = 0; tx < j->cols; tx++) {
+      uint32_t i = (uint32_t)ty * (uint32_t)j->cols + (uint32_t)tx;
+      int x, y, w, h;
+      Tile_Rect(j->img, j->cols, i, &x, &y, &w, &h);
+      j->keys[i] = Tile_Hash(IMAGE_ROW(j->img, y) + (size_t)x * 4,
+                             (size_t)j->img->stride, w, h);
+    }
+}
+
+// Gathers each tile into its own work slice and packs it after itself;
+// tiles LZ cannot shrink are stored as they are.
+static void Pack_Tiles(void *ctx, int begin, int end) {
+  ADD_JOB *j = (ADD_JOB *)ctx;
+  for (int k = begin; k < end; k++) {
+    unsigned char *raw = j->work + (size_t)k * (TILE_BYTES +
+                                                 Lz_Bound(TILE_BYTES));
+    int x, y, w, h;
+    Tile_Rect(j->img, j->cols, j->fresh[k], &x, &y, &w, &h);
+    size_t row = (size_t)w * 4, n = row * (size_t)h;
+    for (int r = 0; r < h; r++)
+      memcpy(raw + r * row, IMAGE_ROW(j->img, y + r) + (size_t)x * 4, row);
+    size_t packed = Lz_Compress(raw, n, raw + TILE_BYTES);
+    j->data[k] = packed < n ? raw + TILE_BYTES : raw;
+    j->size[k] = (uint32_t)(packed < n ? packed : n);
+  }
+}
+
+static int Add_Reserve(HISTORY *h, size_t n) {
+  if (!h->work) {
+    h->work = (unsigned char *)malloc(PACK_BATCH *
+                                      (TILE_BYTES + Lz_Bound(TILE_BYTES)));
+    if (!h->work)
+      return 0;
+  }
+  if (n <= h->keyCap)
+    return 1;
+  HISTORY_KEY *k =
+      (HISTORY_KEY *)realloc(h->keys, n * sizeof(HISTORY_KEY));
+  if (k)
+    h->keys = k;
+  uint32_t *f = (uint32_t *)realloc(h->fresh, n * sizeof(uint32_t));
+  if (f)
+    h->fresh = f;
+  if (!k || !f)
+    return 0;
+  h->keyCap = n;
+  return 1;
+}
+
+int History_Add(HISTORY *h, const IMAGE *img, int64_t time) {
+  if (!h->mapped || !h->writer || img->w <= 0 || img->h <= 0)
+    return -1;
+  long long t0 = Clock_Ns();
+  ADD_JOB j;
+  j.img = img;
+  j.cols = (img->w + HISTORY_TILE - 1) / HISTORY_TILE;
+  int rows = (img->h + HISTORY_TILE - 1) / HISTORY_TILE;
+  size_t n = (size_t)j.cols * (size_t)rows;
+  if (n > 0xFFFFFFFFu || !Add_Reserve(h, n) ||
+      !Index_Reserve(h, (uint64_t)n))
+    return -1;
+  j.keys = h->keys;
+  j.work = h->work;
+  Par_For(rows, 1, Hash_Bands, &j);
+  long long t1 = Clock_Ns();
+
+  // Claim slots for tiles the store lacks, in order, so a tile repeated
+  // within this capture is packed once too.
+  HISTORY_INDEX *ix = Index(h);
+  HISTORY_SLOT *s = Slots(h);
+  ix->dirty = 1;
+  uint32_t fresh = 0;
+  for (uint32_t i = 0; i < (uint32_t)n; i++) {
+    uint64_t at = Index_Probe(h, h->keys[i]);
+    if (!Key_Empty(s[at].key))
+      continue;
+    int x, y, w, th;
+    Tile_Rect(img, j.cols, i, &x, &y, &w, &th);
+    s[at].key = h->keys[i];
+    s[at].offset = NO_OFFSET;
+    s[at].size = 0;
+    s[at].w = (uint16_t)w;
+    s[at].h = (uint16_t)th;
+    ix->used++;
+    h->fresh[fresh++] = i;
+  }
+
+  long long end = h->packEnd;
+  unsigned long long packed = 0;
+  int ok = File_Seek(h->pack, end, SEEK_SET) == 0;
+  for (uint32_t b = 0; ok && b < fresh; b += PACK_BATCH) {
+    int m = (int)(fresh - b < PACK_BATCH ? fresh - b : PACK_BATCH);
+    j.fresh = h->fresh + b;
+    Par_For(m, 1, Pack_Tiles, &j);
+    for (int k = 0; ok && k < m; k++) {
+      HISTORY_SLOT *t = &s[Index_Probe(h, h->keys[j.fresh[k]])];
+      HISTORY_TILE_RECORD rec;
+      rec.key = t->key;
+      rec.size = j.size[k];
+      rec.w = t->w;
+      rec.h = t->h;
+      ok = fwrite(&rec, sizeof(rec), 1, h->pack) == 1 &&
+           fwrite(j.data[k], 1, rec.size, h->pack) == rec.size;
+      t->offset = (uint64_t)end;
+      t->size = rec.size;
+      end += (long long)(sizeof(rec) + rec.size);
+      packed += sizeof(rec) + rec.size;
+    }
+  }
+  if (!ok || fflush(h->pack)) {
+    // The slots just claimed point at nothing now; records past packBytes
+    // are written over by the next capture.
+    clearerr(h->pack);
+    Index_Rebuild(h);
+    return -1;
+  }
+  h->packEnd = end;
+  ix->packBytes = (uint64_t)end;
+  ix->dirty = 0;
+  long long t2 = Clock_Ns();
+
+  // Only now is the capture visible; if its record is cut short the tiles
+  // stay, unreferenced, and the next capture writes over it.
+  HISTORY_RECORD rec;
+  memcpy(rec.magic, kRecordMagic, 4);
+  rec.w = (uint32_t)img->w;
+  rec.h = (uint32_t)img->h;
+  rec.tiles = (uint32_t)n;
+  rec.time = time;
+  long long keys = h->logEnd + (long long)sizeof(rec);
+  if (File_Seek(h->log, h->logEnd, SEEK_SET) ||
+      fwrite(&rec, sizeof(rec), 1, h->log) != 1 ||
+      fwrite(h->keys, sizeof(HISTORY_KEY), n, h->log) != n ||
+      fflush(h->log) || !Capture_Push(h, &rec, keys)) {
+    clearerr(h->log);
+    return -1;
+  }
+  h->logEnd = keys + (long long)(n * sizeof(HISTORY_KEY));
+
+  HISTORY_STATS *st = &h->stats;
+  st->captures++;
+  st->tiles += n;
+  st->newTiles += fresh;
+  st->pixelBytes += (unsigned long long)img->w * img->h * 4;
+  st->packBytes += packed;
+  st->hashNs += t1 - t0;
+  st->packNs += t2 - t1;
+  st->addNs += Clock_Ns() - t0;
+  return h->n - 1;
+}
+
+// --- Read ---
+
+typedef struct {
+  IMAGE *out;
+  IRECT want;
+  int tx0, ty0, tcols;
+  const HISTORY_SLOT *slot;
+  const unsigned char **data;
+  volatile long failed;
+} READ_JOB;
+
+typedef struct {
+  uint64_t offset;
+  uint32_t k;
+} READ_ORDER;
+
+static int Read_ByOffset(const void *a, const void *b) {
+  uint64_t x = ((const READ_ORDER *)a)->offset;
+  uint64_t y = ((const READ_ORDER *)b)->offset;
+  return x < y ? -1 : x > y;
+}
+
+static void Read_Tiles(void *ctx, int begin, int end) {
+  READ_JOB *j = (READ_JOB *)ctx;
+  unsigned char px[TILE_BYTES];
+  for (int k = begin; k < end; k++) {
+    const HISTORY_SLOT *s = &j->slot[k];
+    size_t row = (size_t)s->w * 4;
+    if (!Tile_Unpack(j->data[k], s->size, px, row * s->h)) {
+      Atomic_Store(&j->failed, 1);
+      return;
+    }
+    IRECT t, c;
+    t.left = (j->tx0 + k % j->tcols) * HISTORY_TILE;
+    t.top = (j->ty0 + k / j->tcols) * HISTORY_TILE;
+    t.right = t.left + s->w;
+    t.bottom = t.top + s->h;
+    if (!IRect_Intersect(&t, &j->want, &c))
+      continue;
+    for (int y = c.top; y < c.bottom; y++)
+      memcpy(IMAGE_ROW(j->out, y - j->want.top) +
+                 (size_t)(c.left - j->want.left) * 4,
+             px + (size_t)(y - t.top) * row + (size_t)(c.left - t.left) * 4,
+             (size_t)(c.right - c.left) * 4);
+  }
+}
+
+int History_Read(HISTORY *h, int i, const IRECT *r, IMAGE *out) {
+  if (!h->mapped || i < 0 || i >= h->n)
+    return 0;
+  long long t0 = Clock_Ns();
+  const HISTORY_CAPTURE *c = &h->capture[i];
+  IRECT full = {0, 0, c->w, c->h};
+  READ_JOB j;
+  memset(&j, 0, sizeof(j));
+  if (!IRect_Intersect(r ? r : &full, &full, &j.want))
+    return 0;
+  int cols = (c->w + HISTORY_TILE - 1) / HISTORY_TILE;
+  j.tx0 = j.want.left / HISTORY_TILE;
+  j.ty0 = j.want.top / HISTORY_TILE;
+  j.tcols = (j.want.right - 1) / HISTORY_TILE + 1 - j.tx0;
+  int trows = (j.want.bottom - 1) / HISTORY_TILE + 1 - j.ty0;
+  size_t n = (size_t)j.tcols * (size_t)trows;
+
+  // Keys from the log, slots from the index, then every distinct record
+  // read once in pack order.
+  HISTORY_SLOT *slot = (HISTORY_SLOT *)malloc(n * sizeof(HISTORY_SLOT));
+  const unsigned char **data =
+      (const unsigned char **)malloc(n * sizeof(*data));
+  READ_ORDER *order = (READ_ORDER *)malloc(n * sizeof(READ_ORDER));
+  HISTORY_KEY *key =
+      (HISTORY_KEY *)malloc((size_t)j.tcols * sizeof(HISTORY_KEY));
+  unsigned char *buf = NULL;
+  int ok = slot && data && order && key;
+  size_t total = 0;
+  for (int ty = 0; ok && ty < trows; ty++) {
+    long long at = c->keys + ((long long)(j.ty0 + ty) * cols + j.tx0) *
+                                 (long long)sizeof(HISTORY_KEY);
+    ok = File_Seek(h->log, at, SEEK_SET) == 0 &&
+         fread(key, sizeof(HISTORY_KEY), (size_t)j.tcols, h->log) ==
+             (size_t)j.tcols;
+    for (int tx = 0; ok && tx < j.tcols; tx++) {
+      size_t k = (size_t)ty * j.tcols + tx;
+      const HISTORY_SLOT *s = &Slots(h)[Index_Probe(h, key[tx])];
+      ok = !Key_Empty(s->key) && s->offset != NO_OFFSET;
+      slot[k] = *s;
+      order[k].offset = s->offset;
+      order[k].k = (uint32_t)k;
+      total += s->size;
+    }
+  }
+  if (ok) {
+    qsort(order, n, sizeof(READ_ORDER), Read_ByOffset);
+    ok = (buf = (unsigned char *)malloc(total ? total : 1)) != NULL;
+  }
+  size_t pos = 0;
+  for (size_t k = 0; ok && k < n; k++) {
+    const HISTORY_SLOT *s = &slot[order[k].k];
+    if (k && order[k].offset == order[k - 1].offset) {
+      data[order[k].k] = data[order[k - 1].k];
+      continue;
+    }
+    ok = File_Seek(h->pack,
+                   (long long)(s->offset + sizeof(HISTORY_TILE_RECORD)),
+                   SEEK_SET) == 0 &&
+         fread(buf + pos, 1, s->size, h->pack) == s->size;
+    data[order[k].k] = buf + pos;
+    pos += s->size;
+  }
+  if (ok)
+    ok = Image_Alloc(out, j.want.right - j.want.left,
+                     j.want.bottom - j.want.top);
+  if (ok) {
+    j.out = out;
+    j.slot = slot;
+    j.data = data;
+    Par_For((int)n, READ_GRAIN, Read_Tiles, &j);
+    if (Atomic_Load(&j.failed)) {
+      Image_Free(out);
+      ok = 0;
+    }
+  }
+  clearerr(h->log);
+  clearerr(h->pack);
+  free(slot);
+  free(data);
+  free(order);
+  free(key);
+  free(buf);
+  if (ok) {
+    h->stats.reads++;
+    h->stats.readNs += Clock_Ns() - t0;
+  }
+  return ok;
+}
+
+void History_Usage(const HISTORY *h, HISTORY_USAGE *u) {
+  memset(u, 0, sizeof(*u));
+  u->captures = h->n;
+  for (int i = 0; i < h->n; i++) {
+    const HISTORY_CAPTURE *c = &h->capture[i];
+    u->pixelBytes += (unsigned long long)c->w * c->h * 4;
+    u->tileRefs += Tile_Count((uint32_t)c->w, (uint32_t)c->h);
+  }
+  if (h->mapped) {
+    u->tiles = Index(h)->used;
+    u->diskBytes = h->idx.size;
+  }
+  u->diskBytes += (unsigned long long)h->packEnd + h->logEnd;
+}
+
+void History_Describe(const HISTORY *h, const HISTORY_STATS *before,
+                      char *buf, size_t n) {
+  const HISTORY_STATS *st = &h->stats;
+  HISTORY_USAGE u;
+  History_Usage(h, &u);
+  long long ns = st->addNs - before->addNs;
+  unsigned long long px = st->pixelBytes - before->pixelBytes;
+  snprintf(buf, n,
+           "%llu of %llu tiles new (%.1f KB) in %.2f ms (%.0f MB/s); store "
+           "%.1f MB for %.1f MB in %d captures, dedup %.1fx",
+           st->newTiles - before->newTiles, st->tiles - before->tiles,
+           (st->packBytes - before->packBytes) / 1e3, ns / 1e6,
+           ns > 0 ? px / (ns / 1e3) : 0.0, u.diskBytes / 1e6,
+           u.pixelBytes / 1e6, u.captures,
+           u.tiles ? (double)u.tileRefs / u.tiles : 0.0);
+}
+
+// --- Directory ---
+
+static int History_Env(const char *name, char *buf, size_t n) {
+#ifdef _WIN32
+  // The C runtime would hand back ANSI.
+  wchar_t wname[64], *v;
+  if (!MultiByteToWideChar(CP_UTF8, 0, name, -1, wname, 64) ||
+      !(v = _wgetenv(wname)))
+    return 0;
+  return WideCharToMultiByte(CP_UTF8, 0, v, -1, buf, (int)n, NULL, NULL) != 0;
+#else
+  const char *v = getenv(name);
+  if (!v || strlen(v) >= n)
+    return 0;
+  memcpy(buf, v, strlen(v) + 1);
+  return 1;
+#endif
+}
+
+int History_Dir(char *buf, size_t n) {
+  char base[HISTORY_PATH_MAX];
+  int len;
+  if (History_Env("SCREENSHOT_HISTORY", base, sizeof(base))) {
+    if (!base[0] || !strcmp(base, "0"))
+      return 0;
+    len = snprintf(buf, n, "%s", base);
+  }
+#ifdef _WIN32
+  else if (History_Env("LOCALAPPDATA", base, sizeof(base)) && base[0])
+    len = snprintf(buf, n, "%s\\screenshot\\history", base);
+#else
+  else if (History_Env("XDG_DATA_HOME", base, sizeof(base)) &&
+           base[0] == '/')
+    len = snprintf(buf, n, "%s/screenshot/history", base);
+  else if (History_Env("HOME", base, sizeof(base)) && base[0])
+    len = snprintf(buf, n, "%s/.local/share/screenshot/history", base);
+#endif
+  else
+    return 0;
+  return len > 0 && (size_t)len < n;
+}
+
+// --- `screenshot history` ---
+
+static int History_List(HISTORY *h, long long openNs) {
+  HISTORY_USAGE u;
+  History_Usage(h, &u);
+  printf("{\n  \"dir\": ");
+  Json_String(stdout, h->dir);
+  printf(",\n  \"captures\": %d,\n  \"pixel_bytes\": %llu,\n"
+         "  \"disk_bytes\": %llu,\n  \"space_ratio\": %.2f,\n"
+         "  \"tile_refs\": %llu,\n  \"tiles\": %llu,\n"
+         "  \"dedup_ratio\": %.2f,\n  \"open_ms\": %.3f,\n"
+         "  \"rebuild_ms\": %.3f,\n  \"list\": [",
+         u.captures, u.pixelBytes, u.diskBytes,
+         u.diskBytes ? (double)u.pixelBytes / u.diskBytes : 0.0, u.tileRefs,
+         u.tiles, u.tiles ? (double)u.tileRefs / u.tiles : 0.0, openNs / 1e6,
+         h->stats.rebuildNs / 1e6);
+  for (int i = 0; i < h->n; i++)
+    printf("%s\n    {\"id\": %d, \"time\": %lld, \"w\": %d, \"h\": %d}",
+           i ? "," : "", i, (long long)h->capture[i].time, h->capture[i].w,
+           h->capture[i].h);
+  printf("%s]\n}\n", h->n ? "\n  " : "");
+  return fflush(stdout) == 0;
+}
+
+static int History_Extract(HISTORY *h, int id, const IRECT *r,
+                           const char *out, EXPORT_FORMAT fmt) {
+  IMAGE img;
+  long long t0 = Clock_Ns();
+  if (!History_Read(h, id, r, &img)) {
+    fprintf(stderr, "screenshot history: cannot rebuild capture %d\n", id);
+    return 0;
+  }
+  long long t1 = Clock_Ns();
+  FILE *f = File_Open(out, "wb");
+  int ok = f && Export_Write(f, &img, fmt, NULL);
+  if (f)
+    ok = fclose(f) == 0 && ok;
+  long long t2 = Clock_Ns();
+  if (!ok) {
+    fprintf(stderr, "screenshot history: cannot write %s\n", out);
+  } else {
+    printf("{\n  \"id\": %d,\n  \"w\": %d,\n  \"h\": %d,\n  \"out\": ", id,
+           img.w, img.h);
+    Json_String(stdout, out);
+    printf(",\n  \"read_ms\": %.3f,\n  \"write_ms\": %.3f\n}\n",
+           (t1 - t0) / 1e6, (t2 - t1) / 1e6);
+    ok = fflush(stdout) == 0;
+  }
+  Image_Free(&img);
+  return ok;
+}
+
+int History_Main(int argc, char **argv) {
+  char dir[HISTORY_PATH_MAX];
+  const char *out = NULL, *dirArg = NULL;
+  EXPORT_FORMAT fmt = Export_Format();
+  int id = 0, extract = 0, formatSet = 0, region = 0;
+  IRECT r = {0, 0, 0, 0};
+  for (int i = 0; i < argc; i++) {
+    const char *arg = argv[i], *val = i + 1 < argc ? argv[i + 1] : NULL;
+    if (!val)
+      goto usage;
+    i++;
+    int ok = 1;
+    if (!strcmp(arg, "--dir")) {
+      dirArg = val;
+    } else if (!strcmp(arg, "--extract")) {
+      char *e;
+      long v = strtol(val, &e, 10);
+      ok = e != val && !*e && v >= -0x7FFFFFFF && v <= 0x7FFFFFFF;
+      id = (int)v;
+      extract = 1;
+    } else if (!strcmp(arg, "--out")) {
+      out = val;
+    } else if (!strcmp(arg, "--region")) {
+      int x, y, w, h;
+      char tail;
+      ok = sscanf(val, "%d,%d,%d,%d%c", &x, &y, &w, &h, &tail) == 4 &&
+           w > 0 && h > 0;
+      r.left = x;
+      r.top = y;
+      r.right = x + w;
+      r.bottom = y + h;
+      region = 1;
+    } else if (!strcmp(arg, "--format")) {
+      ok = Export_ParseFormat(val, &fmt);
+      formatSet = 1;
+    } else {
+      ok = 0;
+    }
+    if (!ok)
+      goto usage;
+  }
+  if (extract != (out != NULL) || (region && !extract))
+    goto usage;
+  if (dirArg) {
+    if (strlen(dirArg) >= sizeof(dir))
+      goto usage;
+    memcpy(dir, dirArg, strlen(dirArg) + 1);
+  } else if (!History_Dir(dir, sizeof(dir))) {
+    fprintf(stderr, "screenshot history: history is off\n");
+    return 1;
+  }
+  if (out && !formatSet) {
+    const char *dot = strrchr(out, '.');
+    if (dot && !strpbrk(dot, "/\\"))
+      Export_ParseFormat(dot + 1, &fmt);
+  }
+
+  HISTORY h;
+  long long t0 = Clock_Ns();
+  if (!History_Open(&h, dir, 0)) {
+    fprintf(stderr, "screenshot history: cannot open %s\n", dir);
+    return 1;
+  }
+  long long openNs = Clock_Ns() - t0;
+  int ok;
+  if (extract) {
+    if (id < 0)
+      id += h.n;
+    ok = History_Extract(&h, id, region ? &r : NULL, out, fmt);
+  } else {
+    ok = History_List(&h, openNs);
+  }
+  History_Close(&h);
+  return ok ? 0 : 1;
+usage:
+  fprintf(stderr, "usage: screenshot history [--dir d]\n"
+                  "       screenshot history [--dir d] --extract N "
+                  "--out file\n"
+                  "                          [--region x,y,w,h] "
+                  "[--format png|qoi|raw]\n");
+  return 2;
+}
@@ -0,0 +1,137 @@
+#ifndef SCREENSHOT_HISTORY_H
+#define SCREENSHOT_HISTORY_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "image.h"
+#include "platform.h"
+
+// Capture history: every confirmed selection, as it was copied or saved
+// (redacted and annotated), is kept in a local store. A capture is cut into
+// HISTORY_TILE squares from its top-left corner, each keyed by a 128-bit
+// hash of its pixels. Every distinct tile is LZ-packed once into an
+// append-only pack file, so consecutive shots of a mostly unchanged screen
+// only cost the tiles that changed. The tile index is an open-addressing
+// hash table kept in its own file and mapped, so opening the store loads
+// nothing and a lookup is a probe. A capture itself is its size, time and
+// tile keys, appended to a log; any region of any capture is rebuilt by
+// unpacking just the tiles under it.
+//
+//   tiles.pack    HISTORY_TILE_RECORD + packed pixels, per distinct tile
+//   tiles.idx     HISTORY_INDEX + slots (mapped)
+//   captures.log  HISTORY_RECORD + tile keys (row-major), per capture
+//
+// Files are in native byte order. The index can always be rebuilt from the
+// pack (each record carries its key, checked against the unpacked pixels
+// when it is), which is what happens if a writer died half-way through a
+// capture. One process writes at a time, holding a lock on tiles.pack;
+// readers never write, and rebuild a stale index in their own memory.
+
+#define HISTORY_TILE 64
+#define HISTORY_MIN_SLOTS 4096 // power of two; grown to stay half empty
+#define HISTORY_PATH_MAX 1024
+
+typedef struct {
+  uint64_t lo, hi; // both zero marks an empty index slot
+} HISTORY_KEY;
+
+typedef struct {
+  HISTORY_KEY key;
+  uint32_t size; // packed bytes; w * h * 4 when stored as is
+  uint16_t w, h; // HISTORY_TILE, or less on a capture's right/bottom edge
+} HISTORY_TILE_RECORD;
+
+typedef struct {
+  HISTORY_KEY key;
+  uint64_t offset; // of the tile's record in tiles.pack
+  uint32_t size;
+  uint16_t w, h;
+} HISTORY_SLOT;
+
+typedef struct {
+  char magic[8];      // "SHIDX01"
+  uint64_t slots;     // power of two, following this header
+  uint64_t used;
+  uint64_t packBytes; // length of tiles.pack the slots describe
+  uint64_t dirty;     // set while a capture is being added
+  uint64_t reserved[3];
+} HISTORY_INDEX;
+
+typedef struct {
+  char magic[4]; // "SHC1"
+  uint32_t w, h;
+  uint32_t tiles; // columns * rows
+  int64_t time;   // seconds since 1970
+} HISTORY_RECORD;
+
+typedef struct {
+  int64_t time;
+  int w, h;
+  long long keys; // offset of its tile keys in captures.log
+} HISTORY_CAPTURE;
+
+typedef struct {
+  unsigned long long captures, tiles, newTiles; // added since open
+  unsigned long long pixelBytes, packBytes; // their input; new records
+  long long addNs, hashNs, packNs;
+  unsigned long long reads;
+  long long readNs, rebuildNs;
+} HISTORY_STATS;
+
+typedef struct {
+  char dir[HISTORY_PATH_MAX];
+  FILE *pack, *log;
+  FILE_MAP idx;
+  int mapped, writer;
+  long long packEnd, logEnd;
+  HISTORY_CAPTURE *capture;
+  int n, cap;
+  HISTORY_STATS stats;
+
+  // History_Add scratch
+  HISTORY_KEY *keys;
+  uint32_t *fresh; // tiles new to the store
+  size_t keyCap;
+  unsigned char *work;
+} HISTORY;
+
+// The store directory: $SCREENSHOT_HISTORY if set ("0" or empty turns the
+// history off), else screenshot/history under the per-user data directory
+// ($XDG_DATA_HOME or ~/.local/share, %LOCALAPPDATA% on Windows). Returns 0
+// when off or unknown.
+int History_Dir(char *buf, size_t n);
+
+// Opens the store in dir read-only, or if `write` for adding, creating it
+// if missing; fails if another process has it open for writing. Returns 0
+// on failure.
+int History_Open(HISTORY *h, const char *dir, int write);
+void History_Close(HISTORY *h);
+
+// Adds a capture; returns its number, or -1 (the store is left as it was,
+// as it always is when opened read-only).
+int History_Add(HISTORY *h, const IMAGE *img, int64_t time);
+// Rebuilds r of capture i (all of it if r is NULL) as a new heap image.
+int History_Read(HISTORY *h, int i, const IRECT *r, IMAGE *out);
+
+// Sizes for reports: what the captures would take as plain pixels, what
+// the store takes on disk, and tile references against distinct tiles.
+typedef struct {
+  int captures;
+  unsigned long long pixelBytes, diskBytes, tileRefs, tiles;
+} HISTORY_USAGE;
+
+void History_Usage(const HISTORY *h, HISTORY_USAGE *u);
+
+// One-line summary for the stats logs of what was added since `before` (a
+// copy of h->stats): tiles new, time, throughput and store usage.
+void History_Describe(const HISTORY *h, const HISTORY_STATS *before,
+                      char *buf, size_t n);
+
+// `screenshot history`: lists the captures and store usage as JSON, or
+// with --extract N writes capture N (negative counts from the newest) to
+// --out. Exits 0 on success, 1 if the store or capture cannot be read and
+// 2 on bad arguments.
+int History_Main(int argc, char **argv);
+
+#endif
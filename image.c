@@ -0,0 +1,83 @@
+#include "image.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+int Image_Alloc(IMAGE *img, int w, int h) {
+  img->px = NULL;
+  img->w = img->h = img->stride = 0;
+  if (w <= 0 || h <= 0)
+    return 0;
+  img->px = (unsigned char *)malloc((size_t)w * (size_t)h * 4);
+  if (!img->px)
+    return 0;
+  img->w = w;
+  img->h = h;
+  img->stride = w * 4;
+  return 1;
+}
+
+void Image_Free(IMAGE *img) {
+  free(img->px);
+  img->px = NULL;
+  img->w = img->h = img->stride = 0;
+}
+
+int Image_Crop(const IMAGE *src, const IRECT *r, IMAGE *out) {
+  IRECT bounds = {0, 0, src->w, src->h}, c;
+  if (!IRect_Intersect(r, &bounds, &c) ||
+      !Image_Alloc(out, c.right - c.left, c.bottom - c.top))
+    return 0;
+  for (int y = 0; y < out->h; y++)
+    memcpy(IMAGE_ROW(out, y), IMAGE_ROW(src, c.top + y) + (size_t)c.left * 4,
+           (size_t)out->w * 4);
+  return 1;
+}
+
+int IRect_IsEmpty(const IRECT *r) {
+  return r->right <= r->left || r->bottom <= r->top;
+}
+
+int IRect_Intersect(const IRECT *a, const IRECT *b, IRECT *out) {
+  IRECT r;
+  r.left = a->left > b->left ? a->left : b->left;
+  r.top = a->top > b->top ? a->top : b->top;
+  r.right = a->right < b->right ? a->right : b->right;
+  r.bottom = a->bottom < b->bottom ? a->bottom : b->bottom;
+  if (IRect_IsEmpty(&r)) {
+    out->left = out->top = out->right = out->bottom = 0;
+    return 0;
+  }
+  *out = r;
+  return 1;
+}
+
+void IRect_Union(const IRECT *a, const IRECT *b, IRECT *out) {
+  if (IRect_IsEmpty(a)) {
+    *out = *b;
+    return;
+  }
+  if (IRect_IsEmpty(b)) {
+    *out = *a;
+    return;
+  }
+  IRECT r;
+  r.left = a->left < b->left ? a->left : b->left;
+  r.top = a->top < b->top ? a->top : b->top;
+  r.right = a->right > b->right ? a->right : b->right;
+  r.bottom = a->bottom > b->bottom ? a->bottom : b->bottom;
+  *out = r;
+}
+
+void IRect_Normalize(IRECT *r) {
+  if (r->left > r->right) {
+    int t = r->left;
+    r->left = r->right;
+    r->right = t;
+  }
+  if (r->top > r->bottom) {
+    int t = r->top;
+    r->top = r->bottom;
+    r->bottom = t;
+  }
+}
@@ -0,0 +1,32 @@
+#ifndef SCREENSHOT_IMAGE_H
+#define SCREENSHOT_IMAGE_H
+
+#include <stddef.h>
+
+// 32-bpp BGRA pixels, top-down, rows `stride` bytes apart. This is the layout
+// of a top-down DIB section on Windows and a ZPixmap XImage on Linux, so the
+// portable modules work on capture memory in place.
+typedef struct {
+  unsigned char *px;
+  int w, h, stride;
+} IMAGE;
+
+// Half-open pixel rectangle, same convention as a Win32 RECT.
+typedef struct {
+  int left, top, right, bottom;
+} IRECT;
+
+#define IMAGE_ROW(img, y) ((img)->px + (size_t)(y) * (size_t)(img)->stride)
+
+// Heap images (tightly packed, stride = w * 4).
+int Image_Alloc(IMAGE *img, int w, int h);
+void Image_Free(IMAGE *img);
+// Copies r (clipped to src) into a new heap image.
+int Image_Crop(const IMAGE *src, const IRECT *r, IMAGE *out);
+
+int IRect_IsEmpty(const IRECT *r);
+int IRect_Intersect(const IRECT *a, const IRECT *b, IRECT *out);
+void IRect_Union(const IRECT *a, const IRECT *b, IRECT *out);
+void IRect_Normalize(IRECT *r);
+
+#endif
@@ -0,0 +1,151 @@
+#include "lz.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#define MIN_MATCH 4
+#define LAST_LITERALS 5 // the format ends every block with literals
+#define MF_LIMIT 12     // no match may start closer than this to the end
+#define HASH_LOG 13
+#define MAX_OFFSET 65535
+
+static uint32_t Read32(const unsigned char *p) {
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return v;
+}
+static uint64_t Read64(const unsigned char *p) {
+  uint64_t v;
+  memcpy(&v, p, 8);
+  return v;
+}
+static unsigned Hash(uint32_t v) {
+  return (v * 2654435761u) >> (32 - HASH_LOG);
+}
+
+// 255-run length continuation bytes
+static unsigned char *PutLength(unsigned char *op, size_t len) {
+  for (; len >= 255; len -= 255)
+    *op++ = 255;
+  *op++ = (unsigned char)len;
+  return op;
+}
+
+static unsigned char *PutSequence(unsigned char *op, const unsigned char *lit,
+                                  size_t nlit, size_t offset, size_t mlen) {
+  unsigned char *token = op++;
+  *token = (unsigned char)((nlit >= 15 ? 15 : nlit) << 4);
+  if (nlit >= 15)
+    op = PutLength(op, nlit - 15);
+  memcpy(op, lit, nlit);
+  op += nlit;
+  if (!offset)
+    return op; // final literals
+  *op++ = (unsigned char)offset;
+  *op++ = (unsigned char)(offset >> 8);
+  mlen -= MIN_MATCH;
+  *token |= (unsigned char)(mlen >= 15 ? 15 : mlen);
+  if (mlen >= 15)
+    op = PutLength(op, mlen - 15);
+  return op;
+}
+
+size_t Lz_Bound(size_t n) { return n + n / 255 + 16; }
+
+size_t Lz_Compress(const unsigned char *src, size_t n, unsigned char *dst) {
+  uint32_t table[1 << HASH_LOG];
+  const unsigned char *ip = src, *anchor = src, *end = src + n;
+  unsigned char *op = dst;
+  if (n > MF_LIMIT) {
+    const unsigned char *mfLimit = end - MF_LIMIT;
+    const unsigned char *matchLimit = end - LAST_LITERALS;
+    memset(table, 0, sizeof(table));
+    unsigned misses = 0;
+    ip++;
+    while (ip < mfLimit) {
+      uint32_t seq = Read32(ip);
+      unsigned h = Hash(seq);
+      const unsigned char *ref = src + table[h];
+      table[h] = (uint32_t)(ip - src);
+      if (ref >= ip || ip - ref > MAX_OFFSET || Read32(ref) != seq) {
+        ip += 1 + (misses++ >> 6); // skip faster through noise
+        continue;
+      }
+      misses = 0;
+      while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+        ip--;
+        ref--;
+      }
+      const unsigned char *m = ip + MIN_MATCH, *r = ref + MIN_MATCH;
+      while (m + 8 <= matchLimit && Read64(m) == Read64(r)) {
+        m += 8;
+        r += 8;
+      }
+      while (m < matchLimit && *m == *r) {
+        m++;
+        r++;
+      }
+      op = PutSequence(op, anchor, (size_t)(ip - anchor), (size_t)(ip - ref),
+                       (size_t)(m - ip));
+      ip = anchor = m;
+      if (ip < mfLimit)
+        table[Hash(Read32(ip - 2))] = (uint32_t)(ip - 2 - src);
+    }
+  }
+  op = PutSequence(op, anchor, (size_t)(end - anchor), 0, 0);
+  return (size_t)(op - dst);
+}
+
+static int GetLength(const unsigned char **ip, const unsigned char *end,
+                     size_t *len) {
+  unsigned b;
+  do {
+    if (*ip >= end)
+      return 0;
+    b = *(*ip)++;
+    *len += b;
+  } while (b == 255);
+  return 1;
+}
+
+size_t Lz_Decompress(const unsigned char *src, size_t n, unsigned char *dst,
+                     size_t cap) {
+  const unsigned char *ip = src, *end = src + n;
+  unsigned char *op = dst, *oend = dst + cap;
+  while (ip < end) {
+    unsigned token = *ip++;
+    size_t nlit = token >> 4;
+    if (nlit == 15 && !GetLength(&ip, end, &nlit))
+      return 0;
+    if ((size_t)(end - ip) < nlit || (size_t)(oend - op) < nlit)
+      return 0;
+    memcpy(op, ip, nlit);
+    ip += nlit;
+    op += nlit;
+    if (ip == end)
+      break; // final literals
+    if (end - ip < 2)
+      return 0;
+    size_t offset = ip[0] | (size_t)ip[1] << 8;
+    ip += 2;
+    size_t mlen = token & 15;
+    if (mlen == 15 && !GetLength(&ip, end, &mlen))
+      return 0;
+    mlen += MIN_MATCH;
+    if (!offset || offset > (size_t)(op - dst) ||
+        (size_t)(oend - op) < mlen)
+      return 0;
+    // A short offset repeats a pattern; any multiple of it >= 8 is an equally
+    // valid source, and lets the copy go 8 bytes at a time.
+    size_t d = offset < 8 ? offset * ((8 + offset - 1) / offset) : offset;
+    size_t i = 0;
+    for (; i < mlen && i < d - offset; i++)
+      op[i] = op[i - offset];
+    for (; i + 8 <= mlen; i += 8)
+      memcpy(op + i, op + i - d, 8);
+    for (; i < mlen; i++)
+      op[i] = op[i - offset];
+    op += mlen;
+  }
+  return (size_t)(op - dst);
+}
@@ -0,0 +1,22 @@
+#ifndef SCREENSHOT_LZ_H
+#define SCREENSHOT_LZ_H
+
+#include <stddef.h>
+
+// Fast LZ77 block codec (LZ4 block format: token, literals, 16-bit offset,
+// match length), used to keep captured pixels compressed in memory. Screen
+// content is mostly flat runs and repeats, so it packs well at memcpy-like
+// speeds.
+
+// Worst-case compressed size for n input bytes.
+size_t Lz_Bound(size_t n);
+
+// Compresses n bytes; dst must hold Lz_Bound(n). Returns the packed size.
+size_t Lz_Compress(const unsigned char *src, size_t n, unsigned char *dst);
+
+// Returns the unpacked size, or 0 if the input is malformed or would not fit
+// in cap bytes.
+size_t Lz_Decompress(const unsigned char *src, size_t n, unsigned char *dst,
+                     size_t cap);
+
+#endif
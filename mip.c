@@ -0,0 +1,203 @@
+#include "mip.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef PLATFORM_X86
+#include <emmintrin.h>
+#endif
+
+#define MIP_GRAIN 16 // output rows per Par_For chunk
+
+// out[i] = mean of pixels 2i, 2i + 1 of rows a and b, for i < n (rounded
+// pairwise, the way _mm_avg_epu8 does).
+static void Mip_HalfRow(const unsigned char *a, const unsigned char *b, int n,
+                        unsigned char *out) {
+  int i = 0;
+#ifdef PLATFORM_X86
+  for (; i + 4 <= n; i += 4) {
+    const unsigned char *pa = a + (size_t)i * 8, *pb = b + (size_t)i * 8;
+    __m128 v0 = _mm_castsi128_ps(
+        _mm_avg_epu8(_mm_loadu_si128((const __m128i *)pa),
+                     _mm_loadu_si128((const __m128i *)pb)));
+    __m128 v1 = _mm_castsi128_ps(
+        _mm_avg_epu8(_mm_loadu_si128((const __m128i *)(pa + 16)),
+                     _mm_loadu_si128((const __m128i *)(pb + 16))));
+    __m128i even = _mm_castps_si128(_mm_shuffle_ps(v0, v1, 0x88));
+    __m128i odd = _mm_castps_si128(_mm_shuffle_ps(v0, v1, 0xDD));
+    _mm_storeu_si128((__m128i *)(out + (size_t)i * 4),
+                     _mm_avg_epu8(even, odd));
+  }
+#endif
+  for (; i < n; i++)
+    for (int c = 0; c < 4; c++) {
+      const unsigned char *pa = a + (size_t)i * 8 + c;
+      const unsigned char *pb = b + (size_t)i * 8 + c;
+      int left = (pa[0] + pb[0] + 1) >> 1, right = (pa[4] + pb[4] + 1) >> 1;
+      out[(size_t)i * 4 + c] = (unsigned char)((left + right + 1) >> 1);
+    }
+}
+
+typedef struct {
+  const IMAGE *src; // tile capture, or the level above
+  IMAGE *dst;
+  int shift;        // 1: halve src; 2: quarter it (tiles only)
+  int sx, sy;       // src pixel of dst (dx, dy)
+  int dx, dy, n;    // first dst pixel and row length
+} MIP_JOB;
+
+static void Mip_Rows(void *ctx, int begin, int end) {
+  const MIP_JOB *j = (const MIP_JOB *)ctx;
+  unsigned char *tmp = NULL;
+  if (j->shift == 2 && !(tmp = (unsigned char *)malloc((size_t)j->n * 16)))
+    return;
+  for (int y = begin; y < end; y++) {
+    const unsigned char *s =
+        IMAGE_ROW(j->src, j->sy + (y << j->shift)) + (size_t)j->sx * 4;
+    unsigned char *d = IMAGE_ROW(j->dst, j->dy + y) + (size_t)j->dx * 4;
+    if (j->shift == 1) {
+      Mip_HalfRow(s, s + j->src->stride, j->n, d);
+    } else {
+      unsigned char *t1 = tmp + (size_t)j->n * 8;
+      Mip_HalfRow(s, s + j->src->stride, j->n * 2, tmp);
+      s += (size_t)j->src->stride * 2;
+      Mip_HalfRow(s, s + j->src->stride, j->n * 2, t1);
+      Mip_HalfRow(tmp, t1, j->n, d);
+    }
+  }
+  free(tmp);
+}
+
+// The first level straight from the tiles: dst pixel (x, y) covers frame
+// pixels [x << shift, (x + 1) << shift), so only blocks inside one tile
+// are filled and the rest (gaps, blocks across monitor edges) stay black.
+static void Mip_FromTiles(const FRAMEBUFFER *fb, IMAGE *dst, int shift) {
+  int b = 1 << shift;
+  size_t covered = 0;
+  int split = 0;
+  for (int i = 0; i < fb->ntiles; i++) {
+    const IRECT *a = &fb->tiles[i].area;
+    covered += (size_t)(a->right - a->left) * (size_t)(a->bottom - a->top);
+    split |= (a->left | a->top | a->right | a->bottom) & (b - 1);
+  }
+  if (split || covered < (size_t)fb->w * fb->h)
+    for (int y = 0; y < dst->h; y++) {
+      uint32_t *p = (uint32_t *)IMAGE_ROW(dst, y);
+      for (int x = 0; x < dst->w; x++)
+        p[x] = 0xFF000000u;
+    }
+  for (int i = 0; i < fb->ntiles; i++) {
+    const FB_TILE *t = &fb->tiles[i];
+    int x0 = (t->area.left + b - 1) >> shift, x1 = t->area.right >> shift;
+    int y0 = (t->area.top + b - 1) >> shift, y1 = t->area.bottom >> shift;
+    if (x1 > dst->w)
+      x1 = dst->w;
+    if (y1 > dst->h)
+      y1 = dst->h;
+    if (x1 <= x0 || y1 <= y0)
+      continue;
+    MIP_JOB j = {&t->capture, dst, shift, (x0 << shift) - t->area.left,
+                 (y0 << shift) - t->area.top, x0, y0, x1 - x0};
+    Par_For(y1 - y0, MIP_GRAIN, Mip_Rows, &j);
+  }
+}
+
+static void Mip_FreeLevels(MIP_PYRAMID *m) {
+  for (int i = 0; i < MIP_LEVELS; i++)
+    Image_Free(&m->level[i]);
+  m->n = 0;
+}
+
+int Mip_Build(MIP_PYRAMID *m, const FRAMEBUFFER *fb) {
+  long long t0 = Clock_Ns();
+  Atomic_Store(&m->ready, 0);
+  Mip_FreeLevels(m);
+  memset(&m->stats, 0, sizeof(m->stats));
+  m->w = fb->w;
+  m->h = fb->h;
+  m->first = Framebuffer_Bytes(fb) > MIP_HALF_MAX_BYTES ? 2 : 1;
+  int ok = 1;
+  for (int i = 0; i < MIP_LEVELS; i++) {
+    int shift = m->first + i;
+    int w = fb->w >> shift, h = fb->h >> shift;
+    if (w < 1 || h < 1 || (i > 0 && w < MIP_MIN_SIDE && h < MIP_MIN_SIDE))
+      break;
+    IMAGE *l = &m->level[i];
+    if (!Image_Alloc(l, w, h)) {
+      ok = 0;
+      break;
+    }
+    if (i == 0) {
+      Mip_FromTiles(fb, l, m->first);
+    } else {
+      MIP_JOB j = {&m->level[i - 1], l, 1, 0, 0, 0, 0, w};
+      Par_For(h, MIP_GRAIN, Mip_Rows, &j);
+    }
+    m->stats.bytes += (size_t)w * h * 4;
+    m->n = i + 1;
+  }
+  m->stats.buildNs = Clock_Ns() - t0;
+  Atomic_Store(&m->ready, 1);
+  return ok;
+}
+
+static void Mip_Worker(void *arg) {
+  MIP_PYRAMID *m = (MIP_PYRAMID *)arg;
+  Mip_Build(m, m->fb);
+}
+
+void Mip_BuildAsync(MIP_PYRAMID *m, const FRAMEBUFFER *fb) {
+  Mip_Wait(m);
+  Atomic_Store(&m->ready, 0);
+  m->fb = fb;
+  m->threaded = Thread_Start(&m->thread, Mip_Worker, m);
+  if (!m->threaded)
+    Mip_Build(m, fb);
+}
+
+void Mip_Wait(MIP_PYRAMID *m) {
+  if (m->threaded)
+    Thread_Join(m->thread);
+  m->threaded = 0;
+  m->fb = NULL;
+}
+
+int Mip_Ready(const MIP_PYRAMID *m) { return Atomic_Load(&m->ready) != 0; }
+
+void Mip_Free(MIP_PYRAMID *m) {
+  Mip_Wait(m);
+  Mip_FreeLevels(m);
+  memset(m, 0, sizeof(*m));
+}
+
+void Mip_DrawFit(const MIP_PYRAMID *m, IMAGE *dst, const IRECT *box,
+                 const IRECT *clip) {
+  IRECT r, full = {0, 0, dst->w, dst->h};
+  if (!Mip_Ready(m) || !m->n || !IRect_Intersect(box, clip, &r) ||
+      !IRect_Intersect(&r, &full, &r))
+    return;
+  int bw = box->right - box->left, bh = box->bottom - box->top;
+  // the smallest level that still has a pixel for every target pixel
+  int li = 0;
+  while (li + 1 < m->n && m->level[li + 1].w >= bw &&
+         m->level[li + 1].h >= bh)
+    li++;
+  const IMAGE *l = &m->level[li];
+  int n = r.right - r.left;
+  int *xs = (int *)malloc((size_t)n * sizeof(int));
+  if (!xs)
+    return;
+  // nearest source pixel to each target pixel's center
+  for (int i = 0; i < n; i++)
+    xs[i] = (int)(((long long)(r.left + i - box->left) * 2 + 1) * l->w /
+                  (2LL * bw));
+  for (int y = r.top; y < r.bottom; y++) {
+    int sy = (int)(((long long)(y - box->top) * 2 + 1) * l->h / (2LL * bh));
+    const uint32_t *s = (const uint32_t *)IMAGE_ROW(l, sy);
+    uint32_t *d = (uint32_t *)IMAGE_ROW(dst, y) + r.left;
+    for (int i = 0; i < n; i++)
+      d[i] = s[xs[i]];
+  }
+  free(xs);
+}
@@ -0,0 +1,54 @@
+#ifndef SCREENSHOT_MIP_H
+#define SCREENSHOT_MIP_H
+
+#include "framebuffer.h"
+#include "image.h"
+#include "platform.h"
+
+// Mip pyramid of a capture: successive half-size copies, each pixel the
+// mean of a 2x2 block of the level above, down to MIP_MIN_SIDE. Minified
+// draws (the zoom-to-fit overview) sample the smallest level that is still
+// at least as large as the target, so drawing the whole desktop costs the
+// target's pixels, not the frame's. Magnified draws read the frame itself.
+//
+// Level 1 (half size) is skipped for frames over MIP_HALF_MAX_BYTES, which
+// keeps the pyramid of a 16K desktop near 1/12 of the frame.
+
+#define MIP_LEVELS 12
+#define MIP_MIN_SIDE 64
+#define MIP_HALF_MAX_BYTES (64u << 20)
+
+typedef struct {
+  long long buildNs;
+  size_t bytes;
+} MIP_STATS;
+
+typedef struct {
+  int w, h; // frame size
+  int first, n;            // level[i] is the frame at 1 / 2^(first + i)
+  IMAGE level[MIP_LEVELS]; // gaps between monitors are black
+  MIP_STATS stats;
+
+  // Mip_BuildAsync
+  const FRAMEBUFFER *fb;
+  THREAD thread;
+  int threaded;
+  volatile long ready;
+} MIP_PYRAMID;
+
+// Builds the pyramid from the capture pixels of fb. Returns 0 if out of
+// memory (the levels built so far are kept).
+int Mip_Build(MIP_PYRAMID *m, const FRAMEBUFFER *fb);
+// Mip_Build on a worker thread; the capture pixels must stay until Mip_Wait
+// or Mip_Free.
+void Mip_BuildAsync(MIP_PYRAMID *m, const FRAMEBUFFER *fb);
+void Mip_Wait(MIP_PYRAMID *m);
+int Mip_Ready(const MIP_PYRAMID *m);
+void Mip_Free(MIP_PYRAMID *m);
+
+// Draws the whole frame scaled into box (of dst), only where it meets clip.
+// Draws nothing until the pyramid is ready.
+void Mip_DrawFit(const MIP_PYRAMID *m, IMAGE *dst, const IRECT *box,
+                 const IRECT *clip);
+
+#endif
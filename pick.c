@@ -0,0 +1,111 @@
+#include "pick.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "platform.h"
+
+static int Pick_Min(int a, int b) { return a < b ? a : b; }
+
+// Visits every cell r reaches into that is still open, topmost window first:
+// counts (fill == NULL) or fills the cell lists, closing cells r covers.
+static void Pick_Cells(PICK_INDEX *p, int i, unsigned char *closed,
+                       int *fill) {
+  const IRECT *r = &p->rects[i], *b = &p->bounds;
+  int cx0 = (r->left - b->left) / p->cell;
+  int cx1 = (r->right - 1 - b->left) / p->cell;
+  int cy0 = (r->top - b->top) / p->cell;
+  int cy1 = (r->bottom - 1 - b->top) / p->cell;
+  for (int cy = cy0; cy <= cy1; cy++) {
+    int top = b->top + cy * p->cell;
+    int bottom = Pick_Min(top + p->cell, b->bottom);
+    for (int cx = cx0; cx <= cx1; cx++) {
+      int c = cy * p->gw + cx;
+      if (closed[c])
+        continue;
+      if (fill)
+        p->list[fill[c]++] = i;
+      else
+        p->start[c + 1]++;
+      int left = b->left + cx * p->cell;
+      int right = Pick_Min(left + p->cell, b->right);
+      closed[c] = r->left <= left && r->right >= right && r->top <= top &&
+                  r->bottom >= bottom;
+    }
+  }
+}
+
+int Pick_Build(PICK_INDEX *p, const IRECT *rects, int n, const IRECT *bounds) {
+  long long t0 = Clock_Ns();
+  Pick_Free(p);
+  p->bounds = *bounds;
+  int bw = bounds->right - bounds->left, bh = bounds->bottom - bounds->top;
+  if (bw <= 0 || bh <= 0 || n <= 0)
+    return 1;
+  int side = bw > bh ? bw : bh;
+  p->cell = (side + PICK_GRID - 1) / PICK_GRID;
+  if (p->cell < PICK_CELL_MIN)
+    p->cell = PICK_CELL_MIN;
+  p->gw = (bw + p->cell - 1) / p->cell;
+  p->gh = (bh + p->cell - 1) / p->cell;
+  size_t ncell = (size_t)p->gw * (size_t)p->gh;
+  p->rects = (IRECT *)malloc((size_t)n * sizeof(IRECT));
+  p->start = (int *)calloc(ncell + 1, sizeof(int));
+  unsigned char *closed = (unsigned char *)calloc(ncell, 1);
+  int *fill = (int *)malloc(ncell * sizeof(int));
+  int ok = p->rects && p->start && closed && fill;
+  if (ok) {
+    p->n = n;
+    for (int i = 0; i < n; i++)
+      if (!IRect_Intersect(&rects[i], bounds, &p->rects[i]))
+        p->rects[i] = (IRECT){0, 0, 0, 0};
+    for (int i = 0; i < n; i++)
+      if (!IRect_IsEmpty(&p->rects[i]))
+        Pick_Cells(p, i, closed, NULL);
+    for (size_t c = 0; c < ncell; c++) {
+      if (p->stats.longest < p->start[c + 1])
+        p->stats.longest = p->start[c + 1];
+      p->start[c + 1] += p->start[c];
+    }
+    p->stats.entries = (size_t)p->start[ncell];
+    ok = (p->list = (int *)malloc((p->stats.entries ? p->stats.entries : 1) *
+                                  sizeof(int))) != NULL;
+  }
+  if (ok) {
+    memcpy(fill, p->start, ncell * sizeof(int));
+    memset(closed, 0, ncell);
+    for (int i = 0; i < n; i++)
+      if (!IRect_IsEmpty(&p->rects[i]))
+        Pick_Cells(p, i, closed, fill);
+  }
+  free(closed);
+  free(fill);
+  if (!ok) {
+    Pick_Free(p);
+    return 0;
+  }
+  p->stats.buildNs = Clock_Ns() - t0;
+  return 1;
+}
+
+int Pick_Hit(const PICK_INDEX *p, int x, int y) {
+  if (!p->list)
+    return -1;
+  const IRECT *b = &p->bounds;
+  if (x < b->left || y < b->top || x >= b->right || y >= b->bottom)
+    return -1;
+  int c = (y - b->top) / p->cell * p->gw + (x - b->left) / p->cell;
+  for (int k = p->start[c]; k < p->start[c + 1]; k++) {
+    const IRECT *r = &p->rects[p->list[k]];
+    if (x >= r->left && x < r->right && y >= r->top && y < r->bottom)
+      return p->list[k];
+  }
+  return -1;
+}
+
+void Pick_Free(PICK_INDEX *p) {
+  free(p->rects);
+  free(p->start);
+  free(p->list);
+  memset(p, 0, sizeof(*p));
+}
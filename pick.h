@@ -0,0 +1,40 @@
+#ifndef SCREENSHOT_PICK_H
+#define SCREENSHOT_PICK_H
+
+#include <stddef.h>
+
+#include "image.h"
+
+// Window picking: the top-level window rectangles, in stacking order, laid
+// over a uniform grid. Each cell lists the windows that reach into it,
+// topmost first, and the list ends at the first window that covers the whole
+// cell, since nothing below it can be hit there. A hit test is one cell
+// lookup and a short scan, with no dependence on how many windows exist.
+
+#define PICK_GRID 64     // cells along the longer side of the bounds
+#define PICK_CELL_MIN 16 // smallest cell, in pixels
+
+typedef struct {
+  long long buildNs;
+  size_t entries; // cell list entries
+  int longest;    // longest cell list
+} PICK_STATS;
+
+typedef struct {
+  int n;
+  IRECT *rects; // clipped to bounds; topmost first
+  IRECT bounds;
+  int cell, gw, gh;
+  int *start; // window indices of cell c: list[start[c] .. start[c + 1])
+  int *list;
+  PICK_STATS stats;
+} PICK_INDEX;
+
+// Indexes n rectangles, topmost first, clipped to bounds. Returns 0 if out
+// of memory (the index is then empty).
+int Pick_Build(PICK_INDEX *p, const IRECT *rects, int n, const IRECT *bounds);
+// Index of the topmost rectangle containing (x, y), or -1.
+int Pick_Hit(const PICK_INDEX *p, int x, int y);
+void Pick_Free(PICK_INDEX *p);
+
+#endif
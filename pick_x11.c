@@ -0,0 +1,77 @@
+#include "pick_x11.h"
+
+#include <X11/Xatom.h>
+#include <stdlib.h>
+
+// A 32-bit property of the given type (items as longs, free with XFree), or
+// NULL.
+static long *PickX11_Property(Display *dpy, Window w, Atom prop, Atom type,
+                              unsigned long *n) {
+  Atom actual;
+  int format;
+  unsigned long after;
+  unsigned char *data = NULL;
+  if (XGetWindowProperty(dpy, w, prop, 0, 1 << 16, False, type, &actual,
+                         &format, n, &after, &data) != Success)
+    return NULL;
+  if (actual != type || format != 32 || !*n) {
+    if (data)
+      XFree(data);
+    return NULL;
+  }
+  return (long *)data;
+}
+
+int PickX11_List(Display *dpy, Window skip, IRECT **out) {
+  Window root = DefaultRootWindow(dpy), *kids = NULL;
+  unsigned long n = 0;
+  long *clients = PickX11_Property(
+      dpy, root, XInternAtom(dpy, "_NET_CLIENT_LIST_STACKING", False),
+      XA_WINDOW, &n);
+  Atom frame = XInternAtom(dpy, "_NET_FRAME_EXTENTS", False);
+  Atom gtk = XInternAtom(dpy, "_GTK_FRAME_EXTENTS", False);
+  if (!clients) {
+    Window r, parent;
+    unsigned nkids = 0;
+    if (!XQueryTree(dpy, root, &r, &parent, &kids, &nkids))
+      nkids = 0;
+    n = nkids;
+  }
+  int count = 0;
+  *out = (IRECT *)malloc((n ? n : 1) * sizeof(IRECT));
+  for (unsigned long k = n; *out && k-- > 0;) { // both lists go bottom up
+    Window w = clients ? (Window)clients[k] : kids[k];
+    XWindowAttributes wa;
+    if (w == skip || !XGetWindowAttributes(dpy, w, &wa) ||
+        wa.map_state != IsViewable || wa.class != InputOutput)
+      continue;
+    IRECT r = {wa.x, wa.y, wa.x + wa.width + 2 * wa.border_width,
+               wa.y + wa.height + 2 * wa.border_width};
+    if (clients) {
+      Window child;
+      int x, y;
+      if (!XTranslateCoordinates(dpy, w, root, 0, 0, &x, &y, &child))
+        continue;
+      r = (IRECT){x, y, x + wa.width, y + wa.height};
+      unsigned long m;
+      long *e;
+      if ((e = PickX11_Property(dpy, w, gtk, XA_CARDINAL, &m))) {
+        if (m == 4)
+          r = (IRECT){r.left + (int)e[0], r.top + (int)e[2],
+                      r.right - (int)e[1], r.bottom - (int)e[3]};
+      } else if ((e = PickX11_Property(dpy, w, frame, XA_CARDINAL, &m))) {
+        if (m == 4)
+          r = (IRECT){r.left - (int)e[0], r.top - (int)e[2],
+                      r.right + (int)e[1], r.bottom + (int)e[3]};
+      }
+      if (e)
+        XFree(e);
+    }
+    (*out)[count++] = r;
+  }
+  if (clients)
+    XFree(clients);
+  if (kids)
+    XFree(kids);
+  return count;
+}
@@ -0,0 +1,19 @@
+#ifndef SCREENSHOT_PICK_X11_H
+#define SCREENSHOT_PICK_X11_H
+
+#include <X11/Xlib.h>
+
+#include "image.h"
+
+// The windows the overlay can pick (pick.h indexes them). Windows may be
+// destroyed while they are queried, so the caller should drop X errors on
+// this connection.
+
+// Viewable top-level windows in root coordinates, topmost first, except
+// skip. With an EWMH window manager these are its clients, grown by their
+// decorations (_NET_FRAME_EXTENTS) or shrunk by client-side shadows
+// (_GTK_FRAME_EXTENTS); otherwise the root's children as they are. *out is
+// malloc'ed (NULL if out of memory); returns the count.
+int PickX11_List(Display *dpy, Window skip, IRECT **out);
+
+#endif
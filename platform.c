@@ -0,0 +1,603 @@
+#ifndef _WIN32
+#define _GNU_SOURCE // clock_gettime, sysconf
+#define _FILE_OFFSET_BITS 64 // fseeko/ftello past 2 GB on 32-bit builds
+#endif
+#include "platform.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <intrin.h>
+#include <io.h>
+#include <psapi.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+typedef struct {
+  THREAD_FN fn;
+  void *arg;
+} THREAD_START;
+
+#ifdef _WIN32
+static DWORD WINAPI Thread_Trampoline(LPVOID p) {
+  THREAD_START ts = *(THREAD_START *)p;
+  free(p);
+  ts.fn(ts.arg);
+  return 0;
+}
+#else
+static void *Thread_Trampoline(void *p) {
+  THREAD_START ts = *(THREAD_START *)p;
+  free(p);
+  ts.fn(ts.arg);
+  return NULL;
+}
+#endif
+
+int Thread_Start(THREAD *t, THREAD_FN fn, void *arg) {
+  THREAD_START *ts = (THREAD_START *)malloc(sizeof(*ts));
+  if (!ts)
+    return 0;
+  ts->fn = fn;
+  ts->arg = arg;
+#ifdef _WIN32
+  *t = CreateThread(NULL, 0, Thread_Trampoline, ts, 0, NULL);
+  if (!*t) {
+    free(ts);
+    return 0;
+  }
+#else
+  if (pthread_create(t, NULL, Thread_Trampoline, ts) != 0) {
+    free(ts);
+    return 0;
+  }
+#endif
+  return 1;
+}
+
+void Thread_Join(THREAD t) {
+#ifdef _WIN32
+  WaitForSingleObject(t, INFINITE);
+  CloseHandle(t);
+#else
+  pthread_join(t, NULL);
+#endif
+}
+
+#ifdef _WIN32
+void Mutex_Init(MUTEX *m) { InitializeSRWLock(m); }
+void Mutex_Destroy(MUTEX *m) { (void)m; }
+void Mutex_Lock(MUTEX *m) { AcquireSRWLockExclusive(m); }
+int Mutex_TryLock(MUTEX *m) { return TryAcquireSRWLockExclusive(m) != 0; }
+void Mutex_Unlock(MUTEX *m) { ReleaseSRWLockExclusive(m); }
+
+void Cond_Init(COND *c) { InitializeConditionVariable(c); }
+void Cond_Destroy(COND *c) { (void)c; }
+void Cond_Wait(COND *c, MUTEX *m) {
+  SleepConditionVariableSRW(c, m, INFINITE, 0);
+}
+void Cond_Signal(COND *c) { WakeConditionVariable(c); }
+void Cond_Broadcast(COND *c) { WakeAllConditionVariable(c); }
+
+long Atomic_Inc(volatile long *v) { return InterlockedIncrement(v); }
+long Atomic_Dec(volatile long *v) { return InterlockedDecrement(v); }
+long Atomic_Load(const volatile long *v) {
+  return InterlockedCompareExchange((volatile long *)v, 0, 0);
+}
+void Atomic_Store(volatile long *v, long x) { InterlockedExchange(v, x); }
+
+long long Clock_Ns(void) {
+  static LARGE_INTEGER freq;
+  LARGE_INTEGER now;
+  if (!freq.QuadPart)
+    QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&now);
+  // split to avoid overflowing on long uptimes
+  long long sec = now.QuadPart / freq.QuadPart;
+  long long rem = now.QuadPart % freq.QuadPart;
+  return sec * 1000000000LL + rem * 1000000000LL / freq.QuadPart;
+}
+
+// Sleep() only has timer-tick resolution, so the last stretch spins.
+void Sleep_Until(long long deadline) {
+  for (;;) {
+    long long left = deadline - Clock_Ns();
+    if (left <= 0)
+      return;
+    if (left > 2000000)
+      Sleep((DWORD)((left - 1000000) / 1000000));
+    else
+      YieldProcessor();
+  }
+}
+
+int Cpu_Count(void) {
+  SYSTEM_INFO si;
+  GetSystemInfo(&si);
+  return si.dwNumberOfProcessors > 0 ? (int)si.dwNumberOfProcessors : 1;
+}
+
+long long Cpu_ProcessNs(void) {
+  FILETIME created, exited, kernel, user;
+  if (!GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user))
+    return 0;
+  ULARGE_INTEGER k = {{kernel.dwLowDateTime, kernel.dwHighDateTime}};
+  ULARGE_INTEGER u = {{user.dwLowDateTime, user.dwHighDateTime}};
+  return (long long)(k.QuadPart + u.QuadPart) * 100; // 100 ns units
+}
+
+size_t Mem_PeakRss(void) {
+  PROCESS_MEMORY_COUNTERS pmc;
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+    return 0;
+  return pmc.PeakWorkingSetSize;
+}
+#else
+void Mutex_Init(MUTEX *m) { pthread_mutex_init(m, NULL); }
+void Mutex_Destroy(MUTEX *m) { pthread_mutex_destroy(m); }
+void Mutex_Lock(MUTEX *m) { pthread_mutex_lock(m); }
+int Mutex_TryLock(MUTEX *m) { return pthread_mutex_trylock(m) == 0; }
+void Mutex_Unlock(MUTEX *m) { pthread_mutex_unlock(m); }
+
+void Cond_Init(COND *c) { pthread_cond_init(c, NULL); }
+void Cond_Destroy(COND *c) { pthread_cond_destroy(c); }
+void Cond_Wait(COND *c, MUTEX *m) { pthread_cond_wait(c, m); }
+void Cond_Signal(COND *c) { pthread_cond_signal(c); }
+void Cond_Broadcast(COND *c) { pthread_cond_broadcast(c); }
+
+long Atomic_Inc(volatile long *v) {
+  return __atomic_add_fetch(v, 1, __ATOMIC_SEQ_CST);
+}
+long Atomic_Dec(volatile long *v) {
+  return __atomic_sub_fetch(v, 1, __ATOMIC_SEQ_CST);
+}
+long Atomic_Load(const volatile long *v) {
+  return __atomic_load_n(v, __ATOMIC_ACQUIRE);
+}
+void Atomic_Store(volatile long *v, long x) {
+  __atomic_store_n(v, x, __ATOMIC_RELEASE);
+}
+
+long long Clock_Ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void Sleep_Until(long long deadline) {
+  struct timespec ts = {(time_t)(deadline / 1000000000LL),
+                        (long)(deadline % 1000000000LL)};
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+  }
+}
+
+int Cpu_Count(void) {
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (int)n : 1;
+}
+
+long long Cpu_ProcessNs(void) {
+  struct rusage ru;
+  if (getrusage(RUSAGE_SELF, &ru))
+    return 0;
+  return ((long long)ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000000LL +
+         ((long long)ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000LL;
+}
+
+size_t Mem_PeakRss(void) {
+  struct rusage ru;
+  if (getrusage(RUSAGE_SELF, &ru))
+    return 0;
+  return (size_t)ru.ru_maxrss * 1024; // kilobytes on Linux
+}
+#endif
+
+static int Cpu_DetectAVX2(void) {
+#if !defined(PLATFORM_X86)
+  return 0;
+#elif defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7)
+    return 0;
+  __cpuid(info, 1);
+  // OSXSAVE + AVX, then make sure the OS saves YMM state
+  if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0)
+    return 0;
+  if ((_xgetbv(0) & 6) != 6)
+    return 0;
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#else
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+#endif
+}
+
+int Cpu_HasAVX2(void) {
+  static volatile long cached = -1;
+  if (cached < 0)
+    cached = Cpu_DetectAVX2();
+  return (int)cached;
+}
+
+// --- Fork/join pool ---
+#define PAR_MAX_WORKERS 64
+
+static struct {
+  int started, workers;
+  THREAD th[PAR_MAX_WORKERS];
+  MUTEX call; // held for the duration of one Par_For
+  MUTEX mu;
+  COND wake, done;
+  unsigned gen;
+  int active;
+  // current job
+  PAR_FN fn;
+  void *ctx;
+  int count, grain, chunks;
+  volatile long next;
+} g_par;
+
+static MUTEX *Par_InitOnce(void);
+
+static void Par_RunChunks(void) {
+  for (;;) {
+    long i = Atomic_Inc(&g_par.next) - 1;
+    if (i >= g_par.chunks)
+      break;
+    int b = (int)i * g_par.grain;
+    int e = b + g_par.grain;
+    if (e > g_par.count)
+      e = g_par.count;
+    g_par.fn(g_par.ctx, b, e);
+  }
+}
+
+static void Par_Worker(void *arg) {
+  (void)arg;
+  unsigned seen = 0;
+  for (;;) {
+    Mutex_Lock(&g_par.mu);
+    while (g_par.gen == seen)
+      Cond_Wait(&g_par.wake, &g_par.mu);
+    seen = g_par.gen;
+    Mutex_Unlock(&g_par.mu);
+
+    Par_RunChunks();
+
+    Mutex_Lock(&g_par.mu);
+    if (--g_par.active == 0)
+      Cond_Signal(&g_par.done);
+    Mutex_Unlock(&g_par.mu);
+  }
+}
+
+#ifdef _WIN32
+static INIT_ONCE g_parOnce = INIT_ONCE_STATIC_INIT;
+static BOOL CALLBACK Par_InitCb(PINIT_ONCE o, PVOID p, PVOID *c) {
+  (void)o;
+  (void)p;
+  (void)c;
+  Mutex_Init(&g_par.call);
+  return TRUE;
+}
+static MUTEX *Par_InitOnce(void) {
+  InitOnceExecuteOnce(&g_parOnce, Par_InitCb, NULL, NULL);
+  return &g_par.call;
+}
+#else
+static pthread_once_t g_parOnce = PTHREAD_ONCE_INIT;
+static void Par_InitCb(void) { Mutex_Init(&g_par.call); }
+static MUTEX *Par_InitOnce(void) {
+  pthread_once(&g_parOnce, Par_InitCb);
+  return &g_par.call;
+}
+#endif
+
+static void Par_Start(void) {
+  Mutex_Init(&g_par.mu);
+  Cond_Init(&g_par.wake);
+  Cond_Init(&g_par.done);
+  int n = Cpu_Count() - 1;
+  if (n > PAR_MAX_WORKERS)
+    n = PAR_MAX_WORKERS;
+  g_par.workers = 0;
+  for (int i = 0; i < n; i++) {
+    if (!Thread_Start(&g_par.th[i], Par_Worker, NULL))
+      break;
+    g_par.workers++;
+  }
+  g_par.started = 1;
+}
+
+void Par_For(int count, int grain, PAR_FN fn, void *ctx) {
+  if (count <= 0)
+    return;
+  if (grain < 1)
+    grain = 1;
+  int chunks = (count + grain - 1) / grain;
+  MUTEX *call = Par_InitOnce();
+  if (chunks == 1 || !Mutex_TryLock(call)) {
+    fn(ctx, 0, count);
+    return;
+  }
+  if (!g_par.started)
+    Par_Start();
+  if (g_par.workers == 0) {
+    Mutex_Unlock(call);
+    fn(ctx, 0, count);
+    return;
+  }
+
+  Mutex_Lock(&g_par.mu);
+  g_par.fn = fn;
+  g_par.ctx = ctx;
+  g_par.count = count;
+  g_par.grain = grain;
+  g_par.chunks = chunks;
+  g_par.next = 0;
+  g_par.active = g_par.workers;
+  g_par.gen++;
+  Cond_Broadcast(&g_par.wake);
+  Mutex_Unlock(&g_par.mu);
+
+  Par_RunChunks();
+
+  Mutex_Lock(&g_par.mu);
+  while (g_par.active > 0)
+    Cond_Wait(&g_par.done, &g_par.mu);
+  Mutex_Unlock(&g_par.mu);
+  Mutex_Unlock(call);
+}
+
+// --- Files ---
+#ifdef _WIN32
+// Arguments arrive as UTF-8; the C runtime would read them as ANSI.
+static int Wide(const char *s, wchar_t *out, int cap) {
+  return MultiByteToWideChar(CP_UTF8, 0, s, -1, out, cap) != 0;
+}
+
+FILE *File_Open(const char *path, const char *mode) {
+  wchar_t wide[4096], wmode[8];
+  if (!Wide(path, wide, 4096) || !Wide(mode, wmode, 8))
+    return NULL;
+  return _wfopen(wide, wmode);
+}
+
+int File_Seek(FILE *f, long long off, int whence) {
+  return _fseeki64(f, off, whence);
+}
+
+long long File_Tell(FILE *f) { return _ftelli64(f); }
+
+static int Dir_Exists(const wchar_t *path) {
+  DWORD a = GetFileAttributesW(path);
+  return a != INVALID_FILE_ATTRIBUTES && (a & FILE_ATTRIBUTE_DIRECTORY);
+}
+
+int Dir_Create(const char *path) {
+  wchar_t wide[4096];
+  if (!Wide(path, wide, 4096))
+    return 0;
+  // Each prefix in turn; drive roots and existing parents just fail.
+  for (wchar_t *p = wide + 1; *p; p++) {
+    if (*p != L'/' && *p != L'\\')
+      continue;
+    wchar_t c = *p;
+    *p = 0;
+    CreateDirectoryW(wide, NULL);
+    *p = c;
+  }
+  CreateDirectoryW(wide, NULL);
+  return Dir_Exists(wide);
+}
+
+// One byte far past any end of file: byte-range locks on Windows block
+// reads of the range, and nothing is ever read there.
+int File_Lock(FILE *f) {
+  HANDLE file = (HANDLE)_get_osfhandle(_fileno(f));
+  OVERLAPPED o;
+  ZeroMemory(&o, sizeof(o));
+  o.Offset = 0xFFFFFFFEu;
+  o.OffsetHigh = 0x7FFFFFFFu;
+  return file != INVALID_HANDLE_VALUE &&
+         LockFileEx(file, LOCKFILE_EXCLUSIVE_LOCK | LOCKFILE_FAIL_IMMEDIATELY,
+                    0, 1, 0, &o);
+}
+
+int FileMap_Open(FILE_MAP *m, const char *path, size_t size) {
+  wchar_t wide[4096];
+  LARGE_INTEGER have;
+  ZeroMemory(m, sizeof(*m));
+  if (!path) { // backed by the page file, zeroed, seen by no one else
+    unsigned long long s64 = size;
+    m->file = INVALID_HANDLE_VALUE;
+    m->map = size ? CreateFileMappingW(INVALID_HANDLE_VALUE, NULL,
+                                       PAGE_READWRITE, (DWORD)(s64 >> 32),
+                                       (DWORD)s64, NULL)
+                  : NULL;
+    m->p = m->map ? (unsigned char *)MapViewOfFile(m->map, FILE_MAP_ALL_ACCESS,
+                                                   0, 0, 0)
+                  : NULL;
+    m->size = size;
+    if (m->p)
+      return 1;
+    FileMap_Close(m);
+    return 0;
+  }
+  if (!Wide(path, wide, 4096))
+    return 0;
+  m->file = CreateFileW(wide, GENERIC_READ | GENERIC_WRITE,
+                        FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_ALWAYS,
+                        FILE_ATTRIBUTE_NORMAL, NULL);
+  if (m->file == INVALID_HANDLE_VALUE)
+    return 0;
+  if (!GetFileSizeEx(m->file, &have))
+    goto fail;
+  size_t old = (size_t)have.QuadPart;
+  if (size < old)
+    size = old;
+  if (!size)
+    goto fail;
+  // Mapping past the end grows the file, but not necessarily with zeros.
+  unsigned long long s64 = size;
+  m->map = CreateFileMappingW(m->file, NULL, PAGE_READWRITE,
+                              (DWORD)(s64 >> 32), (DWORD)s64, NULL);
+  if (!m->map)
+    goto fail;
+  m->p = (unsigned char *)MapViewOfFile(m->map, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+  if (!m->p)
+    goto fail;
+  m->size = size;
+  if (size > old)
+    ZeroMemory(m->p + old, size - old);
+  return 1;
+fail:
+  FileMap_Close(m);
+  return 0;
+}
+
+int FileMap_OpenRead(FILE_MAP *m, const char *path) {
+  wchar_t wide[4096];
+  LARGE_INTEGER have;
+  ZeroMemory(m, sizeof(*m));
+  if (!Wide(path, wide, 4096))
+    return 0;
+  m->file = CreateFileW(wide, GENERIC_READ,
+                        FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (m->file == INVALID_HANDLE_VALUE || !GetFileSizeEx(m->file, &have) ||
+      !have.QuadPart)
+    goto fail;
+  m->map = CreateFileMappingW(m->file, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (!m->map)
+    goto fail;
+  m->p = (unsigned char *)MapViewOfFile(m->map, FILE_MAP_READ, 0, 0, 0);
+  if (!m->p)
+    goto fail;
+  m->size = (size_t)have.QuadPart;
+  return 1;
+fail:
+  FileMap_Close(m);
+  return 0;
+}
+
+void FileMap_Close(FILE_MAP *m) {
+  if (m->p)
+    UnmapViewOfFile(m->p);
+  if (m->map)
+    CloseHandle(m->map);
+  if (m->file && m->file != INVALID_HANDLE_VALUE)
+    CloseHandle(m->file);
+  ZeroMemory(m, sizeof(*m));
+}
+#else
+FILE *File_Open(const char *path, const char *mode) {
+  return fopen(path, mode);
+}
+
+int File_Seek(FILE *f, long long off, int whence) {
+  return fseeko(f, (off_t)off, whence);
+}
+
+long long File_Tell(FILE *f) { return (long long)ftello(f); }
+
+int Dir_Create(const char *path) {
+  char buf[4096];
+  size_t n = strlen(path);
+  if (!n || n >= sizeof(buf))
+    return 0;
+  memcpy(buf, path, n + 1);
+  for (char *p = buf + 1; *p; p++) {
+    if (*p != '/')
+      continue;
+    *p = 0;
+    mkdir(buf, 0755);
+    *p = '/';
+  }
+  mkdir(buf, 0755);
+  struct stat st;
+  return stat(buf, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+int File_Lock(FILE *f) { return flock(fileno(f), LOCK_EX | LOCK_NB) == 0; }
+
+int FileMap_Open(FILE_MAP *m, const char *path, size_t size) {
+  struct stat st;
+  m->p = NULL;
+  m->size = 0;
+  m->fd = -1;
+  if (!path) {
+    void *p = size ? mmap(NULL, size, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)
+                   : MAP_FAILED;
+    if (p == MAP_FAILED)
+      return 0;
+    m->p = (unsigned char *)p;
+    m->size = size;
+    return 1;
+  }
+  m->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (m->fd < 0)
+    return 0;
+  if (fstat(m->fd, &st))
+    goto fail;
+  if (size > (size_t)st.st_size) {
+    if (ftruncate(m->fd, (off_t)size)) // the new bytes read as zero
+      goto fail;
+  } else {
+    size = (size_t)st.st_size;
+  }
+  if (!size)
+    goto fail;
+  void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, m->fd, 0);
+  if (p == MAP_FAILED)
+    goto fail;
+  m->p = (unsigned char *)p;
+  m->size = size;
+  return 1;
+fail:
+  FileMap_Close(m);
+  return 0;
+}
+
+int FileMap_OpenRead(FILE_MAP *m, const char *path) {
+  struct stat st;
+  m->p = NULL;
+  m->size = 0;
+  m->fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (m->fd < 0)
+    return 0;
+  if (fstat(m->fd, &st) || !st.st_size)
+    goto fail;
+  void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, m->fd, 0);
+  if (p == MAP_FAILED)
+    goto fail;
+  m->p = (unsigned char *)p;
+  m->size = (size_t)st.st_size;
+  return 1;
+fail:
+  FileMap_Close(m);
+  return 0;
+}
+
+void FileMap_Close(FILE_MAP *m) {
+  if (m->p)
+    munmap(m->p, m->size);
+  if (m->fd >= 0)
+    close(m->fd);
+  m->p = NULL;
+  m->size = 0;
+  m->fd = -1;
+}
+#endif
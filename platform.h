@@ -0,0 +1,109 @@
+#ifndef SCREENSHOT_PLATFORM_H
+#define SCREENSHOT_PLATFORM_H
+
+// Thin portability layer shared by the platform front-ends: threads, locks,
+// atomics, CPU feature checks, a fork/join helper for pixel kernels and the
+// few file operations stdio lacks.
+
+#include <stddef.h>
+#include <stdio.h>
+
+#ifdef _WIN32
+#include <windows.h>
+typedef HANDLE THREAD;
+typedef SRWLOCK MUTEX;
+typedef CONDITION_VARIABLE COND;
+#else
+#include <pthread.h>
+typedef pthread_t THREAD;
+typedef pthread_mutex_t MUTEX;
+typedef pthread_cond_t COND;
+#endif
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) ||              \
+    defined(__x86_64__)
+#define PLATFORM_X86 1
+#endif
+
+// gcc/clang only emit AVX2 for functions that opt in; MSVC always can.
+#if defined(PLATFORM_X86) && (defined(__GNUC__) || defined(__clang__))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
+
+typedef void (*THREAD_FN)(void *arg);
+
+int Thread_Start(THREAD *t, THREAD_FN fn, void *arg);
+void Thread_Join(THREAD t);
+
+void Mutex_Init(MUTEX *m);
+void Mutex_Destroy(MUTEX *m);
+void Mutex_Lock(MUTEX *m);
+int Mutex_TryLock(MUTEX *m);
+void Mutex_Unlock(MUTEX *m);
+
+void Cond_Init(COND *c);
+void Cond_Destroy(COND *c);
+void Cond_Wait(COND *c, MUTEX *m);
+void Cond_Signal(COND *c);
+void Cond_Broadcast(COND *c);
+
+long Atomic_Inc(volatile long *v); // returns the new value
+long Atomic_Dec(volatile long *v);
+long Atomic_Load(const volatile long *v);    // acquire
+void Atomic_Store(volatile long *v, long x); // release
+
+// Monotonic clock in nanoseconds.
+long long Clock_Ns(void);
+// Sleeps until Clock_Ns() reaches `deadline` (returns at once if past).
+void Sleep_Until(long long deadline);
+
+int Cpu_Count(void);
+int Cpu_HasAVX2(void);
+
+// User + kernel CPU time consumed by the whole process, in nanoseconds.
+long long Cpu_ProcessNs(void);
+
+// Peak resident set (working set on Windows) in bytes, 0 if unknown.
+size_t Mem_PeakRss(void);
+
+// Runs fn over [0, count) split into chunks of `grain`, on a lazily created
+// pool of Cpu_Count() - 1 workers plus the calling thread. Calls that arrive
+// while the pool is busy (or from inside a worker) run inline instead.
+typedef void (*PAR_FN)(void *ctx, int begin, int end);
+void Par_For(int count, int grain, PAR_FN fn, void *ctx);
+
+// --- Files ---
+// Paths are UTF-8 everywhere (Windows converts them for the wide APIs).
+
+FILE *File_Open(const char *path, const char *mode);
+// 64-bit fseek/ftell; File_Seek returns 0 on success.
+int File_Seek(FILE *f, long long off, int whence);
+long long File_Tell(FILE *f);
+// Creates path and any missing parents; returns 1 if it exists afterwards.
+int Dir_Create(const char *path);
+// Takes an exclusive advisory lock on f for as long as it stays open;
+// returns 0 if another process holds one. Reads are not blocked.
+int File_Lock(FILE *f);
+
+// Shared read-write mapping of a whole file, or a read-only view of one.
+typedef struct {
+  unsigned char *p;
+  size_t size;
+#ifdef _WIN32
+  HANDLE file, map;
+#else
+  int fd;
+#endif
+} FILE_MAP;
+
+// Maps path, creating it or growing it (zero-filled) to at least `size`
+// bytes; size 0 maps an existing file as it is. A NULL path maps `size`
+// zeroed bytes of private memory instead. Returns 0 on failure.
+int FileMap_Open(FILE_MAP *m, const char *path, size_t size);
+// Maps an existing file read-only; nothing is created or written.
+int FileMap_OpenRead(FILE_MAP *m, const char *path);
+void FileMap_Close(FILE_MAP *m);
+
+#endif
@@ -0,0 +1,756 @@
+#include "png.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "deflate.h"
+#include "platform.h"
+
+#ifdef PLATFORM_X86
+#include <emmintrin.h>
+#endif
+
+#define BAND_BYTES (1 << 20) // raw scanline bytes per band
+#define ROW_PAD 16           // zeros before each RGB row: the left of x = 0
+
+// --- Filters ---
+// Every filter predicts from unfiltered bytes only (left a, above b, upper
+// left c), so all four can be computed for a whole row at once. The row
+// keeps the one with the smallest sum of absolute signed bytes, the usual
+// libpng heuristic.
+
+static int Paeth(int a, int b, int c) {
+  int pa = abs(b - c), pb = abs(a - c), pc = abs(a + b - 2 * c);
+  return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+}
+
+static unsigned Cost(unsigned char v) { return v < 128 ? v : 256u - v; }
+
+static void Filter_RowScalar(const unsigned char *x, const unsigned char *b,
+                             unsigned char *const f[5], int i, int n,
+                             unsigned long long cost[5]) {
+  for (; i < n; i++) {
+    int a = x[i - 3], c = b[i - 3];
+    f[1][i] = (unsigned char)(x[i] - a);
+    f[2][i] = (unsigned char)(x[i] - b[i]);
+    f[3][i] = (unsigned char)(x[i] - ((a + b[i]) >> 1));
+    f[4][i] = (unsigned char)(x[i] - Paeth(a, b[i], c));
+    for (int k = 0; k < 5; k++)
+      cost[k] += Cost(f[k][i]);
+  }
+}
+
+#ifdef PLATFORM_X86
+static __m128i Abs16(__m128i v) {
+  return _mm_max_epi16(v, _mm_sub_epi16(_mm_setzero_si128(), v));
+}
+
+// Paeth predictor on 8 zero-extended bytes.
+static __m128i Paeth16(__m128i a, __m128i b, __m128i c) {
+  __m128i pa = Abs16(_mm_sub_epi16(b, c));
+  __m128i pb = Abs16(_mm_sub_epi16(a, c));
+  __m128i pc = Abs16(_mm_add_epi16(_mm_sub_epi16(a, c), _mm_sub_epi16(b, c)));
+  __m128i notA = _mm_or_si128(_mm_cmpgt_epi16(pa, pb), _mm_cmpgt_epi16(pa, pc));
+  __m128i notB = _mm_cmpgt_epi16(pb, pc);
+  __m128i bc = _mm_or_si128(_mm_and_si128(notB, c), _mm_andnot_si128(notB, b));
+  return _mm_or_si128(_mm_and_si128(notA, bc), _mm_andnot_si128(notA, a));
+}
+
+// Sum of |signed byte| per 64-bit half: min(v, -v) as unsigned, then SAD.
+static __m128i Cost16(__m128i v) {
+  const __m128i zero = _mm_setzero_si128();
+  return _mm_sad_epu8(_mm_min_epu8(v, _mm_sub_epi8(zero, v)), zero);
+}
+
+static int Filter_RowSSE2(const unsigned char *x, const unsigned char *b,
+                          unsigned char *const f[5], int n,
+                          unsigned long long cost[5]) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i one = _mm_set1_epi8(1);
+  __m128i acc[5];
+  for (int k = 0; k < 5; k++)
+    acc[k] = zero;
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i vx = _mm_loadu_si128((const __m128i *)(x + i));
+    __m128i va = _mm_loadu_si128((const __m128i *)(x + i - 3));
+    __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+    __m128i vc = _mm_loadu_si128((const __m128i *)(b + i - 3));
+    // pavgb rounds up; drop the carried bit for (a + b) >> 1
+    __m128i avg = _mm_sub_epi8(_mm_avg_epu8(va, vb),
+                               _mm_and_si128(_mm_xor_si128(va, vb), one));
+    __m128i lo = Paeth16(_mm_unpacklo_epi8(va, zero),
+                         _mm_unpacklo_epi8(vb, zero),
+                         _mm_unpacklo_epi8(vc, zero));
+    __m128i hi = Paeth16(_mm_unpackhi_epi8(va, zero),
+                         _mm_unpackhi_epi8(vb, zero),
+                         _mm_unpackhi_epi8(vc, zero));
+    __m128i v[5] = {vx, _mm_sub_epi8(vx, va), _mm_sub_epi8(vx, vb),
+                    _mm_sub_epi8(vx, avg),
+                    _mm_sub_epi8(vx, _mm_packus_epi16(lo, hi))};
+    for (int k = 1; k < 5; k++)
+      _mm_storeu_si128((__m128i *)(f[k] + i), v[k]);
+    for (int k = 0; k < 5; k++)
+      acc[k] = _mm_add_epi64(acc[k], Cost16(v[k]));
+  }
+  for (int k = 0; k < 5; k++) {
+    unsigned long long s[2];
+    _mm_storeu_si128((__m128i *)s, acc[k]);
+    cost[k] += s[0] + s[1];
+  }
+  return i;
+}
+#endif
+
+// Filters RGB row x (row above: b) into dst as a filter type byte + data.
+// f[1..4] are n-byte scratch rows; f[0] is set to x.
+static void Filter_Row(const unsigned char *x, const unsigned char *b,
+                       unsigned char *f[5], int n, unsigned char *dst) {
+  unsigned long long cost[5] = {0};
+  int done = 0;
+  f[0] = (unsigned char *)x;
+#ifdef PLATFORM_X86
+  done = Filter_RowSSE2(x, b, f, n, cost);
+#endif
+  Filter_RowScalar(x, b, f, done, n, cost);
+  int best = 0;
+  for (int k = 1; k < 5; k++)
+    if (cost[k] < cost[best])
+      best = k;
+  dst[0] = (unsigned char)best;
+  memcpy(dst + 1, f[best], (size_t)n);
+}
+
+static void ToRgb(const unsigned char *s, unsigned char *d, int w) {
+  for (int x = 0; x < w; x++, s += 4, d += 3) {
+    d[0] = s[2];
+    d[1] = s[1];
+    d[2] = s[0];
+  }
+}
+
+// --- Palette ---
+// Open addressing over the 24-bit colors (keys carry bit 24 so 0 is empty);
+// four slots per entry keep the probes short.
+#define PALETTE_SLOTS 1024
+
+typedef struct {
+  unsigned key[PALETTE_SLOTS];
+  unsigned char index[PALETTE_SLOTS];
+  unsigned rgb[256]; // 0x00RRGGBB in order of first appearance
+  int n;
+} PNG_PALETTE;
+
+static unsigned Palette_Slot(unsigned key) {
+  return (key * 2654435761u) >> (32 - 10);
+}
+
+// Slot holding key, or the empty slot where it belongs.
+static unsigned Palette_Find(const PNG_PALETTE *p, unsigned key) {
+  unsigned i = Palette_Slot(key);
+  while (p->key[i] && p->key[i] != key)
+    i = (i + 1) & (PALETTE_SLOTS - 1);
+  return i;
+}
+
+// One pass over the pixels; gives up at the 257th color. Runs of one color
+// (most of a UI) cost a compare each.
+static int Palette_Census(const IMAGE *img, PNG_PALETTE *p) {
+  memset(p->key, 0, sizeof(p->key));
+  p->n = 0;
+  unsigned last = 0;
+  for (int y = 0; y < img->h; y++) {
+    const unsigned *px = (const unsigned *)IMAGE_ROW(img, y);
+    for (int x = 0; x < img->w; x++) {
+      unsigned key = (px[x] & 0xFFFFFF) | 0x1000000;
+      if (key == last)
+        continue;
+      last = key;
+      unsigned i = Palette_Find(p, key);
+      if (p->key[i])
+        continue;
+      if (p->n == 256)
+        return 0;
+      p->key[i] = key;
+      p->index[i] = (unsigned char)p->n;
+      p->rgb[p->n++] = key & 0xFFFFFF;
+    }
+  }
+  return 1;
+}
+
+static int Palette_Depth(int n) {
+  return n <= 2 ? 1 : n <= 4 ? 2 : n <= 16 ? 4 : 8;
+}
+
+// Packs a row of indices MSB first, `depth` bits each.
+static void ToIndexed(const PNG_PALETTE *p, const unsigned char *s,
+                      unsigned char *d, int w, int depth) {
+  const unsigned *px = (const unsigned *)s;
+  unsigned last = 0, idx = 0, acc = 0;
+  int bits = 0;
+  for (int x = 0; x < w; x++) {
+    unsigned key = (px[x] & 0xFFFFFF) | 0x1000000;
+    if (key != last) {
+      last = key;
+      idx = p->index[Palette_Find(p, key)];
+    }
+    acc = (acc << depth) | idx;
+    bits += depth;
+    if (bits == 8) {
+      *d++ = (unsigned char)acc;
+      acc = 0;
+      bits = 0;
+    }
+  }
+  if (bits)
+    *d = (unsigned char)(acc << (8 - bits));
+}
+
+// --- Bands ---
+typedef struct {
+  int y0, y1;
+  unsigned char *out; // compressed piece, NULL if out of memory
+  size_t outLen, rawLen;
+  unsigned long adler; // of the raw scanlines
+} PNG_BAND;
+
+typedef struct {
+  const IMAGE *img;
+  const PNG_PALETTE *pal; // NULL for RGB
+  int depth;
+  size_t stride; // scanline bytes, filter type included
+  PNG_BAND *band; // current group
+  int base;       // index of band[0] in the image
+  int count;      // bands in the image
+} PNG_JOB;
+
+static int Png_FilterRgb(const PNG_JOB *j, const PNG_BAND *bd,
+                         unsigned char *raw) {
+  const IMAGE *img = j->img;
+  int n = img->w * 3;
+  unsigned char *rows =
+      (unsigned char *)calloc(1, 2 * ((size_t)n + ROW_PAD) + 4 * (size_t)n);
+  if (!rows)
+    return 0;
+  unsigned char *prev = rows + ROW_PAD;
+  unsigned char *cur = prev + n + ROW_PAD;
+  unsigned char *f[5] = {NULL};
+  for (int k = 1; k < 5; k++)
+    f[k] = cur + n + (size_t)(k - 1) * n;
+  // the filters of the first row look at the last row of the band above
+  if (bd->y0 > 0)
+    ToRgb(IMAGE_ROW(img, bd->y0 - 1), prev, img->w);
+  for (int y = bd->y0; y < bd->y1; y++) {
+    ToRgb(IMAGE_ROW(img, y), cur, img->w);
+    Filter_Row(cur, prev, f, n, raw + (size_t)(y - bd->y0) * j->stride);
+    unsigned char *t = prev;
+    prev = cur;
+    cur = t;
+  }
+  free(rows);
+  return 1;
+}
+
+static void Png_Band(const PNG_JOB *j, PNG_BAND *bd, int index) {
+  bd->rawLen = (size_t)(bd->y1 - bd->y0) * j->stride;
+  bd->out = NULL;
+  unsigned char *raw = (unsigned char *)malloc(bd->rawLen);
+  int ok = raw != NULL;
+  if (ok && j->pal) {
+    // filter None: the usual choice for indexed images, whose neighboring
+    // indices do not predict each other
+    for (int y = bd->y0; y < bd->y1; y++) {
+      unsigned char *d = raw + (size_t)(y - bd->y0) * j->stride;
+      d[0] = 0;
+      ToIndexed(j->pal, IMAGE_ROW(j->img, y), d + 1, j->img->w, j->depth);
+    }
+  } else if (ok) {
+    ok = Png_FilterRgb(j, bd, raw);
+  }
+  if (ok) {
+    bd->adler = Adler32(1, raw, bd->rawLen);
+    // room for the zlib header (first band) and the Adler-32 (last band)
+    bd->out = (unsigned char *)malloc(Deflate_Bound(bd->rawLen) + 6);
+    if (bd->out) {
+      size_t pos = 0;
+      if (index == 0) {
+        bd->out[pos++] = 0x78; // deflate, 32 KB window
+        bd->out[pos++] = 0x5E; // "fast"; makes the header a multiple of 31
+      }
+      pos += Deflate_Compress(raw, bd->rawLen, bd->out + pos,
+                              index == j->count - 1);
+      bd->outLen = pos;
+    }
+  }
+  free(raw);
+}
+
+static void Png_Bands(void *ctx, int begin, int end) {
+  const PNG_JOB *j = (const PNG_JOB *)ctx;
+  for (int i = begin; i < end; i++)
+    Png_Band(j, &j->band[i], j->base + i);
+}
+
+// --- Chunks ---
+static void Crc_Init(unsigned long t[256]) {
+  for (unsigned long n = 0; n < 256; n++) {
+    unsigned long c = n;
+    for (int k = 0; k < 8; k++)
+      c = c & 1 ? 0xEDB88320UL ^ (c >> 1) : c >> 1;
+    t[n] = c;
+  }
+}
+
+static unsigned long Crc_Update(const unsigned long t[256], unsigned long crc,
+                                const unsigned char *p, size_t n) {
+  while (n--)
+    crc = t[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+  return crc;
+}
+
+static void PutBE32(unsigned char *p, unsigned long v) {
+  p[0] = (unsigned char)(v >> 24);
+  p[1] = (unsigned char)(v >> 16);
+  p[2] = (unsigned char)(v >> 8);
+  p[3] = (unsigned char)v;
+}
+
+// seq, if not NULL, is the 4-byte sequence number that starts APNG fdAT
+// chunks, written ahead of data.
+static int Png_Chunk(FILE *f, const unsigned long crcTab[256],
+                     const char *type, const unsigned char *seq,
+                     const unsigned char *data, size_t n) {
+  unsigned char hdr[12], tail[4];
+  size_t h = seq ? 12 : 8;
+  PutBE32(hdr, (unsigned long)(n + h - 8));
+  memcpy(hdr + 4, type, 4);
+  if (seq)
+    memcpy(hdr + 8, seq, 4);
+  unsigned long crc = Crc_Update(crcTab, 0xFFFFFFFFUL, hdr + 4, h - 4);
+  crc = Crc_Update(crcTab, crc, data, n) ^ 0xFFFFFFFFUL;
+  PutBE32(tail, crc);
+  return fwrite(hdr, 1, h, f) == h && (!n || fwrite(data, 1, n, f) == n) &&
+         fwrite(tail, 1, 4, f) == 4;
+}
+
+// Filters and deflates img in parallel bands and writes them out as IDAT
+// chunks, or as fdAT chunks numbered from *seq for later APNG frames. Fills
+// the rawBytes, bands and groups of st.
+static int Png_Data(FILE *f, const unsigned long crcTab[256],
+                    const IMAGE *img, const PNG_PALETTE *pal, int depth,
+                    unsigned long *seq, PNG_STATS *st) {
+  size_t stride = pal ? ((size_t)img->w * depth + 7) / 8 + 1
+                      : (size_t)img->w * 3 + 1;
+  int rowsPerBand = stride < BAND_BYTES ? (int)(BAND_BYTES / stride) : 1;
+  int nbands = (img->h + rowsPerBand - 1) / rowsPerBand;
+  // two bands per core evens out bands that compress slower than others
+  int group = Cpu_Count() * 2;
+  if (group > nbands)
+    group = nbands;
+  PNG_BAND *band = (PNG_BAND *)calloc((size_t)group, sizeof(PNG_BAND));
+  PNG_JOB job = {img, pal, depth, stride, band, 0, nbands};
+  unsigned long adler = 1;
+  int groups = 0;
+  int ok = band != NULL;
+  for (int base = 0; ok && base < nbands; base += group) {
+    int count = nbands - base < group ? nbands - base : group;
+    for (int i = 0; i < count; i++) {
+      band[i].y0 = (base + i) * rowsPerBand;
+      band[i].y1 = band[i].y0 + rowsPerBand < img->h
+                       ? band[i].y0 + rowsPerBand
+                       : img->h;
+    }
+    job.base = base;
+    Par_For(count, 1, Png_Bands, &job);
+    groups++;
+    for (int i = 0; i < count; i++) {
+      PNG_BAND *bd = &band[i];
+      if (ok && bd->out) {
+        adler = Adler32_Combine(adler, bd->adler, bd->rawLen);
+        if (base + i == nbands - 1) {
+          PutBE32(bd->out + bd->outLen, adler);
+          bd->outLen += 4;
+        }
+        unsigned char num[4];
+        if (seq)
+          PutBE32(num, (*seq)++);
+        ok = Png_Chunk(f, crcTab, seq ? "fdAT" : "IDAT", seq ? num : NULL,
+                       bd->out, bd->outLen);
+      } else {
+        ok = 0;
+      }
+      free(bd->out);
+    }
+  }
+  free(band);
+  st->rawBytes = (unsigned long long)stride * (unsigned long long)img->h;
+  st->bands = nbands;
+  st->groups = groups;
+  return ok;
+}
+
+static const unsigned char kSignature[8] = {0x89, 'P',  'N',  'G',
+                                            '\r', '\n', 0x1A, '\n'};
+
+int Png_Write(FILE *f, const IMAGE *img, int flags, PNG_STATS *st) {
+  if (img->w <= 0 || img->h <= 0)
+    return 0;
+  long long t0 = Clock_Ns();
+  unsigned long crcTab[256];
+  Crc_Init(crcTab);
+
+  PNG_PALETTE *pal = NULL;
+  if (!(flags & PNG_TRUECOLOR)) {
+    pal = (PNG_PALETTE *)malloc(sizeof(PNG_PALETTE));
+    if (pal && !Palette_Census(img, pal)) {
+      free(pal);
+      pal = NULL;
+    }
+  }
+  long long censusNs = Clock_Ns() - t0;
+  int colors = pal ? pal->n : 0;
+  int depth = pal ? Palette_Depth(colors) : 8; // bits per sample
+
+  unsigned char ihdr[13];
+  PutBE32(ihdr, (unsigned long)img->w);
+  PutBE32(ihdr + 4, (unsigned long)img->h);
+  ihdr[8] = (unsigned char)depth;
+  ihdr[9] = pal ? 3 : 2; // indexed or truecolor
+  ihdr[10] = 0;          // deflate
+  ihdr[11] = 0;          // adaptive filtering
+  ihdr[12] = 0;          // no interlace
+  int ok = fwrite(kSignature, 1, 8, f) == 8 &&
+           Png_Chunk(f, crcTab, "IHDR", NULL, ihdr, sizeof(ihdr));
+  if (ok && pal) {
+    unsigned char plte[256 * 3];
+    for (int i = 0; i < pal->n; i++) {
+      plte[i * 3] = (unsigned char)(pal->rgb[i] >> 16);
+      plte[i * 3 + 1] = (unsigned char)(pal->rgb[i] >> 8);
+      plte[i * 3 + 2] = (unsigned char)pal->rgb[i];
+    }
+    ok = Png_Chunk(f, crcTab, "PLTE", NULL, plte, (size_t)pal->n * 3);
+  }
+  PNG_STATS data;
+  memset(&data, 0, sizeof(data));
+  ok = ok && Png_Data(f, crcTab, img, pal, depth, NULL, &data);
+  free(pal);
+  ok = ok && Png_Chunk(f, crcTab, "IEND", NULL, NULL, 0) && fflush(f) == 0;
+
+  if (st) {
+    long long pos = File_Tell(f);
+    st->rawBytes = data.rawBytes;
+    st->fileBytes = pos > 0 ? (unsigned long long)pos : 0;
+    st->bands = data.bands;
+    st->groups = data.groups;
+    st->colors = colors;
+    st->depth = colors ? depth : 24;
+    st->censusNs = censusNs;
+    st->ns = Clock_Ns() - t0;
+  }
+  return ok;
+}
+
+// --- APNG ---
+struct PNG_ANIM {
+  FILE *f;
+  unsigned long crcTab[256];
+  int w, h;
+  long long actl;            // file offset of the acTL chunk
+  long long fctl;            // of the last frame's fcTL, patched with its delay
+  unsigned char control[26]; // that fcTL's data
+  long long pts;             // and its timestamp
+  unsigned long seq, frames;
+  IMAGE prev; // the canvas after the last frame
+  int ok;
+};
+
+static int Anim_Patch(PNG_ANIM *a, long long at, const char *type,
+                      const unsigned char *data, size_t n) {
+  long long end = File_Tell(a->f);
+  return end >= 0 && File_Seek(a->f, at, SEEK_SET) == 0 &&
+         Png_Chunk(a->f, a->crcTab, type, NULL, data, n) &&
+         File_Seek(a->f, end, SEEK_SET) == 0;
+}
+
+// The last frame shows until pts.
+static int Anim_SetDelay(PNG_ANIM *a, long long pts) {
+  if (!a->frames)
+    return 1;
+  long long ms = (pts - a->pts) / 1000000;
+  ms = ms < 1 ? 1 : ms > 65535 ? 65535 : ms;
+  a->control[20] = (unsigned char)(ms >> 8);
+  a->control[21] = (unsigned char)ms;
+  a->control[22] = 1000 >> 8; // delay_den: milliseconds
+  a->control[23] = 1000 & 0xFF;
+  return Anim_Patch(a, a->fctl, "fcTL", a->control, sizeof(a->control));
+}
+
+// Bounding box of the pixels that differ from the canvas; empty if none.
+static IRECT Anim_Changed(const PNG_ANIM *a, const IMAGE *img) {
+  IRECT r = {a->w, a->h, 0, 0};
+  size_t n = (size_t)a->w * 4;
+  for (int y = 0; y < a->h; y++) {
+    const unsigned *p = (const unsigned *)IMAGE_ROW(img, y);
+    const unsigned *q = (const unsigned *)IMAGE_ROW(&a->prev, y);
+    if (!memcmp(p, q, n))
+      continue;
+    if (r.top > y)
+      r.top = y;
+    r.bottom = y + 1;
+    int x = 0;
+    while (x < r.left && p[x] == q[x])
+      x++;
+    r.left = x;
+    x = a->w;
+    while (x > r.right && p[x - 1] == q[x - 1])
+      x--;
+    r.right = x;
+  }
+  return r;
+}
+
+PNG_ANIM *Png_AnimBegin(FILE *f, int w, int h) {
+  if (w <= 0 || h <= 0)
+    return NULL;
+  PNG_ANIM *a = (PNG_ANIM *)calloc(1, sizeof(*a));
+  if (!a)
+    return NULL;
+  if (!Image_Alloc(&a->prev, w, h)) {
+    free(a);
+    return NULL;
+  }
+  a->f = f;
+  a->w = w;
+  a->h = h;
+  Crc_Init(a->crcTab);
+  unsigned char ihdr[13] = {0}, actl[8] = {0};
+  PutBE32(ihdr, (unsigned long)w);
+  PutBE32(ihdr + 4, (unsigned long)h);
+  ihdr[8] = 8; // truecolor: frames would not share one palette
+  ihdr[9] = 2;
+  a->ok = fwrite(kSignature, 1, 8, f) == 8 &&
+          Png_Chunk(f, a->crcTab, "IHDR", NULL, ihdr, sizeof(ihdr));
+  // num_frames is filled in by Png_AnimEnd; num_plays 0 loops forever
+  a->actl = File_Tell(f);
+  a->ok = a->ok && a->actl > 0 &&
+          Png_Chunk(f, a->crcTab, "acTL", NULL, actl, sizeof(actl));
+  return a;
+}
+
+int Png_AnimFrame(PNG_ANIM *a, const IMAGE *img, long long pts,
+                  PNG_STATS *st) {
+  long long t0 = Clock_Ns();
+  if (!a->ok || img->w != a->w || img->h != a->h)
+    return a->ok = 0;
+  IRECT r = {0, 0, a->w, a->h};
+  if (a->frames) {
+    r = Anim_Changed(a, img);
+    if (IRect_IsEmpty(&r))
+      r = (IRECT){0, 0, 1, 1}; // unchanged: redraw one pixel as it was
+  }
+  a->ok = Anim_SetDelay(a, pts);
+
+  // dispose_op NONE and blend_op SOURCE: the rect replaces what is there
+  unsigned char *c = a->control;
+  memset(c, 0, sizeof(a->control));
+  PutBE32(c, a->seq++);
+  PutBE32(c + 4, (unsigned long)(r.right - r.left));
+  PutBE32(c + 8, (unsigned long)(r.bottom - r.top));
+  PutBE32(c + 12, (unsigned long)r.left);
+  PutBE32(c + 16, (unsigned long)r.top);
+  a->fctl = File_Tell(a->f);
+  a->pts = pts;
+  a->ok = a->ok && a->fctl > 0 &&
+          Png_Chunk(a->f, a->crcTab, "fcTL", NULL, c, sizeof(a->control));
+
+  // The first frame is also the default image, so it goes in IDAT.
+  IMAGE sub = {IMAGE_ROW(img, r.top) + (size_t)r.left * 4, r.right - r.left,
+               r.bottom - r.top, img->stride};
+  PNG_STATS data;
+  memset(&data, 0, sizeof(data));
+  a->ok = a->ok &&
+          Png_Data(a->f, a->crcTab, &sub, NULL, 8, a->frames ? &a->seq : NULL,
+                   &data);
+  for (int y = r.top; y < r.bottom; y++)
+    memcpy(IMAGE_ROW(&a->prev, y) + (size_t)r.left * 4,
+           IMAGE_ROW(img, y) + (size_t)r.left * 4,
+           (size_t)(r.right - r.left) * 4);
+  a->frames++;
+  if (st) {
+    long long pos = File_Tell(a->f);
+    *st = data;
+    st->fileBytes = pos > 0 ? (unsigned long long)pos : 0;
+    st->depth = 24;
+    st->ns = Clock_Ns() - t0;
+  }
+  return a->ok;
+}
+
+int Png_AnimEnd(PNG_ANIM *a, long long pts) {
+  int ok = a->ok && a->frames && Anim_SetDelay(a, pts) &&
+           Png_Chunk(a->f, a->crcTab, "IEND", NULL, NULL, 0);
+  unsigned char actl[8] = {0};
+  PutBE32(actl, a->frames);
+  ok = ok && Anim_Patch(a, a->actl, "acTL", actl, sizeof(actl)) &&
+       fflush(a->f) == 0;
+  Image_Free(&a->prev);
+  free(a);
+  return ok;
+}
+
+// --- Reading ---
+
+static unsigned long GetBE32(const unsigned char *p) {
+  return (unsigned long)p[0] << 24 | (unsigned long)p[1] << 16 |
+         (unsigned long)p[2] << 8 | p[3];
+}
+
+// Row x in place, given the unfiltered row above (b) and bpp bytes per
+// pixel (at least 1).
+static int Unfilter(unsigned char *x, const unsigned char *b, int type,
+                    size_t n, size_t bpp) {
+  size_t i;
+  switch (type) {
+  case 0:
+    break;
+  case 1:
+    for (i = bpp; i < n; i++)
+      x[i] = (unsigned char)(x[i] + x[i - bpp]);
+    break;
+  case 2:
+    for (i = 0; i < n; i++)
+      x[i] = (unsigned char)(x[i] + b[i]);
+    break;
+  case 3:
+    for (i = 0; i < bpp && i < n; i++)
+      x[i] = (unsigned char)(x[i] + (b[i] >> 1));
+    for (; i < n; i++)
+      x[i] = (unsigned char)(x[i] + ((x[i - bpp] + b[i]) >> 1));
+    break;
+  case 4:
+    for (i = 0; i < bpp && i < n; i++)
+      x[i] = (unsigned char)(x[i] + b[i]);
+    for (; i < n; i++)
+      x[i] = (unsigned char)(x[i] + Paeth(x[i - bpp], b[i], b[i - bpp]));
+    break;
+  default:
+    return 0;
+  }
+  return 1;
+}
+
+// Sample i of a row: high byte at 16 bits, packed from the MSB below 8.
+static unsigned Sample(const unsigned char *s, int depth, size_t i) {
+  if (depth >= 8)
+    return s[i * (size_t)(depth / 8)];
+  size_t bit = i * (size_t)depth;
+  return (s[bit >> 3] >> (8 - depth - (int)(bit & 7))) & ((1u << depth) - 1);
+}
+
+static const int kChannels[7] = {1, 0, 3, 1, 2, 0, 4}; // by color type
+
+static void FromPng(const unsigned char *s, int type, int depth,
+                    const unsigned *pal, int w, unsigned *d) {
+  size_t ch = (size_t)kChannels[type];
+  if (depth == 8 && (type == 2 || type == 6)) {
+    for (int x = 0; x < w; x++, s += ch)
+      d[x] = 0xFF000000u | (unsigned)s[0] << 16 | (unsigned)s[1] << 8 | s[2];
+    return;
+  }
+  for (int x = 0; x < w; x++) {
+    size_t i = (size_t)x * ch;
+    if (type == 3) {
+      d[x] = pal[Sample(s, depth, i)];
+    } else if (type == 2 || type == 6) {
+      d[x] = 0xFF000000u | Sample(s, depth, i) << 16 |
+             Sample(s, depth, i + 1) << 8 | Sample(s, depth, i + 2);
+    } else {
+      unsigned g = Sample(s, depth, i);
+      if (depth < 8)
+        g = g * 255 / ((1u << depth) - 1);
+      d[x] = 0xFF000000u | g << 16 | g << 8 | g;
+    }
+  }
+}
+
+int Png_Decode(const unsigned char *data, size_t n, IMAGE *out) {
+  if (n < 8 || memcmp(data, kSignature, 8))
+    return 0;
+  unsigned long w = 0, h = 0;
+  int depth = 0, type = -1, interlace = 0;
+  unsigned pal[256];
+  for (int i = 0; i < 256; i++)
+    pal[i] = 0xFF000000u;
+  size_t idat = 0;
+  // chunks: first the header, palette and IDAT size, then the IDAT bytes
+  for (size_t pos = 8; pos + 12 <= n;) {
+    unsigned long len = GetBE32(data + pos);
+    const unsigned char *t = data + pos + 4, *body = data + pos + 8;
+    if (len > n - pos - 12)
+      return 0;
+    if (!memcmp(t, "IHDR", 4) && len >= 13) {
+      w = GetBE32(body);
+      h = GetBE32(body + 4);
+      depth = body[8];
+      type = body[9];
+      interlace = body[12];
+      if (body[10] || body[11])
+        return 0;
+    } else if (!memcmp(t, "PLTE", 4)) {
+      for (unsigned long i = 0; i < len / 3 && i < 256; i++)
+        pal[i] = 0xFF000000u | (unsigned)body[i * 3] << 16 |
+                 (unsigned)body[i * 3 + 1] << 8 | body[i * 3 + 2];
+    } else if (!memcmp(t, "IDAT", 4)) {
+      idat += len;
+    } else if (!memcmp(t, "IEND", 4)) {
+      break;
+    }
+    pos += 12 + len;
+  }
+  int ok = type == 0   ? depth == 1 || depth == 2 || depth == 4 ||
+                             depth == 8 || depth == 16
+           : type == 3 ? depth == 1 || depth == 2 || depth == 4 || depth == 8
+           : type == 2 || type == 4 || type == 6 ? depth == 8 || depth == 16
+                                                 : 0;
+  if (!ok || interlace || w == 0 || h == 0 || w > 0x7FFF || h > 0x7FFF ||
+      idat < 2)
+    return 0;
+  size_t bits = (size_t)kChannels[type] * (size_t)depth;
+  size_t rowBytes = (w * bits + 7) / 8, bpp = bits < 8 ? 1 : bits / 8;
+  size_t need = (rowBytes + 1) * h;
+  unsigned char *z = (unsigned char *)malloc(idat);
+  unsigned char *raw = (unsigned char *)malloc(need);
+  unsigned char *zero = (unsigned char *)calloc(rowBytes, 1);
+  ok = z && raw && zero;
+  size_t got = 0;
+  for (size_t pos = 8; ok && pos + 12 <= n;) {
+    unsigned long len = GetBE32(data + pos);
+    if (!memcmp(data + pos + 4, "IDAT", 4)) {
+      memcpy(z + got, data + pos + 8, len);
+      got += len;
+    } else if (!memcmp(data + pos + 4, "IEND", 4)) {
+      break;
+    }
+    pos += 12 + len;
+  }
+  // zlib wrapper: deflate, no preset dictionary
+  ok = ok && (z[0] & 15) == 8 && ((z[0] << 8) | z[1]) % 31 == 0 &&
+       !(z[1] & 0x20) && Inflate(z + 2, idat - 2, raw, need) == need;
+  free(z);
+  int alloc = ok && Image_Alloc(out, (int)w, (int)h);
+  const unsigned char *above = zero;
+  for (unsigned long y = 0; alloc && ok && y < h; y++) {
+    unsigned char *row = raw + y * (rowBytes + 1);
+    if ((ok = Unfilter(row + 1, above, row[0], rowBytes, bpp)))
+      FromPng(row + 1, type, depth, pal, (int)w,
+              (unsigned *)IMAGE_ROW(out, y));
+    above = row + 1;
+  }
+  ok = ok && alloc;
+  if (alloc && !ok)
+    Image_Free(out);
+  free(raw);
+  free(zero);
+  return ok;
+}
@@ -0,0 +1,50 @@
+#ifndef SCREENSHOT_PNG_H
+#define SCREENSHOT_PNG_H
+
+#include <stdio.h>
+
+#include "image.h"
+
+// PNG writer for saving selections (the alpha byte of captures is not
+// meaningful, so no alpha channel). The image is cut into bands of rows that
+// are filtered and deflated in parallel, each band a piece of the one zlib
+// stream (see deflate.h). Bands are written out as IDAT chunks group by
+// group, so at most one group of compressed bands is held in memory.
+//
+// UI captures rarely use more than 256 colors: a census pass counts them,
+// giving up at the 257th, and if it succeeds the image is written indexed at
+// 1, 2, 4 or 8 bits per pixel instead of 8-bit RGB.
+
+#define PNG_TRUECOLOR 1 // skip the census, always write RGB
+
+typedef struct {
+  unsigned long long rawBytes, fileBytes; // filtered scanlines, whole file
+  int bands, groups;
+  int colors, depth; // palette size (0 for RGB), bits per pixel
+  long long censusNs, ns;
+} PNG_STATS;
+
+// Returns 1 on success; st may be NULL.
+int Png_Write(FILE *f, const IMAGE *img, int flags, PNG_STATS *st);
+
+// Decodes a whole PNG file into a new heap image: gray, RGB and indexed
+// images with or without alpha, at any bit depth, but not interlaced.
+// Pixels come out opaque and 16-bit samples keep their high byte; CRCs and
+// the Adler-32 are not checked. Returns 0 on bad or unsupported data.
+int Png_Decode(const unsigned char *data, size_t n, IMAGE *out);
+
+// Animated PNG for recordings, written frame by frame. Each frame after the
+// first is stored as the rectangle that changed since the one before, and
+// shows until the next frame's timestamp. The file must be seekable: frame
+// delays and the frame count are filled in afterwards.
+typedef struct PNG_ANIM PNG_ANIM;
+
+PNG_ANIM *Png_AnimBegin(FILE *f, int w, int h);
+// img is w x h; pts is in nanoseconds on any clock. st may be NULL.
+int Png_AnimFrame(PNG_ANIM *a, const IMAGE *img, long long pts,
+                  PNG_STATS *st);
+// The last frame shows until pts. Frees a; returns 1 if the whole file was
+// written.
+int Png_AnimEnd(PNG_ANIM *a, long long pts);
+
+#endif
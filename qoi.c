@@ -0,0 +1,161 @@
+#include "qoi.h"
+
+#include <string.h>
+
+#define QOI_OP_INDEX 0x00 // 00xxxxxx
+#define QOI_OP_DIFF 0x40  // 01xxxxxx
+#define QOI_OP_LUMA 0x80  // 10xxxxxx
+#define QOI_OP_RUN 0xC0   // 11xxxxxx
+#define QOI_OP_RGB 0xFE
+#define QOI_OP_RGBA 0xFF
+#define QOI_MASK 0xC0
+#define QOI_HEADER 14
+#define QOI_MAX_RUN 62
+
+static const unsigned char kQoiEnd[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+
+// Pixels are handled as 0xAARRGGBB, which is how BGRA reads as a word.
+static unsigned Qoi_Hash(unsigned px) {
+  unsigned r = (px >> 16) & 0xFF, g = (px >> 8) & 0xFF, b = px & 0xFF;
+  return (r * 3 + g * 5 + b * 7 + (px >> 24) * 11) & 63;
+}
+
+static void PutBE32(unsigned char *p, unsigned v) {
+  p[0] = (unsigned char)(v >> 24);
+  p[1] = (unsigned char)(v >> 16);
+  p[2] = (unsigned char)(v >> 8);
+  p[3] = (unsigned char)v;
+}
+
+static unsigned GetBE32(const unsigned char *p) {
+  return (unsigned)p[0] << 24 | (unsigned)p[1] << 16 | (unsigned)p[2] << 8 |
+         p[3];
+}
+
+int Qoi_Write(FILE *f, const IMAGE *img) {
+  if (img->w <= 0 || img->h <= 0)
+    return 0;
+  unsigned char buf[65536];
+  size_t pos = 0;
+  memcpy(buf, "qoif", 4);
+  PutBE32(buf + 4, (unsigned)img->w);
+  PutBE32(buf + 8, (unsigned)img->h);
+  buf[12] = 3; // RGB
+  buf[13] = 0; // sRGB with linear alpha
+  pos = QOI_HEADER;
+
+  unsigned index[64] = {0};
+  unsigned prev = 0xFF000000;
+  int run = 0;
+  for (int y = 0; y < img->h; y++) {
+    const unsigned *row = (const unsigned *)IMAGE_ROW(img, y);
+    for (int x = 0; x < img->w; x++) {
+      if (pos > sizeof(buf) - 8) {
+        if (fwrite(buf, 1, pos, f) != pos)
+          return 0;
+        pos = 0;
+      }
+      unsigned px = row[x] | 0xFF000000;
+      if (px == prev) {
+        if (++run == QOI_MAX_RUN) {
+          buf[pos++] = (unsigned char)(QOI_OP_RUN | (run - 1));
+          run = 0;
+        }
+        continue;
+      }
+      if (run) {
+        buf[pos++] = (unsigned char)(QOI_OP_RUN | (run - 1));
+        run = 0;
+      }
+      unsigned h = Qoi_Hash(px);
+      if (index[h] == px) {
+        buf[pos++] = (unsigned char)(QOI_OP_INDEX | h);
+      } else {
+        index[h] = px;
+        signed char vr = (signed char)((px >> 16) - (prev >> 16));
+        signed char vg = (signed char)((px >> 8) - (prev >> 8));
+        signed char vb = (signed char)(px - prev);
+        signed char vgr = (signed char)(vr - vg), vgb = (signed char)(vb - vg);
+        if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2) {
+          buf[pos++] = (unsigned char)(QOI_OP_DIFF | (vr + 2) << 4 |
+                                       (vg + 2) << 2 | (vb + 2));
+        } else if (vgr > -9 && vgr < 8 && vg > -33 && vg < 32 && vgb > -9 &&
+                   vgb < 8) {
+          buf[pos++] = (unsigned char)(QOI_OP_LUMA | (vg + 32));
+          buf[pos++] = (unsigned char)((vgr + 8) << 4 | (vgb + 8));
+        } else {
+          buf[pos++] = QOI_OP_RGB;
+          buf[pos++] = (unsigned char)(px >> 16);
+          buf[pos++] = (unsigned char)(px >> 8);
+          buf[pos++] = (unsigned char)px;
+        }
+      }
+      prev = px;
+    }
+  }
+  if (run)
+    buf[pos++] = (unsigned char)(QOI_OP_RUN | (run - 1));
+  memcpy(buf + pos, kQoiEnd, sizeof(kQoiEnd));
+  pos += sizeof(kQoiEnd);
+  return fwrite(buf, 1, pos, f) == pos;
+}
+
+int Qoi_Decode(const unsigned char *data, size_t n, IMAGE *out) {
+  if (n < QOI_HEADER + sizeof(kQoiEnd) || memcmp(data, "qoif", 4))
+    return 0;
+  unsigned w = GetBE32(data + 4), h = GetBE32(data + 8);
+  int channels = data[12];
+  if (w == 0 || h == 0 || w > 0x7FFF || h > 0x7FFF ||
+      (channels != 3 && channels != 4) || !Image_Alloc(out, (int)w, (int)h))
+    return 0;
+  const unsigned char *p = data + QOI_HEADER;
+  const unsigned char *end = data + n - sizeof(kQoiEnd);
+  unsigned index[64] = {0};
+  unsigned px = 0xFF000000;
+  int run = 0;
+  for (int y = 0; y < out->h; y++) {
+    unsigned *row = (unsigned *)IMAGE_ROW(out, y);
+    for (int x = 0; x < out->w; x++) {
+      if (run) {
+        run--;
+      } else if (p < end) {
+        int op = *p++;
+        if (op == QOI_OP_RGB || op == QOI_OP_RGBA) {
+          int k = op == QOI_OP_RGB ? 3 : 4;
+          if (end - p < k)
+            goto bad;
+          px = (px & 0xFF000000) | (unsigned)p[0] << 16 |
+               (unsigned)p[1] << 8 | p[2];
+          if (k == 4)
+            px = (px & 0xFFFFFF) | (unsigned)p[3] << 24;
+          p += k;
+        } else if ((op & QOI_MASK) == QOI_OP_INDEX) {
+          px = index[op];
+        } else if ((op & QOI_MASK) == QOI_OP_DIFF) {
+          unsigned r = ((px >> 16) + ((op >> 4) & 3) - 2) & 0xFF;
+          unsigned g = ((px >> 8) + ((op >> 2) & 3) - 2) & 0xFF;
+          unsigned b = (px + (op & 3) - 2) & 0xFF;
+          px = (px & 0xFF000000) | r << 16 | g << 8 | b;
+        } else if ((op & QOI_MASK) == QOI_OP_LUMA) {
+          if (p >= end)
+            goto bad;
+          int vg = (op & 0x3F) - 32, b2 = *p++;
+          unsigned r = ((px >> 16) + vg - 8 + (b2 >> 4)) & 0xFF;
+          unsigned g = ((px >> 8) + vg) & 0xFF;
+          unsigned b = (px + vg - 8 + (b2 & 15)) & 0xFF;
+          px = (px & 0xFF000000) | r << 16 | g << 8 | b;
+        } else {
+          run = op & 0x3F;
+        }
+        index[Qoi_Hash(px)] = px;
+      } else {
+        goto bad;
+      }
+      row[x] = channels == 3 ? px | 0xFF000000 : px;
+    }
+  }
+  return 1;
+bad:
+  Image_Free(out);
+  return 0;
+}
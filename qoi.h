@@ -0,0 +1,19 @@
+#ifndef SCREENSHOT_QOI_H
+#define SCREENSHOT_QOI_H
+
+#include <stdio.h>
+
+#include "image.h"
+
+// QOI ("Quite OK Image", qoiformat.org) encoder and decoder: lossless, one
+// pass, no entropy coding, so it writes about as fast as memory allows at a
+// PNG-like size on UI content. Images are written with 3 channels (the alpha
+// byte of captures is not meaningful).
+
+// Streams img to f through a small buffer. Returns 1 on success.
+int Qoi_Write(FILE *f, const IMAGE *img);
+
+// Decodes a whole QOI file into a new heap image. Returns 0 on bad data.
+int Qoi_Decode(const unsigned char *data, size_t n, IMAGE *out);
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef _WIN32
+#define _GNU_SOURCE // fileno, IOV_MAX
+#endif
+#include "raw.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <limits.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#ifndef IOV_MAX
+#define IOV_MAX 1024 // POSIX minimum
+#endif
+#endif
+
+static void PutLE32(unsigned char *p, unsigned v) {
+  p[0] = (unsigned char)v;
+  p[1] = (unsigned char)(v >> 8);
+  p[2] = (unsigned char)(v >> 16);
+  p[3] = (unsigned char)(v >> 24);
+}
+
+void Raw_Header(const IMAGE *img, unsigned char hdr[RAW_HEADER]) {
+  memcpy(hdr, "BGRA", 4);
+  PutLE32(hdr + 4, (unsigned)img->w);
+  PutLE32(hdr + 8, (unsigned)img->h);
+  PutLE32(hdr + 12, (unsigned)img->w * 4);
+}
+
+#ifndef _WIN32
+// Gathers everything into as few writev calls as the iovec limit allows:
+// one for a packed image, one per IOV_MAX rows otherwise. Retries the rest
+// after short writes.
+static int WriteAll(int fd, struct iovec *iov, int n) {
+  while (n > 0) {
+    ssize_t k = writev(fd, iov, n < IOV_MAX ? n : IOV_MAX);
+    if (k < 0)
+      return 0;
+    while (n > 0 && (size_t)k >= iov->iov_len) {
+      k -= (ssize_t)iov->iov_len;
+      iov++;
+      n--;
+    }
+    if (n > 0) {
+      iov->iov_base = (char *)iov->iov_base + k;
+      iov->iov_len -= (size_t)k;
+    }
+  }
+  return 1;
+}
+#endif
+
+int Raw_Write(FILE *f, const IMAGE *img) {
+  if (img->w <= 0 || img->h <= 0)
+    return 0;
+  size_t row = (size_t)img->w * 4;
+  unsigned char hdr[RAW_HEADER];
+  Raw_Header(img, hdr);
+  int packed = (size_t)img->stride == row;
+#ifdef _WIN32
+  // the CRT hands writes this large straight to WriteFile
+  if (fwrite(hdr, 1, sizeof(hdr), f) != sizeof(hdr))
+    return 0;
+  if (packed)
+    return fwrite(img->px, row, (size_t)img->h, f) == (size_t)img->h;
+  for (int y = 0; y < img->h; y++)
+    if (fwrite(IMAGE_ROW(img, y), 1, row, f) != row)
+      return 0;
+  return 1;
+#else
+  if (fflush(f) != 0)
+    return 0;
+  int n = packed ? 2 : img->h + 1;
+  struct iovec stack[2], *iov = packed ? stack : NULL;
+  if (!iov && !(iov = (struct iovec *)malloc(sizeof(*iov) * (size_t)n)))
+    return 0;
+  iov[0].iov_base = hdr;
+  iov[0].iov_len = sizeof(hdr);
+  if (packed) {
+    iov[1].iov_base = img->px;
+    iov[1].iov_len = row * (size_t)img->h;
+  } else {
+    for (int y = 0; y < img->h; y++) {
+      iov[y + 1].iov_base = IMAGE_ROW(img, y);
+      iov[y + 1].iov_len = row;
+    }
+  }
+  int ok = WriteAll(fileno(f), iov, n);
+  if (iov != stack)
+    free(iov);
+  return ok;
+#endif
+}
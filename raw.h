@@ -0,0 +1,19 @@
+#ifndef SCREENSHOT_RAW_H
+#define SCREENSHOT_RAW_H
+
+#include <stdio.h>
+
+#include "image.h"
+
+// Raw dump, for tools that want pixels on disk as fast as possible: a
+// 16-byte header ("BGRA", then width, height and row stride as little-endian
+// 32-bit integers) followed by the rows exactly as captured, stride = w * 4.
+#define RAW_HEADER 16
+
+void Raw_Header(const IMAGE *img, unsigned char hdr[RAW_HEADER]);
+
+// Writes header and rows with one writev where available. Returns 1 on
+// success.
+int Raw_Write(FILE *f, const IMAGE *img);
+
+#endif
@@ -0,0 +1,242 @@
+#include "record.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "platform.h"
+#include "png.h"
+#include "y4m.h"
+
+typedef struct {
+  IMAGE img;
+  long long pts; // when the grab started
+  unsigned long long tick;
+} RECORD_FRAME;
+
+struct RECORDER {
+  FILE *f;
+  RECORD_CONFIG cfg;
+  RECORD_FRAME *ring;
+  int nring;
+  // Monotonic counts: the capture thread alone stores head, the encoder
+  // alone stores tail; frame i lives in ring[i % nring].
+  volatile long head, tail;
+  volatile long stop;     // asked to stop
+  volatile long captured; // capture thread has finished
+  volatile long failed;   // encoder could not write
+  MUTEX mu;               // only for sleeping...
+  COND wake;              // ...until head moves or capture ends
+  THREAD capture, encoder;
+  PNG_ANIM *apng;
+  Y4M y4m;
+  long long start, end; // capture clock
+  RECORD_STATS st;
+};
+
+RECORD_FORMAT Record_Format(void) {
+  const char *env = getenv("SCREENSHOT_RECORD");
+  return env && !strcmp(env, "y4m") ? RECORD_Y4M : RECORD_APNG;
+}
+
+int Record_Fps(void) {
+  const char *env = getenv("SCREENSHOT_FPS");
+  int fps = env ? atoi(env) : 0;
+  return fps > 0 && fps <= 240 ? fps : RECORD_DEFAULT_FPS;
+}
+
+const char *Record_Extension(RECORD_FORMAT fmt) {
+  return fmt == RECORD_Y4M ? "y4m" : "png";
+}
+
+static void Record_Wake(RECORDER *r) {
+  Mutex_Lock(&r->mu);
+  Cond_Signal(&r->wake);
+  Mutex_Unlock(&r->mu);
+}
+
+static void Record_Max(long long *max, long long v) {
+  if (*max < v)
+    *max = v;
+}
+
+// Runs the frame clock. A grab that overruns its slot skips the ticks it
+// covered (late); a full ring skips the grab (dropped).
+static void Record_Capture(void *arg) {
+  RECORDER *r = (RECORDER *)arg;
+  RECORD_STATS *st = &r->st;
+  long long period = 1000000000LL / r->cfg.fps;
+  long long next = r->start;
+  unsigned long long tick = 0;
+  while (!Atomic_Load(&r->stop) && !Atomic_Load(&r->failed) &&
+         (!r->cfg.maxTicks || tick < r->cfg.maxTicks)) {
+    Sleep_Until(next);
+    long long now = Clock_Ns();
+    long long behind = (now - next) / period;
+    if (behind > 0) {
+      if (r->cfg.maxTicks && tick + behind >= r->cfg.maxTicks)
+        behind = (long long)(r->cfg.maxTicks - tick);
+      st->late += (unsigned long long)behind;
+      tick += (unsigned long long)behind;
+      next += behind * period;
+      continue;
+    }
+    long head = r->head; // only this thread stores it
+    if (head - Atomic_Load(&r->tail) >= r->nring) {
+      st->dropped++;
+    } else {
+      RECORD_FRAME *fr = &r->ring[head % r->nring];
+      fr->pts = now;
+      fr->tick = tick;
+      int ok = r->cfg.grab(r->cfg.ctx, &fr->img);
+      long long ns = Clock_Ns() - now;
+      st->grabNs += ns;
+      Record_Max(&st->grabMaxNs, ns);
+      if (ok) {
+        st->captured++;
+        Atomic_Store(&r->head, head + 1);
+        Record_Wake(r);
+      } else {
+        st->failed++;
+      }
+    }
+    tick++;
+    next += period;
+  }
+  st->ticks = tick;
+  r->end = r->start + (long long)tick * period;
+  Atomic_Store(&r->captured, 1);
+  Record_Wake(r);
+}
+
+static int Record_Encode(RECORDER *r, const RECORD_FRAME *fr,
+                         unsigned long long *lastTick) {
+  if (r->cfg.format == RECORD_Y4M) {
+    // constant frame rate: the frame stands in for every tick since the
+    // last one that was written
+    int repeat = *lastTick == ~0ULL ? 1 : (int)(fr->tick - *lastTick);
+    *lastTick = fr->tick;
+    return Y4m_Frame(&r->y4m, &fr->img, repeat);
+  }
+  return Png_AnimFrame(r->apng, &fr->img, fr->pts, NULL);
+}
+
+static void Record_Encoder(void *arg) {
+  RECORDER *r = (RECORDER *)arg;
+  RECORD_STATS *st = &r->st;
+  unsigned long long lastTick = ~0ULL;
+  for (;;) {
+    long tail = r->tail; // only this thread stores it
+    if (Atomic_Load(&r->head) == tail) {
+      Mutex_Lock(&r->mu);
+      while (Atomic_Load(&r->head) == tail && !Atomic_Load(&r->captured))
+        Cond_Wait(&r->wake, &r->mu);
+      Mutex_Unlock(&r->mu);
+      if (Atomic_Load(&r->head) == tail)
+        break; // capture ended and the ring is empty
+    }
+    RECORD_FRAME *fr = &r->ring[tail % r->nring];
+    long long t0 = Clock_Ns();
+    st->waitNs += t0 - fr->pts;
+    Record_Max(&st->waitMaxNs, t0 - fr->pts);
+    int ok = !Atomic_Load(&r->failed) && Record_Encode(r, fr, &lastTick);
+    long long ns = Clock_Ns() - t0;
+    st->encodeNs += ns;
+    Record_Max(&st->encodeMaxNs, ns);
+    if (ok)
+      st->encoded++;
+    else
+      Atomic_Store(&r->failed, 1);
+    Atomic_Store(&r->tail, tail + 1);
+  }
+  // Fill the Y4M stream out to the last tick, as the capture clock saw it.
+  if (r->cfg.format == RECORD_Y4M && lastTick != ~0ULL &&
+      st->ticks > lastTick + 1 && !Atomic_Load(&r->failed) &&
+      !Y4m_Frame(&r->y4m, NULL, (int)(st->ticks - lastTick - 1)))
+    Atomic_Store(&r->failed, 1);
+}
+
+static void Record_Free(RECORDER *r) {
+  if (r->y4m.yuv)
+    Y4m_End(&r->y4m);
+  if (r->apng)
+    Png_AnimEnd(r->apng, 0);
+  for (int i = 0; i < r->nring; i++)
+    Image_Free(&r->ring[i].img);
+  free(r->ring);
+  Cond_Destroy(&r->wake);
+  Mutex_Destroy(&r->mu);
+  free(r);
+}
+
+RECORDER *Record_Start(FILE *f, const RECORD_CONFIG *cfg) {
+  if (cfg->w <= 0 || cfg->h <= 0 || cfg->fps <= 0 || !cfg->grab)
+    return NULL;
+  RECORDER *r = (RECORDER *)calloc(1, sizeof(*r));
+  if (!r)
+    return NULL;
+  r->f = f;
+  r->cfg = *cfg;
+  Mutex_Init(&r->mu);
+  Cond_Init(&r->wake);
+  size_t frame = (size_t)cfg->w * (size_t)cfg->h * 4;
+  size_t fit = ((size_t)RECORD_RING_MB << 20) / frame;
+  r->nring = fit < 2 ? 2 : fit < RECORD_RING ? (int)fit : RECORD_RING;
+  r->ring = (RECORD_FRAME *)calloc((size_t)r->nring, sizeof(RECORD_FRAME));
+  int ok = r->ring != NULL;
+  for (int i = 0; ok && i < r->nring; i++)
+    ok = Image_Alloc(&r->ring[i].img, cfg->w, cfg->h);
+  if (ok && cfg->format == RECORD_Y4M)
+    ok = Y4m_Begin(&r->y4m, f, cfg->w, cfg->h, cfg->fps);
+  else if (ok)
+    ok = (r->apng = Png_AnimBegin(f, cfg->w, cfg->h)) != NULL;
+  if (!ok || !Thread_Start(&r->encoder, Record_Encoder, r)) {
+    Record_Free(r);
+    return NULL;
+  }
+  r->st.ring = r->nring;
+  r->start = Clock_Ns();
+  if (!Thread_Start(&r->capture, Record_Capture, r)) {
+    Atomic_Store(&r->captured, 1);
+    Record_Wake(r);
+    Thread_Join(r->encoder);
+    Record_Free(r);
+    return NULL;
+  }
+  return r;
+}
+
+int Record_Running(RECORDER *r) { return !Atomic_Load(&r->captured); }
+
+int Record_Stop(RECORDER *r, RECORD_STATS *st) {
+  Atomic_Store(&r->stop, 1);
+  Thread_Join(r->capture);
+  Thread_Join(r->encoder);
+  int ok = !Atomic_Load(&r->failed) && r->st.encoded > 0;
+  if (r->cfg.format == RECORD_Y4M)
+    ok = Y4m_End(&r->y4m) && ok;
+  else
+    ok = Png_AnimEnd(r->apng, r->end) && ok;
+  r->apng = NULL;
+  r->st.durationNs = r->end - r->start;
+  long long pos = File_Tell(r->f); // -1 on a pipe
+  r->st.fileBytes = pos > 0 ? (unsigned long long)pos : 0;
+  if (st)
+    *st = r->st;
+  Record_Free(r);
+  return ok;
+}
+
+void Record_Describe(const RECORD_STATS *st, char *buf, size_t n) {
+  double grabs = st->captured + st->failed ? st->captured + st->failed : 1;
+  double frames = st->encoded ? (double)st->encoded : 1;
+  snprintf(buf, n,
+           "%llu ticks in %.2f s: %llu captured, %llu encoded, %llu dropped "
+           "(ring of %d full), %llu late, %llu failed\n"
+           "  grab avg %.2f ms max %.2f ms | queue avg %.2f ms max %.2f ms | "
+           "encode avg %.2f ms max %.2f ms",
+           st->ticks, st->durationNs / 1e9, st->captured, st->encoded,
+           st->dropped, st->ring, st->late, st->failed,
+           st->grabNs / 1e6 / grabs, st->grabMaxNs / 1e6,
+           st->waitNs / 1e6 / frames, st->waitMaxNs / 1e6,
+           st->encodeNs / 1e6 / frames, st->encodeMaxNs / 1e6);
+}
@@ -0,0 +1,67 @@
+#ifndef SCREENSHOT_RECORD_H
+#define SCREENSHOT_RECORD_H
+
+#include <stdio.h>
+
+#include "image.h"
+
+// Region recording. A capture thread grabs the region on a fixed frame
+// clock into a ring of preallocated frames; an encoder thread drains the
+// ring into an animated PNG or a Y4M stream. The ring has one producer and
+// one consumer, each advancing only its own index, so neither side takes a
+// lock to hand over a frame (a condition variable only wakes an idle
+// encoder). When the encoder falls behind and the ring is full, the tick is
+// dropped rather than stalling the capture clock.
+
+#define RECORD_RING 8            // frames, fewer if they would not fit...
+#define RECORD_RING_MB 256       // ...in this much memory (at least 2)
+#define RECORD_DEFAULT_FPS 30
+
+typedef enum { RECORD_APNG, RECORD_Y4M } RECORD_FORMAT;
+
+// Fills dst (sized like the region) on the capture thread. Returns 1 on
+// success.
+typedef int (*RECORD_GRAB_FN)(void *ctx, IMAGE *dst);
+
+typedef struct {
+  RECORD_FORMAT format;
+  int w, h, fps;
+  unsigned long long maxTicks; // stop by itself after this many; 0 = never
+  RECORD_GRAB_FN grab;
+  void *ctx;
+} RECORD_CONFIG;
+
+typedef struct {
+  int ring; // frames in the ring
+  unsigned long long ticks; // frame slots elapsed
+  unsigned long long captured, encoded;
+  unsigned long long dropped; // ring full: the encoder was behind
+  unsigned long long late;    // skipped because a grab overran its slot
+  unsigned long long failed;  // grabs that returned 0
+  long long grabNs, grabMaxNs;     // per stage: total and worst frame
+  long long waitNs, waitMaxNs;     // captured until the encoder took it
+  long long encodeNs, encodeMaxNs;
+  long long durationNs;
+  unsigned long long fileBytes;
+} RECORD_STATS;
+
+typedef struct RECORDER RECORDER;
+
+// SCREENSHOT_RECORD ("apng", the default, or "y4m") and SCREENSHOT_FPS.
+RECORD_FORMAT Record_Format(void);
+int Record_Fps(void);
+const char *Record_Extension(RECORD_FORMAT fmt);
+
+// Starts both threads; f stays the caller's. APNG needs a seekable file.
+// Returns NULL if the frames or threads could not be set up.
+RECORDER *Record_Start(FILE *f, const RECORD_CONFIG *cfg);
+// False once capture has ended (maxTicks reached, or a write failed).
+int Record_Running(RECORDER *r);
+// Stops capturing, encodes what is left in the ring and finishes the file.
+// Frees r; returns 1 if the whole file was written. st may be NULL.
+int Record_Stop(RECORDER *r, RECORD_STATS *st);
+
+// Multi-line summary for the stats logs.
+void Record_Describe(const RECORD_STATS *st, char *buf, size_t n);
+
+#endif
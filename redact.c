@@ -0,0 +1,411 @@
+#include "redact.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "platform.h"
+
+#ifdef PLATFORM_X86
+#include <emmintrin.h>
+#endif
+
+#define REDACT_ROW_GRAIN 32  // rows per Par_For chunk
+#define REDACT_COL_GROUP 256 // columns per vertical-pass chunk
+
+static int Redact_Min(int a, int b) { return a < b ? a : b; }
+static int Redact_Max(int a, int b) { return a > b ? a : b; }
+
+// 65536 / n rounded up: with sums offset by n / 2, the high half of
+// sum * recip is the rounded mean (at most one over; saturated to 255).
+static unsigned Redact_Recip(int n) { return (65536u + n - 1) / n; }
+
+static unsigned char Redact_Mean(unsigned sum, unsigned recip) {
+  unsigned v = (sum * recip) >> 16;
+  return (unsigned char)(v > 255 ? 255 : v);
+}
+
+// --- Pixelate ---
+
+typedef struct {
+  IMAGE *img;
+  int block;
+  int x0, y0; // img position of the first grid cell's corner (<= 0)
+  int skipX, skipY; // 1 when the first grid cell joins the next one
+  int cellsX, cellsY;
+} PIXELATE_JOB;
+
+// Cells along an axis of n pixels whose grid starts at x0 (<= 0). A cell
+// cut to under half a block at either end joins its neighbour, so no pixel
+// at a region's edge or corner is averaged with only a few others.
+static int Redact_Cells(int x0, int b, int n, int *skip) {
+  int c = (n - x0 + b - 1) / b;
+  *skip = c > 1 && (x0 + b) * 2 < b;
+  c -= *skip;
+  if (c > 1 && (n - x0 - (c + *skip - 1) * b) * 2 < b)
+    c--;
+  return c;
+}
+
+// Cell i of `cells` in pixels [*lo, *hi).
+static void Redact_Cell(int x0, int b, int n, int skip, int cells, int i,
+                        int *lo, int *hi) {
+  *lo = i ? x0 + (i + skip) * b : 0;
+  *hi = i + 1 < cells ? x0 + (i + skip + 1) * b : n;
+}
+
+// Cell rows [begin, end): each cell becomes the rounded mean of its pixels.
+// The band's rows are first summed column by column (16-bit lanes, a band
+// being at most 257 rows), then each cell adds up its stretch of that row.
+static void Redact_PixelateBands(void *ctx, int begin, int end) {
+  const PIXELATE_JOB *j = (const PIXELATE_JOB *)ctx;
+  IMAGE *img = j->img;
+  int b = j->block, bytes = img->w * 4;
+  uint16_t *col = (uint16_t *)malloc((size_t)bytes * sizeof(uint16_t));
+  if (!col)
+    return;
+  for (int band = begin; band < end; band++) {
+    int y0, y1;
+    Redact_Cell(j->y0, b, img->h, j->skipY, j->cellsY, band, &y0, &y1);
+    memset(col, 0, (size_t)bytes * sizeof(uint16_t));
+    for (int y = y0; y < y1; y++) {
+      const unsigned char *p = IMAGE_ROW(img, y);
+      int i = 0;
+#ifdef PLATFORM_X86
+      __m128i zero = _mm_setzero_si128();
+      for (; i + 16 <= bytes; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+        __m128i *c = (__m128i *)(col + i);
+        _mm_storeu_si128(c, _mm_add_epi16(_mm_loadu_si128(c),
+                                          _mm_unpacklo_epi8(v, zero)));
+        _mm_storeu_si128(c + 1, _mm_add_epi16(_mm_loadu_si128(c + 1),
+                                              _mm_unpackhi_epi8(v, zero)));
+      }
+#endif
+      for (; i < bytes; i++)
+        col[i] = (uint16_t)(col[i] + p[i]);
+    }
+    for (int c = 0; c < j->cellsX; c++) {
+      int x, x1;
+      Redact_Cell(j->x0, b, img->w, j->skipX, j->cellsX, c, &x, &x1);
+      uint32_t s[4] = {0, 0, 0, 0};
+      for (int cx = x; cx < x1; cx++)
+        for (int k = 0; k < 4; k++)
+          s[k] += col[(size_t)cx * 4 + k];
+      uint32_t n = (uint32_t)((x1 - x) * (y1 - y0)), color = 0;
+      for (int k = 0; k < 4; k++)
+        color |= ((s[k] + n / 2) / n) << (8 * k);
+      for (int y = y0; y < y1; y++) {
+        uint32_t *p = (uint32_t *)IMAGE_ROW(img, y);
+        for (int cx = x; cx < x1; cx++)
+          p[cx] = color;
+      }
+    }
+  }
+  free(col);
+}
+
+void Redact_Pixelate(IMAGE *img, int block, int ox, int oy) {
+  if (block < 1 || img->w <= 0 || img->h <= 0)
+    return;
+  if (block > REDACT_RADIUS_MAX + 1) // a band with a joined cell: < 257 rows
+    block = REDACT_RADIUS_MAX + 1;
+  PIXELATE_JOB j = {img, block, -(ox % block), -(oy % block), 0, 0, 0, 0};
+  j.cellsX = Redact_Cells(j.x0, block, img->w, &j.skipX);
+  j.cellsY = Redact_Cells(j.y0, block, img->h, &j.skipY);
+  Par_For(j.cellsY, Redact_Max(1, REDACT_ROW_GRAIN / block),
+          Redact_PixelateBands, &j);
+}
+
+// --- Box blur ---
+
+typedef struct {
+  const IMAGE *src;
+  IMAGE *dst;
+  int r;
+} BLUR_JOB;
+
+// Horizontal pass over row pairs [begin, end): both rows of a pair share one
+// vector (four 16-bit channel sums each), so the running sum's add and
+// subtract cover two pixels.
+static void Redact_BlurRows(void *ctx, int begin, int end) {
+  const BLUR_JOB *j = (const BLUR_JOB *)ctx;
+  int w = j->src->w, r = j->r, n = 2 * r + 1;
+  for (int pair = begin; pair < end; pair++) {
+    int ya = pair * 2, yb = Redact_Min(ya + 1, j->src->h - 1);
+    const uint32_t *a = (const uint32_t *)IMAGE_ROW(j->src, ya);
+    const uint32_t *b = (const uint32_t *)IMAGE_ROW(j->src, yb);
+    uint32_t *da = (uint32_t *)IMAGE_ROW(j->dst, ya);
+    uint32_t *db = (uint32_t *)IMAGE_ROW(j->dst, yb);
+#ifdef PLATFORM_X86
+    __m128i zero = _mm_setzero_si128();
+#define REDACT_PAIR(x)                                                         \
+  _mm_unpacklo_epi8(_mm_unpacklo_epi32(_mm_cvtsi32_si128((int)a[x]),           \
+                                       _mm_cvtsi32_si128((int)b[x])),          \
+                    zero)
+    __m128i rc = _mm_set1_epi16((short)Redact_Recip(n));
+    __m128i sum = _mm_add_epi16(
+        _mm_set1_epi16((short)(n / 2)),
+        _mm_mullo_epi16(REDACT_PAIR(0), _mm_set1_epi16((short)(r + 1))));
+    for (int i = 1; i <= r; i++)
+      sum = _mm_add_epi16(sum, REDACT_PAIR(Redact_Min(i, w - 1)));
+    for (int x = 0; x < w; x++) {
+      __m128i out = _mm_mulhi_epu16(sum, rc);
+      out = _mm_packus_epi16(out, out);
+      da[x] = (uint32_t)_mm_cvtsi128_si32(out);
+      db[x] = (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(out, 4));
+      sum = _mm_add_epi16(sum, REDACT_PAIR(Redact_Min(x + r + 1, w - 1)));
+      sum = _mm_sub_epi16(sum, REDACT_PAIR(Redact_Max(x - r, 0)));
+    }
+#undef REDACT_PAIR
+#else
+    unsigned rc = Redact_Recip(n);
+    for (int row = 0; row < 2; row++) {
+      const unsigned char *p = (const unsigned char *)(row ? b : a);
+      unsigned char *d = (unsigned char *)(row ? db : da);
+      for (int k = 0; k < 4; k++) {
+        unsigned sum = n / 2 + (r + 1) * p[k];
+        for (int i = 1; i <= r; i++)
+          sum += p[(size_t)Redact_Min(i, w - 1) * 4 + k];
+        for (int x = 0; x < w; x++) {
+          d[(size_t)x * 4 + k] = Redact_Mean(sum, rc);
+          sum += p[(size_t)Redact_Min(x + r + 1, w - 1) * 4 + k];
+          sum -= p[(size_t)Redact_Max(x - r, 0) * 4 + k];
+        }
+      }
+    }
+#endif
+  }
+}
+
+// Vertical pass over column groups [begin, end): a row of running sums
+// moves down the image, so every step is a sequential row read.
+static void Redact_BlurCols(void *ctx, int begin, int end) {
+  const BLUR_JOB *j = (const BLUR_JOB *)ctx;
+  int h = j->src->h, r = j->r, n = 2 * r + 1;
+  for (int g = begin; g < end; g++) {
+    int x0 = g * REDACT_COL_GROUP;
+    int bytes = Redact_Min(REDACT_COL_GROUP, j->src->w - x0) * 4;
+    uint16_t sum[REDACT_COL_GROUP * 4];
+    const unsigned char *first = IMAGE_ROW(j->src, 0) + (size_t)x0 * 4;
+    for (int i = 0; i < bytes; i++)
+      sum[i] = (uint16_t)(n / 2 + (r + 1) * first[i]);
+    for (int k = 1; k <= r; k++) {
+      const unsigned char *p =
+          IMAGE_ROW(j->src, Redact_Min(k, h - 1)) + (size_t)x0 * 4;
+      for (int i = 0; i < bytes; i++)
+        sum[i] = (uint16_t)(sum[i] + p[i]);
+    }
+    unsigned rc = Redact_Recip(n);
+    for (int y = 0; y < h; y++) {
+      const unsigned char *in =
+          IMAGE_ROW(j->src, Redact_Min(y + r + 1, h - 1)) + (size_t)x0 * 4;
+      const unsigned char *out =
+          IMAGE_ROW(j->src, Redact_Max(y - r, 0)) + (size_t)x0 * 4;
+      unsigned char *d = IMAGE_ROW(j->dst, y) + (size_t)x0 * 4;
+      int i = 0;
+#ifdef PLATFORM_X86
+      __m128i zero = _mm_setzero_si128();
+      __m128i rcv = _mm_set1_epi16((short)rc);
+      for (; i + 16 <= bytes; i += 16) {
+        __m128i s0 = _mm_loadu_si128((const __m128i *)(sum + i));
+        __m128i s1 = _mm_loadu_si128((const __m128i *)(sum + i + 8));
+        _mm_storeu_si128(
+            (__m128i *)(d + i),
+            _mm_packus_epi16(_mm_mulhi_epu16(s0, rcv),
+                             _mm_mulhi_epu16(s1, rcv)));
+        __m128i vi = _mm_loadu_si128((const __m128i *)(in + i));
+        __m128i vo = _mm_loadu_si128((const __m128i *)(out + i));
+        s0 = _mm_sub_epi16(_mm_add_epi16(s0, _mm_unpacklo_epi8(vi, zero)),
+                           _mm_unpacklo_epi8(vo, zero));
+        s1 = _mm_sub_epi16(_mm_add_epi16(s1, _mm_unpackhi_epi8(vi, zero)),
+                           _mm_unpackhi_epi8(vo, zero));
+        _mm_storeu_si128((__m128i *)(sum + i), s0);
+        _mm_storeu_si128((__m128i *)(sum + i + 8), s1);
+      }
+#endif
+      for (; i < bytes; i++) {
+        d[i] = Redact_Mean(sum[i], rc);
+        sum[i] = (uint16_t)(sum[i] + in[i] - out[i]);
+      }
+    }
+  }
+}
+
+void Redact_Blur(IMAGE *img, unsigned char *tmp, int radius, int passes) {
+  if (radius < 1 || img->w <= 0 || img->h <= 0)
+    return;
+  if (radius > REDACT_RADIUS_MAX)
+    radius = REDACT_RADIUS_MAX;
+  IMAGE t = {tmp, img->w, img->h, img->w * 4};
+  BLUR_JOB rows = {img, &t, radius}, cols = {&t, img, radius};
+  int groups = (img->w + REDACT_COL_GROUP - 1) / REDACT_COL_GROUP;
+  for (int p = 0; p < passes; p++) {
+    Par_For((img->h + 1) / 2, REDACT_ROW_GRAIN / 2, Redact_BlurRows, &rows);
+    Par_For(groups, 1, Redact_BlurCols, &cols);
+  }
+}
+
+// --- Layer ---
+
+int Redact_Add(REDACT_LAYER *l, int mode) {
+  if (l->n >= REDACT_MAX)
+    return -1;
+  REDACT_REGION *g = &l->region[l->n];
+  memset(g, 0, sizeof(*g));
+  g->mode = mode;
+  return l->n++;
+}
+
+// Grows *buf to at least `bytes`, keeping nothing.
+static int Redact_Reserve(unsigned char **buf, size_t *cap, size_t bytes) {
+  if (*cap >= bytes)
+    return 1;
+  free(*buf);
+  *buf = (unsigned char *)malloc(bytes);
+  *cap = *buf ? bytes : 0;
+  return *buf != NULL;
+}
+
+// How far a source pixel's influence reaches in the mode's output (a
+// pixelate cell at an edge may have joined its neighbour).
+static int Redact_Reach(int mode) {
+  return mode == REDACT_PIXELATE ? 2 * REDACT_BLOCK
+         : mode == REDACT_BLUR   ? REDACT_RADIUS
+                                 : REDACT_GAUSS_RADIUS * 3;
+}
+
+// Filters the part s of region g (rect r, frame coordinates) into dst. The
+// source read grows by the mode's reach, clipped to r, so s comes out as it
+// would from filtering all of r: its pixels are too far from the
+// artificial edges to see the clamping there.
+static int Redact_Strip(REDACT_LAYER *l, const REDACT_REGION *g,
+                        const FRAMEBUFFER *fb, const IRECT *r,
+                        const IRECT *s, IMAGE *dst) {
+  int k = Redact_Reach(g->mode);
+  IRECT e = {s->left - k, s->top - k, s->right + k, s->bottom + k};
+  if (IRect_IsEmpty(s) || !IRect_Intersect(&e, r, &e))
+    return 1;
+  int w = e.right - e.left, h = e.bottom - e.top;
+  size_t bytes = (size_t)w * (size_t)h * 4;
+  if (!Redact_Reserve(&l->src, &l->srcCap, bytes) ||
+      (g->mode != REDACT_PIXELATE &&
+       !Redact_Reserve(&l->tmp, &l->tmpCap, bytes)))
+    return 0;
+  IMAGE img = {l->src, w, h, w * 4};
+  Framebuffer_Read(fb, 0, &e, &img, -e.left, -e.top);
+  if (g->mode == REDACT_PIXELATE)
+    Redact_Pixelate(&img, REDACT_BLOCK, e.left, e.top);
+  else if (g->mode == REDACT_BLUR)
+    Redact_Blur(&img, l->tmp, REDACT_RADIUS, 1);
+  else
+    Redact_Blur(&img, l->tmp, REDACT_GAUSS_RADIUS, 3);
+  size_t row = (size_t)(s->right - s->left) * 4;
+  for (int y = s->top; y < s->bottom; y++)
+    memcpy(IMAGE_ROW(dst, y - r->top) + (size_t)(s->left - r->left) * 4,
+           IMAGE_ROW(&img, y - e.top) + (size_t)(s->left - e.left) * 4, row);
+  l->stats.pixels += (unsigned long long)w * (unsigned long long)h;
+  return 1;
+}
+
+int Redact_Update(REDACT_LAYER *l, int i, const FRAMEBUFFER *fb,
+                  const IRECT *rect) {
+  REDACT_REGION *g = &l->region[i];
+  IRECT bounds = {0, 0, fb->w, fb->h}, r, old = g->rect, core;
+  if (!IRect_Intersect(rect, &bounds, &r))
+    r = (IRECT){0, 0, 0, 0};
+  if (!memcmp(&r, &old, sizeof(r)))
+    return 1;
+  long long t0 = Clock_Ns();
+  g->rect = (IRECT){0, 0, 0, 0};
+  if (IRect_IsEmpty(&r))
+    return 1;
+  int w = r.right - r.left, h = r.bottom - r.top;
+  if (!Redact_Reserve(&g->spare, &g->spareCap, (size_t)w * (size_t)h * 4))
+    return 0;
+  IMAGE next = {g->spare, w, h, w * 4};
+
+  // Output further than the reach from every edge that moved is unchanged:
+  // it is copied over, and only the strips around it are filtered again.
+  int k = Redact_Reach(g->mode);
+  if (IRect_IsEmpty(&old) || !IRect_Intersect(&old, &r, &core)) {
+    core = (IRECT){r.left, r.top, r.left, r.top};
+  } else {
+    core.left += old.left != r.left ? k : 0;
+    core.top += old.top != r.top ? k : 0;
+    core.right -= old.right != r.right ? k : 0;
+    core.bottom -= old.bottom != r.bottom ? k : 0;
+    if (IRect_IsEmpty(&core))
+      core = (IRECT){r.left, r.top, r.left, r.top};
+  }
+  size_t row = (size_t)(core.right - core.left) * 4;
+  for (int y = core.top; y < core.bottom; y++)
+    memcpy(IMAGE_ROW(&next, y - r.top) + (size_t)(core.left - r.left) * 4,
+           IMAGE_ROW(&g->pixels, y - old.top) +
+               (size_t)(core.left - old.left) * 4,
+           row);
+  IRECT strips[4] = {{r.left, r.top, r.right, core.top},
+                     {r.left, core.bottom, r.right, r.bottom},
+                     {r.left, core.top, core.left, core.bottom},
+                     {core.right, core.top, r.right, core.bottom}};
+  for (int s = 0; s < 4; s++)
+    if (!Redact_Strip(l, g, fb, &r, &strips[s], &next))
+      return 0;
+
+  // the old pixels become the spare buffer
+  unsigned char *px = g->pixels.px;
+  size_t cap = g->cap;
+  g->pixels = next;
+  g->cap = g->spareCap;
+  g->spare = px;
+  g->spareCap = cap;
+  g->rect = r;
+  REDACT_STATS *st = &l->stats;
+  st->lastNs = Clock_Ns() - t0;
+  if (st->maxNs < st->lastNs)
+    st->maxNs = st->lastNs;
+  st->updates++;
+  return 1;
+}
+
+void Redact_Pop(REDACT_LAYER *l) {
+  if (!l->n)
+    return;
+  REDACT_REGION *g = &l->region[--l->n];
+  free(g->pixels.px);
+  free(g->spare);
+  memset(g, 0, sizeof(*g));
+}
+
+void Redact_Clear(REDACT_LAYER *l) {
+  while (l->n)
+    Redact_Pop(l);
+  free(l->src);
+  free(l->tmp);
+  memset(l, 0, sizeof(*l));
+}
+
+void Redact_Apply(const REDACT_LAYER *l, IMAGE *dst, int ox, int oy,
+                  const IRECT *clip) {
+  IRECT target = {ox, oy, ox + dst->w, oy + dst->h}, c;
+  if (!IRect_Intersect(clip, &target, &c))
+    return;
+  // in order, so a later region wins where two overlap
+  for (int i = 0; i < l->n; i++) {
+    const REDACT_REGION *g = &l->region[i];
+    IRECT r;
+    if (IRect_IsEmpty(&g->rect) || !IRect_Intersect(&g->rect, &c, &r))
+      continue;
+    size_t bytes = (size_t)(r.right - r.left) * 4;
+    for (int y = r.top; y < r.bottom; y++)
+      memcpy(IMAGE_ROW(dst, y - oy) + (size_t)(r.left - ox) * 4,
+             IMAGE_ROW(&g->pixels, y - g->rect.top) +
+                 (size_t)(r.left - g->rect.left) * 4,
+             bytes);
+  }
+}
+
+const char *Redact_ModeName(int mode) {
+  static const char *names[REDACT_MODES] = {"pixelate", "blur", "gaussian"};
+  return mode >= 0 && mode < REDACT_MODES ? names[mode] : "off";
+}
@@ -0,0 +1,77 @@
+#ifndef SCREENSHOT_REDACT_H
+#define SCREENSHOT_REDACT_H
+
+#include <stddef.h>
+
+#include "framebuffer.h"
+#include "image.h"
+
+// Redaction regions over a capture: rectangles (frame coordinates) whose
+// pixels are replaced by a pixelated or blurred copy, both in the overlay
+// and in everything exported from it. Each region keeps its filtered pixels.
+// When a region is dragged, only the strips within the filter's reach of
+// the edges that moved are read and filtered again.
+//
+// The filters are separable and cost O(1) per pixel whatever the radius:
+// pixelate averages cells on a grid fixed to the frame, the box blur slides
+// a running sum along rows and then columns, and three box passes
+// approximate a Gaussian. Edges clamp to the region, so its output only
+// depends on its own pixels; a pixelate cell the region's edge cuts to under
+// half a block joins the next one.
+
+#define REDACT_MAX 64
+#define REDACT_BLOCK 12       // pixelate cell side
+#define REDACT_RADIUS 12      // box blur radius
+#define REDACT_GAUSS_RADIUS 6 // radius of each of the three Gaussian passes
+#define REDACT_RADIUS_MAX 127 // sums of 2 * r + 1 pixels must fit 16 bits
+
+enum { REDACT_PIXELATE, REDACT_BLUR, REDACT_GAUSS, REDACT_MODES };
+
+typedef struct {
+  IRECT rect; // frame coordinates; empty until the first update
+  int mode;
+  IMAGE pixels; // the filtered rect
+  size_t cap;   // bytes allocated behind pixels.px
+  unsigned char *spare; // the next update's pixels
+  size_t spareCap;
+} REDACT_REGION;
+
+typedef struct {
+  long long lastNs, maxNs; // time of an update
+  unsigned long long updates;
+  unsigned long long pixels; // filtered, reach included
+} REDACT_STATS;
+
+typedef struct {
+  int n;
+  REDACT_REGION region[REDACT_MAX];
+  unsigned char *src, *tmp; // strip and blur scratch, shared by all regions
+  size_t srcCap, tmpCap;
+  REDACT_STATS stats;
+} REDACT_LAYER;
+
+// Appends an empty region; returns its index, or -1 when the layer is full.
+int Redact_Add(REDACT_LAYER *l, int mode);
+// Moves region i to rect and filters what changed from fb's capture.
+// Returns 0 if out of memory; the region is then empty.
+int Redact_Update(REDACT_LAYER *l, int i, const FRAMEBUFFER *fb,
+                  const IRECT *rect);
+// Drops the last region.
+void Redact_Pop(REDACT_LAYER *l);
+// Drops every region and frees the scratch.
+void Redact_Clear(REDACT_LAYER *l);
+
+// Copies the filtered pixels over dst, where frame point (x, y) is dst pixel
+// (x - ox, y - oy), but only inside clip (frame coordinates).
+void Redact_Apply(const REDACT_LAYER *l, IMAGE *dst, int ox, int oy,
+                  const IRECT *clip);
+const char *Redact_ModeName(int mode);
+
+// The filters, in place. Pixelate cells sit on a grid of `block` in the
+// coordinates where img's corner is (ox, oy), cells cut to under half a
+// block at img's edges joining their neighbours. tmp must hold img->w * img->h
+// pixels.
+void Redact_Pixelate(IMAGE *img, int block, int ox, int oy);
+void Redact_Blur(IMAGE *img, unsigned char *tmp, int radius, int passes);
+
+#endif
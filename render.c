@@ -0,0 +1,340 @@
+#include "render.h"
+
+#include <stdio.h>
+
+#define WHITE 0xFFFFFFFFu
+#define BLACK 0xFF000000u
+#define LABEL_TEXT 0xFFF0F0F0u
+
+// 5x7 glyphs for the only characters the label needs ("0"-"9", "x"),
+// one byte per row, bit 4 = leftmost column. Drawn at 2x.
+#define GLYPH_SCALE 2
+#define GLYPH_ADVANCE (6 * GLYPH_SCALE)
+#define GLYPH_H (7 * GLYPH_SCALE)
+static const unsigned char kGlyphs[11][7] = {
+    {0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E}, // 0
+    {0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E}, // 1
+    {0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F}, // 2
+    {0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E}, // 3
+    {0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02}, // 4
+    {0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E}, // 5
+    {0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E}, // 6
+    {0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08}, // 7
+    {0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E}, // 8
+    {0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C}, // 9
+    {0x00, 0x00, 0x11, 0x0A, 0x04, 0x0A, 0x11}, // x
+};
+
+static int LabelText(const IRECT *sel, char buf[32]) {
+  IRECT s = *sel;
+  IRect_Normalize(&s);
+  return snprintf(buf, 32, "%dx%d", s.right - s.left, s.bottom - s.top);
+}
+
+IRECT Render_LabelBox(const IRECT *sel, const IRECT *client) {
+  IRECT s = *sel;
+  IRect_Normalize(&s);
+  char buf[32];
+  int n = LabelText(&s, buf);
+  const int outside = RENDER_HANDLE_SIZE + 6, inside = 6;
+  int boxW = n * GLYPH_ADVANCE - GLYPH_SCALE + RENDER_LABEL_PAD_X * 2;
+  int boxH = GLYPH_H + RENDER_LABEL_PAD_Y * 2;
+
+  // left of the selection, then above it, then tucked inside
+  IRECT box;
+  box.right = s.left - outside;
+  box.left = box.right - boxW;
+  box.top = s.top;
+  box.bottom = box.top + boxH;
+  if (box.left >= client->left)
+    return box;
+
+  box.left = s.left;
+  box.right = box.left + boxW;
+  box.bottom = s.top - outside;
+  box.top = box.bottom - boxH;
+  if (box.top >= client->top)
+    return box;
+
+  box.left = s.left + inside;
+  box.top = s.top + inside;
+  box.right = box.left + boxW;
+  box.bottom = box.top + boxH;
+  if (box.left < client->left) {
+    int dx = client->left - box.left;
+    box.left += dx;
+    box.right += dx;
+  }
+  if (box.top < client->top) {
+    int dy = client->top - box.top;
+    box.top += dy;
+    box.bottom += dy;
+  }
+  if (box.right > client->right) {
+    int dx = box.right - client->right;
+    box.left -= dx;
+    box.right -= dx;
+  }
+  if (box.bottom > client->bottom) {
+    int dy = box.bottom - client->bottom;
+    box.top -= dy;
+    box.bottom -= dy;
+  }
+  return box;
+}
+
+static void HandleRects(const IRECT *s, IRECT out[8]) {
+  int cx = (s->left + s->right) / 2, cy = (s->top + s->bottom) / 2;
+  int px[8] = {s->left, cx, s->right, s->left, s->right, s->left, cx, s->right};
+  int py[8] = {s->top, s->top, s->top, cy, cy, s->bottom, s->bottom, s->bottom};
+  for (int i = 0; i < 8; i++) {
+    out[i].left = px[i] - RENDER_HANDLE_SIZE;
+    out[i].top = py[i] - RENDER_HANDLE_SIZE;
+    out[i].right = px[i] + RENDER_HANDLE_SIZE;
+    out[i].bottom = py[i] + RENDER_HANDLE_SIZE;
+  }
+}
+
+IRECT Render_SelBounds(const IRECT *sel, const IRECT *client) {
+  IRECT s = *sel;
+  IRect_Normalize(&s);
+  int grow = RENDER_HANDLE_SIZE > RENDER_BORDER_WIDTH ? RENDER_HANDLE_SIZE
+                                                      : RENDER_BORDER_WIDTH;
+  IRECT r = {s.left - grow, s.top - grow, s.right + grow, s.bottom + grow};
+  IRECT label = Render_LabelBox(&s, client);
+  IRect_Union(&r, &label, &r);
+  return r;
+}
+
+// Dashes are phased on absolute coordinates so they line up across rects.
+static void DashRows(IMAGE *dst, const IRECT *r, int horizontal) {
+  for (int y = r->top; y < r->bottom; y++) {
+    unsigned *p = (unsigned *)IMAGE_ROW(dst, y);
+    for (int x = r->left; x < r->right; x++) {
+      int pos = horizontal ? x : y;
+      if (((pos / RENDER_DASH) & 1) == 0)
+        p[x] = WHITE;
+    }
+  }
+}
+
+static void DrawBorder(IMAGE *dst, const IRECT *s, const IRECT *clip) {
+  const int hw = RENDER_BORDER_WIDTH / 2;
+  IRECT edges[4] = {
+      {s->left - hw, s->top - hw, s->right + hw, s->top + hw},       // top
+      {s->left - hw, s->bottom - hw, s->right + hw, s->bottom + hw}, // bottom
+      {s->left - hw, s->top + hw, s->left + hw, s->bottom - hw},     // left
+      {s->right - hw, s->top + hw, s->right + hw, s->bottom - hw},   // right
+  };
+  for (int i = 0; i < 4; i++) {
+    IRECT r;
+    if (IRect_Intersect(&edges[i], clip, &r))
+      DashRows(dst, &r, i < 2);
+  }
+}
+
+static void DrawHandles(IMAGE *dst, const IRECT *s, const IRECT *clip) {
+  IRECT h[8];
+  HandleRects(s, h);
+  for (int i = 0; i < 8; i++) {
+    IRECT r;
+    if (!IRect_Intersect(&h[i], clip, &r))
+      continue;
+    for (int y = r.top; y < r.bottom; y++) {
+      unsigned *p = (unsigned *)IMAGE_ROW(dst, y);
+      int edgeRow = (y == h[i].top || y == h[i].bottom - 1);
+      for (int x = r.left; x < r.right; x++)
+        p[x] = (edgeRow || x == h[i].left || x == h[i].right - 1) ? WHITE
+                                                                  : BLACK;
+    }
+  }
+}
+
+static void DrawLabel(IMAGE *dst, const IRECT *s, const IRECT *client,
+                      const IRECT *clip) {
+  IRECT box = Render_LabelBox(s, client), r;
+  if (!IRect_Intersect(&box, clip, &r))
+    return;
+  char buf[32];
+  int n = LabelText(s, buf);
+  int tx = box.left + RENDER_LABEL_PAD_X, ty = box.top + RENDER_LABEL_PAD_Y;
+  for (int y = r.top; y < r.bottom; y++) {
+    unsigned *p = (unsigned *)IMAGE_ROW(dst, y);
+    int gy = (y - ty) / GLYPH_SCALE;
+    for (int x = r.left; x < r.right; x++) {
+      unsigned c = BLACK;
+      int gx = x - tx;
+      if (y >= ty && gy < 7 && gx >= 0 && gx < n * GLYPH_ADVANCE) {
+        int ch = buf[gx / GLYPH_ADVANCE];
+        int col = (gx % GLYPH_ADVANCE) / GLYPH_SCALE;
+        const unsigned char *g = kGlyphs[ch == 'x' ? 10 : ch - '0'];
+        if (col < 5 && (g[gy] & (0x10 >> col)))
+          c = LABEL_TEXT;
+      }
+      p[x] = c;
+    }
+  }
+}
+
+static void FillBox(IMAGE *dst, const IRECT *rect, const IRECT *clip,
+                     unsigned color) {
+  IRECT r;
+  if (!IRect_Intersect(rect, clip, &r))
+    return;
+  for (int y = r.top; y < r.bottom; y++) {
+    unsigned *p = (unsigned *)IMAGE_ROW(dst, y);
+    for (int x = r.left; x < r.right; x++)
+      p[x] = color;
+  }
+}
+
+// Frame pixels across the loupe: odd, so the cursor pixel is the middle one.
+static int LoupeSpan(int zoom) { return (RENDER_LOUPE_SIZE / zoom) | 1; }
+
+#define LOUPE_MAX_SPAN ((RENDER_LOUPE_SIZE / RENDER_ZOOM_MIN) | 1)
+
+IRECT Render_LoupeBox(int x, int y, int zoom, const IRECT *client) {
+  int side = LoupeSpan(zoom) * zoom + 2;
+  int left = x + RENDER_LOUPE_OFFSET, top = y + RENDER_LOUPE_OFFSET;
+  if (left + side > client->right)
+    left = x - RENDER_LOUPE_OFFSET - side;
+  if (top + side > client->bottom)
+    top = y - RENDER_LOUPE_OFFSET - side;
+  if (left < client->left)
+    left = client->left;
+  if (top < client->top)
+    top = client->top;
+  return (IRECT){left, top, left + side, top + side};
+}
+
+// Zoomed cells of the frame around (srcX, srcY) inside a white border; the
+// middle cell is drawn inverted to mark the pixel under the cursor.
+static void DrawLoupe(IMAGE *dst, const RENDER_SCENE *sc, const IRECT *clip) {
+  int zoom = sc->zoom, n = LoupeSpan(zoom);
+  IRECT box = Render_LoupeBox(sc->cursorX, sc->cursorY, zoom, &sc->client);
+  IRECT r;
+  if (!IRect_Intersect(&box, clip, &r))
+    return;
+  unsigned patch[LOUPE_MAX_SPAN * LOUPE_MAX_SPAN];
+  for (int i = 0; i < n * n; i++)
+    patch[i] = BLACK;
+  IMAGE pi = {(unsigned char *)patch, n, n, n * 4};
+  IRECT src = {sc->srcX - n / 2, sc->srcY - n / 2, sc->srcX - n / 2 + n,
+               sc->srcY - n / 2 + n};
+  Framebuffer_Read(sc->fb, 0, &src, &pi, -src.left, -src.top);
+  if (sc->haveSel) {
+    IRECT s = sc->sel;
+    IRect_Normalize(&s);
+    if (sc->redact)
+      Redact_Apply(sc->redact, &pi, src.left, src.top, &s);
+    if (sc->annot)
+      Annot_Flatten(sc->annot, &pi, src.left, src.top, &s);
+  }
+  for (int y = r.top; y < r.bottom; y++) {
+    unsigned *p = (unsigned *)IMAGE_ROW(dst, y);
+    int iy = y - box.top - 1;
+    for (int x = r.left; x < r.right; x++) {
+      int ix = x - box.left - 1;
+      if (iy < 0 || ix < 0 || iy >= n * zoom || ix >= n * zoom) {
+        p[x] = WHITE;
+        continue;
+      }
+      unsigned c = patch[(iy / zoom) * n + ix / zoom];
+      p[x] = iy / zoom == n / 2 && ix / zoom == n / 2 ? c ^ 0x00FFFFFFu : c;
+    }
+  }
+}
+
+IRECT Render_OverviewBox(const FRAMEBUFFER *fb, const IRECT *area) {
+  int aw = area->right - area->left - 2 * RENDER_OVERVIEW_MARGIN;
+  int ah = area->bottom - area->top - 2 * RENDER_OVERVIEW_MARGIN;
+  if (aw < 1 || ah < 1 || fb->w < 1 || fb->h < 1)
+    return (IRECT){0, 0, 0, 0};
+  int w = aw, h = (int)((long long)fb->h * aw / fb->w);
+  if (h > ah) {
+    h = ah;
+    w = (int)((long long)fb->w * ah / fb->h);
+  }
+  int left = area->left + (area->right - area->left - w) / 2;
+  int top = area->top + (area->bottom - area->top - h) / 2;
+  return (IRECT){left, top, left + (w ? w : 1), top + (h ? h : 1)};
+}
+
+void Render_OverviewToFrame(const IRECT *box, const FRAMEBUFFER *fb, int *x,
+                            int *y) {
+  int bw = box->right - box->left, bh = box->bottom - box->top;
+  *x = (int)((long long)(*x - box->left) * fb->w / bw);
+  *y = (int)((long long)(*y - box->top) * fb->h / bh);
+}
+
+// The pyramid fitted into the box, a solid frame around it, and the
+// selection's place in it.
+static void DrawOverview(IMAGE *dst, const RENDER_SCENE *sc,
+                         const IRECT *clip) {
+  const IRECT *b = &sc->overviewBox;
+  Mip_DrawFit(sc->mip, dst, b, clip);
+  IRECT edges[4] = {{b->left - 1, b->top - 1, b->right + 1, b->top},
+                    {b->left - 1, b->bottom, b->right + 1, b->bottom + 1},
+                    {b->left - 1, b->top, b->left, b->bottom},
+                    {b->right, b->top, b->right + 1, b->bottom}};
+  for (int i = 0; i < 4; i++)
+    FillBox(dst, &edges[i], clip, WHITE);
+  if (!sc->haveSel)
+    return;
+  IRECT s = sc->sel;
+  IRect_Normalize(&s);
+  int bw = b->right - b->left, bh = b->bottom - b->top;
+  IRECT m = {b->left + (int)((long long)s.left * bw / sc->fb->w),
+             b->top + (int)((long long)s.top * bh / sc->fb->h),
+             b->left + (int)((long long)s.right * bw / sc->fb->w),
+             b->top + (int)((long long)s.bottom * bh / sc->fb->h)};
+  IRECT inside;
+  if (IRect_Intersect(b, clip, &inside))
+    DrawBorder(dst, &m, &inside);
+}
+
+size_t Render_Frame(const RENDER_SCENE *sc, IMAGE *dst, const IRECT *dirty,
+                    int ndirty) {
+  IRECT bounds = {0, 0, dst->w < sc->fb->w ? dst->w : sc->fb->w,
+                  dst->h < sc->fb->h ? dst->h : sc->fb->h};
+  IRECT s = sc->sel;
+  IRect_Normalize(&s);
+  // Without a finished pyramid the overview is only its frame, and the
+  // frame shows through the box.
+  int fitted =
+      sc->overview && sc->mip && Mip_Ready(sc->mip) && sc->mip->n;
+  size_t touched = 0;
+  for (int i = 0; i < ndirty; i++) {
+    IRECT d, r;
+    if (!IRect_Intersect(&dirty[i], &bounds, &d))
+      continue;
+    touched += (size_t)(d.right - d.left) * (size_t)(d.bottom - d.top);
+    // the overview hides what is under it
+    const IRECT *ob = &sc->overviewBox;
+    int covered = fitted && d.left >= ob->left && d.top >= ob->top &&
+                  d.right <= ob->right && d.bottom <= ob->bottom;
+    if (!covered) {
+      Framebuffer_Read(sc->fb, 1, &d, dst, 0, 0);
+      if (sc->haveSel && IRect_Intersect(&s, &d, &r)) {
+        Framebuffer_Read(sc->fb, 0, &r, dst, 0, 0);
+        if (sc->redact)
+          Redact_Apply(sc->redact, dst, 0, 0, &r);
+        if (sc->annot)
+          Annot_Draw(sc->annot, sc->fb, sc->redact, dst, &r);
+      }
+      if (sc->diff)
+        Diff_DrawOutlines(sc->diff, dst, &d);
+      if (sc->haveSel && !sc->overview) {
+        DrawBorder(dst, &s, &d);
+        if (!sc->hover)
+          DrawHandles(dst, &s, &d);
+        DrawLabel(dst, &s, &sc->client, &d);
+      }
+    }
+    if (sc->overview && sc->mip)
+      DrawOverview(dst, sc, &d);
+    if (sc->loupe)
+      DrawLoupe(dst, sc, &d);
+  }
+  return touched;
+}
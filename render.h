@@ -0,0 +1,73 @@
+#ifndef SCREENSHOT_RENDER_H
+#define SCREENSHOT_RENDER_H
+
+#include "annot.h"
+#include "diff.h"
+#include "framebuffer.h"
+#include "image.h"
+#include "mip.h"
+#include "redact.h"
+
+// Portable overlay compositor: dimmed background, bright selection cut-out,
+// dashed border, resize handles and the WxH label, redaction regions and
+// annotations, the regions that changed since the previous capture, plus
+// the loupe and the zoom-to-fit overview, drawn straight into a BGRA
+// buffer. Every output pixel is a pure function of the scene,
+// so drawing only the dirty rects gives the same result as a full repaint.
+
+#define RENDER_HANDLE_SIZE 3  // half-extent of a handle square
+#define RENDER_BORDER_WIDTH 2 // dashed selection border, straddles the edge
+#define RENDER_DASH 4         // dash and gap length of the border
+#define RENDER_LABEL_PAD_X 6
+#define RENDER_LABEL_PAD_Y 3
+#define RENDER_LOUPE_SIZE 128  // loupe side, rounded to whole zoomed pixels
+#define RENDER_LOUPE_OFFSET 24 // gap between the cursor and the loupe
+#define RENDER_ZOOM_MIN 2
+#define RENDER_ZOOM_MAX 16
+#define RENDER_OVERVIEW_MARGIN 48 // around the overview, inside its area
+
+typedef struct {
+  const FRAMEBUFFER *fb; // captured tiles with their dimmed copies
+  int haveSel;
+  IRECT sel;    // selection in client coordinates (any orientation)
+  int hover;    // sel is the window under the cursor: drawn without handles
+  IRECT client; // overlay client area, used for label placement
+  const REDACT_LAYER *redact; // shown inside the selection, NULL for none
+  ANNOT_LAYER *annot; // likewise; its tile cache is filled as tiles show up
+  const DIFF *diff;   // its regions are framed, NULL for none
+
+  // Magnifier next to the cursor showing the frame around (srcX, srcY) at
+  // `zoom`x, read from the full-resolution frame.
+  int loupe, zoom;
+  int cursorX, cursorY, srcX, srcY;
+
+  // The whole frame fitted into overviewBox, drawn from the pyramid; until
+  // there is one, only the box frame is drawn over the dimmed frame.
+  int overview;
+  IRECT overviewBox;
+  const MIP_PYRAMID *mip;
+} RENDER_SCENE;
+
+// Where the dimensions label goes for a selection; callers use the same
+// placement when computing what to invalidate.
+IRECT Render_LabelBox(const IRECT *sel, const IRECT *client);
+
+// Bounding box of everything drawn for a selection: border, handles, label.
+IRECT Render_SelBounds(const IRECT *sel, const IRECT *client);
+
+// Where the loupe goes for a cursor at (x, y), border included.
+IRECT Render_LoupeBox(int x, int y, int zoom, const IRECT *client);
+
+// The frame scaled to fit area less RENDER_OVERVIEW_MARGIN, centered. Its
+// 1-pixel frame is drawn just outside.
+IRECT Render_OverviewBox(const FRAMEBUFFER *fb, const IRECT *area);
+// The frame point shown at (*x, *y) in the overview.
+void Render_OverviewToFrame(const IRECT *box, const FRAMEBUFFER *fb, int *x,
+                            int *y);
+
+// Composites the scene into dst, touching only the given rects (clipped to
+// dst). Returns the number of pixels written.
+size_t Render_Frame(const RENDER_SCENE *sc, IMAGE *dst, const IRECT *dirty,
+                    int ndirty);
+
+#endif
@@ -1,13 +1,34 @@
 #include <objbase.h>
 #include <shellapi.h>
+#include <shlobj.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
 #include <wchar.h>
 #include <windows.h>
+#include <dwmapi.h>
 #include <windowsx.h>
 
+#include "annot.h"
+#include "batch.h"
+#include "diff.h"
+#include "edges.h"
+#include "export.h"
+#include "framebuffer.h"
+#include "frameclock.h"
+#include "history.h"
+#include "mip.h"
+#include "pick.h"
+#include "platform.h"
+#include "record.h"
+#include "redact.h"
+#include "render.h"
+#include "stitch.h"
+
 #pragma comment(lib, "Gdi32.lib")
 #pragma comment(lib, "User32.lib")
-#pragma comment(lib, "Msimg32.lib")
 #pragma comment(lib, "Shell32.lib")
+#pragma comment(lib, "Psapi.lib")
 
 #ifndef MIN
 #define MIN(a, b) (((a) < (b)) ? (a) : (b))
@@ -45,20 +66,21 @@ typedef enum {
 
 typedef struct {
   RECT virt;
-  HBITMAP hbmCapture;
-  HDC hdcCapture;
-  HBITMAP hbmBlack;
-  HDC hdcBlack;
+  FRAMEBUFFER fb; // one tile per monitor, each with a pre-dimmed copy
+  HBITMAP hbmTile[FB_MAX_TILES]; // DIBs behind fb.tiles[i].capture
+  long long captureNs;
   HBITMAP hbmBack;
   HDC hdcBack;
+  IMAGE back;
   int backW, backH;
-  HFONT hFontSmall;
 
-  HPEN hPenHandle;    // handle outline pen (white)
-  HPEN hPenDotted;    // selection dotted pen (white)
-  HBRUSH hBrushBlack; // black (for label bg)
+  // repaint cost: pixels composited by the last paint and in total
+  size_t paintPixels, paintPixelsTotal;
+  unsigned paints;
 
-  BLENDFUNCTION blendFn;
+  // drag input is coalesced to one selection update per display frame
+  FRAME_CLOCK clock;
+  BOOL frameTimer;
 
   // selection state
   BOOL haveSel, selecting, resizing, moving;
@@ -66,17 +88,130 @@ typedef struct {
   POINT dragStart, dragCur, lastMouse, moveOffset;
   HANDLE_ID activeHandle;
 
-  // overlay window handle (for closing only the overlay)
+  // snap-to-edge, built from the frozen frame; Shift held turns it off
+  EDGE_INDEX edges;
+  int snapDist;
+  BOOL noSnap;
+
+  // window pick: top-level windows as the grab saw them, and the one under
+  // the cursor while nothing is selected
+  PICK_INDEX pick;
+  int hover; // index into pick, -1 for none
+  int pickWindows;
+  long long pickListNs;
+
+  // loupe ('M', the wheel zooms) and the zoom-to-fit overview of the whole
+  // frame over the monitor under the cursor ('Z'), drawn from the pyramid
+  MIP_PYRAMID mip;
+  BOOL loupe, overview;
+  int zoom;
+  IRECT overviewBox;
+  POINT pointer; // where the loupe was last drawn for
+
+  // redaction: 'X' cycles the brush (off, pixelate, blur, Gaussian), a drag
+  // inside the selection then adds a region; Backspace drops the last one
+  REDACT_LAYER redact;
+  int brush; // REDACT_* mode, -1 for off
+  BOOL redacting;
+  POINT redactStart;
+
+  // annotations: 'A' arrow, 'B' box, 'H' highlighter, 'T' text pick the
+  // tool (the same key drops it); a drag inside the selection draws one,
+  // and a text click places a label that takes the typed keys
+  ANNOT_LAYER annot;
+  int tool; // ANNOT_* kind, -1 for off
+  BOOL annotating; // dragging the last annotation
+  int typing;      // label being typed, -1 for none
+
+  // 'D' frames what changed since the previous capture; every session
+  // keeps a copy of its frame for the next one to compare with
+  DIFF_KEEP keep[2]; // keep[cur] is this session's
+  int cur;
+  DIFF diff;
+  BOOL diffShown, diffDone;
+
+  // overlay window handle; the window is hidden, not destroyed, between
+  // activations so it and its buffers can be reused (see g_pool)
   HWND hwnd;
+  BOOL active;
 } OVERLAY;
 
 static OVERLAY og;
 
+// Activations that found the overlay window and buffers already allocated,
+// and the setup time (hotkey to shown window, excluding the grab itself).
+typedef struct {
+  unsigned hits, misses;
+  BOOL lastHit;
+  long long setupNs, missNs; // last activation; total over misses
+} POOL_STATS;
+static POOL_STATS g_pool;
+static HWND g_hwndCtl = NULL; // hidden controller: tray, hotkey, clipboard
+
+// Region recording ('R' in the overlay; PrintScreen stops it). The capture
+// thread blits into dib and copies rows into the recorder's frame.
+static struct {
+  RECORDER *rec;
+  FILE *f;
+  wchar_t path[MAX_PATH + 64];
+  HBITMAP dib;
+  IMAGE pixels; // dib's bits
+  int x, y;     // virtual-screen coordinates
+} g_rec;
+
+// Scrolling capture ('S' in the overlay): the selection is grabbed every
+// STITCH_INTERVAL_MS while the user scrolls it; PrintScreen saves the result.
+static struct {
+  BOOL active;
+  STITCH st;
+  HBITMAP dib;
+  IMAGE pixels;
+  int x, y;
+} g_scroll;
+
 static const BYTE OVERLAY_ALPHA = 100;
-static const int HANDLE_SIZE = 3;
-static const int BORDER_WIDTH = 2;
-static const int HANDLE_BORDER_WIDTH = 1;
+static const int HANDLE_SIZE = RENDER_HANDLE_SIZE;
 static const int MIN_SEL_SIZE = 2;
+static const int LOUPE_ZOOM = 4; // first loupe magnification
+static const UINT_PTR FRAME_TIMER_ID = 1;
+#define WM_OVERLAY_DIMBAND (WM_APP + 2) // wParam tile (-1: done), lParam rows
+#define WM_EXPORT_CLIPBOARD (WM_APP + 3) // lParam CF_DIB HGLOBAL to publish
+static const UINT_PTR RECORD_TIMER_ID = 2; // on the controller window
+static const UINT_PTR SCROLL_TIMER_ID = 3;
+
+static IRECT ToIRect(const RECT *r) {
+  IRECT ir = {r->left, r->top, r->right, r->bottom};
+  return ir;
+}
+static RECT FromIRect(const IRECT *r) {
+  RECT rr = {r->left, r->top, r->right, r->bottom};
+  return rr;
+}
+
+static void DIBInfo32(BITMAPINFO *bi, int w, int h) {
+  ZeroMemory(bi, sizeof(*bi));
+  bi->bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+  bi->bmiHeader.biWidth = w;
+  bi->bmiHeader.biHeight = -h;
+  bi->bmiHeader.biPlanes = 1;
+  bi->bmiHeader.biBitCount = 32;
+  bi->bmiHeader.biCompression = BI_RGB;
+}
+
+// Top-down 32-bpp DIB so the portable pixel kernels can work on it in place.
+static HBITMAP CreateDIB32(HDC hdc, int w, int h, IMAGE *img) {
+  BITMAPINFO bi;
+  DIBInfo32(&bi, w, h);
+  void *pv = NULL;
+  HBITMAP bm = CreateDIBSection(hdc, &bi, DIB_RGB_COLORS, &pv, NULL, 0);
+  if (!bm)
+    return NULL;
+  img->px = (unsigned char *)pv;
+  img->w = w;
+  img->h = h;
+  img->stride = w * 4;
+  return bm;
+}
 
 static void Overlay_DeleteBackBuffer(void) {
   if (og.hdcBack) {
@@ -87,6 +222,7 @@ static void Overlay_DeleteBackBuffer(void) {
     DeleteObject(og.hbmBack);
     og.hbmBack = NULL;
   }
+  og.back.px = NULL;
   og.backW = og.backH = 0;
 }
 static BOOL Overlay_EnsureBackBuffer(HWND hwnd, int w, int h) {
@@ -95,7 +231,7 @@ static BOOL Overlay_EnsureBackBuffer(HWND hwnd, int w, int h) {
   Overlay_DeleteBackBuffer();
   HDC hdc = GetDC(hwnd);
   og.hdcBack = CreateCompatibleDC(hdc);
-  og.hbmBack = CreateCompatibleBitmap(hdc, w, h);
+  og.hbmBack = CreateDIB32(hdc, w, h, &og.back);
   ReleaseDC(hwnd, hdc);
   if (!og.hdcBack || !og.hbmBack)
     return FALSE;
@@ -105,111 +241,173 @@ static BOOL Overlay_EnsureBackBuffer(HWND hwnd, int w, int h) {
   return TRUE;
 }
 
-static BOOL Overlay_CaptureVirtual(void) {
-  og.virt.left = GetSystemMetrics(SM_XVIRTUALSCREEN);
-  og.virt.top = GetSystemMetrics(SM_YVIRTUALSCREEN);
-  og.virt.right = og.virt.left + GetSystemMetrics(SM_CXVIRTUALSCREEN);
-  og.virt.bottom = og.virt.top + GetSystemMetrics(SM_CYVIRTUALSCREEN);
-  int W = RectW(&og.virt), H = RectH(&og.virt);
+typedef struct {
+  IRECT rects[FB_MAX_TILES];
+  int n;
+} MONITOR_LIST;
+
+static BOOL CALLBACK Overlay_AddMonitor(HMONITOR mon, HDC hdc, LPRECT rc,
+                                        LPARAM lp) {
+  (void)mon;
+  (void)hdc;
+  MONITOR_LIST *l = (MONITOR_LIST *)lp;
+  if (l->n < FB_MAX_TILES)
+    l->rects[l->n++] = ToIRect(rc);
+  return TRUE;
+}
+
+// Top-level windows in client coordinates, topmost first (EnumWindows order).
+typedef struct {
+  IRECT *rects;
+  int n, cap;
+} WINDOW_LIST;
+
+static BOOL CALLBACK Overlay_AddWindow(HWND hwnd, LPARAM lp) {
+  WINDOW_LIST *l = (WINDOW_LIST *)lp;
+  // hidden, minimized, click-through, or cloaked (other virtual desktops,
+  // suspended store apps)
+  DWORD cloaked = 0;
+  RECT r;
+  if (hwnd == og.hwnd || !IsWindowVisible(hwnd) || IsIconic(hwnd) ||
+      (GetWindowLongW(hwnd, GWL_EXSTYLE) & WS_EX_TRANSPARENT) ||
+      (SUCCEEDED(DwmGetWindowAttribute(hwnd, DWMWA_CLOAKED, &cloaked,
+                                       sizeof(cloaked))) &&
+       cloaked) ||
+      !GetWindowRect(hwnd, &r) || IsRectEmpty(&r))
+    return TRUE;
+  if (l->n == l->cap) {
+    int cap = l->cap ? l->cap * 2 : 256;
+    IRECT *grown = (IRECT *)realloc(l->rects, (size_t)cap * sizeof(IRECT));
+    if (!grown)
+      return FALSE;
+    l->rects = grown;
+    l->cap = cap;
+  }
+  l->rects[l->n++] = (IRECT){r.left - og.virt.left, r.top - og.virt.top,
+                             r.right - og.virt.left, r.bottom - og.virt.top};
+  return TRUE;
+}
+
+static void Overlay_ListWindows(void) {
+  long long t0 = Clock_Ns();
+  WINDOW_LIST l = {0};
+  EnumWindows(Overlay_AddWindow, (LPARAM)&l);
+  IRECT bounds = {0, 0, RectW(&og.virt), RectH(&og.virt)};
+  Pick_Build(&og.pick, l.rects, l.n, &bounds);
+  free(l.rects);
+  og.pickWindows = l.n;
+  og.pickListNs = Clock_Ns() - t0;
+}
 
+// Runs on a capture thread, so it takes its own screen and memory DCs and
+// flushes its own GDI batch.
+static int Overlay_GrabTile(void *ctx, int i) {
+  (void)ctx;
+  const FB_TILE *t = &og.fb.tiles[i];
   HDC s = GetDC(NULL);
   if (!s)
-    return FALSE;
+    return 0;
   HDC mem = CreateCompatibleDC(s);
-  HBITMAP bm = CreateCompatibleBitmap(s, W, H);
-  if (!mem || !bm) {
-    if (mem)
-      DeleteDC(mem);
+  if (!mem) {
     ReleaseDC(NULL, s);
-    return FALSE;
+    return 0;
   }
-  HGDIOBJ old = SelectObject(mem, bm);
-  BitBlt(mem, 0, 0, W, H, s, og.virt.left, og.virt.top, SRCCOPY | CAPTUREBLT);
+  HGDIOBJ old = SelectObject(mem, og.hbmTile[i]);
+  BOOL ok = BitBlt(mem, 0, 0, t->capture.w, t->capture.h, s,
+                   og.fb.virt.left + t->area.left, og.fb.virt.top + t->area.top,
+                   SRCCOPY | CAPTUREBLT);
+  GdiFlush();
   SelectObject(mem, old);
   DeleteDC(mem);
   ReleaseDC(NULL, s);
+  return ok;
+}
 
-  og.hdcCapture = CreateCompatibleDC(NULL);
-  SelectObject(og.hdcCapture, bm);
-  og.hbmCapture = bm;
-
-  // 1x1 black DIB for AlphaBlend
-  BITMAPINFO bi = {0};
-  bi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
-  bi.bmiHeader.biWidth = 1;
-  bi.bmiHeader.biHeight = 1;
-  bi.bmiHeader.biPlanes = 1;
-  bi.bmiHeader.biBitCount = 32;
-  bi.bmiHeader.biCompression = BI_RGB;
-  void *pv = NULL;
-  og.hbmBlack = CreateDIBSection(NULL, &bi, DIB_RGB_COLORS, &pv, NULL, 0);
-  if (!og.hbmBlack)
-    return FALSE;
-  *(DWORD *)pv = 0xFF000000;
-  og.hdcBlack = CreateCompatibleDC(NULL);
-  if (!og.hdcBlack) {
-    DeleteObject(og.hbmBlack);
-    og.hbmBlack = NULL;
-    return FALSE;
+// Runs on the dimming worker: hand each finished band to the UI thread.
+static void Overlay_DimNotify(void *ctx, int tile, int top, int bottom) {
+  PostMessageW((HWND)ctx, WM_OVERLAY_DIMBAND, (WPARAM)tile,
+               MAKELPARAM(top, bottom));
+}
+
+static void Overlay_ReleaseTiles(void) {
+  Edges_Wait(&og.edges); // these read the tile DIBs
+  Mip_Wait(&og.mip);
+  Diff_KeepWait(&og.keep[og.cur]);
+  Framebuffer_Free(&og.fb);
+  for (int i = 0; i < FB_MAX_TILES; i++) {
+    if (og.hbmTile[i]) {
+      DeleteObject(og.hbmTile[i]);
+      og.hbmTile[i] = NULL;
+    }
   }
-  SelectObject(og.hdcBlack, og.hbmBlack);
+  ZeroMemory(&og.fb, sizeof(og.fb));
+}
 
-  // font
-  LOGFONTW lf = {0};
-  lf.lfHeight = -14;
-  lf.lfQuality = CLEARTYPE_QUALITY;
-  wcscpy_s(lf.lfFaceName, LF_FACESIZE, L"Segoe UI");
-  og.hFontSmall = CreateFontIndirectW(&lf);
+// Grabs each monitor on its own thread; gaps in the virtual desktop's
+// bounding box are never allocated or blitted. The tile DIBs (and dimmed
+// copies) of the previous activation are reused if the layout is the same.
+static BOOL Overlay_GrabDesktop(BOOL *reused) {
+  MONITOR_LIST ml = {0};
+  EnumDisplayMonitors(NULL, NULL, Overlay_AddMonitor, (LPARAM)&ml);
+  FRAMEBUFFER fb;
+  if (!Framebuffer_Layout(&fb, ml.rects, ml.n))
+    return FALSE;
+  *reused = og.hbmTile[0] && Framebuffer_SameLayout(&og.fb, &fb);
+  if (!*reused) {
+    Overlay_ReleaseTiles();
+    og.fb = fb;
+    for (int i = 0; i < og.fb.ntiles; i++) {
+      FB_TILE *t = &og.fb.tiles[i];
+      og.hbmTile[i] = CreateDIB32(NULL, t->area.right - t->area.left,
+                                  t->area.bottom - t->area.top, &t->capture);
+      if (!og.hbmTile[i])
+        return FALSE;
+    }
+  }
+  og.virt = FromIRect(&og.fb.virt);
+  long long t0 = Clock_Ns();
+  BOOL ok = Framebuffer_Capture(&og.fb, Overlay_GrabTile, NULL);
+  og.captureNs = Clock_Ns() - t0;
+  return ok;
+}
 
-  // pens/brush and blend
-  og.hPenHandle = CreatePen(PS_SOLID, HANDLE_BORDER_WIDTH, RGB(255, 255, 255));
-  LOGBRUSH lb = {BS_SOLID, RGB(255, 255, 255), 0};
-  og.hPenDotted =
-      ExtCreatePen(PS_GEOMETRIC | PS_DOT | PS_ENDCAP_FLAT | PS_JOIN_MITER,
-                   BORDER_WIDTH, &lb, 0, NULL);
-  og.hBrushBlack = CreateSolidBrush(RGB(0, 0, 0));
+static BOOL Overlay_CaptureVirtual(BOOL *reused) {
+  if (!Overlay_GrabDesktop(reused))
+    return FALSE;
 
-  og.blendFn.BlendOp = AC_SRC_OVER;
-  og.blendFn.BlendFlags = 0;
-  og.blendFn.SourceConstantAlpha = OVERLAY_ALPHA;
-  og.blendFn.AlphaFormat = 0;
+  // Darken once, off the UI thread: the window shows the frozen capture at
+  // once and the dimmed bands replace it as they finish. Past the memory
+  // budget the tiles are packed instead.
+  Framebuffer_PrepareAsync(&og.fb, OVERLAY_ALPHA, Overlay_DimNotify, og.hwnd);
+  og.snapDist = Edges_SnapDistance();
+  if (og.snapDist)
+    Edges_BuildAsync(&og.edges, &og.fb);
+  Mip_BuildAsync(&og.mip, &og.fb);
+  og.cur ^= 1;
+  Diff_KeepAsync(&og.keep[og.cur], &og.fb);
+  Overlay_ListWindows();
+  return TRUE;
+}
 
-  return (og.hPenHandle && og.hPenDotted && og.hBrushBlack);
+// Background preparation finished; a packed framebuffer no longer reads
+// the capture DIBs.
+static void Overlay_FinishCapture(HWND hwnd) {
+  Framebuffer_Finish(&og.fb);
+  if (!og.fb.store)
+    return;
+  Edges_Wait(&og.edges);
+  Mip_Wait(&og.mip);
+  Diff_KeepWait(&og.keep[og.cur]);
+  for (int i = 0; i < og.fb.ntiles; i++) {
+    DeleteObject(og.hbmTile[i]);
+    og.hbmTile[i] = NULL;
+    ZeroMemory(&og.fb.tiles[i].capture, sizeof(IMAGE));
+  }
+  InvalidateRect(hwnd, NULL, FALSE);
 }
 
 static void Overlay_CleanupGDI(void) {
-  if (og.hdcCapture) {
-    DeleteDC(og.hdcCapture);
-    og.hdcCapture = NULL;
-  }
-  if (og.hbmCapture) {
-    DeleteObject(og.hbmCapture);
-    og.hbmCapture = NULL;
-  }
-  if (og.hdcBlack) {
-    DeleteDC(og.hdcBlack);
-    og.hdcBlack = NULL;
-  }
-  if (og.hbmBlack) {
-    DeleteObject(og.hbmBlack);
-    og.hbmBlack = NULL;
-  }
-  if (og.hFontSmall) {
-    DeleteObject(og.hFontSmall);
-    og.hFontSmall = NULL;
-  }
-  if (og.hPenHandle) {
-    DeleteObject(og.hPenHandle);
-    og.hPenHandle = NULL;
-  }
-  if (og.hPenDotted) {
-    DeleteObject(og.hPenDotted);
-    og.hPenDotted = NULL;
-  }
-  if (og.hBrushBlack) {
-    DeleteObject(og.hBrushBlack);
-    og.hBrushBlack = NULL;
-  }
+  Overlay_ReleaseTiles();
   Overlay_DeleteBackBuffer();
 }
 
@@ -312,194 +510,609 @@ static HANDLE_ID SwapV(HANDLE_ID h) {
   }
 }
 
-// --- Drawing helpers ---
-static void DrawHandles(HDC hdc, const RECT *r) {
-  POINT c[8];
-  GetHandleCenters(r, c);
-  HGDIOBJ oldPen = SelectObject(hdc, og.hPenHandle);
-  HGDIOBJ oldBr = SelectObject(hdc, og.hBrushBlack);
-  for (int i = 0; i < 8; i++) {
-    RECT hr = HR(c[i]);
-    Rectangle(hdc, hr.left, hr.top, hr.right, hr.bottom);
+// Repaint only what the renderer drew for the old and the new selection.
+static void InvalidateSelChange(HWND hwnd, RECT oldSel, RECT newSel) {
+  IRECT client = {0, 0, og.virt.right - og.virt.left,
+                  og.virt.bottom - og.virt.top};
+  IRECT o = ToIRect(&oldSel), n = ToIRect(&newSel);
+  IRECT a = Render_SelBounds(&o, &client), b = Render_SelBounds(&n, &client);
+  IRECT u;
+  IRect_Union(&a, &b, &u);
+  RECT r = FromIRect(&u);
+  InvalidateRect(hwnd, &r, FALSE);
+}
+
+// Highlights window `hover` of og.pick (-1 for none) while nothing is
+// selected.
+static void Overlay_Hover(HWND hwnd, int hover) {
+  if (hover == og.hover)
+    return;
+  IRECT client = {0, 0, RectW(&og.virt), RectH(&og.virt)};
+  for (int i = 0; i < 2; i++) {
+    int h = i ? hover : og.hover;
+    if (h < 0)
+      continue;
+    IRECT b = Render_SelBounds(&og.pick.rects[h], &client);
+    RECT r = FromIRect(&b);
+    InvalidateRect(hwnd, &r, FALSE);
   }
-  SelectObject(hdc, oldBr);
-  SelectObject(hdc, oldPen);
+  og.hover = hover;
 }
 
-static RECT LabelBox(const RECT *sel, const RECT *client, HDC hdc) {
-  RECT s = *sel;
-  NormalizeRect_(&s);
-  int w = RectW(&s), h = RectH(&s);
-  wchar_t buf[64];
-  swprintf(buf, 64, L"%dx%d", w, h);
-
-  HFONT oldF = NULL;
-  if (og.hFontSmall)
-    oldF = (HFONT)SelectObject(hdc, og.hFontSmall);
-  SIZE sz;
-  GetTextExtentPoint32W(hdc, buf, (int)wcslen(buf), &sz);
-  const int padX = 6, padY = 3, outside = HANDLE_SIZE + 6, inside = 6;
-  int boxW = sz.cx + padX * 2, boxH = sz.cy + padY * 2;
-
-  RECT box;
-  box.right = s.left - outside;
-  box.left = box.right - boxW;
-  box.top = s.top;
-  box.bottom = box.top + boxH;
-  if (box.left >= client->left) {
-    if (oldF)
-      SelectObject(hdc, oldF);
-    return box;
-  }
-
-  box.left = s.left;
-  box.right = box.left + boxW;
-  box.bottom = s.top - outside;
-  box.top = box.bottom - boxH;
-  if (box.top >= client->top) {
-    if (oldF)
-      SelectObject(hdc, oldF);
-    return box;
-  }
-
-  box.left = s.left + inside;
-  box.top = s.top + inside;
-  box.right = box.left + boxW;
-  box.bottom = box.top + boxH;
-  if (box.left < client->left) {
-    int dx = client->left - box.left;
-    box.left += dx;
-    box.right += dx;
-  }
-  if (box.top < client->top) {
-    int dy = client->top - box.top;
-    box.top += dy;
-    box.bottom += dy;
-  }
-  if (box.right > client->right) {
-    int dx = box.right - client->right;
-    box.left -= dx;
-    box.right -= dx;
-  }
-  if (box.bottom > client->bottom) {
-    int dy = box.bottom - client->bottom;
-    box.top -= dy;
-    box.bottom -= dy;
-  }
-  if (oldF)
-    SelectObject(hdc, oldF);
-  return box;
-}
-
-static RECT InflateForUI(RECT r) {
-  InflateRect(&r, 40, 40);
-  return r;
-}
-
-static RECT ExactLabelRect(HWND hwnd, const RECT *sel, const RECT *client) {
-  HDC hdc = og.hdcBack;
-  BOOL temp = FALSE;
-  if (!hdc) {
-    hdc = GetDC(hwnd);
-    temp = TRUE;
-  }
-  RECT box = LabelBox(sel, client, hdc);
-  if (temp)
-    ReleaseDC(hwnd, hdc);
-  return box;
+// --- Loupe & overview ---
+
+static void Overlay_InvalidateLoupe(HWND hwnd) {
+  if (!og.loupe)
+    return;
+  IRECT client = {0, 0, RectW(&og.virt), RectH(&og.virt)};
+  IRECT b = Render_LoupeBox(og.pointer.x, og.pointer.y, og.zoom, &client);
+  RECT r = FromIRect(&b);
+  InvalidateRect(hwnd, &r, FALSE);
 }
 
-static void InvalidateSelChange(HWND hwnd, RECT oldSel, RECT newSel) {
-  NormalizeRect_(&oldSel);
-  NormalizeRect_(&newSel);
-  RECT client = {0, 0, og.virt.right - og.virt.left,
-                 og.virt.bottom - og.virt.top};
-  RECT a = InflateForUI(oldSel), b = InflateForUI(newSel);
-  RECT la = ExactLabelRect(hwnd, &oldSel, &client),
-       lb = ExactLabelRect(hwnd, &newSel, &client);
-  RECT u;
-  u.left = MIN(MIN(a.left, b.left), MIN(la.left, lb.left));
-  u.top = MIN(MIN(a.top, b.top), MIN(la.top, lb.top));
-  u.right = MAX(MAX(a.right, b.right), MAX(la.right, lb.right));
-  u.bottom = MAX(MAX(a.bottom, b.bottom), MAX(la.bottom, lb.bottom));
-  InvalidateRect(hwnd, &u, FALSE);
-}
-
-static void DrawDimsLabel(HDC hdc, const RECT *sel, const RECT *client) {
-  RECT s = *sel;
-  NormalizeRect_(&s);
-  int w = RectW(&s), h = RectH(&s);
-  wchar_t buf[64];
-  swprintf(buf, 64, L"%dx%d", w, h);
-  HFONT oldF = NULL;
-  if (og.hFontSmall)
-    oldF = (HFONT)SelectObject(hdc, og.hFontSmall);
-
-  SIZE sz;
-  GetTextExtentPoint32W(hdc, buf, (int)wcslen(buf), &sz);
-  const int padX = 6, padY = 3;
-  RECT box = LabelBox(sel, client, hdc);
-
-  FillRect(hdc, &box, og.hBrushBlack);
-  SetBkMode(hdc, TRANSPARENT);
-  SetTextColor(hdc, RGB(240, 240, 240));
-  RECT txt = {box.left + padX, box.top + padY, box.right - padX,
-              box.bottom - padY};
-  DrawTextW(hdc, buf, -1, &txt,
-            DT_LEFT | DT_VCENTER | DT_SINGLELINE | DT_NOPREFIX);
-
-  if (oldF)
-    SelectObject(hdc, oldF);
-}
-
-static void PaintOverlay(HWND hwnd, HDC hdc) {
+static void Overlay_MoveLoupe(HWND hwnd, POINT p) {
+  if (p.x == og.pointer.x && p.y == og.pointer.y)
+    return;
+  Overlay_InvalidateLoupe(hwnd);
+  og.pointer = p;
+  Overlay_InvalidateLoupe(hwnd);
+}
+
+static void Overlay_SetZoom(HWND hwnd, int zoom) {
+  Overlay_InvalidateLoupe(hwnd);
+  og.zoom = MAX(RENDER_ZOOM_MIN, MIN(zoom, RENDER_ZOOM_MAX));
+  Overlay_InvalidateLoupe(hwnd);
+}
+
+// The overview shows up over the monitor under the cursor and hides the
+// selection decorations while it is up.
+static void Overlay_ToggleOverview(HWND hwnd) {
+  IRECT client = {0, 0, RectW(&og.virt), RectH(&og.virt)};
+  if (!og.overview) {
+    IRECT area = client;
+    for (int i = 0; i < og.fb.ntiles; i++) {
+      RECT t = FromIRect(&og.fb.tiles[i].area);
+      if (PtInRect(&t, og.pointer))
+        area = og.fb.tiles[i].area;
+    }
+    Mip_Wait(&og.mip);
+    og.overviewBox = Render_OverviewBox(&og.fb, &area);
+  }
+  Overlay_Hover(hwnd, -1);
+  og.overview = !og.overview;
+  RECT r = FromIRect(&og.overviewBox);
+  InflateRect(&r, 1, 1);
+  InvalidateRect(hwnd, &r, FALSE);
+  if (og.haveSel) {
+    IRECT s = ToIRect(&og.sel);
+    IRECT b = Render_SelBounds(&s, &client);
+    r = FromIRect(&b);
+    InvalidateRect(hwnd, &r, FALSE);
+  }
+  Overlay_InvalidateLoupe(hwnd);
+}
+
+// Compares with the previous session's frame on first use, once this
+// session's copy is done.
+static void Overlay_ToggleDiff(HWND hwnd) {
+  const DIFF_KEEP *prev = &og.keep[og.cur ^ 1], *now = &og.keep[og.cur];
+  if (!og.diffDone) {
+    Diff_KeepWait(&og.keep[og.cur]);
+    if (!prev->img.px || !now->img.px) {
+      OutputDebugStringA("screenshot: no previous capture to compare\n");
+      return;
+    }
+    if (!Diff_Compare(&og.diff, &prev->img, &now->img, 0))
+      return;
+    og.diffDone = TRUE;
+    char buf[256];
+    const DIFF_STATS *ds = &og.diff.stats;
+    snprintf(buf, sizeof(buf),
+             "screenshot: diff with the previous capture: %d regions, %llu "
+             "px changed, %d/%d tiles identical, compare %.2f ms, merge "
+             "%.3f ms\n",
+             og.diff.n, ds->pixels, ds->identical, ds->tiles,
+             ds->compareNs / 1e6, ds->mergeNs / 1e6);
+    OutputDebugStringA(buf);
+  }
+  og.diffShown = !og.diffShown;
+  InvalidateRect(hwnd, NULL, FALSE);
+}
+
+static void PaintOverlay(HWND hwnd, const RECT *dirty) {
   RECT rc;
   GetClientRect(hwnd, &rc);
-  int W = rc.right, H = rc.bottom;
-  BitBlt(hdc, 0, 0, W, H, og.hdcCapture, 0, 0, SRCCOPY);
-  AlphaBlend(hdc, 0, 0, W, H, og.hdcBlack, 0, 0, 1, 1, og.blendFn);
+  RENDER_SCENE sc = {0};
+  sc.fb = &og.fb;
+  sc.haveSel = og.haveSel;
+  sc.sel = ToIRect(&og.sel);
+  if (!og.haveSel && og.hover >= 0) {
+    sc.haveSel = sc.hover = 1;
+    sc.sel = og.pick.rects[og.hover];
+  }
+  sc.client = ToIRect(&rc);
+  sc.redact = &og.redact;
+  sc.annot = &og.annot;
+  sc.diff = og.diffShown ? &og.diff : NULL;
+  sc.loupe = og.loupe;
+  sc.zoom = og.zoom;
+  sc.cursorX = sc.srcX = og.pointer.x;
+  sc.cursorY = sc.srcY = og.pointer.y;
+  sc.overview = og.overview;
+  sc.overviewBox = og.overviewBox;
+  sc.mip = &og.mip;
+  RECT ob = FromIRect(&og.overviewBox);
+  if (og.overview && PtInRect(&ob, og.pointer))
+    Render_OverviewToFrame(&og.overviewBox, &og.fb, &sc.srcX, &sc.srcY);
+  IRECT d = ToIRect(dirty);
+  og.paintPixels = Render_Frame(&sc, &og.back, &d, 1);
+  og.paintPixelsTotal += og.paintPixels;
+  og.paints++;
+}
 
-  if (og.haveSel) {
-    RECT s = og.sel;
-    NormalizeRect_(&s);
-    BitBlt(hdc, s.left, s.top, RectW(&s), RectH(&s), og.hdcCapture, s.left,
-           s.top, SRCCOPY);
-    HGDIOBJ oldPen = SelectObject(hdc, og.hPenDotted);
-    HGDIOBJ oldBr = SelectObject(hdc, GetStockObject(HOLLOW_BRUSH));
-    Rectangle(hdc, s.left, s.top, s.right, s.bottom);
-    SelectObject(hdc, oldBr);
-    SelectObject(hdc, oldPen);
-    DrawHandles(hdc, &s);
-    DrawDimsLabel(hdc, &s, &rc);
+static void Overlay_LogStats(void) {
+  char buf[512];
+  const FRAME_CLOCK *fc = &og.clock;
+  long long avg = fc->presents ? fc->latencySum / (long long)fc->presents : 0;
+  snprintf(buf, sizeof(buf),
+           "screenshot: capture %.2f ms (%d monitor(s), %.1f of %.1f MP "
+           "stored), %u paints, %llu px composited, last %llu px; "
+           "%llu drag events -> %llu updates, input-to-photon avg %.2f ms "
+           "max %.2f ms\n",
+           og.captureNs / 1e6, og.fb.ntiles, Framebuffer_Bytes(&og.fb) / 4e6,
+           (double)og.fb.w * og.fb.h / 1e6, og.paints,
+           (unsigned long long)og.paintPixelsTotal,
+           (unsigned long long)og.paintPixels, fc->events, fc->updates,
+           avg / 1e6, fc->latencyMax / 1e6);
+  OutputDebugStringA(buf);
+  const FB_PACK_STATS *ps = Framebuffer_PackStats(&og.fb);
+  if (ps) {
+    snprintf(buf, sizeof(buf),
+             "screenshot: packed %.1f MB -> %.1f MB in %.2f ms, cache %.1f "
+             "MB, %llu block faults avg %.3f ms, longest stall %.2f ms\n",
+             ps->rawBytes / 1e6, ps->packedBytes / 1e6, ps->packNs / 1e6,
+             ps->cacheBytes / 1e6, ps->faults,
+             ps->faults ? ps->faultNs / 1e6 / (double)ps->faults : 0.0,
+             ps->faultMaxNs / 1e6);
+    OutputDebugStringA(buf);
+  }
+  const POOL_STATS *pl = &g_pool;
+  long long missAvg = pl->misses ? pl->missNs / (long long)pl->misses : 0;
+  snprintf(buf, sizeof(buf),
+           "screenshot: pool %s (%u hits, %u misses), setup %.2f ms, saved "
+           "%.2f ms\n",
+           pl->lastHit ? "hit" : "miss", pl->hits, pl->misses,
+           pl->setupNs / 1e6,
+           pl->lastHit && missAvg > pl->setupNs
+               ? (missAvg - pl->setupNs) / 1e6
+               : 0.0);
+  OutputDebugStringA(buf);
+  if (og.annot.stats.edits) {
+    const ANNOT_STATS *as = &og.annot.stats;
+    snprintf(buf, sizeof(buf),
+             "screenshot: annotations %d, %llu edits, %llu tiles drawn in "
+             "%.2f ms, tile cache %.1f MB\n",
+             og.annot.n, as->edits, as->tilesDrawn, as->drawNs / 1e6,
+             as->cacheBytes / 1e6);
+    OutputDebugStringA(buf);
   }
+  if (og.redact.stats.updates) {
+    const REDACT_STATS *rs = &og.redact.stats;
+    snprintf(buf, sizeof(buf),
+             "screenshot: redaction %d regions, %llu updates (last %.2f ms, "
+             "max %.2f ms), %.1f Mpx filtered\n",
+             og.redact.n, rs->updates, rs->lastNs / 1e6, rs->maxNs / 1e6,
+             rs->pixels / 1e6);
+    OutputDebugStringA(buf);
+  }
+  Diff_KeepWait(&og.keep[og.cur]);
+  if (og.keep[og.cur].img.px) {
+    snprintf(buf, sizeof(buf),
+             "screenshot: frame kept for the next diff in %.2f ms\n",
+             og.keep[og.cur].copyNs / 1e6);
+    OutputDebugStringA(buf);
+  }
+  if (Mip_Ready(&og.mip)) {
+    snprintf(buf, sizeof(buf),
+             "screenshot: mip pyramid %.2f ms, %d levels from 1/%d, %.1f "
+             "MB\n",
+             og.mip.stats.buildNs / 1e6, og.mip.n, 1 << og.mip.first,
+             og.mip.stats.bytes / 1e6);
+    OutputDebugStringA(buf);
+  }
+  if (og.snapDist) {
+    Edges_Wait(&og.edges);
+    const EDGE_STATS *es = &og.edges.stats;
+    snprintf(buf, sizeof(buf),
+             "screenshot: edge index %.2f ms (gradient %.2f, runs %.2f, "
+             "tables %.2f), %llu vertical / %llu horizontal edge px%s\n",
+             es->totalNs / 1e6, es->gradientNs / 1e6, es->runsNs / 1e6,
+             es->tablesNs / 1e6, (unsigned long long)es->vertical,
+             (unsigned long long)es->horizontal,
+             es->dropped ? ", an axis dropped" : "");
+    OutputDebugStringA(buf);
+  }
+  snprintf(buf, sizeof(buf),
+           "screenshot: window pick %d windows listed in %.2f ms, indexed "
+           "in %.3f ms (%llu cell entries, longest %d)\n",
+           og.pickWindows, og.pickListNs / 1e6, og.pick.stats.buildNs / 1e6,
+           (unsigned long long)og.pick.stats.entries, og.pick.stats.longest);
+  OutputDebugStringA(buf);
+  snprintf(buf, sizeof(buf), "screenshot: peak working set %.1f MB\n",
+           Mem_PeakRss() / 1e6);
+  OutputDebugStringA(buf);
 }
 
-static BOOL CopySelectionToClipboard(HWND hwnd) {
+// The selection as a crop the export queue can own.
+static EXPORT_IMAGE *Overlay_CropSelection(void) {
   if (!og.haveSel)
-    return FALSE;
+    return NULL;
   RECT s = og.sel;
   NormalizeRect_(&s);
-  int w = RectW(&s), h = RectH(&s);
-  if (w <= 0 || h <= 0)
+  if (RectW(&s) <= 0 || RectH(&s) <= 0)
+    return NULL;
+  IRECT ir = ToIRect(&s);
+  IMAGE crop;
+  if (!Framebuffer_Crop(&og.fb, &ir, &crop))
+    return NULL;
+  // every export goes through here: redacted pixels never leave raw, and
+  // the annotations are drawn in once
+  IRECT c = {0, 0, og.fb.w, og.fb.h};
+  IRect_Intersect(&ir, &c, &c);
+  Redact_Apply(&og.redact, &crop, c.left, c.top, &c);
+  Annot_Flatten(&og.annot, &crop, c.left, c.top, &c);
+  EXPORT_IMAGE *ei = ExportImage_Wrap(&crop);
+  if (!ei)
+    Image_Free(&crop);
+  return ei;
+}
+
+// Export worker stage: packs the crop as a bottom-up 24-bpp CF_DIB (32-bpp
+// DIBs get their zero alpha honored by some apps) and hands it to the
+// controller window, which owns the clipboard.
+static int PublishClipboard(EXPORT_JOB *job) {
+  const IMAGE *img = &job->image->img;
+  size_t row = ((size_t)img->w * 3 + 3) & ~(size_t)3;
+  HGLOBAL h = GlobalAlloc(GMEM_MOVEABLE,
+                          sizeof(BITMAPINFOHEADER) + row * (size_t)img->h);
+  if (!h)
+    return 0;
+  BITMAPINFOHEADER *bh = (BITMAPINFOHEADER *)GlobalLock(h);
+  ZeroMemory(bh, sizeof(*bh));
+  bh->biSize = sizeof(BITMAPINFOHEADER);
+  bh->biWidth = img->w;
+  bh->biHeight = img->h;
+  bh->biPlanes = 1;
+  bh->biBitCount = 24;
+  bh->biCompression = BI_RGB;
+  BYTE *bits = (BYTE *)(bh + 1);
+  for (int y = 0; y < img->h; y++) {
+    const BYTE *s = IMAGE_ROW(img, y);
+    BYTE *d = bits + row * (size_t)(img->h - 1 - y);
+    for (int x = 0; x < img->w; x++, s += 4, d += 3) {
+      d[0] = s[0];
+      d[1] = s[1];
+      d[2] = s[2];
+    }
+  }
+  GlobalUnlock(h);
+  if (!PostMessageW(g_hwndCtl, WM_EXPORT_CLIPBOARD, 0, (LPARAM)h)) {
+    GlobalFree(h);
+    return 0;
+  }
+  return 1;
+}
+
+static void Clipboard_Publish(HWND hwnd, HGLOBAL h) {
+  if (!OpenClipboard(hwnd)) {
+    GlobalFree(h);
+    return;
+  }
+  EmptyClipboard();
+  if (!SetClipboardData(CF_DIB, h))
+    GlobalFree(h);
+  CloseClipboard();
+}
+
+// --- Capture history ---
+// Every copied or saved crop is also added to the history store, as one
+// more job on the export worker; the store is opened there on first use
+// and never touched from anywhere else.
+
+static HISTORY g_history;
+static volatile long g_historyState; // 0 not opened yet, 1 open, -1 off
+
+// Runs on the export worker.
+static void ArchiveDone(EXPORT_JOB *job, int ok) {
+  char buf[512];
+  (void)ok;
+  if (Atomic_Load(&g_historyState) == 0) {
+    char dir[HISTORY_PATH_MAX];
+    int on = History_Dir(dir, sizeof(dir)), opened = 0;
+    if (on && !(opened = History_Open(&g_history, dir, 1))) {
+      snprintf(buf, sizeof(buf), "screenshot: cannot open history in %s\n",
+               dir);
+      OutputDebugStringA(buf);
+    }
+    Atomic_Store(&g_historyState, opened ? 1 : -1);
+  }
+  if (Atomic_Load(&g_historyState) < 0)
+    return;
+  HISTORY_STATS before = g_history.stats;
+  int id = History_Add(&g_history, &job->image->img, (int64_t)time(NULL));
+  if (id < 0) {
+    snprintf(buf, sizeof(buf), "screenshot: cannot add to history in %s\n",
+             g_history.dir);
+  } else {
+    char desc[256];
+    History_Describe(&g_history, &before, desc, sizeof(desc));
+    snprintf(buf, sizeof(buf), "screenshot: history #%d, %s\n", id, desc);
+  }
+  OutputDebugStringA(buf);
+}
+
+// Queues ei (whose reference it takes) for the history.
+static void ArchiveCapture(EXPORT_IMAGE *ei) {
+  if (Atomic_Load(&g_historyState) < 0) {
+    ExportImage_Release(ei);
+    return;
+  }
+  EXPORT_JOB job = {0};
+  job.image = ei;
+  job.done = ArchiveDone;
+  Export_Submit(&job);
+}
+
+static BOOL CopySelectionToClipboard(void) {
+  EXPORT_JOB job = {0};
+  if (!(job.image = Overlay_CropSelection()))
     return FALSE;
-  HDC hdc = GetDC(hwnd);
-  HDC mem = CreateCompatibleDC(hdc);
-  HBITMAP bmp = CreateCompatibleBitmap(hdc, w, h);
-  HGDIOBJ old = SelectObject(mem, bmp);
-  BitBlt(mem, 0, 0, w, h, og.hdcCapture, s.left, s.top, SRCCOPY);
+  job.publish = PublishClipboard;
+  ExportImage_Retain(job.image);
+  Export_Submit(&job);
+  ArchiveCapture(job.image);
+  return TRUE;
+}
+
+// <My Pictures>\<prefix>-YYYYMMDD-HHMMSS.<ext>
+static BOOL SavePath(wchar_t *path, size_t n, const wchar_t *prefix,
+                     const char *ext) {
+  wchar_t dir[MAX_PATH], wext[8];
+  if (FAILED(SHGetFolderPathW(NULL, CSIDL_MYPICTURES, NULL, 0, dir)))
+    return FALSE;
+  size_t i = 0;
+  for (; ext[i] && i < 7; i++)
+    wext[i] = (wchar_t)ext[i];
+  wext[i] = 0;
+  SYSTEMTIME t;
+  GetLocalTime(&t);
+  swprintf(path, n, L"%ls\\%ls-%04u%02u%02u-%02u%02u%02u.%ls", dir, prefix,
+           t.wYear, t.wMonth, t.wDay, t.wHour, t.wMinute, t.wSecond, wext);
+  return TRUE;
+}
+
+// Runs on the export worker.
+static void SaveDone(EXPORT_JOB *job, int ok) {
+  wchar_t *path = (wchar_t *)job->ctx;
+  if (!ok) {
+    _wremove(path);
+  } else {
+    char desc[256], buf[320];
+    Export_Describe(&job->stats, desc, sizeof(desc));
+    snprintf(buf, sizeof(buf), "screenshot: saved (%s, queued %.2f ms)\n",
+             desc, (job->startNs - job->submitNs) / 1e6);
+    OutputDebugStringA(buf);
+  }
+  free(path);
+}
+
+static void LogExportQueue(void) {
+  EXPORT_QUEUE_STATS q;
+  Export_QueueStats(&q);
+  if (!q.completed)
+    return;
+  char buf[320];
+  snprintf(buf, sizeof(buf),
+           "screenshot: export queue %llu jobs, %llu stalls; wait p50 %.2f "
+           "p99 %.2f max %.2f ms, done p50 %.2f p99 %.2f max %.2f ms\n",
+           q.completed, q.stalls, q.waitP50 / 1e6, q.waitP99 / 1e6,
+           q.waitMax / 1e6, q.doneP50 / 1e6, q.doneP99 / 1e6,
+           q.doneMax / 1e6);
+  OutputDebugStringA(buf);
+}
+
+// Opens the file and queues the write of ei (whose reference it takes); the
+// overlay can close right away.
+static BOOL SaveImageToFile(EXPORT_IMAGE *ei, const wchar_t *prefix) {
+  EXPORT_JOB job = {0};
+  job.format = Export_Format();
+  wchar_t path[MAX_PATH + 64];
+  if (!(job.image = ei))
+    return FALSE;
+  if (!SavePath(path, sizeof(path) / sizeof(path[0]), prefix,
+                Export_Extension(job.format))) {
+    ExportImage_Release(ei);
+    return FALSE;
+  }
+  job.file = _wfopen(path, L"wb");
+  job.ctx = _wcsdup(path);
+  if (!job.file || !job.ctx) {
+    if (job.file)
+      fclose(job.file);
+    free(job.ctx);
+    ExportImage_Release(job.image);
+    return FALSE;
+  }
+  job.done = SaveDone;
+  ExportImage_Retain(ei);
+  Export_Submit(&job);
+  ArchiveCapture(ei);
+  return TRUE;
+}
+
+static BOOL SaveSelectionToFile(void) {
+  return SaveImageToFile(Overlay_CropSelection(), L"screenshot");
+}
+
+// Copies the w x h screen area at (x, y) into dib, with its own DCs like
+// Overlay_GrabTile so it can run on any thread.
+static BOOL Screen_Blit(HBITMAP dib, int x, int y, int w, int h) {
+  HDC s = GetDC(NULL);
+  if (!s)
+    return FALSE;
+  HDC mem = CreateCompatibleDC(s);
+  if (!mem) {
+    ReleaseDC(NULL, s);
+    return FALSE;
+  }
+  HGDIOBJ old = SelectObject(mem, dib);
+  BOOL ok = BitBlt(mem, 0, 0, w, h, s, x, y, SRCCOPY | CAPTUREBLT);
+  GdiFlush();
   SelectObject(mem, old);
   DeleteDC(mem);
-  ReleaseDC(hwnd, hdc);
-  if (!OpenClipboard(hwnd)) {
-    DeleteObject(bmp);
+  ReleaseDC(NULL, s);
+  return ok;
+}
+
+// Runs on the recorder's capture thread.
+static int Recording_Grab(void *ctx, IMAGE *dst) {
+  (void)ctx;
+  if (!Screen_Blit(g_rec.dib, g_rec.x, g_rec.y, dst->w, dst->h))
+    return 0;
+  for (int y = 0; y < dst->h; y++)
+    CopyMemory(IMAGE_ROW(dst, y), IMAGE_ROW(&g_rec.pixels, y),
+           (size_t)dst->w * 4);
+  return 1;
+}
+
+// The selection clipped to the overlay, in overlay coordinates.
+static BOOL Overlay_ClippedSelection(RECT *s) {
+  RECT client = {0, 0, RectW(&og.virt), RectH(&og.virt)};
+  *s = og.sel;
+  NormalizeRect_(s);
+  return og.haveSel && IntersectRect(s, s, &client);
+}
+
+// Records the selection, clipped to the virtual screen, until
+// Recording_Stop. The overlay must be hidden first.
+static BOOL Recording_Start(void) {
+  RECT s;
+  if (g_rec.rec || !Overlay_ClippedSelection(&s))
+    return FALSE;
+  RECORD_FORMAT fmt = Record_Format();
+  if (!SavePath(g_rec.path, sizeof(g_rec.path) / sizeof(g_rec.path[0]),
+                L"recording", Record_Extension(fmt)))
     return FALSE;
+  HDC screen = GetDC(NULL);
+  g_rec.dib = screen ? CreateDIB32(screen, RectW(&s), RectH(&s), &g_rec.pixels)
+                     : NULL;
+  if (screen)
+    ReleaseDC(NULL, screen);
+  g_rec.x = og.virt.left + s.left;
+  g_rec.y = og.virt.top + s.top;
+  g_rec.f = g_rec.dib ? _wfopen(g_rec.path, L"wb") : NULL;
+  RECORD_CONFIG cfg = {fmt, RectW(&s), RectH(&s), Record_Fps(), 0,
+                       Recording_Grab, NULL};
+  if (g_rec.f && (g_rec.rec = Record_Start(g_rec.f, &cfg)) != NULL) {
+    // polls for a failed write
+    SetTimer(g_hwndCtl, RECORD_TIMER_ID, 100, NULL);
+    return TRUE;
   }
-  EmptyClipboard();
-  SetClipboardData(CF_BITMAP, bmp);
-  CloseClipboard();
+  if (g_rec.f) {
+    fclose(g_rec.f);
+    _wremove(g_rec.path);
+  }
+  if (g_rec.dib)
+    DeleteObject(g_rec.dib);
+  g_rec.f = NULL;
+  g_rec.dib = NULL;
+  return FALSE;
+}
+
+static void Recording_Stop(void) {
+  if (!g_rec.rec)
+    return;
+  KillTimer(g_hwndCtl, RECORD_TIMER_ID);
+  RECORD_STATS st;
+  int ok = Record_Stop(g_rec.rec, &st);
+  if (fclose(g_rec.f) != 0)
+    ok = 0;
+  if (!ok)
+    _wremove(g_rec.path);
+  DeleteObject(g_rec.dib);
+  char desc[512], buf[600];
+  Record_Describe(&st, desc, sizeof(desc));
+  snprintf(buf, sizeof(buf), "screenshot: recording %s (%.1f MB): %s\n",
+           ok ? "saved" : "failed", st.fileBytes / 1e6, desc);
+  OutputDebugStringA(buf);
+  g_rec.rec = NULL;
+  g_rec.f = NULL;
+  g_rec.dib = NULL;
+}
+
+// Grabs the first frame of a scrolling capture; the overlay must be hidden.
+static BOOL Scroll_Start(void) {
+  RECT s;
+  if (g_scroll.active || !Overlay_ClippedSelection(&s))
+    return FALSE;
+  HDC screen = GetDC(NULL);
+  g_scroll.dib = screen ? CreateDIB32(screen, RectW(&s), RectH(&s),
+                                      &g_scroll.pixels)
+                        : NULL;
+  if (screen)
+    ReleaseDC(NULL, screen);
+  g_scroll.x = og.virt.left + s.left;
+  g_scroll.y = og.virt.top + s.top;
+  if (!g_scroll.dib ||
+      !Screen_Blit(g_scroll.dib, g_scroll.x, g_scroll.y, RectW(&s),
+                   RectH(&s)) ||
+      !Stitch_Begin(&g_scroll.st, &g_scroll.pixels)) {
+    if (g_scroll.dib)
+      DeleteObject(g_scroll.dib);
+    g_scroll.dib = NULL;
+    return FALSE;
+  }
+  g_scroll.active = TRUE;
+  SetTimer(g_hwndCtl, SCROLL_TIMER_ID, STITCH_INTERVAL_MS, NULL);
   return TRUE;
 }
 
+// Stitches the result and queues it for saving.
+static void Scroll_Finish(void) {
+  if (!g_scroll.active)
+    return;
+  KillTimer(g_hwndCtl, SCROLL_TIMER_ID);
+  g_scroll.active = FALSE;
+  DeleteObject(g_scroll.dib);
+  g_scroll.dib = NULL;
+  STITCH_STATS st = g_scroll.st.st;
+  IMAGE out;
+  if (!Stitch_Finish(&g_scroll.st, &out))
+    return;
+  char buf[320];
+  double n = st.frames > 1 ? (double)(st.frames - 1) : 1;
+  snprintf(buf, sizeof(buf),
+           "screenshot: stitched %dx%d from %llu frames (%llu unchanged, "
+           "%llu skipped), per frame hash %.2f ms, align %.2f ms, verify "
+           "%.2f ms, worst %.2f ms\n",
+           out.w, out.h, st.frames, st.unchanged, st.skipped,
+           st.hashNs / 1e6 / n, st.alignNs / 1e6 / n, st.verifyNs / 1e6 / n,
+           st.alignMaxNs / 1e6);
+  OutputDebugStringA(buf);
+  EXPORT_IMAGE *ei = ExportImage_Wrap(&out);
+  if (!ei)
+    Image_Free(&out);
+  SaveImageToFile(ei, L"scroll");
+}
+
+static void Scroll_Step(void) {
+  if (g_scroll.active &&
+      Screen_Blit(g_scroll.dib, g_scroll.x, g_scroll.y, g_scroll.pixels.w,
+                  g_scroll.pixels.h) &&
+      Stitch_Add(&g_scroll.st, &g_scroll.pixels) == STITCH_FULL)
+    Scroll_Finish();
+}
+
 // robust resize (same as before)
 static void ResizeRobust(HANDLE_ID *hIO, POINT p, RECT *anchor, RECT *outSel) {
   HANDLE_ID h = *hIO;
@@ -549,22 +1162,261 @@ static void ResizeRobust(HANDLE_ID *hIO, POINT p, RECT *anchor, RECT *outSel) {
   *hIO = h;
 }
 
+// The dragged corner pulled onto the nearest edge within reach; each axis
+// snaps on its own, the row first so a corner can land on both.
+static POINT Overlay_Snap(POINT p) {
+  if (og.noSnap || !og.snapDist)
+    return p;
+  int y = Edges_SnapY(&og.edges, p.x, p.y, og.snapDist);
+  int x = Edges_SnapX(&og.edges, p.x, y, og.snapDist);
+  if (x == p.x)
+    x = Edges_SnapX(&og.edges, p.x, p.y, og.snapDist);
+  return (POINT){x, y};
+}
+
+// Selection update for one (coalesced) drag position.
+// The region being drawn spans its start and p, inside the selection; only
+// what its move uncovers or exposes is filtered again.
+static void Overlay_RedactDrag(HWND hwnd, POINT p) {
+  int i = og.redact.n - 1;
+  RECT s = og.sel;
+  NormalizeRect_(&s);
+  IRECT sel = ToIRect(&s), r = {og.redactStart.x, og.redactStart.y, p.x, p.y};
+  IRect_Normalize(&r);
+  if (!IRect_Intersect(&r, &sel, &r))
+    r = (IRECT){0, 0, 0, 0};
+  RECT old = FromIRect(&og.redact.region[i].rect);
+  Redact_Update(&og.redact, i, &og.fb, &r);
+  RECT now = FromIRect(&og.redact.region[i].rect);
+  InvalidateRect(hwnd, &old, FALSE);
+  InvalidateRect(hwnd, &now, FALSE);
+  IRECT io = ToIRect(&old); // annotated tiles show the redaction
+  Annot_Invalidate(&og.annot, &io);
+  Annot_Invalidate(&og.annot, &og.redact.region[i].rect);
+}
+
+static void Overlay_PopRedact(HWND hwnd) {
+  IRECT ir = og.redact.region[og.redact.n - 1].rect;
+  RECT r = FromIRect(&ir);
+  Redact_Pop(&og.redact);
+  InvalidateRect(hwnd, &r, FALSE);
+  Annot_Invalidate(&og.annot, &ir);
+}
+
+// Replaces annotation i and repaints what it covered and what it covers.
+static void Overlay_SetAnnot(HWND hwnd, int i, const ANNOTATION *a) {
+  RECT old = FromIRect(&og.annot.bounds[i]);
+  Annot_Set(&og.annot, i, a);
+  RECT now = FromIRect(&og.annot.bounds[i]);
+  InvalidateRect(hwnd, &old, FALSE);
+  InvalidateRect(hwnd, &now, FALSE);
+}
+
+static void Overlay_PopAnnot(HWND hwnd) {
+  RECT r = FromIRect(&og.annot.bounds[og.annot.n - 1]);
+  Annot_Pop(&og.annot);
+  InvalidateRect(hwnd, &r, FALSE);
+}
+
+// A label left empty goes away.
+static void Overlay_EndTyping(HWND hwnd) {
+  if (og.typing < 0)
+    return;
+  if (!og.annot.item[og.typing].len && og.typing == og.annot.n - 1)
+    Overlay_PopAnnot(hwnd);
+  og.typing = -1;
+}
+
+// Appends a printable character to the label, or deletes its last one.
+static void Overlay_Type(HWND hwnd, int ch) {
+  ANNOTATION a = og.annot.item[og.typing];
+  if (ch == '\b' && a.len > 0)
+    a.len--;
+  else if (ch >= 32 && ch < 127 && a.len < ANNOT_TEXT_MAX)
+    a.text[a.len++] = (char)ch;
+  else
+    return;
+  Overlay_SetAnnot(hwnd, og.typing, &a);
+}
+
+// A new annotation of the current tool at p: shapes grow as the drag goes
+// on, a label starts taking keys.
+static void Overlay_StartAnnot(HWND hwnd, POINT p) {
+  ANNOTATION a = {0};
+  a.kind = og.tool;
+  a.x0 = a.x1 = p.x;
+  a.y0 = a.y1 = p.y;
+  a.color = og.tool == ANNOT_MARK ? ANNOT_HIGHLIGHT : ANNOT_COLOR;
+  int i = Annot_Add(&og.annot, &og.fb, &a);
+  if (i < 0)
+    return;
+  RECT r = FromIRect(&og.annot.bounds[i]);
+  InvalidateRect(hwnd, &r, FALSE);
+  if (og.tool == ANNOT_TEXT)
+    og.typing = i;
+  else
+    og.annotating = TRUE;
+}
+
+static void Overlay_AnnotDrag(HWND hwnd, POINT p) {
+  ANNOTATION a = og.annot.item[og.annot.n - 1];
+  a.x1 = p.x;
+  a.y1 = p.y;
+  Overlay_SetAnnot(hwnd, og.annot.n - 1, &a);
+}
+
+// The brush and the annotation tools take turns on a drag inside the
+// selection, so picking one drops the other.
+static void Overlay_CycleBrush(HWND hwnd) {
+  Overlay_EndTyping(hwnd);
+  og.brush = og.brush + 1 < REDACT_MODES ? og.brush + 1 : -1;
+  og.tool = -1;
+  char buf[64];
+  snprintf(buf, sizeof(buf), "screenshot: redaction brush %s\n",
+           Redact_ModeName(og.brush));
+  OutputDebugStringA(buf);
+}
+
+static void Overlay_SetTool(HWND hwnd, int tool) {
+  Overlay_EndTyping(hwnd);
+  og.tool = og.tool == tool ? -1 : tool;
+  og.brush = -1;
+  char buf[64];
+  snprintf(buf, sizeof(buf), "screenshot: annotation tool %s\n",
+           Annot_KindName(og.tool));
+  OutputDebugStringA(buf);
+}
+
+static void Overlay_ApplyDrag(HWND hwnd, POINT p) {
+  if (og.redacting) {
+    Overlay_RedactDrag(hwnd, p);
+    return;
+  }
+  if (og.annotating) {
+    Overlay_AnnotDrag(hwnd, p);
+    return;
+  }
+  if (og.selecting || og.resizing)
+    p = Overlay_Snap(p);
+  if (og.selecting) {
+    RECT old = og.sel;
+    og.dragCur = p;
+    og.sel = (RECT){og.dragStart.x, og.dragStart.y, p.x, p.y};
+    InvalidateSelChange(hwnd, old, og.sel);
+  } else if (og.resizing) {
+    RECT old = og.sel;
+    ResizeRobust(&og.activeHandle, p, &og.resizeAnchor, &og.sel);
+    // clamp to client
+    RECT client = {0, 0, og.virt.right - og.virt.left,
+                   og.virt.bottom - og.virt.top};
+    if (og.sel.left < client.left)
+      og.sel.left = client.left;
+    if (og.sel.top < client.top)
+      og.sel.top = client.top;
+    if (og.sel.right > client.right)
+      og.sel.right = client.right;
+    if (og.sel.bottom > client.bottom)
+      og.sel.bottom = client.bottom;
+    InvalidateSelChange(hwnd, old, og.sel);
+  } else if (og.moving) {
+    RECT old = og.sel;
+    RECT s = old;
+    NormalizeRect_(&s);
+    int w = RectW(&s), h = RectH(&s);
+    int nl = p.x - og.moveOffset.x, nt = p.y - og.moveOffset.y;
+    RECT client = {0, 0, og.virt.right - og.virt.left,
+                   og.virt.bottom - og.virt.top};
+    if (nl < client.left)
+      nl = client.left;
+    if (nt < client.top)
+      nt = client.top;
+    if (nl + w > client.right)
+      nl = client.right - w;
+    if (nt + h > client.bottom)
+      nt = client.bottom - h;
+    og.sel = (RECT){nl, nt, nl + w, nt + h};
+    InvalidateSelChange(hwnd, old, og.sel);
+  }
+}
+
+// Applies queued drag input if a frame is due, otherwise arms a timer for
+// the next frame boundary.
+static void Overlay_PumpFrame(HWND hwnd) {
+  long long now = Clock_Ns();
+  long long due = FrameClock_Due(&og.clock, now);
+  if (due < 0)
+    return;
+  if (due > 0) {
+    if (!og.frameTimer) {
+      SetTimer(hwnd, FRAME_TIMER_ID, (UINT)((due + 999999) / 1000000), NULL);
+      og.frameTimer = TRUE;
+    }
+    return;
+  }
+  POINTER_EVENT e;
+  if (FrameClock_Take(&og.clock, now, &e))
+    Overlay_ApplyDrag(hwnd, (POINT){e.x, e.y});
+}
+
+static int Overlay_RefreshRate(void) {
+  DEVMODEW dm = {0};
+  dm.dmSize = sizeof(dm);
+  if (EnumDisplaySettingsW(NULL, ENUM_CURRENT_SETTINGS, &dm))
+    return (int)dm.dmDisplayFrequency;
+  return 60;
+}
+
+// Resets the per-activation state; the window is still hidden.
+static void Overlay_BeginSession(HWND hwnd) {
+  RECT rc;
+  GetClientRect(hwnd, &rc);
+  Overlay_EnsureBackBuffer(hwnd, rc.right, rc.bottom);
+  og.haveSel = og.selecting = og.resizing = og.moving = og.noSnap = FALSE;
+  og.redacting = og.annotating = FALSE;
+  og.brush = og.tool = og.typing = -1;
+  og.hover = -1;
+  og.loupe = og.overview = FALSE;
+  og.diffShown = og.diffDone = FALSE;
+  if (!og.zoom)
+    og.zoom = LOUPE_ZOOM;
+  og.paints = 0;
+  og.paintPixels = og.paintPixelsTotal = 0;
+  FrameClock_Init(&og.clock, Overlay_RefreshRate());
+  og.frameTimer = FALSE;
+  og.active = TRUE;
+}
+
+// Hides the overlay and ends the session; the window, back buffer and tile
+// DIBs stay allocated for the next activation.
+static void Overlay_Close(HWND hwnd) {
+  if (!og.active)
+    return;
+  Overlay_LogStats();
+  if (og.frameTimer)
+    KillTimer(hwnd, FRAME_TIMER_ID);
+  og.frameTimer = FALSE;
+  ReleaseCapture();
+  ShowWindow(hwnd, SW_HIDE);
+  Edges_Free(&og.edges); // before the next grab overwrites the DIBs
+  Mip_Free(&og.mip);
+  Diff_KeepWait(&og.keep[og.cur]);
+  Redact_Clear(&og.redact);
+  Annot_Clear(&og.annot);
+  Pick_Free(&og.pick);
+  Framebuffer_Reset(&og.fb); // joins the dimming worker
+  MSG m;
+  while (PeekMessageW(&m, hwnd, WM_OVERLAY_DIMBAND, WM_OVERLAY_DIMBAND,
+                      PM_REMOVE))
+    ;
+  og.active = FALSE;
+}
+
 static LRESULT CALLBACK Overlay_WndProc(HWND hwnd, UINT msg, WPARAM wParam,
                                         LPARAM lParam) {
   switch (msg) {
-  case WM_CREATE: {
+  case WM_CREATE:
     og.hwnd = hwnd;
-    if (!Overlay_CaptureVirtual()) {
-      DestroyWindow(hwnd);
-      return 0;
-    }
-    RECT rc;
-    GetClientRect(hwnd, &rc);
-    Overlay_EnsureBackBuffer(hwnd, rc.right, rc.bottom);
-    SetCursor(LoadCursor(NULL, IDC_CROSS));
-    og.haveSel = og.selecting = og.resizing = og.moving = FALSE;
     return 0;
-  }
   case WM_SIZE: {
     int w = LOWORD(lParam), h = HIWORD(lParam);
     Overlay_EnsureBackBuffer(hwnd, w, h);
@@ -576,11 +1428,13 @@ static LRESULT CALLBACK Overlay_WndProc(HWND hwnd, UINT msg, WPARAM wParam,
     ScreenToClient(hwnd, &pt);
     og.lastMouse = pt;
     LPCSTR cur = IDC_CROSS;
-    if (og.haveSel && !og.selecting && !og.resizing && !og.moving) {
+    if (og.haveSel && !og.selecting && !og.resizing && !og.moving &&
+        !og.redacting && !og.annotating) {
       HANDLE_ID hh = HitTest(&og.sel, pt);
       if (hh != HT_NONE)
         cur = CursorForHandle(hh);
-      else if (PtInRect(&(RECT){MIN(og.sel.left, og.sel.right),
+      else if (og.brush < 0 && og.tool < 0 &&
+               PtInRect(&(RECT){MIN(og.sel.left, og.sel.right),
                                 MIN(og.sel.top, og.sel.bottom),
                                 MAX(og.sel.left, og.sel.right),
                                 MAX(og.sel.top, og.sel.bottom)},
@@ -593,6 +1447,20 @@ static LRESULT CALLBACK Overlay_WndProc(HWND hwnd, UINT msg, WPARAM wParam,
   case WM_LBUTTONDOWN: {
     POINT p = {GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam)};
     og.lastMouse = p;
+    Overlay_EndTyping(hwnd);
+    if (og.overview) {
+      // a click in the overview pans: the cursor jumps to that spot
+      IRECT b = og.overviewBox;
+      RECT br = FromIRect(&b);
+      Overlay_ToggleOverview(hwnd);
+      if (PtInRect(&br, p)) {
+        int x = p.x, y = p.y;
+        Render_OverviewToFrame(&b, &og.fb, &x, &y);
+        SetCursorPos(og.virt.left + x, og.virt.top + y);
+        Overlay_MoveLoupe(hwnd, (POINT){x, y});
+      }
+      return 0;
+    }
     SetCapture(hwnd);
     if (og.haveSel) {
       HANDLE_ID h = HitTest(&og.sel, p);
@@ -605,6 +1473,23 @@ static LRESULT CALLBACK Overlay_WndProc(HWND hwnd, UINT msg, WPARAM wParam,
       }
       RECT s = og.sel;
       NormalizeRect_(&s);
+      if (PtInRect(&s, p) && og.tool >= 0) {
+        og.selecting = og.resizing = og.moving = FALSE;
+        Overlay_StartAnnot(hwnd, p);
+        if (!og.annotating)
+          ReleaseCapture();
+        return 0;
+      }
+      if (PtInRect(&s, p) && og.brush >= 0) {
+        if (Redact_Add(&og.redact, og.brush) >= 0) {
+          og.redacting = TRUE;
+          og.selecting = og.resizing = og.moving = FALSE;
+          og.redactStart = p;
+        } else {
+          ReleaseCapture();
+        }
+        return 0;
+      }
       if (PtInRect(&s, p)) {
         og.moving = TRUE;
         og.selecting = og.resizing = FALSE;
@@ -613,80 +1498,131 @@ static LRESULT CALLBACK Overlay_WndProc(HWND hwnd, UINT msg, WPARAM wParam,
         return 0;
       }
     }
-    // new selection
+    // new selection; a click without a drag picks the window under it
+    Overlay_Hover(hwnd, -1);
+    RECT old = og.haveSel ? og.sel : (RECT){p.x, p.y, p.x, p.y};
     og.selecting = TRUE;
     og.resizing = og.moving = FALSE;
     og.haveSel = TRUE;
     og.dragStart = og.dragCur = p;
     og.sel = (RECT){p.x, p.y, p.x, p.y};
-    InvalidateRect(hwnd, NULL, FALSE);
+    InvalidateSelChange(hwnd, old, og.sel);
     return 0;
   }
   case WM_MOUSEMOVE: {
     POINT p = {GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam)};
     og.lastMouse = p;
-    if (og.selecting) {
-      RECT old = og.sel;
-      og.dragCur = p;
-      og.sel = (RECT){og.dragStart.x, og.dragStart.y, p.x, p.y};
-      InvalidateSelChange(hwnd, old, og.sel);
-    } else if (og.resizing) {
-      RECT old = og.sel;
-      ResizeRobust(&og.activeHandle, p, &og.resizeAnchor, &og.sel);
-      // clamp to client
-      RECT client = {0, 0, og.virt.right - og.virt.left,
-                     og.virt.bottom - og.virt.top};
-      if (og.sel.left < client.left)
-        og.sel.left = client.left;
-      if (og.sel.top < client.top)
-        og.sel.top = client.top;
-      if (og.sel.right > client.right)
-        og.sel.right = client.right;
-      if (og.sel.bottom > client.bottom)
-        og.sel.bottom = client.bottom;
-      InvalidateSelChange(hwnd, old, og.sel);
-    } else if (og.moving) {
-      RECT old = og.sel;
-      RECT s = old;
-      NormalizeRect_(&s);
-      int w = RectW(&s), h = RectH(&s);
-      int nl = p.x - og.moveOffset.x, nt = p.y - og.moveOffset.y;
-      RECT client = {0, 0, og.virt.right - og.virt.left,
-                     og.virt.bottom - og.virt.top};
-      if (nl < client.left)
-        nl = client.left;
-      if (nt < client.top)
-        nt = client.top;
-      if (nl + w > client.right)
-        nl = client.right - w;
-      if (nt + h > client.bottom)
-        nt = client.bottom - h;
-      og.sel = (RECT){nl, nt, nl + w, nt + h};
-      InvalidateSelChange(hwnd, old, og.sel);
+    og.noSnap = (wParam & MK_SHIFT) != 0;
+    Overlay_MoveLoupe(hwnd, p);
+    if (og.selecting || og.resizing || og.moving || og.redacting ||
+        og.annotating) {
+      FrameClock_Push(&og.clock, p.x, p.y, Clock_Ns());
+      Overlay_PumpFrame(hwnd);
+    } else if (!og.haveSel && !og.overview) {
+      Overlay_Hover(hwnd, Pick_Hit(&og.pick, p.x, p.y));
     }
     return 0;
   }
   case WM_LBUTTONUP: {
     POINT p = {GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam)};
     og.lastMouse = p;
-    og.selecting = og.resizing = og.moving = FALSE;
+    og.noSnap = (wParam & MK_SHIFT) != 0;
+    // land the final position before the drag ends
+    POINTER_EVENT e;
+    if (FrameClock_Take(&og.clock, Clock_Ns(), &e))
+      Overlay_ApplyDrag(hwnd, (POINT){e.x, e.y});
+    int pick = og.selecting && abs(RectW(&og.sel)) < MIN_SEL_SIZE &&
+                       abs(RectH(&og.sel)) < MIN_SEL_SIZE
+                   ? Pick_Hit(&og.pick, p.x, p.y)
+                   : -1;
+    if (pick >= 0) {
+      RECT old = og.sel;
+      og.sel = FromIRect(&og.pick.rects[pick]);
+      InvalidateSelChange(hwnd, old, og.sel);
+    }
+    if (og.redacting &&
+        IRect_IsEmpty(&og.redact.region[og.redact.n - 1].rect))
+      Redact_Pop(&og.redact); // a click, not a drag
+    if (og.annotating && IRect_IsEmpty(&og.annot.bounds[og.annot.n - 1]))
+      Overlay_PopAnnot(hwnd);
+    og.selecting = og.resizing = og.moving = og.redacting = FALSE;
+    og.annotating = FALSE;
     ReleaseCapture();
     return 0;
   }
+  case WM_MOUSEWHEEL:
+    if (og.loupe)
+      Overlay_SetZoom(hwnd, GET_WHEEL_DELTA_WPARAM(wParam) > 0 ? og.zoom * 2
+                                                               : og.zoom / 2);
+    return 0;
+  case WM_CHAR:
+    if (og.typing >= 0 && wParam >= 32 && wParam < 127)
+      Overlay_Type(hwnd, (int)wParam);
+    return 0;
   case WM_KEYDOWN: {
+    if (og.typing >= 0) {
+      // characters come as WM_CHAR
+      if (wParam == VK_RETURN || wParam == VK_ESCAPE)
+        Overlay_EndTyping(hwnd);
+      else if (wParam == VK_BACK)
+        Overlay_Type(hwnd, '\b');
+      return 0;
+    }
     if (wParam == VK_ESCAPE || wParam == VK_RBUTTON) {
-      DestroyWindow(hwnd);
+      Overlay_Close(hwnd);
     } else if (wParam == VK_RETURN ||
                ((GetKeyState(VK_CONTROL) & 0x8000) && wParam == 'C')) {
-      if (CopySelectionToClipboard(hwnd)) {
-        /* silent */
-      }
-      DestroyWindow(hwnd); // close overlay only, app keeps running
+      CopySelectionToClipboard(); // finishes on the export worker
+      Overlay_Close(hwnd); // close overlay only, app keeps running
+    } else if ((GetKeyState(VK_CONTROL) & 0x8000) && wParam == 'S') {
+      if (SaveSelectionToFile())
+        Overlay_Close(hwnd);
+    } else if ((wParam == 'S' || wParam == 'R') && og.haveSel &&
+               og.redact.n) {
+      // both grab the live screen, which the regions do not cover: the
+      // overlay stays open until they are removed
+      OutputDebugStringA(wParam == 'S'
+                             ? "screenshot: scrolling capture would not be "
+                               "redacted, remove the redaction regions first\n"
+                             : "screenshot: recording would not be redacted, "
+                               "remove the redaction regions first\n");
+      MessageBeep(MB_ICONWARNING);
+    } else if (wParam == 'S' && og.haveSel) {
+      Overlay_Close(hwnd);
+      Scroll_Start();
+    } else if (wParam == 'R' && og.haveSel) {
+      Overlay_Close(hwnd); // the first grabs must not see the overlay
+      Recording_Start();
+    } else if (wParam == 'M') {
+      Overlay_MoveLoupe(hwnd, og.lastMouse);
+      Overlay_InvalidateLoupe(hwnd);
+      og.loupe = !og.loupe;
+      Overlay_InvalidateLoupe(hwnd);
+    } else if (wParam == 'Z' && !og.selecting && !og.resizing &&
+               !og.moving) {
+      Overlay_MoveLoupe(hwnd, og.lastMouse);
+      Overlay_ToggleOverview(hwnd);
+    } else if (wParam == 'X') {
+      Overlay_CycleBrush(hwnd);
+    } else if (wParam == 'D') {
+      Overlay_ToggleDiff(hwnd);
+    } else if (wParam == 'A' || wParam == 'B' || wParam == 'H' ||
+               wParam == 'T') {
+      Overlay_SetTool(hwnd, wParam == 'A'   ? ANNOT_ARROW
+                            : wParam == 'B' ? ANNOT_BOX
+                            : wParam == 'H' ? ANNOT_MARK
+                                            : ANNOT_TEXT);
+    } else if (wParam == VK_BACK && !og.redacting && !og.annotating) {
+      // the last annotation, or the last region with the brush on
+      if (og.redact.n && (og.brush >= 0 || !og.annot.n))
+        Overlay_PopRedact(hwnd);
+      else if (og.annot.n)
+        Overlay_PopAnnot(hwnd);
     }
     return 0;
   }
   case WM_RBUTTONDOWN: {
-    DestroyWindow(hwnd);
+    Overlay_Close(hwnd);
     return 0;
   }
   case WM_PAINT: {
@@ -694,20 +1630,53 @@ static LRESULT CALLBACK Overlay_WndProc(HWND hwnd, UINT msg, WPARAM wParam,
     HDC h = BeginPaint(hwnd, &ps);
     RECT rc;
     GetClientRect(hwnd, &rc);
-    Overlay_EnsureBackBuffer(hwnd, rc.right, rc.bottom);
-    PaintOverlay(hwnd, og.hdcBack);
+    if (!Overlay_EnsureBackBuffer(hwnd, rc.right, rc.bottom)) {
+      EndPaint(hwnd, &ps);
+      return 0;
+    }
+    PaintOverlay(hwnd, &ps.rcPaint);
     BitBlt(h, ps.rcPaint.left, ps.rcPaint.top,
            ps.rcPaint.right - ps.rcPaint.left,
            ps.rcPaint.bottom - ps.rcPaint.top, og.hdcBack, ps.rcPaint.left,
            ps.rcPaint.top, SRCCOPY);
     EndPaint(hwnd, &ps);
+    FrameClock_Presented(&og.clock, Clock_Ns());
+    return 0;
+  }
+  case WM_OVERLAY_DIMBAND: {
+    int tile = (int)wParam;
+    if (!og.active) {
+      // stale band from a closed session
+    } else if (tile < 0) {
+      Overlay_FinishCapture(hwnd);
+    } else if (tile < og.fb.ntiles) {
+      const IRECT *a = &og.fb.tiles[tile].area;
+      RECT r = {a->left, a->top + LOWORD(lParam), a->right,
+                a->top + HIWORD(lParam)};
+      InvalidateRect(hwnd, &r, FALSE);
+    }
     return 0;
   }
+  case WM_TIMER:
+    if (wParam == FRAME_TIMER_ID) {
+      KillTimer(hwnd, FRAME_TIMER_ID);
+      og.frameTimer = FALSE;
+      Overlay_PumpFrame(hwnd);
+    }
+    return 0;
   case WM_ERASEBKGND:
     return 1;
+  case WM_DISPLAYCHANGE:
+    // the pooled buffers no longer fit the desktop
+    if (!og.active)
+      DestroyWindow(hwnd);
+    return 0;
   case WM_DESTROY: {
+    if (og.active)
+      Overlay_LogStats();
     Overlay_CleanupGDI();
     og.hwnd = NULL;
+    og.active = FALSE;
     return 0;
   }
   default:
@@ -715,8 +1684,12 @@ static LRESULT CALLBACK Overlay_WndProc(HWND hwnd, UINT msg, WPARAM wParam,
   }
 }
 
-// Create and show the overlay over the virtual desktop
+// Show the overlay over the virtual desktop, reusing the hidden window and
+// its buffers while the monitor layout is unchanged
 static void LaunchOverlay(HINSTANCE hInst) {
+  if (og.active)
+    return;
+  long long t0 = Clock_Ns();
   // compute virtual desktop + size
   RECT virt;
   virt.left = GetSystemMetrics(SM_XVIRTUALSCREEN);
@@ -725,6 +1698,14 @@ static void LaunchOverlay(HINSTANCE hInst) {
   virt.bottom = virt.top + GetSystemMetrics(SM_CYVIRTUALSCREEN);
   int W = RectW(&virt), H = RectH(&virt);
 
+  if (og.hwnd) {
+    RECT wr;
+    GetWindowRect(og.hwnd, &wr);
+    if (!EqualRect(&wr, &virt))
+      DestroyWindow(og.hwnd);
+  }
+  BOOL hit = og.hwnd != NULL;
+
   static const wchar_t *kOverlayClass = L"OverlayCaptureClass_Tray";
   static BOOL classRegd = FALSE;
   if (!classRegd) {
@@ -737,14 +1718,34 @@ static void LaunchOverlay(HINSTANCE hInst) {
     classRegd = TRUE;
   }
 
-  HWND hwnd = CreateWindowExW(WS_EX_TOPMOST | WS_EX_TOOLWINDOW, kOverlayClass,
-                              L"CaptureOverlay", WS_POPUP, virt.left, virt.top,
-                              W, H, NULL, NULL, hInst, NULL);
-  if (!hwnd)
+  // Created hidden, so it never shows up in its own capture
+  if (!og.hwnd &&
+      !CreateWindowExW(WS_EX_TOPMOST | WS_EX_TOOLWINDOW, kOverlayClass,
+                       L"CaptureOverlay", WS_POPUP, virt.left, virt.top, W,
+                       H, NULL, NULL, hInst, NULL))
+    return;
+  HWND hwnd = og.hwnd;
+
+  BOOL reused;
+  if (!Overlay_CaptureVirtual(&reused)) {
+    DestroyWindow(hwnd);
     return;
+  }
+  Overlay_BeginSession(hwnd);
 
+  g_pool.lastHit = hit && reused;
+  g_pool.setupNs = Clock_Ns() - t0 - og.captureNs;
+  if (g_pool.lastHit) {
+    g_pool.hits++;
+  } else {
+    g_pool.misses++;
+    g_pool.missNs += g_pool.setupNs;
+  }
+
+  SetCursor(LoadCursor(NULL, IDC_CROSS));
+  InvalidateRect(hwnd, NULL, FALSE);
   SetWindowPos(hwnd, HWND_TOPMOST, virt.left, virt.top, W, H, SWP_SHOWWINDOW);
-  ShowWindow(hwnd, SW_SHOW);
+  SetForegroundWindow(hwnd);
   UpdateWindow(hwnd);
 }
 
@@ -755,7 +1756,6 @@ static void LaunchOverlay(HINSTANCE hInst) {
 #define HOTKEY_ID_PRINT 3001
 
 static NOTIFYICONDATAW g_nid;
-static HWND g_hwndCtl = NULL;
 
 static void Tray_Add(HWND hwnd) {
   ZeroMemory(&g_nid, sizeof(g_nid));
@@ -800,9 +1800,20 @@ static LRESULT CALLBACK Ctl_WndProc(HWND hwnd, UINT msg, WPARAM wParam,
     return 0;
   case WM_HOTKEY:
     if ((int)wParam == HOTKEY_ID_PRINT) {
-      LaunchOverlay((HINSTANCE)GetWindowLongPtr(hwnd, GWLP_HINSTANCE));
+      if (g_rec.rec)
+        Recording_Stop();
+      else if (g_scroll.active)
+        Scroll_Finish();
+      else
+        LaunchOverlay((HINSTANCE)GetWindowLongPtr(hwnd, GWLP_HINSTANCE));
     }
     return 0;
+  case WM_TIMER:
+    if (wParam == RECORD_TIMER_ID && g_rec.rec && !Record_Running(g_rec.rec))
+      Recording_Stop(); // a write failed
+    else if (wParam == SCROLL_TIMER_ID)
+      Scroll_Step();
+    return 0;
   case WM_TRAYICON:
     switch (LOWORD(lParam)) {
     case WM_LBUTTONDBLCLK:
@@ -825,9 +1836,16 @@ static LRESULT CALLBACK Ctl_WndProc(HWND hwnd, UINT msg, WPARAM wParam,
     }
     return 0;
   }
+  case WM_EXPORT_CLIPBOARD:
+    Clipboard_Publish(hwnd, (HGLOBAL)lParam);
+    return 0;
   case WM_DESTROY:
     UnregisterHotKey(hwnd, HOTKEY_ID_PRINT);
+    Recording_Stop();
+    Scroll_Finish();
     Tray_Delete();
+    Export_Flush(); // let queued saves finish
+    LogExportQueue();
     PostQuitMessage(0);
     return 0;
   default:
@@ -835,12 +1853,118 @@ static LRESULT CALLBACK Ctl_WndProc(HWND hwnd, UINT msg, WPARAM wParam,
   }
 }
 
+// The subcommands' arguments as UTF-8, NULL if out of memory. A
+// GUI-subsystem process only has a stdout when the caller redirected it;
+// otherwise the parent's console is borrowed for reports and errors.
+static char **CommandArgs(int argc, wchar_t **wargv) {
+  if (!GetStdHandle(STD_OUTPUT_HANDLE) &&
+      AttachConsole(ATTACH_PARENT_PROCESS)) {
+    freopen("CONOUT$", "w", stdout);
+    freopen("CONOUT$", "w", stderr);
+  }
+  char **argv = (char **)calloc(argc + 1, sizeof(char *));
+  for (int i = 0; argv && i < argc; i++) {
+    int n = WideCharToMultiByte(CP_UTF8, 0, wargv[i], -1, NULL, 0, NULL, NULL);
+    if (n > 0 && (argv[i] = (char *)malloc(n))) {
+      WideCharToMultiByte(CP_UTF8, 0, wargv[i], -1, argv[i], n, NULL, NULL);
+      continue;
+    }
+    for (int k = 0; k < i; k++)
+      free(argv[k]);
+    free(argv);
+    argv = NULL;
+  }
+  return argv;
+}
+
+static void CommandArgs_Free(char **argv, int argc) {
+  for (int i = 0; argv && i < argc; i++)
+    free(argv[i]);
+  free(argv);
+}
+
+// `screenshot capture ...` (see batch.h): one grab, no windows, every
+// region encoded in parallel, a JSON report on stdout (or --report). Exits
+// 0 only if every region was written.
+static int CaptureMain(int argc, wchar_t **wargv) {
+  char **argv = CommandArgs(argc, wargv);
+  int converted = argv != NULL;
+
+  BATCH b;
+  char err[512];
+  int status = 2;
+  ZeroMemory(&b, sizeof(b));
+  if (!converted) {
+    fprintf(stderr, "screenshot capture: out of memory\n");
+  } else if (!Batch_Parse(&b, argc, argv, err, sizeof(err))) {
+    fprintf(stderr, "screenshot capture: %s\n", err);
+  } else {
+    BOOL reused;
+    long long t0 = Clock_Ns();
+    BOOL grabbed = Overlay_GrabDesktop(&reused);
+    b.grabNs = Clock_Ns() - t0;
+    int done = grabbed ? Batch_Run(&b, &og.fb) : 0;
+    if (!Batch_Report(&b, grabbed ? &og.fb : NULL,
+                      grabbed ? NULL : "desktop grab failed"))
+      fprintf(stderr, "screenshot capture: cannot write the report\n");
+    status = done == b.count ? 0 : 1;
+    Overlay_ReleaseTiles();
+  }
+  Batch_Free(&b);
+  CommandArgs_Free(argv, argc);
+  return status;
+}
+
+// `screenshot diff ...` (see diff.h): needs no capture at all.
+static int DiffMain(int argc, wchar_t **wargv) {
+  char **argv = CommandArgs(argc, wargv);
+  if (!argv) {
+    fprintf(stderr, "screenshot diff: out of memory\n");
+    return 2;
+  }
+  int status = Diff_Main(argc, argv);
+  CommandArgs_Free(argv, argc);
+  return status;
+}
+
+// `screenshot history ...` (see history.h): no capture, just the store.
+static int HistoryMain(int argc, wchar_t **wargv) {
+  char **argv = CommandArgs(argc, wargv);
+  if (!argv) {
+    fprintf(stderr, "screenshot history: out of memory\n");
+    return 2;
+  }
+  int status = History_Main(argc, argv);
+  CommandArgs_Free(argv, argc);
+  return status;
+}
+
 int APIENTRY wWinMain(HINSTANCE hInst, HINSTANCE hPrev, LPWSTR lpCmd,
                       int nShow) {
   (void)hPrev;
   (void)lpCmd;
   (void)nShow;
 
+  int argc;
+  wchar_t **argv = CommandLineToArgvW(GetCommandLineW(), &argc);
+  if (argv && argc > 1 && !wcscmp(argv[1], L"capture")) {
+    int status = CaptureMain(argc - 2, argv + 2);
+    LocalFree(argv);
+    return status;
+  }
+  if (argv && argc > 1 && !wcscmp(argv[1], L"diff")) {
+    int status = DiffMain(argc - 2, argv + 2);
+    LocalFree(argv);
+    return status;
+  }
+  if (argv && argc > 1 && !wcscmp(argv[1], L"history")) {
+    int status = HistoryMain(argc - 2, argv + 2);
+    LocalFree(argv);
+    return status;
+  }
+  if (argv)
+    LocalFree(argv);
+
   // Controller window (hidden) for tray + hotkey
   const wchar_t kCtlClass[] = L"ScreenshotCtlClass";
   WNDCLASSW wc = {0};
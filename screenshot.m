@@ -6,6 +6,11 @@ static const CGFloat OVERLAY_ALPHA = 0.4;
 static const CGFloat HANDLE_SIZE = 4.0;
 static const CGFloat BORDER_WIDTH = 1.0;
 static const CGFloat MIN_SEL_SIZE = 2.0;
+static const CGFloat LABEL_PAD_X = 6, LABEL_PAD_Y = 3;
+static const CGFloat LOUPE_SIZE = 128.0;  // loupe side, in points
+static const CGFloat LOUPE_OFFSET = 24.0; // gap between the cursor and loupe
+static const NSInteger LOUPE_ZOOM = 4;    // points per frame pixel
+static const NSInteger ZOOM_MIN = 2, ZOOM_MAX = 16;
 
 typedef NS_ENUM(NSInteger, HANDLE_ID) {
   HT_NONE = -1,
@@ -31,9 +36,43 @@ typedef NS_ENUM(NSInteger, HANDLE_ID) {
 @property (nonatomic, assign) NSPoint moveOffset;
 @property (nonatomic, assign) HANDLE_ID activeHandle;
 @property (nonatomic, assign) NSRect resizeAnchor;
+@property (nonatomic, assign) BOOL copyPending; // Enter before the capture
+@property (nonatomic, assign) BOOL loupe;        // 'M'; the wheel zooms
+@property (nonatomic, assign) NSInteger zoom;
+@property (nonatomic, assign) NSPoint pointer;   // where the loupe is drawn for
+- (void)setCapture:(NSImage *)image;
 @end
 
-@implementation OverlayView
+// The dirty rect less the selection, as up to four rects.
+static NSInteger DimRects(NSRect dirty, NSRect s, NSRect out[4]) {
+  if (NSIsEmptyRect(s) || !NSIntersectsRect(dirty, s)) {
+    out[0] = dirty;
+    return 1;
+  }
+  NSInteger n = 0;
+  CGFloat bottom = MAX(NSMinY(dirty), NSMinY(s));
+  CGFloat top = MIN(NSMaxY(dirty), NSMaxY(s));
+  if (NSMinY(dirty) < bottom)
+    out[n++] = NSMakeRect(NSMinX(dirty), NSMinY(dirty), dirty.size.width,
+                          bottom - NSMinY(dirty));
+  if (NSMaxY(dirty) > top)
+    out[n++] = NSMakeRect(NSMinX(dirty), top, dirty.size.width,
+                          NSMaxY(dirty) - top);
+  if (NSMinX(dirty) < NSMinX(s))
+    out[n++] = NSMakeRect(NSMinX(dirty), bottom, NSMinX(s) - NSMinX(dirty),
+                          top - bottom);
+  if (NSMaxX(dirty) > NSMaxX(s))
+    out[n++] = NSMakeRect(NSMaxX(s), bottom, NSMaxX(dirty) - NSMaxX(s),
+                          top - bottom);
+  return n;
+}
+
+@implementation OverlayView {
+  // capturedImage at the window's backing resolution, made once per capture
+  // so a repaint copies pixels instead of rescaling the whole capture
+  CGImageRef _frame;
+  CGFloat _scroll; // wheel travel not yet turned into a zoom step
+}
 
 - (instancetype)initWithFrame:(NSRect)frame {
   self = [super initWithFrame:frame];
@@ -43,10 +82,47 @@ typedef NS_ENUM(NSInteger, HANDLE_ID) {
     _resizing = NO;
     _moving = NO;
     _activeHandle = HT_NONE;
+    _zoom = LOUPE_ZOOM;
   }
   return self;
 }
 
+- (void)dealloc {
+  CGImageRelease(_frame);
+}
+
+- (CGImageRef)backingFrame {
+  if (_frame || !self.capturedImage) return _frame;
+  NSRect px = [self convertRectToBacking:self.bounds];
+  size_t w = (size_t)px.size.width, h = (size_t)px.size.height;
+  CGImageRef src = [self.capturedImage CGImageForProposedRect:NULL
+                                                      context:nil
+                                                        hints:nil];
+  if (!src || !w || !h) return NULL;
+  if (CGImageGetWidth(src) == w && CGImageGetHeight(src) == h) {
+    _frame = CGImageRetain(src);
+    return _frame;
+  }
+  CGColorSpaceRef cs = CGColorSpaceCreateWithName(kCGColorSpaceSRGB);
+  CGContextRef bc = CGBitmapContextCreate(
+      NULL, w, h, 8, 0, cs,
+      kCGImageAlphaPremultipliedFirst | kCGBitmapByteOrder32Little);
+  CGColorSpaceRelease(cs);
+  if (!bc) return NULL;
+  CGContextSetInterpolationQuality(bc, kCGInterpolationHigh);
+  CGContextDrawImage(bc, CGRectMake(0, 0, w, h), src);
+  _frame = CGBitmapContextCreateImage(bc);
+  CGContextRelease(bc);
+  return _frame;
+}
+
+- (void)viewDidChangeBackingProperties {
+  [super viewDidChangeBackingProperties];
+  CGImageRelease(_frame);
+  _frame = NULL;
+  [self setNeedsDisplay:YES];
+}
+
 - (BOOL)acceptsFirstResponder { return YES; }
 - (BOOL)canBecomeKeyView { return YES; }
 
@@ -156,26 +232,40 @@ typedef NS_ENUM(NSInteger, HANDLE_ID) {
 
 // --- Drawing helpers ---
 - (void)drawRect:(NSRect)dirtyRect {
-  if (!self.capturedImage) return;
-
   NSRect bounds = self.bounds;
-
-  // Draw captured image
-  [self.capturedImage drawInRect:bounds];
-
-  // Draw dark overlay
+  CGImageRef frame = [self backingFrame];
+  CGContextRef cg = [NSGraphicsContext currentContext].CGContext;
+  NSRect s = self.haveSel ? [self normalizeSel] : NSZeroRect;
+
+  // Only the rects being redrawn are touched, and the frame maps 1:1 onto
+  // the backing pixels, so each one is a copy. Until the capture arrives the
+  // window is a translucent tint over the live desktop.
+  const NSRect *rects;
+  NSInteger count;
+  [self getRectsBeingDrawn:&rects count:&count];
   [[NSColor colorWithWhite:0.0 alpha:OVERLAY_ALPHA] setFill];
-  NSRectFillUsingOperation(bounds, NSCompositingOperationSourceOver);
+  for (NSInteger i = 0; i < count; i++) {
+    if (frame) {
+      CGContextSaveGState(cg);
+      CGContextClipToRect(cg, rects[i]);
+      CGContextSetInterpolationQuality(cg, kCGInterpolationNone);
+      CGContextDrawImage(cg, bounds, frame);
+      CGContextRestoreGState(cg);
+    }
+    // dark overlay everywhere but the selection
+    NSRect dim[4];
+    NSInteger n = DimRects(rects[i], s, dim);
+    NSRectFillListUsingOperation(dim, n,
+                                 frame ? NSCompositingOperationSourceOver
+                                       : NSCompositingOperationCopy);
+  }
 
   if (self.haveSel) {
-    NSRect s = [self normalizeSel];
-
-    // Draw clear selection area (show original image)
-    NSGraphicsContext *ctx = [NSGraphicsContext currentContext];
-    [ctx saveGraphicsState];
-    NSRectClip(s);
-    [self.capturedImage drawInRect:bounds];
-    [ctx restoreGraphicsState];
+    if (!frame) {
+      [[NSColor clearColor] setFill];
+      NSRectFillUsingOperation(NSIntersectionRect(s, dirtyRect),
+                               NSCompositingOperationCopy);
+    }
 
     // Draw selection border (white dotted line)
     [[NSColor whiteColor] setStroke];
@@ -188,6 +278,74 @@ typedef NS_ENUM(NSInteger, HANDLE_ID) {
     [self drawHandles:s];
     [self drawDimsLabel:s];
   }
+
+  if (self.loupe && frame) [self drawLoupe:frame];
+}
+
+// Frame pixels across the loupe: odd, so the cursor pixel is the middle one.
+- (NSInteger)loupeSpan {
+  return (NSInteger)(LOUPE_SIZE / self.zoom) | 1;
+}
+
+// The loupe next to the pointer, border included; it flips to the other
+// side near the edges.
+- (NSRect)loupeBox {
+  NSRect bounds = self.bounds;
+  NSPoint p = self.pointer;
+  CGFloat side = [self loupeSpan] * self.zoom + 2;
+  CGFloat x = p.x + LOUPE_OFFSET, y = p.y - LOUPE_OFFSET - side;
+  if (x + side > NSMaxX(bounds)) x = p.x - LOUPE_OFFSET - side;
+  if (y < NSMinY(bounds)) y = p.y + LOUPE_OFFSET;
+  return NSMakeRect(MAX(x, NSMinX(bounds)),
+                    MIN(y, NSMaxY(bounds) - side), side, side);
+}
+
+// Zoomed frame pixels around the pointer, cropped from the frame rather
+// than scaling it; the middle cell is inverted to mark the pointed pixel.
+- (void)drawLoupe:(CGImageRef)frame {
+  NSRect box = [self loupeBox];
+  NSRect inner = NSInsetRect(box, 1, 1);
+  NSInteger n = [self loupeSpan], zoom = self.zoom;
+  CGFloat scale = CGImageGetWidth(frame) / self.bounds.size.width;
+  CGFloat cx = floor(self.pointer.x * scale);
+  CGFloat cy = floor((self.bounds.size.height - self.pointer.y) * scale);
+  CGRect want = CGRectMake(cx - n / 2, cy - n / 2, n, n);
+  CGRect have = CGRectIntersection(
+      want, CGRectMake(0, 0, CGImageGetWidth(frame), CGImageGetHeight(frame)));
+
+  [[NSColor blackColor] setFill];
+  NSRectFill(inner);
+  CGImageRef patch = CGRectIsEmpty(have)
+                         ? NULL
+                         : CGImageCreateWithImageInRect(frame, have);
+  if (patch) {
+    // image rows run top-down, view coordinates bottom-up
+    CGRect dst = CGRectMake(
+        NSMinX(inner) + (have.origin.x - want.origin.x) * zoom,
+        NSMaxY(inner) - (CGRectGetMaxY(have) - want.origin.y) * zoom,
+        have.size.width * zoom, have.size.height * zoom);
+    CGContextRef cg = [NSGraphicsContext currentContext].CGContext;
+    CGContextSaveGState(cg);
+    CGContextClipToRect(cg, inner);
+    CGContextSetInterpolationQuality(cg, kCGInterpolationNone);
+    CGContextDrawImage(cg, dst, patch);
+    CGContextRestoreGState(cg);
+    CGImageRelease(patch);
+  }
+  [[NSColor whiteColor] setFill];
+  NSRectFillUsingOperation(NSMakeRect(NSMinX(inner) + n / 2 * zoom,
+                                      NSMaxY(inner) - (n / 2 + 1) * zoom,
+                                      zoom, zoom),
+                           NSCompositingOperationDifference);
+  NSFrameRect(box);
+}
+
+// Repaints the loupe around a new pointer position or zoom.
+- (void)moveLoupeTo:(NSPoint)p zoom:(NSInteger)zoom {
+  if (self.loupe) [self setNeedsDisplayInRect:[self loupeBox]];
+  self.pointer = p;
+  self.zoom = MAX(ZOOM_MIN, MIN(zoom, ZOOM_MAX));
+  if (self.loupe) [self setNeedsDisplayInRect:[self loupeBox]];
 }
 
 - (void)drawHandles:(NSRect)r {
@@ -206,47 +364,69 @@ typedef NS_ENUM(NSInteger, HANDLE_ID) {
   }
 }
 
-- (void)drawDimsLabel:(NSRect)s {
-  NSInteger w = (NSInteger)s.size.width;
-  NSInteger h = (NSInteger)s.size.height;
-  NSString *dims = [NSString stringWithFormat:@"%ldx%ld", (long)w, (long)h];
+static NSString *LabelText(NSRect s) {
+  return [NSString stringWithFormat:@"%ldx%ld", (long)s.size.width,
+                                    (long)s.size.height];
+}
 
-  NSDictionary *attrs = @{
+static NSDictionary *LabelAttrs(void) {
+  return @{
     NSFontAttributeName: [NSFont systemFontOfSize:12],
     NSForegroundColorAttributeName: [NSColor colorWithWhite:0.94 alpha:1.0]
   };
+}
 
-  NSSize textSize = [dims sizeWithAttributes:attrs];
-  const CGFloat padX = 6, padY = 3, outside = HANDLE_SIZE + 6, inside = 6;
-  CGFloat boxW = textSize.width + padX * 2;
-  CGFloat boxH = textSize.height + padY * 2;
+- (NSRect)labelBox:(NSRect)s {
+  NSSize textSize = [LabelText(s) sizeWithAttributes:LabelAttrs()];
+  const CGFloat outside = HANDLE_SIZE + 6, inside = 6;
+  CGFloat boxW = textSize.width + LABEL_PAD_X * 2;
+  CGFloat boxH = textSize.height + LABEL_PAD_Y * 2;
 
   NSRect box;
   NSRect bounds = self.bounds;
 
   // Try left of selection
   box = NSMakeRect(NSMinX(s) - outside - boxW, NSMaxY(s) - boxH, boxW, boxH);
-  if (box.origin.x >= 0) goto draw_label;
+  if (box.origin.x >= 0) goto place_label;
 
   // Try above selection
   box = NSMakeRect(NSMinX(s), NSMaxY(s) + outside, boxW, boxH);
-  if (NSMaxY(box) <= bounds.size.height) goto draw_label;
+  if (NSMaxY(box) <= bounds.size.height) goto place_label;
 
   // Inside selection (top-left corner)
   box = NSMakeRect(NSMinX(s) + inside, NSMaxY(s) - boxH - inside, boxW, boxH);
 
-draw_label:
+place_label:
   // Clamp to bounds
   if (box.origin.x < 0) box.origin.x = 0;
   if (box.origin.y < 0) box.origin.y = 0;
   if (NSMaxX(box) > bounds.size.width) box.origin.x = bounds.size.width - boxW;
   if (NSMaxY(box) > bounds.size.height) box.origin.y = bounds.size.height - boxH;
+  return box;
+}
 
+- (void)drawDimsLabel:(NSRect)s {
+  NSRect box = [self labelBox:s];
   [[NSColor blackColor] setFill];
   NSRectFill(box);
 
-  NSPoint textPoint = NSMakePoint(box.origin.x + padX, box.origin.y + padY);
-  [dims drawAtPoint:textPoint withAttributes:attrs];
+  NSPoint textPoint =
+      NSMakePoint(box.origin.x + LABEL_PAD_X, box.origin.y + LABEL_PAD_Y);
+  [LabelText(s) drawAtPoint:textPoint withAttributes:LabelAttrs()];
+}
+
+// Everything drawn for the selection: border, handles and label.
+- (NSRect)selBounds {
+  if (!self.haveSel) return NSZeroRect;
+  NSRect s = [self normalizeSel];
+  CGFloat grow = HANDLE_SIZE + BORDER_WIDTH + 1;
+  return NSUnionRect(NSInsetRect(s, -grow, -grow), [self labelBox:s]);
+}
+
+// Repaints what the selection covered (before) and covers now.
+- (void)selChangedFrom:(NSRect)before {
+  [self setNeedsDisplayInRect:before];
+  [self setNeedsDisplayInRect:[self selBounds]];
 }
 
 - (void)mouseDown:(NSEvent *)event {
@@ -273,17 +453,20 @@ draw_label:
   }
 
   // new selection
+  NSRect before = [self selBounds];
   self.selecting = YES;
   self.resizing = self.moving = NO;
   self.haveSel = YES;
   self.dragStart = p;
   self.sel = NSMakeRect(p.x, p.y, 0, 0);
-  [self setNeedsDisplay:YES];
+  [self selChangedFrom:before];
 }
 
 - (void)mouseDragged:(NSEvent *)event {
   NSPoint p = [self convertPoint:event.locationInWindow fromView:nil];
   NSRect bounds = self.bounds;
+  NSRect before = [self selBounds];
+  [self moveLoupeTo:p zoom:self.zoom];
 
   if (self.selecting) {
     CGFloat x = MIN(self.dragStart.x, p.x);
@@ -291,10 +474,10 @@ draw_label:
     CGFloat w = fabs(p.x - self.dragStart.x);
     CGFloat h = fabs(p.y - self.dragStart.y);
     self.sel = NSMakeRect(x, y, w, h);
-    [self setNeedsDisplay:YES];
+    [self selChangedFrom:before];
   } else if (self.resizing) {
     [self resizeRobust:p];
-    [self setNeedsDisplay:YES];
+    [self selChangedFrom:before];
   } else if (self.moving) {
     NSRect s = [self normalizeSel];
     CGFloat newX = p.x - self.moveOffset.x;
@@ -309,7 +492,7 @@ draw_label:
       newY = bounds.size.height - s.size.height;
 
     self.sel = NSMakeRect(newX, newY, s.size.width, s.size.height);
-    [self setNeedsDisplay:YES];
+    [self selChangedFrom:before];
   }
 }
 
@@ -379,6 +562,7 @@ draw_label:
 
 - (void)mouseMoved:(NSEvent *)event {
   NSPoint p = [self convertPoint:event.locationInWindow fromView:nil];
+  [self moveLoupeTo:p zoom:self.zoom];
 
   if (self.haveSel && !self.selecting && !self.resizing && !self.moving) {
     NSRect s = [self normalizeSel];
@@ -416,17 +600,50 @@ draw_label:
     [self.window close];
   } else if (event.keyCode == kVK_Return ||
              ((event.modifierFlags & NSEventModifierFlagCommand) && event.keyCode == kVK_ANSI_C)) {
+    if (!self.capturedImage) {
+      self.copyPending = YES; // finish once the capture lands
+      return;
+    }
     [self copySelectionToClipboard];
     [self.window close];
+  } else if (event.keyCode == kVK_ANSI_M) {
+    NSPoint p = [self convertPoint:self.window.mouseLocationOutsideOfEventStream
+                          fromView:nil];
+    [self moveLoupeTo:p zoom:self.zoom];
+    self.loupe = !self.loupe;
+    [self setNeedsDisplayInRect:[self loupeBox]];
   } else {
     [super keyDown:event];
   }
 }
 
+// One zoom step per wheel notch, or per stretch of trackpad travel.
+- (void)scrollWheel:(NSEvent *)event {
+  if (!self.loupe) return;
+  _scroll += event.scrollingDeltaY;
+  CGFloat step = event.hasPreciseScrollingDeltas ? 24 : 1;
+  if (fabs(_scroll) < step) return;
+  NSInteger zoom = _scroll > 0 ? self.zoom * 2 : self.zoom / 2;
+  _scroll = 0;
+  [self moveLoupeTo:self.pointer zoom:zoom];
+}
+
 - (void)rightMouseDown:(NSEvent *)event {
   [self.window close];
 }
 
+- (void)setCapture:(NSImage *)image {
+  self.capturedImage = image;
+  CGImageRelease(_frame);
+  _frame = NULL; // rebuilt at the next draw
+  [self setNeedsDisplay:YES];
+  if (self.copyPending) {
+    self.copyPending = NO;
+    [self copySelectionToClipboard];
+    [self.window close];
+  }
+}
+
 - (BOOL)copySelectionToClipboard {
   if (!self.haveSel) return NO;
 
@@ -486,7 +703,7 @@ draw_label:
 @property (nonatomic, strong) OverlayWindow *overlayWindow;
 @property (nonatomic, assign) EventHotKeyRef hotKeyRef;
 - (void)launchOverlay;
-- (void)captureAndShowOverlay;
+- (void)captureIntoOverlay:(OverlayWindow *)window;
 - (void)showOverlayWithImage:(NSImage *)capturedImage frame:(NSRect)frame;
 @end
 
@@ -557,17 +774,26 @@ OSStatus HotKeyHandler(EventHandlerCallRef nextHandler, EventRef event, void *us
     self.overlayWindow = nil;
   }
 
-  dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(0.1 * NSEC_PER_SEC)),
-                 dispatch_get_main_queue(), ^{
-    [self captureAndShowOverlay];
-  });
+  // Show the overlay straight away and let the capture fill it in; the
+  // capture filter leaves our own windows out, so no settle delay is needed.
+  NSRect frame = [NSScreen screens].firstObject.frame;
+  [self showOverlayWithImage:nil frame:frame];
+  [self captureIntoOverlay:self.overlayWindow];
 }
 
-- (void)captureAndShowOverlay {
+// Closes the overlay if it is still the one this capture was started for.
+- (void)dropOverlay:(OverlayWindow *)window {
+  if (self.overlayWindow != window) return;
+  [window close];
+  self.overlayWindow = nil;
+}
+
+- (void)captureIntoOverlay:(OverlayWindow *)window {
   if (@available(macOS 12.3, *)) {
     [SCShareableContent getShareableContentWithCompletionHandler:^(SCShareableContent *content, NSError *error) {
       if (error || !content) {
         dispatch_async(dispatch_get_main_queue(), ^{
+          [self dropOverlay:window];
           NSAlert *alert = [[NSAlert alloc] init];
           alert.messageText = @"Screen Recording Permission Required";
           alert.informativeText = @"Please grant Screen Recording permission in System Settings > Privacy & Security > Screen Recording, then restart the app.";
@@ -579,6 +805,7 @@ OSStatus HotKeyHandler(EventHandlerCallRef nextHandler, EventRef event, void *us
       SCDisplay *mainDisplay = content.displays.firstObject;
       if (!mainDisplay) {
         dispatch_async(dispatch_get_main_queue(), ^{
+          [self dropOverlay:window];
           NSAlert *alert = [[NSAlert alloc] init];
           alert.messageText = @"No Display Found";
           alert.informativeText = @"Could not find a display to capture.";
@@ -587,7 +814,15 @@ OSStatus HotKeyHandler(EventHandlerCallRef nextHandler, EventRef event, void *us
         return;
       }
 
-      SCContentFilter *filter = [[SCContentFilter alloc] initWithDisplay:mainDisplay excludingWindows:@[]];
+      // Leave out our own overlay, which is already on screen
+      pid_t pid = [NSProcessInfo processInfo].processIdentifier;
+      NSMutableArray<SCRunningApplication *> *ownApps = [NSMutableArray array];
+      for (SCRunningApplication *app in content.applications) {
+        if (app.processID == pid) [ownApps addObject:app];
+      }
+      SCContentFilter *filter = [[SCContentFilter alloc] initWithDisplay:mainDisplay
+                                                   excludingApplications:ownApps
+                                                        exceptingWindows:@[]];
       SCStreamConfiguration *config = [[SCStreamConfiguration alloc] init];
       config.width = mainDisplay.width * 2;  // Retina
       config.height = mainDisplay.height * 2;
@@ -599,6 +834,7 @@ OSStatus HotKeyHandler(EventHandlerCallRef nextHandler, EventRef event, void *us
                                 completionHandler:^(CGImageRef cgImage, NSError *captureError) {
         if (captureError || !cgImage) {
           dispatch_async(dispatch_get_main_queue(), ^{
+            [self dropOverlay:window];
             NSAlert *alert = [[NSAlert alloc] init];
             alert.messageText = @"Capture Failed";
             alert.informativeText = captureError.localizedDescription ?: @"Unknown error";
@@ -611,11 +847,13 @@ OSStatus HotKeyHandler(EventHandlerCallRef nextHandler, EventRef event, void *us
         NSImage *capturedImage = [[NSImage alloc] initWithCGImage:cgImage size:displayFrame.size];
 
         dispatch_async(dispatch_get_main_queue(), ^{
-          [self showOverlayWithImage:capturedImage frame:displayFrame];
+          if (self.overlayWindow != window || !window.isVisible) return;
+          [(OverlayView *)window.contentView setCapture:capturedImage];
         });
       }];
     }];
   } else {
+    [self dropOverlay:window];
     NSAlert *alert = [[NSAlert alloc] init];
     alert.messageText = @"macOS 12.3 or later required";
     alert.informativeText = @"This app requires macOS 12.3 (Monterey) or later for screen capture.";
@@ -0,0 +1,1942 @@
+#define _GNU_SOURCE
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/cursorfont.h>
+#include <X11/keysym.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "annot.h"
+#include "batch.h"
+#include "capture_x11.h"
+#include "clipboard_x11.h"
+#include "diff.h"
+#include "edges.h"
+#include "export.h"
+#include "frameclock.h"
+#include "history.h"
+#include "mip.h"
+#include "pick.h"
+#include "pick_x11.h"
+#include "platform.h"
+#include "record.h"
+#include "redact.h"
+#include "render.h"
+#include "service.h"
+#include "shadow_x11.h"
+#include "stitch.h"
+
+#ifndef MIN
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+#ifndef MAX
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+
+typedef struct {
+  int x, y;
+} POINT;
+
+static int RectW(const IRECT *r) { return r->right - r->left; }
+static int RectH(const IRECT *r) { return r->bottom - r->top; }
+static int PtInRect(const IRECT *r, POINT p) {
+  return p.x >= r->left && p.x < r->right && p.y >= r->top && p.y < r->bottom;
+}
+
+typedef enum {
+  HT_NONE = -1,
+  HT_TL = 0,
+  HT_T,
+  HT_TR,
+  HT_L,
+  HT_R,
+  HT_BL,
+  HT_B,
+  HT_BR
+} HANDLE_ID;
+
+enum { CUR_CROSS, CUR_NS, CUR_WE, CUR_NWSE, CUR_NESW, CUR_MOVE, CUR_COUNT };
+
+typedef struct {
+  // Kept between activations (see g_pool); win stays unmapped while idle.
+  Window win;
+  GC gc;
+  X11_CAPTURE cap; // per-monitor tiles, read in place; dimmed copies too
+  X11_IMAGE back;  // composited frame, presented with (Shm)PutImage
+  IRECT virt, client;
+  Cursor cursors[CUR_COUNT];
+
+  int active; // mapped and taking input
+  int cursor;
+
+  // pending repaint, the equivalent of the Win32 update region
+  IRECT dirty;
+  size_t paintPixels, paintPixelsTotal;
+  unsigned paints;
+
+  FRAME_CLOCK clock;
+
+  // progressive dimming: hotkey, first present, first present once complete
+  long long tLaunch, firstFrameNs, completeNs;
+  int prepared, completePending;
+
+  // selection state
+  int haveSel, selecting, resizing, moving;
+  IRECT sel, resizeAnchor;
+  POINT dragStart, moveOffset;
+  HANDLE_ID activeHandle;
+
+  // snap-to-edge, built from the frozen frame; Shift held turns it off
+  EDGE_INDEX edges;
+  int snapDist, noSnap;
+
+  // window pick: the window under the cursor while nothing is selected
+  int hover; // index into g_pick.index, -1 for none
+
+  // loupe ('m', the wheel zooms) and the zoom-to-fit overview of the whole
+  // frame over the monitor under the cursor ('z'), drawn from the pyramid
+  MIP_PYRAMID mip;
+  int loupe, zoom, overview;
+  IRECT overviewBox;
+  POINT pointer;
+
+  // redaction: 'x' cycles the brush (off, pixelate, blur, Gaussian), a drag
+  // inside the selection then adds a region; Backspace drops the last one
+  REDACT_LAYER redact;
+  int brush; // REDACT_* mode, -1 for off
+  int redacting;
+  POINT redactStart;
+
+  // annotations: 'a' arrow, 'b' box, 'h' highlighter, 't' text pick the
+  // tool (the same key drops it); a drag inside the selection draws one,
+  // and a text click places a label that takes the typed keys
+  ANNOT_LAYER annot;
+  int tool; // ANNOT_* kind, -1 for off
+  int annotating; // dragging the last annotation
+  int typing;     // label being typed, -1 for none
+
+  // 'd' frames what changed since the previous capture; every session
+  // keeps a copy of its frame for the next one to compare with
+  DIFF_KEEP keep[2]; // keep[cur] is this session's
+  int cur;
+  DIFF diff;
+  int diffShown, diffDone;
+} OVERLAY;
+
+static OVERLAY og;
+static Display *g_dpy;
+static Window g_ctl; // hidden controller window: hotkey + clipboard owner
+static int g_verbose;
+static X11_SHADOW g_shadow; // --shadow: damage-tracked copy of the screen
+static int g_wake[2] = {-1, -1}; // dim worker -> event loop
+static volatile long g_dimDone;  // the dim worker has finished
+
+// --serve: the local capture service and the frame it last grabbed.
+static struct {
+  SERVICE *svc;
+  X11_CAPTURE cap;
+  long long grabbedAt;
+  int fresh; // cap holds a frame that can still be shared
+  int lent;  // cap holds a shadow snapshot until Service_EndFrame
+} g_service;
+
+// Region recording ('r' in the overlay; PrintScreen stops it). The capture
+// thread reads the screen through its own connection.
+typedef struct {
+  Display *dpy;
+  X11_IMAGE img;
+  int x, y; // root coordinates
+} REC_GRAB;
+
+static struct {
+  RECORDER *rec;
+  REC_GRAB grab;
+  FILE *f;
+  char path[4200];
+} g_rec;
+
+// Scrolling capture ('S' in the overlay): the selection is grabbed every
+// STITCH_INTERVAL_MS while the user scrolls it; PrintScreen saves the result.
+static struct {
+  int active;
+  STITCH st;
+  X11_IMAGE img;
+  int x, y; // root coordinates
+  long long next;
+} g_scroll;
+
+// Window pick: the top-level windows, listed on a worker thread over its own
+// connection while the overlay opens, then indexed for hit testing.
+static struct {
+  Display *dpy;
+  THREAD thread;
+  int threaded;
+  volatile long ready; // index is built
+  Window skip;         // the overlay
+  IRECT virt;          // root coordinates of the overlay client area
+  PICK_INDEX index;
+  int windows;
+  long long listNs;
+} g_pick;
+
+// Activations that found the overlay surfaces already allocated, and the
+// setup time (hotkey to mapped window, excluding the grab itself).
+typedef struct {
+  unsigned hits, misses;
+  int lastHit;
+  long long setupNs, missNs; // last activation; total over misses
+} POOL_STATS;
+static POOL_STATS g_pool;
+
+typedef struct {
+  int tile, top, bottom;
+} DIM_BAND_MSG;
+
+static const unsigned char OVERLAY_ALPHA = 100;
+static const long long RECORD_POLL_NS = 100000000LL;
+static const int HANDLE_SIZE = RENDER_HANDLE_SIZE;
+static const int MIN_SEL_SIZE = 2;
+static const int LOUPE_ZOOM = 4; // first loupe magnification
+
+// --- Handle helpers & swapping ---
+static void GetHandleCenters(const IRECT *r, POINT p[8]) {
+  int cx = (r->left + r->right) / 2, cy = (r->top + r->bottom) / 2;
+  p[HT_TL] = (POINT){r->left, r->top};
+  p[HT_T] = (POINT){cx, r->top};
+  p[HT_TR] = (POINT){r->right, r->top};
+  p[HT_L] = (POINT){r->left, cy};
+  p[HT_R] = (POINT){r->right, cy};
+  p[HT_BL] = (POINT){r->left, r->bottom};
+  p[HT_B] = (POINT){cx, r->bottom};
+  p[HT_BR] = (POINT){r->right, r->bottom};
+}
+static IRECT HR(POINT c) {
+  int hs = HANDLE_SIZE;
+  IRECT rr = {c.x - hs, c.y - hs, c.x + hs, c.y + hs};
+  return rr;
+}
+static HANDLE_ID HitTest(const IRECT *r, POINT pt) {
+  if (RectW(r) < 1 || RectH(r) < 1)
+    return HT_NONE;
+  POINT c[8];
+  GetHandleCenters(r, c);
+  for (int i = 0; i < 8; i++) {
+    IRECT h = HR(c[i]);
+    if (PtInRect(&h, pt))
+      return (HANDLE_ID)i;
+  }
+  const int EDGE = HANDLE_SIZE + 2;
+  IRECT top = {r->left + EDGE, r->top - EDGE, r->right - EDGE, r->top + EDGE};
+  IRECT bot = {r->left + EDGE, r->bottom - EDGE, r->right - EDGE,
+               r->bottom + EDGE};
+  IRECT left = {r->left - EDGE, r->top + EDGE, r->left + EDGE,
+                r->bottom - EDGE};
+  IRECT right = {r->right - EDGE, r->top + EDGE, r->right + EDGE,
+                 r->bottom - EDGE};
+  if (PtInRect(&top, pt))
+    return HT_T;
+  if (PtInRect(&bot, pt))
+    return HT_B;
+  if (PtInRect(&left, pt))
+    return HT_L;
+  if (PtInRect(&right, pt))
+    return HT_R;
+  return HT_NONE;
+}
+static int CursorForHandle(HANDLE_ID h) {
+  switch (h) {
+  case HT_T:
+  case HT_B:
+    return CUR_NS;
+  case HT_L:
+  case HT_R:
+    return CUR_WE;
+  case HT_TL:
+  case HT_BR:
+    return CUR_NWSE;
+  case HT_TR:
+  case HT_BL:
+    return CUR_NESW;
+  default:
+    return CUR_CROSS;
+  }
+}
+static HANDLE_ID SwapH(HANDLE_ID h) {
+  switch (h) {
+  case HT_L:
+    return HT_R;
+  case HT_R:
+    return HT_L;
+  case HT_TL:
+    return HT_TR;
+  case HT_TR:
+    return HT_TL;
+  case HT_BL:
+    return HT_BR;
+  case HT_BR:
+    return HT_BL;
+  default:
+    return h;
+  }
+}
+static HANDLE_ID SwapV(HANDLE_ID h) {
+  switch (h) {
+  case HT_T:
+    return HT_B;
+  case HT_B:
+    return HT_T;
+  case HT_TL:
+    return HT_BL;
+  case HT_BL:
+    return HT_TL;
+  case HT_TR:
+    return HT_BR;
+  case HT_BR:
+    return HT_TR;
+  default:
+    return h;
+  }
+}
+
+// robust resize, same rules as the Win32 overlay
+static void ResizeRobust(HANDLE_ID *hIO, POINT p, IRECT *anchor,
+                         IRECT *outSel) {
+  HANDLE_ID h = *hIO;
+  int L = anchor->left, R = anchor->right, T = anchor->top, B = anchor->bottom;
+  if (h == HT_R || h == HT_TR || h == HT_BR) {
+    if (p.x < anchor->left) {
+      R = anchor->left;
+      L = R;
+      h = SwapH(h);
+      anchor->right = R;
+    } else
+      R = (p.x < anchor->left + MIN_SEL_SIZE) ? (anchor->left + MIN_SEL_SIZE)
+                                              : p.x;
+  } else if (h == HT_L || h == HT_TL || h == HT_BL) {
+    if (p.x > anchor->right) {
+      L = anchor->right;
+      R = L;
+      h = SwapH(h);
+      anchor->left = L;
+    } else
+      L = (p.x > anchor->right - MIN_SEL_SIZE) ? (anchor->right - MIN_SEL_SIZE)
+                                               : p.x;
+  }
+  if (h == HT_B || h == HT_BL || h == HT_BR) {
+    if (p.y < anchor->top) {
+      B = anchor->top;
+      T = B;
+      h = SwapV(h);
+      anchor->bottom = B;
+    } else
+      B = (p.y < anchor->top + MIN_SEL_SIZE) ? (anchor->top + MIN_SEL_SIZE)
+                                             : p.y;
+  } else if (h == HT_T || h == HT_TL || h == HT_TR) {
+    if (p.y > anchor->bottom) {
+      T = anchor->bottom;
+      B = T;
+      h = SwapV(h);
+      anchor->top = T;
+    } else
+      T = (p.y > anchor->bottom - MIN_SEL_SIZE)
+              ? (anchor->bottom - MIN_SEL_SIZE)
+              : p.y;
+  }
+  IRECT r = {L, T, R, B};
+  IRect_Normalize(&r);
+  *outSel = r;
+  *hIO = h;
+}
+
+// --- Painting ---
+static void InvalidateRect_(const IRECT *r) {
+  IRect_Union(&og.dirty, r, &og.dirty);
+}
+
+static void InvalidateSelChange(IRECT oldSel, IRECT newSel) {
+  IRECT a = Render_SelBounds(&oldSel, &og.client),
+        b = Render_SelBounds(&newSel, &og.client);
+  InvalidateRect_(&a);
+  InvalidateRect_(&b);
+}
+
+// Composites and presents the pending dirty rect (cf. WM_PAINT).
+static void Overlay_Paint(void) {
+  IRECT d;
+  if (!IRect_Intersect(&og.dirty, &og.client, &d)) {
+    og.dirty = (IRECT){0, 0, 0, 0};
+    return;
+  }
+  og.dirty = (IRECT){0, 0, 0, 0};
+  RENDER_SCENE sc = {0};
+  sc.fb = &og.cap.fb;
+  sc.haveSel = og.haveSel;
+  sc.sel = og.sel;
+  if (!og.haveSel && og.hover >= 0) {
+    sc.haveSel = sc.hover = 1;
+    sc.sel = g_pick.index.rects[og.hover];
+  }
+  sc.client = og.client;
+  sc.redact = &og.redact;
+  sc.annot = &og.annot;
+  sc.diff = og.diffShown ? &og.diff : NULL;
+  sc.loupe = og.loupe;
+  sc.zoom = og.zoom;
+  sc.cursorX = sc.srcX = og.pointer.x;
+  sc.cursorY = sc.srcY = og.pointer.y;
+  sc.overview = og.overview;
+  sc.overviewBox = og.overviewBox;
+  sc.mip = &og.mip;
+  if (og.overview && PtInRect(&og.overviewBox, og.pointer))
+    Render_OverviewToFrame(&og.overviewBox, &og.cap.fb, &sc.srcX, &sc.srcY);
+  og.paintPixels = Render_Frame(&sc, &og.back.image, &d, 1);
+  og.paintPixelsTotal += og.paintPixels;
+  og.paints++;
+  X11Image_Put(g_dpy, og.win, og.gc, &og.back, &d);
+  XSync(g_dpy, False); // the server has read the back buffer
+  long long now = Clock_Ns();
+  FrameClock_Presented(&og.clock, now);
+  if (!og.firstFrameNs)
+    og.firstFrameNs = now - og.tLaunch;
+  if (og.completePending) {
+    og.completePending = 0;
+    og.completeNs = now - og.tLaunch;
+  }
+}
+
+static void Overlay_SetCursor(int c) {
+  if (c == og.cursor)
+    return;
+  og.cursor = c;
+  XDefineCursor(g_dpy, og.win, og.cursors[c]);
+}
+
+// The dragged corner pulled onto the nearest edge within reach; each axis
+// snaps on its own, the row first so a corner can land on both.
+static POINT Overlay_Snap(POINT p) {
+  if (og.noSnap || !og.snapDist)
+    return p;
+  int y = Edges_SnapY(&og.edges, p.x, p.y, og.snapDist);
+  int x = Edges_SnapX(&og.edges, p.x, y, og.snapDist);
+  if (x == p.x)
+    x = Edges_SnapX(&og.edges, p.x, p.y, og.snapDist);
+  return (POINT){x, y};
+}
+
+// The region being drawn spans its start and p, inside the selection; only
+// what its move uncovers or exposes is filtered again.
+static void Overlay_RedactDrag(POINT p) {
+  int i = og.redact.n - 1;
+  IRECT s = og.sel, r = {og.redactStart.x, og.redactStart.y, p.x, p.y};
+  IRECT old = og.redact.region[i].rect;
+  IRect_Normalize(&s);
+  IRect_Normalize(&r);
+  if (!IRect_Intersect(&r, &s, &r))
+    r = (IRECT){0, 0, 0, 0};
+  Redact_Update(&og.redact, i, &og.cap.fb, &r);
+  InvalidateRect_(&old);
+  InvalidateRect_(&og.redact.region[i].rect);
+  Annot_Invalidate(&og.annot, &old); // annotated tiles show the redaction
+  Annot_Invalidate(&og.annot, &og.redact.region[i].rect);
+}
+
+static void Overlay_PopRedact(void) {
+  IRECT r = og.redact.region[og.redact.n - 1].rect;
+  Redact_Pop(&og.redact);
+  InvalidateRect_(&r);
+  Annot_Invalidate(&og.annot, &r);
+}
+
+// Replaces annotation i and repaints what it covered and what it covers.
+static void Overlay_SetAnnot(int i, const ANNOTATION *a) {
+  IRECT old = og.annot.bounds[i];
+  Annot_Set(&og.annot, i, a);
+  InvalidateRect_(&old);
+  InvalidateRect_(&og.annot.bounds[i]);
+}
+
+static void Overlay_PopAnnot(void) {
+  IRECT r = og.annot.bounds[og.annot.n - 1];
+  Annot_Pop(&og.annot);
+  InvalidateRect_(&r);
+}
+
+// A label left empty goes away.
+static void Overlay_EndTyping(void) {
+  if (og.typing < 0)
+    return;
+  if (!og.annot.item[og.typing].len && og.typing == og.annot.n - 1)
+    Overlay_PopAnnot();
+  og.typing = -1;
+}
+
+// Appends a printable character to the label, or deletes its last one.
+static void Overlay_Type(int ch) {
+  ANNOTATION a = og.annot.item[og.typing];
+  if (ch == '\b' && a.len > 0)
+    a.len--;
+  else if (ch >= 32 && ch < 127 && a.len < ANNOT_TEXT_MAX)
+    a.text[a.len++] = (char)ch;
+  else
+    return;
+  Overlay_SetAnnot(og.typing, &a);
+}
+
+// A new annotation of the current tool at p: shapes grow as the drag goes
+// on, a label starts taking keys.
+static void Overlay_StartAnnot(POINT p) {
+  ANNOTATION a;
+  memset(&a, 0, sizeof(a));
+  a.kind = og.tool;
+  a.x0 = a.x1 = p.x;
+  a.y0 = a.y1 = p.y;
+  a.color = og.tool == ANNOT_MARK ? ANNOT_HIGHLIGHT : ANNOT_COLOR;
+  int i = Annot_Add(&og.annot, &og.cap.fb, &a);
+  if (i < 0)
+    return;
+  InvalidateRect_(&og.annot.bounds[i]);
+  if (og.tool == ANNOT_TEXT)
+    og.typing = i;
+  else
+    og.annotating = 1;
+}
+
+static void Overlay_AnnotDrag(POINT p) {
+  ANNOTATION a = og.annot.item[og.annot.n - 1];
+  a.x1 = p.x;
+  a.y1 = p.y;
+  Overlay_SetAnnot(og.annot.n - 1, &a);
+}
+
+// The brush and the annotation tools take turns on a drag inside the
+// selection, so picking one drops the other.
+static void Overlay_CycleBrush(void) {
+  Overlay_EndTyping();
+  og.brush = og.brush + 1 < REDACT_MODES ? og.brush + 1 : -1;
+  og.tool = -1;
+  if (g_verbose)
+    fprintf(stderr, "screenshot: redaction brush %s\n",
+            Redact_ModeName(og.brush));
+}
+
+static void Overlay_SetTool(int tool) {
+  Overlay_EndTyping();
+  og.tool = og.tool == tool ? -1 : tool;
+  og.brush = -1;
+  if (g_verbose)
+    fprintf(stderr, "screenshot: annotation tool %s\n",
+            Annot_KindName(og.tool));
+}
+
+// Selection update for one (coalesced) drag position.
+static void Overlay_ApplyDrag(POINT p) {
+  if (og.redacting) {
+    Overlay_RedactDrag(p);
+    return;
+  }
+  if (og.annotating) {
+    Overlay_AnnotDrag(p);
+    return;
+  }
+  if (og.selecting || og.resizing)
+    p = Overlay_Snap(p);
+  if (og.selecting) {
+    IRECT old = og.sel;
+    og.sel = (IRECT){og.dragStart.x, og.dragStart.y, p.x, p.y};
+    InvalidateSelChange(old, og.sel);
+  } else if (og.resizing) {
+    IRECT old = og.sel;
+    ResizeRobust(&og.activeHandle, p, &og.resizeAnchor, &og.sel);
+    og.sel.left = MAX(og.sel.left, og.client.left);
+    og.sel.top = MAX(og.sel.top, og.client.top);
+    og.sel.right = MIN(og.sel.right, og.client.right);
+    og.sel.bottom = MIN(og.sel.bottom, og.client.bottom);
+    InvalidateSelChange(old, og.sel);
+  } else if (og.moving) {
+    IRECT old = og.sel, s = og.sel;
+    IRect_Normalize(&s);
+    int w = RectW(&s), h = RectH(&s);
+    int nl = p.x - og.moveOffset.x, nt = p.y - og.moveOffset.y;
+    nl = MAX(nl, og.client.left);
+    nt = MAX(nt, og.client.top);
+    if (nl + w > og.client.right)
+      nl = og.client.right - w;
+    if (nt + h > og.client.bottom)
+      nt = og.client.bottom - h;
+    og.sel = (IRECT){nl, nt, nl + w, nt + h};
+    InvalidateSelChange(old, og.sel);
+  }
+}
+
+static void Overlay_PumpFrame(void) {
+  POINTER_EVENT e;
+  if (FrameClock_Due(&og.clock, Clock_Ns()) == 0 &&
+      FrameClock_Take(&og.clock, Clock_Ns(), &e))
+    Overlay_ApplyDrag((POINT){e.x, e.y});
+}
+
+// --- Window pick ---
+
+static void WindowPick_Worker(void *arg) {
+  (void)arg;
+  long long t0 = Clock_Ns();
+  IRECT *rects = NULL, *v = &g_pick.virt;
+  int n = PickX11_List(g_pick.dpy, g_pick.skip, &rects);
+  for (int i = 0; i < n; i++)
+    rects[i] = (IRECT){rects[i].left - v->left, rects[i].top - v->top,
+                       rects[i].right - v->left, rects[i].bottom - v->top};
+  g_pick.windows = n;
+  g_pick.listNs = Clock_Ns() - t0;
+  IRECT bounds = {0, 0, RectW(v), RectH(v)};
+  Pick_Build(&g_pick.index, rects, n, &bounds);
+  free(rects);
+  Atomic_Store(&g_pick.ready, 1);
+}
+
+static void WindowPick_Stop(void) {
+  if (g_pick.threaded)
+    Thread_Join(g_pick.thread);
+  g_pick.threaded = 0;
+  Atomic_Store(&g_pick.ready, 0);
+  Pick_Free(&g_pick.index);
+}
+
+// Lists the windows under the overlay (root area virt) in the background.
+static void WindowPick_Start(const IRECT *virt) {
+  WindowPick_Stop();
+  if (!g_pick.dpy) {
+    if (!(g_pick.dpy = XOpenDisplay(DisplayString(g_dpy))))
+      return;
+    // Windows can go away while the worker queries them; errors on its
+    // connection are dropped.
+    X11Error_Ignore(g_pick.dpy);
+  }
+  g_pick.skip = og.win;
+  g_pick.virt = *virt;
+  g_pick.threaded = Thread_Start(&g_pick.thread, WindowPick_Worker, NULL);
+  if (!g_pick.threaded)
+    WindowPick_Worker(NULL);
+}
+
+// The window under p, while nothing is selected and the list is ready.
+static int WindowPick_Hit(POINT p) {
+  if (og.haveSel || !Atomic_Load(&g_pick.ready))
+    return -1;
+  return Pick_Hit(&g_pick.index, p.x, p.y);
+}
+
+static void Overlay_Hover(int hover) {
+  if (hover == og.hover)
+    return;
+  for (int i = 0; i < 2; i++) {
+    int h = i ? hover : og.hover;
+    if (h < 0)
+      continue;
+    IRECT b = Render_SelBounds(&g_pick.index.rects[h], &og.client);
+    InvalidateRect_(&b);
+  }
+  og.hover = hover;
+}
+
+// --- Loupe & overview ---
+
+static void Overlay_InvalidateLoupe(void) {
+  if (!og.loupe)
+    return;
+  IRECT b = Render_LoupeBox(og.pointer.x, og.pointer.y, og.zoom, &og.client);
+  InvalidateRect_(&b);
+}
+
+static void Overlay_MoveLoupe(POINT p) {
+  if (p.x == og.pointer.x && p.y == og.pointer.y)
+    return;
+  Overlay_InvalidateLoupe();
+  og.pointer = p;
+  Overlay_InvalidateLoupe();
+}
+
+static void Overlay_SetZoom(int zoom) {
+  zoom = MAX(RENDER_ZOOM_MIN, MIN(zoom, RENDER_ZOOM_MAX));
+  Overlay_InvalidateLoupe();
+  og.zoom = zoom;
+  Overlay_InvalidateLoupe();
+}
+
+// The overview shows up over the monitor under the cursor and hides the
+// selection decorations while it is up.
+static void Overlay_ToggleOverview(void) {
+  if (!og.overview) {
+    const FRAMEBUFFER *fb = &og.cap.fb;
+    IRECT area = og.client;
+    for (int i = 0; i < fb->ntiles; i++)
+      if (PtInRect(&fb->tiles[i].area, og.pointer))
+        area = fb->tiles[i].area;
+    Mip_Wait(&og.mip);
+    og.overviewBox = Render_OverviewBox(fb, &area);
+  }
+  Overlay_Hover(-1);
+  og.overview = !og.overview;
+  IRECT b = og.overviewBox;
+  b.left--, b.top--, b.right++, b.bottom++;
+  InvalidateRect_(&b);
+  if (og.haveSel) {
+    b = Render_SelBounds(&og.sel, &og.client);
+    InvalidateRect_(&b);
+  }
+  Overlay_InvalidateLoupe();
+}
+
+// Compares with the previous session's frame on first use, once this
+// session's copy is done.
+static void Overlay_ToggleDiff(void) {
+  const DIFF_KEEP *prev = &og.keep[og.cur ^ 1], *now = &og.keep[og.cur];
+  if (!og.diffDone) {
+    Diff_KeepWait(&og.keep[og.cur]);
+    if (!prev->img.px || !now->img.px) {
+      if (g_verbose)
+        fprintf(stderr, "screenshot: no previous capture to compare\n");
+      return;
+    }
+    if (!Diff_Compare(&og.diff, &prev->img, &now->img, 0))
+      return;
+    og.diffDone = 1;
+    if (g_verbose) {
+      const DIFF_STATS *ds = &og.diff.stats;
+      fprintf(stderr,
+              "screenshot: diff with the previous capture: %d regions, "
+              "%llu px changed, %d/%d tiles identical, compare %.2f ms, "
+              "merge %.3f ms\n",
+              og.diff.n, ds->pixels, ds->identical, ds->tiles,
+              ds->compareNs / 1e6, ds->mergeNs / 1e6);
+    }
+  }
+  og.diffShown = !og.diffShown;
+  InvalidateRect_(&og.client);
+}
+
+// The selection as a crop the clipboard and the export queue can share.
+static EXPORT_IMAGE *Overlay_CropSelection(void) {
+  if (!og.haveSel)
+    return NULL;
+  IRECT s = og.sel;
+  IRect_Normalize(&s);
+  if (RectW(&s) <= 0 || RectH(&s) <= 0)
+    return NULL;
+  IMAGE crop;
+  if (!Framebuffer_Crop(&og.cap.fb, &s, &crop))
+    return NULL;
+  // every export goes through here: redacted pixels never leave raw, and
+  // the annotations are drawn in once
+  IRECT c = {0, 0, og.cap.fb.w, og.cap.fb.h};
+  IRect_Intersect(&s, &c, &c);
+  Redact_Apply(&og.redact, &crop, c.left, c.top, &c);
+  Annot_Flatten(&og.annot, &crop, c.left, c.top, &c);
+  EXPORT_IMAGE *ei = ExportImage_Wrap(&crop);
+  if (!ei)
+    Image_Free(&crop);
+  return ei;
+}
+
+// --- Capture history ---
+// Every copied or saved crop is also added to the history store, as one
+// more job on the export worker; the store is opened there on first use
+// and never touched from anywhere else.
+
+static HISTORY g_history;
+static volatile long g_historyState; // 0 not opened yet, 1 open, -1 off
+
+// Runs on the export worker.
+static void ArchiveDone(EXPORT_JOB *job, int ok) {
+  (void)ok;
+  if (Atomic_Load(&g_historyState) == 0) {
+    char dir[HISTORY_PATH_MAX];
+    int on = History_Dir(dir, sizeof(dir)), opened = 0;
+    if (on && !(opened = History_Open(&g_history, dir, 1)))
+      fprintf(stderr, "screenshot: cannot open history in %s\n", dir);
+    Atomic_Store(&g_historyState, opened ? 1 : -1);
+  }
+  if (Atomic_Load(&g_historyState) < 0)
+    return;
+  HISTORY_STATS before = g_history.stats;
+  int id = History_Add(&g_history, &job->image->img, (int64_t)time(NULL));
+  if (id < 0) {
+    fprintf(stderr, "screenshot: cannot add to history in %s\n",
+            g_history.dir);
+  } else if (g_verbose) {
+    char desc[256];
+    History_Describe(&g_history, &before, desc, sizeof(desc));
+    fprintf(stderr, "screenshot: history #%d, %s\n", id, desc);
+  }
+}
+
+// Queues ei (whose reference it takes) for the history.
+static void ArchiveCapture(EXPORT_IMAGE *ei) {
+  if (Atomic_Load(&g_historyState) < 0) {
+    ExportImage_Release(ei);
+    return;
+  }
+  EXPORT_JOB job = {0};
+  job.image = ei;
+  job.done = ArchiveDone;
+  Export_Submit(&job);
+}
+
+static int CopySelectionToClipboard(Time t) {
+  EXPORT_IMAGE *ei = Overlay_CropSelection();
+  if (!ei)
+    return 0;
+  int ok = X11Clip_Set(ei, t);
+  ArchiveCapture(ei);
+  return ok;
+}
+
+// ~/Pictures/<prefix>-YYYYMMDD-HHMMSS.<ext>, or the home directory
+// without a Pictures folder.
+static void SavePath(char *path, size_t n, const char *prefix,
+                     const char *ext) {
+  const char *home = getenv("HOME");
+  char dir[4096];
+  struct stat sb;
+  snprintf(dir, sizeof(dir), "%s/Pictures", home ? home : ".");
+  if (stat(dir, &sb) != 0 || !S_ISDIR(sb.st_mode))
+    snprintf(dir, sizeof(dir), "%s", home ? home : ".");
+  char stamp[32];
+  time_t now = time(NULL);
+  strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", localtime(&now));
+  snprintf(path, n, "%s/%s-%s.%s", dir, prefix, stamp, ext);
+}
+
+// Runs on the export worker.
+static void SaveDone(EXPORT_JOB *job, int ok) {
+  char *path = (char *)job->ctx;
+  if (!ok) {
+    fprintf(stderr, "screenshot: cannot write %s\n", path);
+    remove(path);
+  } else if (g_verbose) {
+    char desc[256];
+    Export_Describe(&job->stats, desc, sizeof(desc));
+    fprintf(stderr, "screenshot: saved %s (%s, queued %.2f ms)\n", path, desc,
+            (job->startNs - job->submitNs) / 1e6);
+  }
+  free(path);
+}
+
+// Opens the file and queues the write of ei (whose reference it takes); the
+// overlay can close right away.
+static int SaveImageToFile(EXPORT_IMAGE *ei, const char *prefix) {
+  EXPORT_JOB job = {0};
+  job.format = Export_Format();
+  char path[4200];
+  SavePath(path, sizeof(path), prefix, Export_Extension(job.format));
+  if (!(job.image = ei))
+    return 0;
+  job.file = fopen(path, "wb");
+  job.ctx = strdup(path);
+  if (!job.file || !job.ctx) {
+    fprintf(stderr, "screenshot: cannot write %s\n", path);
+    if (job.file)
+      fclose(job.file);
+    free(job.ctx);
+    ExportImage_Release(job.image);
+    return 0;
+  }
+  job.done = SaveDone;
+  ExportImage_Retain(ei);
+  Export_Submit(&job);
+  ArchiveCapture(ei);
+  return 1;
+}
+
+static int SaveSelectionToFile(void) {
+  return SaveImageToFile(Overlay_CropSelection(), "screenshot");
+}
+
+// Normalizes r (root coordinates) and clips it to the root window. Returns 0
+// if nothing is left.
+static int ClipToRoot(Display *dpy, IRECT *r) {
+  int scr = DefaultScreen(dpy);
+  IRECT root = {0, 0, DisplayWidth(dpy, scr), DisplayHeight(dpy, scr)};
+  IRect_Normalize(r);
+  return IRect_Intersect(r, &root, r);
+}
+
+// The selection in root coordinates.
+static IRECT Overlay_ScreenSelection(void) {
+  IRECT s = og.sel;
+  IRect_Normalize(&s);
+  s.left += og.virt.left;
+  s.right += og.virt.left;
+  s.top += og.virt.top;
+  s.bottom += og.virt.top;
+  return s;
+}
+
+// Runs on the recorder's capture thread.
+static int Recording_Grab(void *ctx, IMAGE *dst) {
+  REC_GRAB *g = (REC_GRAB *)ctx;
+  if (!X11Image_Get(g->dpy, DefaultRootWindow(g->dpy), g->x, g->y, &g->img))
+    return 0;
+  for (int y = 0; y < dst->h; y++)
+    memcpy(IMAGE_ROW(dst, y), IMAGE_ROW(&g->img.image, y),
+           (size_t)dst->w * 4);
+  return 1;
+}
+
+static void Recording_CloseGrab(REC_GRAB *g) {
+  if (!g->dpy)
+    return;
+  X11Image_Destroy(g->dpy, &g->img);
+  XCloseDisplay(g->dpy);
+  g->dpy = NULL;
+}
+
+// Starts recording r (root coordinates, clipped to the root window) from
+// display `name` into f. Returns NULL, with nothing left open but f, if the
+// region is empty or the grab connection or recorder cannot be set up.
+static RECORDER *Recording_Start(const char *name, IRECT r, FILE *f,
+                                 RECORD_FORMAT fmt, int fps,
+                                 unsigned long long maxTicks, REC_GRAB *g) {
+  memset(g, 0, sizeof(*g));
+  if (!(g->dpy = XOpenDisplay(name)))
+    return NULL;
+  RECORDER *rec = NULL;
+  if (ClipToRoot(g->dpy, &r) &&
+      X11Image_Create(g->dpy, RectW(&r), RectH(&r), &g->img)) {
+    g->x = r.left;
+    g->y = r.top;
+    RECORD_CONFIG cfg = {fmt, RectW(&r), RectH(&r), fps, maxTicks,
+                         Recording_Grab, g};
+    rec = Record_Start(f, &cfg);
+  }
+  if (!rec)
+    Recording_CloseGrab(g);
+  return rec;
+}
+
+static int Recording_Finish(RECORDER *rec, REC_GRAB *g, FILE *f,
+                            const char *path, int verbose) {
+  RECORD_STATS st;
+  int ok = Record_Stop(rec, &st);
+  Recording_CloseGrab(g);
+  if (f != stdout && fclose(f) != 0)
+    ok = 0;
+  else if (f == stdout && fflush(f) != 0)
+    ok = 0;
+  if (!ok)
+    fprintf(stderr, "screenshot: cannot write %s\n", path);
+  if (verbose || !ok) {
+    char desc[512];
+    Record_Describe(&st, desc, sizeof(desc));
+    fprintf(stderr, "screenshot: recorded %s (%.1f MB): %s\n", path,
+            st.fileBytes / 1e6, desc);
+  }
+  return ok;
+}
+
+// The selection, on screen, once the overlay is gone.
+static int Overlay_StartRecording(void) {
+  if (!og.haveSel || g_rec.rec)
+    return 0;
+  IRECT s = Overlay_ScreenSelection();
+  RECORD_FORMAT fmt = Record_Format();
+  SavePath(g_rec.path, sizeof(g_rec.path), "recording",
+           Record_Extension(fmt));
+  if (!(g_rec.f = fopen(g_rec.path, "wb"))) {
+    fprintf(stderr, "screenshot: cannot write %s\n", g_rec.path);
+    return 0;
+  }
+  g_rec.rec = Recording_Start(DisplayString(g_dpy), s, g_rec.f, fmt,
+                              Record_Fps(), 0, &g_rec.grab);
+  if (!g_rec.rec) {
+    fprintf(stderr, "screenshot: cannot record the selection\n");
+    fclose(g_rec.f);
+    remove(g_rec.path);
+    return 0;
+  }
+  if (g_verbose)
+    fprintf(stderr, "screenshot: recording to %s, PrintScreen stops\n",
+            g_rec.path);
+  return 1;
+}
+
+static void Overlay_StopRecording(void) {
+  if (!g_rec.rec)
+    return;
+  if (!Recording_Finish(g_rec.rec, &g_rec.grab, g_rec.f, g_rec.path,
+                        g_verbose))
+    remove(g_rec.path);
+  g_rec.rec = NULL;
+}
+
+// Grabs the first frame of a scrolling capture of the selection.
+static int Overlay_StartScroll(void) {
+  IRECT r = Overlay_ScreenSelection();
+  if (!og.haveSel || g_scroll.active || !ClipToRoot(g_dpy, &r) ||
+      !X11Image_Create(g_dpy, RectW(&r), RectH(&r), &g_scroll.img))
+    return 0;
+  g_scroll.x = r.left;
+  g_scroll.y = r.top;
+  if (!X11Image_Get(g_dpy, DefaultRootWindow(g_dpy), r.left, r.top,
+                    &g_scroll.img) ||
+      !Stitch_Begin(&g_scroll.st, &g_scroll.img.image)) {
+    X11Image_Destroy(g_dpy, &g_scroll.img);
+    fprintf(stderr, "screenshot: cannot start a scrolling capture\n");
+    return 0;
+  }
+  g_scroll.active = 1;
+  g_scroll.next = Clock_Ns() + STITCH_INTERVAL_MS * 1000000LL;
+  if (g_verbose)
+    fprintf(stderr, "screenshot: scrolling capture of %dx%d, scroll the "
+                    "content, PrintScreen saves\n",
+            RectW(&r), RectH(&r));
+  return 1;
+}
+
+static void Overlay_FinishScroll(void) {
+  if (!g_scroll.active)
+    return;
+  g_scroll.active = 0;
+  X11Image_Destroy(g_dpy, &g_scroll.img);
+  STITCH_STATS st = g_scroll.st.st;
+  IMAGE out;
+  if (!Stitch_Finish(&g_scroll.st, &out)) {
+    fprintf(stderr, "screenshot: scrolling capture ran out of memory\n");
+    return;
+  }
+  if (g_verbose) {
+    double n = st.frames > 1 ? (double)(st.frames - 1) : 1;
+    fprintf(stderr,
+            "screenshot: stitched %dx%d from %llu frames (%llu unchanged, "
+            "%llu skipped), per frame hash %.2f ms, align %.2f ms, verify "
+            "%.2f ms, worst %.2f ms\n",
+            out.w, out.h, st.frames, st.unchanged, st.skipped,
+            st.hashNs / 1e6 / n, st.alignNs / 1e6 / n, st.verifyNs / 1e6 / n,
+            st.alignMaxNs / 1e6);
+  }
+  EXPORT_IMAGE *ei = ExportImage_Wrap(&out);
+  if (!ei)
+    Image_Free(&out);
+  SaveImageToFile(ei, "scroll");
+}
+
+// Adds the next frame when it is due. Returns nanoseconds until the one
+// after.
+static long long Overlay_ScrollStep(long long now) {
+  if (now >= g_scroll.next) {
+    int r = STITCH_SKIPPED;
+    if (X11Image_Get(g_dpy, DefaultRootWindow(g_dpy), g_scroll.x, g_scroll.y,
+                     &g_scroll.img))
+      r = Stitch_Add(&g_scroll.st, &g_scroll.img.image);
+    if (r == STITCH_FULL) {
+      Overlay_FinishScroll();
+      return -1;
+    }
+    g_scroll.next = now + STITCH_INTERVAL_MS * 1000000LL;
+  }
+  return g_scroll.next - now;
+}
+
+static void Overlay_LogStats(void) {
+  if (!g_verbose)
+    return;
+  const FRAME_CLOCK *fc = &og.clock;
+  const FRAMEBUFFER *fb = &og.cap.fb;
+  double mp = Framebuffer_Bytes(fb) / 4e6;
+  long long avg = fc->presents ? fc->latencySum / (long long)fc->presents : 0;
+  const char *src = og.cap.adopted ? "shadow"
+                    : og.cap.shm   ? "MIT-SHM"
+                                   : "XGetImage";
+  fprintf(stderr,
+          "screenshot: capture %.2f ms (%.2f ms/MP, %s, %d monitor(s)%s, "
+          "%.1f of %.1f MP stored), %u paints, %llu px composited, last "
+          "%llu px; %llu drag events -> %llu updates, input-to-photon avg "
+          "%.2f ms max %.2f ms\n",
+          og.cap.grabNs / 1e6, mp > 0 ? og.cap.grabNs / 1e6 / mp : 0.0,
+          src, fb->ntiles,
+          og.cap.serial ? " serial" : "", mp, (double)fb->w * fb->h / 1e6,
+          og.paints,
+          (unsigned long long)og.paintPixelsTotal,
+          (unsigned long long)og.paintPixels, fc->events, fc->updates,
+          avg / 1e6, fc->latencyMax / 1e6);
+  const FB_PACK_STATS *ps = Framebuffer_PackStats(fb);
+  if (ps)
+    fprintf(stderr,
+            "screenshot: packed %.1f MB -> %.1f MB in %.2f ms, cache %.1f MB, "
+            "%llu block faults avg %.3f ms, longest stall %.2f ms\n",
+            ps->rawBytes / 1e6, ps->packedBytes / 1e6, ps->packNs / 1e6,
+            ps->cacheBytes / 1e6, ps->faults,
+            ps->faults ? ps->faultNs / 1e6 / (double)ps->faults : 0.0,
+            ps->faultMaxNs / 1e6);
+  fprintf(stderr,
+          "screenshot: hotkey-to-first-frame %.2f ms, "
+          "hotkey-to-complete-frame %.2f ms\n",
+          og.firstFrameNs / 1e6, og.completeNs / 1e6);
+  const POOL_STATS *pl = &g_pool;
+  long long missAvg = pl->misses ? pl->missNs / (long long)pl->misses : 0;
+  fprintf(stderr,
+          "screenshot: pool %s (%u hits, %u misses), setup %.2f ms, "
+          "saved %.2f ms\n",
+          pl->lastHit ? "hit" : "miss", pl->hits, pl->misses,
+          pl->setupNs / 1e6,
+          pl->lastHit && missAvg > pl->setupNs
+              ? (missAvg - pl->setupNs) / 1e6
+              : 0.0);
+  if (g_shadow.dpy) {
+    const SHADOW_STATS *ss = &g_shadow.stats;
+    double idle = ss->idleNs / 1e9;
+    fprintf(stderr,
+            "screenshot: shadow %s, idle CPU %.2f%%, damage %.1f KB/s "
+            "(%llu rects, %llu refreshes, %llu copy-on-write tiles)\n",
+            og.cap.adopted ? "in sync" : "behind, grabbed instead",
+            idle > 0 ? ss->idleCpuNs / 1e7 / idle : 0.0,
+            idle > 0 ? ss->damageBytes / 1e3 / idle : 0.0, ss->damageRects,
+            ss->refreshes, ss->cowCopies);
+  }
+  if (Atomic_Load(&g_pick.ready)) {
+    const PICK_STATS *pick = &g_pick.index.stats;
+    fprintf(stderr,
+            "screenshot: window pick %d windows listed in %.2f ms, indexed "
+            "in %.3f ms (%zu cell entries, longest %d)\n",
+            g_pick.windows, g_pick.listNs / 1e6, pick->buildNs / 1e6,
+            pick->entries, pick->longest);
+  }
+  if (og.redact.stats.updates) {
+    const REDACT_STATS *rs = &og.redact.stats;
+    fprintf(stderr,
+            "screenshot: redaction %d regions, %llu updates (last %.2f ms, "
+            "max %.2f ms), %.1f Mpx filtered\n",
+            og.redact.n, rs->updates, rs->lastNs / 1e6, rs->maxNs / 1e6,
+            rs->pixels / 1e6);
+  }
+  if (og.annot.stats.edits) {
+    const ANNOT_STATS *as = &og.annot.stats;
+    fprintf(stderr,
+            "screenshot: annotations %d, %llu edits, %llu tiles drawn in "
+            "%.2f ms, tile cache %.1f MB\n",
+            og.annot.n, as->edits, as->tilesDrawn, as->drawNs / 1e6,
+            as->cacheBytes / 1e6);
+  }
+  Diff_KeepWait(&og.keep[og.cur]);
+  if (og.keep[og.cur].img.px)
+    fprintf(stderr, "screenshot: frame kept for the next diff in %.2f ms\n",
+            og.keep[og.cur].copyNs / 1e6);
+  if (Mip_Ready(&og.mip))
+    fprintf(stderr,
+            "screenshot: mip pyramid %.2f ms, %d levels from 1/%d, %.1f MB\n",
+            og.mip.stats.buildNs / 1e6, og.mip.n, 1 << og.mip.first,
+            og.mip.stats.bytes / 1e6);
+  if (og.snapDist) {
+    Edges_Wait(&og.edges);
+    const EDGE_STATS *es = &og.edges.stats;
+    fprintf(stderr,
+            "screenshot: edge index %.2f ms (gradient %.2f, runs %.2f, "
+            "tables %.2f), %zu vertical / %zu horizontal edge px%s\n",
+            es->totalNs / 1e6, es->gradientNs / 1e6, es->runsNs / 1e6,
+            es->tablesNs / 1e6, es->vertical, es->horizontal,
+            es->dropped ? ", an axis dropped" : "");
+  }
+  fprintf(stderr, "screenshot: peak RSS %.1f MB\n", Mem_PeakRss() / 1e6);
+}
+
+static void Overlay_LogConfirm(const char *what, long long t0) {
+  if (!g_verbose)
+    return;
+  EXPORT_QUEUE_STATS q;
+  Export_QueueStats(&q);
+  fprintf(stderr,
+          "screenshot: %s keypress-to-close %.2f ms, clipboard holds %.1f MB, "
+          "export queue %llu/%llu done (%llu stalls, %.2f ms; wait p50 %.2f "
+          "p99 %.2f max %.2f ms, done p50 %.2f p99 %.2f max %.2f ms), peak "
+          "RSS %.1f MB\n",
+          what, (Clock_Ns() - t0) / 1e6, X11Clip_HeldBytes() / 1e6,
+          q.completed, q.submitted, q.stalls, q.stallNs / 1e6,
+          q.waitP50 / 1e6, q.waitP99 / 1e6, q.waitMax / 1e6, q.doneP50 / 1e6,
+          q.doneP99 / 1e6, q.doneMax / 1e6, Mem_PeakRss() / 1e6);
+}
+
+static void Overlay_DrainWake(void) {
+  DIM_BAND_MSG m;
+  while (read(g_wake[0], &m, sizeof(m)) == (ssize_t)sizeof(m))
+    ;
+}
+
+// Ends the session; the surfaces stay allocated for the next activation.
+static void Overlay_Close(void) {
+  if (!og.active)
+    return;
+  Overlay_LogStats();
+  XUngrabPointer(g_dpy, CurrentTime);
+  XUngrabKeyboard(g_dpy, CurrentTime);
+  XUnmapWindow(g_dpy, og.win);
+  WindowPick_Stop();
+  Edges_Free(&og.edges); // before the grab it reads goes away
+  Mip_Free(&og.mip);
+  Diff_KeepWait(&og.keep[og.cur]);
+  Redact_Clear(&og.redact);
+  Annot_Clear(&og.annot);
+  Framebuffer_Reset(&og.cap.fb); // joins the dim worker
+  X11Shadow_Release(&g_shadow);
+  X11Shadow_Pause(&g_shadow, 0);
+  og.active = 0;
+  XFlush(g_dpy);
+  Overlay_DrainWake();
+}
+
+static void Overlay_DestroySurface(void) {
+  if (!og.win)
+    return;
+  XDestroyWindow(g_dpy, og.win);
+  XFreeGC(g_dpy, og.gc);
+  for (int i = 0; i < CUR_COUNT; i++)
+    XFreeCursor(g_dpy, og.cursors[i]);
+  X11Image_Destroy(g_dpy, &og.back);
+  og.win = 0;
+}
+
+// Frees everything the pool holds, e.g. after the screen was reconfigured.
+static void Overlay_ReleasePool(void) {
+  WindowPick_Stop();
+  if (g_pick.dpy) {
+    X11Error_Forget(g_pick.dpy);
+    XCloseDisplay(g_pick.dpy);
+  }
+  g_pick.dpy = NULL;
+  Overlay_DestroySurface();
+  X11Capture_Release(&og.cap);
+  X11Shadow_Release(&g_shadow);
+  X11Shadow_Pause(&g_shadow, 0);
+  XFlush(g_dpy);
+  Overlay_DrainWake();
+}
+
+// Runs on the dim worker. Completion is g_dimDone, set before the last
+// message, so a full pipe only drops repaint hints: a pipe too full to take
+// a message is readable, and the event loop wakes and sees the flag anyway.
+static void Overlay_DimNotify(void *ctx, int tile, int top, int bottom) {
+  (void)ctx;
+  DIM_BAND_MSG m = {tile, top, bottom};
+  if (tile < 0)
+    Atomic_Store(&g_dimDone, 1);
+  while (write(g_wake[1], &m, sizeof(m)) < 0 && errno == EINTR)
+    ;
+}
+
+static void Overlay_DimProgress(void) {
+  DIM_BAND_MSG m;
+  while (read(g_wake[0], &m, sizeof(m)) == (ssize_t)sizeof(m)) {
+    if (!og.active || m.tile < 0)
+      continue;
+    const FRAMEBUFFER *fb = &og.cap.fb;
+    const IRECT *a = &fb->tiles[m.tile].area;
+    IRECT r = {a->left - fb->virt.left, a->top - fb->virt.top + m.top,
+               a->right - fb->virt.left, a->top - fb->virt.top + m.bottom};
+    InvalidateRect_(&r);
+  }
+  if (og.active && !og.prepared && Atomic_Load(&g_dimDone)) {
+    og.prepared = 1;
+    Framebuffer_Finish(&og.cap.fb);
+    Edges_Wait(&og.edges); // these read the raw grab too
+    Mip_Wait(&og.mip);
+    Diff_KeepWait(&og.keep[og.cur]);
+    X11Capture_Trim(&og.cap); // packed: the raw grab is no longer read
+    InvalidateRect_(&og.client);
+    og.completePending = 1;
+  }
+}
+
+// Override-redirect window over fb->virt, its back buffer and cursors.
+static int Overlay_CreateSurface(const FRAMEBUFFER *fb) {
+  if (!X11Image_Create(g_dpy, fb->w, fb->h, &og.back))
+    return 0;
+  og.virt = fb->virt;
+  og.client = (IRECT){0, 0, fb->w, fb->h};
+
+  static const unsigned shapes[CUR_COUNT] = {
+      XC_crosshair,       XC_sb_v_double_arrow, XC_sb_h_double_arrow,
+      XC_top_left_corner, XC_top_right_corner,  XC_fleur};
+  for (int i = 0; i < CUR_COUNT; i++)
+    og.cursors[i] = XCreateFontCursor(g_dpy, shapes[i]);
+
+  Window root = DefaultRootWindow(g_dpy);
+  XSetWindowAttributes wa = {0};
+  wa.override_redirect = True;
+  wa.background_pixmap = None;
+  wa.cursor = og.cursors[CUR_CROSS];
+  wa.event_mask = ExposureMask | KeyPressMask | ButtonPressMask |
+                  ButtonReleaseMask | PointerMotionMask;
+  og.win = XCreateWindow(
+      g_dpy, root, fb->virt.left, fb->virt.top, (unsigned)fb->w,
+      (unsigned)fb->h, 0, CopyFromParent, InputOutput, CopyFromParent,
+      CWOverrideRedirect | CWBackPixmap | CWCursor | CWEventMask, &wa);
+  og.gc = XCreateGC(g_dpy, og.win, 0, NULL);
+  XStoreName(g_dpy, og.win, "CaptureOverlay");
+  og.cursor = CUR_CROSS;
+  return 1;
+}
+
+static void Overlay_BeginSession(long long tLaunch) {
+  og.active = 1;
+  og.dirty = og.client;
+  og.paintPixels = og.paintPixelsTotal = 0;
+  og.paints = 0;
+  FrameClock_Init(&og.clock, 60);
+  og.tLaunch = tLaunch;
+  og.firstFrameNs = og.completeNs = 0;
+  og.prepared = og.completePending = 0;
+  og.haveSel = og.selecting = og.resizing = og.moving = og.noSnap = 0;
+  og.redacting = og.annotating = 0;
+  og.brush = og.tool = og.typing = -1;
+  og.hover = -1;
+  og.loupe = og.overview = 0;
+  og.diffShown = og.diffDone = 0;
+  if (!og.zoom)
+    og.zoom = LOUPE_ZOOM;
+  Overlay_SetCursor(CUR_CROSS);
+}
+
+// The frozen frame: a snapshot of the resident shadow when it is in sync,
+// otherwise a full grab.
+static int Overlay_Grab(void) {
+  FRAMEBUFFER layout;
+  IMAGE tiles[FB_MAX_TILES];
+  if (X11Shadow_Snapshot(&g_shadow, &layout, tiles)) {
+    X11Capture_Adopt(g_dpy, &og.cap, &layout, tiles);
+    og.cap.grabNs = g_shadow.stats.snapshotNs;
+    return 1;
+  }
+  return X11Capture_Grab(g_dpy, &og.cap);
+}
+
+// Show the overlay over the root window, reusing the pooled surfaces while
+// the monitor layout is unchanged.
+static void LaunchOverlay(void) {
+  if (og.active)
+    return;
+  long long t0 = Clock_Ns();
+  if (!Overlay_Grab()) {
+    fprintf(stderr, "screenshot: capture failed (need a 24/32-bit "
+                    "TrueColor BGRA root visual)\n");
+    Overlay_ReleasePool();
+    return;
+  }
+  X11Shadow_Pause(&g_shadow, 1); // reads would see the overlay
+  const FRAMEBUFFER *fb = &og.cap.fb;
+  if (og.win && memcmp(&og.virt, &fb->virt, sizeof(IRECT)))
+    Overlay_DestroySurface();
+  int hit = og.win && !og.cap.reopened;
+  if (!og.win && !Overlay_CreateSurface(fb)) {
+    Overlay_ReleasePool();
+    return;
+  }
+  Overlay_BeginSession(t0);
+  // The grab above is the frozen frame; it shows undimmed until the worker
+  // reports each band.
+  Atomic_Store(&g_dimDone, 0);
+  Framebuffer_PrepareAsync(&og.cap.fb, OVERLAY_ALPHA, Overlay_DimNotify, NULL);
+  og.snapDist = Edges_SnapDistance();
+  if (og.snapDist)
+    Edges_BuildAsync(&og.edges, &og.cap.fb);
+  Mip_BuildAsync(&og.mip, &og.cap.fb);
+  og.cur ^= 1;
+  Diff_KeepAsync(&og.keep[og.cur], &og.cap.fb);
+  WindowPick_Start(&fb->virt);
+  XMapRaised(g_dpy, og.win);
+
+  g_pool.lastHit = hit;
+  g_pool.setupNs = Clock_Ns() - t0 - og.cap.grabNs;
+  if (hit) {
+    g_pool.hits++;
+  } else {
+    g_pool.misses++;
+    g_pool.missNs += g_pool.setupNs;
+  }
+
+  // The hotkey's own passive grab may still be held for a moment.
+  for (int i = 0; i < 100; i++) {
+    if (XGrabKeyboard(g_dpy, og.win, True, GrabModeAsync, GrabModeAsync,
+                      CurrentTime) == GrabSuccess)
+      break;
+    usleep(1000);
+  }
+  XGrabPointer(g_dpy, og.win, False,
+               ButtonPressMask | ButtonReleaseMask | PointerMotionMask,
+               GrabModeAsync, GrabModeAsync, None, og.cursors[CUR_CROSS],
+               CurrentTime);
+}
+
+static void Overlay_HandleEvent(XEvent *ev) {
+  switch (ev->type) {
+  case Expose: {
+    IRECT r = {ev->xexpose.x, ev->xexpose.y,
+               ev->xexpose.x + ev->xexpose.width,
+               ev->xexpose.y + ev->xexpose.height};
+    InvalidateRect_(&r);
+    break;
+  }
+  case ButtonPress: {
+    POINT p = {ev->xbutton.x, ev->xbutton.y};
+    if (ev->xbutton.button == Button3) {
+      Overlay_Close();
+      break;
+    }
+    if (ev->xbutton.button == Button4 || ev->xbutton.button == Button5) {
+      if (og.loupe)
+        Overlay_SetZoom(ev->xbutton.button == Button4 ? og.zoom * 2
+                                                      : og.zoom / 2);
+      break;
+    }
+    if (ev->xbutton.button != Button1)
+      break;
+    Overlay_EndTyping();
+    if (og.overview) {
+      // a click in the overview pans: the pointer jumps to that spot
+      IRECT b = og.overviewBox;
+      Overlay_ToggleOverview();
+      if (PtInRect(&b, p)) {
+        Render_OverviewToFrame(&b, &og.cap.fb, &p.x, &p.y);
+        XWarpPointer(g_dpy, None, og.win, 0, 0, 0, 0, p.x, p.y);
+        Overlay_MoveLoupe(p);
+      }
+      break;
+    }
+    if (og.haveSel) {
+      HANDLE_ID h = HitTest(&og.sel, p);
+      if (h != HT_NONE) {
+        og.resizing = 1;
+        og.selecting = og.moving = 0;
+        og.activeHandle = h;
+        og.resizeAnchor = og.sel;
+        break;
+      }
+      IRECT s = og.sel;
+      IRect_Normalize(&s);
+      if (PtInRect(&s, p) && og.tool >= 0) {
+        og.selecting = og.resizing = og.moving = 0;
+        Overlay_StartAnnot(p);
+        break;
+      }
+      if (PtInRect(&s, p) && og.brush >= 0) {
+        if (Redact_Add(&og.redact, og.brush) >= 0) {
+          og.redacting = 1;
+          og.selecting = og.resizing = og.moving = 0;
+          og.redactStart = p;
+        }
+        break;
+      }
+      if (PtInRect(&s, p)) {
+        og.moving = 1;
+        og.selecting = og.resizing = 0;
+        og.moveOffset.x = p.x - s.left;
+        og.moveOffset.y = p.y - s.top;
+        break;
+      }
+    }
+    // new selection; a click without a drag picks the window under it
+    Overlay_Hover(-1);
+    IRECT old = og.haveSel ? og.sel : (IRECT){p.x, p.y, p.x, p.y};
+    og.selecting = 1;
+    og.resizing = og.moving = 0;
+    og.haveSel = 1;
+    og.dragStart = p;
+    og.sel = (IRECT){p.x, p.y, p.x, p.y};
+    InvalidateSelChange(old, og.sel);
+    break;
+  }
+  case MotionNotify: {
+    POINT p = {ev->xmotion.x, ev->xmotion.y};
+    og.noSnap = (ev->xmotion.state & ShiftMask) != 0;
+    Overlay_MoveLoupe(p);
+    if (og.selecting || og.resizing || og.moving || og.redacting ||
+        og.annotating) {
+      FrameClock_Push(&og.clock, p.x, p.y, Clock_Ns());
+      break;
+    }
+    if (og.overview)
+      break;
+    Overlay_Hover(WindowPick_Hit(p));
+    int cur = CUR_CROSS;
+    if (og.haveSel) {
+      IRECT s = og.sel;
+      IRect_Normalize(&s);
+      HANDLE_ID hh = HitTest(&og.sel, p);
+      if (hh != HT_NONE)
+        cur = CursorForHandle(hh);
+      else if (PtInRect(&s, p) && og.brush < 0 && og.tool < 0)
+        cur = CUR_MOVE;
+    }
+    Overlay_SetCursor(cur);
+    break;
+  }
+  case ButtonRelease: {
+    if (ev->xbutton.button != Button1)
+      break;
+    // land the final position before the drag ends
+    og.noSnap = (ev->xbutton.state & ShiftMask) != 0;
+    POINTER_EVENT e;
+    if (FrameClock_Take(&og.clock, Clock_Ns(), &e))
+      Overlay_ApplyDrag((POINT){e.x, e.y});
+    if (og.redacting &&
+        IRect_IsEmpty(&og.redact.region[og.redact.n - 1].rect))
+      Redact_Pop(&og.redact); // a click, not a drag
+    if (og.annotating && IRect_IsEmpty(&og.annot.bounds[og.annot.n - 1]))
+      Overlay_PopAnnot();
+    og.redacting = og.annotating = 0;
+    IRect_Normalize(&og.sel);
+    if (og.selecting && RectW(&og.sel) < MIN_SEL_SIZE &&
+        RectH(&og.sel) < MIN_SEL_SIZE && Atomic_Load(&g_pick.ready)) {
+      int i = Pick_Hit(&g_pick.index, ev->xbutton.x, ev->xbutton.y);
+      if (i >= 0) {
+        IRECT old = og.sel;
+        og.sel = g_pick.index.rects[i];
+        InvalidateSelChange(old, og.sel);
+      }
+    }
+    og.selecting = og.resizing = og.moving = 0;
+    break;
+  }
+  case KeyPress: {
+    KeySym ks = XLookupKeysym(&ev->xkey, 0);
+    if (og.typing >= 0) {
+      char buf[8];
+      KeySym sym;
+      int n = XLookupString(&ev->xkey, buf, sizeof(buf), &sym, NULL);
+      if (ks == XK_Return || ks == XK_KP_Enter || ks == XK_Escape)
+        Overlay_EndTyping();
+      else if (ks == XK_BackSpace)
+        Overlay_Type('\b');
+      else if (n == 1)
+        Overlay_Type((unsigned char)buf[0]);
+      break;
+    }
+    if (ks == XK_Escape) {
+      Overlay_Close();
+    } else if (ks == XK_Return || ks == XK_KP_Enter ||
+               ((ev->xkey.state & ControlMask) && ks == XK_c)) {
+      long long t0 = Clock_Ns();
+      CopySelectionToClipboard(ev->xkey.time);
+      Overlay_Close(); // close overlay only, app keeps running
+      Overlay_LogConfirm("copy", t0);
+    } else if ((ev->xkey.state & ControlMask) && ks == XK_s) {
+      long long t0 = Clock_Ns();
+      if (SaveSelectionToFile()) {
+        Overlay_Close();
+        Overlay_LogConfirm("save", t0);
+      }
+    } else if ((ks == XK_s || ks == XK_r) && og.haveSel && og.redact.n) {
+      // both grab the live screen, which the regions do not cover: the
+      // overlay stays open until they are removed
+      fprintf(stderr, "screenshot: %s would not be redacted, remove the "
+                      "redaction regions first\n",
+              ks == XK_s ? "scrolling capture" : "recording");
+    } else if (ks == XK_s && og.haveSel) {
+      Overlay_Close();
+      XSync(g_dpy, False);
+      Overlay_StartScroll();
+    } else if (ks == XK_r && og.haveSel) {
+      // the first grabs must not see the overlay
+      Overlay_Close();
+      XSync(g_dpy, False);
+      Overlay_StartRecording();
+    } else if (ks == XK_m) {
+      Overlay_MoveLoupe((POINT){ev->xkey.x, ev->xkey.y});
+      Overlay_InvalidateLoupe();
+      og.loupe = !og.loupe;
+      Overlay_InvalidateLoupe();
+    } else if (ks == XK_z && !og.selecting && !og.resizing && !og.moving) {
+      Overlay_MoveLoupe((POINT){ev->xkey.x, ev->xkey.y});
+      Overlay_ToggleOverview();
+    } else if (ks == XK_x) {
+      Overlay_CycleBrush();
+    } else if (ks == XK_d) {
+      Overlay_ToggleDiff();
+    } else if (ks == XK_a || ks == XK_b || ks == XK_h || ks == XK_t) {
+      Overlay_SetTool(ks == XK_a   ? ANNOT_ARROW
+                      : ks == XK_b ? ANNOT_BOX
+                      : ks == XK_h ? ANNOT_MARK
+                                   : ANNOT_TEXT);
+    } else if (ks == XK_BackSpace && !og.redacting && !og.annotating) {
+      // the last annotation, or the last region with the brush on
+      if (og.redact.n && (og.brush >= 0 || !og.annot.n))
+        Overlay_PopRedact();
+      else if (og.annot.n)
+        Overlay_PopAnnot();
+    }
+    break;
+  }
+  }
+}
+
+// Frame for a batch of service requests. While the overlay is up the screen
+// shows the overlay itself, so clients get the frozen frame under it; grabs
+// younger than a frame are shared.
+static const FRAMEBUFFER *Service_Frame(void *ctx, long long *grabNs) {
+  (void)ctx;
+  if (og.active)
+    return &og.cap.fb;
+  long long now = Clock_Ns();
+  if (g_service.fresh && now - g_service.grabbedAt < SERVICE_FRAME_NS)
+    return &g_service.cap.fb;
+  FRAMEBUFFER layout;
+  IMAGE tiles[FB_MAX_TILES];
+  g_service.fresh = 0;
+  if (X11Shadow_Snapshot(&g_shadow, &layout, tiles)) {
+    X11Capture_Adopt(g_dpy, &g_service.cap, &layout, tiles);
+    g_service.lent = 1;
+  } else if (!X11Capture_Grab(g_dpy, &g_service.cap)) {
+    return NULL;
+  }
+  g_service.grabbedAt = now;
+  g_service.fresh = 1;
+  *grabNs = Clock_Ns() - now;
+  return &g_service.cap.fb;
+}
+
+// The shadow's tiles go back right away (the hotkey may need them next);
+// a shadow snapshot is cheap to take again anyway.
+static void Service_EndFrame(void *ctx) {
+  (void)ctx;
+  if (g_service.lent) {
+    X11Shadow_Release(&g_shadow);
+    g_service.lent = g_service.fresh = 0;
+  }
+}
+
+static void Ctl_HandleEvent(XEvent *ev, KeyCode printKey) {
+  if (X11Clip_HandleEvent(ev))
+    return;
+  if (og.win && ev->xany.window == og.win) {
+    if (og.active)
+      Overlay_HandleEvent(ev);
+    return;
+  }
+  // Screen reconfigured: the pooled surfaces no longer fit.
+  if (ev->type == ConfigureNotify &&
+      ev->xconfigure.window == DefaultRootWindow(g_dpy) && !og.active) {
+    Overlay_ReleasePool();
+    return;
+  }
+  if (ev->type == KeyPress && ev->xkey.keycode == printKey) {
+    if (g_rec.rec)
+      Overlay_StopRecording();
+    else if (g_scroll.active)
+      Overlay_FinishScroll();
+    else
+      LaunchOverlay();
+  }
+}
+
+static void Ctl_Run(KeyCode printKey) {
+  int fd = ConnectionNumber(g_dpy);
+  for (;;) {
+    while (XPending(g_dpy)) {
+      XEvent ev;
+      XNextEvent(g_dpy, &ev);
+      Ctl_HandleEvent(&ev, printKey);
+    }
+    if (og.active) {
+      Overlay_PumpFrame();
+      Overlay_Paint();
+    }
+    if (XPending(g_dpy))
+      continue;
+
+    long long now = Clock_Ns();
+    long long due = og.active ? FrameClock_Due(&og.clock, now) : -1;
+    long long shadowDue = X11Shadow_Pump(&g_shadow, now);
+    if (shadowDue >= 0 && (due < 0 || shadowDue < due))
+      due = shadowDue;
+    if (g_rec.rec && !Record_Running(g_rec.rec))
+      Overlay_StopRecording(); // a write failed
+    if (g_rec.rec && (due < 0 || due > RECORD_POLL_NS))
+      due = RECORD_POLL_NS;
+    long long scrollDue = g_scroll.active ? Overlay_ScrollStep(now) : -1;
+    if (scrollDue >= 0 && (due < 0 || scrollDue < due))
+      due = scrollDue;
+    struct timeval tv, *ptv = NULL;
+    if (due >= 0) {
+      tv.tv_sec = (time_t)(due / 1000000000LL);
+      tv.tv_usec = (suseconds_t)(due % 1000000000LL / 1000);
+      ptv = &tv;
+    }
+    fd_set rd;
+    FD_ZERO(&rd);
+    FD_SET(fd, &rd);
+    FD_SET(g_wake[0], &rd);
+    int sfd = X11Shadow_Fd(&g_shadow);
+    if (sfd >= 0)
+      FD_SET(sfd, &rd);
+    int vfd = Service_Fd(g_service.svc);
+    if (vfd >= 0)
+      FD_SET(vfd, &rd);
+    int nfds = MAX(MAX(fd, g_wake[0]), MAX(sfd, vfd)) + 1;
+    if (select(nfds, &rd, NULL, NULL, ptv) <= 0)
+      continue;
+    if (FD_ISSET(g_wake[0], &rd))
+      Overlay_DimProgress();
+    if (vfd >= 0 && FD_ISSET(vfd, &rd))
+      Service_Pump(g_service.svc);
+  }
+}
+
+// `screenshot capture ...`: one grab, no windows, every region encoded in
+// parallel, a JSON report on stdout (or --report). Exits 0 only if every
+// region was written.
+static int CaptureMain(int argc, char **argv) {
+  BATCH b;
+  char err[512];
+  if (!Batch_Parse(&b, argc, argv, err, sizeof(err))) {
+    fprintf(stderr, "screenshot capture: %s\n", err);
+    Batch_Free(&b);
+    return 2;
+  }
+  Display *dpy = XOpenDisplay(NULL);
+  X11_CAPTURE cap;
+  memset(&cap, 0, sizeof(cap));
+  long long t0 = Clock_Ns();
+  int grabbed = dpy && X11Capture_Grab(dpy, &cap);
+  b.grabNs = Clock_Ns() - t0;
+  int done = grabbed ? Batch_Run(&b, &cap.fb) : 0;
+  const char *error = !dpy       ? "cannot open display"
+                      : !grabbed ? "desktop grab failed"
+                                 : NULL;
+  if (!Batch_Report(&b, grabbed ? &cap.fb : NULL, error))
+    fprintf(stderr, "screenshot capture: cannot write the report\n");
+  int status = done == b.count ? 0 : 1;
+  if (error)
+    fprintf(stderr, "screenshot capture: %s\n", error);
+  X11Capture_Release(&cap);
+  if (dpy)
+    XCloseDisplay(dpy);
+  Batch_Free(&b);
+  return status;
+}
+
+static volatile sig_atomic_t g_interrupted;
+static void OnInterrupt(int sig) {
+  (void)sig;
+  g_interrupted = 1;
+}
+
+// `screenshot record --region x,y,w,h --out file ...`: records without any
+// windows until the duration is reached or SIGINT/SIGTERM.
+static int RecordMain(int argc, char **argv) {
+  IRECT r = {0, 0, 0, 0};
+  const char *out = NULL;
+  RECORD_FORMAT fmt = Record_Format();
+  int fps = Record_Fps(), haveRegion = 0, formatSet = 0, verbose = 0;
+  double seconds = 0;
+  long long frames = 0;
+  for (int i = 0; i < argc; i++) {
+    const char *arg = argv[i], *val = i + 1 < argc ? argv[i + 1] : NULL;
+    int x, y, w, h;
+    if (!strcmp(arg, "-v")) {
+      verbose = 1;
+      continue;
+    }
+    if (!val)
+      goto usage;
+    i++;
+    int ok = 1;
+    if (!strcmp(arg, "--region")) {
+      ok = sscanf(val, "%d,%d,%d,%d", &x, &y, &w, &h) == 4 && w > 0 && h > 0;
+      r = (IRECT){x, y, x + w, y + h};
+      haveRegion = 1;
+    } else if (!strcmp(arg, "--out")) {
+      out = val;
+    } else if (!strcmp(arg, "--fps")) {
+      fps = atoi(val);
+      ok = fps > 0 && fps <= 240;
+    } else if (!strcmp(arg, "--seconds")) {
+      ok = (seconds = atof(val)) > 0;
+    } else if (!strcmp(arg, "--frames")) {
+      ok = (frames = atoll(val)) > 0;
+    } else if (!strcmp(arg, "--format")) {
+      ok = !strcmp(val, "apng") || !strcmp(val, "y4m");
+      fmt = !strcmp(val, "y4m") ? RECORD_Y4M : RECORD_APNG;
+      formatSet = 1;
+    } else {
+      ok = 0;
+    }
+    if (!ok)
+      goto usage;
+  }
+  if (!haveRegion || !out)
+    goto usage;
+  int toStdout = !strcmp(out, "-");
+  size_t len = strlen(out);
+  if (!formatSet && len > 4 && !strcmp(out + len - 4, ".y4m"))
+    fmt = RECORD_Y4M;
+  if (toStdout && fmt != RECORD_Y4M) {
+    fprintf(stderr, "screenshot record: APNG needs a file, not stdout\n");
+    return 2;
+  }
+  unsigned long long ticks =
+      frames ? (unsigned long long)frames
+             : (unsigned long long)(seconds * fps + 0.5);
+  FILE *f = toStdout ? stdout : fopen(out, "wb");
+  if (!f) {
+    fprintf(stderr, "screenshot record: cannot write %s\n", out);
+    return 1;
+  }
+  REC_GRAB g;
+  RECORDER *rec = Recording_Start(NULL, r, f, fmt, fps, ticks, &g);
+  if (!rec) {
+    fprintf(stderr, "screenshot record: cannot open the display or record "
+                    "the region\n");
+    if (!toStdout) {
+      fclose(f);
+      remove(out);
+    }
+    return 1;
+  }
+  signal(SIGINT, OnInterrupt);
+  signal(SIGTERM, OnInterrupt);
+  while (Record_Running(rec) && !g_interrupted)
+    Sleep_Until(Clock_Ns() + RECORD_POLL_NS);
+  return Recording_Finish(rec, &g, f, toStdout ? "stdout" : out, verbose)
+             ? 0
+             : 1;
+usage:
+  fprintf(stderr, "usage: screenshot record --region x,y,w,h --out file|- "
+                  "[--fps N]\n"
+                  "                         [--seconds S | --frames N] "
+                  "[--format apng|y4m] [-v]\n");
+  return 2;
+}
+
+static void Usage(void) {
+  fprintf(stderr, "usage: screenshot [-v] [--now] [--shadow] [--serve]\n"
+                  "       screenshot capture --region x,y,w,h... "
+                  "[--manifest file]\n"
+                  "                  [--out pattern] [--format png|qoi|raw] "
+                  "[--report file]\n"
+                  "       screenshot record --region x,y,w,h --out file|- "
+                  "[--fps N]\n"
+                  "                  [--seconds S | --frames N] "
+                  "[--format apng|y4m] [-v]\n"
+                  "       screenshot diff [--threshold N] [--out file] "
+                  "[--format png|qoi|raw]\n"
+                  "                  [--report file] a b\n"
+                  "       screenshot history [--dir d] [--extract N --out "
+                  "file\n"
+                  "                  [--region x,y,w,h] [--format "
+                  "png|qoi|raw]]\n"
+                  "  Resident region screenshot tool; PrintScreen opens the "
+                  "overlay;\n"
+                  "  Enter copies the selection, Ctrl+S saves it to ~/Pictures "
+                  "(format:\n"
+                  "  SCREENSHOT_FORMAT=png, qoi or raw), R records it until "
+                  "PrintScreen\n"
+                  "  (SCREENSHOT_RECORD=apng or y4m, SCREENSHOT_FPS, default "
+                  "30),\n"
+                  "  S stitches it while it is scrolled, until PrintScreen.\n"
+                  "  Copies and saves are also kept in a tile-deduplicated "
+                  "history\n"
+                  "  ($SCREENSHOT_HISTORY, 0 for none; default "
+                  "~/.local/share/screenshot/\n"
+                  "  history).\n"
+                  "  -v        print capture/paint/latency stats to stderr\n"
+                  "  --now     open the overlay immediately\n"
+                  "  --shadow  keep a damage-tracked copy of the screen so "
+                  "the overlay\n"
+                  "            opens without a full read (needs XDamage)\n"
+                  "  --serve   answer capture requests on a local socket "
+                  "(see service.h;\n"
+                  "            $SCREENSHOT_SOCKET or "
+                  "$XDG_RUNTIME_DIR/screenshot.sock)\n"
+                  "  capture   grab once and write each region to the pattern "
+                  "({n} {x} {y}\n"
+                  "            {w} {h} {ext}) with no windows; JSON report on "
+                  "stdout\n"
+                  "  record    record a region with no windows until the "
+                  "duration or\n"
+                  "            SIGINT (Y4M can go to stdout)\n"
+                  "  diff      compare two PNG, QOI or raw images: JSON "
+                  "changed regions,\n"
+                  "            --out the highlighted image; exits 1 if they "
+                  "differ\n"
+                  "  history   list the kept captures and store usage as "
+                  "JSON, or\n"
+                  "            --extract N (negative from the newest) to "
+                  "--out\n");
+}
+
+int main(int argc, char **argv) {
+  if (argc > 1 && !strcmp(argv[1], "capture"))
+    return CaptureMain(argc - 2, argv + 2);
+  if (argc > 1 && !strcmp(argv[1], "record"))
+    return RecordMain(argc - 2, argv + 2);
+  if (argc > 1 && !strcmp(argv[1], "diff"))
+    return Diff_Main(argc - 2, argv + 2); // no display needed
+  if (argc > 1 && !strcmp(argv[1], "history"))
+    return History_Main(argc - 2, argv + 2);
+
+  int now = 0, shadow = 0, serve = 0;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-v"))
+      g_verbose = 1;
+    else if (!strcmp(argv[i], "--serve"))
+      serve = 1;
+    else if (!strcmp(argv[i], "--now"))
+      now = 1;
+    else if (!strcmp(argv[i], "--shadow"))
+      shadow = 1;
+    else {
+      Usage();
+      return 2;
+    }
+  }
+
+  g_dpy = XOpenDisplay(NULL);
+  if (!g_dpy) {
+    fprintf(stderr, "screenshot: cannot open display\n");
+    return 1;
+  }
+  Window root = DefaultRootWindow(g_dpy);
+
+  if (pipe(g_wake) != 0) {
+    perror("screenshot: pipe");
+    return 1;
+  }
+  for (int i = 0; i < 2; i++)
+    fcntl(g_wake[i], F_SETFL, fcntl(g_wake[i], F_GETFL) | O_NONBLOCK);
+
+  if (shadow && !X11Shadow_Start(&g_shadow, DisplayString(g_dpy)))
+    fprintf(stderr, "screenshot: no XDamage, capturing on demand\n");
+
+  if (serve) {
+    char path[256];
+    Service_DefaultPath(path, sizeof(path));
+    g_service.svc = Service_Start(path, Service_Frame, Service_EndFrame, NULL,
+                                  g_verbose);
+    if (!g_service.svc)
+      fprintf(stderr, "screenshot: cannot listen on %s (already running?)\n",
+              path);
+    else if (g_verbose)
+      fprintf(stderr, "screenshot: serving captures on %s\n", path);
+  }
+
+  // Controller window (never mapped) for the clipboard
+  g_ctl = XCreateSimpleWindow(g_dpy, root, -1, -1, 1, 1, 0, 0, 0);
+  X11Clip_Init(g_dpy, g_ctl, g_verbose);
+
+  // Register PrintScreen as a global hotkey (any modifiers)
+  KeyCode printKey = XKeysymToKeycode(g_dpy, XK_Print);
+  if (printKey)
+    XGrabKey(g_dpy, printKey, AnyModifier, root, True, GrabModeAsync,
+             GrabModeAsync);
+  XSelectInput(g_dpy, root, KeyPressMask | StructureNotifyMask);
+
+  if (now)
+    LaunchOverlay();
+  Ctl_Run(printKey);
+  return 0;
+}
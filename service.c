@@ -0,0 +1,447 @@
+#define _GNU_SOURCE // memfd_create, accept4, SO_PEERCRED
+#include "service.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "export.h"
+#include "platform.h"
+
+#define SERVICE_MAX_BATCH 256 // requests answered per pump
+#define SERVICE_LISTENER SERVICE_MAX_CLIENTS // epoll tag of the socket
+
+typedef struct {
+  int fd; // -1 when the slot is free
+  unsigned char buf[sizeof(SERVICE_REQUEST)];
+  size_t have;
+  int closing;
+} SERVICE_CLIENT;
+
+typedef struct {
+  int client;
+  SERVICE_REQUEST req;
+  SERVICE_REPLY reply;
+  int memfd;
+} SERVICE_PENDING;
+
+struct SERVICE {
+  int listen, epoll;
+  char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+  SERVICE_GRAB_FN grab;
+  SERVICE_DONE_FN done;
+  void *ctx;
+  int verbose;
+  SERVICE_CLIENT clients[SERVICE_MAX_CLIENTS];
+  SERVICE_PENDING pending[SERVICE_MAX_BATCH];
+  int npending;
+  unsigned long long frame;
+  SERVICE_STATS stats;
+};
+
+void Service_DefaultPath(char *path, size_t n) {
+  const char *env = getenv("SCREENSHOT_SOCKET");
+  const char *run = getenv("XDG_RUNTIME_DIR");
+  if (env && *env)
+    snprintf(path, n, "%s", env);
+  else if (run && *run)
+    snprintf(path, n, "%s/screenshot.sock", run);
+  else
+    snprintf(path, n, "/tmp/screenshot-%u.sock", (unsigned)geteuid());
+}
+
+static int Service_Address(const char *path, struct sockaddr_un *sa) {
+  memset(sa, 0, sizeof(*sa));
+  sa->sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(sa->sun_path))
+    return 0;
+  strcpy(sa->sun_path, path);
+  return 1;
+}
+
+SERVICE *Service_Start(const char *path, SERVICE_GRAB_FN grab,
+                       SERVICE_DONE_FN done, void *ctx, int verbose) {
+  struct sockaddr_un sa;
+  if (!Service_Address(path, &sa))
+    return NULL;
+  // A socket nobody answers on is left over from a crash; a live one
+  // belongs to another instance.
+  int probe = Service_Connect(path);
+  if (probe >= 0) {
+    close(probe);
+    return NULL;
+  }
+  unlink(path);
+
+  SERVICE *s = (SERVICE *)calloc(1, sizeof(*s));
+  if (!s)
+    return NULL;
+  s->grab = grab;
+  s->done = done;
+  s->ctx = ctx;
+  s->verbose = verbose;
+  s->epoll = -1;
+  for (int i = 0; i < SERVICE_MAX_CLIENTS; i++)
+    s->clients[i].fd = -1;
+  strcpy(s->path, path);
+
+  s->listen = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  mode_t mask = umask(0177); // owner-only socket
+  int bound = s->listen >= 0 &&
+              bind(s->listen, (struct sockaddr *)&sa, sizeof(sa)) == 0;
+  umask(mask);
+  struct epoll_event ev = {.events = EPOLLIN};
+  ev.data.u32 = SERVICE_LISTENER;
+  if (!bound || listen(s->listen, 16) != 0 ||
+      (s->epoll = epoll_create1(EPOLL_CLOEXEC)) < 0 ||
+      epoll_ctl(s->epoll, EPOLL_CTL_ADD, s->listen, &ev) != 0) {
+    if (bound)
+      unlink(path);
+    if (s->listen >= 0)
+      close(s->listen);
+    if (s->epoll >= 0)
+      close(s->epoll);
+    free(s);
+    return NULL;
+  }
+  return s;
+}
+
+static void Service_Close(SERVICE *s, int slot) {
+  SERVICE_CLIENT *c = &s->clients[slot];
+  epoll_ctl(s->epoll, EPOLL_CTL_DEL, c->fd, NULL);
+  close(c->fd);
+  memset(c, 0, sizeof(*c));
+  c->fd = -1;
+}
+
+void Service_Stop(SERVICE *s) {
+  if (!s)
+    return;
+  for (int i = 0; i < SERVICE_MAX_CLIENTS; i++)
+    if (s->clients[i].fd >= 0)
+      Service_Close(s, i);
+  close(s->listen);
+  close(s->epoll);
+  unlink(s->path);
+  free(s);
+}
+
+int Service_Fd(const SERVICE *s) { return s ? s->epoll : -1; }
+
+void Service_Stats(const SERVICE *s, SERVICE_STATS *out) {
+  if (s)
+    *out = s->stats;
+  else
+    memset(out, 0, sizeof(*out));
+}
+
+static void Service_Accept(SERVICE *s) {
+  for (;;) {
+    int fd = accept4(s->listen, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0)
+      return;
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    int slot = 0;
+    while (slot < SERVICE_MAX_CLIENTS && s->clients[slot].fd >= 0)
+      slot++;
+    struct epoll_event ev = {.events = EPOLLIN};
+    ev.data.u32 = (uint32_t)slot;
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0 ||
+        cred.uid != geteuid() || slot == SERVICE_MAX_CLIENTS ||
+        epoll_ctl(s->epoll, EPOLL_CTL_ADD, fd, &ev) != 0) {
+      close(fd);
+      continue;
+    }
+    s->clients[slot].fd = fd;
+    s->stats.clients++;
+  }
+}
+
+// Queues every complete request the client has sent, up to the batch limit;
+// the rest stays in the socket (epoll is level-triggered).
+static void Service_Read(SERVICE *s, int slot) {
+  SERVICE_CLIENT *c = &s->clients[slot];
+  while (!c->closing && s->npending < SERVICE_MAX_BATCH) {
+    ssize_t r = recv(c->fd, c->buf + c->have, sizeof(c->buf) - c->have, 0);
+    if (r == 0 || (r < 0 && errno != EAGAIN && errno != EINTR))
+      c->closing = 1;
+    if (r <= 0)
+      return;
+    c->have += (size_t)r;
+    if (c->have == sizeof(c->buf)) {
+      SERVICE_PENDING *p = &s->pending[s->npending++];
+      memset(p, 0, sizeof(*p));
+      p->client = slot;
+      p->memfd = -1;
+      memcpy(&p->req, c->buf, sizeof(p->req));
+      c->have = 0;
+    }
+  }
+}
+
+// The requested rect in framebuffer coordinates, clipped. Returns a status.
+static int Service_Rect(const FRAMEBUFFER *fb, const SERVICE_REQUEST *q,
+                        IRECT *r) {
+  IRECT want;
+  if (q->op == SERVICE_REGION) {
+    if (q->w <= 0 || q->h <= 0 || q->w > 1 << 20 || q->h > 1 << 20 ||
+        q->x < -(1 << 20) || q->x > 1 << 20 || q->y < -(1 << 20) ||
+        q->y > 1 << 20)
+      return SERVICE_BAD_REQUEST;
+    want.left = q->x - fb->virt.left;
+    want.top = q->y - fb->virt.top;
+    want.right = want.left + q->w;
+    want.bottom = want.top + q->h;
+  } else if (q->output == -1) {
+    want = (IRECT){0, 0, fb->w, fb->h};
+  } else if (q->output >= 0 && q->output < fb->ntiles) {
+    want = fb->tiles[q->output].area;
+  } else {
+    return SERVICE_NO_PIXELS;
+  }
+  IRECT bounds = {0, 0, fb->w, fb->h};
+  return IRect_Intersect(&want, &bounds, r) ? SERVICE_OK : SERVICE_NO_PIXELS;
+}
+
+// Raw pixels are read from the frame straight into the mapped memfd; the
+// encoded formats are written through a stdio stream on it.
+static int Service_Fill(const FRAMEBUFFER *fb, const IRECT *r, int format,
+                        int memfd, SERVICE_REPLY *a) {
+  int w = r->right - r->left, h = r->bottom - r->top;
+  if (format == SERVICE_RAW) {
+    size_t size = (size_t)w * (size_t)h * 4;
+    if (ftruncate(memfd, (off_t)size) != 0)
+      return 0;
+    // prefaulted: one call instead of a write fault per page
+    void *map =
+        mmap(NULL, size, PROT_WRITE, MAP_SHARED | MAP_POPULATE, memfd, 0);
+    if (map == MAP_FAILED)
+      return 0;
+    IMAGE dst = {(unsigned char *)map, w, h, w * 4};
+    Framebuffer_Read(fb, 0, r, &dst, -r->left, -r->top);
+    munmap(map, size);
+    a->stride = (uint32_t)dst.stride;
+    a->size = size;
+    return 1;
+  }
+
+  IMAGE img, crop = {0};
+  if (!Framebuffer_View(fb, r, &img)) {
+    if (!Framebuffer_Crop(fb, r, &crop))
+      return 0;
+    img = crop;
+  }
+  int dupfd = dup(memfd);
+  FILE *f = dupfd >= 0 ? fdopen(dupfd, "wb") : NULL;
+  EXPORT_STATS st;
+  int ok = f && Export_Write(f, &img,
+                             format == SERVICE_PNG ? EXPORT_PNG : EXPORT_QOI,
+                             &st);
+  if (f)
+    ok = fclose(f) == 0 && ok;
+  else if (dupfd >= 0)
+    close(dupfd);
+  Image_Free(&crop);
+  a->size = ok ? st.fileBytes : 0;
+  return ok;
+}
+
+static void Service_Answer(SERVICE_PENDING *p, const FRAMEBUFFER *fb) {
+  const SERVICE_REQUEST *q = &p->req;
+  SERVICE_REPLY *a = &p->reply;
+  long long t0 = Clock_Ns();
+  if (q->magic != SERVICE_MAGIC || q->version != SERVICE_VERSION ||
+      (q->op != SERVICE_REGION && q->op != SERVICE_OUTPUT) ||
+      q->format > SERVICE_QOI) {
+    a->status = SERVICE_BAD_REQUEST;
+    return;
+  }
+  IRECT r;
+  if (!fb) {
+    a->status = SERVICE_GRAB_FAILED;
+    return;
+  }
+  if ((a->status = (uint16_t)Service_Rect(fb, q, &r)) != SERVICE_OK)
+    return;
+  a->x = r.left + fb->virt.left;
+  a->y = r.top + fb->virt.top;
+  a->w = r.right - r.left;
+  a->h = r.bottom - r.top;
+
+  p->memfd = memfd_create("screenshot", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (p->memfd < 0 || !Service_Fill(fb, &r, (int)q->format, p->memfd, a) ||
+      fcntl(p->memfd, F_ADD_SEALS,
+            F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) != 0) {
+    if (p->memfd >= 0)
+      close(p->memfd);
+    p->memfd = -1;
+    a->status = SERVICE_NO_MEMORY;
+    a->size = 0;
+  }
+  a->serveNs = Clock_Ns() - t0;
+}
+
+typedef struct {
+  SERVICE *s;
+  const FRAMEBUFFER *fb;
+} SERVICE_BATCH;
+
+static void Service_AnswerRange(void *ctx, int begin, int end) {
+  SERVICE_BATCH *b = (SERVICE_BATCH *)ctx;
+  for (int i = begin; i < end; i++)
+    Service_Answer(&b->s->pending[i], b->fb);
+}
+
+static void Service_Send(SERVICE *s, SERVICE_PENDING *p) {
+  SERVICE_CLIENT *c = &s->clients[p->client];
+  if (c->fd < 0)
+    return;
+  struct iovec iov = {&p->reply, sizeof(p->reply)};
+  union {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(sizeof(int))];
+  } cm;
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  if (p->memfd >= 0) {
+    memset(&cm, 0, sizeof(cm));
+    msg.msg_control = cm.buf;
+    msg.msg_controllen = sizeof(cm.buf);
+    struct cmsghdr *h = CMSG_FIRSTHDR(&msg);
+    h->cmsg_level = SOL_SOCKET;
+    h->cmsg_type = SCM_RIGHTS;
+    h->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(h), &p->memfd, sizeof(int));
+  }
+  // Replies are small; a client that lets them back up is dropped rather
+  // than stalling the event loop.
+  if (sendmsg(c->fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL) !=
+      (ssize_t)sizeof(p->reply))
+    c->closing = 1;
+}
+
+static void Service_Serve(SERVICE *s) {
+  long long t0 = Clock_Ns(), grabNs = 0;
+  const FRAMEBUFFER *fb = s->grab(s->ctx, &grabNs);
+  if (fb && grabNs > 0) {
+    s->frame++;
+    s->stats.grabs++;
+  }
+  for (int i = 0; i < s->npending; i++) {
+    SERVICE_REPLY *a = &s->pending[i].reply;
+    a->magic = SERVICE_MAGIC;
+    a->version = SERVICE_VERSION;
+    a->format = s->pending[i].req.format;
+    a->tag = s->pending[i].req.tag;
+    a->frame = s->frame;
+    a->grabNs = grabNs;
+  }
+  // Packed frames decode through a shared block cache: one at a time.
+  SERVICE_BATCH b = {s, fb};
+  if (fb && !fb->store)
+    Par_For(s->npending, 1, Service_AnswerRange, &b);
+  else
+    Service_AnswerRange(&b, 0, s->npending);
+  s->done(s->ctx);
+
+  for (int i = 0; i < s->npending; i++) {
+    SERVICE_PENDING *p = &s->pending[i];
+    Service_Send(s, p);
+    if (p->memfd >= 0)
+      close(p->memfd);
+    s->stats.requests++;
+    s->stats.errors += p->reply.status != SERVICE_OK;
+    s->stats.bytes += p->reply.size;
+  }
+  if (s->verbose)
+    fprintf(stderr,
+            "screenshot: served %d request(s) from frame %llu (%s %.2f ms), "
+            "%.2f ms total\n",
+            s->npending, s->frame, grabNs > 0 ? "grab" : "reused",
+            grabNs / 1e6, (Clock_Ns() - t0) / 1e6);
+  s->npending = 0;
+}
+
+void Service_Pump(SERVICE *s) {
+  if (!s)
+    return;
+  struct epoll_event ev[SERVICE_MAX_CLIENTS + 1];
+  int n = epoll_wait(s->epoll, ev, SERVICE_MAX_CLIENTS + 1, 0);
+  for (int i = 0; i < n; i++) {
+    if (ev[i].data.u32 == SERVICE_LISTENER)
+      Service_Accept(s);
+    else
+      Service_Read(s, (int)ev[i].data.u32);
+  }
+  if (s->npending)
+    Service_Serve(s);
+  for (int i = 0; i < SERVICE_MAX_CLIENTS; i++)
+    if (s->clients[i].fd >= 0 && s->clients[i].closing)
+      Service_Close(s, i);
+}
+
+int Service_Connect(const char *path) {
+  struct sockaddr_un sa;
+  if (!Service_Address(path, &sa))
+    return -1;
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd >= 0 && connect(fd, (struct sockaddr *)&sa, sizeof(sa)) != 0) {
+    close(fd);
+    fd = -1;
+  }
+  return fd;
+}
+
+int Service_Call(int sock, const SERVICE_REQUEST *req, SERVICE_REPLY *reply,
+                 int *fd) {
+  *fd = -1;
+  const unsigned char *out = (const unsigned char *)req;
+  for (size_t sent = 0; sent < sizeof(*req);) {
+    ssize_t r = send(sock, out + sent, sizeof(*req) - sent, MSG_NOSIGNAL);
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (r <= 0)
+      return 0;
+    sent += (size_t)r;
+  }
+  unsigned char *in = (unsigned char *)reply;
+  for (size_t got = 0; got < sizeof(*reply);) {
+    struct iovec iov = {in + got, sizeof(*reply) - got};
+    union {
+      struct cmsghdr align;
+      char buf[CMSG_SPACE(sizeof(int))];
+    } cm;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cm.buf;
+    msg.msg_controllen = sizeof(cm.buf);
+    ssize_t r = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (r <= 0) {
+      if (*fd >= 0)
+        close(*fd);
+      *fd = -1;
+      return 0;
+    }
+    struct cmsghdr *h = CMSG_FIRSTHDR(&msg);
+    if (h && h->cmsg_level == SOL_SOCKET && h->cmsg_type == SCM_RIGHTS)
+      memcpy(fd, CMSG_DATA(h), sizeof(int));
+    got += (size_t)r;
+  }
+  return 1;
+}
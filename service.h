@@ -0,0 +1,97 @@
+#ifndef SCREENSHOT_SERVICE_H
+#define SCREENSHOT_SERVICE_H
+
+#include <stdint.h>
+
+#include "framebuffer.h"
+
+// Local capture service for other tools (`screenshot --serve`, Linux). The
+// resident process listens on a Unix stream socket; a client sends fixed-size
+// SERVICE_REQUESTs and gets one SERVICE_REPLY per request, in order, with the
+// result as a sealed memfd passed alongside (SCM_RIGHTS). The memfd holds
+// bare BGRA rows for SERVICE_RAW, so clients mmap the pixels instead of
+// reading a file back, or the encoded PNG/QOI file otherwise.
+//
+// Requests that arrive together, or within SERVICE_FRAME_NS of the last
+// grab, are served from one grab. Only processes of the same user may
+// connect. Structs are in host byte order (the socket is local).
+
+#define SERVICE_MAGIC 0x54485353u // "SSHT"
+#define SERVICE_VERSION 1
+#define SERVICE_FRAME_NS 16666667LL
+#define SERVICE_MAX_CLIENTS 64
+
+enum {
+  SERVICE_REGION = 1, // x, y, w, h in screen coordinates
+  SERVICE_OUTPUT = 2  // monitor `output`, or -1 for the whole desktop
+};
+
+// Reply formats; the encoded ones use the export writers.
+enum { SERVICE_RAW = 0, SERVICE_PNG = 1, SERVICE_QOI = 2 };
+
+enum {
+  SERVICE_OK = 0,
+  SERVICE_BAD_REQUEST = 1,
+  SERVICE_NO_PIXELS = 2, // region outside the desktop, or no such output
+  SERVICE_GRAB_FAILED = 3,
+  SERVICE_NO_MEMORY = 4
+};
+
+typedef struct {
+  uint32_t magic;
+  uint16_t version, op;
+  int32_t x, y, w, h;
+  int32_t output;
+  uint32_t format;
+  uint64_t tag; // echoed in the reply
+} SERVICE_REQUEST;
+
+typedef struct {
+  uint32_t magic;
+  uint16_t version, status;
+  int32_t x, y, w, h;       // what was captured, clipped to the desktop
+  uint32_t stride, format;  // stride is for SERVICE_RAW
+  uint64_t size;            // bytes in the memfd (none unless SERVICE_OK)
+  uint64_t frame;           // grab serial, shared by batched requests
+  uint64_t tag;
+  int64_t grabNs, serveNs;  // grab (0 when shared), memfd fill
+} SERVICE_REPLY;
+
+typedef struct {
+  unsigned long long clients, requests, grabs, errors;
+  unsigned long long bytes; // memfd payload handed out
+} SERVICE_STATS;
+
+// The platform's frame for a batch of requests (NULL if the grab failed),
+// and the end of that batch; the frame is read only in between. *grabNs is
+// the grab time, or 0 when the previous frame was still fresh and is reused.
+typedef const FRAMEBUFFER *(*SERVICE_GRAB_FN)(void *ctx, long long *grabNs);
+typedef void (*SERVICE_DONE_FN)(void *ctx);
+
+typedef struct SERVICE SERVICE;
+
+// $SCREENSHOT_SOCKET, else $XDG_RUNTIME_DIR/screenshot.sock, else
+// /tmp/screenshot-<uid>.sock.
+void Service_DefaultPath(char *path, size_t n);
+
+// Binds path (replacing a stale socket, failing if another instance is
+// listening). Returns NULL on failure.
+SERVICE *Service_Start(const char *path, SERVICE_GRAB_FN grab,
+                       SERVICE_DONE_FN done, void *ctx, int verbose);
+void Service_Stop(SERVICE *s);
+// One descriptor for the caller's select loop; readable when Service_Pump
+// has work.
+int Service_Fd(const SERVICE *s);
+// Accepts clients, reads requests and answers every complete one.
+void Service_Pump(SERVICE *s);
+void Service_Stats(const SERVICE *s, SERVICE_STATS *out);
+
+// --- Client side ---
+// Returns a connected socket or -1.
+int Service_Connect(const char *path);
+// Sends req and waits for its reply. *fd receives the memfd (or -1).
+// Returns 1 if a reply arrived (check reply->status).
+int Service_Call(int sock, const SERVICE_REQUEST *req, SERVICE_REPLY *reply,
+                 int *fd);
+
+#endif
@@ -0,0 +1,265 @@
+#define _GNU_SOURCE
+#include "shadow_x11.h"
+
+#include <string.h>
+
+#include "platform.h"
+
+#ifdef HAVE_XDAMAGE
+#include <X11/extensions/Xdamage.h>
+
+static void Shadow_FreeTiles(X11_SHADOW *s) {
+  for (int i = 0; i < FB_MAX_TILES; i++)
+    for (int b = 0; b < 2; b++)
+      X11Image_Destroy(s->dpy, &s->tiles[i].buf[b]);
+  memset(s->tiles, 0, sizeof(s->tiles));
+}
+
+static void Shadow_MarkAll(X11_SHADOW *s) {
+  for (int i = 0; i < s->fb.ntiles; i++) {
+    const IRECT *a = &s->fb.tiles[i].area;
+    s->tiles[i].dirty[0] = (IRECT){0, 0, a->right - a->left,
+                                   a->bottom - a->top};
+    s->tiles[i].ndirty = 1;
+  }
+}
+
+// (Re)allocates the tiles for the current monitor layout; everything has to
+// be read again.
+static int Shadow_Layout(X11_SHADOW *s) {
+  Shadow_FreeTiles(s);
+  s->synced = s->relayout = 0;
+  X11Capture_Layout(s->dpy, &s->fb);
+  for (int i = 0; i < s->fb.ntiles; i++) {
+    const IRECT *a = &s->fb.tiles[i].area;
+    if (!X11Image_Create(s->dpy, a->right - a->left, a->bottom - a->top,
+                         &s->tiles[i].buf[0]))
+      return 0;
+  }
+  Shadow_MarkAll(s);
+  return 1;
+}
+
+static void Tile_AddDirty(SHADOW_TILE *t, const IRECT *r) {
+  for (int i = 0; i < t->ndirty; i++) {
+    IRECT x;
+    if (IRect_Intersect(&t->dirty[i], r, &x)) {
+      IRect_Union(&t->dirty[i], r, &t->dirty[i]);
+      return;
+    }
+  }
+  if (t->ndirty == SHADOW_MAX_RECTS) {
+    // too fragmented: one bounding rect reads less than many round trips
+    for (int i = 1; i < t->ndirty; i++)
+      IRect_Union(&t->dirty[0], &t->dirty[i], &t->dirty[0]);
+    t->ndirty = 1;
+    IRect_Union(&t->dirty[0], r, &t->dirty[0]);
+    return;
+  }
+  t->dirty[t->ndirty++] = *r;
+}
+
+// Splits a damaged root rect over the tiles it touches.
+static void Shadow_AddDamage(X11_SHADOW *s, const XRectangle *area) {
+  IRECT r = {area->x - s->fb.virt.left, area->y - s->fb.virt.top,
+             area->x + area->width - s->fb.virt.left,
+             area->y + area->height - s->fb.virt.top};
+  for (int i = 0; i < s->fb.ntiles; i++) {
+    const IRECT *a = &s->fb.tiles[i].area;
+    IRECT x;
+    if (!IRect_Intersect(&r, a, &x))
+      continue;
+    x.left -= a->left;
+    x.right -= a->left;
+    x.top -= a->top;
+    x.bottom -= a->top;
+    Tile_AddDirty(&s->tiles[i], &x);
+  }
+}
+
+static void Shadow_DrainEvents(X11_SHADOW *s) {
+  while (XPending(s->dpy)) {
+    XEvent ev;
+    XNextEvent(s->dpy, &ev);
+    if (ev.type == s->damageEvent + XDamageNotify)
+      Shadow_AddDamage(s, &((XDamageNotifyEvent *)&ev)->area);
+    else if (ev.type == ConfigureNotify)
+      s->relayout = 1;
+  }
+}
+
+// Copy-on-write: the lent image stays as it is, the shadow moves on to the
+// spare one.
+static int Tile_Unshare(X11_SHADOW *s, SHADOW_TILE *t) {
+  X11_IMAGE *from = &t->buf[t->live], *to = &t->buf[!t->live];
+  if (!to->img &&
+      !X11Image_Create(s->dpy, from->image.w, from->image.h, to))
+    return 0;
+  for (int y = 0; y < from->image.h; y++)
+    memcpy(IMAGE_ROW(&to->image, y), IMAGE_ROW(&from->image, y),
+           (size_t)from->image.w * 4);
+  t->live = !t->live;
+  t->shared = 0;
+  s->stats.cowCopies++;
+  return 1;
+}
+
+// Reads every pending dirty rect back from the root window.
+static void Shadow_Refresh(X11_SHADOW *s) {
+  if (s->relayout && !Shadow_Layout(s))
+    return;
+  Window root = DefaultRootWindow(s->dpy);
+  int full = 1;
+  X11Error_Trap(s->dpy);
+  for (int i = 0; i < s->fb.ntiles; i++) {
+    SHADOW_TILE *t = &s->tiles[i];
+    if (t->ndirty && t->shared && !Tile_Unshare(s, t)) {
+      full = 0; // keep the damage for the next try
+      continue;
+    }
+    const IRECT *a = &s->fb.tiles[i].area;
+    X11_IMAGE *xi = &t->buf[t->live];
+    for (int j = 0; j < t->ndirty; j++) {
+      const IRECT *r = &t->dirty[j];
+      int w = r->right - r->left, h = r->bottom - r->top;
+      int x = s->fb.virt.left + a->left, y = s->fb.virt.top + a->top;
+      if (w == xi->image.w && h == xi->image.h) // whole tile: MIT-SHM
+        X11Image_Get(s->dpy, root, x, y, xi);
+      else
+        XGetSubImage(s->dpy, root, x + r->left, y + r->top, (unsigned)w,
+                     (unsigned)h, AllPlanes, ZPixmap, xi->img, r->left,
+                     r->top);
+      s->stats.damageRects++;
+      s->stats.damageBytes += (unsigned long long)w * h * 4;
+    }
+    t->ndirty = 0;
+  }
+  int err = X11Error_Untrap(s->dpy);
+  s->stats.refreshes++;
+  if (err)
+    s->relayout = 1; // the screen changed under us; start over
+  else if (full)
+    s->synced = 1;
+}
+
+static int Shadow_Pending(const X11_SHADOW *s) {
+  if (s->relayout)
+    return 1;
+  for (int i = 0; i < s->fb.ntiles; i++)
+    if (s->tiles[i].ndirty)
+      return 1;
+  return 0;
+}
+
+int X11Shadow_Start(X11_SHADOW *s, const char *display) {
+  memset(s, 0, sizeof(*s));
+  s->dpy = XOpenDisplay(display);
+  if (!s->dpy)
+    return 0;
+  int errBase;
+  if (!XDamageQueryExtension(s->dpy, &s->damageEvent, &errBase) ||
+      !Shadow_Layout(s)) {
+    X11Shadow_Stop(s);
+    return 0;
+  }
+  Window root = DefaultRootWindow(s->dpy);
+  s->damage = XDamageCreate(s->dpy, root, XDamageReportRawRectangles);
+  XSelectInput(s->dpy, root, StructureNotifyMask);
+  XFlush(s->dpy);
+  s->idleStart = Clock_Ns();
+  s->idleCpuStart = Cpu_ProcessNs();
+  return 1;
+}
+
+void X11Shadow_Stop(X11_SHADOW *s) {
+  if (!s->dpy)
+    return;
+  if (s->damage)
+    XDamageDestroy(s->dpy, s->damage);
+  Shadow_FreeTiles(s);
+  XCloseDisplay(s->dpy);
+  memset(s, 0, sizeof(*s));
+}
+
+long long X11Shadow_Pump(X11_SHADOW *s, long long now) {
+  if (!s->dpy)
+    return -1;
+  Shadow_DrainEvents(s);
+  if (s->paused || !Shadow_Pending(s))
+    return -1;
+  long long due = s->lastRefresh + SHADOW_INTERVAL_NS - now;
+  if (due > 0)
+    return due;
+  Shadow_Refresh(s);
+  s->lastRefresh = now;
+  return Shadow_Pending(s) ? SHADOW_INTERVAL_NS : -1;
+}
+
+int X11Shadow_Snapshot(X11_SHADOW *s, FRAMEBUFFER *layout,
+                       IMAGE tiles[FB_MAX_TILES]) {
+  if (!s->dpy)
+    return 0;
+  long long t0 = Clock_Ns();
+  XSync(s->dpy, False); // every damage event up to now is queued
+  Shadow_DrainEvents(s);
+  if (Shadow_Pending(s))
+    Shadow_Refresh(s);
+  if (!s->synced || s->relayout)
+    return 0;
+  *layout = s->fb;
+  for (int i = 0; i < s->fb.ntiles; i++) {
+    SHADOW_TILE *t = &s->tiles[i];
+    tiles[i] = t->buf[t->live].image;
+    t->shared = 1;
+  }
+  s->stats.snapshotNs = Clock_Ns() - t0;
+  return 1;
+}
+
+void X11Shadow_Release(X11_SHADOW *s) {
+  for (int i = 0; i < FB_MAX_TILES; i++)
+    s->tiles[i].shared = 0;
+}
+
+void X11Shadow_Pause(X11_SHADOW *s, int paused) {
+  if (!s->dpy || s->paused == paused)
+    return;
+  s->paused = paused;
+  long long now = Clock_Ns(), cpu = Cpu_ProcessNs();
+  if (paused) {
+    s->stats.idleNs += now - s->idleStart;
+    s->stats.idleCpuNs += cpu - s->idleCpuStart;
+  } else {
+    s->idleStart = now;
+    s->idleCpuStart = cpu;
+  }
+}
+#else
+int X11Shadow_Start(X11_SHADOW *s, const char *display) {
+  (void)display;
+  memset(s, 0, sizeof(*s));
+  return 0;
+}
+void X11Shadow_Stop(X11_SHADOW *s) { (void)s; }
+long long X11Shadow_Pump(X11_SHADOW *s, long long now) {
+  (void)s;
+  (void)now;
+  return -1;
+}
+int X11Shadow_Snapshot(X11_SHADOW *s, FRAMEBUFFER *layout,
+                       IMAGE tiles[FB_MAX_TILES]) {
+  (void)s;
+  (void)layout;
+  (void)tiles;
+  return 0;
+}
+void X11Shadow_Release(X11_SHADOW *s) { (void)s; }
+void X11Shadow_Pause(X11_SHADOW *s, int paused) {
+  (void)s;
+  (void)paused;
+}
+#endif
+
+int X11Shadow_Fd(const X11_SHADOW *s) {
+  return s->dpy ? ConnectionNumber(s->dpy) : -1;
+}
@@ -0,0 +1,66 @@
+#ifndef SCREENSHOT_SHADOW_X11_H
+#define SCREENSHOT_SHADOW_X11_H
+
+#include "capture_x11.h"
+
+// Resident mode (--shadow): a copy of the root window kept current by
+// re-reading only the regions XDamage reports, so the hotkey can hand out a
+// frame without a full-desktop read. Runs on its own connection, pumped from
+// the caller's event loop. Needs HAVE_XDAMAGE; X11Shadow_Start fails
+// without it.
+//
+// Snapshots lend the shadow's tile images out. While they are lent, the
+// first refresh that touches a tile copies it to a spare image and continues
+// there (copy-on-write per tile), so the lent pixels never change.
+
+#define SHADOW_MAX_RECTS 16 // pending damage rects per tile before merging
+#define SHADOW_INTERVAL_NS 33000000LL // at most ~30 refreshes per second
+
+typedef struct {
+  X11_IMAGE buf[2];
+  int live;   // index of the image the shadow keeps current
+  int shared; // buf[live] is lent to a snapshot
+  IRECT dirty[SHADOW_MAX_RECTS]; // tile coordinates
+  int ndirty;
+} SHADOW_TILE;
+
+typedef struct {
+  unsigned long long damageRects, damageBytes; // read back from the server
+  unsigned long long refreshes, cowCopies;
+  long long idleNs, idleCpuNs; // wall and process CPU time while unpaused
+  long long snapshotNs;        // last X11Shadow_Snapshot (hotkey-to-frame)
+} SHADOW_STATS;
+
+typedef struct {
+  Display *dpy; // own connection; NULL when not running
+  int damageEvent;
+  XID damage;
+  FRAMEBUFFER fb; // layout only
+  SHADOW_TILE tiles[FB_MAX_TILES];
+  int synced;   // every tile read since the last layout change
+  int relayout; // root window reconfigured
+  int paused;   // the overlay is mapped; reads would see it
+  long long lastRefresh, idleStart, idleCpuStart;
+  SHADOW_STATS stats;
+} X11_SHADOW;
+
+int X11Shadow_Start(X11_SHADOW *s, const char *display);
+void X11Shadow_Stop(X11_SHADOW *s);
+int X11Shadow_Fd(const X11_SHADOW *s);
+
+// Handles pending damage events and refreshes at most every
+// SHADOW_INTERVAL_NS. Returns ns until a refresh is due, or -1 if idle.
+long long X11Shadow_Pump(X11_SHADOW *s, long long now);
+
+// Brings the shadow up to date with everything drawn so far and lends its
+// tiles out. Returns 0 (nothing lent) if it has not been fully read yet.
+int X11Shadow_Snapshot(X11_SHADOW *s, FRAMEBUFFER *layout,
+                       IMAGE tiles[FB_MAX_TILES]);
+// Ends the lending of the last snapshot.
+void X11Shadow_Release(X11_SHADOW *s);
+
+// Stops reading back while the overlay covers the screen; damage keeps
+// accumulating and is applied on resume.
+void X11Shadow_Pause(X11_SHADOW *s, int paused);
+
+#endif
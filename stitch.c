@@ -0,0 +1,355 @@
+#include "stitch.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "platform.h"
+
+#ifdef PLATFORM_X86
+#include <emmintrin.h>
+#endif
+
+#define STITCH_GRAIN 64 // rows per Par_For chunk
+
+static uint64_t Stitch_Mix(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xBF58476D1CE4E5B9ULL;
+  x ^= x >> 27;
+  x *= 0x94D049BB133111EBULL;
+  return x ^ (x >> 31);
+}
+
+// Row fingerprint. Equal rows hash equal; anything that relies on rows
+// being different compares pixels too, so this only has to be fast and
+// spread well.
+static uint64_t Stitch_RowHash(const unsigned char *p, int n) {
+  uint64_t h = 0x9E3779B97F4A7C15ULL;
+  int i = 0;
+#ifdef PLATFORM_X86
+  __m128i sum = _mm_setzero_si128(), rot = _mm_set1_epi32(0x2545F491);
+  for (; i + 16 <= n; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+    sum = _mm_add_epi32(sum, v);
+    rot = _mm_xor_si128(
+        _mm_or_si128(_mm_slli_epi32(rot, 7), _mm_srli_epi32(rot, 25)), v);
+  }
+  uint64_t lanes[4];
+  _mm_storeu_si128((__m128i *)lanes, sum);
+  _mm_storeu_si128((__m128i *)(lanes + 2), rot);
+  for (int k = 0; k < 4; k++)
+    h = Stitch_Mix(h ^ lanes[k]);
+#endif
+  for (; i + 4 <= n; i += 4) {
+    uint32_t v;
+    memcpy(&v, p + i, 4);
+    h = (h ^ v) * 0x100000001B3ULL;
+  }
+  return Stitch_Mix(h);
+}
+
+typedef struct {
+  const IMAGE *img;
+  uint64_t *hash;
+} HASH_JOB;
+
+static void Stitch_HashRows(void *ctx, int begin, int end) {
+  const HASH_JOB *j = (const HASH_JOB *)ctx;
+  for (int y = begin; y < end; y++)
+    j->hash[y] = Stitch_RowHash(IMAGE_ROW(j->img, y), j->img->w * 4);
+}
+
+static void Stitch_Hash(const IMAGE *img, uint64_t *hash) {
+  HASH_JOB j = {img, hash};
+  Par_For(img->h, STITCH_GRAIN, Stitch_HashRows, &j);
+}
+
+static int Stitch_RowEqual(const unsigned char *a, const unsigned char *b,
+                           int n) {
+  int i = 0;
+#ifdef PLATFORM_X86
+  for (; i + 64 <= n; i += 64) {
+    __m128i e = _mm_and_si128(
+        _mm_and_si128(
+            _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i)),
+                           _mm_loadu_si128((const __m128i *)(b + i))),
+            _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i + 16)),
+                           _mm_loadu_si128((const __m128i *)(b + i + 16)))),
+        _mm_and_si128(
+            _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i + 32)),
+                           _mm_loadu_si128((const __m128i *)(b + i + 32))),
+            _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i + 48)),
+                           _mm_loadu_si128((const __m128i *)(b + i + 48)))));
+    if (_mm_movemask_epi8(e) != 0xFFFF)
+      return 0;
+  }
+#endif
+  return !memcmp(a + i, b + i, (size_t)(n - i));
+}
+
+// The previous frame's row j is prev row (base + j).
+typedef struct {
+  const IMAGE *prev;
+  int base;
+  const IMAGE *cur;
+  int top, d; // cur rows from top + begin match prev rows d further down
+  volatile long differ;
+} VERIFY_JOB;
+
+static void Stitch_VerifyRows(void *ctx, int begin, int end) {
+  VERIFY_JOB *j = (VERIFY_JOB *)ctx;
+  int n = j->cur->w * 4;
+  for (int i = begin; i < end; i++) {
+    if ((i & 15) == 0 && Atomic_Load(&j->differ))
+      return;
+    int y = j->top + i;
+    if (!Stitch_RowEqual(IMAGE_ROW(j->cur, y),
+                         IMAGE_ROW(j->prev, j->base + y + j->d), n)) {
+      Atomic_Store(&j->differ, 1);
+      return;
+    }
+  }
+}
+
+// Pixel check of cur rows [top, bottom - d) against the previous frame's
+// rows [top + d, bottom).
+static int Stitch_Verify(const IMAGE *prev, int base, const IMAGE *cur,
+                         int top, int bottom, int d, long long *ns) {
+  long long t0 = Clock_Ns();
+  VERIFY_JOB j = {prev, base, cur, top, d, 0};
+  Par_For(bottom - d - top, STITCH_GRAIN, Stitch_VerifyRows, &j);
+  *ns += Clock_Ns() - t0;
+  return !j.differ;
+}
+
+static int Stitch_HashesEqual(const uint64_t *a, const uint64_t *b, int n) {
+  return !memcmp(a, b, (size_t)n * sizeof(*a));
+}
+
+// Rows i around the probe [p, p + k) with cur row i == prev row i + d, as
+// [*a, *b) within [lo, hi).
+static void Stitch_Run(const uint64_t *ph, const uint64_t *ch, int lo, int hi,
+                       int p, int k, int d, int *a, int *b) {
+  int i = p;
+  while (i > lo && ch[i - 1] == ph[i - 1 + d])
+    i--;
+  *a = i;
+  i = p + k;
+  while (i < hi && ch[i] == ph[i + d])
+    i++;
+  *b = i;
+}
+
+// Offset d >= 0 such that cur rows [top, bottom - d) are the previous
+// frame's rows [top + d, bottom), or STITCH_SKIPPED. With a fixed band the
+// smallest d that covers all of it wins. Otherwise the band is found here:
+// the longest run of matching rows around the probe (at least two windows)
+// and the new rows under it, returned in *top, *bottom.
+static int Stitch_Align(const IMAGE *prev, int base, const uint64_t *ph,
+                        const IMAGE *cur, const uint64_t *ch, int *top,
+                        int *bottom, int fixed, long long *verifyNs) {
+  int lo = *top, hi = *bottom, band = hi - lo;
+  if (band <= 0)
+    return 0;
+  if (Stitch_HashesEqual(ph + lo, ch + lo, band) &&
+      Stitch_Verify(prev, base, cur, lo, hi, 0, verifyNs))
+    return 0;
+  int k = band / 4 < STITCH_WINDOW ? band / 4 : STITCH_WINDOW;
+  if (k < 1)
+    return STITCH_SKIPPED;
+  // Probe with the first window that is not one row repeated (blank space
+  // would match anywhere), starting where the frames first differ unless
+  // the band is known.
+  int from = lo;
+  while (!fixed && from < hi && ch[from] == ph[from])
+    from++;
+  int i = from + 1;
+  while (i < hi && ch[i] == ch[i - 1])
+    i++;
+  int s = i - k + 1 > from ? i - k + 1 : from;
+  if (i >= hi || s + k >= hi)
+    return STITCH_SKIPPED;
+
+  // Rabin-Karp over the row hashes, mod 2^64.
+  const uint64_t B = 0x100000001B3ULL;
+  uint64_t pow = 1, probe = 0, roll = 0;
+  for (int r = 0; r < k; r++) {
+    probe = probe * B + ch[s + r];
+    roll = roll * B + ph[s + 1 + r];
+    if (r)
+      pow *= B;
+  }
+  int best = STITCH_SKIPPED, bestA = 0, bestB = 0;
+  for (int p = s + 1; p + k <= hi; p++) {
+    if (p > s + 1)
+      roll = (roll - ph[p - 1] * pow) * B + ph[p + k - 1];
+    if (roll != probe || !Stitch_HashesEqual(ph + p, ch + s, k))
+      continue;
+    int d = p - s, a, b;
+    Stitch_Run(ph, ch, lo, hi - d, s, k, d, &a, &b);
+    if (fixed) {
+      if (a == lo && b == hi - d &&
+          Stitch_Verify(prev, base, cur, lo, hi, d, verifyNs))
+        return d;
+    } else if (b - a > bestB - bestA) {
+      best = d;
+      bestA = a;
+      bestB = b;
+    }
+  }
+  if (best == STITCH_SKIPPED || bestB - bestA < 2 * k ||
+      !Stitch_Verify(prev, base, cur, bestA, bestB + best, best, verifyNs))
+    return STITCH_SKIPPED;
+  *top = bestA;
+  *bottom = bestB + best;
+  return best;
+}
+
+static int Stitch_Reserve(STITCH *s, int rows) {
+  if (rows > STITCH_MAX_ROWS)
+    return 0;
+  if (rows <= s->cap)
+    return 1;
+  int cap = s->cap * 2 > rows ? s->cap * 2 : rows;
+  if (cap > STITCH_MAX_ROWS)
+    cap = STITCH_MAX_ROWS;
+  unsigned char *px =
+      (unsigned char *)realloc(s->out.px, (size_t)cap * (size_t)s->out.stride);
+  if (!px)
+    return 0;
+  s->out.px = px;
+  s->cap = cap;
+  return 1;
+}
+
+static void Stitch_CopyRows(IMAGE *dst, int dy, const IMAGE *src, int sy,
+                            int rows) {
+  for (int r = 0; r < rows; r++)
+    memcpy(IMAGE_ROW(dst, dy + r), IMAGE_ROW(src, sy + r),
+           (size_t)src->w * 4);
+}
+
+int Stitch_Begin(STITCH *s, const IMAGE *first) {
+  memset(s, 0, sizeof(*s));
+  s->w = first->w;
+  s->h = first->h;
+  s->out.w = first->w;
+  s->out.stride = first->w * 4;
+  s->top = 0;
+  s->bottom = first->h;
+  s->prevHash = (uint64_t *)malloc((size_t)first->h * sizeof(uint64_t));
+  s->hash = (uint64_t *)malloc((size_t)first->h * sizeof(uint64_t));
+  if (first->w <= 0 || first->h <= 0 || !s->prevHash || !s->hash ||
+      !Stitch_Reserve(s, first->h * 2 < STITCH_MAX_ROWS ? first->h * 2
+                                                       : first->h)) {
+    Stitch_Free(s);
+    return 0;
+  }
+  s->out.h = first->h;
+  Stitch_CopyRows(&s->out, 0, first, 0, first->h);
+  Stitch_Hash(first, s->prevHash);
+  s->st.frames = 1;
+  return 1;
+}
+
+// Keeps the latest rows below the band for Stitch_Finish.
+static void Stitch_KeepFoot(STITCH *s, const IMAGE *frame) {
+  if (s->foot.h)
+    Stitch_CopyRows(&s->foot, 0, frame, s->bottom, s->foot.h);
+}
+
+int Stitch_Add(STITCH *s, const IMAGE *frame) {
+  if (frame->w != s->w || frame->h != s->h)
+    return STITCH_SKIPPED;
+  STITCH_STATS *st = &s->st;
+  st->frames++;
+  long long t0 = Clock_Ns();
+  Stitch_Hash(frame, s->hash);
+  long long t1 = Clock_Ns();
+  st->hashNs += t1 - t0;
+
+  int top = s->top, bottom = s->bottom;
+  long long verifyNs = 0;
+  int d = Stitch_Align(&s->out, s->base, s->prevHash, frame, s->hash, &top,
+                       &bottom, s->fixed, &verifyNs);
+  long long ns = Clock_Ns() - t0;
+  st->alignNs += ns - (t1 - t0) - verifyNs;
+  st->verifyNs += verifyNs;
+  if (st->alignMaxNs < ns)
+    st->alignMaxNs = ns;
+  if (d == STITCH_SKIPPED) {
+    st->skipped++;
+    return STITCH_SKIPPED;
+  }
+  if (d == 0) {
+    st->unchanged++;
+    Stitch_KeepFoot(s, frame);
+    return 0;
+  }
+
+  if (!s->fixed) {
+    // First scroll: the rows above and below the band stay put from now
+    // on. The first frame's rows below it come back at the end.
+    if (bottom < s->h && !Image_Alloc(&s->foot, s->w, s->h - bottom))
+      return STITCH_FULL;
+    s->top = top;
+    s->bottom = bottom;
+    s->fixed = 1;
+    s->out.h = bottom;
+  }
+  // leave room for the rows below the band, or Stitch_Finish could not
+  // add them
+  if (!Stitch_Reserve(s, s->out.h + d + s->foot.h))
+    return STITCH_FULL;
+  Stitch_CopyRows(&s->out, s->out.h, frame, s->bottom - d, d);
+  s->out.h += d;
+  s->base += d;
+  Stitch_KeepFoot(s, frame);
+  uint64_t *t = s->prevHash;
+  s->prevHash = s->hash;
+  s->hash = t;
+  st->appended += (unsigned long long)d;
+  return d;
+}
+
+int Stitch_Finish(STITCH *s, IMAGE *out) {
+  int ok = s->out.px != NULL;
+  if (ok && s->foot.h) {
+    ok = Stitch_Reserve(s, s->out.h + s->foot.h);
+    if (ok) {
+      Stitch_CopyRows(&s->out, s->out.h, &s->foot, 0, s->foot.h);
+      s->out.h += s->foot.h;
+    }
+  }
+  if (ok) {
+    *out = s->out;
+    s->out.px = NULL;
+  }
+  Stitch_Free(s);
+  return ok;
+}
+
+void Stitch_Free(STITCH *s) {
+  free(s->out.px);
+  free(s->prevHash);
+  free(s->hash);
+  Image_Free(&s->foot);
+  s->out.px = NULL;
+  s->prevHash = s->hash = NULL;
+  s->cap = 0;
+}
+
+int Stitch_Offset(const IMAGE *a, const IMAGE *b) {
+  if (a->w != b->w || a->h != b->h || a->h <= 0)
+    return STITCH_SKIPPED;
+  uint64_t *ha = (uint64_t *)malloc((size_t)a->h * 2 * sizeof(uint64_t));
+  if (!ha)
+    return STITCH_SKIPPED;
+  uint64_t *hb = ha + a->h;
+  Stitch_Hash(a, ha);
+  Stitch_Hash(b, hb);
+  long long ns = 0;
+  int top = 0, bottom = a->h;
+  int d = Stitch_Align(a, 0, ha, b, hb, &top, &bottom, 0, &ns);
+  free(ha);
+  return d;
+}
@@ -0,0 +1,62 @@
+#ifndef SCREENSHOT_STITCH_H
+#define SCREENSHOT_STITCH_H
+
+#include <stdint.h>
+
+#include "image.h"
+
+// Scrolling capture: frames of the same region, taken while its content
+// scrolls down, are stitched into one tall image. Each row of a frame is
+// hashed once; the vertical offset to the previous frame is found by
+// sliding a rolling hash of a few consecutive row hashes over the previous
+// frame, and a candidate is accepted only if every overlapping row matches
+// pixel for pixel. Rows that stay put at the top and bottom (sticky headers,
+// toolbars, status bars) are detected on the first scroll and kept once.
+//
+// The stitched image doubles as the previous frame: its last rows are that
+// frame's scrolling band, so frames are never copied, only the new rows.
+// Content must scroll as a whole across the full width; a frame that moved
+// by more than its scrolling band, or not at all, adds nothing.
+
+#define STITCH_WINDOW 16          // rows per rolling-hash probe
+#define STITCH_MAX_ROWS 65536     // height of the stitched image
+#define STITCH_INTERVAL_MS 66     // suggested time between frames
+
+enum {
+  STITCH_SKIPPED = -1, // no overlap with the previous frame (or wrong size)
+  STITCH_FULL = -2     // STITCH_MAX_ROWS reached, or out of memory
+};
+
+typedef struct {
+  unsigned long long frames, appended, unchanged, skipped;
+  long long hashNs, alignNs, verifyNs; // totals
+  long long alignMaxNs;                // hash + align + verify, worst frame
+} STITCH_STATS;
+
+typedef struct {
+  IMAGE out;   // stitched so far (stride w * 4); rows allocated: cap
+  int cap;
+  int w, h;    // frame size
+  int top, bottom; // scrolling band [top, bottom), fixed on the first scroll
+  int fixed;
+  int base;    // out row of the previous frame's row 0
+  uint64_t *prevHash, *hash; // row hashes, h each
+  IMAGE foot;  // last frame's rows [bottom, h)
+  STITCH_STATS st;
+} STITCH;
+
+// Starts from the first frame. Returns 0 if out of memory.
+int Stitch_Begin(STITCH *s, const IMAGE *first);
+// Rows appended (0 if nothing scrolled), or STITCH_SKIPPED / STITCH_FULL.
+int Stitch_Add(STITCH *s, const IMAGE *frame);
+// Appends the bottom rows that never scrolled and hands the stitched image
+// to the caller (free with Image_Free). Frees everything else.
+int Stitch_Finish(STITCH *s, IMAGE *out);
+void Stitch_Free(STITCH *s);
+
+// How far b's content sits above a's, in rows, finding the scrolling band
+// the way the first scroll of Stitch_Add does; 0 if the frames are the
+// same, STITCH_SKIPPED if no offset fits.
+int Stitch_Offset(const IMAGE *a, const IMAGE *b);
+
+#endif
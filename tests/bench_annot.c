@@ -0,0 +1,205 @@
+// Annotation tile cache on 4K and 8K frames with 100 to 1000 annotations
+// (arrows, boxes, highlighter marks and labels of mixed sizes): adding them,
+// the first paint, repainting 300x200 rects with no edit (as a moving
+// loupe or selection does), nudging one a few pixels as a drag does (the
+// edit plus repainting its old and new bounds), and dragging the corner of
+// a small and a large box. Each repaint is also timed without the cache,
+// reading the frame and drawing every annotation clipped to the same
+// rects, and the whole frame rasterized again. Reports p50 and worst.
+//   bench_annot [max-width]
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "annot.h"
+#include "platform.h"
+#include "test.h"
+
+#define EDITS 500
+
+typedef struct {
+  FRAMEBUFFER fb;
+  ANNOT_LAYER l;
+  IMAGE back;
+} ANNOT_RUN;
+
+static int CompareLL(const void *a, const void *b) {
+  long long x = *(const long long *)a, y = *(const long long *)b;
+  return x < y ? -1 : x > y;
+}
+
+static void Sort(long long *t, int n, double *p50, double *worst) {
+  qsort(t, (size_t)n, sizeof(t[0]), CompareLL);
+  *p50 = t[n / 2] / 1e6;
+  *worst = t[n - 1] / 1e6;
+}
+
+static ANNOTATION Random(uint32_t *s, int w, int h, int i) {
+  ANNOTATION a;
+  memset(&a, 0, sizeof(a));
+  a.kind = i % ANNOT_KINDS;
+  a.color = a.kind == ANNOT_MARK ? ANNOT_HIGHLIGHT : ANNOT_COLOR;
+  a.x0 = (int)(Test_Rand(s) % (uint32_t)w);
+  a.y0 = (int)(Test_Rand(s) % (uint32_t)h);
+  int dx = (int)(Test_Rand(s) % 801) - 400;
+  int dy = (int)(Test_Rand(s) % 601) - 300;
+  if (a.kind == ANNOT_MARK)
+    dy = 20 + dy / 20; // a line of text high
+  a.x1 = a.x0 + dx;
+  a.y1 = a.y0 + dy;
+  if (a.kind == ANNOT_TEXT)
+    a.len = snprintf(a.text, sizeof(a.text), "label %d", i);
+  return a;
+}
+
+// What the overlay does on a drag step: the edit, then a repaint of the
+// annotation's old and new bounds through the cache.
+static long long Edit(ANNOT_RUN *r, int i, const ANNOTATION *a) {
+  long long t0 = Clock_Ns();
+  IRECT old = r->l.bounds[i];
+  Annot_Set(&r->l, i, a);
+  Annot_Draw(&r->l, &r->fb, NULL, &r->back, &old);
+  Annot_Draw(&r->l, &r->fb, NULL, &r->back, &r->l.bounds[i]);
+  return Clock_Ns() - t0;
+}
+
+// The same repaint without the cache: the frame under each rect, and every
+// annotation clipped to it.
+static long long Uncached(ANNOT_RUN *r, const IRECT *rects, int n) {
+  long long t0 = Clock_Ns();
+  for (int k = 0; k < n; k++) {
+    Framebuffer_Read(&r->fb, 0, &rects[k], &r->back, 0, 0);
+    Annot_Flatten(&r->l, &r->back, 0, 0, &rects[k]);
+  }
+  return Clock_Ns() - t0;
+}
+
+static void RunFull(void *ctx) {
+  ANNOT_RUN *r = (ANNOT_RUN *)ctx;
+  IRECT all = {0, 0, r->fb.w, r->fb.h};
+  Uncached(r, &all, 1);
+}
+
+// Drags the corner of a side x side box one pixel a step, out and back.
+static void BoxDrag(ANNOT_RUN *r, int side, uint32_t *s) {
+  ANNOTATION a;
+  memset(&a, 0, sizeof(a));
+  a.kind = ANNOT_BOX;
+  a.color = ANNOT_COLOR;
+  a.x0 = (int)(Test_Rand(s) % (uint32_t)(r->fb.w - 2 * side));
+  a.y0 = (int)(Test_Rand(s) % (uint32_t)(r->fb.h - 2 * side));
+  a.x1 = a.x0 + side;
+  a.y1 = a.y0 + side;
+  int i = Annot_Add(&r->l, &r->fb, &a);
+  if (i < 0)
+    return;
+  IRECT all = {0, 0, r->fb.w, r->fb.h};
+  Annot_Draw(&r->l, &r->fb, NULL, &r->back, &all);
+  long long cached[EDITS], plain[EDITS];
+  for (int e = 0; e < EDITS; e++) {
+    int d = e < EDITS / 2 ? 1 : -1;
+    a.x1 += d;
+    a.y1 += d;
+    IRECT old = r->l.bounds[i];
+    cached[e] = Edit(r, i, &a);
+    IRECT rects[2] = {old, r->l.bounds[i]};
+    plain[e] = Uncached(r, rects, 2);
+  }
+  double p50, worst, u50, uworst;
+  Sort(cached, EDITS, &p50, &worst);
+  Sort(plain, EDITS, &u50, &uworst);
+  printf("%-22s box %3dx%-3d corner: p50 %.3f ms, worst %.3f ms; "
+         "uncached p50 %.3f ms\n",
+         "", side, side, p50, worst, u50);
+  Annot_Pop(&r->l);
+}
+
+static void Run(int w, int h, int count) {
+  ANNOT_RUN r;
+  memset(&r, 0, sizeof(r));
+  IRECT mon = {0, 0, w, h};
+  Framebuffer_Layout(&r.fb, &mon, 1);
+  IMAGE *img = &r.fb.tiles[0].capture;
+  if (!Image_Alloc(img, w, h) || !Image_Alloc(&r.back, w, h)) {
+    printf("%5dx%-4d skipped (out of memory)\n", w, h);
+    Image_Free(img);
+    return;
+  }
+  Test_Noise(img, 4);
+  uint32_t s = (uint32_t)count;
+  long long t0 = Clock_Ns();
+  for (int i = 0; i < count; i++) {
+    ANNOTATION a = Random(&s, w, h, i);
+    Annot_Add(&r.l, &r.fb, &a);
+  }
+  double add = (Clock_Ns() - t0) / 1e6;
+  IRECT all = {0, 0, w, h};
+  t0 = Clock_Ns();
+  Annot_Draw(&r.l, &r.fb, NULL, &r.back, &all);
+  double first = (Clock_Ns() - t0) / 1e6;
+  double full = Test_BestMs(RunFull, &r, 3);
+
+  // repaints: the frame under a rect, then the annotations over it
+  long long cached[EDITS], plain[EDITS];
+  for (int e = 0; e < EDITS; e++) {
+    int x = (int)(Test_Rand(&s) % (uint32_t)(w - 300));
+    int y = (int)(Test_Rand(&s) % (uint32_t)(h - 200));
+    IRECT d = {x, y, x + 300, y + 200};
+    t0 = Clock_Ns();
+    Framebuffer_Read(&r.fb, 0, &d, &r.back, 0, 0);
+    Annot_Draw(&r.l, &r.fb, NULL, &r.back, &d);
+    cached[e] = Clock_Ns() - t0;
+    plain[e] = Uncached(&r, &d, 1);
+  }
+  double p50, worst, u50, uworst;
+  Sort(cached, EDITS, &p50, &worst);
+  Sort(plain, EDITS, &u50, &uworst);
+  printf("%5dx%-4d %5d annot  add %6.2f ms, first paint %7.2f ms, "
+         "all again %7.2f ms, cache %5.1f MB\n",
+         w, h, count, add, first, full, r.l.stats.cacheBytes / 1e6);
+  printf("%-22s repaint: p50 %.3f ms, worst %.3f ms; uncached p50 %.3f ms, "
+         "worst %.3f ms\n",
+         "", p50, worst, u50, uworst);
+
+  // nudges: a random annotation moved up to 3 pixels each way
+  unsigned long long tiles = r.l.stats.tilesDrawn;
+  for (int e = 0; e < EDITS; e++) {
+    int i = (int)(Test_Rand(&s) % (uint32_t)count);
+    ANNOTATION a = r.l.item[i];
+    int dx = (int)(Test_Rand(&s) % 7) - 3;
+    int dy = (int)(Test_Rand(&s) % 7) - 3;
+    a.x0 += dx;
+    a.x1 += dx;
+    a.y0 += dy;
+    a.y1 += dy;
+    IRECT old = r.l.bounds[i];
+    cached[e] = Edit(&r, i, &a);
+    IRECT rects[2] = {old, r.l.bounds[i]};
+    plain[e] = Uncached(&r, rects, 2);
+  }
+  tiles = r.l.stats.tilesDrawn - tiles;
+  Sort(cached, EDITS, &p50, &worst);
+  Sort(plain, EDITS, &u50, &uworst);
+  printf("%-22s nudge: p50 %.3f ms, worst %.3f ms, %.1f tiles drawn; "
+         "uncached p50 %.3f ms\n",
+         "", p50, worst, (double)tiles / EDITS, u50);
+  BoxDrag(&r, 32, &s);
+  BoxDrag(&r, 512, &s);
+  Annot_Clear(&r.l);
+  Framebuffer_Free(&r.fb);
+  Image_Free(img);
+  Image_Free(&r.back);
+}
+
+int main(int argc, char **argv) {
+  static const int kSizes[][2] = {{3840, 2160}, {7680, 4320}};
+  static const int kCount[] = {100, 500, 1000};
+  int maxW = argc > 1 ? atoi(argv[1]) : 7680;
+  printf("bench_annot: %d thread(s), %d edits per run, %dx%d tiles\n",
+         Cpu_Count(), EDITS, ANNOT_TILE, ANNOT_TILE);
+  for (size_t i = 0; i < sizeof(kSizes) / sizeof(kSizes[0]); i++)
+    for (size_t c = 0; c < sizeof(kCount) / sizeof(kCount[0]); c++)
+      if (kSizes[i][0] <= maxW)
+        Run(kSizes[i][0], kSizes[i][1], kCount[c]);
+  return 0;
+}
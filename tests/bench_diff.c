@@ -0,0 +1,144 @@
+// Visual diff at 1080p, 4K and 8K: compare and merge times for an identical
+// pair, a pair with scattered UI-sized edits, one with noise jitter under
+// the threshold on every pixel, and one where every pixel changed, against
+// a plain per-pixel loop that tests the threshold and grows one bounding
+// box. Also times Diff_Highlight. Exits non-zero if a changed-pixel count
+// differs from the plain loop's.
+//   bench_diff [max-width]
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "diff.h"
+#include "platform.h"
+#include "test.h"
+
+#define JITTER_THRESHOLD 8
+
+typedef struct {
+  DIFF d;
+  IMAGE a, b;
+  int threshold;
+  IRECT box;
+  unsigned long long changed;
+} DIFF_RUN;
+
+static void RunCompare(void *ctx) {
+  DIFF_RUN *r = (DIFF_RUN *)ctx;
+  Diff_Compare(&r->d, &r->a, &r->b, r->threshold);
+}
+
+// Every pixel, every channel, one thread.
+static void RunPlain(void *ctx) {
+  DIFF_RUN *r = (DIFF_RUN *)ctx;
+  IRECT box = {r->b.w, r->b.h, 0, 0};
+  unsigned long long n = 0;
+  for (int y = 0; y < r->b.h; y++) {
+    const unsigned char *p = IMAGE_ROW(&r->a, y), *q = IMAGE_ROW(&r->b, y);
+    for (int x = 0; x < r->b.w; x++, p += 4, q += 4) {
+      int c = 0;
+      for (int k = 0; k < 3; k++)
+        c |= abs(p[k] - q[k]) > r->threshold;
+      if (!c)
+        continue;
+      n++;
+      if (x < box.left)
+        box.left = x;
+      if (x >= box.right)
+        box.right = x + 1;
+      if (y < box.top)
+        box.top = y;
+      box.bottom = y + 1;
+    }
+  }
+  r->box = box;
+  r->changed = n;
+}
+
+// Windows of text changed, a cursor, a progress bar: 40 rects of 8 to 400
+// pixels a side.
+static void Edits(IMAGE *img) {
+  uint32_t s = 9;
+  for (int i = 0; i < 40; i++) {
+    int w = 8 + (int)(Test_Rand(&s) % 392);
+    int h = 8 + (int)(Test_Rand(&s) % 392);
+    int x0 = (int)(Test_Rand(&s) % (uint32_t)(img->w - w));
+    int y0 = (int)(Test_Rand(&s) % (uint32_t)(img->h - h));
+    for (int y = y0; y < y0 + h; y++) {
+      unsigned char *p = IMAGE_ROW(img, y) + (size_t)x0 * 4;
+      for (int x = 0; x < w * 4; x++)
+        if ((x & 3) != 3)
+          p[x] ^= 0x80;
+    }
+  }
+}
+
+// Every color channel moved by up to 3 either way, as a re-encode or a
+// different renderer would.
+static void Jitter(IMAGE *img) {
+  uint32_t s = 17;
+  for (int y = 0; y < img->h; y++) {
+    unsigned char *p = IMAGE_ROW(img, y);
+    for (int x = 0; x < img->w * 4; x++) {
+      if ((x & 3) == 3)
+        continue;
+      int v = p[x] + (int)(Test_Rand(&s) % 7) - 3;
+      p[x] = (unsigned char)(v < 0 ? 0 : v > 255 ? 255 : v);
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  static const int kSizes[][2] = {{1920, 1080}, {3840, 2160}, {7680, 4320}};
+  static const char *kCase[] = {"same", "edits", "jitter", "all"};
+  int maxW = argc > 1 ? atoi(argv[1]) : 7680, mismatch = 0;
+  printf("bench_diff: %d thread(s)\n", Cpu_Count());
+  printf("%-10s %-6s %9s %9s %8s %8s %12s %9s %9s\n", "size", "pair",
+         "compare", "merge", "regions", "tiles", "changed px", "plain ms",
+         "highlight");
+  for (size_t i = 0; i < sizeof(kSizes) / sizeof(kSizes[0]); i++) {
+    int w = kSizes[i][0], h = kSizes[i][1];
+    if (w > maxW)
+      continue;
+    DIFF_RUN r;
+    memset(&r, 0, sizeof(r));
+    if (!Image_Alloc(&r.a, w, h) || !Image_Alloc(&r.b, w, h)) {
+      printf("%5dx%-4d skipped (out of memory)\n", w, h);
+      Image_Free(&r.a);
+      continue;
+    }
+    Test_Noise(&r.a, 1);
+    for (int c = 0; c < 4; c++) {
+      for (int y = 0; y < h; y++)
+        memcpy(IMAGE_ROW(&r.b, y), IMAGE_ROW(&r.a, y), (size_t)w * 4);
+      r.threshold = 0;
+      if (c == 1) {
+        Edits(&r.b);
+      } else if (c == 2) {
+        Jitter(&r.b);
+        r.threshold = JITTER_THRESHOLD;
+      } else if (c == 3) {
+        Test_Noise(&r.b, 2);
+      }
+      double compare = Test_BestMs(RunCompare, &r, 5);
+      const DIFF_STATS *st = &r.d.stats;
+      double plain = Test_BestMs(RunPlain, &r, 1);
+      IMAGE out;
+      long long t0 = Clock_Ns();
+      int ok = Diff_Highlight(&r.d, &r.a, &r.b, &out);
+      double highlight = (Clock_Ns() - t0) / 1e6;
+      if (ok)
+        Image_Free(&out);
+      mismatch += st->pixels != r.changed;
+      printf("%5dx%-4d %-6s %9.2f %9.3f %8d %8d %12llu %9.1f %9.1f%s\n", w,
+             h, kCase[c], compare, st->mergeNs / 1e6, r.d.n, st->changed,
+             st->pixels, plain, highlight,
+             st->pixels != r.changed ? "  (differs from the plain loop)"
+                                     : "");
+    }
+    Diff_Free(&r.d);
+    Image_Free(&r.a);
+    Image_Free(&r.b);
+  }
+  return mismatch ? 1 : 0;
+}
@@ -0,0 +1,50 @@
+// Dim_Build throughput per kernel, 1080p to 16K, on every core.
+//   bench_dim [max-width]
+
+#include <stdlib.h>
+
+#include "dim.h"
+#include "platform.h"
+#include "test.h"
+
+typedef struct {
+  IMAGE src, dst;
+  DIM_PATH path;
+} DIM_RUN;
+
+static void Run(void *ctx) {
+  DIM_RUN *r = (DIM_RUN *)ctx;
+  Dim_BuildPath(&r->src, &r->dst, 96, r->path);
+}
+
+int main(int argc, char **argv) {
+  static const int kSizes[][2] = {{1920, 1080}, {3840, 2160}, {5120, 2880},
+                                  {7680, 4320}, {11520, 2160},
+                                  {15360, 8640}};
+  static const char *kPathName[] = {"scalar", "sse2", "avx2"};
+  int maxW = argc > 1 ? atoi(argv[1]) : 15360;
+  printf("bench_dim: %d thread(s)\n", Cpu_Count());
+  printf("%-12s %-7s %10s %10s\n", "size", "kernel", "ms", "MB/s");
+  for (size_t i = 0; i < sizeof(kSizes) / sizeof(kSizes[0]); i++) {
+    int w = kSizes[i][0], h = kSizes[i][1];
+    if (w > maxW)
+      continue;
+    DIM_RUN r;
+    if (!Image_Alloc(&r.src, w, h) || !Image_Alloc(&r.dst, w, h)) {
+      printf("%5dx%-6d skipped (out of memory)\n", w, h);
+      Image_Free(&r.src);
+      continue;
+    }
+    Test_Noise(&r.src, 7);
+    double mb = (double)w * h * 4 / 1e6;
+    for (int p = DIM_SCALAR; p <= (int)Dim_BestPath(); p++) {
+      r.path = (DIM_PATH)p;
+      double ms = Test_BestMs(Run, &r, w > 8000 ? 3 : 7);
+      printf("%5dx%-6d %-7s %10.2f %10.0f\n", w, h, kPathName[p], ms,
+             mb / (ms / 1e3));
+    }
+    Image_Free(&r.src);
+    Image_Free(&r.dst);
+  }
+  return 0;
+}
@@ -0,0 +1,207 @@
+// Snap-to-edge index: build time per stage and per-query cost, 1080p to
+// 8K, on a synthetic desktop (windows with borders, title bars, buttons
+// and lines of glyph-like strokes over a gradient wallpaper) and on noise,
+// where most boundaries are edges and the tables overflow. Queries are a
+// random scatter and a drag path, one Edges_SnapY plus Edges_SnapX each,
+// against snapping by scanning the pixels around the cursor.
+//   bench_edges [max-width]
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "edges.h"
+#include "framebuffer.h"
+#include "platform.h"
+#include "test.h"
+
+#define QUERIES (1 << 20)
+
+static void FillRect(IMAGE *img, int x0, int y0, int x1, int y1, unsigned c) {
+  for (int y = y0; y < y1; y++) {
+    unsigned *p = (unsigned *)IMAGE_ROW(img, y);
+    for (int x = x0; x < x1; x++)
+      p[x] = c;
+  }
+}
+
+// One window per 0.3 megapixels, each with a 1-pixel border, a title bar,
+// a row of buttons and text.
+static void Desktop(IMAGE *img) {
+  uint32_t s = 77;
+  for (int y = 0; y < img->h; y++) {
+    unsigned *p = (unsigned *)IMAGE_ROW(img, y);
+    for (int x = 0; x < img->w; x++)
+      p[x] = 0xFF000040u | (unsigned)(x * 255 / img->w) << 16 |
+             (unsigned)(y * 255 / img->h) << 8;
+  }
+  int windows = (int)((long long)img->w * img->h / 300000);
+  for (int i = 0; i < windows; i++) {
+    int w = 400 + (int)(Test_Rand(&s) % 800);
+    int h = 300 + (int)(Test_Rand(&s) % 500);
+    int x0 = (int)(Test_Rand(&s) % (uint32_t)(img->w - w));
+    int y0 = (int)(Test_Rand(&s) % (uint32_t)(img->h - h));
+    FillRect(img, x0, y0, x0 + w, y0 + h, 0xFF707070u);
+    FillRect(img, x0 + 1, y0 + 1, x0 + w - 1, y0 + 29, 0xFF3050A0u);
+    FillRect(img, x0 + 1, y0 + 29, x0 + w - 1, y0 + h - 1, 0xFFF0F0F0u);
+    for (int b = x0 + 8; b + 80 < x0 + w - 8; b += 90) {
+      FillRect(img, b, y0 + 36, b + 80, y0 + 60, 0xFF909090u);
+      FillRect(img, b + 1, y0 + 37, b + 79, y0 + 59, 0xFFE0E0E0u);
+    }
+    for (int y = y0 + 70; y < y0 + h - 8; y++) {
+      unsigned *p = (unsigned *)IMAGE_ROW(img, y);
+      if ((y - y0 - 70) % 18 >= 12)
+        continue;
+      for (int x = x0 + 8; x < x0 + w - 8; x++)
+        if ((Test_Rand(&s) & 3) == 0)
+          p[x] = 0xFF202020u;
+    }
+  }
+}
+
+typedef struct {
+  FRAMEBUFFER fb;
+  EDGE_INDEX e;
+  int (*pt)[2];
+  int moved;
+} EDGE_RUN;
+
+static void RunBuild(void *ctx) {
+  EDGE_RUN *r = (EDGE_RUN *)ctx;
+  Edges_Build(&r->e, &r->fb); // frees the last tables first
+}
+
+static void RunQueries(void *ctx) {
+  EDGE_RUN *r = (EDGE_RUN *)ctx;
+  int moved = 0;
+  for (int i = 0; i < QUERIES; i++) {
+    int x = r->pt[i][0], y = r->pt[i][1];
+    int sy = Edges_SnapY(&r->e, x, y, EDGE_SNAP);
+    int sx = Edges_SnapX(&r->e, x, sy, EDGE_SNAP);
+    moved += sx != x || sy != y;
+  }
+  r->moved = moved;
+}
+
+static int Step(const unsigned char *a, const unsigned char *b) {
+  for (int c = 0; c < 3; c++)
+    if (abs(a[c] - b[c]) > EDGE_THRESHOLD)
+      return 1;
+  return 0;
+}
+
+// Nearest boundary within EDGE_SNAP by reading pixels, without the run
+// filter: what each mouse move would cost with no index.
+static void RunScan(void *ctx) {
+  EDGE_RUN *r = (EDGE_RUN *)ctx;
+  const IMAGE *img = &r->fb.tiles[0].capture;
+  int moved = 0;
+  for (int i = 0; i < QUERIES; i++) {
+    int x = r->pt[i][0], y = r->pt[i][1], sx = x, sy = y;
+    for (int d = 0; d <= EDGE_SNAP; d++) {
+      int a = y - d, b = y + d;
+      if (a > 0 && Step(IMAGE_ROW(img, a - 1) + x * 4,
+                        IMAGE_ROW(img, a) + x * 4)) {
+        sy = a;
+        break;
+      }
+      if (b > 0 && b < img->h &&
+          Step(IMAGE_ROW(img, b - 1) + x * 4, IMAGE_ROW(img, b) + x * 4)) {
+        sy = b;
+        break;
+      }
+    }
+    const unsigned char *row = IMAGE_ROW(img, sy);
+    for (int d = 0; d <= EDGE_SNAP; d++) {
+      int a = x - d, b = x + d;
+      if (a > 0 && Step(row + (a - 1) * 4, row + a * 4)) {
+        sx = a;
+        break;
+      }
+      if (b > 0 && b < img->w && Step(row + (b - 1) * 4, row + b * 4)) {
+        sx = b;
+        break;
+      }
+    }
+    moved += sx != x || sy != y;
+  }
+  r->moved = moved;
+}
+
+// Random points, or a drag: a few pixels a step, turning now and then.
+static void Points(int (*pt)[2], int w, int h, int drag) {
+  uint32_t s = 5;
+  int x = w / 2, y = h / 2, dx = 3, dy = 2;
+  for (int i = 0; i < QUERIES; i++) {
+    if (drag) {
+      if (i % 200 == 0) {
+        dx = (int)(Test_Rand(&s) % 7) - 3;
+        dy = (int)(Test_Rand(&s) % 7) - 3;
+      }
+      x = x + dx < 0 || x + dx >= w ? x - dx : x + dx;
+      y = y + dy < 0 || y + dy >= h ? y - dy : y + dy;
+    } else {
+      x = (int)(Test_Rand(&s) % (uint32_t)w);
+      y = (int)(Test_Rand(&s) % (uint32_t)h);
+    }
+    pt[i][0] = x;
+    pt[i][1] = y;
+  }
+}
+
+int main(int argc, char **argv) {
+  static const int kSizes[][2] = {{1920, 1080}, {3840, 2160}, {7680, 4320}};
+  int maxW = argc > 1 ? atoi(argv[1]) : 7680;
+  EDGE_RUN r;
+  memset(&r, 0, sizeof(r));
+  r.pt = (int(*)[2])malloc(sizeof(*r.pt) * QUERIES);
+  if (!r.pt) {
+    printf("out of memory\n");
+    return 1;
+  }
+  printf("bench_edges: %d thread(s), %d queries per run, snap %d px\n",
+         Cpu_Count(), QUERIES, EDGE_SNAP);
+  printf("%-10s %-7s %8s %8s %8s %8s %9s %9s %7s %8s %8s %8s\n", "size",
+         "image", "build ms", "grad", "runs", "tables", "v edges", "h edges",
+         "MB", "rand ns", "drag ns", "scan ns");
+  for (size_t i = 0; i < sizeof(kSizes) / sizeof(kSizes[0]); i++) {
+    int w = kSizes[i][0], h = kSizes[i][1];
+    if (w > maxW)
+      continue;
+    IRECT mon = {0, 0, w, h};
+    Framebuffer_Layout(&r.fb, &mon, 1);
+    IMAGE *img = &r.fb.tiles[0].capture;
+    if (!Image_Alloc(img, w, h)) {
+      printf("%5dx%-4d skipped (out of memory)\n", w, h);
+      continue;
+    }
+    for (int noise = 0; noise < 2; noise++) {
+      if (noise)
+        Test_Noise(img, 3);
+      else
+        Desktop(img);
+      double ms = Test_BestMs(RunBuild, &r, w > 4000 ? 3 : 5);
+      const EDGE_STATS *st = &r.e.stats;
+      double mb = ((size_t)w + h + 2 + st->vertical + st->horizontal) *
+                  sizeof(int) / 1e6;
+      Points(r.pt, w, h, 0);
+      double rnd = Test_BestMs(RunQueries, &r, 3) * 1e6 / QUERIES;
+      int moved = r.moved;
+      double scan = Test_BestMs(RunScan, &r, 3) * 1e6 / QUERIES;
+      Points(r.pt, w, h, 1);
+      double drag = Test_BestMs(RunQueries, &r, 3) * 1e6 / QUERIES;
+      printf("%5dx%-4d %-7s %8.2f %8.2f %8.2f %8.2f %9zu %9zu %7.1f %8.1f "
+             "%8.1f %8.1f%s\n",
+             w, h, noise ? "noise" : "desktop", ms, st->gradientNs / 1e6,
+             st->runsNs / 1e6, st->tablesNs / 1e6, st->vertical,
+             st->horizontal, mb, rnd, drag, scan,
+             st->dropped ? "  (tables full)" : "");
+      if (!noise)
+        printf("%-10s %-7s %d%% of random points snap\n", "", "",
+               (int)((long long)moved * 100 / QUERIES));
+    }
+    Edges_Free(&r.e);
+    Image_Free(img);
+  }
+  free(r.pt);
+  return 0;
+}
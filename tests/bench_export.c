@@ -0,0 +1,103 @@
+// Time to file per export format: PNG, QOI and raw BGRA through
+// Export_Write into a temporary file, at 1080p to 8K, on UI-like and
+// photo-like content. Reports ms, MB/s of input pixels and file size, and
+// the decode speed of the formats we can read back.
+//   bench_export [max-width]
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "export.h"
+#include "platform.h"
+#include "png.h"
+#include "qoi.h"
+#include "test.h"
+
+// Flat windows with glyph runs, or smooth noise.
+static void Fill(IMAGE *img, int photo) {
+  uint32_t s = 4242;
+  for (int y = 0; y < img->h; y++) {
+    unsigned *p = (unsigned *)IMAGE_ROW(img, y);
+    int line = y % 20;
+    for (int x = 0; x < img->w; x++) {
+      if (photo)
+        p[x] = x ? (p[x - 1] + (Test_Rand(&s) & 0x030303u)) | 0xFF000000u
+                 : Test_Rand(&s) | 0xFF000000u;
+      else
+        p[x] = line < 14 && (x / 300 + y / 400) % 3 &&
+                       (Test_Rand(&s) & 3) == 0
+                   ? 0xFF202020u + (unsigned)(x / 300 % 7) * 0x1A0C05u
+                   : 0xFFF0F0F0u - (unsigned)(y / 400 % 3) * 0x101010u;
+    }
+  }
+}
+
+typedef struct {
+  const IMAGE *img;
+  EXPORT_FORMAT fmt;
+  EXPORT_STATS st;
+  unsigned char *data; // the file, for decoding
+  size_t n;
+} EXPORT_RUN;
+
+static void RunWrite(void *ctx) {
+  EXPORT_RUN *r = (EXPORT_RUN *)ctx;
+  FILE *f = tmpfile();
+  if (!f || !Export_Write(f, r->img, r->fmt, &r->st))
+    r->st.fileBytes = 0;
+  if (f && !r->data && r->fmt != EXPORT_RAW)
+    r->data = Test_Slurp(f, &r->n);
+  if (f)
+    fclose(f);
+}
+
+static void RunDecode(void *ctx) {
+  EXPORT_RUN *r = (EXPORT_RUN *)ctx;
+  IMAGE dec = {0};
+  if (r->fmt == EXPORT_PNG)
+    Png_Decode(r->data, r->n, &dec);
+  else
+    Qoi_Decode(r->data, r->n, &dec);
+  Image_Free(&dec);
+}
+
+int main(int argc, char **argv) {
+  static const int kSizes[][2] = {{1920, 1080}, {3840, 2160}, {7680, 4320}};
+  static const char *kFormat[] = {"png", "qoi", "raw"};
+  int maxW = argc > 1 ? atoi(argv[1]) : 7680;
+  printf("bench_export: %d thread(s)\n", Cpu_Count());
+  printf("%-10s %-6s %-6s %9s %8s %11s %12s\n", "size", "image", "format",
+         "write ms", "MB/s", "KB", "decode MB/s");
+  for (size_t i = 0; i < sizeof(kSizes) / sizeof(kSizes[0]); i++) {
+    int w = kSizes[i][0], h = kSizes[i][1];
+    if (w > maxW)
+      continue;
+    IMAGE img;
+    if (!Image_Alloc(&img, w, h)) {
+      printf("%5dx%-4d skipped (out of memory)\n", w, h);
+      continue;
+    }
+    double mb = (double)w * h * 4 / 1e6;
+    int reps = w > 4000 ? 3 : 5;
+    for (int photo = 0; photo < 2; photo++) {
+      Fill(&img, photo);
+      for (int f = EXPORT_PNG; f <= EXPORT_RAW; f++) {
+        EXPORT_RUN r;
+        memset(&r, 0, sizeof(r));
+        r.img = &img;
+        r.fmt = (EXPORT_FORMAT)f;
+        double ms = Test_BestMs(RunWrite, &r, reps);
+        printf("%5dx%-4d %-6s %-6s %9.1f %8.0f %11.0f", w, h,
+               photo ? "photo" : "ui", kFormat[f], ms, mb / (ms / 1e3),
+               r.st.fileBytes / 1e3);
+        if (r.data)
+          printf(" %12.0f\n", mb / (Test_BestMs(RunDecode, &r, reps) / 1e3));
+        else
+          printf(" %12s\n", "-");
+        free(r.data);
+      }
+    }
+    Image_Free(&img);
+  }
+  return 0;
+}
@@ -0,0 +1,173 @@
+// Memory-budget mode on a video wall: a synthetic desktop of 4K monitors is
+// prepared plain (dimmed copies) or packed (LZ blocks plus a decode cache),
+// then an overlay session is replayed through Render_Frame: the first paint,
+// monitor by monitor, and a selection dragged across the wall. Reports peak
+// RSS, paint times and tile-fault latency. Peak RSS only grows, so every
+// configuration runs in its own process.
+//   bench_framebuffer [cols rows]       plain, then packed at 256 and 64 MB
+//   bench_framebuffer plain|packed [budget-MB [cols rows]]
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "framebuffer.h"
+#include "platform.h"
+#include "render.h"
+#include "test.h"
+
+#define MON_W 3840
+#define MON_H 2160
+#define DRAG_FRAMES 300
+
+// Flat windows with title bars and lines of glyph-like runs over a plain
+// background, plus a noisy "photo" on every third monitor: what desktops
+// mostly look like, and what the LZ blocks are sized for.
+static void FillMonitor(IMAGE *img, uint32_t seed) {
+  uint32_t s = seed | 1;
+  unsigned bg = 0xFF000000u | (Test_Rand(&s) & 0x3F3F3Fu);
+  for (int y = 0; y < img->h; y++) {
+    unsigned *p = (unsigned *)IMAGE_ROW(img, y);
+    for (int x = 0; x < img->w; x++)
+      p[x] = bg;
+  }
+  for (int w = 0; w < 6; w++) {
+    int x0 = (int)(Test_Rand(&s) % (uint32_t)(img->w - 900));
+    int y0 = (int)(Test_Rand(&s) % (uint32_t)(img->h - 700));
+    int x1 = x0 + 500 + (int)(Test_Rand(&s) % 400);
+    int y1 = y0 + 300 + (int)(Test_Rand(&s) % 400);
+    unsigned face = 0xFFC0C0C0u | (Test_Rand(&s) & 0x3F3F3Fu);
+    for (int y = y0; y < y1; y++) {
+      unsigned *p = (unsigned *)IMAGE_ROW(img, y);
+      int title = y < y0 + 28, line = (y - y0 - 36) % 18;
+      for (int x = x0; x < x1; x++) {
+        unsigned c = title ? 0xFF3050A0u : face;
+        if (!title && y > y0 + 36 && line < 12 && x > x0 + 8 && x < x1 - 8 &&
+            (Test_Rand(&s) & 3) == 0)
+          c = 0xFF202020u;
+        p[x] = c;
+      }
+    }
+  }
+  if (seed % 3 == 0) {
+    for (int y = 100; y < 700; y++) {
+      unsigned *p = (unsigned *)IMAGE_ROW(img, y);
+      for (int x = 2000; x < 2800; x++)
+        p[x] = Test_Rand(&s) | 0xFF000000u;
+    }
+  }
+}
+
+static int CompareLL(const void *a, const void *b) {
+  long long x = *(const long long *)a, y = *(const long long *)b;
+  return x < y ? -1 : x > y;
+}
+
+static int Run(int packed, size_t budgetMb, int cols, int rows) {
+  IRECT mon[FB_MAX_TILES];
+  int n = 0;
+  for (int r = 0; r < rows; r++)
+    for (int c = 0; c < cols && n < FB_MAX_TILES; c++)
+      mon[n++] = (IRECT){c * MON_W, r * MON_H, (c + 1) * MON_W,
+                         (r + 1) * MON_H};
+  FRAMEBUFFER fb;
+  Framebuffer_Layout(&fb, mon, n);
+  for (int i = 0; i < fb.ntiles; i++) {
+    if (!Image_Alloc(&fb.tiles[i].capture, MON_W, MON_H)) {
+      printf("out of memory\n");
+      return 1;
+    }
+    FillMonitor(&fb.tiles[i].capture, (uint32_t)i + 1);
+  }
+  size_t raw = Framebuffer_Bytes(&fb);
+
+  long long t0 = Clock_Ns();
+  int ok = packed ? Framebuffer_Pack(&fb, 96, budgetMb << 20)
+                  : Framebuffer_Dim(&fb, 96);
+  long long prepNs = Clock_Ns() - t0;
+  if (!ok) {
+    printf("out of memory\n");
+    return 1;
+  }
+  // The front-ends drop their grab images once the frame is packed.
+  if (packed)
+    for (int i = 0; i < fb.ntiles; i++)
+      Image_Free(&fb.tiles[i].capture);
+
+  IMAGE back;
+  if (!Image_Alloc(&back, fb.w, fb.h)) {
+    printf("out of memory\n");
+    return 1;
+  }
+  RENDER_SCENE sc;
+  memset(&sc, 0, sizeof(sc));
+  sc.fb = &fb;
+  sc.client = (IRECT){0, 0, fb.w, fb.h};
+
+  t0 = Clock_Ns();
+  for (int i = 0; i < fb.ntiles; i++)
+    Render_Frame(&sc, &back, &fb.tiles[i].area, 1);
+  long long firstNs = Clock_Ns() - t0;
+
+  // A drag from near the top-left corner to across most of the wall.
+  long long frame[DRAG_FRAMES];
+  sc.haveSel = 1;
+  IRECT prev = {200, 200, 201, 201};
+  for (int f = 0; f < DRAG_FRAMES; f++) {
+    sc.sel = (IRECT){200, 200, 201 + (int)((long long)(fb.w - 600) * f /
+                                           DRAG_FRAMES),
+                     201 + (int)((long long)(fb.h - 600) * f / DRAG_FRAMES)};
+    IRECT a = Render_SelBounds(&prev, &sc.client);
+    IRECT b = Render_SelBounds(&sc.sel, &sc.client);
+    IRECT d;
+    IRect_Union(&a, &b, &d);
+    t0 = Clock_Ns();
+    Render_Frame(&sc, &back, &d, 1);
+    frame[f] = Clock_Ns() - t0;
+    prev = sc.sel;
+  }
+  qsort(frame, DRAG_FRAMES, sizeof(frame[0]), CompareLL);
+
+  char mode[32];
+  snprintf(mode, sizeof(mode), packed ? "packed %zu MB" : "plain", budgetMb);
+  printf("%-14s %5dx%-5d raw %4.0f MB  prepare %6.1f ms  first paint "
+         "%6.1f ms  drag p50 %5.2f p99 %5.2f max %6.2f ms  peak RSS "
+         "%5.0f MB\n",
+         mode, fb.w, fb.h, raw / 1e6, prepNs / 1e6, firstNs / 1e6,
+         frame[DRAG_FRAMES / 2] / 1e6, frame[DRAG_FRAMES * 99 / 100] / 1e6,
+         frame[DRAG_FRAMES - 1] / 1e6, Mem_PeakRss() / 1e6);
+  const FB_PACK_STATS *ps = Framebuffer_PackStats(&fb);
+  if (ps)
+    printf("%-14s packed %.0f MB + cache %.0f MB, %llu tile faults, "
+           "%.1f us each, worst %.2f ms\n",
+           "", ps->packedBytes / 1e6, ps->cacheBytes / 1e6, ps->faults,
+           ps->faults ? ps->faultNs / 1e3 / (double)ps->faults : 0.0,
+           ps->faultMaxNs / 1e6);
+  Image_Free(&back);
+  Framebuffer_Free(&fb);
+  for (int i = 0; i < fb.ntiles; i++)
+    Image_Free(&fb.tiles[i].capture);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  if (argc > 1 && (!strcmp(argv[1], "plain") || !strcmp(argv[1], "packed"))) {
+    int packed = !strcmp(argv[1], "packed");
+    size_t budget = argc > 2 ? (size_t)atol(argv[2]) : 256;
+    int cols = argc > 4 ? atoi(argv[3]) : 4;
+    int rows = argc > 4 ? atoi(argv[4]) : 4;
+    return Run(packed, budget, cols, rows);
+  }
+  int cols = argc > 2 ? atoi(argv[1]) : 4, rows = argc > 2 ? atoi(argv[2]) : 4;
+  static const char *kRuns[] = {"plain 0", "packed 256", "packed 64"};
+  printf("bench_framebuffer: %dx%d monitors of %dx%d, %d thread(s)\n", cols,
+         rows, MON_W, MON_H, Cpu_Count());
+  for (size_t i = 0; i < sizeof(kRuns) / sizeof(kRuns[0]); i++) {
+    char cmd[1024];
+    snprintf(cmd, sizeof(cmd), "\"%s\" %s %d %d", argv[0], kRuns[i], cols,
+             rows);
+    fflush(stdout);
+    if (system(cmd) != 0)
+      printf("%s: failed\n", kRuns[i]);
+  }
+  return 0;
+}
@@ -0,0 +1,398 @@
+// History store on a synthetic desktop session: four text windows over a
+// gradient wallpaper, a taskbar and a clock. Between shots the user types,
+// scrolls, moves or switches windows, or opens another document; about 60%
+// of the shots are the full screen and 40% the active window. Reports what
+// the shots take as pixels and on disk, the tile dedup ratio, add time and
+// throughput, reading whole captures and 300x200 parts back (checked
+// against what was added), and the open time with a valid index and with
+// one a writer left mid-capture: rebuilt in private memory by a read-only
+// open, which must leave tiles.idx as it was, and in place by a writer.
+// The store is made in dir (bench_history.tmp here by default) and removed.
+// Exits 1 if the store cannot be opened or a check fails; failed checks
+// are flagged in parentheses on the open line.
+//   bench_history [max-width [dir]]
+
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <direct.h>
+#define rmdir _rmdir
+#else
+#include <unistd.h>
+#endif
+
+#include "history.h"
+#include "platform.h"
+#include "test.h"
+
+#define WINDOWS 4
+#define CHAR_W 8
+#define LINE_H 16
+#define TITLE_H 24
+#define TASKBAR_H 40
+#define PART_W 300
+#define PART_H 200
+
+typedef struct {
+  IRECT r;
+  uint32_t doc; // seed of its text
+  int lines;    // in the document, the last one being typed
+  int typed;    // characters on the last line
+  int scroll;   // first line shown
+} WINDOW;
+
+typedef struct {
+  IMAGE img;
+  WINDOW win[WINDOWS];
+  int order[WINDOWS]; // bottom to top; the top one is active
+  int tick, clock;
+} DESKTOP;
+
+static unsigned char g_glyph[64][LINE_H]; // 0 is a space
+
+static uint32_t Mix(uint32_t a, uint32_t b, uint32_t c) {
+  uint32_t h = a * 0x9E3779B1u ^ b * 0x85EBCA77u ^ c * 0xC2B2AE3Du;
+  h ^= h >> 15;
+  h *= 0x2C1B3C6Du;
+  return h ^ h >> 13;
+}
+
+static void Glyphs_Init(void) {
+  uint32_t s = 11;
+  for (int c = 1; c < 64; c++)
+    for (int y = 3; y < 13; y++)
+      g_glyph[c][y] = (unsigned char)(Test_Rand(&s) & 0x7E);
+}
+
+static void Fill(IMAGE *img, IRECT r, uint32_t color) {
+  IRECT all = {0, 0, img->w, img->h}, c;
+  if (!IRect_Intersect(&r, &all, &c))
+    return;
+  for (int y = c.top; y < c.bottom; y++) {
+    uint32_t *p = (uint32_t *)IMAGE_ROW(img, y) + c.left;
+    for (int x = 0; x < c.right - c.left; x++)
+      p[x] = color;
+  }
+}
+
+static void Glyph(IMAGE *img, int x, int y, int c, uint32_t ink,
+                  const IRECT *clip) {
+  for (int gy = 0; gy < LINE_H; gy++) {
+    if (y + gy < clip->top || y + gy >= clip->bottom || !g_glyph[c][gy])
+      continue;
+    uint32_t *p = (uint32_t *)IMAGE_ROW(img, y + gy);
+    for (int bx = 0; bx < CHAR_W; bx++)
+      if (g_glyph[c][gy] >> bx & 1 && x + bx >= clip->left &&
+          x + bx < clip->right)
+        p[x + bx] = ink;
+  }
+}
+
+// Character col of a line of w's document; lines are 20 to 80 long.
+static int Char(const WINDOW *w, int line, int col) {
+  if (line >= w->lines || (line == w->lines - 1 && col >= w->typed) ||
+      col >= 20 + (int)(Mix(w->doc, (uint32_t)line, 0xFFFF) % 60))
+    return 0;
+  int c = (int)(Mix(w->doc, (uint32_t)line, (uint32_t)col) % 64);
+  return c < 10 ? 0 : c;
+}
+
+static void Text(IMAGE *img, const WINDOW *w, IRECT area) {
+  IRECT all = {0, 0, img->w, img->h}, clip;
+  Fill(img, area, 0xFFF8F8F8u);
+  if (!IRect_Intersect(&area, &all, &clip))
+    return;
+  int rows = (area.bottom - area.top + LINE_H - 1) / LINE_H;
+  int cols = (area.right - area.left + CHAR_W - 1) / CHAR_W;
+  for (int r = 0; r < rows; r++)
+    for (int col = 0; col < cols; col++) {
+      int c = Char(w, w->scroll + r, col);
+      if (c)
+        Glyph(img, area.left + col * CHAR_W, area.top + r * LINE_H, c,
+              0xFF202020u, &clip);
+    }
+}
+
+static int View_Lines(const WINDOW *w) {
+  return (w->r.bottom - w->r.top - TITLE_H - 6) / LINE_H;
+}
+
+static void Desktop_Init(DESKTOP *d, int w, int h) {
+  for (int i = 0; i < WINDOWS; i++) {
+    WINDOW *win = &d->win[i];
+    int x = w / 16 + i * w / 7, y = h / 16 + i * h / 9;
+    win->r = (IRECT){x, y, x + w / 2, y + h * 11 / 20};
+    win->doc = Mix((uint32_t)i, 1, 2);
+    win->lines = 100 + 50 * i;
+    win->typed = 10;
+    win->scroll = win->lines - View_Lines(win);
+    d->order[i] = i;
+  }
+  d->tick = 0;
+  d->clock = 9 * 60;
+}
+
+static void Desktop_Draw(DESKTOP *d) {
+  IMAGE *img = &d->img;
+  for (int y = 0; y < img->h; y++) {
+    unsigned char *p = IMAGE_ROW(img, y);
+    for (int x = 0; x < img->w; x++, p += 4) {
+      p[0] = (unsigned char)(96 + 96 * y / img->h);
+      p[1] = (unsigned char)(64 + 64 * x / img->w);
+      p[2] = (unsigned char)(48 + 48 * (x + y) / (img->w + img->h));
+      p[3] = 0xFF;
+    }
+  }
+  for (int k = 0; k < WINDOWS; k++) {
+    const WINDOW *w = &d->win[d->order[k]];
+    int active = k == WINDOWS - 1;
+    Fill(img, w->r, 0xFF808080u);
+    Fill(img,
+         (IRECT){w->r.left + 1, w->r.top + 1, w->r.right - 1,
+                 w->r.top + TITLE_H},
+         active ? 0xFF2060C0u : 0xFFA0A0A0u);
+    Text(img, w,
+         (IRECT){w->r.left + 4, w->r.top + TITLE_H + 2, w->r.right - 4,
+                 w->r.bottom - 4});
+  }
+  IRECT bar = {0, img->h - TASKBAR_H, img->w, img->h};
+  Fill(img, bar, 0xFF202830u);
+  for (int i = 0; i < WINDOWS; i++)
+    Fill(img,
+         (IRECT){8 + i * 160, bar.top + 6, 158 + i * 160, bar.bottom - 6},
+         i == d->order[WINDOWS - 1] ? 0xFF405060u : 0xFF303840u);
+  int digits[4] = {d->clock / 600 % 3, d->clock / 60 % 10,
+                   d->clock % 60 / 10, d->clock % 10};
+  for (int i = 0; i < 4; i++)
+    Glyph(img, img->w - 60 + i * CHAR_W, bar.top + 12, 1 + digits[i],
+          0xFFFFFFFFu, &bar);
+}
+
+// What the user does between two shots.
+static void Desktop_Step(DESKTOP *d, uint32_t *s) {
+  WINDOW *w = &d->win[d->order[WINDOWS - 1]];
+  uint32_t a = Test_Rand(s) % 100;
+  if (a < 45) { // typing, the view following the cursor
+    w->typed += 1 + (int)(Test_Rand(s) % 12);
+    if (w->typed > 70) {
+      w->lines++;
+      w->typed = 0;
+    }
+    if (w->lines - w->scroll > View_Lines(w))
+      w->scroll = w->lines - View_Lines(w);
+  } else if (a < 65) {
+    w->scroll += (int)(Test_Rand(s) % 21) - 10;
+    w->scroll = w->scroll < 0 ? 0 : w->scroll;
+    w->scroll = w->scroll >= w->lines ? w->lines - 1 : w->scroll;
+  } else if (a < 77) {
+    int ww = w->r.right - w->r.left, wh = w->r.bottom - w->r.top;
+    int x = w->r.left + (int)(Test_Rand(s) % 401) - 200;
+    int y = w->r.top + (int)(Test_Rand(s) % 401) - 200;
+    int maxX = d->img.w - ww, maxY = d->img.h - TASKBAR_H - wh;
+    x = x < 0 ? 0 : x > maxX ? maxX : x;
+    y = y < 0 ? 0 : y > maxY ? maxY : y;
+    w->r = (IRECT){x, y, x + ww, y + wh};
+  } else if (a < 95) { // another window to the top
+    int k = (int)(Test_Rand(s) % (WINDOWS - 1)), i = d->order[k];
+    memmove(d->order + k, d->order + k + 1,
+            (size_t)(WINDOWS - 1 - k) * sizeof(int));
+    d->order[WINDOWS - 1] = i;
+  } else {
+    w->doc = Test_Rand(s);
+    w->lines = 40 + (int)(Test_Rand(s) % 400);
+    w->typed = 30;
+    w->scroll = 0;
+  }
+  if (++d->tick % 4 == 0)
+    d->clock++;
+}
+
+static uint64_t Sum(const IMAGE *img) {
+  uint64_t h = 0xCBF29CE484222325ull;
+  for (int y = 0; y < img->h; y++) {
+    const unsigned char *p = IMAGE_ROW(img, y);
+    for (int x = 0; x < img->w; x++, p += 4) {
+      uint32_t v;
+      memcpy(&v, p, 4);
+      h = (h ^ v) * 0x100000001B3ull;
+    }
+  }
+  return h;
+}
+
+static const char *kFiles[] = {"tiles.pack", "tiles.idx", "captures.log"};
+
+static const char *Path(const char *dir, const char *name) {
+  static char path[HISTORY_PATH_MAX + 16];
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  return path;
+}
+
+static void Store_Remove(const char *dir) {
+  for (int i = 0; i < 3; i++)
+    remove(Path(dir, kFiles[i]));
+}
+
+// The whole of a file, or NULL.
+static unsigned char *Slurp(const char *path, size_t *n) {
+  FILE *f = File_Open(path, "rb");
+  unsigned char *p = f ? Test_Slurp(f, n) : NULL;
+  if (f)
+    fclose(f);
+  return p;
+}
+
+static int CompareLL(const void *a, const void *b) {
+  long long x = *(const long long *)a, y = *(const long long *)b;
+  return x < y ? -1 : x > y;
+}
+
+// Reads every capture whole and a part of each; returns how many differ.
+static int ReadBack(HISTORY *h, const uint64_t *sum, long long *whole,
+                    long long *part) {
+  uint32_t s = 7;
+  int wrong = 0;
+  for (int i = 0; i < h->n; i++) {
+    IMAGE img;
+    long long t0 = Clock_Ns();
+    int ok = History_Read(h, i, NULL, &img);
+    whole[i] = Clock_Ns() - t0;
+    wrong += !ok || Sum(&img) != sum[i];
+    if (ok)
+      Image_Free(&img);
+    const HISTORY_CAPTURE *c = &h->capture[i];
+    int pw = c->w < PART_W ? c->w : PART_W, ph = c->h < PART_H ? c->h : PART_H;
+    int x = (int)(Test_Rand(&s) % (uint32_t)(c->w - pw + 1));
+    int y = (int)(Test_Rand(&s) % (uint32_t)(c->h - ph + 1));
+    IRECT r = {x, y, x + pw, y + ph};
+    t0 = Clock_Ns();
+    ok = History_Read(h, i, &r, &img);
+    part[i] = Clock_Ns() - t0;
+    wrong += !ok;
+    if (ok)
+      Image_Free(&img);
+  }
+  return wrong;
+}
+
+// Returns 0, or 1 if the store misbehaved in any of the ways it reports.
+static int Run(const char *dir, int w, int h, int shots) {
+  DESKTOP d;
+  memset(&d, 0, sizeof(d));
+  uint64_t *sum = (uint64_t *)malloc(sizeof(uint64_t) * shots);
+  long long *whole = (long long *)malloc(sizeof(long long) * shots);
+  long long *part = (long long *)malloc(sizeof(long long) * shots);
+  HISTORY hist, other;
+  int bad = 0;
+  Store_Remove(dir);
+  if (!sum || !whole || !part || !Image_Alloc(&d.img, w, h)) {
+    printf("%5dx%-4d skipped (out of memory)\n", w, h);
+    goto done;
+  }
+  if (!History_Open(&hist, dir, 1)) {
+    printf("%5dx%-4d cannot open a store in %s\n", w, h, dir);
+    bad = 1;
+    goto done;
+  }
+  int refused = !History_Open(&other, dir, 1);
+  if (!refused)
+    History_Close(&other);
+
+  Desktop_Init(&d, w, h);
+  uint32_t s = (uint32_t)w;
+  int failed = 0;
+  for (int i = 0; i < shots; i++) {
+    Desktop_Step(&d, &s);
+    Desktop_Draw(&d);
+    IMAGE shot = d.img;
+    if (Test_Rand(&s) % 100 >= 60) { // the active window
+      IRECT r = d.win[d.order[WINDOWS - 1]].r;
+      shot.px = IMAGE_ROW(&d.img, r.top) + (size_t)r.left * 4;
+      shot.w = r.right - r.left;
+      shot.h = r.bottom - r.top;
+    }
+    sum[hist.n] = Sum(&shot);
+    failed += History_Add(&hist, &shot, i) < 0;
+  }
+  int n = hist.n;
+  int wrong = ReadBack(&hist, sum, whole, part);
+  HISTORY_USAGE u;
+  History_Usage(&hist, &u);
+  const HISTORY_STATS *st = &hist.stats;
+  qsort(whole, (size_t)n, sizeof(whole[0]), CompareLL);
+  long long partNs = 0;
+  for (int i = 0; i < n; i++)
+    partNs += part[i];
+  printf("%5dx%-4d %d shots: %.0f MB as pixels, %.1f MB on disk (%.0fx), "
+         "tile dedup %.1fx\n",
+         w, h, n, u.pixelBytes / 1e6, u.diskBytes / 1e6,
+         u.diskBytes ? (double)u.pixelBytes / u.diskBytes : 0.0,
+         u.tiles ? (double)u.tileRefs / u.tiles : 0.0);
+  printf("%-10s add %.2f ms (%.2f GB/s, hash %.2f, pack %.2f); read whole "
+         "p50 %.2f ms, worst %.2f ms; %dx%d %.3f ms\n",
+         "", st->addNs / 1e6 / n, st->pixelBytes / (double)st->addNs,
+         st->hashNs / 1e6 / n, st->packNs / 1e6 / n, whole[n / 2] / 1e6,
+         whole[n - 1] / 1e6, PART_W, PART_H, partNs / 1e6 / n);
+
+  // A writer that died mid-capture leaves the index marked dirty.
+  ((HISTORY_INDEX *)hist.idx.p)->dirty = 1;
+  History_Close(&hist);
+  size_t idxBytes = 0, afterBytes = 0;
+  unsigned char *idx = Slurp(Path(dir, "tiles.idx"), &idxBytes);
+  long long t0 = Clock_Ns();
+  int opened = History_Open(&hist, dir, 0);
+  double roMs = (Clock_Ns() - t0) / 1e6;
+  if (opened) {
+    wrong += ReadBack(&hist, sum, whole, part);
+    failed += History_Add(&hist, &d.img, 0) >= 0; // must be refused
+    History_Close(&hist);
+  }
+  unsigned char *after = Slurp(Path(dir, "tiles.idx"), &afterBytes);
+  int touched = !idx || !after || idxBytes != afterBytes ||
+                memcmp(idx, after, idxBytes);
+  t0 = Clock_Ns();
+  opened = opened && History_Open(&hist, dir, 1);
+  double rwMs = (Clock_Ns() - t0) / 1e6;
+  if (opened)
+    History_Close(&hist);
+  t0 = Clock_Ns();
+  opened = opened && History_Open(&hist, dir, 0);
+  double cleanMs = (Clock_Ns() - t0) / 1e6;
+  if (opened)
+    History_Close(&hist);
+  printf("%-10s open %.3f ms; index rebuild %.1f ms read-only, %.1f ms "
+         "writer%s%s%s%s%s\n",
+         "", cleanMs, roMs, rwMs, !opened ? "  (cannot reopen)" : "",
+         touched ? "  (read-only open wrote tiles.idx)" : "",
+         !refused ? "  (second writer not refused)" : "",
+         wrong ? "  (reads differ)" : "", failed ? "  (adds failed)" : "");
+  bad = !opened || touched || !refused || wrong || failed;
+  free(idx);
+  free(after);
+done:
+  Store_Remove(dir);
+  Image_Free(&d.img);
+  free(sum);
+  free(whole);
+  free(part);
+  return bad;
+}
+
+int main(int argc, char **argv) {
+  static const int kSession[][3] = {{1920, 1080, 200}, {3840, 2160, 100}};
+  int maxW = argc > 1 ? atoi(argv[1]) : 3840;
+  const char *dir = argc > 2 ? argv[2] : "bench_history.tmp";
+  if (!Dir_Create(dir)) {
+    printf("bench_history: cannot create %s\n", dir);
+    return 1;
+  }
+  Glyphs_Init();
+  printf("bench_history: %d thread(s), %dx%d tiles, store in %s\n",
+         Cpu_Count(), HISTORY_TILE, HISTORY_TILE, dir);
+  int bad = 0;
+  for (size_t i = 0; i < sizeof(kSession) / sizeof(kSession[0]); i++)
+    if (kSession[i][0] <= maxW)
+      bad |= Run(dir, kSession[i][0], kSession[i][1], kSession[i][2]);
+  rmdir(dir);
+  return bad;
+}
@@ -0,0 +1,179 @@
+// Loupe and overview on walls of 4K monitors, up to 16K (4x4): the mip
+// pyramid's build time and size, the zoom-to-fit overview drawn onto one
+// 4K monitor from the pyramid against box-filtering the whole frame into
+// the same box, and a loupe dragged across that monitor at each zoom,
+// repainting its old and new squares like the overlay does. Reports per
+// frame p50 and worst.
+//   bench_mip [cols rows]
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "framebuffer.h"
+#include "mip.h"
+#include "platform.h"
+#include "render.h"
+#include "test.h"
+
+#define MON_W 3840
+#define MON_H 2160
+#define LOUPE_FRAMES 300
+
+typedef struct {
+  FRAMEBUFFER fb;
+  MIP_PYRAMID mip;
+  IMAGE back;
+  IRECT box;
+} MIP_RUN;
+
+static void RunBuild(void *ctx) {
+  MIP_RUN *r = (MIP_RUN *)ctx;
+  Mip_Build(&r->mip, &r->fb);
+}
+
+static void RunOverview(void *ctx) {
+  MIP_RUN *r = (MIP_RUN *)ctx;
+  RENDER_SCENE sc;
+  memset(&sc, 0, sizeof(sc));
+  sc.fb = &r->fb;
+  sc.client = (IRECT){0, 0, r->back.w, r->back.h};
+  sc.overview = 1;
+  sc.overviewBox = r->box;
+  sc.mip = &r->mip;
+  Render_Frame(&sc, &r->back, &sc.client, 1);
+}
+
+// What the overview would cost without a pyramid: every frame pixel
+// averaged into the box, row by row of the box.
+static void RunRescale(void *ctx) {
+  MIP_RUN *r = (MIP_RUN *)ctx;
+  const FRAMEBUFFER *fb = &r->fb;
+  int bw = r->box.right - r->box.left, bh = r->box.bottom - r->box.top;
+  unsigned *acc = (unsigned *)calloc((size_t)bw * 4 + 4, sizeof(unsigned));
+  unsigned *cnt = (unsigned *)calloc((size_t)bw + 1, sizeof(unsigned));
+  if (!acc || !cnt) {
+    free(acc);
+    free(cnt);
+    return;
+  }
+  int sy = 0;
+  for (int by = 0; by < bh; by++) {
+    int sy1 = (int)((long long)(by + 1) * fb->h / bh);
+    memset(acc, 0, (size_t)bw * 4 * sizeof(unsigned));
+    memset(cnt, 0, (size_t)bw * sizeof(unsigned));
+    for (; sy < sy1; sy++)
+      for (int t = 0; t < fb->ntiles; t++) {
+        const FB_TILE *tile = &fb->tiles[t];
+        if (sy < tile->area.top || sy >= tile->area.bottom)
+          continue;
+        const unsigned char *p =
+            IMAGE_ROW(&tile->capture, sy - tile->area.top);
+        for (int x = tile->area.left; x < tile->area.right; x++, p += 4) {
+          int bx = (int)((long long)x * bw / fb->w);
+          unsigned *a = acc + bx * 4;
+          a[0] += p[0];
+          a[1] += p[1];
+          a[2] += p[2];
+          cnt[bx]++;
+        }
+      }
+    unsigned char *d = IMAGE_ROW(&r->back, r->box.top + by) + r->box.left * 4;
+    for (int bx = 0; bx < bw; bx++, d += 4) {
+      unsigned n = cnt[bx] ? cnt[bx] : 1;
+      d[0] = (unsigned char)(acc[bx * 4] / n);
+      d[1] = (unsigned char)(acc[bx * 4 + 1] / n);
+      d[2] = (unsigned char)(acc[bx * 4 + 2] / n);
+      d[3] = 0xFF;
+    }
+  }
+  free(acc);
+  free(cnt);
+}
+
+static int CompareLL(const void *a, const void *b) {
+  long long x = *(const long long *)a, y = *(const long long *)b;
+  return x < y ? -1 : x > y;
+}
+
+// The cursor sweeps the monitor diagonally; the loupe shows the frame
+// point under it as if the monitor were the zoom-to-fit view.
+static void Loupe(MIP_RUN *r, int zoom, long long *p50, long long *worst) {
+  long long frame[LOUPE_FRAMES];
+  RENDER_SCENE sc;
+  memset(&sc, 0, sizeof(sc));
+  sc.fb = &r->fb;
+  sc.client = (IRECT){0, 0, r->back.w, r->back.h};
+  sc.loupe = 1;
+  sc.zoom = zoom;
+  IRECT prev = {0, 0, 0, 0};
+  for (int f = 0; f < LOUPE_FRAMES; f++) {
+    sc.cursorX = 100 + (r->back.w - 200) * f / LOUPE_FRAMES;
+    sc.cursorY = 100 + (r->back.h - 200) * f / LOUPE_FRAMES;
+    sc.srcX = (int)((long long)sc.cursorX * r->fb.w / r->back.w);
+    sc.srcY = (int)((long long)sc.cursorY * r->fb.h / r->back.h);
+    IRECT dirty[2] = {prev, Render_LoupeBox(sc.cursorX, sc.cursorY, zoom,
+                                            &sc.client)};
+    long long t0 = Clock_Ns();
+    Render_Frame(&sc, &r->back, dirty, 2);
+    frame[f] = Clock_Ns() - t0;
+    prev = dirty[1];
+  }
+  qsort(frame, LOUPE_FRAMES, sizeof(frame[0]), CompareLL);
+  *p50 = frame[LOUPE_FRAMES / 2];
+  *worst = frame[LOUPE_FRAMES - 1];
+}
+
+static void Run(int cols, int rows) {
+  MIP_RUN r;
+  memset(&r, 0, sizeof(r));
+  IRECT mon[FB_MAX_TILES];
+  int n = 0;
+  for (int y = 0; y < rows; y++)
+    for (int x = 0; x < cols && n < FB_MAX_TILES; x++)
+      mon[n++] = (IRECT){x * MON_W, y * MON_H, (x + 1) * MON_W,
+                         (y + 1) * MON_H};
+  Framebuffer_Layout(&r.fb, mon, n);
+  int ok = Image_Alloc(&r.back, MON_W, MON_H);
+  for (int i = 0; ok && i < r.fb.ntiles; i++) {
+    ok = Image_Alloc(&r.fb.tiles[i].capture, MON_W, MON_H);
+    if (ok)
+      Test_Noise(&r.fb.tiles[i].capture, (uint32_t)i + 1);
+  }
+  if (!ok || !Framebuffer_Dim(&r.fb, 96)) {
+    printf("%5dx%-5d skipped (out of memory)\n", r.fb.w, r.fb.h);
+  } else {
+    double build = Test_BestMs(RunBuild, &r, 3);
+    IRECT client = {0, 0, MON_W, MON_H};
+    r.box = Render_OverviewBox(&r.fb, &client);
+    double overview = Test_BestMs(RunOverview, &r, 5);
+    double rescale = Test_BestMs(RunRescale, &r, 1);
+    printf("%5dx%-5d %6.0f MB  pyramid %7.1f ms %5.1f MB (from 1/%d)  "
+           "overview %7.2f ms, rescale %7.1f ms\n",
+           r.fb.w, r.fb.h, Framebuffer_Bytes(&r.fb) / 1e6, build,
+           r.mip.stats.bytes / 1e6, 1 << r.mip.first, overview, rescale);
+    for (int zoom = RENDER_ZOOM_MIN; zoom <= RENDER_ZOOM_MAX; zoom *= 2) {
+      long long p50, worst;
+      Loupe(&r, zoom, &p50, &worst);
+      printf("%-11s loupe %2dx: p50 %.3f ms, worst %.3f ms per frame\n", "",
+             zoom, p50 / 1e6, worst / 1e6);
+    }
+  }
+  Mip_Free(&r.mip);
+  Framebuffer_Free(&r.fb);
+  for (int i = 0; i < r.fb.ntiles; i++)
+    Image_Free(&r.fb.tiles[i].capture);
+  Image_Free(&r.back);
+}
+
+int main(int argc, char **argv) {
+  printf("bench_mip: %d thread(s), %dx%d monitors\n", Cpu_Count(), MON_W,
+         MON_H);
+  if (argc > 2) {
+    Run(atoi(argv[1]), atoi(argv[2]));
+    return 0;
+  }
+  Run(1, 1);
+  Run(2, 2);
+  Run(4, 4);
+  return 0;
+}
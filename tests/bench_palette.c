@@ -0,0 +1,165 @@
+// Indexed against truecolor PNG on a corpus of UI captures: Png_Write with
+// the color census, then with PNG_TRUECOLOR, reporting colors, bit depth,
+// census time, encode time and size. The built-in corpus is synthetic 4K
+// UI (a terminal, a dialog, an editor with syntax colors, antialiased text)
+// plus a photo the census must give up on quickly; PNG files named on the
+// command line are added to it.
+//   bench_palette [capture.png ...]
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "platform.h"
+#include "png.h"
+#include "test.h"
+
+#define W 3840
+#define H 2160
+
+typedef enum { TERMINAL, DIALOG, EDITOR, ANTIALIASED, PHOTO } SAMPLE;
+
+static const char *kSampleName[] = {"terminal", "dialog", "editor",
+                                    "antialiased", "photo"};
+
+// Lines of glyph-like runs in `ink` colors over bg, inside r.
+static void Text(IMAGE *img, const IRECT *r, unsigned bg, const unsigned *ink,
+                 int inks, uint32_t *s) {
+  for (int y = r->top; y < r->bottom; y++) {
+    unsigned *p = (unsigned *)IMAGE_ROW(img, y);
+    int line = (y - r->top) % 20, word = 0;
+    unsigned c = ink[0];
+    for (int x = r->left; x < r->right; x++) {
+      if (x % 48 == 0) {
+        word = (int)(Test_Rand(s) % 5) != 0;
+        c = ink[Test_Rand(s) % (unsigned)inks];
+      }
+      p[x] = line < 14 && word && (Test_Rand(s) & 3) == 0 ? c : bg;
+    }
+  }
+}
+
+static void Fill(IMAGE *img, SAMPLE what) {
+  uint32_t s = 99 + (uint32_t)what;
+  IRECT all = {0, 0, img->w, img->h};
+  unsigned ink[200];
+  switch (what) {
+  case TERMINAL:
+    ink[0] = 0xFFC0C0C0u;
+    Text(img, &all, 0xFF000000u, ink, 1, &s);
+    break;
+  case DIALOG:
+    for (int i = 0; i < 4; i++)
+      ink[i] = 0xFF101010u + (unsigned)i * 0x202020u;
+    Text(img, &all, 0xFFF0F0F0u, ink, 4, &s);
+    // buttons, a title bar and a focus ring
+    for (int b = 0; b < 24; b++) {
+      IRECT r = {(b % 6) * 600 + 50, (b / 6) * 500 + 80, 0, 0};
+      r.right = r.left + 240;
+      r.bottom = r.top + 60;
+      for (int y = r.top; y < r.bottom; y++) {
+        unsigned *p = (unsigned *)IMAGE_ROW(img, y);
+        for (int x = r.left; x < r.right; x++)
+          p[x] = y == r.top || x == r.left ? 0xFF0078D7u : 0xFFE1E1E1u;
+      }
+    }
+    for (int y = 0; y < 32; y++) {
+      unsigned *p = (unsigned *)IMAGE_ROW(img, y);
+      for (int x = 0; x < img->w; x++)
+        p[x] = 0xFF2B579Au;
+    }
+    break;
+  case EDITOR:
+    for (int i = 0; i < 40; i++)
+      ink[i] = 0xFF000000u | (Test_Rand(&s) & 0xFFFFFF);
+    Text(img, &all, 0xFF1E1E1Eu, ink, 40, &s);
+    break;
+  case ANTIALIASED:
+    // text with 200 shades of coverage between ink and background
+    for (int i = 0; i < 200; i++) {
+      unsigned a = (unsigned)i * 255 / 199;
+      ink[i] = 0xFF000000u | ((0x20 * a + 0xFF * (255 - a)) / 255) * 0x010101u;
+    }
+    Text(img, &all, 0xFFFFFFFFu, ink, 200, &s);
+    break;
+  case PHOTO:
+    for (int y = 0; y < img->h; y++) {
+      unsigned *p = (unsigned *)IMAGE_ROW(img, y);
+      for (int x = 0; x < img->w; x++)
+        p[x] = x ? (p[x - 1] + (Test_Rand(&s) & 0x030303u)) | 0xFF000000u
+                 : Test_Rand(&s) | 0xFF000000u;
+    }
+    break;
+  }
+}
+
+typedef struct {
+  const IMAGE *img;
+  int flags;
+  PNG_STATS st;
+} PNG_RUN;
+
+static void Run(void *ctx) {
+  PNG_RUN *r = (PNG_RUN *)ctx;
+  FILE *f = tmpfile();
+  if (!f || !Png_Write(f, r->img, r->flags, &r->st))
+    memset(&r->st, 0, sizeof(r->st));
+  if (f)
+    fclose(f);
+}
+
+static void Report(const char *name, const IMAGE *img) {
+  PNG_RUN idx = {img, 0, {0}}, rgb = {img, PNG_TRUECOLOR, {0}};
+  int reps = (long long)img->w * img->h > 4000000 ? 3 : 5;
+  double idxMs = Test_BestMs(Run, &idx, reps);
+  double rgbMs = Test_BestMs(Run, &rgb, reps);
+  char colors[16];
+  if (idx.st.colors)
+    snprintf(colors, sizeof(colors), "%d", idx.st.colors);
+  else
+    snprintf(colors, sizeof(colors), ">256");
+  printf("%-14s %5dx%-5d %6s %5d %9.2f %9.1f %9.0f %9.1f %9.0f %6.2f\n",
+         name, img->w, img->h, colors, idx.st.depth, idx.st.censusNs / 1e6,
+         idxMs, idx.st.fileBytes / 1e3, rgbMs, rgb.st.fileBytes / 1e3,
+         rgb.st.fileBytes ? (double)idx.st.fileBytes / rgb.st.fileBytes : 0);
+}
+
+static unsigned char *ReadFile(const char *path, size_t *n) {
+  FILE *f = fopen(path, "rb");
+  if (!f)
+    return NULL;
+  unsigned char *data = Test_Slurp(f, n);
+  fclose(f);
+  return data;
+}
+
+int main(int argc, char **argv) {
+  printf("bench_palette: %d thread(s)\n", Cpu_Count());
+  printf("%-14s %-11s %6s %5s %9s %9s %9s %9s %9s %6s\n", "sample", "size",
+         "colors", "bits", "census", "ms", "KB", "rgb ms", "rgb KB", "ratio");
+  IMAGE img;
+  if (!Image_Alloc(&img, W, H)) {
+    printf("out of memory\n");
+    return 1;
+  }
+  for (int i = TERMINAL; i <= PHOTO; i++) {
+    Fill(&img, (SAMPLE)i);
+    Report(kSampleName[i], &img);
+  }
+  Image_Free(&img);
+
+  for (int i = 1; i < argc; i++) {
+    size_t n;
+    unsigned char *data = ReadFile(argv[i], &n);
+    IMAGE dec = {0};
+    if (!data || !Png_Decode(data, n, &dec)) {
+      printf("%s: not a PNG we can read\n", argv[i]);
+      free(data);
+      continue;
+    }
+    const char *base = strrchr(argv[i], '/');
+    Report(base ? base + 1 : argv[i], &dec);
+    Image_Free(&dec);
+    free(data);
+  }
+  return 0;
+}
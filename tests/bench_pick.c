@@ -0,0 +1,146 @@
+// Window pick index: build time and hit-test cost with 100 to 2000
+// windows on a 4K screen and a three-monitor desktop, against scanning the
+// window list top down. Windows are mostly application-sized, with a few
+// maximized ones and many small ones (dialogs, tooltips, docks); points
+// are a random scatter and a drag path. A sample of the hits is checked
+// against the scan.
+//   bench_pick [max-windows]
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "pick.h"
+#include "platform.h"
+#include "test.h"
+
+#define QUERIES (1 << 20)
+
+typedef struct {
+  PICK_INDEX index;
+  const IRECT *rects, *bounds;
+  int n;
+  int (*pt)[2];
+  long long sum;
+} PICK_RUN;
+
+static void Windows(IRECT *r, int n, const IRECT *b, uint32_t seed) {
+  uint32_t s = seed;
+  int bw = b->right - b->left, bh = b->bottom - b->top;
+  for (int i = 0; i < n; i++) {
+    int kind = (int)(Test_Rand(&s) % 20), w, h;
+    if (kind == 0) { // maximized on one 3840-wide monitor
+      w = bw < 3840 ? bw : 3840;
+      h = bh;
+    } else if (kind < 12) {
+      w = 400 + (int)(Test_Rand(&s) % 1400);
+      h = 300 + (int)(Test_Rand(&s) % 900);
+    } else {
+      w = 20 + (int)(Test_Rand(&s) % 300);
+      h = 16 + (int)(Test_Rand(&s) % 200);
+    }
+    if (w > bw)
+      w = bw;
+    if (h > bh)
+      h = bh;
+    int x = b->left + (int)(Test_Rand(&s) % (uint32_t)(bw - w + 1));
+    int y = b->top + (int)(Test_Rand(&s) % (uint32_t)(bh - h + 1));
+    r[i] = (IRECT){x, y, x + w, y + h};
+  }
+}
+
+static int Scan(const IRECT *r, int n, int x, int y) {
+  for (int i = 0; i < n; i++)
+    if (x >= r[i].left && x < r[i].right && y >= r[i].top && y < r[i].bottom)
+      return i;
+  return -1;
+}
+
+static void RunBuild(void *ctx) {
+  PICK_RUN *p = (PICK_RUN *)ctx;
+  Pick_Build(&p->index, p->rects, p->n, p->bounds);
+}
+
+static void RunHits(void *ctx) {
+  PICK_RUN *p = (PICK_RUN *)ctx;
+  long long sum = 0;
+  for (int i = 0; i < QUERIES; i++)
+    sum += Pick_Hit(&p->index, p->pt[i][0], p->pt[i][1]);
+  p->sum = sum;
+}
+
+static void RunScan(void *ctx) {
+  PICK_RUN *p = (PICK_RUN *)ctx;
+  long long sum = 0;
+  for (int i = 0; i < QUERIES; i++)
+    sum += Scan(p->rects, p->n, p->pt[i][0], p->pt[i][1]);
+  p->sum = sum;
+}
+
+// Random points, or a drag a few pixels a step.
+static void Points(int (*pt)[2], const IRECT *b, int drag) {
+  uint32_t s = 3;
+  int w = b->right - b->left, h = b->bottom - b->top;
+  int x = w / 2, y = h / 2, dx = 3, dy = 2;
+  for (int i = 0; i < QUERIES; i++) {
+    if (drag) {
+      if (i % 200 == 0) {
+        dx = (int)(Test_Rand(&s) % 9) - 4;
+        dy = (int)(Test_Rand(&s) % 9) - 4;
+      }
+      x = x + dx < 0 || x + dx >= w ? x - dx : x + dx;
+      y = y + dy < 0 || y + dy >= h ? y - dy : y + dy;
+    } else {
+      x = (int)(Test_Rand(&s) % (uint32_t)w);
+      y = (int)(Test_Rand(&s) % (uint32_t)h);
+    }
+    pt[i][0] = b->left + x;
+    pt[i][1] = b->top + y;
+  }
+}
+
+int main(int argc, char **argv) {
+  static const IRECT kDesk[] = {{0, 0, 3840, 2160}, {0, 0, 11520, 2160}};
+  static const int kCount[] = {100, 500, 2000};
+  int maxN = argc > 1 ? atoi(argv[1]) : 2000;
+  PICK_RUN p;
+  memset(&p, 0, sizeof(p));
+  IRECT *rects = (IRECT *)malloc(sizeof(IRECT) * 2000);
+  p.pt = (int(*)[2])malloc(sizeof(*p.pt) * QUERIES);
+  if (!rects || !p.pt) {
+    printf("out of memory\n");
+    return 1;
+  }
+  printf("bench_pick: %d queries per run\n", QUERIES);
+  printf("%-11s %7s %9s %8s %8s %8s %8s %8s\n", "desktop", "windows",
+         "build ms", "entries", "longest", "rand ns", "drag ns", "scan ns");
+  for (size_t d = 0; d < sizeof(kDesk) / sizeof(kDesk[0]); d++) {
+    const IRECT *b = &kDesk[d];
+    for (size_t c = 0; c < sizeof(kCount) / sizeof(kCount[0]); c++) {
+      int n = kCount[c];
+      if (n > maxN)
+        continue;
+      Windows(rects, n, b, (uint32_t)(d * 10 + c + 1));
+      p.rects = rects;
+      p.n = n;
+      p.bounds = b;
+      double build = Test_BestMs(RunBuild, &p, 5);
+      Points(p.pt, b, 0);
+      int wrong = 0;
+      for (int i = 0; i < QUERIES; i += 16)
+        wrong += Pick_Hit(&p.index, p.pt[i][0], p.pt[i][1]) !=
+                 Scan(rects, n, p.pt[i][0], p.pt[i][1]);
+      double rnd = Test_BestMs(RunHits, &p, 3) * 1e6 / QUERIES;
+      double scan = Test_BestMs(RunScan, &p, 3) * 1e6 / QUERIES;
+      Points(p.pt, b, 1);
+      double drag = Test_BestMs(RunHits, &p, 3) * 1e6 / QUERIES;
+      printf("%5dx%-5d %7d %9.3f %8zu %8d %8.1f %8.1f %8.1f%s\n",
+             b->right - b->left, b->bottom - b->top, n, build,
+             p.index.stats.entries, p.index.stats.longest, rnd, drag, scan,
+             wrong ? "  (hits differ from the scan)" : "");
+    }
+  }
+  Pick_Free(&p.index);
+  free(rects);
+  free(p.pt);
+  return 0;
+}
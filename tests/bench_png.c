@@ -0,0 +1,175 @@
+// Png_Write against the single-threaded baseline it replaces: zlib at its
+// default level over RGB scanlines filtered the way libpng does by default
+// (per row, the filter with the smallest sum of absolute differences).
+// Synthetic UI (few colors, so indexed), UI with gradients (truecolor) and
+// photo-like images, 1080p to 8K. Files go to a temporary file.
+//   bench_png [max-width]
+
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "platform.h"
+#include "png.h"
+#include "test.h"
+
+typedef enum { UI, GRADIENT, PHOTO } CONTENT;
+
+// Windows with title bars and glyph runs on a flat background; GRADIENT
+// shades the background, PHOTO is smooth noise throughout.
+static void Fill(IMAGE *img, CONTENT what) {
+  uint32_t s = 12345;
+  for (int y = 0; y < img->h; y++) {
+    unsigned *p = (unsigned *)IMAGE_ROW(img, y);
+    for (int x = 0; x < img->w; x++) {
+      unsigned c = 0xFF204060u;
+      if (what == GRADIENT)
+        c = 0xFF000000u | (unsigned)(x * 255 / img->w) << 16 |
+            (unsigned)(y * 255 / img->h) << 8 | 0x60;
+      else if (what == PHOTO)
+        c = x ? (p[x - 1] + (Test_Rand(&s) & 0x030303u)) & 0xFFFFFF
+              : Test_Rand(&s) & 0xFFFFFF;
+      p[x] = c | 0xFF000000u;
+    }
+  }
+  if (what == PHOTO)
+    return;
+  for (int w = 0; w < 12; w++) {
+    int x0 = (int)(Test_Rand(&s) % (uint32_t)(img->w * 2 / 3));
+    int y0 = (int)(Test_Rand(&s) % (uint32_t)(img->h * 2 / 3));
+    int x1 = x0 + img->w / 4, y1 = y0 + img->h / 4;
+    for (int y = y0; y < y1; y++) {
+      unsigned *p = (unsigned *)IMAGE_ROW(img, y);
+      int title = y < y0 + 28, line = (y - y0 - 36) % 18;
+      for (int x = x0; x < x1; x++) {
+        unsigned c = title ? 0xFF3050A0u : 0xFFE8E8E8u;
+        if (!title && y > y0 + 36 && line < 12 && (Test_Rand(&s) & 3) == 0)
+          c = 0xFF202020u;
+        p[x] = c;
+      }
+    }
+  }
+}
+
+typedef struct {
+  const IMAGE *img;
+  int flags;
+  PNG_STATS st;
+  unsigned char *rows, *packed, *cand; // baseline only
+  size_t out;
+} PNG_RUN;
+
+static void RunPng(void *ctx) {
+  PNG_RUN *r = (PNG_RUN *)ctx;
+  FILE *f = tmpfile();
+  if (!f || !Png_Write(f, r->img, r->flags, &r->st))
+    r->st.fileBytes = 0;
+  if (f)
+    fclose(f);
+}
+
+static int Paeth(int a, int b, int c) {
+  int p = a + b - c, pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+  return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+}
+
+// libpng's default row filter choice, then zlib compress2 on one thread.
+static void RunZlib(void *ctx) {
+  PNG_RUN *r = (PNG_RUN *)ctx;
+  const IMAGE *img = r->img;
+  size_t n = (size_t)img->w * 3, stride = n + 1;
+  unsigned char *cur = r->packed, *prev = r->packed + n;
+  memset(prev, 0, n);
+  for (int y = 0; y < img->h; y++) {
+    const unsigned char *px = IMAGE_ROW(img, y);
+    for (int x = 0; x < img->w; x++) {
+      cur[x * 3] = px[x * 4 + 2];
+      cur[x * 3 + 1] = px[x * 4 + 1];
+      cur[x * 3 + 2] = px[x * 4];
+    }
+    long best = -1;
+    int pick = 0;
+    for (int t = 0; t < 5; t++) {
+      long sum = 0;
+      unsigned char *f = r->cand + t * stride;
+      f[0] = (unsigned char)t;
+      for (size_t i = 0; i < n; i++) {
+        int a = i >= 3 ? cur[i - 3] : 0, b = prev[i];
+        int c = i >= 3 ? prev[i - 3] : 0;
+        int pred = t == 0 ? 0 : t == 1 ? a : t == 2 ? b
+                                 : t == 3 ? (a + b) / 2
+                                          : Paeth(a, b, c);
+        unsigned char v = (unsigned char)(cur[i] - pred);
+        f[1 + i] = v;
+        sum += v < 128 ? v : 256 - v;
+      }
+      if (best < 0 || sum < best) {
+        best = sum;
+        pick = t;
+      }
+    }
+    memcpy(r->rows + (size_t)y * stride, r->cand + pick * stride, stride);
+    unsigned char *t = cur;
+    cur = prev;
+    prev = t;
+  }
+  uLong raw = (uLong)(stride * img->h);
+  uLongf len = compressBound(raw);
+  unsigned char *z = (unsigned char *)malloc(len);
+  r->out = z && compress2(z, &len, r->rows, raw, Z_DEFAULT_COMPRESSION) ==
+                    Z_OK
+               ? len + 57 // signature, IHDR, one IDAT, IEND
+               : 0;
+  free(z);
+}
+
+int main(int argc, char **argv) {
+  static const int kSizes[][2] = {{1920, 1080}, {3840, 2160}, {7680, 4320}};
+  static const char *kContent[] = {"ui", "gradient", "photo"};
+  int maxW = argc > 1 ? atoi(argv[1]) : 7680;
+  printf("bench_png: %d thread(s), zlib %s\n", Cpu_Count(), zlibVersion());
+  printf("%-10s %-9s %-14s %9s %8s %10s\n", "size", "content", "writer", "ms",
+         "MB/s", "bytes");
+  for (size_t i = 0; i < sizeof(kSizes) / sizeof(kSizes[0]); i++) {
+    int w = kSizes[i][0], h = kSizes[i][1];
+    if (w > maxW)
+      continue;
+    IMAGE img;
+    if (!Image_Alloc(&img, w, h)) {
+      printf("%5dx%-4d skipped (out of memory)\n", w, h);
+      continue;
+    }
+    double mb = (double)w * h * 3 / 1e6;
+    int reps = w > 4000 ? 3 : 5;
+    for (int c = UI; c <= PHOTO; c++) {
+      Fill(&img, (CONTENT)c);
+      PNG_RUN r = {&img, 0, {0}, NULL, NULL, NULL, 0};
+      double ms = Test_BestMs(RunPng, &r, reps);
+      char name[32];
+      snprintf(name, sizeof(name), r.st.colors ? "Png_Write %d-bit"
+                                               : "Png_Write rgb",
+               r.st.depth);
+      printf("%5dx%-4d %-9s %-14s %9.1f %8.0f %10llu\n", w, h, kContent[c],
+             name, ms, mb / (ms / 1e3), r.st.fileBytes);
+      if (r.st.colors) {
+        r.flags = PNG_TRUECOLOR;
+        ms = Test_BestMs(RunPng, &r, reps);
+        printf("%5dx%-4d %-9s %-14s %9.1f %8.0f %10llu\n", w, h, kContent[c],
+               "Png_Write rgb", ms, mb / (ms / 1e3), r.st.fileBytes);
+      }
+      r.rows = (unsigned char *)malloc(((size_t)w * 3 + 1) * h);
+      r.packed = (unsigned char *)malloc((size_t)w * 6);
+      r.cand = (unsigned char *)malloc(((size_t)w * 3 + 1) * 5);
+      if (r.rows && r.packed && r.cand) {
+        ms = Test_BestMs(RunZlib, &r, reps);
+        printf("%5dx%-4d %-9s %-14s %9.1f %8.0f %10zu\n", w, h, kContent[c],
+               "zlib 1 thread", ms, mb / (ms / 1e3), r.out);
+      }
+      free(r.rows);
+      free(r.packed);
+      free(r.cand);
+    }
+    Image_Free(&img);
+  }
+  return 0;
+}
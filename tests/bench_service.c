@@ -0,0 +1,285 @@
+// The capture service against a file round trip, in requests per second
+// and latency. The service runs in-process on a temporary socket with a
+// synthetic desktop (two 1080p monitors) whose "grab" is a copy of every
+// pixel, reused for SERVICE_FRAME_NS like the X11 front-end does; clients
+// on their own threads call it and touch every page of the memfd. The file
+// round trip is what tools did before: grab, crop, write the file, read it
+// back. Process start-up is not counted, so those numbers are a lower
+// bound for shelling out.
+//   bench_service [seconds-per-run]
+
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "export.h"
+#include "platform.h"
+#include "service.h"
+#include "test.h"
+
+#define MON_W 1920
+#define MON_H 1080
+#define MAX_CLIENTS 8
+#define MAX_CALLS 200000
+
+// The desktop and where its grabs come from.
+static struct {
+  FRAMEBUFFER fb;
+  IMAGE screen[2];
+  int fresh;
+  long long grabbedAt;
+  volatile long stop;
+} g_desk;
+
+static void Grab(FRAMEBUFFER *fb) {
+  for (int i = 0; i < fb->ntiles; i++)
+    memcpy(fb->tiles[i].capture.px, g_desk.screen[i].px,
+           (size_t)g_desk.screen[i].stride * g_desk.screen[i].h);
+}
+
+static const FRAMEBUFFER *Frame(void *ctx, long long *grabNs) {
+  (void)ctx;
+  long long now = Clock_Ns();
+  if (g_desk.fresh && now - g_desk.grabbedAt < SERVICE_FRAME_NS)
+    return &g_desk.fb;
+  Grab(&g_desk.fb);
+  g_desk.fresh = 1;
+  g_desk.grabbedAt = now;
+  *grabNs = Clock_Ns() - now;
+  return &g_desk.fb;
+}
+
+static void FrameDone(void *ctx) { (void)ctx; }
+
+static void Serve(void *arg) {
+  SERVICE *s = (SERVICE *)arg;
+  while (!Atomic_Load(&g_desk.stop)) {
+    struct pollfd p = {Service_Fd(s), POLLIN, 0};
+    if (poll(&p, 1, 10) > 0)
+      Service_Pump(s);
+  }
+}
+
+typedef struct {
+  const char *path; // socket, or NULL for the file round trip
+  IRECT r;
+  uint32_t format;
+  long long until;
+  long long *lat;
+  int calls, failed;
+  char file[64];
+} CLIENT;
+
+// Reads every page, as a consumer of the pixels would at least once.
+static unsigned Touch(const unsigned char *p, size_t n) {
+  unsigned sum = 0;
+  for (size_t i = 0; i < n; i += 4096)
+    sum += p[i];
+  return sum;
+}
+
+static void ServiceClient(CLIENT *c) {
+  int sock = Service_Connect(c->path);
+  if (sock < 0) {
+    c->failed++;
+    return;
+  }
+  SERVICE_REQUEST rq;
+  memset(&rq, 0, sizeof(rq));
+  rq.magic = SERVICE_MAGIC;
+  rq.version = SERVICE_VERSION;
+  rq.op = SERVICE_REGION;
+  rq.x = c->r.left;
+  rq.y = c->r.top;
+  rq.w = c->r.right - c->r.left;
+  rq.h = c->r.bottom - c->r.top;
+  rq.format = c->format;
+  while (c->calls < MAX_CALLS && Clock_Ns() < c->until) {
+    long long t0 = Clock_Ns();
+    SERVICE_REPLY rp;
+    int fd = -1;
+    rq.tag = (uint64_t)c->calls;
+    if (!Service_Call(sock, &rq, &rp, &fd) || rp.status != SERVICE_OK ||
+        fd < 0) {
+      c->failed++;
+      if (fd >= 0)
+        close(fd);
+      break;
+    }
+    void *p = mmap(NULL, rp.size, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+      c->failed++;
+    } else {
+      Touch((const unsigned char *)p, rp.size);
+      munmap(p, rp.size);
+    }
+    close(fd);
+    c->lat[c->calls++] = Clock_Ns() - t0;
+  }
+  close(sock);
+}
+
+// Grab, crop, write, read back: one request the old way.
+static void FileClient(CLIENT *c) {
+  FRAMEBUFFER fb = g_desk.fb;
+  for (int i = 0; i < fb.ntiles; i++)
+    if (!Image_Alloc(&fb.tiles[i].capture, MON_W, MON_H)) {
+      c->failed++;
+      return;
+    }
+  EXPORT_FORMAT fmt = c->format == SERVICE_PNG   ? EXPORT_PNG
+                      : c->format == SERVICE_QOI ? EXPORT_QOI
+                                                 : EXPORT_RAW;
+  while (c->calls < MAX_CALLS && Clock_Ns() < c->until) {
+    long long t0 = Clock_Ns();
+    Grab(&fb);
+    IMAGE crop;
+    FILE *f = fopen(c->file, "wb");
+    int ok = f && Framebuffer_Crop(&fb, &c->r, &crop);
+    if (ok) {
+      ok = Export_Write(f, &crop, fmt, NULL);
+      Image_Free(&crop);
+    }
+    if (f)
+      ok = fclose(f) == 0 && ok;
+    size_t n = 0;
+    unsigned char *data = NULL;
+    if (ok && (f = fopen(c->file, "rb"))) {
+      data = Test_Slurp(f, &n);
+      fclose(f);
+    }
+    if (!data) {
+      c->failed++;
+      break;
+    }
+    Touch(data, n);
+    free(data);
+    c->lat[c->calls++] = Clock_Ns() - t0;
+  }
+  remove(c->file);
+  for (int i = 0; i < fb.ntiles; i++)
+    Image_Free(&fb.tiles[i].capture);
+}
+
+static void RunClient(void *arg) {
+  CLIENT *c = (CLIENT *)arg;
+  if (c->path)
+    ServiceClient(c);
+  else
+    FileClient(c);
+}
+
+static int CompareLL(const void *a, const void *b) {
+  long long x = *(const long long *)a, y = *(const long long *)b;
+  return x < y ? -1 : x > y;
+}
+
+static void Run(const char *path, const char *what, IRECT r,
+                uint32_t format, int clients, double seconds,
+                SERVICE *svc) {
+  static const char *kFormat[] = {"raw", "png", "qoi"};
+  CLIENT c[MAX_CLIENTS];
+  THREAD t[MAX_CLIENTS];
+  int threaded[MAX_CLIENTS];
+  long long *lat = (long long *)malloc(sizeof(long long) * MAX_CALLS *
+                                       (size_t)clients);
+  if (!lat) {
+    printf("out of memory\n");
+    return;
+  }
+  SERVICE_STATS before;
+  Service_Stats(svc, &before);
+  long long t0 = Clock_Ns();
+  for (int i = 0; i < clients; i++) {
+    memset(&c[i], 0, sizeof(c[i]));
+    c[i].path = path;
+    c[i].r = r;
+    c[i].format = format;
+    c[i].until = t0 + (long long)(seconds * 1e9);
+    c[i].lat = lat + (size_t)i * MAX_CALLS;
+    snprintf(c[i].file, sizeof(c[i].file), "/tmp/bench_service.%d.%d",
+             (int)getpid(), i);
+    if (!(threaded[i] = Thread_Start(&t[i], RunClient, &c[i])))
+      RunClient(&c[i]);
+  }
+  int calls = 0, failed = 0;
+  for (int i = 0; i < clients; i++) {
+    if (threaded[i])
+      Thread_Join(t[i]);
+    failed += c[i].failed;
+    // gather the latencies into one array
+    memmove(lat + calls, c[i].lat, sizeof(long long) * (size_t)c[i].calls);
+    calls += c[i].calls;
+  }
+  double s = (Clock_Ns() - t0) / 1e9;
+  SERVICE_STATS after;
+  Service_Stats(svc, &after);
+  qsort(lat, (size_t)calls, sizeof(lat[0]), CompareLL);
+  char size[32];
+  snprintf(size, sizeof(size), "%dx%d %s", r.right - r.left,
+           r.bottom - r.top, kFormat[format]);
+  printf("%-8s %-14s %7d %9.0f %8.2f %8.2f", what, size, clients, calls / s,
+         calls ? lat[calls / 2] / 1e6 : 0.0,
+         calls ? lat[(calls - 1) * 99 / 100] / 1e6 : 0.0);
+  if (path)
+    printf(" %8llu", after.grabs - before.grabs);
+  else
+    printf(" %8d", calls);
+  printf("%s\n", failed ? "  (failures)" : "");
+  free(lat);
+}
+
+int main(int argc, char **argv) {
+  double seconds = argc > 1 ? atof(argv[1]) : 2.0;
+  IRECT mon[2] = {{0, 0, MON_W, MON_H}, {MON_W, 0, 2 * MON_W, MON_H}};
+  Framebuffer_Layout(&g_desk.fb, mon, 2);
+  for (int i = 0; i < 2; i++) {
+    if (!Image_Alloc(&g_desk.screen[i], MON_W, MON_H) ||
+        !Image_Alloc(&g_desk.fb.tiles[i].capture, MON_W, MON_H)) {
+      printf("out of memory\n");
+      return 1;
+    }
+    Test_Noise(&g_desk.screen[i], (uint32_t)i + 3);
+  }
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/bench_service.%d.sock", (int)getpid());
+  SERVICE *svc = Service_Start(path, Frame, FrameDone, NULL, 0);
+  if (!svc) {
+    printf("bench_service: cannot listen on %s\n", path);
+    return 1;
+  }
+  THREAD server;
+  if (!Thread_Start(&server, Serve, svc)) {
+    printf("bench_service: cannot start the server thread\n");
+    Service_Stop(svc);
+    return 1;
+  }
+
+  printf("bench_service: %d thread(s), desktop %dx%d, %.1f s per run\n",
+         Cpu_Count(), g_desk.fb.w, g_desk.fb.h, seconds);
+  printf("%-8s %-14s %7s %9s %8s %8s %8s\n", "path", "request", "clients",
+         "req/s", "p50 ms", "p99 ms", "grabs");
+  IRECT small = {1700, 300, 2500, 900}; // across both monitors
+  IRECT all = {0, 0, g_desk.fb.w, g_desk.fb.h};
+  static const int kClients[] = {1, 4};
+  for (int k = 0; k < 2; k++) {
+    int n = kClients[k];
+    Run(path, "service", small, SERVICE_RAW, n, seconds, svc);
+    Run(NULL, "file", small, SERVICE_RAW, n, seconds, svc);
+    Run(path, "service", all, SERVICE_RAW, n, seconds, svc);
+    Run(NULL, "file", all, SERVICE_RAW, n, seconds, svc);
+    Run(path, "service", small, SERVICE_PNG, n, seconds, svc);
+    Run(NULL, "file", small, SERVICE_PNG, n, seconds, svc);
+  }
+
+  Atomic_Store(&g_desk.stop, 1);
+  Thread_Join(server);
+  Service_Stop(svc);
+  for (int i = 0; i < 2; i++) {
+    Image_Free(&g_desk.screen[i]);
+    Image_Free(&g_desk.fb.tiles[i].capture);
+  }
+  return 0;
+}
@@ -0,0 +1,82 @@
+#include "test.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "platform.h"
+
+int g_testFailures;
+
+int Test_Finish(const char *name) {
+  if (g_testFailures) {
+    fprintf(stderr, "%s: %d check(s) failed\n", name, g_testFailures);
+    return 1;
+  }
+  printf("%s: ok\n", name);
+  return 0;
+}
+
+uint32_t Test_Rand(uint32_t *state) {
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *state = x;
+}
+
+void Test_Noise(IMAGE *img, uint32_t seed) {
+  uint32_t s = seed ? seed : 1;
+  for (int y = 0; y < img->h; y++) {
+    unsigned char *row = IMAGE_ROW(img, y);
+    for (int x = 0; x < img->w; x++) {
+      uint32_t v = Test_Rand(&s);
+      memcpy(row + (size_t)x * 4, &v, 4);
+    }
+  }
+}
+
+int Test_AllocPadded(IMAGE *img, int w, int h, int pad) {
+  img->px = (unsigned char *)malloc(((size_t)w * 4 + (size_t)pad) * h);
+  if (!img->px)
+    return 0;
+  img->w = w;
+  img->h = h;
+  img->stride = w * 4 + pad;
+  return 1;
+}
+
+int Test_FirstDiffRow(const IMAGE *a, const IMAGE *b) {
+  for (int y = 0; y < a->h; y++)
+    if (memcmp(IMAGE_ROW(a, y), IMAGE_ROW(b, y), (size_t)a->w * 4))
+      return y;
+  return -1;
+}
+
+unsigned char *Test_Slurp(FILE *f, size_t *n) {
+  if (fflush(f) || File_Seek(f, 0, SEEK_END))
+    return NULL;
+  long long size = File_Tell(f);
+  unsigned char *data = size >= 0 ? (unsigned char *)malloc((size_t)size + 1)
+                                  : NULL;
+  if (!data)
+    return NULL;
+  if (File_Seek(f, 0, SEEK_SET) ||
+      fread(data, 1, (size_t)size, f) != (size_t)size) {
+    free(data);
+    return NULL;
+  }
+  *n = (size_t)size;
+  return data;
+}
+
+double Test_BestMs(void (*fn)(void *ctx), void *ctx, int reps) {
+  long long best = -1;
+  for (int i = 0; i < reps; i++) {
+    long long t0 = Clock_Ns();
+    fn(ctx);
+    long long ns = Clock_Ns() - t0;
+    if (best < 0 || ns < best)
+      best = ns;
+  }
+  return best / 1e6;
+}
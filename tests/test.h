@@ -0,0 +1,46 @@
+#ifndef SCREENSHOT_TEST_H
+#define SCREENSHOT_TEST_H
+
+// Minimal harness shared by the tests and benchmarks. CHECK records a
+// failure and carries on, so one run reports every broken case; main
+// returns Test_Finish(). ctest reads exit status 77 as "skipped".
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "image.h"
+
+#define TEST_SKIP 77
+
+extern int g_testFailures;
+
+#define CHECK(cond)                                                            \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+      g_testFailures++;                                                        \
+    }                                                                          \
+  } while (0)
+
+// Prints a one-line verdict; returns the exit status for main.
+int Test_Finish(const char *name);
+
+// xorshift32; state must start non-zero.
+uint32_t Test_Rand(uint32_t *state);
+// Fills img with opaque-or-not random bytes.
+void Test_Noise(IMAGE *img, uint32_t seed);
+// A heap image of w x h whose rows are `pad` bytes wider than needed, so
+// stride != w * 4. Free with Image_Free.
+int Test_AllocPadded(IMAGE *img, int w, int h, int pad);
+// First row where a and b differ (compared over the width), or -1. Sizes
+// must match.
+int Test_FirstDiffRow(const IMAGE *a, const IMAGE *b);
+
+// The whole of f, from the start, as a new heap buffer (free() it); NULL
+// on error.
+unsigned char *Test_Slurp(FILE *f, size_t *n);
+
+// Benchmarks: milliseconds for the fastest of `reps` runs of fn(ctx).
+double Test_BestMs(void (*fn)(void *ctx), void *ctx, int reps);
+
+#endif
@@ -0,0 +1,238 @@
+// `screenshot capture` end to end on Xvfb: the test paints a pattern over
+// the screen and runs the real binary (its path is the first argument) on
+// a manifest of 300 regions and on --region lists, in every format. Every
+// file must hold the pattern under its region, clipped to the desktop; the
+// exit status and JSON report must say what failed; and the run must not
+// create a window. Prints the wall time and the report's grab and encode
+// times.
+//   test_batch_x11 path/to/screenshot
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "platform.h"
+#include "png.h"
+#include "qoi.h"
+#include "raw.h"
+#include "test.h"
+#include "test_x11.h"
+
+#define REGIONS 300
+
+static const char *g_exe;
+static char g_dir[64];
+
+static unsigned char *ReadAll(const char *path, size_t *n) {
+  FILE *f = fopen(path, "rb");
+  if (!f)
+    return NULL;
+  unsigned char *data = Test_Slurp(f, n);
+  fclose(f);
+  return data;
+}
+
+// Runs the binary with `args` (already quoted), returns its exit status.
+static int Capture(const char *args, long long *ns) {
+  char cmd[4096];
+  snprintf(cmd, sizeof(cmd), "\"%s\" capture %s", g_exe, args);
+  long long t0 = Clock_Ns();
+  int st = system(cmd);
+  if (ns)
+    *ns = Clock_Ns() - t0;
+  return st != -1 && WIFEXITED(st) ? WEXITSTATUS(st) : -1;
+}
+
+// The file must decode to the pattern under r, clipped to the screen.
+static int FileHolds(const char *path, const IMAGE *pattern, IRECT r) {
+  IRECT screen = {0, 0, pattern->w, pattern->h};
+  if (!IRect_Intersect(&r, &screen, &r))
+    return 0;
+  size_t n;
+  unsigned char *data = ReadAll(path, &n);
+  if (!data)
+    return 0;
+  IMAGE got = {0}, dec = {0};
+  int ok;
+  if (n >= RAW_HEADER && !memcmp(data, "BGRA", 4)) {
+    // raw: the rows follow the header, packed
+    got = (IMAGE){data + RAW_HEADER, r.right - r.left, r.bottom - r.top,
+                  (r.right - r.left) * 4};
+    unsigned char hdr[RAW_HEADER];
+    Raw_Header(&got, hdr);
+    ok = n == RAW_HEADER + (size_t)got.stride * got.h &&
+         !memcmp(data, hdr, RAW_HEADER);
+  } else {
+    ok = Png_Decode(data, n, &dec) || Qoi_Decode(data, n, &dec);
+    got = dec;
+  }
+  IMAGE want = {IMAGE_ROW(pattern, r.top) + (size_t)r.left * 4,
+                r.right - r.left, r.bottom - r.top, pattern->stride};
+  ok = ok && got.w == want.w && got.h == want.h &&
+       TestX11_FirstDiffRgb(&got, 0, 0, &want) < 0;
+  Image_Free(&dec);
+  free(data);
+  return ok;
+}
+
+// The number after "key": in a JSON report, or -1.
+static double JsonNumber(const char *json, const char *key) {
+  char k[64];
+  snprintf(k, sizeof(k), "\"%s\": ", key);
+  const char *p = json ? strstr(json, k) : NULL;
+  return p ? atof(p + strlen(k)) : -1;
+}
+
+static char *Path(const char *name) {
+  static char buf[4][256];
+  static int i;
+  char *p = buf[i++ % 4];
+  snprintf(p, 256, "%s/%s", g_dir, name);
+  return p;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    printf("test_batch_x11: usage: test_batch_x11 path/to/screenshot\n");
+    return 2;
+  }
+  g_exe = argv[1];
+  Display *dpy = TestX11_Open("test_batch_x11");
+  if (!dpy)
+    return TEST_SKIP;
+  snprintf(g_dir, sizeof(g_dir), "/tmp/test_batch_x11.XXXXXX");
+  if (!mkdtemp(g_dir)) {
+    CHECK(!"mkdtemp");
+    XCloseDisplay(dpy);
+    return Test_Finish("test_batch_x11");
+  }
+  int scr = DefaultScreen(dpy);
+  IRECT all = {0, 0, DisplayWidth(dpy, scr), DisplayHeight(dpy, scr)};
+  IMAGE pattern;
+  if (!Image_Alloc(&pattern, all.right, all.bottom)) {
+    CHECK(!"out of memory");
+    XCloseDisplay(dpy);
+    return Test_Finish("test_batch_x11");
+  }
+  Test_Noise(&pattern, 21);
+  Window win = TestX11_Cover(dpy, &all);
+  TestX11_Paint(dpy, win, &pattern, 0, 0);
+  // Anything the runs create or map under the root shows up here.
+  XSelectInput(dpy, DefaultRootWindow(dpy), SubstructureNotifyMask);
+  XSync(dpy, False);
+
+  // A manifest of small and large regions, some hanging off the screen,
+  // with comments, blank lines and explicit paths mixed in.
+  IRECT rect[REGIONS];
+  uint32_t rng = 8;
+  FILE *m = fopen(Path("manifest"), "w");
+  CHECK(m != NULL);
+  for (int i = 0; i < REGIONS && m; i++) {
+    int w = 1 + (int)(Test_Rand(&rng) % (i % 10 ? 300 : 1500));
+    int h = 1 + (int)(Test_Rand(&rng) % (i % 10 ? 200 : 900));
+    int x = (int)(Test_Rand(&rng) % (uint32_t)(all.right + 100)) - 50;
+    int y = (int)(Test_Rand(&rng) % (uint32_t)(all.bottom + 100)) - 50;
+    if (x + w <= 0 || x >= all.right)
+      x = all.right / 2;
+    if (y + h <= 0 || y >= all.bottom)
+      y = all.bottom / 2;
+    rect[i] = (IRECT){x, y, x + w, y + h};
+    if (i % 50 == 0)
+      fprintf(m, "# region %d\n\n", i + 1);
+    if (i % 7 == 0)
+      fprintf(m, "%d,%d,%d,%d %s/named%d.bgra\n", x, y, w, h, g_dir, i + 1);
+    else
+      fprintf(m, "%d,%d,%d,%d\n", x, y, w, h);
+  }
+  if (m)
+    fclose(m);
+  char args[1024];
+  snprintf(args, sizeof(args),
+           "--manifest %s --out %s/r{n}.{ext} --format raw --report %s",
+           Path("manifest"), g_dir, Path("report.json"));
+  long long wallNs;
+  CHECK(Capture(args, &wallNs) == 0);
+  int bad = 0;
+  for (int i = 0; i < REGIONS; i++) {
+    char name[64];
+    snprintf(name, sizeof(name), i % 7 ? "r%d.bgra" : "named%d.bgra", i + 1);
+    if (!FileHolds(Path(name), &pattern, rect[i]) && !bad++)
+      fprintf(stderr, "test_batch_x11: %s wrong\n", name);
+    remove(Path(name));
+  }
+  CHECK(!bad);
+  size_t n;
+  char *report = (char *)ReadAll(Path("report.json"), &n);
+  if (report)
+    report[n] = 0;
+  CHECK(report && strstr(report, "\"ok\": true"));
+  CHECK(JsonNumber(report, "succeeded") == REGIONS);
+  printf("test_batch_x11: %d raw regions in %.1f ms wall (grab %.2f ms, "
+         "encode %.2f ms, %s)\n",
+         REGIONS, wallNs / 1e6, JsonNumber(report, "grab_ms"),
+         JsonNumber(report, "encode_ms"),
+         report && strstr(report, "\"parallel_regions\": true")
+             ? "regions in parallel"
+             : "one after another");
+  free(report);
+
+  // --region lists in the encoded formats, and one region off the desktop:
+  // the rest are still written, the status and report say it failed.
+  static const char *kFormat[] = {"png", "qoi"};
+  for (int f = 0; f < 2; f++) {
+    snprintf(args, sizeof(args),
+             "--region 0,0,640,480 --region %d,%d,400,300 "
+             "--region 100,100,1,1 --region 20000,20000,10,10 "
+             "--out %s/{n}-{w}x{h}.{ext} --format %s --report %s",
+             all.right - 200, all.bottom - 100, g_dir, kFormat[f],
+             Path("report.json"));
+    long long ns;
+    CHECK(Capture(args, &ns) == 1);
+    char name[64];
+    snprintf(name, sizeof(name), "1-640x480.%s", kFormat[f]);
+    CHECK(FileHolds(Path(name), &pattern, (IRECT){0, 0, 640, 480}));
+    remove(Path(name));
+    snprintf(name, sizeof(name), "2-400x300.%s", kFormat[f]);
+    CHECK(FileHolds(Path(name), &pattern,
+                    (IRECT){all.right - 200, all.bottom - 100,
+                            all.right + 200, all.bottom + 200}));
+    remove(Path(name));
+    snprintf(name, sizeof(name), "3-1x1.%s", kFormat[f]);
+    CHECK(FileHolds(Path(name), &pattern, (IRECT){100, 100, 101, 101}));
+    remove(Path(name));
+    snprintf(name, sizeof(name), "4-10x10.%s", kFormat[f]);
+    CHECK(access(Path(name), F_OK) != 0);
+    report = (char *)ReadAll(Path("report.json"), &n);
+    if (report)
+      report[n] = 0;
+    CHECK(report && strstr(report, "\"ok\": false") &&
+          strstr(report, "outside the desktop"));
+    CHECK(JsonNumber(report, "succeeded") == 3);
+    printf("test_batch_x11: 4 %s regions in %.1f ms wall\n", kFormat[f],
+           ns / 1e6);
+    free(report);
+  }
+
+  // Bad arguments: status 2, nothing grabbed.
+  CHECK(Capture("--region 1,2,3 2>/dev/null", NULL) == 2);
+  CHECK(Capture("--bogus 2>/dev/null", NULL) == 2);
+
+  // No run created or mapped a window.
+  XSync(dpy, False);
+  int windows = 0;
+  while (XPending(dpy)) {
+    XEvent ev;
+    XNextEvent(dpy, &ev);
+    windows += ev.type == CreateNotify || ev.type == MapNotify;
+  }
+  CHECK(!windows);
+
+  remove(Path("manifest"));
+  remove(Path("report.json"));
+  rmdir(g_dir);
+  Image_Free(&pattern);
+  XDestroyWindow(dpy, win);
+  XCloseDisplay(dpy);
+  return Test_Finish("test_batch_x11");
+}
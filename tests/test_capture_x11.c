@@ -0,0 +1,82 @@
+// X11 capture against a live server (ctest runs it under Xvfb): a pattern
+// drawn over the whole screen must read back exactly, through MIT-SHM and
+// through the XGetImage fallback (SCREENSHOT_NO_SHM), including a second
+// grab into the images kept from the first. Prints the grab time per
+// megapixel for both paths.
+
+#include <stdlib.h>
+
+#include "capture_x11.h"
+#include "platform.h"
+#include "test.h"
+#include "test_x11.h"
+
+#define GRABS 20
+
+static void CheckGrab(Display *dpy, X11_CAPTURE *c, const IMAGE *pattern,
+                      const char *path) {
+  CHECK(X11Capture_Grab(dpy, c));
+  for (int i = 0; i < c->fb.ntiles; i++) {
+    const FB_TILE *t = &c->fb.tiles[i];
+    IMAGE want = {IMAGE_ROW(pattern, c->fb.virt.top + t->area.top) +
+                      (size_t)(c->fb.virt.left + t->area.left) * 4,
+                  t->capture.w, t->capture.h, pattern->stride};
+    int row = TestX11_FirstDiffRgb(&t->capture, 0, 0, &want);
+    if (row >= 0)
+      fprintf(stderr, "%s: tile %d differs from the screen at row %d\n", path,
+              i, row);
+    CHECK(row < 0);
+  }
+}
+
+static void Run(Display *dpy, Window win, IMAGE *pattern, int shm) {
+  const char *path = shm ? "MIT-SHM" : "XGetImage";
+  X11_CAPTURE c = {0};
+  Test_Noise(pattern, shm ? 1 : 2);
+  TestX11_Paint(dpy, win, pattern, 0, 0);
+  CheckGrab(dpy, &c, pattern, path);
+  CHECK(c.reopened);
+  if (!shm)
+    CHECK(!c.shm);
+  else if (!c.shm)
+    printf("test_capture_x11: MIT-SHM refused here, fallback used\n");
+
+  // The second grab reuses the images and must see the new pixels.
+  Test_Noise(pattern, shm ? 3 : 4);
+  TestX11_Paint(dpy, win, pattern, 0, 0);
+  CheckGrab(dpy, &c, pattern, path);
+  CHECK(!c.reopened);
+
+  long long best = -1;
+  for (int i = 0; i < GRABS; i++) {
+    X11Capture_Grab(dpy, &c);
+    if (best < 0 || c.grabNs < best)
+      best = c.grabNs;
+  }
+  double mp = (double)Framebuffer_Bytes(&c.fb) / 4 / 1e6;
+  printf("test_capture_x11: %-9s %d tile(s) %dx%d  %.2f ms  %.2f ms/MP\n",
+         c.shm ? "MIT-SHM" : "XGetImage", c.fb.ntiles, c.fb.w, c.fb.h,
+         best / 1e6, best / 1e6 / mp);
+  X11Capture_Release(&c);
+}
+
+int main(void) {
+  Display *dpy = TestX11_Open("test_capture_x11");
+  if (!dpy)
+    return TEST_SKIP;
+  int scr = DefaultScreen(dpy);
+  IRECT root = {0, 0, DisplayWidth(dpy, scr), DisplayHeight(dpy, scr)};
+  IMAGE pattern;
+  if (!Image_Alloc(&pattern, root.right, root.bottom)) {
+    CHECK(!"out of memory");
+    return Test_Finish("test_capture_x11");
+  }
+  Window win = TestX11_Cover(dpy, &root);
+  Run(dpy, win, &pattern, 1);
+  setenv("SCREENSHOT_NO_SHM", "1", 1);
+  Run(dpy, win, &pattern, 0);
+  XDestroyWindow(dpy, win);
+  XCloseDisplay(dpy);
+  Image_Free(&pattern);
+  return Test_Finish("test_capture_x11");
+}
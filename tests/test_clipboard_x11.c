@@ -0,0 +1,354 @@
+// CLIPBOARD owner on Xvfb. The main thread owns the selection and pumps
+// its events like the event loop does; a requestor thread, on its own
+// connection, pastes every target the way toolkits do: TARGETS, then
+// image/x-bgra, image/bmp and image/png, small ones in one property and a
+// 4K capture over INCR, chunk by chunk. Checks every byte against the
+// crop, that PNG is encoded only when asked for, that transfers abandoned
+// by a destroyed requestor free their slot, that two INCR pastes into one
+// window both finish, and that a paste survives the selection being taken
+// away in the middle. Prints request-to-last-byte
+// per target and the memory held.
+
+#include <limits.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bmp.h"
+#include "clipboard_x11.h"
+#include "platform.h"
+#include "png.h"
+#include "raw.h"
+#include "test.h"
+#include "test_x11.h"
+
+// Requestor phases; the owner acts on the ones that need it.
+enum { SMALL, WANT_BIG, BIG, DONE };
+
+typedef struct {
+  volatile long phase;
+  const IMAGE *small, *big;
+} SESSION;
+
+typedef struct {
+  unsigned char *p;
+  size_t n, cap;
+  unsigned chunks; // 0: one property, no INCR
+  long long t0, ns;
+} PASTE;
+
+static Atom g_clipboard, g_prop, g_prop2, g_incr;
+
+// Next PropertyNotify for prop on w announcing a new value; 0 if none
+// comes within 5 s (a stalled transfer).
+static int WaitNewValue(Display *dpy, Window w, Atom prop) {
+  long long deadline = Clock_Ns() + 5000000000LL;
+  XEvent ev;
+  for (;;) {
+    while (XCheckWindowEvent(dpy, w, PropertyChangeMask, &ev))
+      if (ev.xproperty.atom == prop &&
+          ev.xproperty.state == PropertyNewValue)
+        return 1;
+    if (Clock_Ns() > deadline)
+      return 0;
+    struct pollfd pf = {ConnectionNumber(dpy), POLLIN, 0};
+    poll(&pf, 1, 10);
+  }
+}
+
+// Reads and deletes the property; returns its type, or None. Xlib hands
+// out 32-bit items as longs.
+static Atom Take(Display *dpy, Window w, Atom prop, unsigned char **p,
+                 size_t *n) {
+  Atom type;
+  int format;
+  unsigned long items, after;
+  *p = NULL;
+  if (XGetWindowProperty(dpy, w, prop, 0, LONG_MAX / 4, True,
+                         AnyPropertyType, &type, &format, &items, &after,
+                         p) != Success)
+    return None;
+  *n = format == 32 ? items * sizeof(long) : items * (size_t)(format / 8);
+  return type;
+}
+
+// Asks for target in prop on w. Data small enough arrives whole (out->n);
+// otherwise out is left ready for Chunk. Returns 0 if the owner refused.
+static int Request(Display *dpy, Window w, Atom target, Atom prop,
+                   PASTE *out) {
+  memset(out, 0, sizeof(*out));
+  out->t0 = Clock_Ns();
+  XConvertSelection(dpy, g_clipboard, target, prop, w, CurrentTime);
+  XEvent ev;
+  do
+    XNextEvent(dpy, &ev);
+  while (ev.type != SelectionNotify || ev.xselection.requestor != w ||
+         ev.xselection.target != target);
+  unsigned char *p;
+  size_t n;
+  Atom type = ev.xselection.property == None ? None
+                                             : Take(dpy, w, prop, &p, &n);
+  if (type == None)
+    return 0;
+  if (type == g_incr)
+    out->cap = n >= sizeof(long) ? (size_t)*(long *)p : 0;
+  else
+    out->cap = out->n = n;
+  out->p = (unsigned char *)malloc(out->cap ? out->cap : 1);
+  if (type != g_incr) {
+    memcpy(out->p, p, n);
+    out->ns = Clock_Ns() - out->t0;
+  }
+  XFree(p);
+  return 1;
+}
+
+// Reads the next INCR chunk of target from prop, waiting for it unless it
+// is known to be there. Returns 1 for data, 0 after the empty chunk that
+// ends the transfer and -1 if the data broke off or stalled.
+static int Chunk(Display *dpy, Window w, Atom target, Atom prop,
+                 PASTE *out, int ready) {
+  unsigned char *p;
+  size_t n;
+  if (!ready && !WaitNewValue(dpy, w, prop))
+    return -1;
+  if (Take(dpy, w, prop, &p, &n) != target) {
+    if (p)
+      XFree(p);
+    return -1;
+  }
+  if (!n) {
+    XFree(p);
+    out->ns = Clock_Ns() - out->t0;
+    return 0;
+  }
+  if (out->n + n > out->cap) {
+    out->cap = (out->n + n) * 2;
+    out->p = (unsigned char *)realloc(out->p, out->cap);
+  }
+  memcpy(out->p + out->n, p, n);
+  out->n += n;
+  out->chunks++;
+  XFree(p);
+  return 1;
+}
+
+// Pastes target into w. With `abandon`, stops after that many INCR chunks
+// without finishing; with `steal`, takes the selection after the first
+// chunk and reads on. Returns 0 if the owner refused or the data broke off.
+static int Paste(Display *dpy, Window w, Atom target, PASTE *out,
+                 unsigned abandon, int steal) {
+  if (!Request(dpy, w, target, g_prop, out))
+    return 0;
+  if (out->n) // came whole
+    return 1;
+  int r;
+  while ((r = Chunk(dpy, w, target, g_prop, out, 0)) > 0) {
+    if (steal && out->chunks == 1)
+      XSetSelectionOwner(dpy, g_clipboard, w, CurrentTime);
+    if (abandon && out->chunks == abandon)
+      return 1;
+  }
+  return r == 0;
+}
+
+// Two INCR pastes into one window at once, as a client asking for two
+// targets does: the first holds after one chunk while the second runs to
+// its end, then finishes. Its chunk after the first was written while the
+// second was being asked for, so it is read without waiting.
+static int PasteBoth(Display *dpy, Window w, Atom first, Atom second,
+                     PASTE *a, PASTE *b) {
+  memset(b, 0, sizeof(*b));
+  if (!Request(dpy, w, first, g_prop, a) || a->n ||
+      Chunk(dpy, w, first, g_prop, a, 0) != 1 ||
+      !Request(dpy, w, second, g_prop2, b) || b->n)
+    return 0;
+  int r;
+  while ((r = Chunk(dpy, w, second, g_prop2, b, 0)) > 0)
+    ;
+  if (r < 0 || Chunk(dpy, w, first, g_prop, a, 1) != 1)
+    return 0;
+  while ((r = Chunk(dpy, w, first, g_prop, a, 0)) > 0)
+    ;
+  return r == 0;
+}
+
+// header + pixels, the way image/bmp and image/x-bgra are served.
+static int SameBody(const PASTE *p, const unsigned char *hdr, size_t hn,
+                    const IMAGE *img) {
+  size_t px = (size_t)img->w * 4 * img->h;
+  return p->n == hn + px && !memcmp(p->p, hdr, hn) &&
+         !memcmp(p->p + hn, img->px, px);
+}
+
+static int SamePng(const PASTE *p, const IMAGE *img) {
+  IMAGE dec = {0};
+  int same = Png_Decode(p->p, p->n, &dec) && dec.w == img->w &&
+             dec.h == img->h && TestX11_FirstDiffRgb(&dec, 0, 0, img) < 0;
+  Image_Free(&dec);
+  return same;
+}
+
+static void Report(const char *what, const PASTE *p) {
+  printf("test_clipboard_x11: %-13s %7.2f MB in %3u chunk(s), "
+         "request-to-last-byte %7.2f ms\n",
+         what, p->n / 1e6, p->chunks, p->ns / 1e6);
+}
+
+static void Requestor(void *arg) {
+  SESSION *s = (SESSION *)arg;
+  Display *dpy = XOpenDisplay(NULL);
+  if (!dpy) {
+    CHECK(!"requestor connection");
+    Atomic_Store(&s->phase, DONE);
+    return;
+  }
+  Window root = DefaultRootWindow(dpy);
+  Window w = XCreateSimpleWindow(dpy, root, 0, 0, 1, 1, 0, 0, 0);
+  XSelectInput(dpy, w, PropertyChangeMask);
+  Atom png = XInternAtom(dpy, "image/png", False);
+  Atom bmp = XInternAtom(dpy, "image/bmp", False);
+  Atom raw = XInternAtom(dpy, "image/x-bgra", False);
+  unsigned char bmpHdr[BMP_HEADER], rawHdr[RAW_HEADER];
+  PASTE p;
+
+  // TARGETS lists the three image formats.
+  CHECK(Paste(dpy, w, XInternAtom(dpy, "TARGETS", False), &p, 0, 0));
+  int found = 0;
+  for (size_t i = 0; i + sizeof(Atom) <= p.n; i += sizeof(Atom)) {
+    Atom a = *(Atom *)(p.p + i);
+    found += a == png || a == bmp || a == raw;
+  }
+  CHECK(found == 3);
+  free(p.p);
+
+  // A small crop fits in one property.
+  Raw_Header(s->small, rawHdr);
+  CHECK(Paste(dpy, w, raw, &p, 0, 0) && !p.chunks);
+  CHECK(SameBody(&p, rawHdr, RAW_HEADER, s->small));
+  free(p.p);
+  CHECK(Paste(dpy, w, png, &p, 0, 0) && SamePng(&p, s->small));
+  free(p.p);
+
+  // A 4K one goes over INCR.
+  Atomic_Store(&s->phase, WANT_BIG);
+  while (Atomic_Load(&s->phase) != BIG)
+    Sleep_Until(Clock_Ns() + 1000000);
+  Raw_Header(s->big, rawHdr);
+  CHECK(Bmp_Header(s->big, bmpHdr));
+  CHECK(Paste(dpy, w, raw, &p, 0, 0) && p.chunks > 1);
+  CHECK(SameBody(&p, rawHdr, RAW_HEADER, s->big));
+  Report("image/x-bgra", &p);
+  free(p.p);
+  CHECK(Paste(dpy, w, bmp, &p, 0, 0) && p.chunks > 1);
+  CHECK(SameBody(&p, bmpHdr, BMP_HEADER, s->big));
+  Report("image/bmp", &p);
+  free(p.p);
+  CHECK(Paste(dpy, w, png, &p, 0, 0) && SamePng(&p, s->big));
+  Report("image/png", &p);
+  free(p.p);
+  CHECK(Paste(dpy, w, png, &p, 0, 0) && SamePng(&p, s->big));
+  Report("image/png again", &p); // cached
+  free(p.p);
+
+  // Requestors that vanish mid-paste: more than there are transfer slots,
+  // so a leaked slot would make the next INCR paste fail.
+  for (int i = 0; i < 9; i++) {
+    Window gone = XCreateSimpleWindow(dpy, root, 0, 0, 1, 1, 0, 0, 0);
+    XSelectInput(dpy, gone, PropertyChangeMask);
+    CHECK(Paste(dpy, gone, raw, &p, 2, 0));
+    free(p.p);
+    XDestroyWindow(dpy, gone);
+    XSync(dpy, False);
+  }
+  CHECK(Paste(dpy, w, bmp, &p, 0, 0));
+  CHECK(SameBody(&p, bmpHdr, BMP_HEADER, s->big));
+  free(p.p);
+
+  // Two targets at once into one window: the one that ends first must not
+  // stall the other.
+  PASTE q;
+  CHECK(PasteBoth(dpy, w, raw, bmp, &p, &q));
+  CHECK(SameBody(&p, rawHdr, RAW_HEADER, s->big));
+  CHECK(SameBody(&q, bmpHdr, BMP_HEADER, s->big));
+  free(p.p);
+  free(q.p);
+
+  // Another client copies while we paste: the transfer finishes intact.
+  CHECK(Paste(dpy, w, raw, &p, 0, 1));
+  CHECK(SameBody(&p, rawHdr, RAW_HEADER, s->big));
+  free(p.p);
+  CHECK(XGetSelectionOwner(dpy, g_clipboard) == w);
+
+  XCloseDisplay(dpy);
+  Atomic_Store(&s->phase, DONE);
+}
+
+static EXPORT_IMAGE *Crop(int w, int h, uint32_t seed) {
+  IMAGE img;
+  if (!Image_Alloc(&img, w, h))
+    return NULL;
+  Test_Noise(&img, seed);
+  return ExportImage_Wrap(&img);
+}
+
+int main(void) {
+  Display *dpy = TestX11_Open("test_clipboard_x11");
+  if (!dpy)
+    return TEST_SKIP;
+  g_clipboard = XInternAtom(dpy, "CLIPBOARD", False);
+  g_prop = XInternAtom(dpy, "TEST_PASTE", False);
+  g_prop2 = XInternAtom(dpy, "TEST_PASTE2", False);
+  g_incr = XInternAtom(dpy, "INCR", False);
+  Window owner = XCreateSimpleWindow(dpy, DefaultRootWindow(dpy), 0, 0, 1, 1,
+                                     0, 0, 0);
+  X11Clip_Init(dpy, owner, 0);
+  EXPORT_IMAGE *small = Crop(200, 120, 1), *big = Crop(3840, 2160, 2);
+  if (!small || !big) {
+    CHECK(!"out of memory");
+    XCloseDisplay(dpy);
+    return Test_Finish("test_clipboard_x11");
+  }
+  size_t bigBytes = (size_t)3840 * 2160 * 4;
+  CHECK(X11Clip_Set(small, CurrentTime));
+  CHECK(X11Clip_HeldBytes() == (size_t)200 * 120 * 4);
+
+  SESSION s = {SMALL, &small->img, &big->img};
+  THREAD t;
+  CHECK(Thread_Start(&t, Requestor, &s));
+  for (;;) {
+    long phase = Atomic_Load(&s.phase);
+    if (phase == DONE)
+      break;
+    if (phase == WANT_BIG) {
+      CHECK(X11Clip_Set(big, CurrentTime));
+      // nothing encoded before someone asks for PNG
+      CHECK(X11Clip_HeldBytes() == bigBytes);
+      Atomic_Store(&s.phase, BIG);
+    }
+    while (XPending(dpy)) {
+      XEvent ev;
+      XNextEvent(dpy, &ev);
+      X11Clip_HandleEvent(&ev);
+    }
+    struct pollfd pf = {ConnectionNumber(dpy), POLLIN, 0};
+    poll(&pf, 1, 5);
+  }
+  Thread_Join(t);
+  // Drain the SelectionClear from the requestor taking over.
+  XSync(dpy, False);
+  while (XPending(dpy)) {
+    XEvent ev;
+    XNextEvent(dpy, &ev);
+    X11Clip_HandleEvent(&ev);
+  }
+  CHECK(X11Clip_HeldBytes() == 0);
+  printf("test_clipboard_x11: held for a 4K copy: %.1f MB of pixels, no "
+         "encoded copy until a PNG paste\n",
+         bigBytes / 1e6);
+
+  ExportImage_Release(small);
+  ExportImage_Release(big);
+  XCloseDisplay(dpy);
+  return Test_Finish("test_clipboard_x11");
+}
@@ -0,0 +1,266 @@
+// Visual diff on known edits to a 203x150 page (203 is not a multiple of
+// 4, so the last tile ends in the scalar tail) whose channels stay within
+// 64..191, so every edit is exactly the delta it was given. Checks region
+// rects and pixel counts, the threshold boundary (a delta of exactly t is
+// not a change, t + 1 is), that alpha is ignored, a b wider and taller than
+// a, and random jitter against a plain per-pixel count. Then runs
+// `screenshot diff` on files: exit status, the JSON regions and the
+// highlighted image.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "diff.h"
+#include "export.h"
+#include "qoi.h"
+#include "test.h"
+
+#define W 203
+#define H 150
+#define T 10
+
+typedef struct {
+  IRECT r;
+  int channel, delta;
+} EDIT;
+
+// Tiles of different edits are never neighbours, so each is its own
+// region. The last is one pixel in the scalar tail of the last tile.
+static const EDIT kEdits[] = {
+    {{8, 8, 40, 24}, 0, 50},         // well over
+    {{100, 8, 130, 20}, 2, T},       // exactly the threshold
+    {{100, 70, 120, 80}, 1, T + 1},  // just over
+    {{10, 100, 30, 110}, 3, 100},    // alpha only
+    {{202, 140, 203, 141}, 2, -50}}; // scalar tail
+#define EDITS (int)(sizeof(kEdits) / sizeof(kEdits[0]))
+
+static void Page(IMAGE *img, uint32_t seed) {
+  Test_Noise(img, seed);
+  for (int y = 0; y < img->h; y++) {
+    unsigned char *p = IMAGE_ROW(img, y);
+    for (int x = 0; x < img->w * 4; x++)
+      p[x] = (unsigned char)(0x40 + (p[x] & 0x7F));
+  }
+}
+
+static void Copy(const IMAGE *src, IMAGE *dst) {
+  for (int y = 0; y < src->h; y++)
+    memcpy(IMAGE_ROW(dst, y), IMAGE_ROW(src, y), (size_t)src->w * 4);
+}
+
+static void Edit(IMAGE *img, const EDIT *e) {
+  for (int y = e->r.top; y < e->r.bottom; y++)
+    for (int x = e->r.left; x < e->r.right; x++)
+      IMAGE_ROW(img, y)[x * 4 + e->channel] += (unsigned char)e->delta;
+}
+
+// Changed pixels the slow way; outside a they all count.
+static unsigned long long Count(const IMAGE *a, const IMAGE *b, int t) {
+  unsigned long long n = 0;
+  for (int y = 0; y < b->h; y++)
+    for (int x = 0; x < b->w; x++) {
+      const unsigned char *q = IMAGE_ROW(b, y) + x * 4;
+      int c = x >= a->w || y >= a->h;
+      for (int k = 0; k < 3 && !c; k++)
+        c = abs(IMAGE_ROW(a, y)[x * 4 + k] - q[k]) > t;
+      n += c;
+    }
+  return n;
+}
+
+static const DIFF_REGION *Find(const DIFF *d, IRECT r) {
+  for (int i = 0; i < d->n; i++)
+    if (!memcmp(&d->region[i].rect, &r, sizeof(r)))
+      return &d->region[i];
+  return NULL;
+}
+
+static int Area(IRECT r) { return (r.right - r.left) * (r.bottom - r.top); }
+
+// Regions at threshold t: every edit whose delta exceeds it, alone.
+static void CheckEdits(DIFF *d, const IMAGE *a, const IMAGE *b, int t) {
+  CHECK(Diff_Compare(d, a, b, t));
+  int want = 0;
+  for (int i = 0; i < EDITS; i++) {
+    const EDIT *e = &kEdits[i];
+    int changed = e->channel < 3 && abs(e->delta) > t;
+    const DIFF_REGION *g = Find(d, e->r);
+    want += changed;
+    CHECK(changed ? g && g->pixels == (unsigned long long)Area(e->r) : !g);
+    if (changed && !g)
+      fprintf(stderr, "test_diff: t=%d: no region at %d,%d-%d,%d\n", t,
+              e->r.left, e->r.top, e->r.right, e->r.bottom);
+  }
+  CHECK(d->n == want);
+  CHECK(d->stats.pixels == Count(a, b, t));
+}
+
+static void CheckGrown(const IMAGE *a) {
+  IMAGE b;
+  DIFF d;
+  memset(&d, 0, sizeof(d));
+  if (!Image_Alloc(&b, W + 37, H + 20)) {
+    CHECK(!"out of memory");
+    return;
+  }
+  Page(&b, 3);
+  Copy(a, &b);
+  CHECK(Diff_Compare(&d, a, &b, 0));
+  unsigned long long outside = (unsigned long long)b.w * b.h - W * H;
+  CHECK(d.stats.pixels == outside && Count(a, &b, 0) == outside);
+  // the L past a's right and bottom edges is one region
+  CHECK(d.n == 1 && d.region[0].pixels == outside);
+  CHECK(d.n == 1 && d.region[0].rect.left == 0 &&
+        d.region[0].rect.top == 0 && d.region[0].rect.right == b.w &&
+        d.region[0].rect.bottom == b.h);
+  Diff_Free(&d);
+  Image_Free(&b);
+}
+
+static void CheckJitter(const IMAGE *a) {
+  IMAGE b;
+  DIFF d;
+  memset(&d, 0, sizeof(d));
+  if (!Image_Alloc(&b, W, H)) {
+    CHECK(!"out of memory");
+    return;
+  }
+  Copy(a, &b);
+  uint32_t s = 9;
+  for (int y = 0; y < H; y++)
+    for (int x = 0; x < W * 4; x++)
+      IMAGE_ROW(&b, y)[x] += (unsigned char)((int)(Test_Rand(&s) % 25) - 12);
+  for (int t = 0; t <= 13; t++) {
+    CHECK(Diff_Compare(&d, a, &b, t));
+    CHECK(d.stats.pixels == Count(a, &b, t));
+  }
+  Diff_Free(&d);
+  Image_Free(&b);
+}
+
+static int Save(const char *path, const IMAGE *img) {
+  FILE *f = fopen(path, "wb");
+  int ok = f && Export_Write(f, img, EXPORT_QOI, NULL);
+  if (f)
+    ok = fclose(f) == 0 && ok;
+  return ok;
+}
+
+// The whole file as a NUL-terminated string.
+static char *Text(const char *path) {
+  FILE *f = fopen(path, "rb");
+  size_t n = 0;
+  unsigned char *p = f ? Test_Slurp(f, &n) : NULL;
+  if (f)
+    fclose(f);
+  if (p)
+    p[n] = 0; // Test_Slurp leaves room for it
+  return (char *)p;
+}
+
+static int Load(const char *path, IMAGE *img) {
+  FILE *f = fopen(path, "rb");
+  size_t n = 0;
+  unsigned char *p = f ? Test_Slurp(f, &n) : NULL;
+  if (f)
+    fclose(f);
+  int ok = p && Qoi_Decode(p, n, img);
+  free(p);
+  return ok;
+}
+
+static int Run(const char *a, const char *b, const char *threshold) {
+  char *argv[] = {"--threshold", (char *)threshold, "--out",
+                  "test_diff_out.qoi", "--report", "test_diff.json",
+                  (char *)a, (char *)b};
+  return Diff_Main(8, argv);
+}
+
+static void CheckMain(const IMAGE *a, const IMAGE *b) {
+  if (!Save("test_diff_a.qoi", a) || !Save("test_diff_b.qoi", b)) {
+    CHECK(!"cannot write the input files");
+    return;
+  }
+  CHECK(Run("test_diff_a.qoi", "test_diff_b.qoi", "10") == 1);
+  char *json = Text("test_diff.json");
+  CHECK(json && strstr(json, "\"identical\": false"));
+  int want = 0;
+  for (int i = 0; json && i < EDITS; i++) {
+    const EDIT *e = &kEdits[i];
+    char line[128];
+    snprintf(line, sizeof(line),
+             "{\"x\": %d, \"y\": %d, \"w\": %d, \"h\": %d, \"pixels\": %d}",
+             e->r.left, e->r.top, e->r.right - e->r.left,
+             e->r.bottom - e->r.top, Area(e->r));
+    int changed = e->channel < 3 && abs(e->delta) > T;
+    want += changed;
+    CHECK(!strstr(json, line) == !changed);
+  }
+  const char *list = json ? strstr(json, "\"regions\": [") : NULL;
+  int n = 0;
+  for (const char *p = list; p && (p = strstr(p, "\"pixels\"")); p++)
+    n++;
+  CHECK(list && n == want);
+  free(json);
+
+  // the highlighted image is the one Diff_Highlight makes in memory
+  IMAGE out, hi;
+  DIFF d;
+  memset(&d, 0, sizeof(d));
+  if (Load("test_diff_out.qoi", &out)) {
+    CHECK(Diff_Compare(&d, a, b, T) && Diff_Highlight(&d, a, b, &hi));
+    CHECK(out.w == W && out.h == H && Test_FirstDiffRow(&out, &hi) < 0);
+    const unsigned *o = (const unsigned *)IMAGE_ROW(&out, 8);
+    const unsigned *q = (const unsigned *)IMAGE_ROW(b, 8);
+    CHECK(o[8 - 1] == DIFF_COLOR); // frame, left of the first edit
+    CHECK(o[8] != q[8] && o[8] != DIFF_COLOR); // tinted
+    o = (const unsigned *)IMAGE_ROW(&out, 60);
+    q = (const unsigned *)IMAGE_ROW(b, 60);
+    CHECK(o[60] == (0xFF000000u | (((q[60] >> 1) & 0x7F7F7F) + 0x808080)));
+    Image_Free(&hi);
+    Image_Free(&out);
+  } else {
+    CHECK(!"no highlighted image");
+  }
+  Diff_Free(&d);
+
+  CHECK(Run("test_diff_a.qoi", "test_diff_a.qoi", "0") == 0);
+  json = Text("test_diff.json");
+  CHECK(json && strstr(json, "\"identical\": true") &&
+        strstr(json, "\"regions\": []"));
+  free(json);
+  CHECK(Run("test_diff_a.qoi", "test_diff_none.qoi", "0") == 2);
+  CHECK(Run("test_diff_a.qoi", "test_diff_b.qoi", "256") == 2);
+  remove("test_diff_a.qoi");
+  remove("test_diff_b.qoi");
+  remove("test_diff_out.qoi");
+  remove("test_diff.json");
+}
+
+int main(void) {
+  IMAGE a, b;
+  DIFF d;
+  memset(&d, 0, sizeof(d));
+  // a with padded rows, so strides differ
+  if (!Test_AllocPadded(&a, W, H, 12) || !Image_Alloc(&b, W, H)) {
+    CHECK(!"out of memory");
+    return Test_Finish("test_diff");
+  }
+  Page(&a, 1);
+  Copy(&a, &b);
+  CHECK(Diff_Compare(&d, &a, &b, 0) && d.n == 0 && !d.stats.pixels &&
+        d.stats.identical == d.stats.tiles);
+  for (int i = 0; i < EDITS; i++)
+    Edit(&b, &kEdits[i]);
+  CheckEdits(&d, &a, &b, T);
+  CheckEdits(&d, &a, &b, T - 1);
+  CheckEdits(&d, &a, &b, 0);
+  CheckEdits(&d, &a, &b, 50);
+  Diff_Free(&d);
+  CheckGrown(&a);
+  CheckJitter(&a);
+  CheckMain(&a, &b);
+  Image_Free(&a);
+  Image_Free(&b);
+  return Test_Finish("test_diff");
+}
@@ -0,0 +1,73 @@
+// Dim_Build: every kernel against the reference formula, on odd widths
+// (SIMD tails) and padded strides, for a spread of alphas.
+
+#include <stdlib.h>
+
+#include "dim.h"
+#include "platform.h"
+#include "test.h"
+
+static const char *kPathName[] = {"scalar", "sse2", "avx2"};
+
+// round(c * (255 - alpha) / 255), alpha forced opaque.
+static unsigned char Reference(int c, int alpha) {
+  return (unsigned char)((2 * c * (255 - alpha) + 255) / 510);
+}
+
+static void CheckPath(DIM_PATH path, int w, int h, int pad, int alpha) {
+  IMAGE src, dst;
+  if (!Test_AllocPadded(&src, w, h, pad) ||
+      !Test_AllocPadded(&dst, w, h, pad + 12)) {
+    CHECK(!"out of memory");
+    return;
+  }
+  Test_Noise(&src, (uint32_t)(w * 7919 + h * 31 + alpha + 1));
+  Test_Noise(&dst, 99);
+  Dim_BuildPath(&src, &dst, (unsigned char)alpha, path);
+  int bad = 0;
+  for (int y = 0; y < h && !bad; y++) {
+    const unsigned char *s = IMAGE_ROW(&src, y), *d = IMAGE_ROW(&dst, y);
+    for (int x = 0; x < w * 4 && !bad; x++) {
+      int want = (x & 3) == 3 ? 0xFF : Reference(s[x], alpha);
+      if (d[x] != want) {
+        fprintf(stderr,
+                "%s: %dx%d pad %d alpha %d: byte %d of row %d is %d, "
+                "want %d\n",
+                kPathName[path], w, h, pad, alpha, x, y, d[x], want);
+        bad = 1;
+      }
+    }
+  }
+  CHECK(!bad);
+  Image_Free(&src);
+  Image_Free(&dst);
+}
+
+int main(void) {
+  // The shift trick must equal the divide for every byte and factor.
+  int exact = 1;
+  for (int c = 0; c < 256; c++)
+    for (int a = 0; a < 256; a++) {
+      unsigned x = (unsigned)c * (255u - a) + 128;
+      if (((x + (x >> 8)) >> 8) != Reference(c, a))
+        exact = 0;
+    }
+  CHECK(exact);
+
+  static const int kWidths[] = {1, 3, 4, 7, 8, 9, 15, 17, 31, 33, 257, 1001};
+  static const int kAlphas[] = {0, 1, 96, 128, 254, 255};
+  DIM_PATH best = Dim_BestPath();
+  for (int p = DIM_SCALAR; p <= DIM_AVX2; p++) {
+    if (p > (int)best) {
+      printf("test_dim: %s not available here, skipped\n", kPathName[p]);
+      continue;
+    }
+    for (size_t i = 0; i < sizeof(kWidths) / sizeof(kWidths[0]); i++)
+      for (size_t a = 0; a < sizeof(kAlphas) / sizeof(kAlphas[0]); a++)
+        CheckPath((DIM_PATH)p, kWidths[i], 5 + (int)i, (int)(i % 3) * 4,
+                  kAlphas[a]);
+    // Tall enough for Par_For to split it.
+    CheckPath((DIM_PATH)p, 333, 700, 8, 96);
+  }
+  return Test_Finish("test_dim");
+}
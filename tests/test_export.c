@@ -0,0 +1,139 @@
+// The background export queue under 100 back-to-back confirms: each one
+// crops a 4K capture, hands the crop to Export_Submit with a publish step
+// and a file, and returns to the "event loop" at once. Every job must run,
+// in order, publish before its file, with every byte written; the queue
+// stats must count them and their latencies.
+// Prints confirm cost and queue latency percentiles.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "export.h"
+#include "platform.h"
+#include "raw.h"
+#include "test.h"
+
+#define CONFIRMS 100
+
+typedef struct {
+  volatile long published, done, failed, outOfOrder;
+  long long fileBytes[CONFIRMS];
+} LEDGER;
+
+static LEDGER g_ledger;
+
+static int Publish(EXPORT_JOB *job) {
+  long i = (long)(size_t)job->ctx;
+  // publish runs first, and jobs run one after another
+  if (Atomic_Load(&g_ledger.published) != i ||
+      Atomic_Load(&g_ledger.done) != i)
+    Atomic_Inc(&g_ledger.outOfOrder);
+  Atomic_Inc(&g_ledger.published);
+  return 1;
+}
+
+static void Done(EXPORT_JOB *job, int ok) {
+  long i = (long)(size_t)job->ctx;
+  if (!ok)
+    Atomic_Inc(&g_ledger.failed);
+  g_ledger.fileBytes[i] = (long long)job->stats.fileBytes;
+  Atomic_Inc(&g_ledger.done);
+}
+
+static int CompareLL(const void *a, const void *b) {
+  long long x = *(const long long *)a, y = *(const long long *)b;
+  return x < y ? -1 : x > y;
+}
+
+int main(void) {
+  IMAGE capture;
+  if (!Image_Alloc(&capture, 3840, 2160)) {
+    CHECK(!"out of memory");
+    return Test_Finish("test_export");
+  }
+  Test_Noise(&capture, 14);
+  static const EXPORT_FORMAT kFormat[] = {EXPORT_QOI, EXPORT_RAW, EXPORT_PNG};
+  long long confirm[CONFIRMS], wantBytes[CONFIRMS];
+  uint32_t rng = 5;
+  long long t0 = Clock_Ns();
+  for (int i = 0; i < CONFIRMS; i++) {
+    long long c0 = Clock_Ns();
+    int w = 200 + (int)(Test_Rand(&rng) % 1200);
+    int h = 150 + (int)(Test_Rand(&rng) % 800);
+    int x = (int)(Test_Rand(&rng) % (uint32_t)(capture.w - w));
+    int y = (int)(Test_Rand(&rng) % (uint32_t)(capture.h - h));
+    IMAGE crop;
+    if (!Image_Crop(&capture, &(IRECT){x, y, x + w, y + h}, &crop)) {
+      CHECK(!"out of memory");
+      break;
+    }
+    EXPORT_JOB job;
+    memset(&job, 0, sizeof(job));
+    job.image = ExportImage_Wrap(&crop);
+    job.publish = Publish;
+    job.file = tmpfile();
+    job.format = kFormat[i % 3];
+    job.done = Done;
+    job.ctx = (void *)(size_t)i;
+    CHECK(job.image && job.file);
+    // encoded formats: any size will do
+    wantBytes[i] =
+        job.format == EXPORT_RAW ? RAW_HEADER + (long long)w * h * 4 : -1;
+    Export_Submit(&job);
+    confirm[i] = Clock_Ns() - c0;
+  }
+  long long submitNs = Clock_Ns() - t0;
+  Export_Flush();
+  long long drainNs = Clock_Ns() - t0;
+
+  CHECK(g_ledger.published == CONFIRMS);
+  CHECK(g_ledger.done == CONFIRMS);
+  CHECK(!g_ledger.failed);
+  CHECK(!g_ledger.outOfOrder);
+  for (int i = 0; i < CONFIRMS; i++)
+    CHECK(wantBytes[i] < 0 ? g_ledger.fileBytes[i] > 0
+                           : g_ledger.fileBytes[i] == wantBytes[i]);
+
+  EXPORT_QUEUE_STATS q;
+  Export_QueueStats(&q);
+  CHECK(q.submitted == CONFIRMS && q.completed == CONFIRMS);
+  // 100 confirms into a queue of EXPORT_QUEUE_DEPTH must back up
+  CHECK(q.stalls > 0 && q.stallNs > 0);
+  CHECK(q.waitP50 >= 0 && q.waitP50 <= q.waitP99 && q.waitP99 <= q.waitMax);
+  CHECK(q.doneP50 > 0 && q.doneP50 <= q.doneP99 && q.doneP99 <= q.doneMax);
+  CHECK(q.waitP50 <= q.doneP50 && q.waitMax <= q.doneMax);
+
+  qsort(confirm, CONFIRMS, sizeof(confirm[0]), CompareLL);
+  printf("test_export: %d confirms submitted in %.1f ms, drained in %.1f ms "
+         "(%d thread(s))\n",
+         CONFIRMS, submitNs / 1e6, drainNs / 1e6, Cpu_Count());
+  printf("test_export: confirm p50 %.3f p99 %.2f max %.2f ms; %llu stalls "
+         "(%.1f ms)\n",
+         confirm[CONFIRMS / 2] / 1e6, confirm[CONFIRMS * 99 / 100] / 1e6,
+         confirm[CONFIRMS - 1] / 1e6, q.stalls, q.stallNs / 1e6);
+  printf("test_export: queue wait p50 %.2f p99 %.2f max %.2f ms, submit to "
+         "done p50 %.2f p99 %.2f max %.2f ms\n",
+         q.waitP50 / 1e6, q.waitP99 / 1e6, q.waitMax / 1e6, q.doneP50 / 1e6,
+         q.doneP99 / 1e6, q.doneMax / 1e6);
+
+  // A second burst adds to the counts; the maxima never shrink.
+  long long waitMax = q.waitMax;
+  for (int i = 0; i < 10; i++) {
+    IMAGE crop;
+    if (!Image_Crop(&capture, &(IRECT){0, 0, 64, 64}, &crop))
+      break;
+    EXPORT_JOB job;
+    memset(&job, 0, sizeof(job));
+    job.image = ExportImage_Wrap(&crop);
+    job.file = tmpfile();
+    job.format = EXPORT_RAW;
+    Export_Submit(&job);
+  }
+  Export_Flush();
+  Export_QueueStats(&q);
+  CHECK(q.submitted == CONFIRMS + 10 && q.completed == CONFIRMS + 10);
+  CHECK(q.waitMax >= waitMax);
+
+  Image_Free(&capture);
+  return Test_Finish("test_export");
+}
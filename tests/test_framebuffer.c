@@ -0,0 +1,189 @@
+// Framebuffer tile map: layouts with negative origins, gaps and mirrored
+// monitors, read back through Framebuffer_Read/Crop/View against a
+// reference desktop, plain and packed.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "framebuffer.h"
+#include "test.h"
+
+#define BLACK 0xFF000000u
+
+typedef struct {
+  const char *name;
+  int n;
+  IRECT mon[6]; // screen coordinates
+  int tiles;    // expected after dropping empty and mirrored ones
+  IRECT virt;
+} LAYOUT;
+
+static const LAYOUT kLayouts[] = {
+    // A monitor left of the primary, a portrait one reaching above it, a
+    // mirror of the primary and an empty rect.
+    {"left and portrait",
+     5,
+     {{-1280, 0, 0, 1024},
+      {0, 0, 1600, 900},
+      {1600, -320, 2500, 1280},
+      {0, 0, 1600, 900},
+      {5, 5, 5, 5}},
+     3,
+     {-1280, -320, 2500, 1280}},
+    // Stacked above the primary, and one off to the side with a gap.
+    {"stacked with gap",
+     3,
+     {{0, -768, 1024, 0}, {0, 0, 1920, 1080}, {2200, 200, 2800, 700}},
+     3,
+     {0, -768, 2800, 1080}},
+    {"single at negative origin", 1, {{-800, -600, 0, 0}}, 1,
+     {-800, -600, 0, 0}},
+};
+
+// The desktop as one image over the layout's bounding box: monitors hold
+// noise, gaps opaque black.
+static int Reference(const LAYOUT *l, IMAGE *ref, uint32_t seed) {
+  IRECT v = l->virt;
+  if (!Image_Alloc(ref, v.right - v.left, v.bottom - v.top))
+    return 0;
+  for (int y = 0; y < ref->h; y++) {
+    unsigned *p = (unsigned *)IMAGE_ROW(ref, y);
+    for (int x = 0; x < ref->w; x++)
+      p[x] = BLACK;
+  }
+  for (int i = 0; i < l->n; i++) {
+    const IRECT *m = &l->mon[i];
+    if (IRect_IsEmpty(m))
+      continue;
+    uint32_t s = seed + (uint32_t)(m->left * 31 + m->top * 7 + 1000);
+    for (int y = m->top; y < m->bottom; y++) {
+      unsigned *p = (unsigned *)IMAGE_ROW(ref, y - v.top);
+      for (int x = m->left; x < m->right; x++)
+        p[x - v.left] = Test_Rand(&s);
+    }
+  }
+  return 1;
+}
+
+// dst at (dx, dy) must hold the reference over r, clipped to the frame.
+static int Matches(const IMAGE *ref, const IRECT *r, const IMAGE *dst,
+                   int dx, int dy) {
+  IRECT bounds = {0, 0, ref->w, ref->h}, c;
+  if (!IRect_Intersect(r, &bounds, &c))
+    return 1;
+  for (int y = c.top; y < c.bottom; y++)
+    if (memcmp(IMAGE_ROW(dst, y + dy) + (size_t)(c.left + dx) * 4,
+               IMAGE_ROW(ref, y) + (size_t)c.left * 4,
+               (size_t)(c.right - c.left) * 4))
+      return 0;
+  return 1;
+}
+
+static IRECT RandomRect(const IMAGE *ref, uint32_t *rng) {
+  int x = (int)(Test_Rand(rng) % (uint32_t)(ref->w + 200)) - 100;
+  int y = (int)(Test_Rand(rng) % (uint32_t)(ref->h + 200)) - 100;
+  int w = 1 + (int)(Test_Rand(rng) % 900), h = 1 + (int)(Test_Rand(rng) % 700);
+  return (IRECT){x, y, x + w, y + h};
+}
+
+static void CheckLayout(const LAYOUT *l) {
+  FRAMEBUFFER fb;
+  IMAGE ref, dst;
+  if (!Reference(l, &ref, 5)) {
+    CHECK(!"out of memory");
+    return;
+  }
+  CHECK(Framebuffer_Layout(&fb, l->mon, l->n) == l->tiles);
+  CHECK(!memcmp(&fb.virt, &l->virt, sizeof(IRECT)));
+  CHECK(fb.w == ref.w && fb.h == ref.h);
+  // Tiles sit at their monitor less the bounding box origin; the capture
+  // pixels come from the reference at the monitor's screen position.
+  for (int i = 0; i < fb.ntiles; i++) {
+    FB_TILE *t = &fb.tiles[i];
+    int found = 0;
+    for (int j = 0; j < l->n; j++)
+      found |= t->area.left == l->mon[j].left - l->virt.left &&
+               t->area.top == l->mon[j].top - l->virt.top &&
+               t->area.right == l->mon[j].right - l->virt.left &&
+               t->area.bottom == l->mon[j].bottom - l->virt.top;
+    CHECK(found);
+    CHECK(Image_Crop(&ref, &t->area, &t->capture));
+  }
+
+  // Capture reads: random rects, many across gaps or off the frame, into a
+  // buffer at an offset.
+  if (!Image_Alloc(&dst, ref.w + 64, ref.h + 64)) {
+    CHECK(!"out of memory");
+    Image_Free(&ref);
+    return;
+  }
+  uint32_t rng = 77;
+  int bad = 0;
+  for (int i = 0; i < 400; i++) {
+    IRECT r = RandomRect(&ref, &rng);
+    int dx = (int)(Test_Rand(&rng) % 64), dy = (int)(Test_Rand(&rng) % 64);
+    Framebuffer_Read(&fb, 0, &r, &dst, dx, dy);
+    if (!Matches(&ref, &r, &dst, dx, dy) && !bad++)
+      fprintf(stderr, "%s: read of (%d,%d)-(%d,%d) wrong\n", l->name,
+              r.left, r.top, r.right, r.bottom);
+  }
+  CHECK(!bad);
+
+  // A crop spanning every tile and the gaps between them.
+  IRECT all = {-50, -50, fb.w + 50, fb.h + 50};
+  IMAGE crop;
+  CHECK(Framebuffer_Crop(&fb, &all, &crop));
+  CHECK(crop.w == fb.w && crop.h == fb.h);
+  CHECK(Test_FirstDiffRow(&crop, &ref) < 0);
+  Image_Free(&crop);
+
+  // Views exist only inside one tile.
+  IMAGE view;
+  const IRECT *a0 = &fb.tiles[0].area;
+  IRECT in = {a0->left + 3, a0->top + 5, a0->right - 7, a0->bottom - 1};
+  CHECK(Framebuffer_View(&fb, &in, &view));
+  CHECK(Matches(&ref, &in, &view, -in.left, -in.top));
+  CHECK(!Framebuffer_View(&fb, &all, &view));
+
+  // Dimmed reads: packed blocks must give what the plain copies give.
+  IMAGE plain;
+  CHECK(Framebuffer_Dim(&fb, 96));
+  CHECK(Image_Alloc(&plain, fb.w, fb.h));
+  IRECT frame = {0, 0, fb.w, fb.h};
+  Framebuffer_Read(&fb, 1, &frame, &plain, 0, 0);
+  CHECK(Framebuffer_Pack(&fb, 96, 2u << 20));
+  bad = 0;
+  for (int i = 0; i < 200; i++) {
+    IRECT r = RandomRect(&ref, &rng);
+    Framebuffer_Read(&fb, 1, &r, &dst, 0, 0);
+    if (!Matches(&plain, &r, &dst, 0, 0) && !bad++)
+      fprintf(stderr, "%s: packed read of (%d,%d)-(%d,%d) wrong\n", l->name,
+              r.left, r.top, r.right, r.bottom);
+  }
+  CHECK(!bad);
+  CHECK(!Framebuffer_View(&fb, &in, &view));
+
+  Image_Free(&plain);
+  Image_Free(&dst);
+  Framebuffer_Free(&fb);
+  for (int i = 0; i < fb.ntiles; i++)
+    Image_Free(&fb.tiles[i].capture);
+  Image_Free(&ref);
+}
+
+int main(void) {
+  for (size_t i = 0; i < sizeof(kLayouts) / sizeof(kLayouts[0]); i++)
+    CheckLayout(&kLayouts[i]);
+
+  // Same monitors, same layout; one moved, a different one.
+  FRAMEBUFFER a, b;
+  IRECT m[2] = {{-1280, 0, 0, 1024}, {0, 0, 1600, 900}};
+  Framebuffer_Layout(&a, m, 2);
+  Framebuffer_Layout(&b, m, 2);
+  CHECK(Framebuffer_SameLayout(&a, &b));
+  m[1].top = 100;
+  m[1].bottom = 1000;
+  Framebuffer_Layout(&b, m, 2);
+  CHECK(!Framebuffer_SameLayout(&a, &b));
+  return Test_Finish("test_framebuffer");
+}
@@ -0,0 +1,171 @@
+// FrameClock: synthetic 1000 Hz pointer streams through a simulated event
+// loop that sleeps for FrameClock_Due, takes an update when it is due and
+// presents it a little later. No real clock: times are made up, so the
+// pacing checks are exact.
+
+#include <string.h>
+
+#include "frameclock.h"
+#include "test.h"
+
+#define MS 1000000LL
+#define T0 (1000 * MS) // Clock_Ns values are never 0
+
+typedef struct {
+  long long interval; // ns between events at full rate
+  long long jitter;   // each event is up to this much late
+  int burst;          // events arriving together, 1 = evenly spaced
+  long long pauseAt, pauseNs; // an idle gap in the stream
+} STREAM;
+
+typedef struct {
+  unsigned long long events, takes;
+  long long minGap;   // between two takes while the stream was busy
+  long long maxStale; // age of the newest event when it was taken
+  int wrongPos;       // a take that did not return the newest event
+  int lateAfterIdle;  // first event after the gap was not taken at once
+} RESULT;
+
+// Runs `duration` of stream s against a display of hz; each update takes
+// render ns to reach the screen.
+static RESULT Simulate(int hz, const STREAM *s, long long duration,
+                       long long render, FRAME_CLOCK *fc) {
+  RESULT r;
+  memset(&r, 0, sizeof(r));
+  r.minGap = -1;
+  FrameClock_Init(fc, hz);
+  uint32_t rng = (uint32_t)hz * 2654435761u | 1;
+  long long now = T0, nextEvent = T0, lastTake = 0, present = 0;
+  long long resumeAt = s->pauseNs ? T0 + s->pauseAt + s->pauseNs : -1;
+  int n = 0, lastX = -1, lastY = -1, idle = 0;
+  while (now < T0 + duration) {
+    long long due = FrameClock_Due(fc, now);
+    long long wake = nextEvent;
+    if (due >= 0 && now + due < wake)
+      wake = now + due;
+    if (present && present < wake)
+      wake = present;
+    now = wake;
+    if (present && now >= present) {
+      FrameClock_Presented(fc, now);
+      present = 0;
+    }
+    if (now >= nextEvent) {
+      for (int b = 0; b < s->burst; b++) {
+        lastX = n % 1920;
+        lastY = n / 1920;
+        FrameClock_Push(fc, lastX, lastY, now);
+        n++;
+      }
+      r.events += s->burst;
+      long long at = T0 + (long long)n / s->burst * s->interval;
+      if (s->jitter)
+        at += (long long)(Test_Rand(&rng) % (uint32_t)s->jitter);
+      if (s->pauseNs && at >= T0 + s->pauseAt && now < T0 + s->pauseAt) {
+        at = resumeAt;
+        idle = 1;
+      }
+      if (at <= now)
+        at = now + 1;
+      nextEvent = at;
+      if (idle && now >= resumeAt) {
+        // the clock must not hold back the first event after a gap
+        if (FrameClock_Due(fc, now) != 0)
+          r.lateAfterIdle = 1;
+        idle = 0;
+      }
+    }
+    POINTER_EVENT e;
+    if (!present && FrameClock_Due(fc, now) == 0 &&
+        FrameClock_Take(fc, now, &e)) {
+      if (e.x != lastX || e.y != lastY)
+        r.wrongPos++;
+      if (now - e.t > r.maxStale)
+        r.maxStale = now - e.t;
+      if (lastTake && now - lastTake < 2 * fc->period &&
+          (r.minGap < 0 || now - lastTake < r.minGap))
+        r.minGap = now - lastTake;
+      lastTake = now;
+      r.takes++;
+      present = now + render;
+    }
+  }
+  if (present)
+    FrameClock_Presented(fc, present);
+  return r;
+}
+
+static void CheckSteady(int hz, const STREAM *s, const char *what) {
+  FRAME_CLOCK fc;
+  long long duration = 2000 * MS;
+  long long render = 1000000000LL / hz / 2;
+  RESULT r = Simulate(hz, s, duration, render, &fc);
+  long long period = fc.period;
+  // Updates: one per frame, or one per event batch when input is slower.
+  long long frames = duration / period;
+  long long batches = duration / s->interval;
+  long long want = frames < batches ? frames : batches;
+  int ok = r.takes + 2 >= (unsigned long long)want &&
+           r.takes <= (unsigned long long)want + 2 && r.wrongPos == 0 &&
+           fc.events == r.events && fc.updates == r.takes &&
+           fc.presents == fc.updates &&
+           (r.minGap < 0 || r.minGap >= period - s->jitter) &&
+           r.maxStale <= s->interval + s->jitter &&
+           fc.latencyMax <= period + s->interval + s->jitter + render;
+  if (!ok)
+    fprintf(stderr,
+            "%d Hz, %s: %llu events, %llu takes (want ~%lld), %d stale, "
+            "min gap %.2f ms, latency max %.2f ms, presents %llu\n",
+            hz, what, r.events, r.takes, want, r.wrongPos, r.minGap / 1e6,
+            fc.latencyMax / 1e6, fc.presents);
+  CHECK(ok);
+}
+
+int main(void) {
+  static const int kHz[] = {30, 60, 75, 144, 240, 360, 1000};
+  STREAM even = {MS, 0, 1, 0, 0};
+  STREAM jittery = {MS, MS / 2, 1, 0, 0};
+  STREAM bursty = {4 * MS, 0, 4, 0, 0}; // 1000 events/s in USB-sized clumps
+  for (size_t i = 0; i < sizeof(kHz) / sizeof(kHz[0]); i++) {
+    CheckSteady(kHz[i], &even, "even");
+    CheckSteady(kHz[i], &jittery, "jittery");
+    CheckSteady(kHz[i], &bursty, "bursty");
+  }
+
+  // A stream that stops for half a second and resumes: the first event
+  // after the gap goes out at once, and pacing resumes from there.
+  STREAM gap = {MS, 0, 1, 700 * MS, 500 * MS};
+  FRAME_CLOCK fc;
+  RESULT r = Simulate(60, &gap, 2000 * MS, 8 * MS, &fc);
+  CHECK(!r.lateAfterIdle);
+  CHECK(r.wrongPos == 0);
+  CHECK(fc.presents == fc.updates);
+
+  // Refresh rates out of range fall back to 60 Hz.
+  FrameClock_Init(&fc, 5);
+  CHECK(fc.period == 1000000000LL / 60);
+  FrameClock_Init(&fc, 5000);
+  CHECK(fc.period == 1000000000LL / 60);
+
+  // Nothing queued: no update, nothing due, presenting is a no-op.
+  POINTER_EVENT e;
+  FrameClock_Init(&fc, 60);
+  CHECK(FrameClock_Due(&fc, T0) == -1);
+  CHECK(!FrameClock_Take(&fc, T0, &e));
+  FrameClock_Presented(&fc, T0);
+  CHECK(fc.presents == 0);
+
+  // A stalled loop: a second of 1000 Hz input with no take. The queue
+  // keeps the newest FRAMECLOCK_QUEUE events; one take returns the last
+  // position and the latency counts from the oldest event kept.
+  for (int i = 0; i < 1000; i++)
+    FrameClock_Push(&fc, i, -i, T0 + i * MS);
+  CHECK(fc.events == 1000);
+  CHECK(FrameClock_Due(&fc, T0 + 1000 * MS) == 0);
+  CHECK(FrameClock_Take(&fc, T0 + 1000 * MS, &e));
+  CHECK(e.x == 999 && e.y == -999);
+  CHECK(FrameClock_Due(&fc, T0 + 1000 * MS) == -1);
+  FrameClock_Presented(&fc, T0 + 1001 * MS);
+  CHECK(fc.latencyLast == (1001 - (1000 - FRAMECLOCK_QUEUE)) * MS);
+  return Test_Finish("test_frameclock");
+}
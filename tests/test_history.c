@@ -0,0 +1,306 @@
+// History store round trips in a scratch directory: captures with edge
+// tiles, an edit that only adds the tile it touched, a tile repeated within
+// one capture, whole and partial reads (clipped to the capture) checked
+// against the originals, and a second writer refused. Then the recovery
+// paths: an index a writer left dirty, rebuilt in private memory by a
+// read-only open without touching tiles.idx and in place by a writer; a
+// tiles.pack cut in its last record, whose capture stops reading until the
+// tile is added again; and a captures.log cut in its last record, which
+// drops that capture and is written over by the next one. Last, `screenshot
+// history --extract` with and without --region, and its exit status.
+
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <direct.h>
+#define rmdir _rmdir
+#else
+#include <unistd.h>
+#endif
+
+#include "history.h"
+#include "platform.h"
+#include "qoi.h"
+#include "test.h"
+
+#define DIR_NAME "test_history.tmp"
+#define SHOTS 4
+
+static const char *kFiles[] = {"tiles.pack", "tiles.idx", "captures.log"};
+
+static const char *Path(const char *name) {
+  static char path[HISTORY_PATH_MAX + 16];
+  snprintf(path, sizeof(path), "%s/%s", DIR_NAME, name);
+  return path;
+}
+
+static unsigned char *Slurp(const char *path, size_t *n) {
+  FILE *f = File_Open(path, "rb");
+  unsigned char *p = f ? Test_Slurp(f, n) : NULL;
+  if (f)
+    fclose(f);
+  return p;
+}
+
+static long long Size(const char *name) {
+  size_t n = 0;
+  unsigned char *p = Slurp(Path(name), &n);
+  free(p);
+  return p ? (long long)n : -1;
+}
+
+// Drops the last `drop` bytes of a store file, as a crash would.
+static int Cut(const char *name, size_t drop) {
+  size_t n = 0;
+  unsigned char *p = Slurp(Path(name), &n);
+  FILE *f = p && n > drop ? File_Open(Path(name), "wb") : NULL;
+  int ok = f && fwrite(p, 1, n - drop, f) == n - drop;
+  if (f)
+    ok = fclose(f) == 0 && ok;
+  free(p);
+  return ok;
+}
+
+// 1 if capture i, or r of it, reads back as r of src.
+static int Same(HISTORY *h, int i, const IRECT *r, const IMAGE *src) {
+  IRECT full = {0, 0, src->w, src->h}, want;
+  IMAGE got;
+  if (!IRect_Intersect(r ? r : &full, &full, &want) ||
+      !History_Read(h, i, r, &got))
+    return 0;
+  IMAGE part = *src;
+  part.px = IMAGE_ROW(src, want.top) + (size_t)want.left * 4;
+  part.w = want.right - want.left;
+  part.h = want.bottom - want.top;
+  int same = got.w == part.w && got.h == part.h &&
+             Test_FirstDiffRow(&got, &part) < 0;
+  Image_Free(&got);
+  return same;
+}
+
+// The first n captures are shot[0..n).
+static void CheckAll(HISTORY *h, IMAGE *shot, int n) {
+  CHECK(h->n >= n);
+  for (int i = 0; i < n && i < h->n; i++) {
+    CHECK(Same(h, i, NULL, &shot[i]));
+    CHECK(h->capture[i].w == shot[i].w && h->capture[i].h == shot[i].h &&
+          h->capture[i].time == 1000 + i);
+  }
+}
+
+// Noise with the alpha of a screen grab, which is what QOI keeps.
+static void Noise(IMAGE *img, uint32_t seed) {
+  Test_Noise(img, seed);
+  for (int y = 0; y < img->h; y++)
+    for (int x = 0; x < img->w; x++)
+      IMAGE_ROW(img, y)[x * 4 + 3] = 0xFF;
+}
+
+// A: edge tiles on both sides. B: A with one tile edited. C: exactly one
+// tile. D: C repeated, so its full tiles are C's and the two cut along its
+// bottom edge are one.
+static int Shots(IMAGE *shot) {
+  static const int kSize[SHOTS][2] = {
+      {200, 150}, {200, 150}, {64, 64}, {130, 70}};
+  for (int i = 0; i < SHOTS; i++)
+    if (!Image_Alloc(&shot[i], kSize[i][0], kSize[i][1]))
+      return 0;
+  Noise(&shot[0], 1);
+  memcpy(shot[1].px, shot[0].px, (size_t)shot[0].stride * shot[0].h);
+  for (int y = 70; y < 80; y++)
+    for (int x = 70; x < 90; x++)
+      ((uint32_t *)IMAGE_ROW(&shot[1], y))[x] = 0xFF5A5A5A;
+  Noise(&shot[2], 3);
+  for (int y = 0; y < shot[3].h; y++)
+    for (int x = 0; x < shot[3].w; x++)
+      memcpy(IMAGE_ROW(&shot[3], y) + x * 4,
+             IMAGE_ROW(&shot[2], y % 64) + (x % 64) * 4, 4);
+  return 1;
+}
+
+static void CheckRoundTrip(IMAGE *shot) {
+  static const int kNew[SHOTS] = {12, 1, 1, 3};
+  HISTORY h, other;
+  if (!History_Open(&h, DIR_NAME, 1)) {
+    CHECK(!"cannot open the store");
+    return;
+  }
+  int refused = !History_Open(&other, DIR_NAME, 1); // one writer at a time
+  if (!refused)
+    History_Close(&other);
+  CHECK(refused);
+  for (int i = 0; i < SHOTS; i++) {
+    unsigned long long fresh = h.stats.newTiles;
+    CHECK(History_Add(&h, &shot[i], 1000 + i) == i);
+    CHECK(h.stats.newTiles - fresh == (unsigned long long)kNew[i]);
+  }
+  CheckAll(&h, shot, SHOTS);
+  static const IRECT kPart[] = {{60, 50, 160, 140}, // across four tiles
+                                {64, 64, 128, 128}, // exactly the edit's
+                                {199, 149, 200, 150},
+                                {150, 100, 400, 400}}; // clipped
+  for (size_t k = 0; k < sizeof(kPart) / sizeof(kPart[0]); k++)
+    CHECK(Same(&h, 1, &kPart[k], &shot[1]));
+  IRECT off = {200, 0, 300, 10};
+  IMAGE img;
+  CHECK(!History_Read(&h, 1, &off, &img) &&
+        !History_Read(&h, SHOTS, NULL, &img));
+  History_Close(&h);
+
+  // a reader sees the same, cannot add and leaves the files alone
+  long long idx = Size("tiles.idx"), pack = Size("tiles.pack");
+  CHECK(History_Open(&h, DIR_NAME, 0) && h.n == SHOTS);
+  CheckAll(&h, shot, SHOTS);
+  CHECK(History_Add(&h, &shot[0], 0) < 0 && !h.stats.rebuildNs);
+  History_Close(&h);
+  CHECK(Size("tiles.idx") == idx && Size("tiles.pack") == pack);
+}
+
+static void CheckDirtyIndex(IMAGE *shot) {
+  HISTORY h;
+  if (!History_Open(&h, DIR_NAME, 1)) {
+    CHECK(!"cannot reopen the store");
+    return;
+  }
+  ((HISTORY_INDEX *)h.idx.p)->dirty = 1; // as if it died mid-capture
+  History_Close(&h);
+  size_t n = 0, m = 0;
+  unsigned char *before = Slurp(Path("tiles.idx"), &n);
+  CHECK(History_Open(&h, DIR_NAME, 0) && h.stats.rebuildNs > 0);
+  CheckAll(&h, shot, SHOTS);
+  History_Close(&h);
+  unsigned char *after = Slurp(Path("tiles.idx"), &m);
+  CHECK(before && after && n == m && !memcmp(before, after, n));
+  free(before);
+  free(after);
+
+  CHECK(History_Open(&h, DIR_NAME, 1) && h.stats.rebuildNs > 0);
+  CheckAll(&h, shot, SHOTS);
+  History_Close(&h);
+  CHECK(History_Open(&h, DIR_NAME, 0) && !h.stats.rebuildNs);
+  History_Close(&h);
+}
+
+static void CheckCutPack(IMAGE *shot, IMAGE *extra) {
+  HISTORY h;
+  if (!History_Open(&h, DIR_NAME, 1)) {
+    CHECK(!"cannot reopen the store");
+    return;
+  }
+  CHECK(History_Add(&h, extra, 1000 + SHOTS) == SHOTS);
+  History_Close(&h);
+  long long pack = Size("tiles.pack");
+  CHECK(Cut("tiles.pack", 10));
+
+  // the index now describes more than the pack holds
+  CHECK(History_Open(&h, DIR_NAME, 0) && h.stats.rebuildNs > 0);
+  CheckAll(&h, shot, SHOTS);
+  CHECK(h.n == SHOTS + 1 && !Same(&h, SHOTS, NULL, extra));
+  History_Close(&h);
+
+  // adding it again packs only the tile that was cut, over the cut record
+  CHECK(History_Open(&h, DIR_NAME, 1));
+  CHECK(History_Add(&h, extra, 1000 + SHOTS + 1) == SHOTS + 1 &&
+        h.stats.newTiles == 1);
+  CHECK(Same(&h, SHOTS, NULL, extra) && Same(&h, SHOTS + 1, NULL, extra));
+  History_Close(&h);
+  CHECK(Size("tiles.pack") == pack);
+}
+
+static void CheckCutLog(IMAGE *shot, IMAGE *extra) {
+  HISTORY h;
+  long long log = Size("captures.log");
+  CHECK(Cut("captures.log", 5)); // into the last capture's keys
+  CHECK(History_Open(&h, DIR_NAME, 0) && h.n == SHOTS + 1);
+  History_Close(&h);
+  size_t keys = 4 * sizeof(HISTORY_KEY); // extra is 2x2 tiles
+  CHECK(Cut("captures.log", keys - 5 + sizeof(HISTORY_RECORD) / 2));
+  if (!History_Open(&h, DIR_NAME, 1)) {
+    CHECK(!"cannot reopen the store");
+    return;
+  }
+  CHECK(h.n == SHOTS + 1);
+  CHECK(History_Add(&h, extra, 1000 + SHOTS + 1) == SHOTS + 1 &&
+        !h.stats.newTiles);
+  History_Close(&h);
+  CHECK(Size("captures.log") == log);
+  CHECK(History_Open(&h, DIR_NAME, 0));
+  CheckAll(&h, shot, SHOTS);
+  CHECK(h.n == SHOTS + 2 && Same(&h, SHOTS + 1, NULL, extra));
+  History_Close(&h);
+}
+
+static int Extract(const char *id, const char *region) {
+  char *argv[] = {"--dir", DIR_NAME, "--extract", (char *)id,
+                  "--out", "test_history_out.qoi", "--region",
+                  (char *)region};
+  return History_Main(region ? 8 : 6, argv);
+}
+
+// 1 if test_history_out.qoi holds r of src (all of it if r is NULL).
+static int Extracted(const IMAGE *src, const IRECT *r) {
+  IRECT full = {0, 0, src->w, src->h};
+  size_t n = 0;
+  unsigned char *p = Slurp("test_history_out.qoi", &n);
+  IMAGE got, want;
+  int ok = p && Qoi_Decode(p, n, &got);
+  free(p);
+  if (!ok)
+    return 0;
+  ok = Image_Crop(src, r ? r : &full, &want);
+  if (ok) {
+    ok = got.w == want.w && got.h == want.h &&
+         Test_FirstDiffRow(&got, &want) < 0;
+    Image_Free(&want);
+  }
+  Image_Free(&got);
+  return ok;
+}
+
+static void CheckMain(IMAGE *shot, IMAGE *extra) {
+  IRECT part = {60, 50, 160, 140}, clipped = {150, 100, 200, 150};
+  CHECK(Extract("1", "60,50,100,90") == 0 && Extracted(&shot[1], &part));
+  CHECK(Extract("1", "150,100,250,250") == 0 &&
+        Extracted(&shot[1], &clipped));
+  CHECK(Extract("-1", NULL) == 0 && Extracted(extra, NULL));
+  CHECK(Extract("0", NULL) == 0 && Extracted(&shot[0], NULL));
+  CHECK(Extract("99", NULL) == 1);
+  CHECK(Extract("1", "300,300,10,10") == 1); // off the capture
+  CHECK(Extract("1", "1,2,0,3") == 2);
+  CHECK(Extract("1", "1,2,3") == 2);
+  char *whole[] = {"--dir", DIR_NAME, "--region", "1,2,3,4"};
+  CHECK(History_Main(4, whole) == 2); // a region needs --extract
+  char *missing[] = {"--dir", DIR_NAME "/none", "--extract", "0", "--out",
+                     "test_history_out.qoi"};
+  CHECK(History_Main(6, missing) == 1);
+  remove("test_history_out.qoi");
+}
+
+int main(void) {
+  IMAGE shot[SHOTS], extra;
+  memset(shot, 0, sizeof(shot));
+  memset(&extra, 0, sizeof(extra));
+  for (int i = 0; i < 3; i++)
+    remove(Path(kFiles[i]));
+  if (!Dir_Create(DIR_NAME)) {
+    fprintf(stderr, "test_history: cannot create %s\n", DIR_NAME);
+    return 1;
+  }
+  if (!Shots(shot) || !Image_Alloc(&extra, 100, 100)) {
+    CHECK(!"out of memory");
+  } else {
+    Noise(&extra, 5);
+    CheckRoundTrip(shot);
+    CheckDirtyIndex(shot);
+    CheckCutPack(shot, &extra);
+    CheckCutLog(shot, &extra);
+    CheckMain(shot, &extra);
+  }
+  for (int i = 0; i < SHOTS; i++)
+    Image_Free(&shot[i]);
+  Image_Free(&extra);
+  for (int i = 0; i < 3; i++)
+    remove(Path(kFiles[i]));
+  rmdir(DIR_NAME);
+  return Test_Finish("test_history");
+}
@@ -0,0 +1,128 @@
+// Per-monitor X11 capture on Xvfb. Xvfb drives one CRTC, so the layout is
+// made of RandR 1.5 monitors: three with gaps between them, one of them
+// starting left of the root (X clips it there). Each must become its own
+// tile, grabbed over its own connection, and the gaps must read black.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "capture_x11.h"
+#include "test.h"
+#include "test_x11.h"
+
+#ifdef HAVE_MONITORS
+
+#define BLACK 0xFF000000u
+
+static int HasTile(const FRAMEBUFFER *fb, const IRECT *r) {
+  for (int i = 0; i < fb->ntiles; i++) {
+    const IRECT *a = &fb->tiles[i].area;
+    if (a->left + fb->virt.left == r->left &&
+        a->top + fb->virt.top == r->top &&
+        a->right + fb->virt.left == r->right &&
+        a->bottom + fb->virt.top == r->bottom)
+      return 1;
+  }
+  return 0;
+}
+
+int main(void) {
+  Display *dpy = TestX11_Open("test_layout_x11");
+  if (!dpy)
+    return TEST_SKIP;
+  if (!TestX11_HasMonitors(dpy)) {
+    printf("test_layout_x11: server lacks RandR 1.5, skipped\n");
+    XCloseDisplay(dpy);
+    return TEST_SKIP;
+  }
+  Window root = DefaultRootWindow(dpy);
+  XRRScreenResources *res = XRRGetScreenResourcesCurrent(dpy, root);
+  CHECK(res && res->noutput > 0);
+  if (!res || res->noutput < 1) {
+    if (res)
+      XRRFreeScreenResources(res);
+    XCloseDisplay(dpy);
+    return Test_Finish("test_layout_x11");
+  }
+
+  // The first monitor claims the real output, which retires the automatic
+  // monitor covering the whole screen.
+  IRECT mon[3] = {{0, 0, 1280, 1024}, {1280, 300, 2400, 1000},
+                  {-200, 1100, 500, 1400}};
+  IRECT want[3] = {mon[0], mon[1], {0, 1100, 500, 1400}};
+  CHECK(TestX11_SetMonitor(dpy, "TEST-A", &mon[0], res->outputs[0]));
+  CHECK(TestX11_SetMonitor(dpy, "TEST-B", &mon[1], None));
+  int n = 3;
+  if (!TestX11_SetMonitor(dpy, "TEST-C", &mon[2], None)) {
+    printf("test_layout_x11: monitor left of the root refused, left out\n");
+    n = 2;
+  }
+  XRRFreeScreenResources(res);
+
+  FRAMEBUFFER fb;
+  CHECK(X11Capture_Layout(dpy, &fb) == n);
+  for (int i = 0; i < n; i++)
+    CHECK(HasTile(&fb, &want[i]));
+  IRECT virt = {0, 0, 2400, n == 3 ? 1400 : 1024};
+  CHECK(!memcmp(&fb.virt, &virt, sizeof(IRECT)));
+
+  // Paint the whole screen, grab, and compare with the pattern where there
+  // are monitors and black elsewhere.
+  int scr = DefaultScreen(dpy);
+  IRECT all = {0, 0, DisplayWidth(dpy, scr), DisplayHeight(dpy, scr)};
+  IMAGE pattern, expect, crop;
+  if (!Image_Alloc(&pattern, all.right, all.bottom) ||
+      !Image_Alloc(&expect, fb.w, fb.h)) {
+    CHECK(!"out of memory");
+    XCloseDisplay(dpy);
+    return Test_Finish("test_layout_x11");
+  }
+  Test_Noise(&pattern, 9);
+  for (int y = 0; y < expect.h; y++) {
+    unsigned *e = (unsigned *)IMAGE_ROW(&expect, y);
+    const unsigned *p = (const unsigned *)IMAGE_ROW(&pattern, y + virt.top);
+    for (int x = 0; x < expect.w; x++) {
+      e[x] = BLACK;
+      for (int i = 0; i < n; i++)
+        if (x + virt.left >= want[i].left && x + virt.left < want[i].right &&
+            y + virt.top >= want[i].top && y + virt.top < want[i].bottom)
+          e[x] = p[x + virt.left];
+    }
+  }
+  Window win = TestX11_Cover(dpy, &all);
+  TestX11_Paint(dpy, win, &pattern, 0, 0);
+
+  X11_CAPTURE c = {0};
+  CHECK(X11Capture_Grab(dpy, &c));
+  CHECK(c.fb.ntiles == n);
+  CHECK(!c.serial); // every tile past the first has its own connection
+  IRECT frame = {0, 0, c.fb.w, c.fb.h};
+  CHECK(Framebuffer_Crop(&c.fb, &frame, &crop));
+  int row = TestX11_FirstDiffRgb(&crop, 0, 0, &expect);
+  if (row >= 0)
+    fprintf(stderr, "test_layout_x11: frame differs at row %d\n", row);
+  CHECK(row < 0);
+  Image_Free(&crop);
+  printf("test_layout_x11: %d tiles, %dx%d, grab %.2f ms\n", c.fb.ntiles,
+         c.fb.w, c.fb.h, c.grabNs / 1e6);
+
+  X11Capture_Release(&c);
+  XDestroyWindow(dpy, win);
+  XRRDeleteMonitor(dpy, root, XInternAtom(dpy, "TEST-A", False));
+  XRRDeleteMonitor(dpy, root, XInternAtom(dpy, "TEST-B", False));
+  if (n == 3)
+    XRRDeleteMonitor(dpy, root, XInternAtom(dpy, "TEST-C", False));
+  XCloseDisplay(dpy);
+  Image_Free(&pattern);
+  Image_Free(&expect);
+  return Test_Finish("test_layout_x11");
+}
+
+#else
+
+int main(void) {
+  printf("test_layout_x11: built without RandR 1.5, skipped\n");
+  return TEST_SKIP;
+}
+
+#endif
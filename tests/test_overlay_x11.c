@@ -0,0 +1,281 @@
+// The overlay end to end on Xvfb: the test covers the screen with a white
+// window and runs the real binary with -v (its path is the first
+// argument). It opens the overlay with a PrintScreen sent to the root
+// window and closes it with Escape once the screen under it reads dimmed,
+// then reads the -v stats: the first frame must be presented before the
+// complete (dimmed) one. Prints both. It activates twice, splits the
+// screen into two RandR monitors and activates again: the pool counters
+// must show a miss, then a hit on the same overlay window, then a miss.
+//   test_overlay_x11 path/to/screenshot
+
+#define _GNU_SOURCE // kill
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <X11/Xutil.h>
+#include <X11/keysym.h>
+
+#include "capture_x11.h"
+#include "platform.h"
+#include "test.h"
+#include "test_x11.h"
+
+#define LOG "test_overlay_x11.log"
+#define WAIT_NS 5000000000LL
+
+typedef struct {
+  double first, complete; // ms from the hotkey
+  Window win;
+  char pool[8]; // "hit" or "miss"
+  unsigned hits, misses;
+  double setup;
+} ACTIVATION;
+
+// Runs `exe -v` with stderr to LOG.
+static pid_t Start(const char *exe) {
+  pid_t pid = fork();
+  if (pid == 0) {
+    int fd = open(LOG, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int null = open("/dev/null", O_WRONLY);
+    if (fd < 0 || null < 0)
+      _exit(127);
+    dup2(fd, 2);
+    dup2(null, 1);
+    execl(exe, exe, "-v", (char *)NULL);
+    _exit(127);
+  }
+  return pid;
+}
+
+static char *Log(void) {
+  FILE *f = fopen(LOG, "rb");
+  size_t n = 0;
+  unsigned char *p = f ? Test_Slurp(f, &n) : NULL;
+  if (f)
+    fclose(f);
+  if (p)
+    p[n] = 0; // Test_Slurp leaves room for it
+  return (char *)p;
+}
+
+// The last stats line for `key` in the log, and how many there are.
+static const char *Last(const char *log, const char *key, int *n) {
+  const char *last = NULL;
+  *n = 0;
+  for (const char *p = log; p && (p = strstr(p, key)); p++) {
+    last = p;
+    (*n)++;
+  }
+  return last;
+}
+
+static void SendKey(Display *dpy, Window win, KeySym sym) {
+  XKeyEvent ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.type = KeyPress;
+  ev.display = dpy;
+  ev.window = win;
+  ev.root = DefaultRootWindow(dpy);
+  ev.time = CurrentTime;
+  ev.same_screen = True;
+  ev.keycode = XKeysymToKeycode(dpy, sym);
+  XSendEvent(dpy, win, False, KeyPressMask, (XEvent *)&ev);
+  XFlush(dpy);
+}
+
+// The app listens for the hotkey once some client selects key presses on
+// the root window; this test never does.
+static int Ready(Display *dpy) {
+  XWindowAttributes wa;
+  return XGetWindowAttributes(dpy, DefaultRootWindow(dpy), &wa) &&
+         (wa.all_event_masks & KeyPressMask);
+}
+
+// The app's overlay window, mapped, or 0.
+static Window Overlay(Display *dpy) {
+  Window root, parent, *kids = NULL, found = 0;
+  unsigned n = 0;
+  if (!XQueryTree(dpy, DefaultRootWindow(dpy), &root, &parent, &kids, &n))
+    return 0;
+  for (unsigned i = 0; i < n && !found; i++) {
+    char *name = NULL;
+    XWindowAttributes wa;
+    if (XFetchName(dpy, kids[i], &name) && !strcmp(name, "CaptureOverlay") &&
+        XGetWindowAttributes(dpy, kids[i], &wa) && wa.map_state == IsViewable)
+      found = kids[i];
+    if (name)
+      XFree(name);
+  }
+  if (kids)
+    XFree(kids);
+  return found;
+}
+
+// Both corners of the screen darker than the white under the overlay.
+static int Dimmed(Display *dpy, int w, int h) {
+  for (int i = 0; i < 2; i++) {
+    XImage *xi = XGetImage(dpy, DefaultRootWindow(dpy), i ? w - 1 : 0,
+                           i ? h - 1 : 0, 1, 1, AllPlanes, ZPixmap);
+    unsigned long px = xi ? XGetPixel(xi, 0, 0) : 0xFFFFFF;
+    if (xi)
+      XDestroyImage(xi);
+    if ((px & 0xFF) >= 0xF0)
+      return 0;
+  }
+  return 1;
+}
+
+static void Pause(void) { Sleep_Until(Clock_Ns() + 5000000); }
+
+// Opens and closes the overlay; 0 if a step timed out.
+static int Activate(Display *dpy, ACTIVATION *a) {
+  int w = DisplayWidth(dpy, DefaultScreen(dpy));
+  int h = DisplayHeight(dpy, DefaultScreen(dpy));
+  char *log = Log();
+  int before;
+  Last(log, "screenshot: pool ", &before); // the last stats line
+  free(log);
+
+  SendKey(dpy, DefaultRootWindow(dpy), XK_Print);
+  long long end = Clock_Ns() + WAIT_NS;
+  while (!(a->win = Overlay(dpy)) && Clock_Ns() < end)
+    Pause();
+  while (a->win && !Dimmed(dpy, w, h) && Clock_Ns() < end)
+    Pause();
+  if (!a->win || Clock_Ns() >= end)
+    return 0;
+  Sleep_Until(Clock_Ns() + 100000000); // a few more frames
+  SendKey(dpy, a->win, XK_Escape);
+
+  const char *pool = NULL;
+  int n = before;
+  log = NULL;
+  while (n == before && Clock_Ns() < end + WAIT_NS) {
+    Pause();
+    free(log);
+    log = Log();
+    pool = Last(log, "screenshot: pool ", &n);
+  }
+  const char *frame = pool ? Last(log, "hotkey-to-first-frame", &n) : NULL;
+  int ok = frame &&
+           sscanf(frame,
+                  "hotkey-to-first-frame %lf ms, "
+                  "hotkey-to-complete-frame %lf ms",
+                  &a->first, &a->complete) == 2 &&
+           sscanf(pool, "screenshot: pool %7s (%u hits, %u misses), "
+                        "setup %lf ms",
+                  a->pool, &a->hits, &a->misses, &a->setup) == 4;
+  free(log);
+  return ok;
+}
+
+#ifdef HAVE_MONITORS
+// Two monitors side by side: the same screen, another topology.
+static int Split(Display *dpy, int w, int h) {
+  if (!TestX11_HasMonitors(dpy))
+    return 0;
+  XRRScreenResources *res =
+      XRRGetScreenResourcesCurrent(dpy, DefaultRootWindow(dpy));
+  IRECT left = {0, 0, w / 2, h}, right = {w / 2, 0, w, h};
+  int ok = res && res->noutput > 0 &&
+           TestX11_SetMonitor(dpy, "TEST-LEFT", &left, res->outputs[0]) &&
+           TestX11_SetMonitor(dpy, "TEST-RIGHT", &right, None);
+  if (res)
+    XRRFreeScreenResources(res);
+  return ok;
+}
+
+static void Unsplit(Display *dpy) {
+  Window root = DefaultRootWindow(dpy);
+  XRRDeleteMonitor(dpy, root, XInternAtom(dpy, "TEST-LEFT", False));
+  XRRDeleteMonitor(dpy, root, XInternAtom(dpy, "TEST-RIGHT", False));
+  XSync(dpy, False);
+}
+#endif
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: test_overlay_x11 path/to/screenshot\n");
+    return 2;
+  }
+  Display *dpy = TestX11_Open("test_overlay_x11");
+  if (!dpy)
+    return TEST_SKIP;
+  if (!XKeysymToKeycode(dpy, XK_Print) || !XKeysymToKeycode(dpy, XK_Escape)) {
+    printf("test_overlay_x11: no PrintScreen or Escape key, skipped\n");
+    return TEST_SKIP;
+  }
+  X11Error_Ignore(dpy); // windows listed may be gone by the time they are read
+  int w = DisplayWidth(dpy, DefaultScreen(dpy));
+  int h = DisplayHeight(dpy, DefaultScreen(dpy));
+  IRECT screen = {0, 0, w, h};
+  IMAGE white;
+  if (!Image_Alloc(&white, w, h)) {
+    CHECK(!"out of memory");
+    return Test_Finish("test_overlay_x11");
+  }
+  memset(white.px, 0xFF, (size_t)white.stride * h);
+  Window cover = TestX11_Cover(dpy, &screen);
+  TestX11_Paint(dpy, cover, &white, 0, 0);
+  Image_Free(&white);
+
+  pid_t pid = Start(argv[1]);
+  long long end = Clock_Ns() + WAIT_NS;
+  while (pid > 0 && !Ready(dpy) && Clock_Ns() < end)
+    Pause();
+  CHECK(pid > 0 && Ready(dpy));
+
+  ACTIVATION a[3];
+  memset(a, 0, sizeof(a));
+  if (pid > 0 && Ready(dpy)) {
+    CHECK(Activate(dpy, &a[0]));
+    CHECK(a[0].first > 0 && a[0].complete > a[0].first);
+    printf("test_overlay_x11: hotkey-to-first-frame %.2f ms, "
+           "hotkey-to-complete-frame %.2f ms\n",
+           a[0].first, a[0].complete);
+
+    // the same layout again: nothing reallocated, the window kept
+    CHECK(Activate(dpy, &a[1]));
+    CHECK(!strcmp(a[0].pool, "miss") && a[0].hits == 0 && a[0].misses == 1);
+    CHECK(!strcmp(a[1].pool, "hit") && a[1].hits == 1 && a[1].misses == 1 &&
+          a[1].win == a[0].win);
+    printf("test_overlay_x11: pool miss setup %.2f ms, hit %.2f ms\n",
+           a[0].setup, a[1].setup);
+#ifdef HAVE_MONITORS
+    if (Split(dpy, w, h)) {
+      CHECK(Activate(dpy, &a[2]));
+      CHECK(!strcmp(a[2].pool, "miss") && a[2].hits == 1 &&
+            a[2].misses == 2);
+      printf("test_overlay_x11: after the layout changed, pool %s setup "
+             "%.2f ms\n",
+             a[2].pool, a[2].setup);
+    } else {
+      printf("test_overlay_x11: no RandR 1.5 monitors, layout change left "
+             "out\n");
+    }
+    Unsplit(dpy);
+#else
+    printf("test_overlay_x11: built without RandR 1.5, layout change left "
+           "out\n");
+#endif
+  }
+  if (pid > 0) {
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+  }
+  if (g_testFailures) {
+    char *log = Log();
+    if (log)
+      fprintf(stderr, "screenshot -v said:\n%s", log);
+    free(log);
+  }
+  remove(LOG);
+  XDestroyWindow(dpy, cover);
+  X11Error_Forget(dpy);
+  XCloseDisplay(dpy);
+  return Test_Finish("test_overlay_x11");
+}
@@ -0,0 +1,230 @@
+// Window pick on Xvfb. Without a window manager the list is the root's
+// children: 500 windows at random places, with borders, some raised after
+// creation, some unmapped, an input-only one and the one to skip. The list
+// must be exactly the viewable output windows, topmost first; and for
+// random points, the index must pick the window the server itself reports
+// under the pointer. Then _NET_CLIENT_LIST_STACKING is set on the root as
+// a window manager would, with reparented clients and frame extents: the
+// list must follow it and apply the extents. Prints list and hit times.
+
+#include <X11/Xatom.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pick.h"
+#include "pick_x11.h"
+#include "platform.h"
+#include "test.h"
+#include "test_x11.h"
+
+#define WINDOWS 500
+#define POINTS 300
+
+static volatile int g_sink; // keeps the timed hits from being optimized out
+
+typedef struct {
+  Window w;
+  IRECT r; // what the list should say, root coordinates
+  int listed;
+} EXPECT;
+
+static Window Create(Display *dpy, Window parent, IRECT r, int border) {
+  XSetWindowAttributes wa = {0};
+  wa.override_redirect = True;
+  return XCreateWindow(dpy, parent, r.left, r.top,
+                       (unsigned)(r.right - r.left),
+                       (unsigned)(r.bottom - r.top), (unsigned)border,
+                       CopyFromParent, InputOutput, CopyFromParent,
+                       CWOverrideRedirect, &wa);
+}
+
+static void SetExtents(Display *dpy, Window w, const char *name, long l,
+                       long r, long t, long b) {
+  long e[4] = {l, r, t, b};
+  XChangeProperty(dpy, w, XInternAtom(dpy, name, False), XA_CARDINAL, 32,
+                  PropModeReplace, (unsigned char *)e, 4);
+}
+
+// The list must be want[] (topmost first) and nothing else.
+static int SameList(const IRECT *got, int n, const EXPECT *want, int m) {
+  if (n != m)
+    return 0;
+  for (int i = 0; i < n; i++)
+    if (memcmp(&got[i], &want[i].r, sizeof(IRECT)))
+      return 0;
+  return 1;
+}
+
+static void CheckFallback(Display *dpy, IRECT screen) {
+  Window root = DefaultRootWindow(dpy);
+  // Bottom to top as created; expected keeps topmost first.
+  EXPECT *ex = (EXPECT *)calloc(WINDOWS, sizeof(EXPECT));
+  Window *stack = (Window *)calloc(WINDOWS, sizeof(Window));
+  IRECT *rects = NULL;
+  if (!ex || !stack) {
+    CHECK(!"out of memory");
+    free(ex);
+    free(stack);
+    return;
+  }
+  uint32_t s = 12;
+  int n = 0;
+  Window skip = None, inputOnly = None;
+  for (int i = 0; i < WINDOWS; i++) {
+    int w = 20 + (int)(Test_Rand(&s) % 600);
+    int h = 20 + (int)(Test_Rand(&s) % 400);
+    int x = (int)(Test_Rand(&s) % (uint32_t)(screen.right + 200)) - 100;
+    int y = (int)(Test_Rand(&s) % (uint32_t)(screen.bottom + 200)) - 100;
+    int border = i % 5 == 0 ? 2 : 0;
+    IRECT r = {x, y, x + w, y + h};
+    Window win;
+    if (i == 7) {
+      XSetWindowAttributes wa = {0};
+      wa.override_redirect = True;
+      win = inputOnly = XCreateWindow(dpy, root, x, y, (unsigned)w,
+                                      (unsigned)h, 0, 0, InputOnly,
+                                      CopyFromParent, CWOverrideRedirect, &wa);
+    } else {
+      win = Create(dpy, root, r, border);
+    }
+    if (i == 11)
+      skip = win;
+    if (i % 9 != 4) // every ninth stays unmapped
+      XMapWindow(dpy, win);
+    stack[n++] = win;
+    if (i % 9 != 4 && win != inputOnly && win != skip)
+      ex[i] = (EXPECT){win, {x, y, x + w + 2 * border, y + h + 2 * border},
+                       1};
+  }
+  // Raise every 25th window: it moves to the top of the stack.
+  for (int i = 0; i < WINDOWS; i += 25) {
+    XRaiseWindow(dpy, stack[i]);
+    Window w = stack[i];
+    int k = 0;
+    while (stack[k] != w)
+      k++;
+    memmove(stack + k, stack + k + 1, sizeof(Window) * (size_t)(n - k - 1));
+    stack[n - 1] = w;
+  }
+  XSync(dpy, False);
+  // Expected order: the stack from the top, listed windows only.
+  EXPECT *want = (EXPECT *)calloc(WINDOWS, sizeof(EXPECT));
+  int m = 0;
+  for (int k = n - 1; want && k >= 0; k--)
+    for (int i = 0; i < WINDOWS; i++)
+      if (ex[i].w == stack[k] && ex[i].listed)
+        want[m++] = ex[i];
+
+  long long t0 = Clock_Ns();
+  int got = PickX11_List(dpy, skip, &rects);
+  long long listNs = Clock_Ns() - t0;
+  CHECK(rects && want && SameList(rects, got, want, m));
+
+  PICK_INDEX pick;
+  memset(&pick, 0, sizeof(pick));
+  CHECK(Pick_Build(&pick, rects, got, &screen));
+  // The server's answer: the root child under the pointer.
+  int bad = 0, compared = 0;
+  for (int i = 0; i < POINTS && want; i++) {
+    int x = (int)(Test_Rand(&s) % (uint32_t)screen.right);
+    int y = (int)(Test_Rand(&s) % (uint32_t)screen.bottom);
+    XWarpPointer(dpy, None, root, 0, 0, 0, 0, x, y);
+    Window r, child;
+    int rx, ry, wx, wy;
+    unsigned mask;
+    XQueryPointer(dpy, root, &r, &child, &rx, &ry, &wx, &wy, &mask);
+    if (child == skip || child == inputOnly)
+      continue; // not something the list has
+    int hit = Pick_Hit(&pick, x, y);
+    Window picked = hit >= 0 ? want[hit].w : None;
+    compared++;
+    if (picked != child && !bad++)
+      fprintf(stderr, "test_pick_x11: at %d,%d picked %lx, server says %lx\n",
+              x, y, picked, child);
+  }
+  CHECK(!bad && compared > POINTS / 2);
+
+  long long h0 = Clock_Ns();
+  int sum = 0;
+  for (int i = 0; i < 1000000; i++)
+    sum += Pick_Hit(&pick, i * 7 % screen.right, i * 13 % screen.bottom);
+  long long hitNs = Clock_Ns() - h0;
+  printf("test_pick_x11: %d windows listed in %.2f ms, indexed in %.3f ms "
+         "(%zu cell entries, longest %d), hit %.1f ns\n",
+         got, listNs / 1e6, pick.stats.buildNs / 1e6, pick.stats.entries,
+         pick.stats.longest, hitNs / 1e6);
+  g_sink = sum;
+  Pick_Free(&pick);
+  free(rects);
+  for (int i = 0; i < n; i++)
+    XDestroyWindow(dpy, stack[i]);
+  XSync(dpy, False);
+  free(want);
+  free(ex);
+  free(stack);
+}
+
+// A window manager's view: clients in _NET_CLIENT_LIST_STACKING, one
+// inside a frame, with extents.
+static void CheckEwmh(Display *dpy) {
+  Window root = DefaultRootWindow(dpy);
+  Window frame = Create(dpy, root, (IRECT){100, 100, 700, 500}, 0);
+  Window c[6];
+  c[0] = Create(dpy, root, (IRECT){10, 10, 210, 110}, 0);
+  c[1] = Create(dpy, frame, (IRECT){5, 25, 595, 395}, 0);
+  c[2] = Create(dpy, root, (IRECT){800, 50, 1200, 450}, 0);
+  c[3] = Create(dpy, root, (IRECT){300, 600, 500, 700}, 0); // unmapped
+  c[4] = Create(dpy, root, (IRECT){0, 0, 50, 50}, 0);       // skipped
+  c[5] = Create(dpy, root, (IRECT){900, 500, 1300, 900}, 0);
+  SetExtents(dpy, c[1], "_NET_FRAME_EXTENTS", 5, 5, 25, 5);
+  SetExtents(dpy, c[2], "_GTK_FRAME_EXTENTS", 20, 20, 10, 30);
+  SetExtents(dpy, c[5], "_GTK_FRAME_EXTENTS", 8, 8, 8, 8); // wins over...
+  SetExtents(dpy, c[5], "_NET_FRAME_EXTENTS", 1, 1, 1, 1); // ...this
+  XMapWindow(dpy, frame);
+  for (int i = 0; i < 6; i++)
+    if (i != 3)
+      XMapWindow(dpy, c[i]);
+  long list[6];
+  for (int i = 0; i < 6; i++)
+    list[i] = (long)c[i]; // bottom to top
+  Atom stacking = XInternAtom(dpy, "_NET_CLIENT_LIST_STACKING", False);
+  XChangeProperty(dpy, root, stacking, XA_WINDOW, 32, PropModeReplace,
+                  (unsigned char *)list, 6);
+  XSync(dpy, False);
+
+  EXPECT want[] = {
+      {c[5], {908, 508, 1292, 892}, 1},
+      {c[2], {820, 60, 1180, 420}, 1},
+      {c[1], {100, 100, 700, 500}, 1},
+      {c[0], {10, 10, 210, 110}, 1},
+  };
+  IRECT *rects = NULL;
+  int n = PickX11_List(dpy, c[4], &rects);
+  CHECK(rects && SameList(rects, n, want, 4));
+  free(rects);
+
+  // Without the property it is the root's children again.
+  XDeleteProperty(dpy, root, stacking);
+  XSync(dpy, False);
+  n = PickX11_List(dpy, None, &rects);
+  CHECK(rects && n == 5); // frame, c[0], c[2], c[4], c[5]
+  free(rects);
+
+  XDestroyWindow(dpy, frame);
+  for (int i = 0; i < 6; i++)
+    if (i != 1)
+      XDestroyWindow(dpy, c[i]);
+  XSync(dpy, False);
+}
+
+int main(void) {
+  Display *dpy = TestX11_Open("test_pick_x11");
+  if (!dpy)
+    return TEST_SKIP;
+  int scr = DefaultScreen(dpy);
+  IRECT screen = {0, 0, DisplayWidth(dpy, scr), DisplayHeight(dpy, scr)};
+  CheckFallback(dpy, screen);
+  CheckEwmh(dpy);
+  XCloseDisplay(dpy);
+  return Test_Finish("test_pick_x11");
+}
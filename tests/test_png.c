@@ -0,0 +1,217 @@
+// PNG round trips: truecolor noise at odd sizes and padded strides, images
+// big enough for several bands and IDAT groups, every palette depth and the
+// 257-color fallback, and an animated PNG's first frame. Every file is
+// decoded back with Png_Decode; with zlib around, its chunk CRCs are
+// checked and its IDAT stream inflated by zlib as well, so the encoder and
+// our decoder cannot agree on a mistake.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "png.h"
+#include "test.h"
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+static unsigned Be32(const unsigned char *p) {
+  return (unsigned)p[0] << 24 | (unsigned)p[1] << 16 | (unsigned)p[2] << 8 |
+         p[3];
+}
+
+#ifdef HAVE_ZLIB
+// Walks the chunks checking each CRC, and inflates the joined IDAT data
+// with zlib; it must come out as h scanlines of rowBytes plus a filter
+// byte, with a valid Adler-32.
+static int ZlibAgrees(const unsigned char *png, size_t n, size_t rowBytes,
+                      int h) {
+  unsigned char *idat = (unsigned char *)malloc(n);
+  size_t ni = 0, pos = 8;
+  int ok = idat != NULL;
+  while (ok && pos + 12 <= n) {
+    size_t len = Be32(png + pos);
+    if (pos + 12 + len > n)
+      return free(idat), 0;
+    uLong crc = crc32(0, png + pos + 4, (uInt)(len + 4));
+    ok = crc == Be32(png + pos + 8 + len);
+    if (!memcmp(png + pos + 4, "IDAT", 4)) {
+      memcpy(idat + ni, png + pos + 8, len);
+      ni += len;
+    }
+    pos += 12 + len;
+  }
+  uLongf want = (uLongf)((rowBytes + 1) * h), got = want + 1;
+  unsigned char *raw = (unsigned char *)malloc(want + 1);
+  ok = ok && raw && uncompress(raw, &got, idat, (uLong)ni) == Z_OK &&
+       got == want;
+  free(raw);
+  free(idat);
+  return ok;
+}
+#endif
+
+// img's color channels against a decoded (opaque) image.
+static int SameRgb(const IMAGE *img, const IMAGE *dec) {
+  if (dec->w != img->w || dec->h != img->h)
+    return 0;
+  for (int y = 0; y < img->h; y++) {
+    const unsigned *a = (const unsigned *)IMAGE_ROW(img, y);
+    const unsigned *b = (const unsigned *)IMAGE_ROW(dec, y);
+    for (int x = 0; x < img->w; x++)
+      if (((a[x] ^ b[x]) & 0xFFFFFF) || (b[x] >> 24) != 0xFF)
+        return 0;
+  }
+  return 1;
+}
+
+// Writes img, decodes it, and checks the palette decision.
+static void RoundTrip(const char *what, const IMAGE *img, int flags,
+                      int colors) {
+  FILE *f = tmpfile();
+  PNG_STATS st;
+  size_t n = 0;
+  unsigned char *data = NULL;
+  int ok = f && Png_Write(f, img, flags, &st) &&
+           (data = Test_Slurp(f, &n)) != NULL;
+  if (f)
+    fclose(f);
+  IMAGE dec = {0};
+  int depth = !colors        ? 24
+              : colors <= 2  ? 1
+              : colors <= 4  ? 2
+              : colors <= 16 ? 4
+                             : 8;
+  size_t rowBytes = colors ? ((size_t)img->w * depth + 7) / 8
+                           : (size_t)img->w * 3;
+  ok = ok && n == st.fileBytes && st.colors == colors && st.depth == depth &&
+       n > 8 && !memcmp(data, "\x89PNG\r\n\x1a\n", 8) &&
+       Be32(data + 16) == (unsigned)img->w &&
+       Be32(data + 20) == (unsigned)img->h;
+  ok = ok && Png_Decode(data, n, &dec) && SameRgb(img, &dec);
+#ifdef HAVE_ZLIB
+  ok = ok && ZlibAgrees(data, n, rowBytes, img->h);
+#else
+  (void)rowBytes;
+#endif
+  if (!ok)
+    fprintf(stderr, "%s: %dx%d (%d colors): round trip failed\n", what,
+            img->w, img->h, colors);
+  CHECK(ok);
+  Image_Free(&dec);
+  free(data);
+}
+
+// Noise over the first `colors` entries of a fixed palette; alpha is left
+// random, as in captures, and must not count as a color.
+static void Paletted(IMAGE *img, int colors, uint32_t seed) {
+  uint32_t s = seed;
+  for (int y = 0; y < img->h; y++) {
+    unsigned *p = (unsigned *)IMAGE_ROW(img, y);
+    for (int x = 0; x < img->w; x++) {
+      unsigned i = Test_Rand(&s) % (unsigned)colors;
+      // make sure every color shows up
+      if (y == 0 && x < colors)
+        i = (unsigned)x;
+      p[x] = (Test_Rand(&s) & 0xFF000000u) | (i * 0x9E3779u & 0xFFFFFF);
+    }
+  }
+}
+
+int main(void) {
+  static const int kSizes[][3] = {{1, 1, 0},    {3, 5, 4},     {17, 1, 0},
+                                  {1, 17, 12},  {333, 257, 12}, {2048, 600, 0},
+                                  {4001, 1500, 8}};
+  for (size_t i = 0; i < sizeof(kSizes) / sizeof(kSizes[0]); i++) {
+    IMAGE img;
+    if (!Test_AllocPadded(&img, kSizes[i][0], kSizes[i][1], kSizes[i][2])) {
+      CHECK(!"out of memory");
+      continue;
+    }
+    Test_Noise(&img, (uint32_t)i + 1);
+    int tiny = img.w * img.h <= 256;
+    // tiny noise images have few enough colors to go indexed
+    RoundTrip("noise", &img, tiny ? PNG_TRUECOLOR : 0, 0);
+    Image_Free(&img);
+  }
+
+  static const int kColors[] = {1, 2, 3, 4, 5, 16, 17, 255, 256};
+  for (size_t i = 0; i < sizeof(kColors) / sizeof(kColors[0]); i++) {
+    IMAGE img;
+    int w = 257 + (int)i * 3;
+    if (!Test_AllocPadded(&img, w, 190, (int)(i % 3) * 4)) {
+      CHECK(!"out of memory");
+      continue;
+    }
+    Paletted(&img, kColors[i], (uint32_t)i + 100);
+    RoundTrip("indexed", &img, 0, kColors[i]);
+    RoundTrip("forced truecolor", &img, PNG_TRUECOLOR, 0);
+    Image_Free(&img);
+  }
+
+  // One color too many: RGB.
+  IMAGE img;
+  if (Image_Alloc(&img, 300, 300)) {
+    Paletted(&img, 257, 7);
+    RoundTrip("257 colors", &img, 0, 0);
+    Image_Free(&img);
+  }
+
+  // Indexed UI over several bands: a big flat image with a few colors.
+  if (Image_Alloc(&img, 3840, 2160)) {
+    Paletted(&img, 12, 8);
+    for (int y = 0; y < img.h; y++) {
+      unsigned *p = (unsigned *)IMAGE_ROW(&img, y);
+      for (int x = 1; x < img.w; x++)
+        if (x % 64 > 3)
+          p[x] = p[x - 1];
+    }
+    RoundTrip("indexed 4K", &img, 0, 12);
+    Image_Free(&img);
+  }
+
+  // Animated PNG: the default image is the first frame.
+  IMAGE frame[3];
+  FILE *f = tmpfile();
+  PNG_ANIM *a = f ? Png_AnimBegin(f, 160, 90) : NULL;
+  CHECK(a != NULL);
+  for (int i = 0; i < 3; i++) {
+    CHECK(Image_Alloc(&frame[i], 160, 90));
+    Test_Noise(&frame[i], 50 + i);
+    if (a)
+      CHECK(Png_AnimFrame(a, &frame[i], i * 33000000LL, NULL));
+  }
+  if (a) {
+    CHECK(Png_AnimEnd(a, 100000000LL));
+    size_t n;
+    unsigned char *data = Test_Slurp(f, &n);
+    IMAGE dec = {0};
+    CHECK(data && Png_Decode(data, n, &dec) && SameRgb(&frame[0], &dec));
+    Image_Free(&dec);
+    free(data);
+  }
+  if (f)
+    fclose(f);
+  for (int i = 0; i < 3; i++)
+    Image_Free(&frame[i]);
+
+  // Garbage and truncated files are refused.
+  unsigned char junk[64];
+  memset(junk, 0x5A, sizeof(junk));
+  IMAGE dec = {0};
+  CHECK(!Png_Decode(junk, sizeof(junk), &dec));
+  if (Image_Alloc(&img, 64, 64)) {
+    Test_Noise(&img, 3);
+    f = tmpfile();
+    size_t n = 0;
+    unsigned char *data = NULL;
+    if (f && Png_Write(f, &img, 0, NULL))
+      data = Test_Slurp(f, &n);
+    CHECK(data && !Png_Decode(data, n / 2, &dec));
+    free(data);
+    if (f)
+      fclose(f);
+    Image_Free(&img);
+  }
+  return Test_Finish("test_png");
+}
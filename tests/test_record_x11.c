@@ -0,0 +1,246 @@
+// Region recording on Xvfb at 1080p60. The main thread animates a test
+// pattern at 60 fps while the recorder grabs the whole screen: a box that
+// moves every frame and carries its frame number as a 4x4 grid of black
+// and white cells, drawn into a pixmap and copied to the screen in one
+// request so a grab never sees half of a frame. Every Y4M frame must hold
+// a whole box whose number never goes backwards, one frame per tick of the
+// clock; the tick counts must add up; the APNG's first frame must hold a
+// box too. Prints dropped and late ticks and the per-stage timings.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "capture_x11.h"
+#include "platform.h"
+#include "png.h"
+#include "record.h"
+#include "test.h"
+#include "test_x11.h"
+
+#define FPS 60
+#define TICKS 90
+#define BOX 128
+#define CELL 24
+#define AHEAD 600 // pattern frames a grab may be ahead of the last one
+
+#define BG 0x203040u
+#define BORDER 0x808080u
+
+typedef struct {
+  Display *dpy;
+  X11_IMAGE img;
+} GRAB;
+
+// Runs on the recorder's capture thread, on its own connection.
+static int Grab(void *ctx, IMAGE *dst) {
+  GRAB *g = (GRAB *)ctx;
+  if (!X11Image_Get(g->dpy, DefaultRootWindow(g->dpy), 0, 0, &g->img))
+    return 0;
+  for (int y = 0; y < dst->h; y++)
+    memcpy(IMAGE_ROW(dst, y), IMAGE_ROW(&g->img.image, y),
+           (size_t)dst->w * 4);
+  return 1;
+}
+
+// Where the box of pattern frame n is on a w x h screen.
+static IRECT BoxAt(unsigned n, int w, int h) {
+  int x = (int)(n * 23 % (unsigned)(w - BOX));
+  int y = (int)(n * 13 % (unsigned)(h - BOX));
+  return (IRECT){x, y, x + BOX, y + BOX};
+}
+
+static void DrawBox(Display *dpy, Pixmap pm, GC gc, unsigned n, IRECT r) {
+  XSetForeground(dpy, gc, BORDER);
+  XFillRectangle(dpy, pm, gc, r.left, r.top, BOX, BOX);
+  for (int i = 0; i < 16; i++) {
+    XSetForeground(dpy, gc, n >> i & 1 ? 0xFFFFFFu : 0);
+    XFillRectangle(dpy, pm, gc, r.left + 16 + i % 4 * CELL,
+                   r.top + 16 + i / 4 * CELL, CELL, CELL);
+  }
+}
+
+// The pattern frame in a BT.601 limited-range luma plane, searched from
+// `from` on, or -1 if there is no whole box.
+static long FindBox(const unsigned char *luma, int w, int h, long from) {
+  for (long n = from; n < from + AHEAD; n++) {
+    IRECT r = BoxAt((unsigned)n, w, h);
+    const unsigned char *tl = luma + (size_t)(r.top + 4) * w + r.left + 4;
+    const unsigned char *br =
+        luma + (size_t)(r.bottom - 5) * w + r.right - 5;
+    // the border is mid gray, well clear of the background and the cells
+    if (*tl < 90 || *tl > 160 || *br < 90 || *br > 160)
+      continue;
+    unsigned bits = 0;
+    for (int i = 0; i < 16; i++) {
+      int x = r.left + 16 + i % 4 * CELL + CELL / 2;
+      int y = r.top + 16 + i / 4 * CELL + CELL / 2;
+      bits |= (unsigned)(luma[(size_t)y * w + x] > 125) << i;
+    }
+    if (bits == ((unsigned long)n & 0xFFFF))
+      return n;
+  }
+  return -1;
+}
+
+// Records TICKS frames while animating; returns what Record_Stop did.
+static int Record(Display *dpy, Window win, Pixmap pm, GC gc,
+                  RECORD_FORMAT fmt, FILE *f, RECORD_STATS *st,
+                  unsigned *shown) {
+  int w = DisplayWidth(dpy, DefaultScreen(dpy));
+  int h = DisplayHeight(dpy, DefaultScreen(dpy));
+  GRAB g;
+  memset(&g, 0, sizeof(g));
+  if (!(g.dpy = XOpenDisplay(NULL)) || !X11Image_Create(g.dpy, w, h, &g.img)) {
+    if (g.dpy)
+      XCloseDisplay(g.dpy);
+    return 0;
+  }
+  RECORD_CONFIG cfg = {fmt, w, h, FPS, TICKS, Grab, &g};
+  RECORDER *rec = Record_Start(f, &cfg);
+  if (!rec) {
+    X11Image_Destroy(g.dpy, &g.img);
+    XCloseDisplay(g.dpy);
+    return 0;
+  }
+  // Pattern frame n goes up n periods after the start, erasing n - 1.
+  unsigned n = 0;
+  long long period = 1000000000LL / FPS, next = Clock_Ns();
+  while (Record_Running(rec)) {
+    next += period;
+    Sleep_Until(next);
+    IRECT old = BoxAt(n, w, h), box = BoxAt(++n, w, h), both;
+    IRect_Union(&old, &box, &both);
+    XSetForeground(dpy, gc, BG);
+    XFillRectangle(dpy, pm, gc, old.left, old.top, BOX, BOX);
+    DrawBox(dpy, pm, gc, n, box);
+    XCopyArea(dpy, pm, win, gc, both.left, both.top,
+              (unsigned)(both.right - both.left),
+              (unsigned)(both.bottom - both.top), both.left, both.top);
+    XFlush(dpy);
+  }
+  int ok = Record_Stop(rec, st);
+  X11Image_Destroy(g.dpy, &g.img);
+  XCloseDisplay(g.dpy);
+  *shown = n;
+  return ok;
+}
+
+// Reads the Y4M stream frame by frame: every one must hold a box, never
+// one older than the frame before.
+static void CheckY4m(FILE *f, const RECORD_STATS *st) {
+  rewind(f);
+  int w = 0, h = 0, fps = 0;
+  CHECK(fscanf(f, "YUV4MPEG2 W%d H%d F%d:1", &w, &h, &fps) == 3);
+  CHECK(w > BOX && h > BOX && fps == FPS);
+  int c;
+  while ((c = fgetc(f)) != EOF && c != '\n') {
+  }
+  size_t size = (size_t)w * h * 3 / 2;
+  unsigned char *yuv = (unsigned char *)malloc(size);
+  if (!yuv) {
+    CHECK(!"out of memory");
+    return;
+  }
+  unsigned long long frames = 0, distinct = 0;
+  long last = 0;
+  int bad = 0;
+  char tag[6];
+  while (fread(tag, 1, 6, f) == 6) {
+    if (memcmp(tag, "FRAME\n", 6) || fread(yuv, 1, size, f) != size) {
+      CHECK(!"truncated frame");
+      break;
+    }
+    long n = FindBox(yuv, w, h, last);
+    if (n < 0 && !bad++)
+      fprintf(stderr, "test_record_x11: no whole box in frame %llu\n",
+              frames);
+    if (n >= 0) {
+      distinct += !frames || n != last;
+      last = n;
+    }
+    frames++;
+  }
+  free(yuv);
+  CHECK(!bad);
+  // one frame per tick, repeats standing in for the ticks not captured
+  CHECK(frames == st->ticks);
+  CHECK(distinct > 1);
+  printf("test_record_x11: y4m %llu frames, %llu distinct pattern frames, "
+         "last %ld\n",
+         frames, distinct, last);
+}
+
+static void CheckApng(FILE *f) {
+  size_t n;
+  unsigned char *data = Test_Slurp(f, &n);
+  IMAGE dec = {0};
+  CHECK(data && Png_Decode(data, n, &dec));
+  unsigned char *luma =
+      dec.px ? (unsigned char *)malloc((size_t)dec.w * dec.h) : NULL;
+  if (luma) {
+    for (int y = 0; y < dec.h; y++) {
+      const unsigned char *p = IMAGE_ROW(&dec, y);
+      for (int x = 0; x < dec.w; x++, p += 4)
+        luma[(size_t)y * dec.w + x] = (unsigned char)(
+            ((66 * p[2] + 129 * p[1] + 25 * p[0] + 128) >> 8) + 16);
+    }
+    CHECK(FindBox(luma, dec.w, dec.h, 0) >= 0);
+  }
+  free(luma);
+  Image_Free(&dec);
+  free(data);
+}
+
+static void Report(const char *what, const RECORD_STATS *st,
+                   unsigned shown) {
+  char desc[512];
+  Record_Describe(st, desc, sizeof(desc));
+  printf("test_record_x11: %s, %u pattern frames shown\n%s", what, shown,
+         desc);
+}
+
+int main(void) {
+  Display *dpy = TestX11_Open("test_record_x11");
+  if (!dpy)
+    return TEST_SKIP;
+  int scr = DefaultScreen(dpy);
+  IRECT all = {0, 0, DisplayWidth(dpy, scr), DisplayHeight(dpy, scr)};
+  Window win = TestX11_Cover(dpy, &all);
+  Pixmap pm = XCreatePixmap(dpy, win, (unsigned)all.right,
+                            (unsigned)all.bottom,
+                            (unsigned)DefaultDepth(dpy, scr));
+  GC gc = XCreateGC(dpy, pm, 0, NULL);
+
+  static const RECORD_FORMAT kFormat[] = {RECORD_Y4M, RECORD_APNG};
+  for (int i = 0; i < 2; i++) {
+    XSetForeground(dpy, gc, BG);
+    XFillRectangle(dpy, pm, gc, 0, 0, (unsigned)all.right,
+                   (unsigned)all.bottom);
+    DrawBox(dpy, pm, gc, 0, BoxAt(0, all.right, all.bottom));
+    XCopyArea(dpy, pm, win, gc, 0, 0, (unsigned)all.right,
+              (unsigned)all.bottom, 0, 0);
+    XSync(dpy, False);
+    FILE *f = tmpfile();
+    RECORD_STATS st;
+    unsigned shown = 0;
+    memset(&st, 0, sizeof(st));
+    CHECK(f && Record(dpy, win, pm, gc, kFormat[i], f, &st, &shown));
+    CHECK(st.ticks == TICKS && !st.failed);
+    CHECK(st.captured + st.dropped + st.late + st.failed == st.ticks);
+    CHECK(st.captured > 0 && st.encoded == st.captured);
+    CHECK(f && st.fileBytes == (unsigned long long)File_Tell(f));
+    Report(Record_Extension(kFormat[i]), &st, shown);
+    if (f && kFormat[i] == RECORD_Y4M)
+      CheckY4m(f, &st);
+    else if (f)
+      CheckApng(f);
+    if (f)
+      fclose(f);
+  }
+
+  XFreeGC(dpy, gc);
+  XFreePixmap(dpy, pm);
+  XDestroyWindow(dpy, win);
+  XCloseDisplay(dpy);
+  return Test_Finish("test_record_x11");
+}
@@ -0,0 +1,215 @@
+// Redaction on a frame strewn with marker pixels, one every 5 pixels both
+// ways: red 255 and green 0 (blue tells them apart), over a page whose
+// channels stay within 64..191, so no mean of a marker and page pixels can
+// carry the signature. Regions of every mode are dragged a step at a time,
+// corners crossing over, from starts where a pixelate cell would be cut to
+// a single pixel. After each step the region's pixels must equal a full
+// re-filter of its rect and hold no marker. Then the export crop (as both
+// front-ends make it) must hold no marker under a region, and every other
+// pixel as captured. Prints update times against re-filtering.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "platform.h"
+#include "redact.h"
+#include "test.h"
+
+#define SPACING 5
+#define STEPS 40
+#define DRAGS 3
+
+static unsigned char g_tmp[1200 * 500 * 4];
+
+// Two monitors of different heights, so a region can reach into the gap.
+static int Frame_Init(FRAMEBUFFER *fb) {
+  memset(fb, 0, sizeof(*fb));
+  IRECT mon[2] = {{0, 0, 700, 500}, {700, 60, 1200, 460}};
+  Framebuffer_Layout(fb, mon, 2);
+  for (int i = 0; i < fb->ntiles; i++) {
+    FB_TILE *t = &fb->tiles[i];
+    IMAGE *img = &t->capture;
+    if (!Image_Alloc(img, t->area.right - t->area.left,
+                     t->area.bottom - t->area.top))
+      return 0;
+    Test_Noise(img, 21 + i);
+    for (int y = 0; y < img->h; y++) {
+      unsigned char *p = IMAGE_ROW(img, y);
+      for (int x = 0; x < img->w; x++, p += 4) {
+        int fx = t->area.left + x, fy = t->area.top + y;
+        for (int c = 0; c < 3; c++)
+          p[c] = (unsigned char)(0x40 + (p[c] & 0x7F));
+        p[3] = 0xFF;
+        if (fx % SPACING == 0 && fy % SPACING == 0) {
+          p[0] = (unsigned char)(fx / SPACING * 7 + fy / SPACING);
+          p[1] = 0x00;
+          p[2] = 0xFF;
+        }
+      }
+    }
+  }
+  return Framebuffer_Dim(fb, 96);
+}
+
+static void Frame_Free(FRAMEBUFFER *fb) {
+  Framebuffer_Free(fb);
+  for (int i = 0; i < fb->ntiles; i++)
+    Image_Free(&fb->tiles[i].capture);
+}
+
+static int IsMarker(const unsigned char *p) {
+  return p[2] == 0xFF && p[1] == 0x00;
+}
+
+// r filtered in one go, from scratch, into out (allocated here).
+static int Refilter(const FRAMEBUFFER *fb, const IRECT *r, int mode,
+                    IMAGE *out) {
+  if (!Image_Alloc(out, r->right - r->left, r->bottom - r->top))
+    return 0;
+  Framebuffer_Read(fb, 0, r, out, -r->left, -r->top);
+  if (mode == REDACT_PIXELATE)
+    Redact_Pixelate(out, REDACT_BLOCK, r->left, r->top);
+  else if (mode == REDACT_BLUR)
+    Redact_Blur(out, g_tmp, REDACT_RADIUS, 1);
+  else
+    Redact_Blur(out, g_tmp, REDACT_GAUSS_RADIUS, 3);
+  return 1;
+}
+
+// Drags a region of `mode` from (sx, sy): the free corner wanders, crossing
+// to the other side of the start now and then, and for the last steps the
+// whole rect moves. Every step is checked against Refilter.
+static void Drag(REDACT_LAYER *l, const FRAMEBUFFER *fb, int mode, int sx,
+                 int sy, uint32_t *rng, long long ns[2]) {
+  int i = Redact_Add(l, mode);
+  CHECK(i >= 0);
+  if (i < 0)
+    return;
+  int ex = sx + 40, ey = sy + 30, wrong = 0, leaked = 0;
+  for (int step = 0; step < STEPS; step++) {
+    if (step < STEPS - 8) {
+      ex += (int)(Test_Rand(rng) % 61) - 20;
+      ey += (int)(Test_Rand(rng) % 41) - 15;
+      if (step % 13 == 12) { // across the start
+        ex = 2 * sx - ex;
+        ey = 2 * sy - ey;
+      }
+    } else {
+      int dx = (int)(Test_Rand(rng) % 9) - 4, dy = (int)(Test_Rand(rng) % 7);
+      sx += dx;
+      ex += dx;
+      sy += dy;
+      ey += dy;
+    }
+    IRECT r = {sx, sy, ex, ey};
+    IRect_Normalize(&r);
+    long long t0 = Clock_Ns();
+    CHECK(Redact_Update(l, i, fb, &r));
+    long long t1 = Clock_Ns();
+    const REDACT_REGION *g = &l->region[i];
+    IMAGE want;
+    int ok = !IRect_IsEmpty(&g->rect) &&
+             Refilter(fb, &g->rect, mode, &want);
+    ns[0] += t1 - t0;
+    ns[1] += Clock_Ns() - t1;
+    if (!ok)
+      continue;
+    int row = Test_FirstDiffRow(&g->pixels, &want);
+    if (row >= 0 && !wrong++)
+      fprintf(stderr, "test_redact: %s step %d, rect %d,%d-%d,%d: row %d "
+                      "differs from a full re-filter\n",
+              Redact_ModeName(mode), step, g->rect.left, g->rect.top,
+              g->rect.right, g->rect.bottom, row);
+    for (int y = 0; y < g->pixels.h; y++)
+      for (int x = 0; x < g->pixels.w; x++)
+        if (IsMarker(IMAGE_ROW(&g->pixels, y) + x * 4) && !leaked++)
+          fprintf(stderr, "test_redact: %s step %d: marker at %d,%d "
+                          "survives\n",
+                  Redact_ModeName(mode), step, g->rect.left + x,
+                  g->rect.top + y);
+    Image_Free(&want);
+  }
+  CHECK(!wrong && !leaked);
+}
+
+// The selection sel cropped and redacted as the front-ends export it.
+static void CheckExport(const REDACT_LAYER *l, const FRAMEBUFFER *fb,
+                        IRECT sel) {
+  IMAGE crop, raw;
+  if (!Framebuffer_Crop(fb, &sel, &crop)) {
+    CHECK(!"out of memory");
+    return;
+  }
+  if (!Framebuffer_Crop(fb, &sel, &raw)) {
+    CHECK(!"out of memory");
+    Image_Free(&crop);
+    return;
+  }
+  IRECT c = {0, 0, fb->w, fb->h};
+  IRect_Intersect(&sel, &c, &c);
+  Redact_Apply(l, &crop, c.left, c.top, &c);
+  int leaked = 0, changed = 0, markers = 0, covered = 0;
+  for (int y = 0; y < crop.h; y++) {
+    const unsigned char *p = IMAGE_ROW(&crop, y);
+    const unsigned char *q = IMAGE_ROW(&raw, y);
+    for (int x = 0; x < crop.w; x++, p += 4, q += 4) {
+      int fx = c.left + x, fy = c.top + y, under = 0;
+      for (int i = 0; i < l->n && !under; i++) {
+        const IRECT *r = &l->region[i].rect;
+        under = fx >= r->left && fx < r->right && fy >= r->top &&
+                fy < r->bottom;
+      }
+      covered += under;
+      if (under && IsMarker(p) && !leaked++)
+        fprintf(stderr, "test_redact: marker %d at %d,%d survives\n", p[0],
+                fx, fy);
+      if (!under) {
+        changed += memcmp(p, q, 4) != 0;
+        markers += IsMarker(p);
+      }
+    }
+  }
+  CHECK(!leaked && !changed);
+  CHECK(covered > 0 && markers > 0);
+  Image_Free(&raw);
+  Image_Free(&crop);
+}
+
+int main(void) {
+  FRAMEBUFFER fb;
+  if (!Frame_Init(&fb)) {
+    CHECK(!"out of memory");
+    Frame_Free(&fb);
+    return Test_Finish("test_redact");
+  }
+  // 35 is 11 mod 12 and 0 mod 5: the corner pixel of a region starting
+  // there is a marker alone in its pixelate cell unless the cell joins its
+  // neighbours. Starts near the right and bottom make drags that end there.
+  static const int kStart[DRAGS][2] = {{35, 35}, {635, 455}, {1175, 215}};
+  REDACT_LAYER layer;
+  memset(&layer, 0, sizeof(layer));
+  uint32_t rng = 5;
+  for (int mode = 0; mode < REDACT_MODES; mode++) {
+    REDACT_LAYER one;
+    memset(&one, 0, sizeof(one));
+    long long ns[2] = {0, 0}; // updating, re-filtering
+    for (int d = 0; d < DRAGS; d++) {
+      Drag(&one, &fb, mode, kStart[d][0], kStart[d][1], &rng, ns);
+      // and one in the shared layer, over the other modes' regions
+      Drag(&layer, &fb, mode, kStart[d][0] + 60 * mode,
+           kStart[d][1] + 20 * mode, &rng, ns);
+    }
+    CheckExport(&one, &fb, (IRECT){0, 0, fb.w, fb.h});
+    printf("test_redact: %-8s %d drag steps, update %.3f ms, full "
+           "re-filter %.3f ms per step\n",
+           Redact_ModeName(mode), 2 * DRAGS * STEPS,
+           ns[0] / 1e6 / (2 * DRAGS * STEPS),
+           ns[1] / 1e6 / (2 * DRAGS * STEPS));
+    Redact_Clear(&one);
+  }
+  CheckExport(&layer, &fb, (IRECT){0, 0, fb.w, fb.h});
+  CheckExport(&layer, &fb, (IRECT){37, 23, fb.w - 50, fb.h - 41});
+  Redact_Clear(&layer);
+  Frame_Free(&fb);
+  return Test_Finish("test_redact");
+}
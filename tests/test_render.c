@@ -0,0 +1,211 @@
+// Render_Frame: drawing a scene through many small dirty rects must give
+// the same pixels as one full repaint, for every part of the overlay
+// (selection, handles, label, redaction, annotations, diff frames, loupe,
+// overview) and with the framebuffer plain or packed.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "render.h"
+#include "test.h"
+
+typedef struct {
+  FRAMEBUFFER fb;
+  REDACT_LAYER redact;
+  ANNOT_LAYER annot;
+  DIFF diff;
+  MIP_PYRAMID mip;
+} FIXTURE;
+
+// Two monitors of different heights side by side, so the frame has a gap.
+static int Fixture_Init(FIXTURE *f, int packed) {
+  memset(f, 0, sizeof(*f));
+  IRECT mon[2] = {{0, 0, 640, 400}, {640, 100, 1000, 500}};
+  Framebuffer_Layout(&f->fb, mon, 2);
+  for (int i = 0; i < f->fb.ntiles; i++) {
+    FB_TILE *t = &f->fb.tiles[i];
+    if (!Image_Alloc(&t->capture, t->area.right - t->area.left,
+                     t->area.bottom - t->area.top))
+      return 0;
+    Test_Noise(&t->capture, 11 + i);
+  }
+  if (!Mip_Build(&f->mip, &f->fb))
+    return 0;
+  // The diff compares the frame with a copy that has a few blocks changed.
+  IRECT all = {0, 0, f->fb.w, f->fb.h};
+  IMAGE before, after;
+  if (!Framebuffer_Crop(&f->fb, &all, &before) ||
+      !Framebuffer_Crop(&f->fb, &all, &after))
+    return 0;
+  for (int y = 150; y < 190; y++)
+    memset(IMAGE_ROW(&after, y) + 300 * 4, 0x40, 90 * 4);
+  for (int y = 440; y < 450; y++)
+    memset(IMAGE_ROW(&after, y) + 700 * 4, 0xC0, 200 * 4);
+  int ok = Diff_Compare(&f->diff, &before, &after, 0);
+  Image_Free(&before);
+  Image_Free(&after);
+  if (!ok)
+    return 0;
+  if (!(packed ? Framebuffer_Pack(&f->fb, 96, 1u << 20)
+               : Framebuffer_Dim(&f->fb, 96)))
+    return 0;
+
+  static const IRECT kRedact[] = {{150, 100, 260, 170}, {500, 300, 690, 380},
+                                  {400, 90, 450, 400}};
+  for (int i = 0; i < 3; i++) {
+    int r = Redact_Add(&f->redact, i % REDACT_MODES);
+    if (r < 0 || !Redact_Update(&f->redact, r, &f->fb, &kRedact[i]))
+      return 0;
+  }
+  static const int kAnnot[4][5] = {{ANNOT_ARROW, 140, 390, 620, 110},
+                                   {ANNOT_BOX, 480, 280, 710, 400},
+                                   {ANNOT_MARK, 200, 250, 560, 270},
+                                   {ANNOT_TEXT, 300, 320, 0, 0}};
+  ANNOTATION a[4];
+  memset(a, 0, sizeof(a));
+  for (int i = 0; i < 4; i++) {
+    a[i].kind = kAnnot[i][0];
+    a[i].x0 = kAnnot[i][1];
+    a[i].y0 = kAnnot[i][2];
+    a[i].x1 = kAnnot[i][3];
+    a[i].y1 = kAnnot[i][4];
+    a[i].color = a[i].kind == ANNOT_MARK ? ANNOT_HIGHLIGHT : ANNOT_COLOR;
+  }
+  strcpy(a[3].text, "0123 render");
+  a[3].len = (int)strlen(a[3].text);
+  for (int i = 0; i < 4; i++)
+    if (Annot_Add(&f->annot, &f->fb, &a[i]) < 0)
+      return 0;
+  return 1;
+}
+
+static void Fixture_Free(FIXTURE *f) {
+  Annot_Clear(&f->annot);
+  Redact_Clear(&f->redact);
+  Diff_Free(&f->diff);
+  Mip_Free(&f->mip);
+  Framebuffer_Free(&f->fb);
+  for (int i = 0; i < f->fb.ntiles; i++)
+    Image_Free(&f->fb.tiles[i].capture);
+}
+
+// Cuts [0, n) at random steps of 1 to `step` pixels; returns the cut count.
+static int Cuts(int n, int step, uint32_t *rng, int *out) {
+  int k = 0;
+  out[k++] = 0;
+  while (out[k - 1] < n) {
+    int next = out[k - 1] + 1 + (int)(Test_Rand(rng) % (uint32_t)step);
+    out[k++] = next < n ? next : n;
+  }
+  return k;
+}
+
+// Renders sc once in full and once as a random grid of small rects (then
+// some random overlapping ones) over a dst full of noise; both must match.
+static void CheckScene(const char *name, const RENDER_SCENE *sc,
+                       uint32_t seed) {
+  IMAGE full, part;
+  if (!Test_AllocPadded(&full, sc->fb->w, sc->fb->h, 16) ||
+      !Test_AllocPadded(&part, sc->fb->w, sc->fb->h, 16)) {
+    CHECK(!"out of memory");
+    return;
+  }
+  Test_Noise(&full, seed);
+  Test_Noise(&part, seed + 1);
+  IRECT all = {0, 0, full.w, full.h};
+  CHECK(Render_Frame(sc, &full, &all, 1) == (size_t)full.w * full.h);
+
+  uint32_t rng = seed;
+  int *xs = (int *)malloc(sizeof(int) * (full.w + 2));
+  int *ys = (int *)malloc(sizeof(int) * (full.h + 2));
+  int nx = Cuts(full.w, 90, &rng, xs), ny = Cuts(full.h, 90, &rng, ys);
+  size_t touched = 0;
+  for (int j = 0; j + 1 < ny; j++)
+    for (int i = 0; i + 1 < nx; i++) {
+      IRECT d = {xs[i], ys[j], xs[i + 1], ys[j + 1]};
+      touched += Render_Frame(sc, &part, &d, 1);
+    }
+  CHECK(touched == (size_t)full.w * full.h);
+  IRECT extra[64];
+  for (int i = 0; i < 64; i++) {
+    int x = (int)(Test_Rand(&rng) % (uint32_t)full.w);
+    int y = (int)(Test_Rand(&rng) % (uint32_t)full.h);
+    extra[i] = (IRECT){x - 40, y - 40, x + (int)(Test_Rand(&rng) % 200),
+                       y + (int)(Test_Rand(&rng) % 200)};
+  }
+  Render_Frame(sc, &part, extra, 64);
+  free(xs);
+  free(ys);
+
+  int row = Test_FirstDiffRow(&full, &part);
+  if (row >= 0)
+    fprintf(stderr, "%s: partial repaint differs from full at row %d\n",
+            name, row);
+  CHECK(row < 0);
+  Image_Free(&full);
+  Image_Free(&part);
+}
+
+static void CheckFixture(int packed) {
+  FIXTURE f;
+  if (!Fixture_Init(&f, packed)) {
+    CHECK(!"fixture");
+    Fixture_Free(&f);
+    return;
+  }
+  const char *mode = packed ? "packed" : "plain";
+  char name[64];
+  RENDER_SCENE sc;
+  memset(&sc, 0, sizeof(sc));
+  sc.fb = &f.fb;
+  sc.client = (IRECT){0, 0, f.fb.w, f.fb.h};
+  sc.zoom = 6;
+  sc.cursorX = sc.srcX = 330;
+  sc.cursorY = sc.srcY = 210;
+
+  snprintf(name, sizeof(name), "%s: dimmed frame", mode);
+  CheckScene(name, &sc, 1);
+
+  // Dragged up and to the left, so the selection is inverted.
+  sc.haveSel = 1;
+  sc.sel = (IRECT){720, 430, 120, 80};
+  sc.redact = &f.redact;
+  sc.annot = &f.annot;
+  sc.diff = &f.diff;
+  snprintf(name, sizeof(name), "%s: selection", mode);
+  CheckScene(name, &sc, 2);
+
+  sc.hover = 1;
+  sc.loupe = 1;
+  snprintf(name, sizeof(name), "%s: hover and loupe", mode);
+  CheckScene(name, &sc, 3);
+
+  // Against the top-left corner the label goes inside the selection.
+  sc.hover = 0;
+  sc.sel = (IRECT){0, 0, 300, 200};
+  sc.cursorX = sc.srcX = 990;
+  sc.cursorY = sc.srcY = 490;
+  snprintf(name, sizeof(name), "%s: label inside, loupe at corner", mode);
+  CheckScene(name, &sc, 4);
+
+  sc.sel = (IRECT){120, 80, 720, 430};
+  sc.overview = 1;
+  sc.overviewBox = Render_OverviewBox(&f.fb, &sc.client);
+  sc.mip = &f.mip;
+  snprintf(name, sizeof(name), "%s: overview and loupe", mode);
+  CheckScene(name, &sc, 5);
+
+  // No pyramid yet: rects inside the overview box still need the frame.
+  sc.mip = NULL;
+  sc.loupe = 0;
+  snprintf(name, sizeof(name), "%s: overview without pyramid", mode);
+  CheckScene(name, &sc, 6);
+
+  Fixture_Free(&f);
+}
+
+int main(void) {
+  CheckFixture(0);
+  CheckFixture(1);
+  return Test_Finish("test_render");
+}
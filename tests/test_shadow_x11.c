@@ -0,0 +1,177 @@
+// Resident shadow (--shadow) on Xvfb, fed by a synthetic animating client:
+// a thread on its own connection moves a box and ticks a counter strip at
+// 60 fps while the main thread pumps the shadow like the event loop does.
+// Once the client stops, a snapshot must equal a fresh grab; a snapshot
+// held while the client draws again must not change (copy-on-write), and
+// an idle screen must cost no refreshes. Prints damage bandwidth, idle CPU
+// and hotkey-to-frame latency.
+
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "capture_x11.h"
+#include "platform.h"
+#include "shadow_x11.h"
+#include "test.h"
+#include "test_x11.h"
+
+#define ANIM_FRAMES 60
+#define BOX 96
+
+typedef struct {
+  IRECT area;
+  int first, frames;
+} ANIMATION;
+
+// The client: its own connection, one window over the screen, a box
+// sliding across it and a strip of changing bars near the bottom. The
+// window goes away with the connection.
+static void Animate(void *arg) {
+  ANIMATION *a = (ANIMATION *)arg;
+  Display *dpy = XOpenDisplay(NULL);
+  if (!dpy)
+    return;
+  Window win = TestX11_Cover(dpy, &a->area);
+  GC gc = XCreateGC(dpy, win, 0, NULL);
+  int w = a->area.right - a->area.left, h = a->area.bottom - a->area.top;
+  XSetForeground(dpy, gc, 0x203040);
+  XFillRectangle(dpy, win, gc, 0, 0, (unsigned)w, (unsigned)h);
+  long long next = Clock_Ns();
+  int bx = 0, by = 0;
+  for (int f = a->first; f < a->first + a->frames; f++) {
+    XSetForeground(dpy, gc, 0x203040);
+    XFillRectangle(dpy, win, gc, bx, by, BOX, BOX);
+    bx = (f * 17) % (w - BOX);
+    by = (f * 11) % (h - BOX);
+    XSetForeground(dpy, gc, 0xE0A020u + (unsigned)f * 0x010203u);
+    XFillRectangle(dpy, win, gc, bx, by, BOX, BOX);
+    for (int i = 0; i < 16; i++) {
+      XSetForeground(dpy, gc, (unsigned)((f + i) * 0x0F0F0F) & 0xFFFFFFu);
+      XFillRectangle(dpy, win, gc, i * 24, h - 40, 20, 30);
+    }
+    XSync(dpy, False);
+    next += 1000000000LL / 60;
+    Sleep_Until(next);
+  }
+  XFreeGC(dpy, gc);
+  XCloseDisplay(dpy);
+}
+
+// Pumps the shadow for `ns` the way the event loop does: poll its fd with
+// the timeout X11Shadow_Pump asks for.
+static void PumpFor(X11_SHADOW *s, long long ns) {
+  long long end = Clock_Ns() + ns;
+  for (long long now = Clock_Ns(); now < end; now = Clock_Ns()) {
+    long long due = X11Shadow_Pump(s, now);
+    long long wait = end - now;
+    if (due >= 0 && due < wait)
+      wait = due;
+    struct pollfd p = {X11Shadow_Fd(s), POLLIN, 0};
+    poll(&p, 1, (int)((wait + 999999) / 1000000));
+  }
+}
+
+// The snapshot tiles must equal what a fresh grab reads.
+static int SameAsScreen(Display *dpy, const FRAMEBUFFER *layout,
+                        const IMAGE *tiles) {
+  X11_CAPTURE c = {0};
+  int same = X11Capture_Grab(dpy, &c) && c.fb.ntiles == layout->ntiles;
+  for (int i = 0; same && i < layout->ntiles; i++)
+    same = TestX11_FirstDiffRgb(&c.fb.tiles[i].capture, 0, 0, &tiles[i]) < 0;
+  X11Capture_Release(&c);
+  return same;
+}
+
+int main(void) {
+  Display *dpy = TestX11_Open("test_shadow_x11");
+  if (!dpy)
+    return TEST_SKIP;
+  X11_SHADOW s;
+  if (!X11Shadow_Start(&s, NULL)) {
+    printf("test_shadow_x11: no XDamage (build or server), skipped\n");
+    XCloseDisplay(dpy);
+    return TEST_SKIP;
+  }
+  int scr = DefaultScreen(dpy);
+  IRECT all = {0, 0, DisplayWidth(dpy, scr), DisplayHeight(dpy, scr)};
+  size_t frameBytes = (size_t)all.right * all.bottom * 4;
+
+  // The first pump reads everything once.
+  PumpFor(&s, 100000000LL);
+  unsigned long long baseBytes = s.stats.damageBytes;
+  CHECK(baseBytes >= frameBytes);
+
+  ANIMATION anim = {all, 0, ANIM_FRAMES};
+  THREAD t;
+  long long t0 = Clock_Ns();
+  CHECK(Thread_Start(&t, Animate, &anim));
+  long long latencyMax = 0, latencySum = 0;
+  int snaps = 0;
+  while (Clock_Ns() - t0 < ANIM_FRAMES * 1000000000LL / 60 + 200000000LL) {
+    PumpFor(&s, 50000000LL);
+    // The hotkey, pressed mid-animation.
+    FRAMEBUFFER layout;
+    IMAGE tiles[FB_MAX_TILES];
+    if (X11Shadow_Snapshot(&s, &layout, tiles)) {
+      latencySum += s.stats.snapshotNs;
+      if (s.stats.snapshotNs > latencyMax)
+        latencyMax = s.stats.snapshotNs;
+      snaps++;
+      X11Shadow_Release(&s);
+    }
+  }
+  Thread_Join(t);
+  double animS = (Clock_Ns() - t0) / 1e9;
+  unsigned long long animBytes = s.stats.damageBytes - baseBytes;
+  CHECK(snaps > 0);
+  // The window appearing and going away damage the whole screen; each
+  // frame in between only a box and a strip.
+  CHECK(animBytes < frameBytes * 6);
+  printf("test_shadow_x11: %llu refreshes, %.1f MB/s damage read "
+         "(%.1f MB/s for full-frame reads at 60 fps)\n",
+         s.stats.refreshes, animBytes / animS / 1e6, frameBytes * 60 / 1e6);
+  printf("test_shadow_x11: snapshot mid-animation %.2f ms avg, %.2f ms max\n",
+         snaps ? latencySum / 1e6 / snaps : 0.0, latencyMax / 1e6);
+
+  // At rest, a snapshot is the screen.
+  FRAMEBUFFER layout;
+  IMAGE tiles[FB_MAX_TILES];
+  CHECK(X11Shadow_Snapshot(&s, &layout, tiles));
+  CHECK(SameAsScreen(dpy, &layout, tiles));
+
+  // Held while the client draws again: the lent pixels stay as they were.
+  IMAGE kept[FB_MAX_TILES];
+  for (int i = 0; i < layout.ntiles; i++)
+    CHECK(Image_Crop(&tiles[i], &(IRECT){0, 0, tiles[i].w, tiles[i].h},
+                     &kept[i]));
+  unsigned long long cow = s.stats.cowCopies;
+  anim.first = ANIM_FRAMES;
+  anim.frames = 10;
+  CHECK(Thread_Start(&t, Animate, &anim));
+  Thread_Join(t);
+  PumpFor(&s, 200000000LL);
+  CHECK(s.stats.cowCopies > cow);
+  for (int i = 0; i < layout.ntiles; i++) {
+    CHECK(Test_FirstDiffRow(&tiles[i], &kept[i]) < 0);
+    Image_Free(&kept[i]);
+  }
+  X11Shadow_Release(&s);
+  CHECK(X11Shadow_Snapshot(&s, &layout, tiles));
+  CHECK(SameAsScreen(dpy, &layout, tiles));
+  X11Shadow_Release(&s);
+
+  // Idle: nothing drawn, nothing read, and the pump asks for no wakeup.
+  PumpFor(&s, 100000000LL);
+  unsigned long long refreshes = s.stats.refreshes;
+  long long cpu0 = Cpu_ProcessNs(), idle0 = Clock_Ns();
+  PumpFor(&s, 500000000LL);
+  CHECK(s.stats.refreshes == refreshes);
+  CHECK(X11Shadow_Pump(&s, Clock_Ns()) == -1);
+  printf("test_shadow_x11: idle CPU %.2f%%\n",
+         100.0 * (Cpu_ProcessNs() - cpu0) / (double)(Clock_Ns() - idle0));
+
+  X11Shadow_Stop(&s);
+  XCloseDisplay(dpy);
+  return Test_Finish("test_shadow_x11");
+}
@@ -0,0 +1,236 @@
+// Scrolling-capture stitching on synthetic pages scrolled by known
+// offsets. A frame is a window onto the page: a sticky header, a band of
+// page rows from the scroll position, a sticky footer. The page is noise
+// with runs of blank rows, which the probe must not anchor on. Checks
+// Stitch_Offset on pairs, then whole sessions: every Stitch_Add must
+// return the scroll it was given (0 for no scroll, skipped for no
+// overlap), and the result must be header, page and last footer exactly.
+// Prints per-frame alignment time at 4K width.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "platform.h"
+#include "stitch.h"
+#include "test.h"
+
+#define HEADER 48
+#define FOOTER 32
+#define STEP 807
+
+typedef struct {
+  IMAGE page, chrome; // chrome: header rows, then footer rows
+  int band;           // page rows in a frame
+} SCROLLER;
+
+// Noise, with 40 blank rows every 200.
+static int Scroller_Init(SCROLLER *s, int w, int pageRows, int frameH,
+                         uint32_t seed) {
+  s->band = frameH - HEADER - FOOTER;
+  if (!Image_Alloc(&s->page, w, pageRows)) {
+    s->chrome.px = NULL;
+    return 0;
+  }
+  if (!Image_Alloc(&s->chrome, w, HEADER + FOOTER)) {
+    Image_Free(&s->page);
+    return 0;
+  }
+  Test_Noise(&s->page, seed);
+  Test_Noise(&s->chrome, seed + 1);
+  for (int y = 150; y < pageRows; y += 200)
+    for (int r = y; r < y + 40 && r < pageRows; r++)
+      memset(IMAGE_ROW(&s->page, r), 0xF0, (size_t)w * 4);
+  return 1;
+}
+
+static void Scroller_Free(SCROLLER *s) {
+  Image_Free(&s->page);
+  Image_Free(&s->chrome);
+}
+
+static void CopyRows(IMAGE *dst, int dy, const IMAGE *src, int sy, int n) {
+  for (int r = 0; r < n; r++)
+    memcpy(IMAGE_ROW(dst, dy + r), IMAGE_ROW(src, sy + r),
+           (size_t)src->w * 4);
+}
+
+// The window scrolled to page row pos.
+static void Scroller_Frame(const SCROLLER *s, int pos, IMAGE *frame) {
+  CopyRows(frame, 0, &s->chrome, 0, HEADER);
+  CopyRows(frame, HEADER, &s->page, pos, s->band);
+  CopyRows(frame, HEADER + s->band, &s->chrome, HEADER, FOOTER);
+}
+
+// Stitch_Offset between windows at pos and pos + d.
+static void CheckOffsets(const SCROLLER *s) {
+  IMAGE a, b;
+  int h = HEADER + s->band + FOOTER;
+  if (!Image_Alloc(&a, s->page.w, h) || !Image_Alloc(&b, s->page.w, h)) {
+    CHECK(!"out of memory");
+    Image_Free(&a);
+    return;
+  }
+  int big = s->band - 2 * STITCH_WINDOW;
+  int scrolls[] = {0, 1, 7, STITCH_WINDOW, 100, s->band / 2, big};
+  int pos = 13;
+  Scroller_Frame(s, pos, &a);
+  for (size_t i = 0; i < sizeof(scrolls) / sizeof(scrolls[0]); i++) {
+    Scroller_Frame(s, pos + scrolls[i], &b);
+    int d = Stitch_Offset(&a, &b);
+    if (d != scrolls[i])
+      fprintf(stderr, "test_stitch: width %d scroll %d found %d\n",
+              s->page.w, scrolls[i], d);
+    CHECK(d == scrolls[i]);
+  }
+  // No overlap, and one row of it: nothing to go on.
+  Scroller_Frame(s, pos + s->band, &b);
+  CHECK(Stitch_Offset(&a, &b) == STITCH_SKIPPED);
+  Scroller_Frame(s, pos + s->band - 1, &b);
+  CHECK(Stitch_Offset(&a, &b) == STITCH_SKIPPED);
+  // Scrolling back up is not a scroll down.
+  Scroller_Frame(s, pos + 100, &a);
+  Scroller_Frame(s, pos, &b);
+  CHECK(Stitch_Offset(&a, &b) == STITCH_SKIPPED);
+  IMAGE narrow = {b.px, b.w - 1, b.h, b.stride};
+  CHECK(Stitch_Offset(&a, &narrow) == STITCH_SKIPPED);
+  Image_Free(&a);
+  Image_Free(&b);
+}
+
+// A session over the given scroll steps; a step of -1 is a frame from
+// far down the page, which must be skipped without moving the position.
+static void CheckSession(const SCROLLER *s, const int *steps, int n,
+                         const char *what) {
+  IMAGE frame;
+  int h = HEADER + s->band + FOOTER;
+  if (!Image_Alloc(&frame, s->page.w, h)) {
+    CHECK(!"out of memory");
+    return;
+  }
+  STITCH st;
+  Scroller_Frame(s, 0, &frame);
+  CHECK(Stitch_Begin(&st, &frame));
+  int pos = 0, wrong = 0;
+  unsigned long long unchanged = 0, skipped = 0;
+  for (int i = 0; i < n; i++) {
+    int want = steps[i];
+    if (want < 0) {
+      Scroller_Frame(s, pos + 2 * s->band, &frame);
+      want = STITCH_SKIPPED;
+      skipped++;
+    } else {
+      Scroller_Frame(s, pos + want, &frame);
+      pos += want;
+      unchanged += !want;
+    }
+    int d = Stitch_Add(&st, &frame);
+    if (d != want && !wrong++)
+      fprintf(stderr, "test_stitch: %s step %d: want %d, got %d\n", what, i,
+              want, d);
+  }
+  CHECK(!wrong);
+  IMAGE other;
+  if (Image_Alloc(&other, s->page.w, h - 1)) {
+    // wrong size: refused before it counts as a frame
+    CHECK(Stitch_Add(&st, &other) == STITCH_SKIPPED);
+    Image_Free(&other);
+  }
+  STITCH_STATS stats = st.st;
+  CHECK(stats.appended == (unsigned long long)pos);
+  CHECK(stats.unchanged == unchanged && stats.skipped == skipped);
+
+  IMAGE out = {0};
+  CHECK(Stitch_Finish(&st, &out));
+  CHECK(out.w == s->page.w && out.h == HEADER + pos + s->band + FOOTER);
+  if (out.px && out.h == HEADER + pos + s->band + FOOTER) {
+    IMAGE want;
+    if (Image_Alloc(&want, out.w, out.h)) {
+      CopyRows(&want, 0, &s->chrome, 0, HEADER);
+      CopyRows(&want, HEADER, &s->page, 0, pos + s->band);
+      CopyRows(&want, out.h - FOOTER, &s->chrome, HEADER, FOOTER);
+      CHECK(Test_FirstDiffRow(&out, &want) < 0);
+      Image_Free(&want);
+    }
+  }
+  double frames = stats.frames > 1 ? (double)(stats.frames - 1) : 1;
+  printf("test_stitch: %-8s %4dx%-4d %3llu frames, %5d rows: hash %.2f, "
+         "align %.2f, verify %.2f ms per frame, worst %.2f ms\n",
+         what, s->page.w, h, stats.frames, out.h, stats.hashNs / 1e6 / frames,
+         stats.alignNs / 1e6 / frames, stats.verifyNs / 1e6 / frames,
+         stats.alignMaxNs / 1e6);
+  Image_Free(&out);
+  Image_Free(&frame);
+}
+
+// Scrolls a narrow page until the stitched image is full: what was
+// stitched, and the footer, must still come out. Steps of STEP rows stop
+// within a footer of STITCH_MAX_ROWS.
+static void CheckFull(void) {
+  SCROLLER s;
+  if (!Scroller_Init(&s, 16, STITCH_MAX_ROWS + 2000, 1000, 9)) {
+    CHECK(!"out of memory");
+    return;
+  }
+  IMAGE frame;
+  if (!Image_Alloc(&frame, 16, 1000)) {
+    CHECK(!"out of memory");
+    Scroller_Free(&s);
+    return;
+  }
+  STITCH st;
+  Scroller_Frame(&s, 0, &frame);
+  CHECK(Stitch_Begin(&st, &frame));
+  int pos = 0, d = 0;
+  while (pos + STEP + s.band <= s.page.h) {
+    Scroller_Frame(&s, pos + STEP, &frame);
+    if ((d = Stitch_Add(&st, &frame)) != STEP)
+      break;
+    pos += STEP;
+  }
+  CHECK(d == STITCH_FULL);
+  IMAGE out = {0};
+  CHECK(Stitch_Finish(&st, &out));
+  CHECK(out.h == HEADER + pos + s.band + FOOTER && out.h <= STITCH_MAX_ROWS);
+  if (out.px && out.h > FOOTER) {
+    IMAGE foot = {IMAGE_ROW(&s.chrome, HEADER), 16, FOOTER, s.chrome.stride};
+    IMAGE got = {IMAGE_ROW(&out, out.h - FOOTER), 16, FOOTER, out.stride};
+    CHECK(Test_FirstDiffRow(&got, &foot) < 0);
+  }
+  Image_Free(&out);
+  Image_Free(&frame);
+  Scroller_Free(&s);
+}
+
+int main(void) {
+  static const int kWidths[] = {3840, 333, 7};
+  // A wheel at a time, a page at a time, pauses, a stray frame, and the
+  // largest scroll that still leaves two probe windows of overlap.
+  int steps[] = {3, 3, 0, 60, 0, 120, 120, -1, 500, 17, 1, 0, 0, 250, 872,
+                 -1, -1, 200, 64, 300, 5, 800, 48};
+  int n = (int)(sizeof(steps) / sizeof(steps[0]));
+  for (size_t i = 0; i < sizeof(kWidths) / sizeof(kWidths[0]); i++) {
+    SCROLLER s;
+    if (!Scroller_Init(&s, kWidths[i], 8000, 1000, (uint32_t)i + 1)) {
+      CHECK(!"out of memory");
+      continue;
+    }
+    CheckOffsets(&s);
+    CheckSession(&s, steps, n, "steps");
+    Scroller_Free(&s);
+  }
+
+  // 4K wide, 2160 tall: the alignment budget is a few ms a frame.
+  SCROLLER s;
+  if (Scroller_Init(&s, 3840, 20000, 2160, 7)) {
+    int wheel[60];
+    for (int i = 0; i < 60; i++)
+      wheel[i] = i % 6 ? 120 : 0;
+    CheckSession(&s, wheel, 60, "4k wheel");
+    Scroller_Free(&s);
+  } else {
+    CHECK(!"out of memory");
+  }
+
+  CheckFull();
+  return Test_Finish("test_stitch");
+}
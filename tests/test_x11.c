@@ -0,0 +1,97 @@
+#include "test_x11.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <X11/Xutil.h>
+
+#include "capture_x11.h"
+
+Display *TestX11_Open(const char *name) {
+  Display *dpy = XOpenDisplay(NULL);
+  if (!dpy)
+    printf("%s: no X display, skipped (ctest runs it under Xvfb)\n", name);
+  return dpy;
+}
+
+Window TestX11_Cover(Display *dpy, const IRECT *r) {
+  XSetWindowAttributes wa = {0};
+  wa.override_redirect = True;
+  wa.background_pixel = BlackPixel(dpy, DefaultScreen(dpy));
+  wa.event_mask = StructureNotifyMask;
+  Window win = XCreateWindow(
+      dpy, DefaultRootWindow(dpy), r->left, r->top,
+      (unsigned)(r->right - r->left), (unsigned)(r->bottom - r->top), 0,
+      CopyFromParent, InputOutput, CopyFromParent,
+      CWOverrideRedirect | CWBackPixel | CWEventMask, &wa);
+  XMapRaised(dpy, win);
+  XEvent ev;
+  do
+    XWindowEvent(dpy, win, StructureNotifyMask, &ev);
+  while (ev.type != MapNotify);
+  XSync(dpy, False);
+  return win;
+}
+
+void TestX11_Paint(Display *dpy, Window win, const IMAGE *img, int x, int y) {
+  int scr = DefaultScreen(dpy);
+  XImage *xi = XCreateImage(dpy, DefaultVisual(dpy, scr),
+                            (unsigned)DefaultDepth(dpy, scr), ZPixmap, 0,
+                            (char *)img->px, (unsigned)img->w,
+                            (unsigned)img->h, 32, img->stride);
+  if (!xi)
+    return;
+  xi->byte_order = LSBFirst;
+  GC gc = XCreateGC(dpy, win, 0, NULL);
+  XPutImage(dpy, win, gc, xi, 0, 0, x, y, (unsigned)img->w,
+            (unsigned)img->h);
+  XFreeGC(dpy, gc);
+  XSync(dpy, False);
+  xi->data = NULL; // the caller's pixels
+  XDestroyImage(xi);
+}
+
+int TestX11_FirstDiffRgb(const IMAGE *got, int ox, int oy,
+                         const IMAGE *want) {
+  for (int y = 0; y < want->h; y++) {
+    const unsigned *g = (const unsigned *)IMAGE_ROW(got, oy + y) + ox;
+    const unsigned *w = (const unsigned *)IMAGE_ROW(want, y);
+    for (int x = 0; x < want->w; x++)
+      if ((g[x] ^ w[x]) & 0x00FFFFFFu)
+        return y;
+  }
+  return -1;
+}
+
+#ifdef HAVE_MONITORS
+
+int TestX11_HasMonitors(Display *dpy) {
+  int major = 0, minor = 0, evBase, errBase;
+  return XRRQueryExtension(dpy, &evBase, &errBase) &&
+         XRRQueryVersion(dpy, &major, &minor) &&
+         (major > 1 || minor >= 5);
+}
+
+int TestX11_SetMonitor(Display *dpy, const char *name, const IRECT *r,
+                       RROutput out) {
+  XRRMonitorInfo *m = XRRAllocateMonitor(dpy, out != None);
+  if (!m)
+    return 0;
+  m->name = XInternAtom(dpy, name, False);
+  m->x = r->left;
+  m->y = r->top;
+  m->width = r->right - r->left;
+  m->height = r->bottom - r->top;
+  m->mwidth = m->width / 4;
+  m->mheight = m->height / 4;
+  if (out != None)
+    m->outputs[0] = out;
+  XSync(dpy, False);
+  X11Error_Trap(dpy);
+  XRRSetMonitor(dpy, DefaultRootWindow(dpy), m);
+  int err = X11Error_Untrap(dpy);
+  XRRFreeMonitors(m);
+  return !err;
+}
+
+#endif
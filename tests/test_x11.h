@@ -0,0 +1,43 @@
+#ifndef SCREENSHOT_TEST_X11_H
+#define SCREENSHOT_TEST_X11_H
+
+// Helpers for the tests that need an X server. ctest runs them through
+// xvfb_run.sh on a private Xvfb; run by hand without $DISPLAY they report
+// themselves skipped.
+
+#include <X11/Xlib.h>
+
+#include "image.h"
+
+// The display, or NULL after printing why the test is skipped.
+Display *TestX11_Open(const char *name);
+
+// Maps a borderless override-redirect window over r (root coordinates) and
+// waits until it is on screen.
+Window TestX11_Cover(Display *dpy, const IRECT *r);
+
+// Draws img with its top-left corner at (x, y) of win and waits until the
+// server has done it.
+void TestX11_Paint(Display *dpy, Window win, const IMAGE *img, int x, int y);
+
+// First row of want that differs from got at (ox, oy), or -1. Only the
+// color channels count: depth-24 visuals leave the alpha byte undefined.
+int TestX11_FirstDiffRgb(const IMAGE *got, int ox, int oy,
+                         const IMAGE *want);
+
+#ifdef HAVE_XRANDR
+#include <X11/extensions/Xrandr.h>
+#if RANDR_MAJOR > 1 || RANDR_MINOR >= 5
+#define HAVE_MONITORS
+
+// 1 if the server speaks RandR 1.5 (monitors).
+int TestX11_HasMonitors(Display *dpy);
+
+// Defines monitor `name` at r (root coordinates), on output `out` unless it
+// is None. Returns 0 if the server refused it.
+int TestX11_SetMonitor(Display *dpy, const char *name, const IRECT *r,
+                       RROutput out);
+#endif
+#endif
+
+#endif
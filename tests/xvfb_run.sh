@@ -0,0 +1,41 @@
+#!/bin/sh
+# Runs a test against a private Xvfb server:
+#   xvfb_run.sh WxHxD test [args...]
+# Exits 77 (ctest: skipped) when Xvfb is not installed or will not start,
+# otherwise with the test's status.
+
+screen=$1
+shift
+if ! command -v Xvfb >/dev/null 2>&1; then
+  echo "Xvfb not found, skipped"
+  exit 77
+fi
+
+dir=$(mktemp -d) || exit 1
+# Xvfb picks a free display and writes its number to fd 3 once it accepts
+# connections.
+Xvfb -displayfd 3 -screen 0 "$screen" -nolisten tcp +extension RANDR \
+  3>"$dir/display" 2>"$dir/log" &
+pid=$!
+tries=0
+while [ ! -s "$dir/display" ] && kill -0 "$pid" 2>/dev/null &&
+  [ "$tries" -lt 100 ]; do
+  sleep 0.1
+  tries=$((tries + 1))
+done
+if [ ! -s "$dir/display" ]; then
+  echo "Xvfb did not start, skipped"
+  cat "$dir/log"
+  kill "$pid" 2>/dev/null
+  rm -rf "$dir"
+  exit 77
+fi
+
+DISPLAY=:$(cat "$dir/display")
+export DISPLAY
+"$@"
+status=$?
+kill "$pid" 2>/dev/null
+wait "$pid" 2>/dev/null
+rm -rf "$dir"
+exit "$status"
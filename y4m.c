@@ -0,0 +1,161 @@
+#include "y4m.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "platform.h"
+
+#ifdef PLATFORM_X86
+#include <emmintrin.h>
+#endif
+
+#define Y4M_GRAIN 16 // row pairs per Par_For chunk
+
+int Y4m_Begin(Y4M *y, FILE *f, int w, int h, int fps) {
+  memset(y, 0, sizeof(*y));
+  y->f = f;
+  y->w = w & ~1;
+  y->h = h & ~1;
+  if (y->w <= 0 || y->h <= 0 || fps <= 0)
+    return 0;
+  y->size = (size_t)y->w * y->h * 3 / 2;
+  y->yuv = (unsigned char *)malloc(y->size);
+  return y->yuv && fprintf(f, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n",
+                           y->w, y->h, fps) > 0;
+}
+
+typedef struct {
+  const Y4M *y;
+  const IMAGE *img;
+} Y4M_JOB;
+
+// BT.601 limited range in 8.8 fixed point; chroma from the 2x2 average
+// (the sum of the four, with two more bits of shift).
+static void Y4m_Pairs(const unsigned char *s0, const unsigned char *s1,
+                      unsigned char *d0, unsigned char *d1, unsigned char *u,
+                      unsigned char *v, int x, int w) {
+  const unsigned char *s[2] = {s0, s1};
+  unsigned char *d[2] = {d0, d1};
+  for (; x < w; x += 2) {
+    int rs = 0, gs = 0, bs = 0;
+    for (int r = 0; r < 2; r++) {
+      for (int c = 0; c < 2; c++) {
+        const unsigned char *p = s[r] + (size_t)(x + c) * 4;
+        int b = p[0], g = p[1], rr = p[2];
+        d[r][x + c] =
+            (unsigned char)(((66 * rr + 129 * g + 25 * b + 128) >> 8) + 16);
+        rs += rr;
+        gs += g;
+        bs += b;
+      }
+    }
+    u[x / 2] =
+        (unsigned char)(((-38 * rs - 74 * gs + 112 * bs + 512) >> 10) + 128);
+    v[x / 2] =
+        (unsigned char)(((112 * rs - 94 * gs - 18 * bs + 512) >> 10) + 128);
+  }
+}
+
+#ifdef PLATFORM_X86
+// Per-pixel (or per-sample) dot products: madd leaves two partial sums per
+// pixel; adding the even and odd lanes of two registers finishes four.
+static __m128i Dot4(__m128i lo, __m128i hi, __m128i k) {
+  __m128 a = _mm_castsi128_ps(_mm_madd_epi16(lo, k));
+  __m128 b = _mm_castsi128_ps(_mm_madd_epi16(hi, k));
+  return _mm_add_epi32(
+      _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0))),
+      _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1))));
+}
+
+// Luma of 8 pixels.
+static __m128i Luma8(__m128i p0, __m128i p1, __m128i k) {
+  const __m128i z = _mm_setzero_si128();
+  __m128i y0 = Dot4(_mm_unpacklo_epi8(p0, z), _mm_unpackhi_epi8(p0, z), k);
+  __m128i y1 = Dot4(_mm_unpacklo_epi8(p1, z), _mm_unpackhi_epi8(p1, z), k);
+  const __m128i round = _mm_set1_epi32(128), off = _mm_set1_epi16(16);
+  y0 = _mm_srai_epi32(_mm_add_epi32(y0, round), 8);
+  y1 = _mm_srai_epi32(_mm_add_epi32(y1, round), 8);
+  __m128i y = _mm_add_epi16(_mm_packs_epi32(y0, y1), off);
+  return _mm_packus_epi16(y, y);
+}
+
+// 2x2 channel sums of 4 pixels from each row: two samples, 16-bit BGRA.
+static __m128i Sum2x2(__m128i a, __m128i b) {
+  const __m128i z = _mm_setzero_si128();
+  __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, z), _mm_unpacklo_epi8(b, z));
+  __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, z), _mm_unpackhi_epi8(b, z));
+  lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+  hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+  return _mm_unpacklo_epi64(lo, hi);
+}
+
+static int Chroma4(__m128i s0, __m128i s1, __m128i k) {
+  __m128i c = _mm_srai_epi32(_mm_add_epi32(Dot4(s0, s1, k),
+                                           _mm_set1_epi32(512)), 10);
+  c = _mm_add_epi16(_mm_packs_epi32(c, c), _mm_set1_epi16(128));
+  return _mm_cvtsi128_si32(_mm_packus_epi16(c, c));
+}
+
+// 8 pixels of a row pair per step; returns where the scalar tail starts.
+static int Y4m_PairsSSE2(const unsigned char *s0, const unsigned char *s1,
+                         unsigned char *d0, unsigned char *d1, unsigned char *u,
+                         unsigned char *v, int w) {
+  const __m128i ky = _mm_setr_epi16(25, 129, 66, 0, 25, 129, 66, 0);
+  const __m128i ku = _mm_setr_epi16(112, -74, -38, 0, 112, -74, -38, 0);
+  const __m128i kv = _mm_setr_epi16(-18, -94, 112, 0, -18, -94, 112, 0);
+  int x = 0;
+  for (; x + 8 <= w; x += 8) {
+    __m128i a0 = _mm_loadu_si128((const __m128i *)(s0 + (size_t)x * 4));
+    __m128i a1 = _mm_loadu_si128((const __m128i *)(s0 + (size_t)x * 4 + 16));
+    __m128i b0 = _mm_loadu_si128((const __m128i *)(s1 + (size_t)x * 4));
+    __m128i b1 = _mm_loadu_si128((const __m128i *)(s1 + (size_t)x * 4 + 16));
+    _mm_storel_epi64((__m128i *)(d0 + x), Luma8(a0, a1, ky));
+    _mm_storel_epi64((__m128i *)(d1 + x), Luma8(b0, b1, ky));
+    __m128i c0 = Sum2x2(a0, b0), c1 = Sum2x2(a1, b1);
+    int cu = Chroma4(c0, c1, ku), cv = Chroma4(c0, c1, kv);
+    memcpy(u + x / 2, &cu, 4);
+    memcpy(v + x / 2, &cv, 4);
+  }
+  return x;
+}
+#endif
+
+static void Y4m_Rows(void *ctx, int begin, int end) {
+  const Y4M_JOB *j = (const Y4M_JOB *)ctx;
+  int w = j->y->w, cw = w / 2;
+  unsigned char *py = j->y->yuv;
+  unsigned char *pu = py + (size_t)w * j->y->h;
+  unsigned char *pv = pu + (size_t)cw * (j->y->h / 2);
+  for (int k = begin; k < end; k++) {
+    const unsigned char *s0 = IMAGE_ROW(j->img, 2 * k);
+    const unsigned char *s1 = IMAGE_ROW(j->img, 2 * k + 1);
+    unsigned char *d0 = py + (size_t)2 * k * w, *d1 = d0 + w;
+    unsigned char *u = pu + (size_t)k * cw, *v = pv + (size_t)k * cw;
+    int x = 0;
+#ifdef PLATFORM_X86
+    x = Y4m_PairsSSE2(s0, s1, d0, d1, u, v, w);
+#endif
+    Y4m_Pairs(s0, s1, d0, d1, u, v, x, w);
+  }
+}
+
+int Y4m_Frame(Y4M *y, const IMAGE *img, int repeat) {
+  if (img && (img->w < y->w || img->h < y->h))
+    return 0;
+  if (img) {
+    Y4M_JOB job = {y, img};
+    Par_For(y->h / 2, Y4M_GRAIN, Y4m_Rows, &job);
+  }
+  for (int i = 0; i < repeat; i++)
+    if (fwrite("FRAME\n", 1, 6, y->f) != 6 ||
+        fwrite(y->yuv, 1, y->size, y->f) != y->size)
+      return 0;
+  return 1;
+}
+
+int Y4m_End(Y4M *y) {
+  int ok = fflush(y->f) == 0;
+  free(y->yuv);
+  y->yuv = NULL;
+  return ok;
+}
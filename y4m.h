@@ -0,0 +1,29 @@
+#ifndef SCREENSHOT_Y4M_H
+#define SCREENSHOT_Y4M_H
+
+#include <stdio.h>
+
+#include "image.h"
+
+// YUV4MPEG2 stream writer for recordings meant for another encoder (e.g.
+// `ffmpeg -i rec.y4m`): 8-bit 4:2:0, BT.601 limited range, constant frame
+// rate. Frames are uncompressed, so a stream can be piped as it is written.
+
+typedef struct {
+  FILE *f;
+  int w, h;             // even
+  unsigned char *yuv;   // converted frame: Y, then U, then V
+  size_t size;
+} Y4M;
+
+// Writes the stream header. w and h are rounded down to even sizes; frames
+// are cropped to match.
+int Y4m_Begin(Y4M *y, FILE *f, int w, int h, int fps);
+// Converts img and writes it `repeat` times (frames the capture missed are
+// filled with the one before, to keep the frame rate). A NULL img repeats
+// the last frame again.
+int Y4m_Frame(Y4M *y, const IMAGE *img, int repeat);
+// Flushes the stream and frees the conversion buffer. Returns 1 on success.
+int Y4m_End(Y4M *y);
+
+#endif